@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgexporter */
+#include <pgexporter.h>
+#include <catalog.h>
+#include <configuration.h>
+#include <internal.h>
+#include <pg_query_alts.h>
+#include <shmem.h>
+#include <yaml_configuration.h>
+
+/* system */
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * pgexporter-gencatalog parses and validates INTERNAL_YAML when building,
+ * and writes the internal metrics as the C tables of the catalog
+ */
+int
+main(int argc, char** argv)
+{
+   int ret;
+   int exit_code = 1;
+   int number_of_metrics = 0;
+   size_t size = sizeof(struct configuration);
+   struct configuration* config = NULL;
+   FILE* internal_yaml = NULL;
+   FILE* file = NULL;
+
+   if (argc != 2)
+   {
+      warnx("Usage: pgexporter-gencatalog <file>");
+      goto done;
+   }
+
+   if (pgexporter_create_shared_memory(size, HUGEPAGE_OFF, &shmem))
+   {
+      warnx("pgexporter-gencatalog: Error creating shared memory");
+      goto done;
+   }
+   pgexporter_init_configuration(shmem);
+
+   config = (struct configuration*)shmem;
+
+   internal_yaml = fmemopen(INTERNAL_YAML, strlen(INTERNAL_YAML), "r");
+   if (internal_yaml == NULL)
+   {
+      warnx("pgexporter-gencatalog: Error opening INTERNAL_YAML");
+      goto done;
+   }
+
+   if (pgexporter_read_yaml_from_file_pointer(config, 0, &number_of_metrics, internal_yaml))
+   {
+      warnx("pgexporter-gencatalog: Invalid INTERNAL_YAML");
+      goto done;
+   }
+   config->number_of_metrics = number_of_metrics;
+
+   file = fopen(argv[1], "w");
+   if (file == NULL)
+   {
+      warnx("pgexporter-gencatalog: Error creating %s", argv[1]);
+      goto done;
+   }
+
+   ret = pgexporter_catalog_write(config, file);
+   if (fclose(file))
+   {
+      ret = 1;
+   }
+   file = NULL;
+
+   if (ret)
+   {
+      warnx("pgexporter-gencatalog: Error writing %s", argv[1]);
+
+      /* No partial catalog, so the next build generates it again */
+      remove(argv[1]);
+      goto done;
+   }
+
+   exit_code = 0;
+
+done:
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+
+   if (internal_yaml != NULL)
+   {
+      fclose(internal_yaml);
+   }
+
+   if (shmem != NULL)
+   {
+      pgexporter_free_pg_query_alts(config);
+      pgexporter_destroy_shared_memory(shmem, size);
+   }
+
+   return exit_code;
+}
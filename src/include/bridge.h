@@ -77,6 +77,17 @@ extern "C" {
 void
 pgexporter_bridge(int fd);
 
+/**
+ * Serve the requests of a bridge connection without taking
+ * the process down afterwards. The caller owns the connection
+ * and closes it
+ * @param fd The client descriptor
+ * @param requests The number of requests served
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_bridge_serve(int fd, int* requests);
+
 /**
  * Allocates, for the first time, the bridge cache.
  *
@@ -108,6 +119,17 @@ pgexporter_bridge_init_cache(size_t* p_size, void** p_shmem);
 void
 pgexporter_bridge_json(int fd);
 
+/**
+ * Serve the requests of a JSON bridge connection without taking
+ * the process down afterwards. The caller owns the connection
+ * and closes it
+ * @param fd The client descriptor
+ * @param requests The number of requests served
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_bridge_json_serve(int fd, int* requests);
+
 /**
  * Allocates, for the first time, the bridge JSON cache.
  *
@@ -36,10 +36,13 @@ extern "C" {
 #include <pgexporter.h>
 
 #include <stdlib.h>
+#include <time.h>
 
 /**
  * Initialize a prometheus cache in shared memory.
- * @param cache_size The size of the cache data payload
+ * Two buffers of cache_size bytes are allocated, so a new payload
+ * can be built while the previous one is served.
+ * @param cache_size The size of each cache data payload
  * @param p_size Pointer to store the total allocated size
  * @param p_shmem Pointer to store the shared memory pointer
  * @return 0 on success, otherwise 1
@@ -57,10 +60,47 @@ pgexporter_cache_init(size_t cache_size, size_t* p_size, void** p_shmem);
 bool
 pgexporter_cache_is_valid(struct prometheus_cache* cache);
 
+/**
+ * Check if an expired cache may still be served while
+ * another process builds a new payload.
+ * @param cache The cache
+ * @param max_stale How long after its expiry the payload may be served
+ * @return true if the payload is expired, but within max_stale
+ */
+bool
+pgexporter_cache_is_stale(struct prometheus_cache* cache, pgexporter_time_t max_stale);
+
+/**
+ * Copy the published payload.
+ * The lock is not taken, and a copy that raced with a writer is retried,
+ * so the copy is always a complete payload.
+ * @param cache The cache
+ * @param data [out] The copy of the payload, NULL if there is none
+ * @param length [out] The length of the payload
+ * @param created [out] When the payload was published
+ * @param valid_until [out] When the payload will become not valid
+ * @return 0 if a payload was copied, otherwise 1
+ */
+int
+pgexporter_cache_get(struct prometheus_cache* cache, char** data, size_t* length, time_t* created, time_t* valid_until);
+
+/**
+ * Copy a compressed copy of the published payload.
+ * @param cache The cache
+ * @param encoding The content encoding of the copy
+ * @param data [out] The copy, NULL if there is none
+ * @param length [out] The length of the copy
+ * @param created [out] When the payload was published
+ * @param valid_until [out] When the payload will become not valid
+ * @return 0 if a copy was found, otherwise 1
+ */
+int
+pgexporter_cache_get_encoded(struct prometheus_cache* cache, int encoding, char** data, size_t* length, time_t* created, time_t* valid_until);
+
 /**
  * Invalidate the cache.
- * The payload is zero-filled and the valid_until field
- * is set to zero.
+ * The published payload is withdrawn, and the payload
+ * being built starts over.
  * Requires the caller to hold the lock on the cache.
  * @param cache The cache
  */
@@ -68,7 +108,8 @@ void
 pgexporter_cache_invalidate(struct prometheus_cache* cache);
 
 /**
- * Append data to the cache.
+ * Append data to the payload being built.
+ * The published payload is not affected until the cache is finalized.
  * If the cache would overflow, it is invalidated instead.
  * Requires the caller to hold the lock on the cache.
  * @param cache The cache
@@ -79,7 +120,23 @@ bool
 pgexporter_cache_append(struct prometheus_cache* cache, char* data);
 
 /**
- * Finalize the cache by setting its expiry time.
+ * Attach a compressed copy of the payload being built.
+ * The copies must be attached once the payload is complete, in the
+ * order of their encoding. A copy that does not fit is dropped,
+ * and readers asking for that encoding are served the plain payload.
+ * Requires the caller to hold the lock on the cache.
+ * @param cache The cache
+ * @param encoding The content encoding of the copy
+ * @param data The compressed data
+ * @param length The length of the compressed data
+ * @return true if the copy was attached, otherwise false
+ */
+bool
+pgexporter_cache_append_encoded(struct prometheus_cache* cache, int encoding, void* data, size_t length);
+
+/**
+ * Finalize the cache by publishing the payload being built
+ * with its creation and expiry time.
  * Requires the caller to hold the lock on the cache.
  * @param cache The cache
  * @param max_age The maximum age of the cache
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGEXPORTER_CATALOG_H
+#define PGEXPORTER_CATALOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgexporter.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/**
+ * The catalog holds the internal metrics as static tables. It is generated
+ * from INTERNAL_YAML by pgexporter-gencatalog when building, so the internal
+ * metrics are neither parsed nor validated when starting or reloading.
+ */
+
+/** @struct catalog_column
+ * A column of a catalog query
+ */
+struct catalog_column
+{
+   int type;                /**< Metrics type 0--label 1--counter 2--gauge 3--histogram */
+   const char* name;        /**< Column name */
+   const char* description; /**< Description of column */
+};
+
+/** @struct catalog_query
+ * A query alternative of a catalog metric
+ */
+struct catalog_query
+{
+   int pg_version;                       /**< Minimum required postgres version to run query */
+   bool is_histogram;                    /**< Is the query for a histogram metric */
+   const char* query;                    /**< Query String */
+   int n_columns;                        /**< No. of columns */
+   const struct catalog_column* columns; /**< Columns of query */
+};
+
+/** @struct catalog_metric
+ * A metric of the catalog
+ */
+struct catalog_metric
+{
+   const char* tag;                     /**< The metric name */
+   const char* collector;               /**< Collector Tag for query */
+   int sort_type;                       /**< Sorting type of multi queries 0--SORT_NAME 1--SORT_DATA0 */
+   int server_query_type;               /**< Query type 0--SERVER_QUERY_BOTH 1--SERVER_QUERY_PRIMARY 2--SERVER_QUERY_REPLICA */
+   bool exec_on_all_dbs;                /**< Execute on all databases */
+   bool optional;                       /**< If true, suppress warning on query failure */
+   int64_t interval;                    /**< Refresh interval in milliseconds */
+   int n_queries;                       /**< No. of query alternatives */
+   const struct catalog_query* queries; /**< Query alternatives, by increasing version */
+};
+
+/**
+ * Load the catalog into the metrics of a configuration
+ * @param config The configuration
+ * @param prometheus_idx The index of the first metric
+ * @param number_of_metrics The number of metrics loaded
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_catalog_load(struct configuration* config, int prometheus_idx, int* number_of_metrics);
+
+/**
+ * Write the metrics of a configuration as the C tables of a catalog
+ * @param config The configuration
+ * @param file The file
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_catalog_write(struct configuration* config, FILE* file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGEXPORTER_COLUMN_STORE_H
+#define PGEXPORTER_COLUMN_STORE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgexporter.h>
+#include <art.h>
+#include <queries.h>
+
+#include <stdbool.h>
+
+/** @struct column_node
+ * One of the nodes of a linked list of a column entry.
+ *
+ * Since columns are the fundamental unit in a metric and since
+ * due to different versions of servers, each query might have
+ * a variable structure, dividing each query into its constituent
+ * columns is needed.
+ *
+ * Then each received tuple can have their individual column values
+ * appended to the suitable linked list of column nodes.
+ */
+struct column_node
+{
+   char* data;                /**< The value */
+   struct tuple* tuple;       /**< The tuple of the value, or NULL */
+   struct column_node* next;  /**< The next node */
+};
+
+/** @struct column_store
+ * The metadata of a column node linked list.
+ * Meant to be used as part of an array
+ */
+struct column_store
+{
+   struct column_node* columns;       /**< The first node */
+   struct column_node* last_column;   /**< The last node */
+   char tag[PROMETHEUS_LENGTH];       /**< The tag */
+   int type;                          /**< The type */
+   char name[PROMETHEUS_LENGTH];      /**< The column name */
+   int sort_type;                     /**< The sort type */
+   struct art* groups;                /**< SORT_DATA0: first column value -> node before its group */
+   struct column_node* null_last;     /**< SORT_DATA0: node before the group of NULL values */
+   bool has_nulls;                    /**< SORT_DATA0: is there a group of NULL values */
+};
+
+/**
+ * Link a node into a column store.
+ *
+ * With SORT_DATA0 the nodes are grouped by the first column of their
+ * tuple. The groups keep the order in which they first appear, with
+ * the NULL group last, and each group grows at its front. Otherwise
+ * the node is appended
+ * @param store The column store
+ * @param node The node
+ * @param sort_type The sort type
+ */
+void
+pgexporter_column_store_add(struct column_store* store, struct column_node* node, int sort_type);
+
+/**
+ * Find the column store of a column
+ * @param index The index of the column stores
+ * @param tag The tag
+ * @param name The column name
+ * @param type The type
+ * @param sort_type The sort type
+ * @return The slot of the column store, or -1 if not found
+ */
+int
+pgexporter_column_store_find(struct art* index, char* tag, char* name, int type, int sort_type);
+
+/**
+ * Index the column store of a column
+ * @param index The index of the column stores
+ * @param tag The tag
+ * @param name The column name
+ * @param type The type
+ * @param sort_type The sort type
+ * @param slot The slot of the column store
+ */
+void
+pgexporter_column_store_index(struct art* index, char* tag, char* name, int type, int sort_type, int slot);
+
+/**
+ * Destroy the groups of the column stores. The nodes are owned by the caller
+ * @param store The column stores
+ * @param n The number of column stores
+ */
+void
+pgexporter_column_store_destroy(struct column_store* store, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -43,8 +43,10 @@ extern "C" {
 #define CONFIGURATION_ARGUMENT_UNIX_SOCKET_DIR            "unix_socket_dir"
 #define CONFIGURATION_ARGUMENT_METRICS                    "metrics"
 #define CONFIGURATION_ARGUMENT_METRICS_PATH               "metrics_path"
+#define CONFIGURATION_ARGUMENT_METRICS_YAML_CACHE         "metrics_yaml_cache"
 #define CONFIGURATION_ARGUMENT_METRICS_CACHE_MAX_AGE      "metrics_cache_max_age"
 #define CONFIGURATION_ARGUMENT_METRICS_CACHE_MAX_SIZE     "metrics_cache_max_size"
+#define CONFIGURATION_ARGUMENT_METRICS_CACHE_MAX_STALE    "metrics_cache_max_stale"
 #define CONFIGURATION_ARGUMENT_BRIDGE                     "bridge"
 #define CONFIGURATION_ARGUMENT_BRIDGE_ENDPOINTS           "bridge_endpoints"
 #define CONFIGURATION_ARGUMENT_BRIDGE_CACHE_MAX_AGE       "bridge_cache_max_age"
@@ -62,6 +64,10 @@ extern "C" {
 #define CONFIGURATION_ARGUMENT_LOG_LINE_PREFIX            "log_line_prefix"
 #define CONFIGURATION_ARGUMENT_LOG_MODE                   "log_mode"
 #define CONFIGURATION_ARGUMENT_BLOCKING_TIMEOUT           "blocking_timeout"
+#define CONFIGURATION_ARGUMENT_HTTP_KEEP_ALIVE_TIMEOUT    "http_keep_alive_timeout"
+#define CONFIGURATION_ARGUMENT_HTTP_KEEP_ALIVE_MAX_REQS   "http_keep_alive_max_requests"
+#define CONFIGURATION_ARGUMENT_HTTP_WORKERS               "http_workers"
+#define CONFIGURATION_ARGUMENT_HTTP_WORKER_MAX_REQUESTS   "http_worker_max_requests"
 #define CONFIGURATION_ARGUMENT_TLS                        "tls"
 #define CONFIGURATION_ARGUMENT_TLS_CERT_FILE              "tls_cert_file"
 #define CONFIGURATION_ARGUMENT_TLS_KEY_FILE               "tls_key_file"
@@ -70,6 +76,11 @@ extern "C" {
 #define CONFIGURATION_ARGUMENT_METRICS_KEY_FILE           "metrics_key_file"
 #define CONFIGURATION_ARGUMENT_METRICS_CA_FILE            "metrics_ca_file"
 #define CONFIGURATION_ARGUMENT_METRICS_QUERY_TIMEOUT      "metrics_query_timeout"
+#define CONFIGURATION_ARGUMENT_METRICS_QUERY_WORKERS      "metrics_query_workers"
+#define CONFIGURATION_ARGUMENT_METRICS_QUERY_ASYNC        "metrics_query_async"
+#define CONFIGURATION_ARGUMENT_METRICS_SCRAPE_TIMEOUT     "metrics_scrape_timeout"
+#define CONFIGURATION_ARGUMENT_METRICS_COLLECTOR_INTERVAL "metrics_collector_interval"
+#define CONFIGURATION_ARGUMENT_METRICS_POOL_IDLE_TIMEOUT  "metrics_pool_idle_timeout"
 #define CONFIGURATION_ARGUMENT_LIBEV                      "libev"
 #define CONFIGURATION_ARGUMENT_KEEP_ALIVE                 "keep_alive"
 #define CONFIGURATION_ARGUMENT_NODELAY                    "nodelay"
@@ -175,6 +186,15 @@ pgexporter_validate_admins_configuration(void* shmem);
 int
 pgexporter_reload_configuration(bool* reload);
 
+/**
+ * Parse a time value, like 30s, 5m or 1h. A value without a unit is in seconds
+ * @param str The string
+ * @param time [out] The time, or disabled if the string is empty
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_parse_time(char* str, pgexporter_time_t* time);
+
 /**
  * Get a configuration parameter value
  * @param ssl The SSL connection
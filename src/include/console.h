@@ -43,6 +43,18 @@ extern "C" {
 void
 pgexporter_console(SSL* client_ssl, int client_fd);
 
+/**
+ * Serve the console requests of a connection without taking
+ * the process down afterwards. The caller owns the connection
+ * and closes it
+ * @param client_ssl The client SSL connection (can be NULL)
+ * @param client_fd The client file descriptor
+ * @param requests The number of requests served
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_console_serve(SSL* client_ssl, int client_fd, int* requests);
+
 #ifdef __cplusplus
 }
 #endif
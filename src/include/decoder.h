@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGEXPORTER_DECODER_H
+#define PGEXPORTER_DECODER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgexporter.h>
+#include <memory.h>
+#include <message.h>
+#include <queries.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+struct decoder;
+
+/**
+ * Callback for a decoded DataRow message
+ * @param decoder The decoder
+ * @param request The request the row belongs to
+ * @param msg The DataRow message, only valid during the call
+ * @return 0 upon success, otherwise 1
+ */
+typedef int (*decoder_row_callback)(struct decoder* decoder, struct query_request* request, struct message* msg);
+
+/** @struct decoder
+ * An incremental decoder for the results of pipelined simple queries.
+ * The bytes are fed as they arrive from the server and every complete
+ * message is decoded in place. Only a message that is split across two
+ * reads is copied.
+ */
+struct decoder
+{
+   int server;                     /**< The server */
+   struct query_request* requests; /**< The requests */
+   int number_of_requests;         /**< The number of requests */
+   int current;                    /**< The request whose result is being decoded */
+   int64_t mark;                   /**< The time the previous result was complete, in microseconds */
+   bool failed;                    /**< Has the current result an ErrorResponse */
+   struct tuple* last;             /**< The last tuple of the current result */
+   decoder_row_callback row;       /**< The row callback */
+   void* row_data;                 /**< The data of the row callback */
+   struct memory_arena* arena;     /**< The shared arena for the tuples, or NULL */
+   char* pending;                  /**< A message split across reads */
+   size_t pending_length;          /**< The number of bytes of the pending message */
+   size_t pending_capacity;        /**< The capacity of the pending buffer */
+};
+
+/**
+ * Create a decoder
+ * @param server The server
+ * @param requests The requests, which receive their results
+ * @param n The number of requests
+ * @param row The row callback, or NULL to add the rows as tuples to the query
+ * @param row_data The data of the row callback
+ * @param arena The arena for the tuples, or NULL to give each query its own
+ * @param decoder The resulting decoder
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_decoder_create(int server, struct query_request* requests, int n,
+                          decoder_row_callback row, void* row_data, struct memory_arena* arena,
+                          struct decoder** decoder);
+
+/**
+ * Feed bytes received from the server to a decoder
+ * @param decoder The decoder
+ * @param data The data
+ * @param size The size of the data
+ * @return 0 upon success, otherwise 1 for a protocol error
+ */
+int
+pgexporter_decoder_feed(struct decoder* decoder, void* data, size_t size);
+
+/**
+ * Have all the results been decoded
+ * @param decoder The decoder
+ * @return True if every request has its result, otherwise false
+ */
+bool
+pgexporter_decoder_done(struct decoder* decoder);
+
+/**
+ * Add a DataRow message as a tuple to the query of a request
+ * @param decoder The decoder
+ * @param request The request
+ * @param msg The DataRow message
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_decoder_add_tuple(struct decoder* decoder, struct query_request* request, struct message* msg);
+
+/**
+ * Destroy a decoder. A result that is not complete is discarded
+ * @param decoder The decoder
+ */
+void
+pgexporter_decoder_destroy(struct decoder* decoder);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGEXPORTER_ENGINE_H
+#define PGEXPORTER_ENGINE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgexporter.h>
+#include <decoder.h>
+#include <memory.h>
+#include <queries.h>
+
+#include <ev.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define ENGINE_STATE_IDLE    0
+#define ENGINE_STATE_CONNECT 1
+#define ENGINE_STATE_QUERY   2
+#define ENGINE_STATE_ROWS    3
+#define ENGINE_STATE_READY   4
+#define ENGINE_STATE_DONE    5
+
+#define ENGINE_BATCH_OK            0
+#define ENGINE_BATCH_NO_CONNECTION 1
+#define ENGINE_BATCH_EXPIRED       2
+
+struct engine;
+struct server_connect;
+
+/** @struct engine_batch
+ * A pipeline of queries for one server
+ */
+struct engine_batch
+{
+   char* database;                 /**< The database, or NULL for the current connection */
+   struct query_request* requests; /**< The requests, which receive their results */
+   int n;                          /**< The number of requests */
+   struct memory_arena* arena;     /**< The arena for the tuples, or NULL */
+};
+
+/**
+ * Callback for the next batch of a server
+ * @param server The server
+ * @param batch The batch to fill in
+ * @param data The data of the engine
+ * @return True if there is a batch, false when the server is done
+ */
+typedef bool (*engine_next_callback)(int server, struct engine_batch* batch, void* data);
+
+/**
+ * Callback for a completed batch
+ * @param server The server
+ * @param batch The batch, whose requests hold their results
+ * @param status ENGINE_BATCH_OK if the batch was sent, ENGINE_BATCH_NO_CONNECTION when there was
+ *               no connection to its database, or ENGINE_BATCH_EXPIRED when the deadline passed
+ *               before the batch completed. The requests that did complete keep their results
+ * @param data The data of the engine
+ */
+typedef void (*engine_done_callback)(int server, struct engine_batch* batch, int status, void* data);
+
+/** @struct engine_connection
+ * The state machine of a server connection.
+ *
+ * A connection goes from CONNECT, where the connection to the
+ * database of the batch is set up, to QUERY, where the pipeline
+ * is written, to ROWS, where the results are decoded as they
+ * arrive, to READY. The next batch then starts over, until
+ * there are no more batches. A new connection, including its
+ * authentication, is driven by the loop like the queries.
+ */
+struct engine_connection
+{
+   struct ev_io io;                 /**< The watcher of the socket */
+   struct engine* engine;           /**< The engine */
+   int server;                      /**< The server */
+   int state;                       /**< The state */
+   bool nonblocking;                /**< Was the socket non blocking before the batch */
+   struct engine_batch batch;       /**< The current batch */
+   struct server_connect* connect;  /**< The connection being set up, or NULL */
+   struct decoder* decoder;         /**< The decoder of the results */
+   char* content;                   /**< The pipeline */
+   size_t size;                     /**< The size of the pipeline */
+   size_t offset;                   /**< The number of bytes of the pipeline written */
+};
+
+/** @struct engine
+ * An event driven query engine.
+ *
+ * The engine runs the batches of many servers at once from a
+ * single thread. The sockets are only read and written when
+ * libev reports them ready, so a slow server does not hold
+ * back the others.
+ */
+struct engine
+{
+   struct ev_loop* loop;                                    /**< The loop */
+   engine_next_callback next;                               /**< The next batch callback */
+   engine_done_callback done;                               /**< The completed batch callback */
+   void* data;                                              /**< The data of the callbacks */
+   char* buffer;                                            /**< The read buffer */
+   struct ev_timer timer;                                   /**< The watcher of the deadline */
+   ev_tstamp deadline;                                      /**< The deadline, or 0 for none */
+   bool expired;                                            /**< Has the deadline passed */
+   struct engine_connection connections[NUMBER_OF_SERVERS]; /**< The connections */
+};
+
+/**
+ * Create an engine
+ * @param next The next batch callback
+ * @param done The completed batch callback
+ * @param data The data of the callbacks
+ * @param engine The resulting engine
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_engine_create(engine_next_callback next, engine_done_callback done, void* data, struct engine** engine);
+
+/**
+ * Add a server to an engine
+ * @param engine The engine
+ * @param server The server
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_engine_add(struct engine* engine, int server);
+
+/**
+ * Run the batches of the servers until all of them are done, or
+ * until the deadline passes. The queries still running at the
+ * deadline are canceled and the remaining batches are skipped
+ * @param engine The engine
+ * @param timeout The time budget in milliseconds, or 0 for none
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_engine_run(struct engine* engine, int64_t timeout);
+
+/**
+ * Destroy an engine
+ * @param engine The engine
+ */
+void
+pgexporter_engine_destroy(struct engine* engine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
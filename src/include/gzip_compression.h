@@ -45,6 +45,17 @@ extern "C" {
 int
 pgexporter_gzip_string(char* s, unsigned char** buffer, size_t* buffer_size);
 
+/**
+ * GZip a string at a compression level
+ * @param s The original string
+ * @param level The zlib compression level, from 1 (fastest) to 9 (best)
+ * @param buffer The point to the compressed data buffer
+ * @param buffer_size The size of the compressed buffer will be stored.
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_gzip_string_level(char* s, int level, unsigned char** buffer, size_t* buffer_size);
+
 /**
  * GUNZip a buffer to string
  * @param compressed_buffer The buffer containing the GZIP compressed data
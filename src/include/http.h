@@ -36,6 +36,7 @@ extern "C" {
 #include <pgexporter.h>
 
 #include <deque.h>
+#include <message.h>
 
 #include <stdbool.h>
 #include <stdint.h>
@@ -208,6 +209,49 @@ pgexporter_http_response_destroy(struct http_response* response);
 int
 pgexporter_http_destroy(struct http* connection);
 
+/**
+ * Get a header value from a HTTP request received by one of the endpoints
+ * @param msg The request
+ * @param name The header name
+ * @return The header value, or NULL if not found. The caller must free it
+ */
+char*
+pgexporter_http_get_request_header(struct message* msg, char* name);
+
+/**
+ * Decide if a connection is kept open after responding to a request
+ * @param msg The request
+ * @param requests The number of requests served on the connection, this one included
+ * @return true if the connection is kept alive, otherwise false
+ */
+bool
+pgexporter_http_keep_alive(struct message* msg, int requests);
+
+/**
+ * Append the connection management headers to a response
+ * @param data The response headers
+ * @param keep_alive Is the connection kept alive
+ * @return The updated response headers
+ */
+char*
+pgexporter_http_connection_headers(char* data, bool keep_alive);
+
+/**
+ * Stop waiting for requests on kept alive connections, the connection
+ * being served is finished. Safe to call from a signal handler
+ */
+void
+pgexporter_http_shutdown(void);
+
+/**
+ * Wait for the next request on a kept alive connection
+ * @param ssl The SSL connection (NULL for non-secure)
+ * @param socket The socket descriptor
+ * @return true if a request can be read, otherwise false
+ */
+bool
+pgexporter_http_wait_request(SSL* ssl, int socket);
+
 #ifdef __cplusplus
 }
 #endif
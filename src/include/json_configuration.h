@@ -56,14 +56,14 @@ pgexporter_read_json_from_file_pointer(struct prometheus* prometheus, int promet
 
 /**
  * Read and parse a single JSON file into the prometheus metrics structure
- * @param prometheus The prometheus metrics array
+ * @param config The configuration where the metrics are loaded
  * @param prometheus_idx Starting index in the prometheus array
  * @param filename Path to the JSON file
  * @param number_of_metrics Number of metrics read (output parameter)
  * @return 0 upon success, otherwise 1
  */
 int
-pgexporter_read_json(struct prometheus* prometheus, int prometheus_idx, char* filename, int* number_of_metrics);
+pgexporter_read_json(struct configuration* config, int prometheus_idx, char* filename, int* number_of_metrics);
 
 /**
  * Get all JSON files from a directory
@@ -37,8 +37,25 @@ extern "C" {
 
 #include <stdlib.h>
 
+#define MEMORY_ARENA_BLOCK_SIZE (64 * 1024)
+
+struct memory_block;
+
+/** @struct memory_arena
+ * A region of memory that is handed out in small pieces and
+ * released as a whole. An arena is not thread safe
+ */
+struct memory_arena
+{
+   struct memory_block* blocks; /**< The blocks, the current block first */
+   size_t block_size;           /**< The size of a block */
+   size_t number_of_blocks;     /**< The number of blocks */
+   size_t allocations;          /**< The number of allocations */
+   size_t allocated;            /**< The number of bytes allocated */
+};
+
 /**
- * Initialize a memory segment for the process local message structure
+ * Initialize a memory segment for the thread local message structure
  */
 void
 pgexporter_memory_init(void);
@@ -89,6 +106,49 @@ pgexporter_memory_dynamic_append(void* orig, size_t orig_size, void* append, siz
 void
 pgexporter_memory_dynamic_destroy(void* data);
 
+/**
+ * Create a memory arena
+ * @param block_size The size of a block, or 0 for the default
+ * @param arena The resulting arena
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_memory_arena_create(size_t block_size, struct memory_arena** arena);
+
+/**
+ * Allocate zeroed memory from an arena. The memory is released
+ * when the arena is destroyed
+ * @param arena The arena
+ * @param size The size
+ * @return The memory, or NULL
+ */
+void*
+pgexporter_memory_arena_alloc(struct memory_arena* arena, size_t size);
+
+/**
+ * Copy a string into an arena
+ * @param arena The arena
+ * @param s The string
+ * @return The copy, or NULL
+ */
+char*
+pgexporter_memory_arena_strdup(struct memory_arena* arena, char* s);
+
+/**
+ * Move all the memory of an arena into another arena, and destroy it
+ * @param arena The arena that takes over the memory
+ * @param other The arena that is destroyed
+ */
+void
+pgexporter_memory_arena_absorb(struct memory_arena* arena, struct memory_arena* other);
+
+/**
+ * Destroy an arena and all the memory allocated from it
+ * @param arena The arena
+ */
+void
+pgexporter_memory_arena_destroy(struct memory_arena* arena);
+
 #ifdef __cplusplus
 }
 #endif
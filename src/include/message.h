@@ -140,6 +140,16 @@ pgexporter_write_notice(SSL* ssl, int socket);
 int
 pgexporter_write_terminate(SSL* ssl, int socket);
 
+/**
+ * Write a cancel request message
+ * @param socket The socket descriptor of a new connection
+ * @param pid The process id of the backend
+ * @param key The cancel key of the backend
+ * @return MESSAGE_STATUS_OK upon success, otherwise MESSAGE_STATUS_ERROR
+ */
+int
+pgexporter_write_cancel_request(int socket, int pid, int key);
+
 /**
  * Write an empty message
  * @param ssl The SSL struct
@@ -269,6 +279,15 @@ pgexporter_create_ssl_message(struct message** msg);
 int
 pgexporter_create_startup_message(char* username, char* database, struct message** msg);
 
+/**
+ * Create a query message
+ * @param query The query
+ * @param msg The resulting message
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_create_query_message(char* query, struct message** msg);
+
 #ifdef __cplusplus
 }
 #endif
@@ -77,6 +77,17 @@ pgexporter_remove_unix_socket(const char* directory, const char* file);
 int
 pgexporter_connect(const char* hostname, int port, int* fd);
 
+/**
+ * Start to connect to a host without waiting for the connection,
+ * it is complete once the socket becomes writable
+ * @param hostname The host name
+ * @param port The port number
+ * @param fd The resulting descriptor, which is non blocking
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_connect_start(const char* hostname, int port, int* fd);
+
 /**
  * Connect to a Unix Domain Socket
  * @param directory The directory
@@ -77,8 +77,25 @@ extern "C" {
 #define NUMBER_OF_ALERTS             64
 #define NUMBER_OF_DATABASES          64
 #define NUMBER_OF_METRIC_NAMES       1024
+#define NUMBER_OF_HTTP_WORKERS       64
+
+#define TLS_TICKET_KEYS_LENGTH       80
+#define TLS_TICKET_KEY_ROTATION      3600
+#define NUMBER_OF_SCRAM_KEYS         NUMBER_OF_SERVERS
+#define SCRAM_KEY_LENGTH             32
+#define SCRAM_SALT_LENGTH            64
 #define MAX_METRIC_COLUMNS           2048
 
+#define NUMBER_OF_QUERY_TAGS         512
+#define NUMBER_OF_LATENCY_BUCKETS    10
+
+#define SCRAPE_PHASE_CONNECT         0
+#define SCRAPE_PHASE_AUTH            1
+#define SCRAPE_PHASE_QUERY           2
+#define SCRAPE_PHASE_FORMAT          3
+#define SCRAPE_PHASE_SEND            4
+#define NUMBER_OF_SCRAPE_PHASES      5
+
 #define STATE_FREE                   0
 #define STATE_IN_USE                 1
 
@@ -101,6 +118,8 @@ extern "C" {
 #define AUTH_BAD_PASSWORD            1
 #define AUTH_ERROR                   2
 #define AUTH_TIMEOUT                 3
+#define AUTH_WANT_READ               4
+#define AUTH_WANT_WRITE              5
 
 #define HUGEPAGE_OFF                 0
 #define HUGEPAGE_TRY                 1
@@ -157,6 +176,11 @@ enum alert_type {
 #define COMPRESSION_SERVER_ZSTD      6
 #define COMPRESSION_SERVER_LZ4       7
 
+#define CONTENT_ENCODING_IDENTITY    0
+#define CONTENT_ENCODING_GZIP        1
+#define CONTENT_ENCODING_ZSTD        2
+#define NUMBER_OF_CONTENT_ENCODINGS  3
+
 #define UPDATE_PROCESS_TITLE_NEVER   0
 #define UPDATE_PROCESS_TITLE_STRICT  1
 #define UPDATE_PROCESS_TITLE_MINIMAL 2
@@ -256,6 +280,12 @@ extern void* shmem;
  */
 extern void* prometheus_cache_shmem;
 
+/**
+ * Shared memory used to contain the metrics
+ * snapshot of the background collector.
+ */
+extern void* prometheus_snapshot_shmem;
+
 /**
  * Shared memory used to contain the bridge
  * response cache.
@@ -307,6 +337,10 @@ struct server
    int fd;                                                 /**< The socket descriptor */
    bool new;                                               /**< Is the connection new */
    int state;                                              /**< The state of the server */
+   char database[DB_NAME_LENGTH];                          /**< The database of the connection */
+   int backend_pid;                                        /**< The process id of the backend of the connection */
+   int backend_key;                                        /**< The cancel key of the backend of the connection */
+   time_t last_used;                                       /**< The time the connection was last used */
    int version;                                            /**< The major version of the server*/
    int minor_version;                                      /**< The minor version of the server*/
    int number_of_databases;                                /**< The number of databases */
@@ -331,26 +365,126 @@ struct user
    char password[MAX_PASSWORD_LENGTH]; /**< The password */
 } __attribute__((aligned(64)));
 
+/** @struct scram_keys
+ * The SCRAM-SHA-256 keys derived from a password.
+ *
+ * The keys are only valid for the `salt` and the
+ * `iterations` the server sent when they were derived,
+ * so a repeat authentication with the same parameters
+ * can skip the PBKDF2 iterations.
+ */
+struct scram_keys
+{
+   char username[MAX_USERNAME_LENGTH];          /**< The user name */
+   unsigned char salt[SCRAM_SALT_LENGTH];       /**< The salt */
+   int salt_length;                             /**< The length of the salt, 0 if the entry is free */
+   int iterations;                              /**< The iteration count */
+   unsigned char client_key[SCRAM_KEY_LENGTH];  /**< The ClientKey */
+   unsigned char server_key[SCRAM_KEY_LENGTH];  /**< The ServerKey */
+} __attribute__((aligned(64)));
+
+/** @struct ticket_keys
+ * The TLS session ticket keys, shared by all processes.
+ *
+ * A key is a 16 byte name, a 32 byte HMAC key and a
+ * 32 byte AES key. New tickets are encrypted with the
+ * key in `current`, and the other one is the previous
+ * key which only decrypts. A rotation writes the new
+ * key over the previous one before it is published.
+ *
+ * A key is written while its sequence is odd, so a reader
+ * copies it and retries if the sequence changed meanwhile.
+ */
+struct ticket_keys
+{
+   atomic_int current;                            /**< index of the key that encrypts */
+   atomic_uint sequence[2];                       /**< the write sequence of each key */
+   unsigned char keys[2][TLS_TICKET_KEYS_LENGTH]; /**< the current and the previous key */
+};
+
+/** @struct latency_histogram
+ * A histogram of durations that every process updates
+ * without a lock. The buckets are not cumulative, the
+ * last one counts what is above the highest bound.
+ */
+struct latency_histogram
+{
+   atomic_ulong buckets[NUMBER_OF_LATENCY_BUCKETS + 1]; /**< The number of observations per bucket */
+   atomic_ulong sum;                                     /**< The sum of the observations in microseconds */
+};
+
+/** @struct prometheus_cache_buffer
+ * One of the two payload buffers of a cache.
+ *
+ * The `sequence` field is odd while the buffer is
+ * written, so a reader that sees it change during
+ * its copy knows the copy is torn and retries.
+ *
+ * The compressed copies of the payload follow it in
+ * the buffer, in the order of their encoding.
+ *
+ * The `valid_until` and `created` fields store
+ * the result of `time(2)`.
+ */
+struct prometheus_cache_buffer
+{
+   atomic_uint sequence;                               /**< odd while the buffer is written */
+   time_t valid_until;                                 /**< when the payload will become not valid */
+   time_t created;                                     /**< when the payload was published */
+   size_t length;                                      /**< length of the payload */
+   size_t encoded_length[NUMBER_OF_CONTENT_ENCODINGS]; /**< length of each compressed copy, 0 if there is none */
+};
+
 /** @struct prometheus_cache
  * A structure to handle the Prometheus response
  * so that it is possible to serve the very same
  * response over and over depending on the cache
  * settings.
  *
- * The `valid_until` field stores the result
- * of `time(2)`.
- *
- * The cache is protected by the `lock` field.
+ * The payload is double buffered. A writer, holding
+ * the `lock` field, builds the next payload in the
+ * buffer that is not published and publishes it by
+ * storing its index in `current`. Readers never take
+ * the lock. The `refresh` field is held by the single
+ * process that collects a new response, so the others
+ * can be served the previous one meanwhile.
  *
- * The `size` field stores the size of the allocated
- * `data` payload.
+ * The `size` field stores the size of each of the two
+ * buffers in the `data` payload.
  */
 struct prometheus_cache
 {
-   time_t valid_until; /**< when the cache will become not valid */
-   atomic_schar lock;  /**< lock to protect the cache */
-   size_t size;        /**< size of the cache */
-   char data[];        /**< the payload */
+   atomic_int current;                        /**< index of the published buffer */
+   atomic_schar lock;                         /**< lock to serialize the writers */
+   atomic_schar refresh;                      /**< set while a process collects a new response */
+   bool building;                             /**< is the other buffer being written */
+   size_t size;                               /**< size of each buffer */
+   struct prometheus_cache_buffer buffers[2]; /**< the state of the buffers */
+   char data[];                               /**< the payloads */
+} __attribute__((aligned(64)));
+
+/** @struct prometheus_snapshot
+ * A structure holding the metrics published by
+ * the background collector.
+ *
+ * The collector builds the metrics in its own memory
+ * and copies them in while holding the `lock`, so
+ * readers always see a complete snapshot.
+ *
+ * The compressed copies of the snapshot follow it
+ * in the payload, in the order of their encoding.
+ *
+ * The `collected` field stores the result
+ * of `time(2)` when the snapshot was published.
+ */
+struct prometheus_snapshot
+{
+   time_t collected;                                   /**< when the snapshot was published */
+   atomic_schar lock;                                  /**< lock to protect the snapshot */
+   size_t size;                                        /**< size of the payload */
+   size_t length;                                      /**< length of the published snapshot */
+   size_t encoded_length[NUMBER_OF_CONTENT_ENCODINGS]; /**< length of each compressed copy, 0 if there is none */
+   char data[];                                        /**< the payload */
 } __attribute__((aligned(64)));
 
 /** @struct column
@@ -373,6 +507,7 @@ struct prometheus
    int server_query_type;                /**< Query type 0--SERVER_QUERY_BOTH 1--SERVER_QUERY_PRIMARY 2--SERVER_QUERY_REPLICA */
    bool exec_on_all_dbs;                 /**< Execute on all databases */
    bool optional;                        /**< If true, suppress warning on query failure */
+   pgexporter_time_t interval;           /**< Refresh interval of the results, disabled to query on every collection */
    char collector[MAX_COLLECTOR_LENGTH]; /**< Collector Tag for query */
    struct pg_query_alts* pg_root;        /**< Root of the Query Alternatives' AVL Tree for PostgreSQL core queries*/
    struct ext_query_alts* ext_root;      /**< Root of the Query Alternatives' AVL Tree for PostgreSQL extension queries*/
@@ -424,13 +559,19 @@ struct configuration
    char extensions_path[MAX_PATH];    /**< The extensions path, containing metric files */
    char alerts_path[MAX_PATH];        /**< The alerts path */
 
-   char host[MISC_LENGTH];                  /**< The host */
-   int metrics;                             /**< The metrics port */
-   pgexporter_time_t metrics_cache_max_age; /**< Cache duration for Prometheus response */
-   size_t metrics_cache_max_size;           /**< Number of bytes max to cache the Prometheus response */
-   pgexporter_time_t metrics_query_timeout; /**< Timeout for metric queries */
-   int management;                          /**< The management port */
-   int console;                             /**< The console port */
+   char host[MISC_LENGTH];                       /**< The host */
+   int metrics;                                  /**< The metrics port */
+   pgexporter_time_t metrics_cache_max_age;      /**< Cache duration for Prometheus response */
+   pgexporter_time_t metrics_cache_max_stale;    /**< How long an expired Prometheus response may be served during a refresh */
+   size_t metrics_cache_max_size;                /**< Number of bytes max to cache the Prometheus response */
+   pgexporter_time_t metrics_query_timeout;      /**< Timeout for metric queries */
+   int metrics_query_workers;                    /**< Number of servers queried concurrently */
+   bool metrics_query_async;                     /**< Run the queries of all the servers from an event loop */
+   pgexporter_time_t metrics_scrape_timeout;     /**< The time budget of a scrape */
+   pgexporter_time_t metrics_collector_interval; /**< Interval of the background collector */
+   pgexporter_time_t metrics_pool_idle_timeout;  /**< Idle timeout of the collector connections */
+   int management;                               /**< The management port */
+   int console;                                  /**< The console port */
 
    int bridge;                             /**< The bridge port */
    pgexporter_time_t bridge_cache_max_age; /**< Cache duration for bridge response */
@@ -459,9 +600,15 @@ struct configuration
    char metrics_key_file[MAX_PATH];  /**< Metrics TLS key path */
    char metrics_ca_file[MAX_PATH];   /**< Metrics TLS CA certificate path */
 
-   pgexporter_time_t blocking_timeout;       /**< The blocking timeout */
-   pgexporter_time_t authentication_timeout; /**< The authentication timeout */
-   char pidfile[MAX_PATH];                   /**< File containing the PID */
+   struct ticket_keys metrics_ticket_keys; /**< Metrics TLS session ticket keys, shared by all processes */
+
+   pgexporter_time_t blocking_timeout;        /**< The blocking timeout */
+   pgexporter_time_t authentication_timeout;  /**< The authentication timeout */
+   pgexporter_time_t http_keep_alive_timeout; /**< How long an idle HTTP connection is kept open */
+   int http_keep_alive_max_requests;          /**< Number of requests served on one HTTP connection */
+   int http_workers;                          /**< Number of pre-forked HTTP workers (0 = fork per connection) */
+   int http_worker_max_requests;              /**< Number of requests a HTTP worker serves before it is replaced */
+   char pidfile[MAX_PATH];                    /**< File containing the PID */
 
    unsigned int update_process_title; /**< Behaviour for updating the process title */
 
@@ -484,7 +631,9 @@ struct configuration
    int number_of_extensions;          /**< Number of loaded extensions */
    int number_of_metric_names;        /**< Number of unique metric names */
 
-   char metrics_path[MAX_PATH]; /**< The metrics path */
+   char metrics_path[MAX_PATH];       /**< The metrics path */
+   uint64_t metrics_stamp;            /**< The stamp of the loaded metrics files, 0 if unknown */
+   char metrics_yaml_cache[MAX_PATH]; /**< The directory of the parsed metrics YAML files, empty if disabled */
 
    int number_of_alerts;                             /**< The number of alerts */
    struct alert_definition alerts[NUMBER_OF_ALERTS]; /**< The alert definitions */
@@ -496,6 +645,14 @@ struct configuration
    atomic_ulong query_executions_total; /**< Query executions */
    atomic_ulong query_errors_total;     /**< Query errors */
    atomic_ulong query_timeouts_total;   /**< Query timeouts */
+   atomic_ulong scrape_allocations;     /**< Arena allocations of the last collection */
+   atomic_ulong scrape_allocated_bytes; /**< Arena bytes of the last collection */
+   atomic_ulong scrape_arena_blocks;    /**< Arena blocks of the last collection */
+   atomic_ulong metrics_cache_hits;     /**< Scrapes served out of the metrics cache */
+   atomic_ulong metrics_cache_misses;   /**< Scrapes that had to collect */
+   atomic_uint metrics_encodings;       /**< The content encodings scrapes asked for, one bit each */
+
+   struct latency_histogram scrape_phases[NUMBER_OF_SCRAPE_PHASES]; /**< The durations of the phases of a scrape */
 
    char allowed_collectors[NUMBER_OF_COLLECTORS][MAX_COLLECTOR_LENGTH];  /**< List of allowed collectors */
    char excluded_collectors[NUMBER_OF_COLLECTORS][MAX_COLLECTOR_LENGTH]; /**< List of excluded collectors */
@@ -505,9 +662,17 @@ struct configuration
    struct server servers[NUMBER_OF_SERVERS];                     /**< The servers */
    struct user users[NUMBER_OF_USERS];                           /**< The users */
    struct user admins[NUMBER_OF_ADMINS];                         /**< The admins */
+   atomic_schar scram_keys_lock;                                 /**< The lock to protect the SCRAM keys */
+   int scram_keys_next;                                          /**< The next SCRAM keys entry to replace */
+   struct scram_keys scram_keys[NUMBER_OF_SCRAM_KEYS];           /**< The derived SCRAM keys */
    struct prometheus prometheus[NUMBER_OF_METRICS];              /**< The Prometheus metrics */
    struct endpoint endpoints[NUMBER_OF_ENDPOINTS];               /**< The Prometheus metrics */
    struct extension_metrics extensions[NUMBER_OF_EXTENSIONS];    /**< Extension metrics by extension */
+
+   atomic_schar query_tags_lock;                                                      /**< The lock to protect the registration of query tags */
+   atomic_int number_of_query_tags;                                                   /**< The number of query tags */
+   char query_tags[NUMBER_OF_QUERY_TAGS][PROMETHEUS_LENGTH];                          /**< The tags of the query latencies */
+   struct latency_histogram query_latencies[NUMBER_OF_SERVERS][NUMBER_OF_QUERY_TAGS]; /**< The query latencies by server and tag */
 } __attribute__((aligned(64)));
 
 #ifdef __cplusplus
@@ -58,6 +58,12 @@ extern "C" {
  */
 #define PROMETHEUS_DEFAULT_CACHE_SIZE (256 * 1024)
 
+/**
+ * Size of the snapshot published by the
+ * background collector (in bytes).
+ */
+#define PROMETHEUS_SNAPSHOT_SIZE (16 * 1024 * 1024)
+
 /**
  * Create a prometheus instance
  * @param client_ssl The client SSL structure
@@ -66,6 +72,18 @@ extern "C" {
 void
 pgexporter_prometheus(SSL* client_ssl, int fd);
 
+/**
+ * Serve the requests of a prometheus connection without
+ * taking the process down afterwards. The caller owns the
+ * connection and closes it
+ * @param client_ssl The client SSL structure
+ * @param fd The client descriptor
+ * @param requests The number of requests served
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_prometheus_serve(SSL* client_ssl, int fd, int* requests);
+
 /**
  * Reset the counters and histograms
  */
@@ -103,6 +121,41 @@ pgexporter_prometheus_logging(int logging);
 int
 pgexporter_init_prometheus_cache(size_t* p_size, void** p_shmem);
 
+/**
+ * Allocates the snapshot used by the background collector.
+ *
+ * The snapshot is only allocated when `metrics_collector_interval`
+ * is set. Scrapes are then served from the snapshot and never
+ * connect to PostgreSQL themselves.
+ *
+ * @param p_size a pointer to where to store the size of
+ * allocated chunk of memory
+ * @param p_shmem the pointer to the pointer at which the allocated chunk
+ * of shared memory is going to be inserted
+ *
+ * @return 0 on success
+ */
+int
+pgexporter_init_prometheus_snapshot(size_t* p_size, void** p_shmem);
+
+/**
+ * Warn about the metrics with an interval when there is no background
+ * collector. Their results are only reused by the collector, so every
+ * scrape runs their queries.
+ */
+void
+pgexporter_prometheus_warn_intervals(void);
+
+/**
+ * Run the background collector.
+ *
+ * Collects the metrics every `metrics_collector_interval` and
+ * publishes them in the snapshot until SIGTERM is received.
+ * The function does not return.
+ */
+void
+pgexporter_prometheus_collector(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -34,17 +34,35 @@ extern "C" {
 #endif
 
 #include <pgexporter.h>
+#include <memory.h>
 
 #include <stdbool.h>
+#include <stdint.h>
+
+/* The role, the pg_monitor role, the databases and the extensions of a new connection */
+#define OPEN_CONNECTION_REQUESTS 4
+
+struct server_connect;
+
+/** @struct tuple_cell
+ * Defines a view of a column value in the row of a tuple
+ */
+struct tuple_cell
+{
+   int32_t offset; /**< The offset of the value in the row */
+   int32_t length; /**< The length of the value, or -1 for NULL */
+};
 
 /** @struct tuple
- * Defines a tuple
+ * Defines a tuple. The row holds the values as received from the
+ * server, each terminated in place, and the cells point into it
  */
 struct tuple
 {
-   int server;         /**< The server */
-   char** data;        /**< The data */
-   struct tuple* next; /**< The next tuple */
+   int server;               /**< The server */
+   char* row;                /**< The values of the row */
+   struct tuple_cell* cells; /**< The column values */
+   struct tuple* next;       /**< The next tuple */
 } __attribute__((aligned(64)));
 
 /** @struct query
@@ -57,9 +75,26 @@ struct query
    int number_of_columns;                                /**< The number of columns */
    int type_oids[MAX_NUMBER_OF_COLUMNS];                 /**< The PostgreSQL type OIDs */
 
-   struct tuple* tuples; /**< The tuples */
+   struct tuple* tuples;       /**< The tuples */
+   struct memory_arena* arena; /**< The memory of the tuples, unless it belongs to a shared arena */
 } __attribute__((aligned(64)));
 
+/** @struct query_request
+ * Defines a query that is executed as part of a pipeline
+ */
+struct query_request
+{
+   char* qs;            /**< The query string */
+   char* tag;           /**< The tag */
+   int columns;         /**< The number of columns, or -1 to use the result */
+   char** names;        /**< The column names, or NULL to use the result */
+   struct query* query; /**< The resulting query */
+   int error;           /**< 0 upon success, otherwise 1 */
+   bool timeout;        /**< Was the query canceled by a timeout */
+   bool retain;         /**< Keep the tuples in the arena of the query, so it can outlive the pipeline */
+   int64_t duration;    /**< The time the server took for the result in microseconds, -1 if it is incomplete */
+};
+
 /**
  * @struct query_alts_base
  * Base structure containing common fields for query alternatives.
@@ -97,12 +132,60 @@ pgexporter_check_pg_monitor_role(int server);
 void
 pgexporter_open_connections(void);
 
+/**
+ * Open the database connection for a server, reusing it if still valid
+ * @param server The server
+ * @return 0 upon success, otherwise 1 and the server is skipped
+ */
+int
+pgexporter_open_connection(int server);
+
+/**
+ * Describe the queries that inspect a new connection as requests, so they can be pipelined
+ * @param requests The requests, OPEN_CONNECTION_REQUESTS of them
+ */
+void
+pgexporter_open_connection_requests(struct query_request* requests);
+
+/**
+ * Apply the results of the requests of a new connection. The connection
+ * is closed when the user lacks the pg_monitor role
+ * @param server The server
+ * @param requests The requests, whose results are released
+ * @return 0 upon success, otherwise 1 and the server is skipped
+ */
+int
+pgexporter_open_connection_finish(int server, struct query_request* requests);
+
 /**
  * Close database connections
  */
 void
 pgexporter_close_connections(void);
 
+/**
+ * Close the database connection of a server
+ * @param server The server
+ */
+void
+pgexporter_close_connection(int server);
+
+/**
+ * Cancel the query running on the connection of a server. The
+ * connection itself stays open
+ * @param server The server
+ * @return 0 if the cancel request was sent, otherwise 1
+ */
+int
+pgexporter_cancel_query(int server);
+
+/**
+ * Close the database connections that have been idle longer
+ * than metrics_pool_idle_timeout
+ */
+void
+pgexporter_close_idle_connections(void);
+
 /**
  * Execute query
  * @param server The server
@@ -132,6 +215,13 @@ pgexporter_execute_command(int server, char* sql);
 int
 pgexporter_query_version(int server, struct query** query);
 
+/**
+ * Describe the query of PostgreSQL version as a request, so it can be pipelined
+ * @param request The request
+ */
+void
+pgexporter_query_version_request(struct query_request* request);
+
 /**
  * Query PostgreSQL uptime
  * @param server The server
@@ -141,6 +231,13 @@ pgexporter_query_version(int server, struct query** query);
 int
 pgexporter_query_uptime(int server, struct query** query);
 
+/**
+ * Describe the query of PostgreSQL uptime as a request, so it can be pipelined
+ * @param request The request
+ */
+void
+pgexporter_query_uptime_request(struct query_request* request);
+
 /**
  * Query PostgreSQL if it is primary
  * @param server The server
@@ -150,6 +247,13 @@ pgexporter_query_uptime(int server, struct query** query);
 int
 pgexporter_query_primary(int server, struct query** query);
 
+/**
+ * Describe the query of the PostgreSQL primary status as a request, so it can be pipelined
+ * @param request The request
+ */
+void
+pgexporter_query_primary_request(struct query_request* request);
+
 /**
  * Query pg_database for size
  * @param server The server
@@ -222,6 +326,13 @@ pgexporter_query_stat_database_conflicts(int server, struct query** query);
 int
 pgexporter_query_settings(int server, struct query** query);
 
+/**
+ * Describe the query of pg_settings as a request, so it can be pipelined
+ * @param request The request
+ */
+void
+pgexporter_query_settings_request(struct query_request* request);
+
 /**
  * Query custom metrics
  * @param server The server
@@ -235,6 +346,28 @@ pgexporter_query_settings(int server, struct query** query);
 int
 pgexporter_custom_query(int server, char* qs, char* tag, int columns, char** names, struct query** query);
 
+/**
+ * Query custom metrics as a pipeline. The queries are sent back-to-back
+ * before the results are read, so they cost about one round trip
+ * @param server The server
+ * @param requests The queries, which receive their results
+ * @param n The number of queries
+ * @param arena The arena for the tuples, or NULL to give each query its own
+ * @return 0 if all results were received, otherwise 1
+ */
+int
+pgexporter_custom_query_pipeline(int server, struct query_request* requests, int n, struct memory_arena* arena);
+
+/**
+ * Record the durations of the complete results of a pipeline in
+ * the query latency histograms of the server
+ * @param server The server
+ * @param requests The requests
+ * @param n The number of requests
+ */
+void
+pgexporter_query_latencies(int server, struct query_request* requests, int n);
+
 /**
  * Merge queries
  * @param q1 The first query
@@ -246,7 +379,8 @@ struct query*
 pgexporter_merge_queries(struct query* q1, struct query* q2, int sort);
 
 /**
- * Free allocated memory for tuples linked list
+ * Release the tuples linked list. The memory of the tuples
+ * belongs to the arena of their query
  * @param query The query
  * @return 0 upon success, otherwise 1
  */
@@ -270,6 +404,15 @@ pgexporter_free_query(struct query* query);
 char*
 pgexporter_get_column(int col, struct tuple* tuple);
 
+/**
+ * Get the length of a column from a tuple
+ * @param col The column
+ * @param tuple The tuple
+ * @return The length, or -1 for NULL
+ */
+int
+pgexporter_get_column_length(int col, struct tuple* tuple);
+
 /**
  * Debug query
  * @param query The resulting query
@@ -295,6 +438,27 @@ pgexporter_get_column_by_name(char* name, struct query* query, struct tuple* tup
 int
 pgexporter_switch_db(int server, char* database);
 
+/**
+ * Start to change the connection to a database without blocking. An open
+ * connection to the database is reused, otherwise a new one is started,
+ * which is handed over with pgexporter_switch_db_complete() once it succeeds
+ * @param server Server
+ * @param database Database name (default: postgres)
+ * @param connect The resulting connection, or NULL if the server is already connected
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_switch_db_start(int server, char* database, struct server_connect** connect);
+
+/**
+ * Hand over a connection that succeeded to the server, taking the
+ * version of the server from the parameters it reported
+ * @param server Server
+ * @param connect The connection, which is destroyed
+ */
+void
+pgexporter_switch_db_complete(int server, struct server_connect* connect);
+
 #ifdef __cplusplus
 }
 #endif
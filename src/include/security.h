@@ -36,10 +36,63 @@ extern "C" {
 #include <pgexporter.h>
 #include <deque.h>
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #include <openssl/ssl.h>
 
+#define SERVER_CONNECT_SOCKET    0
+#define SERVER_CONNECT_TLS       1
+#define SERVER_CONNECT_HANDSHAKE 2
+#define SERVER_CONNECT_STARTUP   3
+#define SERVER_CONNECT_AUTH      4
+#define SERVER_CONNECT_SETUP     5
+
+/** @struct server_connect
+ * A server connection that is set up without blocking.
+ *
+ * The connection goes from SOCKET, where the socket connects,
+ * through TLS and HANDSHAKE when the server is asked for TLS, to
+ * STARTUP, where the startup message is written, to AUTH, where the
+ * authentication requests are answered, and to SETUP, where the
+ * setup query runs. The caller drives it with
+ * pgexporter_server_connect_step() whenever the socket is ready,
+ * or waits for it with pgexporter_server_connect_run().
+ */
+struct server_connect
+{
+   int server;                                 /**< The server */
+   int state;                                  /**< The state */
+   int fd;                                     /**< The socket */
+   SSL* ssl;                                   /**< The TLS connection, or NULL */
+   char database[DB_NAME_LENGTH];              /**< The database */
+   char username[MAX_USERNAME_LENGTH];         /**< The user name */
+   char password[MAX_PASSWORD_LENGTH];         /**< The password */
+   char* setup;                                /**< The query to run once connected, or NULL */
+   bool authenticated;                         /**< Has the server accepted the user */
+   struct deque* parameters;                   /**< The parameters reported by the server */
+   int backend_pid;                            /**< The process id of the backend */
+   int backend_key;                            /**< The cancel key of the backend */
+   int64_t start;                              /**< The start of the connection in microseconds */
+   int64_t connected;                          /**< The end of the connection setup in microseconds */
+   char* output;                               /**< The bytes to write */
+   size_t output_length;                       /**< The number of bytes to write */
+   size_t output_offset;                       /**< The number of bytes written */
+   char* input;                                /**< The bytes read */
+   size_t input_size;                          /**< The size of the input buffer */
+   size_t input_length;                        /**< The number of bytes read */
+   char* password_prep;                        /**< The prepared password of SCRAM-SHA-256 */
+   char* client_first;                         /**< The client-first-message-bare of SCRAM-SHA-256 */
+   char* server_first;                         /**< The server-first-message of SCRAM-SHA-256 */
+   char* wo_proof;                             /**< The client-final-message-without-proof of SCRAM-SHA-256 */
+   char* salt;                                 /**< The salt of SCRAM-SHA-256 */
+   size_t salt_length;                         /**< The length of the salt */
+   int iterations;                             /**< The iteration count of SCRAM-SHA-256 */
+   bool derived;                               /**< Were the SCRAM-SHA-256 keys derived */
+   unsigned char server_key[SCRAM_KEY_LENGTH]; /**< The ServerKey of SCRAM-SHA-256 */
+};
+
 /**
  * Authenticate a user
  * @param server The server
@@ -53,6 +106,69 @@ extern "C" {
 int
 pgexporter_server_authenticate(int server, char* database, char* username, char* password, SSL** ssl, int* fd);
 
+/**
+ * Start to connect to a server without blocking
+ * @param server The server
+ * @param database The database
+ * @param username The username
+ * @param password The password
+ * @param setup The query to run once connected, or NULL
+ * @param connect The resulting connection
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_server_connect_start(int server, char* database, char* username, char* password, char* setup,
+                                struct server_connect** connect);
+
+/**
+ * Advance a connection as far as its socket allows. Once it succeeds,
+ * the caller takes over the socket and the TLS connection
+ * @param connect The connection
+ * @return AUTH_WANT_READ or AUTH_WANT_WRITE to wait for the socket, otherwise
+ *         AUTH_SUCCESS, AUTH_BAD_PASSWORD or AUTH_ERROR
+ */
+int
+pgexporter_server_connect_step(struct server_connect* connect);
+
+/**
+ * Advance a connection until it succeeds or fails, waiting for its
+ * socket at most authentication_timeout
+ * @param connect The connection
+ * @return AUTH_SUCCESS, AUTH_BAD_PASSWORD or AUTH_ERROR
+ */
+int
+pgexporter_server_connect_run(struct server_connect* connect);
+
+/**
+ * Destroy a connection, closing its socket unless it was taken over
+ * @param connect The connection
+ */
+void
+pgexporter_server_connect_destroy(struct server_connect* connect);
+
+/**
+ * Derive the SCRAM-SHA-256 keys of a password, the keys of a previous
+ * derivation with the same salt and iteration count are reused
+ * @param username The user name
+ * @param password The prepared password
+ * @param salt The salt
+ * @param salt_length The length of the salt
+ * @param iterations The iteration count
+ * @param client_key The resulting ClientKey, SCRAM_KEY_LENGTH bytes
+ * @param server_key The resulting ServerKey, SCRAM_KEY_LENGTH bytes
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_scram_keys(char* username, char* password, char* salt, int salt_length, int iterations,
+                      unsigned char* client_key, unsigned char* server_key);
+
+/**
+ * Forget the SCRAM-SHA-256 keys derived from the passwords,
+ * so that the next authentications use the current ones
+ */
+void
+pgexporter_clear_scram_keys(void);
+
 /**
  * Authenticate a remote management user
  * @param client_fd The descriptor
@@ -106,14 +222,6 @@ pgexporter_tls_valid(void);
 void
 pgexporter_close_ssl(SSL* ssl);
 
-/**
- * Extract server parameters recevied during the latest authentication
- * @param server_parameters The resulting non-thread-safe deque
- * @return 0 on success, otherwise 1
- */
-int
-pgexporter_extract_server_parameters(struct deque** server_parameters);
-
 /**
  * Create a SSL context
  * @param client True if client, false if server
@@ -136,6 +244,40 @@ pgexporter_create_ssl_ctx(bool client, SSL_CTX** ctx);
 int
 pgexporter_create_ssl_server(SSL_CTX* ctx, char* key, char* cert, char* root, int socket, SSL** ssl);
 
+/**
+ * Create a SSL context for a server endpoint with the certificate,
+ * key and CA already loaded. The context is built once and shared
+ * by the processes that serve the connections
+ * @param key The key file path
+ * @param cert The certificate file path
+ * @param root The root file path
+ * @param ticket_keys The TLS session ticket keys, or NULL to disable session tickets
+ * @param ctx The SSL context
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_create_ssl_server_ctx(char* key, char* cert, char* root, struct ticket_keys* ticket_keys, SSL_CTX** ctx);
+
+/**
+ * Rotate the TLS session ticket keys. The current key becomes
+ * the previous one, which still decrypts the tickets it issued
+ * @param ticket_keys The TLS session ticket keys
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_rotate_ticket_keys(struct ticket_keys* ticket_keys);
+
+/**
+ * Create a SSL server from a shared context. The context
+ * stays valid when the SSL structure is closed
+ * @param ctx The SSL context
+ * @param socket The socket
+ * @param ssl The SSL structure
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_create_ssl_server_session(SSL_CTX* ctx, int socket, SSL** ssl);
+
 #ifdef __cplusplus
 }
 #endif
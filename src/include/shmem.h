@@ -36,7 +36,7 @@ extern "C" {
 #include <stdlib.h>
 
 /**
- * Create a shared memory segment
+ * Create a zero filled shared memory segment
  * @param size The size of the segment
  * @param hp Huge page value
  * @parma shmem The shared memory segment
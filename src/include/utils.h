@@ -38,6 +38,7 @@ extern "C" {
 #include <message.h>
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 /** @struct signal_info
@@ -49,6 +50,16 @@ struct signal_info
    int slot;                /**< The slot */
 };
 
+/** @struct string_builder
+ * Defines a growable string that keeps track of its length
+ */
+struct string_builder
+{
+   char* buffer;    /**< The NUL terminated contents */
+   size_t length;   /**< The length of the contents */
+   size_t capacity; /**< The size of the buffer */
+};
+
 /** @struct pgexporter_command
  * Defines pgexporter commands.
  * The necessary fields are marked with an ">".
@@ -269,6 +280,14 @@ pgexporter_write_byte(void* data, signed char b);
 void
 pgexporter_write_uint8(void* data, uint8_t b);
 
+/**
+ * Write an int16
+ * @param data Pointer to the data
+ * @param i The int16
+ */
+void
+pgexporter_write_int16(void* data, int16_t i);
+
 /**
  * Write an int32
  * @param data Pointer to the data
@@ -495,6 +514,91 @@ pgexporter_append_bool(char* orig, bool b);
 char*
 pgexporter_append_char(char* orig, char c);
 
+/**
+ * Create a string builder
+ * @param capacity The initial capacity, or 0 for the default
+ * @param sb The resulting string builder
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_string_builder_create(size_t capacity, struct string_builder** sb);
+
+/**
+ * Append a string to a string builder
+ * @param sb The string builder
+ * @param s The string
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_string_builder_append(struct string_builder* sb, char* s);
+
+/**
+ * Append the first bytes of a string to a string builder
+ * @param sb The string builder
+ * @param s The string
+ * @param length The number of bytes
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_string_builder_append_length(struct string_builder* sb, char* s, size_t length);
+
+/**
+ * Append a char to a string builder
+ * @param sb The string builder
+ * @param c The char
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_string_builder_append_char(struct string_builder* sb, char c);
+
+/**
+ * Append an integer to a string builder
+ * @param sb The string builder
+ * @param i The integer
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_string_builder_append_int(struct string_builder* sb, int64_t i);
+
+/**
+ * Append a string escaped as a Prometheus label value to a string builder
+ * @param sb The string builder
+ * @param s The string
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_string_builder_append_escaped(struct string_builder* sb, char* s);
+
+/**
+ * Copy the contents of a string builder
+ * @param sb The string builder
+ * @return The copy, or NULL if the builder is empty
+ */
+char*
+pgexporter_string_builder_copy(struct string_builder* sb);
+
+/**
+ * Take the contents of a string builder and destroy it
+ * @param sb The string builder
+ * @return The contents, or NULL if the builder is empty
+ */
+char*
+pgexporter_string_builder_release(struct string_builder* sb);
+
+/**
+ * Empty a string builder, keeping its buffer
+ * @param sb The string builder
+ */
+void
+pgexporter_string_builder_reset(struct string_builder* sb);
+
+/**
+ * Destroy a string builder
+ * @param sb The string builder
+ */
+void
+pgexporter_string_builder_destroy(struct string_builder* sb);
+
 /**
  * Indent a string
  * @param str The string
@@ -932,6 +1036,29 @@ pgexporter_time_is_valid(pgexporter_time_t t);
 int
 pgexporter_time_format(pgexporter_time_t t, enum pgexporter_time_format_t fmt, char** output);
 
+/**
+ * Get the time of a monotonic clock, for measuring durations
+ * @return The time in microseconds
+ */
+int64_t
+pgexporter_monotonic_micros(void);
+
+/**
+ * Record a duration in a latency histogram
+ * @param histogram The histogram
+ * @param duration The duration in microseconds
+ */
+void
+pgexporter_latency_observe(struct latency_histogram* histogram, int64_t duration);
+
+/**
+ * Get the upper bound of a bucket of the latency histograms
+ * @param bucket The bucket, less than NUMBER_OF_LATENCY_BUCKETS
+ * @return The upper bound in microseconds
+ */
+int64_t
+pgexporter_latency_bucket(int bucket);
+
 /**
  * Cleanse memory
  * @param data The data
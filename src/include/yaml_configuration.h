@@ -46,8 +46,8 @@ int
 pgexporter_read_metrics_configuration(void* shmem);
 
 /**
- * @brief Read the internal YAML configuration `INTERNAL_YAML` and load the
- * metrics in the config.
+ * @brief Load the internal metrics in the config, from the catalog generated
+ * from `INTERNAL_YAML` when building.
  *
  * @param config The configuration where it will be loaded
  * @param start true if it will reset the `number_of_metrics` in `config` to 0 and start counting from there
@@ -58,14 +58,24 @@ pgexporter_read_internal_yaml_metrics(struct configuration* config, bool start);
 
 /**
  * Read and load YAML configuration from file pointer.
- * @param prometheus The array of data structures where the YAML configuration is loaded
- * @param prometheus_idx The index of the data structure in the array
+ * @param config The configuration where the YAML configuration is loaded
+ * @param prometheus_idx The index of the first metric in the configuration
  * @param number_of_metrics The number of metrics the configuration has. This value will be set by the function.
  * @param file File pointer
  * @return 0 upon success, otherwise 1
  */
 int
-pgexporter_read_yaml_from_file_pointer(struct prometheus* prometheus, int prometheus_idx, int* number_of_metrics, FILE* file);
+pgexporter_read_yaml_from_file_pointer(struct configuration* config, int prometheus_idx, int* number_of_metrics, FILE* file);
+
+/**
+ * Compute the stamp of the metrics files, from the path, the modification
+ * time, the size and the content of each YAML file
+ * @param metrics_path The metrics file or directory, may be empty
+ * @param stamp The resulting stamp, 0 if it could not be computed
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_metrics_stamp(char* metrics_path, uint64_t* stamp);
 
 /**
  * Find and load a specific extension's YAML file
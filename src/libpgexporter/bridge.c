@@ -32,6 +32,7 @@
 #include <bridge.h>
 #include <cache.h>
 #include <deque.h>
+#include <http.h>
 #include <logging.h>
 #include <memory.h>
 #include <message.h>
@@ -68,29 +69,47 @@ static int bad_request(int client_fd);
 static int send_chunk(int client_fd, char* data);
 
 static bool is_bridge_cache_configured(void);
-static bool is_bridge_cache_valid(void);
 static bool bridge_cache_append(char* data);
 static bool bridge_cache_finalize(void);
 static size_t bridge_cache_size_to_alloc(void);
-static void bridge_cache_invalidate(void);
 
 static bool is_bridge_json_cache_configured(void);
 static bool bridge_json_cache_set(char* data);
 static size_t bridge_json_cache_size_to_alloc(void);
 
 static void bridge_metrics(int client_fd);
-static void bridge_json_metrics(int client_fd);
+static int bridge_json_metrics(int client_fd);
+
+static bool keep_alive = false;
 
 void
 pgexporter_bridge(int client_fd)
+{
+   int requests = 0;
+   int ret;
+
+   pgexporter_start_logging();
+   pgexporter_memory_init();
+
+   ret = pgexporter_bridge_serve(client_fd, &requests);
+
+   pgexporter_disconnect(client_fd);
+
+   pgexporter_memory_destroy();
+   pgexporter_stop_logging();
+
+   exit(ret);
+}
+
+int
+pgexporter_bridge_serve(int client_fd, int* requests)
 {
    int status;
    int page;
    struct message* msg = NULL;
    struct configuration* config;
 
-   pgexporter_start_logging();
-   pgexporter_memory_init();
+   *requests = 0;
 
    config = (struct configuration*)shmem;
 
@@ -102,54 +121,78 @@ pgexporter_bridge(int client_fd)
       goto error;
    }
 
-   page = resolve_page(msg);
-
-   if (page == PAGE_HOME)
-   {
-      home_page(client_fd);
-   }
-   else if (page == PAGE_METRICS)
-   {
-      metrics_page(client_fd);
-   }
-   else if (page == PAGE_UNKNOWN)
-   {
-      unknown_page(client_fd);
-   }
-   else
+   while (true)
    {
-      bad_request(client_fd);
-   }
+      (*requests)++;
+      keep_alive = pgexporter_http_keep_alive(msg, *requests);
 
-   pgexporter_disconnect(client_fd);
+      page = resolve_page(msg);
 
-   pgexporter_memory_destroy();
-   pgexporter_stop_logging();
+      if (page == PAGE_HOME)
+      {
+         status = home_page(client_fd);
+      }
+      else if (page == PAGE_METRICS)
+      {
+         status = metrics_page(client_fd);
+      }
+      else if (page == PAGE_UNKNOWN)
+      {
+         status = unknown_page(client_fd);
+      }
+      else
+      {
+         status = bad_request(client_fd);
+      }
+
+      if (status || !keep_alive || !pgexporter_http_wait_request(NULL, client_fd))
+      {
+         break;
+      }
 
-   exit(0);
+      if (pgexporter_read_timeout_message(NULL, client_fd, (int)pgexporter_time_convert(config->authentication_timeout, FORMAT_TIME_S), &msg) != MESSAGE_STATUS_OK)
+      {
+         break;
+      }
+   }
+
+   return 0;
 
 error:
 
    badrequest_page(client_fd);
 
+   return 1;
+}
+
+void
+pgexporter_bridge_json(int client_fd)
+{
+   int requests = 0;
+   int ret;
+
+   pgexporter_start_logging();
+   pgexporter_memory_init();
+
+   ret = pgexporter_bridge_json_serve(client_fd, &requests);
+
    pgexporter_disconnect(client_fd);
 
    pgexporter_memory_destroy();
    pgexporter_stop_logging();
 
-   exit(1);
+   exit(ret);
 }
 
-void
-pgexporter_bridge_json(int client_fd)
+int
+pgexporter_bridge_json_serve(int client_fd, int* requests)
 {
    int status;
    int page;
    struct message* msg = NULL;
    struct configuration* config;
 
-   pgexporter_start_logging();
-   pgexporter_memory_init();
+   *requests = 0;
 
    config = (struct configuration*)shmem;
 
@@ -160,38 +203,44 @@ pgexporter_bridge_json(int client_fd)
       goto error;
    }
 
-   page = resolve_page(msg);
-
-   if (page == PAGE_HOME || page == PAGE_METRICS)
-   {
-      bridge_json_metrics(client_fd);
-   }
-   else if (page == PAGE_UNKNOWN)
+   while (true)
    {
-      unknown_page(client_fd);
-   }
-   else
-   {
-      bad_request(client_fd);
-   }
+      (*requests)++;
+      keep_alive = pgexporter_http_keep_alive(msg, *requests);
 
-   pgexporter_disconnect(client_fd);
+      page = resolve_page(msg);
 
-   pgexporter_memory_destroy();
-   pgexporter_stop_logging();
+      if (page == PAGE_HOME || page == PAGE_METRICS)
+      {
+         status = bridge_json_metrics(client_fd);
+      }
+      else if (page == PAGE_UNKNOWN)
+      {
+         status = unknown_page(client_fd);
+      }
+      else
+      {
+         status = bad_request(client_fd);
+      }
+
+      if (status || !keep_alive || !pgexporter_http_wait_request(NULL, client_fd))
+      {
+         break;
+      }
+
+      if (pgexporter_read_timeout_message(NULL, client_fd, (int)pgexporter_time_convert(config->authentication_timeout, FORMAT_TIME_S), &msg) != MESSAGE_STATUS_OK)
+      {
+         break;
+      }
+   }
 
-   exit(0);
+   return 0;
 
 error:
 
    badrequest_page(client_fd);
 
-   pgexporter_disconnect(client_fd);
-
-   pgexporter_memory_destroy();
-   pgexporter_stop_logging();
-
-   exit(1);
+   return 1;
 }
 
 static int
@@ -209,11 +258,16 @@ resolve_page(struct message* msg)
    index = 4;
    from = (char*)msg->data + index;
 
-   while (pgexporter_read_byte(msg->data + index) != ' ')
+   while (index < msg->length && pgexporter_read_byte(msg->data + index) != ' ')
    {
       index++;
    }
 
+   if (index >= msg->length)
+   {
+      return BAD_REQUEST;
+   }
+
    pgexporter_write_byte(msg->data + index, '\0');
 
    if (strcmp(from, "/") == 0 || strcmp(from, "/index.html") == 0)
@@ -246,11 +300,14 @@ badrequest_page(int client_fd)
    ctime_r(&now, &time_buf[0]);
    time_buf[strlen(time_buf) - 1] = 0;
 
-   data = pgexporter_vappend(data, 4,
+   data = pgexporter_vappend(data, 5,
                              "HTTP/1.1 400 Bad Request\r\n",
                              "Date: ",
                              &time_buf[0],
-                             "\r\n");
+                             "\r\n",
+                             "Content-Length: 0\r\n");
+   data = pgexporter_http_connection_headers(data, keep_alive);
+   data = pgexporter_append(data, "\r\n");
 
    msg.kind = 0;
    msg.length = strlen(data);
@@ -260,7 +317,7 @@ badrequest_page(int client_fd)
 
    free(data);
 
-   return status;
+   return status == MESSAGE_STATUS_OK ? 0 : 1;
 }
 
 static int
@@ -281,11 +338,14 @@ unknown_page(int client_fd)
    ctime_r(&now, &time_buf[0]);
    time_buf[strlen(time_buf) - 1] = 0;
 
-   data = pgexporter_vappend(data, 4,
+   data = pgexporter_vappend(data, 5,
                              "HTTP/1.1 403 Forbidden\r\n",
                              "Date: ",
                              &time_buf[0],
-                             "\r\n");
+                             "\r\n",
+                             "Content-Length: 0\r\n");
+   data = pgexporter_http_connection_headers(data, keep_alive);
+   data = pgexporter_append(data, "\r\n");
 
    msg.kind = 0;
    msg.length = strlen(data);
@@ -295,7 +355,7 @@ unknown_page(int client_fd)
 
    free(data);
 
-   return status;
+   return status == MESSAGE_STATUS_OK ? 0 : 1;
 }
 
 static int
@@ -313,14 +373,15 @@ home_page(int client_fd)
    ctime_r(&now, &time_buf[0]);
    time_buf[strlen(time_buf) - 1] = 0;
 
-   data = pgexporter_vappend(data, 7,
+   data = pgexporter_vappend(data, 6,
                              "HTTP/1.1 200 OK\r\n",
                              "Content-Type: text/html; charset=utf-8\r\n",
                              "Date: ",
                              &time_buf[0],
                              "\r\n",
-                             "Transfer-Encoding: chunked\r\n",
-                             "\r\n");
+                             "Transfer-Encoding: chunked\r\n");
+   data = pgexporter_http_connection_headers(data, keep_alive);
+   data = pgexporter_append(data, "\r\n");
 
    msg.kind = 0;
    msg.length = strlen(data);
@@ -353,12 +414,11 @@ home_page(int client_fd)
    free(data);
    data = NULL;
 
-   /* Footer */
-   data = pgexporter_append(data, "\r\n\r\n");
-
-   send_chunk(client_fd, data);
-   free(data);
-   data = NULL;
+   /* The last chunk is empty, so the client knows where the page ends */
+   if (send_chunk(client_fd, "") != MESSAGE_STATUS_OK)
+   {
+      goto error;
+   }
 
    return 0;
 
@@ -373,16 +433,16 @@ static int
 metrics_page(int client_fd)
 {
    char* data = NULL;
+   char* body = NULL;
+   size_t length = 0;
+   time_t created = 0;
+   time_t valid_until = 0;
    time_t start_time;
-   int dt;
    char time_buf[32];
    int status;
    struct message msg;
    struct prometheus_cache* cache;
-   signed char cache_is_free;
-   struct configuration* config;
 
-   config = (struct configuration*)shmem;
    cache = (struct prometheus_cache*)bridge_cache_shmem;
 
    memset(&msg, 0, sizeof(struct message));
@@ -393,122 +453,107 @@ metrics_page(int client_fd)
    ctime_r(&start_time, &time_buf[0]);
    time_buf[strlen(time_buf) - 1] = 0;
 
-retry_cache_locking:
-   cache_is_free = STATE_FREE;
-   if (atomic_compare_exchange_strong(&cache->lock, &cache_is_free, STATE_IN_USE))
+   // Can we serve the message out of cache?
+   if (is_bridge_cache_configured() && !pgexporter_cache_get(cache, &body, &length, &created, &valid_until) &&
+       time(NULL) <= valid_until)
    {
-      // Can we serve the message out of cache?
-      if (is_bridge_cache_configured() && is_bridge_cache_valid())
-      {
-         // serve the message directly out of the cache
-         pgexporter_log_debug("Serving bridge out of cache (%d/%d bytes valid until %lld)",
-                              strlen(cache->data),
-                              cache->size,
-                              cache->valid_until);
-
-         /* Header */
-         data = pgexporter_vappend(data, 7,
-                                   "HTTP/1.1 200 OK\r\n",
-                                   "Content-Type: text/plain; charset=utf-8\r\n",
-                                   "Date: ", &time_buf[0], "\r\n",
-                                   "Transfer-Encoding: chunked\r\n", "\r\n");
-
-         msg.kind = 0;
-         msg.length = strlen(data);
-         msg.data = data;
-
-         status = pgexporter_write_message(NULL, client_fd, &msg);
-         if (status != MESSAGE_STATUS_OK)
-         {
-            goto error;
-         }
-
-         free(data);
-         data = NULL;
+      // serve the message directly out of the cache
+      pgexporter_log_debug("Serving bridge out of cache (%zu/%zu bytes valid until %lld)",
+                           length,
+                           cache->size,
+                           (long long)valid_until);
 
-         /* Cache */
-         send_chunk(client_fd, cache->data);
+      /* Header */
+      data = pgexporter_vappend(data, 6,
+                                "HTTP/1.1 200 OK\r\n",
+                                "Content-Type: text/plain; charset=utf-8\r\n",
+                                "Date: ", &time_buf[0], "\r\n",
+                                "Transfer-Encoding: chunked\r\n");
+      data = pgexporter_http_connection_headers(data, keep_alive);
+      data = pgexporter_append(data, "\r\n");
 
-         /* Footer */
-         data = pgexporter_append(data, "0\r\n\r\n");
+      msg.kind = 0;
+      msg.length = strlen(data);
+      msg.data = data;
 
-         msg.kind = 0;
-         msg.length = strlen(data);
-         msg.data = data;
+      status = pgexporter_write_message(NULL, client_fd, &msg);
+      if (status != MESSAGE_STATUS_OK)
+      {
+         goto error;
+      }
 
-         status = pgexporter_write_message(NULL, client_fd, &msg);
-         if (status != MESSAGE_STATUS_OK)
-         {
-            goto error;
-         }
+      free(data);
+      data = NULL;
 
-         free(data);
-         data = NULL;
-      }
-      else
+      /* Cache, an empty chunk would end the response early */
+      if (length > 0)
       {
-         pgexporter_log_debug("Serving bridge fresh");
+         send_chunk(client_fd, body);
+      }
 
-         bridge_cache_invalidate();
+      /* Footer */
+      data = pgexporter_append(data, "0\r\n\r\n");
 
-         data = pgexporter_vappend(data, 7,
-                                   "HTTP/1.1 200 OK\r\n",
-                                   "Content-Type: text/plain; version=0.0.1; charset=utf-8\r\n",
-                                   "Date: ", &time_buf[0], "\r\n",
-                                   "Transfer-Encoding: chunked\r\n",
-                                   "\r\n");
+      msg.kind = 0;
+      msg.length = strlen(data);
+      msg.data = data;
 
-         msg.kind = 0;
-         msg.length = strlen(data);
-         msg.data = data;
+      status = pgexporter_write_message(NULL, client_fd, &msg);
+      if (status != MESSAGE_STATUS_OK)
+      {
+         goto error;
+      }
+   }
+   else
+   {
+      pgexporter_log_debug("Serving bridge fresh");
 
-         status = pgexporter_write_message(NULL, client_fd, &msg);
-         if (status != MESSAGE_STATUS_OK)
-         {
-            goto error;
-         }
+      data = pgexporter_vappend(data, 6,
+                                "HTTP/1.1 200 OK\r\n",
+                                "Content-Type: text/plain; version=0.0.1; charset=utf-8\r\n",
+                                "Date: ", &time_buf[0], "\r\n",
+                                "Transfer-Encoding: chunked\r\n");
+      data = pgexporter_http_connection_headers(data, keep_alive);
+      data = pgexporter_append(data, "\r\n");
 
-         free(data);
-         data = NULL;
+      msg.kind = 0;
+      msg.length = strlen(data);
+      msg.data = data;
 
-         /* Metrics */
-         bridge_metrics(client_fd);
+      status = pgexporter_write_message(NULL, client_fd, &msg);
+      if (status != MESSAGE_STATUS_OK)
+      {
+         goto error;
+      }
 
-         /* Footer */
-         data = pgexporter_append(data, "0\r\n\r\n");
+      free(data);
+      data = NULL;
 
-         msg.kind = 0;
-         msg.length = strlen(data);
-         msg.data = data;
+      /* Metrics */
+      bridge_metrics(client_fd);
 
-         status = pgexporter_write_message(NULL, client_fd, &msg);
-         if (status != MESSAGE_STATUS_OK)
-         {
-            goto error;
-         }
-      }
+      /* Footer */
+      data = pgexporter_append(data, "0\r\n\r\n");
 
-      // free the cache
-      atomic_store(&cache->lock, STATE_FREE);
-   }
-   else
-   {
-      dt = (int)difftime(time(NULL), start_time);
-      if (dt >= (pgexporter_time_convert(config->blocking_timeout, FORMAT_TIME_S) > 0 ? pgexporter_time_convert(config->blocking_timeout, FORMAT_TIME_S) : DEFAULT_BLOCKING_TIMEOUT_SECONDS))
+      msg.kind = 0;
+      msg.length = strlen(data);
+      msg.data = data;
+
+      status = pgexporter_write_message(NULL, client_fd, &msg);
+      if (status != MESSAGE_STATUS_OK)
       {
          goto error;
       }
-
-      /* Sleep for 10ms */
-      SLEEP_AND_GOTO(10000000L, retry_cache_locking);
    }
 
+   free(body);
    free(data);
 
    return 0;
 
 error:
 
+   free(body);
    free(data);
 
    return 1;
@@ -532,11 +577,14 @@ bad_request(int client_fd)
    ctime_r(&now, &time_buf[0]);
    time_buf[strlen(time_buf) - 1] = 0;
 
-   data = pgexporter_vappend(data, 4,
+   data = pgexporter_vappend(data, 5,
                              "HTTP/1.1 400 Bad Request\r\n",
                              "Date: ",
                              &time_buf[0],
-                             "\r\n");
+                             "\r\n",
+                             "Content-Length: 0\r\n");
+   data = pgexporter_http_connection_headers(data, keep_alive);
+   data = pgexporter_append(data, "\r\n");
 
    msg.kind = 0;
    msg.length = strlen(data);
@@ -546,7 +594,7 @@ bad_request(int client_fd)
 
    free(data);
 
-   return status;
+   return status == MESSAGE_STATUS_OK ? 0 : 1;
 }
 
 static int
@@ -611,24 +659,6 @@ is_bridge_cache_configured(void)
           config->bridge_cache_max_size != PROMETHEUS_BRIDGE_CACHE_DISABLED;
 }
 
-/**
- * Checks if the cache is still valid, and therefore can be
- * used to serve as a response.
- * A cache is considred valid if it has non-empty payload and
- * a timestamp in the future.
- *
- * @return true if the cache is still valid
- */
-static bool
-is_bridge_cache_valid(void)
-{
-   struct prometheus_cache* cache;
-
-   cache = (struct prometheus_cache*)bridge_cache_shmem;
-
-   return pgexporter_cache_is_valid(cache);
-}
-
 int
 pgexporter_bridge_init_cache(size_t* p_size, void** p_shmem)
 {
@@ -691,24 +721,6 @@ bridge_cache_size_to_alloc(void)
    return cache_size;
 }
 
-/**
- * Invalidates the cache.
- *
- * Requires the caller to hold the lock on the cache!
- *
- * Invalidating the cache means that the payload is zero-filled
- * and that the valid_until field is set to zero too.
- */
-static void
-bridge_cache_invalidate(void)
-{
-   struct prometheus_cache* cache;
-
-   cache = (struct prometheus_cache*)bridge_cache_shmem;
-
-   pgexporter_cache_invalidate(cache);
-}
-
 /**
  * Appends data to the cache.
  *
@@ -858,6 +870,9 @@ bridge_json_cache_size_to_alloc(void)
  *
  * Requires the caller to hold the lock on the cache!
  *
+ * The data is written to the back buffer and published
+ * when complete, so readers never wait for it.
+ *
  * @param data the string to append to the cache
  * @return true on success
  */
@@ -873,17 +888,20 @@ bridge_json_cache_set(char* data)
       return false;
    }
 
-   memset(cache->data, 0, cache->size);
-
-   if (strlen(data) < cache->size)
+   if (strlen(data) >= cache->size)
    {
-      memcpy(cache->data, data, strlen(data));
+      pgexporter_log_warn("Bridge/JSON: The data won't fit - %lld > %lld", strlen(data), cache->size);
+      pgexporter_cache_invalidate(cache);
+      return true;
    }
-   else
+
+   if (!pgexporter_cache_append(cache, data))
    {
-      pgexporter_log_warn("Bridge/JSON: The data won't fit - %lld > %lld", strlen(data), cache->size);
+      return false;
    }
 
+   pgexporter_cache_finalize(cache, PGEXPORTER_TIME_DISABLED);
+
    return true;
 }
 
@@ -894,7 +912,7 @@ bridge_metrics(int client_fd)
    int dt;
    signed char cache_is_free;
    signed char cache_json_is_free;
-   char* data = NULL;
+   struct string_builder* sb = NULL;
    struct prometheus_bridge* bridge = NULL;
    struct art_iterator* metrics_iterator = NULL;
    struct prometheus_cache* cache;
@@ -926,6 +944,11 @@ bridge_metrics(int client_fd)
       goto error;
    }
 
+   if (pgexporter_string_builder_create(0, &sb))
+   {
+      goto error;
+   }
+
    cache_is_free = STATE_FREE;
    cache_json_is_free = STATE_FREE;
 
@@ -934,10 +957,9 @@ bridge_metrics(int client_fd)
 retry_cache_locking:
    if (is_bridge_cache_configured())
    {
+      /* Only writers take the lock, readers copy the published buffer */
       if (atomic_compare_exchange_strong(&cache->lock, &cache_is_free, STATE_IN_USE))
       {
-         bridge_cache_invalidate();
-
          if (is_bridge_json_cache_configured())
          {
 retry_cache_json_locking:
@@ -972,17 +994,19 @@ retry_cache_json_locking:
       struct prometheus_metric* metric_data = (struct prometheus_metric*)metrics_iterator->value->data;
       struct deque_iterator* definition_iterator = NULL;
 
-      data = pgexporter_append(data, "#HELP ");
-      data = pgexporter_append(data, metric_data->name);
-      data = pgexporter_append_char(data, ' ');
-      data = pgexporter_append(data, metric_data->help);
-      data = pgexporter_append_char(data, '\n');
+      pgexporter_string_builder_reset(sb);
 
-      data = pgexporter_append(data, "#TYPE ");
-      data = pgexporter_append(data, metric_data->name);
-      data = pgexporter_append_char(data, ' ');
-      data = pgexporter_append(data, metric_data->type);
-      data = pgexporter_append_char(data, '\n');
+      pgexporter_string_builder_append(sb, "#HELP ");
+      pgexporter_string_builder_append(sb, metric_data->name);
+      pgexporter_string_builder_append_char(sb, ' ');
+      pgexporter_string_builder_append(sb, metric_data->help);
+      pgexporter_string_builder_append_char(sb, '\n');
+
+      pgexporter_string_builder_append(sb, "#TYPE ");
+      pgexporter_string_builder_append(sb, metric_data->name);
+      pgexporter_string_builder_append_char(sb, ' ');
+      pgexporter_string_builder_append(sb, metric_data->type);
+      pgexporter_string_builder_append_char(sb, '\n');
 
       if (pgexporter_deque_iterator_create(metric_data->definitions, &definition_iterator))
       {
@@ -1002,45 +1026,42 @@ retry_cache_json_locking:
 
          value_data = (struct prometheus_value*)pgexporter_deque_peek_last(attrs_data->values, NULL);
 
-         data = pgexporter_append(data, metric_data->name);
-         data = pgexporter_append_char(data, '{');
+         pgexporter_string_builder_append(sb, metric_data->name);
+         pgexporter_string_builder_append_char(sb, '{');
 
          while (pgexporter_deque_iterator_next(attributes_iterator))
          {
             struct prometheus_attribute* attr_data = (struct prometheus_attribute*)attributes_iterator->value->data;
 
-            data = pgexporter_append(data, attr_data->key);
-            data = pgexporter_append(data, "=\"");
-            data = pgexporter_append(data, attr_data->value);
-            data = pgexporter_append_char(data, '\"');
+            pgexporter_string_builder_append(sb, attr_data->key);
+            pgexporter_string_builder_append(sb, "=\"");
+            pgexporter_string_builder_append(sb, attr_data->value);
+            pgexporter_string_builder_append_char(sb, '\"');
 
             if (pgexporter_deque_iterator_has_next(attributes_iterator))
             {
-               data = pgexporter_append(data, ", ");
+               pgexporter_string_builder_append(sb, ", ");
             }
          }
 
-         data = pgexporter_append(data, "} ");
-         data = pgexporter_append(data, value_data->value);
+         pgexporter_string_builder_append(sb, "} ");
+         pgexporter_string_builder_append(sb, value_data->value);
 
-         data = pgexporter_append_char(data, '\n');
+         pgexporter_string_builder_append_char(sb, '\n');
 
          pgexporter_deque_iterator_destroy(attributes_iterator);
       }
 
-      data = pgexporter_append_char(data, '\n');
+      pgexporter_string_builder_append_char(sb, '\n');
 
       if (is_bridge_cache_configured())
       {
-         bridge_cache_append(data);
+         bridge_cache_append(sb->buffer);
       }
 
-      send_chunk(client_fd, data);
+      send_chunk(client_fd, sb->buffer);
 
       pgexporter_deque_iterator_destroy(definition_iterator);
-
-      free(data);
-      data = NULL;
    }
 
    if (is_bridge_json_cache_configured())
@@ -1062,6 +1083,8 @@ retry_cache_json_locking:
       }
    }
 
+   pgexporter_string_builder_destroy(sb);
+
    pgexporter_art_iterator_destroy(metrics_iterator);
 
    pgexporter_prometheus_client_destroy_bridge(bridge);
@@ -1070,29 +1093,29 @@ retry_cache_json_locking:
 
 error:
 
+   pgexporter_string_builder_destroy(sb);
+
    pgexporter_art_iterator_destroy(metrics_iterator);
 
    pgexporter_prometheus_client_destroy_bridge(bridge);
 }
 
-static void
+static int
 bridge_json_metrics(int client_fd)
 {
    char* data = NULL;
+   char* body = NULL;
+   size_t length = 0;
+   time_t created = 0;
+   time_t valid_until = 0;
    time_t start_time;
-   int dt;
    char time_buf[32];
    int status;
    struct message msg;
    struct prometheus_cache* cache;
-   signed char cache_is_free;
-   struct configuration* config = NULL;
 
-   config = (struct configuration*)shmem;
    cache = (struct prometheus_cache*)bridge_json_cache_shmem;
 
-   cache_is_free = STATE_FREE;
-
    start_time = time(NULL);
 
    memset(&msg, 0, sizeof(struct message));
@@ -1102,27 +1125,19 @@ bridge_json_metrics(int client_fd)
    ctime_r(&start_time, &time_buf[0]);
    time_buf[strlen(time_buf) - 1] = 0;
 
-retry_cache_locking:
    if (is_bridge_json_cache_configured())
    {
-      if (!atomic_compare_exchange_strong(&cache->lock, &cache_is_free, STATE_IN_USE))
-      {
-         dt = (int)difftime(time(NULL), start_time);
-         if (dt >= (pgexporter_time_convert(config->blocking_timeout, FORMAT_TIME_S) > 0 ? pgexporter_time_convert(config->blocking_timeout, FORMAT_TIME_S) : DEFAULT_BLOCKING_TIMEOUT_SECONDS))
-         {
-            goto error;
-         }
-
-         /* Sleep for 10ms */
-         SLEEP_AND_GOTO(10000000L, retry_cache_locking);
-      }
+      /* The published payload is copied without taking the lock */
+      pgexporter_cache_get(cache, &body, &length, &created, &valid_until);
 
       /* Header */
-      data = pgexporter_vappend(data, 7,
+      data = pgexporter_vappend(data, 6,
                                 "HTTP/1.1 200 OK\r\n",
                                 "Content-Type: text/plain; charset=utf-8\r\n",
                                 "Date: ", &time_buf[0], "\r\n",
-                                "Transfer-Encoding: chunked\r\n", "\r\n");
+                                "Transfer-Encoding: chunked\r\n");
+      data = pgexporter_http_connection_headers(data, keep_alive);
+      data = pgexporter_append(data, "\r\n");
 
       msg.kind = 0;
       msg.length = strlen(data);
@@ -1138,9 +1153,9 @@ retry_cache_locking:
       data = NULL;
 
       /* Cache */
-      if (strlen(cache->data) > 0)
+      if (body != NULL && length > 0)
       {
-         send_chunk(client_fd, cache->data);
+         send_chunk(client_fd, body);
       }
       else
       {
@@ -1162,17 +1177,22 @@ retry_cache_locking:
 
       free(data);
       data = NULL;
-
-      atomic_store(&cache->lock, STATE_FREE);
    }
    else
    {
       goto error;
    }
 
-   return;
+   free(body);
+
+   return 0;
 
 error:
 
+   free(body);
+   free(data);
+
    pgexporter_log_error("bridge_json_metrics called");
+
+   return 1;
 }
@@ -40,6 +40,12 @@
 #include <string.h>
 #include <time.h>
 
+static char* cache_buffer(struct prometheus_cache* cache, int index);
+static void cache_write_begin(struct prometheus_cache_buffer* buffer);
+static void cache_write_end(struct prometheus_cache_buffer* buffer);
+static void cache_read_header(struct prometheus_cache* cache, time_t* created, time_t* valid_until, size_t* length);
+static bool cache_payload(struct prometheus_cache* cache, struct prometheus_cache_buffer* buffer, int encoding, size_t* offset, size_t* length);
+
 int
 pgexporter_cache_init(size_t cache_size, size_t* p_size, void** p_shmem)
 {
@@ -50,18 +56,28 @@ pgexporter_cache_init(size_t cache_size, size_t* p_size, void** p_shmem)
    config = (struct configuration*)shmem;
    struct_size = sizeof(struct prometheus_cache);
 
-   if (pgexporter_create_shared_memory(struct_size + cache_size, config != NULL ? config->hugepage : false, (void*)&cache))
+   if (pgexporter_create_shared_memory(struct_size + 2 * cache_size, config != NULL ? config->hugepage : false, (void*)&cache))
    {
       goto error;
    }
 
-   memset(cache, 0, struct_size + cache_size);
-   cache->valid_until = 0;
+   memset(cache, 0, struct_size + 2 * cache_size);
    cache->size = cache_size;
+   cache->building = false;
+   atomic_init(&cache->current, 0);
    atomic_init(&cache->lock, STATE_FREE);
+   atomic_init(&cache->refresh, STATE_FREE);
+
+   for (int i = 0; i < 2; i++)
+   {
+      atomic_init(&cache->buffers[i].sequence, 0);
+      cache->buffers[i].valid_until = 0;
+      cache->buffers[i].created = 0;
+      cache->buffers[i].length = 0;
+   }
 
    *p_shmem = cache;
-   *p_size = cache_size + struct_size;
+   *p_size = 2 * cache_size + struct_size;
 
    return 0;
 
@@ -76,54 +92,252 @@ bool
 pgexporter_cache_is_valid(struct prometheus_cache* cache)
 {
    time_t now;
+   time_t created;
+   time_t valid_until;
+   size_t length;
+
+   if (cache == NULL)
+   {
+      return false;
+   }
 
-   if (cache == NULL || cache->valid_until == 0 || strlen(cache->data) == 0)
+   cache_read_header(cache, &created, &valid_until, &length);
+
+   if (valid_until == 0 || length == 0)
    {
       return false;
    }
 
    now = time(NULL);
-   return now <= cache->valid_until;
+   return now <= valid_until;
+}
+
+bool
+pgexporter_cache_is_stale(struct prometheus_cache* cache, pgexporter_time_t max_stale)
+{
+   time_t now;
+   time_t created;
+   time_t valid_until;
+   size_t length;
+
+   if (cache == NULL || !pgexporter_time_is_valid(max_stale))
+   {
+      return false;
+   }
+
+   cache_read_header(cache, &created, &valid_until, &length);
+
+   if (valid_until == 0 || length == 0)
+   {
+      return false;
+   }
+
+   now = time(NULL);
+   return now > valid_until && now <= valid_until + pgexporter_time_convert(max_stale, FORMAT_TIME_S);
+}
+
+int
+pgexporter_cache_get(struct prometheus_cache* cache, char** data, size_t* length, time_t* created, time_t* valid_until)
+{
+   return pgexporter_cache_get_encoded(cache, CONTENT_ENCODING_IDENTITY, data, length, created, valid_until);
+}
+
+int
+pgexporter_cache_get_encoded(struct prometheus_cache* cache, int encoding, char** data, size_t* length, time_t* created, time_t* valid_until)
+{
+   char* copy = NULL;
+   size_t capacity = 0;
+   size_t offset = 0;
+   bool present = false;
+   unsigned int sequence;
+   int index;
+   struct prometheus_cache_buffer* buffer = NULL;
+
+   *data = NULL;
+   *length = 0;
+   *created = 0;
+   *valid_until = 0;
+
+   if (cache == NULL || cache->size == 0 || encoding < CONTENT_ENCODING_IDENTITY || encoding >= NUMBER_OF_CONTENT_ENCODINGS)
+   {
+      return 1;
+   }
+
+   for (;;)
+   {
+      index = atomic_load(&cache->current);
+      buffer = &cache->buffers[index];
+
+      sequence = atomic_load(&buffer->sequence);
+      if (sequence & 1)
+      {
+         /* Only the buffer that is not published is written */
+         continue;
+      }
+
+      *created = buffer->created;
+      *valid_until = buffer->valid_until;
+
+      present = cache_payload(cache, buffer, encoding, &offset, length);
+
+      if (present)
+      {
+         if (capacity < *length + 1)
+         {
+            char* c = realloc(copy, *length + 1);
+            if (c == NULL)
+            {
+               goto error;
+            }
+            copy = c;
+            capacity = *length + 1;
+         }
+
+         memcpy(copy, cache_buffer(cache, index) + offset, *length);
+      }
+
+      atomic_thread_fence(memory_order_acquire);
+
+      if (atomic_load(&buffer->sequence) == sequence)
+      {
+         break;
+      }
+   }
+
+   if (!present || *valid_until == 0)
+   {
+      free(copy);
+      *length = 0;
+      return 1;
+   }
+
+   copy[*length] = '\0';
+   *data = copy;
+
+   return 0;
+
+error:
+   free(copy);
+   *length = 0;
+
+   return 1;
 }
 
 void
 pgexporter_cache_invalidate(struct prometheus_cache* cache)
 {
+   struct prometheus_cache_buffer* buffer = NULL;
+
    if (cache == NULL)
    {
       return;
    }
 
-   memset(cache->data, 0, cache->size);
-   cache->valid_until = 0;
+   buffer = &cache->buffers[atomic_load(&cache->current)];
+
+   cache_write_begin(buffer);
+   buffer->valid_until = 0;
+   buffer->created = 0;
+   buffer->length = 0;
+   memset(buffer->encoded_length, 0, sizeof(buffer->encoded_length));
+   cache_write_end(buffer);
+
+   /* Start the payload being built over */
+   if (cache->building)
+   {
+      buffer = &cache->buffers[1 - atomic_load(&cache->current)];
+      buffer->length = 0;
+      memset(buffer->encoded_length, 0, sizeof(buffer->encoded_length));
+   }
 }
 
 bool
 pgexporter_cache_append(struct prometheus_cache* cache, char* data)
 {
-   size_t origin_length = 0;
    size_t append_length = 0;
+   int index;
+   struct prometheus_cache_buffer* buffer = NULL;
 
    if (cache == NULL || data == NULL)
    {
       return false;
    }
 
-   origin_length = strlen(cache->data);
+   index = 1 - atomic_load(&cache->current);
+   buffer = &cache->buffers[index];
+
+   if (!cache->building)
+   {
+      cache_write_begin(buffer);
+      buffer->length = 0;
+      cache->building = true;
+   }
+
    append_length = strlen(data);
 
-   if (origin_length + append_length >= cache->size)
+   /* The compressed copies are laid out after the payload */
+   memset(buffer->encoded_length, 0, sizeof(buffer->encoded_length));
+
+   if (buffer->length + append_length >= cache->size)
    {
       pgexporter_log_debug("Cannot append %d bytes to the cache because it will overflow the size of %d bytes (currently at %d bytes).",
                            append_length,
                            cache->size,
-                           origin_length);
+                           buffer->length);
       pgexporter_cache_invalidate(cache);
       return false;
    }
 
-   memcpy(cache->data + origin_length, data, append_length);
-   cache->data[origin_length + append_length] = '\0';
+   memcpy(cache_buffer(cache, index) + buffer->length, data, append_length);
+   buffer->length += append_length;
+   cache_buffer(cache, index)[buffer->length] = '\0';
+
+   return true;
+}
+
+bool
+pgexporter_cache_append_encoded(struct prometheus_cache* cache, int encoding, void* data, size_t length)
+{
+   size_t offset = 0;
+   int index;
+   struct prometheus_cache_buffer* buffer = NULL;
+
+   if (cache == NULL || data == NULL || length == 0 ||
+       encoding <= CONTENT_ENCODING_IDENTITY || encoding >= NUMBER_OF_CONTENT_ENCODINGS)
+   {
+      return false;
+   }
+
+   if (!cache->building)
+   {
+      return false;
+   }
+
+   index = 1 - atomic_load(&cache->current);
+   buffer = &cache->buffers[index];
+
+   for (int i = encoding; i < NUMBER_OF_CONTENT_ENCODINGS; i++)
+   {
+      buffer->encoded_length[i] = 0;
+   }
+
+   offset = buffer->length + 1;
+   for (int i = CONTENT_ENCODING_IDENTITY + 1; i < encoding; i++)
+   {
+      offset += buffer->encoded_length[i];
+   }
+
+   if (offset + length > cache->size)
+   {
+      pgexporter_log_debug("Cannot append %zu encoded bytes to the cache because it will overflow the size of %zu bytes (currently at %zu bytes).",
+                           length,
+                           cache->size,
+                           offset);
+      return false;
+   }
+
+   memcpy(cache_buffer(cache, index) + offset, data, length);
+   buffer->encoded_length[encoding] = length;
 
    return true;
 }
@@ -132,14 +346,116 @@ bool
 pgexporter_cache_finalize(struct prometheus_cache* cache, pgexporter_time_t max_age)
 {
    time_t now;
+   int index;
+   struct prometheus_cache_buffer* buffer = NULL;
 
    if (cache == NULL)
    {
       return false;
    }
 
+   index = 1 - atomic_load(&cache->current);
+   buffer = &cache->buffers[index];
+
+   if (!cache->building)
+   {
+      cache_write_begin(buffer);
+      buffer->length = 0;
+      memset(buffer->encoded_length, 0, sizeof(buffer->encoded_length));
+   }
+
    now = time(NULL);
-   cache->valid_until = now + pgexporter_time_convert(max_age, FORMAT_TIME_S);
+   buffer->created = now;
+   buffer->valid_until = now + pgexporter_time_convert(max_age, FORMAT_TIME_S);
+   cache_write_end(buffer);
+
+   cache->building = false;
+
+   /* Publish */
+   atomic_store(&cache->current, index);
 
-   return cache->valid_until > now;
+   return buffer->valid_until > now;
+}
+
+static char*
+cache_buffer(struct prometheus_cache* cache, int index)
+{
+   return cache->data + (size_t)index * cache->size;
+}
+
+static void
+cache_write_begin(struct prometheus_cache_buffer* buffer)
+{
+   atomic_fetch_add(&buffer->sequence, 1);
+   atomic_thread_fence(memory_order_release);
+}
+
+static void
+cache_write_end(struct prometheus_cache_buffer* buffer)
+{
+   atomic_thread_fence(memory_order_release);
+   atomic_fetch_add(&buffer->sequence, 1);
+}
+
+static void
+cache_read_header(struct prometheus_cache* cache, time_t* created, time_t* valid_until, size_t* length)
+{
+   unsigned int sequence;
+   struct prometheus_cache_buffer* buffer = NULL;
+
+   for (;;)
+   {
+      buffer = &cache->buffers[atomic_load(&cache->current)];
+
+      sequence = atomic_load(&buffer->sequence);
+      if (sequence & 1)
+      {
+         continue;
+      }
+
+      *created = buffer->created;
+      *valid_until = buffer->valid_until;
+      *length = buffer->length;
+
+      atomic_thread_fence(memory_order_acquire);
+
+      if (atomic_load(&buffer->sequence) == sequence)
+      {
+         return;
+      }
+   }
+}
+
+static bool
+cache_payload(struct prometheus_cache* cache, struct prometheus_cache_buffer* buffer, int encoding, size_t* offset, size_t* length)
+{
+   *offset = 0;
+   *length = buffer->length;
+
+   if (*length == 0 || *length >= cache->size)
+   {
+      *length = 0;
+      return false;
+   }
+
+   if (encoding == CONTENT_ENCODING_IDENTITY)
+   {
+      return true;
+   }
+
+   *offset = buffer->length + 1;
+   for (int i = CONTENT_ENCODING_IDENTITY + 1; i < encoding; i++)
+   {
+      *offset += buffer->encoded_length[i];
+   }
+   *length = buffer->encoded_length[encoding];
+
+   /* The lengths may be torn, so the copy is bounded by the buffer */
+   if (*length == 0 || *offset + *length > cache->size)
+   {
+      *length = 0;
+      return false;
+   }
+
+   return true;
 }
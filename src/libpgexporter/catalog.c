@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgexporter */
+#include <pgexporter.h>
+#include <catalog.h>
+#include <logging.h>
+#include <pg_query_alts.h>
+#include <shmem.h>
+#include <utils.h>
+
+/* system */
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef PGEXPORTER_CATALOG_BOOTSTRAP
+/* pgexporter-gencatalog generates the catalog, so it is built without one */
+#define CATALOG_NUMBER_OF_METRICS      0
+#define CATALOG_NUMBER_OF_METRIC_NAMES 0
+
+static const struct catalog_metric* catalog_metrics = NULL;
+static const char* const* catalog_metric_names = NULL;
+#else
+#include <catalog_data.h>
+#endif
+
+static char* column_type(int type);
+static char* sort_type(int type);
+static char* server_query_type(int type);
+static int count_alts(struct pg_query_alts* root);
+static void collect_alts(struct pg_query_alts* root, struct pg_query_alts** alts, int* n);
+static void write_string(FILE* file, char* str);
+
+int
+pgexporter_catalog_load(struct configuration* config, int prometheus_idx, int* number_of_metrics)
+{
+   const struct catalog_metric* metric = NULL;
+   const struct catalog_query* query = NULL;
+   struct prometheus* prom = NULL;
+   struct pg_query_alts* new_query = NULL;
+   void* new_query_shmem = NULL;
+
+   if (prometheus_idx + CATALOG_NUMBER_OF_METRICS > NUMBER_OF_METRICS)
+   {
+      pgexporter_log_error("The number of metrics exceed the maximum limit of %d.", NUMBER_OF_METRICS);
+      return 1;
+   }
+
+   for (int i = 0; i < CATALOG_NUMBER_OF_METRICS; i++)
+   {
+      metric = &catalog_metrics[i];
+      prom = &config->prometheus[prometheus_idx + i];
+
+      pgexporter_snprintf(prom->tag, PROMETHEUS_LENGTH, "%s", metric->tag);
+      pgexporter_snprintf(prom->collector, MAX_COLLECTOR_LENGTH, "%s", metric->collector);
+      prom->sort_type = metric->sort_type;
+      prom->server_query_type = metric->server_query_type;
+      prom->exec_on_all_dbs = metric->exec_on_all_dbs;
+      prom->optional = metric->optional;
+      prom->interval.ms = metric->interval;
+
+      for (int j = 0; j < metric->n_queries; j++)
+      {
+         query = &metric->queries[j];
+
+         if (pgexporter_create_shared_memory(sizeof(struct pg_query_alts), HUGEPAGE_OFF, &new_query_shmem))
+         {
+            return 1;
+         }
+         new_query = (struct pg_query_alts*)new_query_shmem;
+
+         new_query->pg_version = (char)query->pg_version;
+         new_query->node.is_histogram = query->is_histogram;
+         new_query->node.n_columns = MIN(query->n_columns, MAX_NUMBER_OF_COLUMNS);
+         pgexporter_snprintf(new_query->node.query, MAX_QUERY_LENGTH, "%s", query->query);
+
+         for (int k = 0; k < new_query->node.n_columns; k++)
+         {
+            new_query->node.columns[k].type = query->columns[k].type;
+            pgexporter_snprintf(new_query->node.columns[k].name, PROMETHEUS_LENGTH, "%s", query->columns[k].name);
+            pgexporter_snprintf(new_query->node.columns[k].description, PROMETHEUS_LENGTH, "%s", query->columns[k].description);
+         }
+
+         prom->pg_root = pgexporter_insert_pg_node_avl(prom->pg_root, &new_query);
+      }
+   }
+
+   for (int i = 0; i < CATALOG_NUMBER_OF_METRIC_NAMES; i++)
+   {
+      if (config->number_of_metric_names < NUMBER_OF_METRIC_NAMES)
+      {
+         pgexporter_snprintf(config->metric_names[config->number_of_metric_names],
+                             PROMETHEUS_LENGTH,
+                             "%s",
+                             catalog_metric_names[i]);
+         config->number_of_metric_names++;
+      }
+      else
+      {
+         pgexporter_log_warn("Maximum metric names reached, skipping: %s", catalog_metric_names[i]);
+      }
+   }
+
+   *number_of_metrics += CATALOG_NUMBER_OF_METRICS;
+
+   return 0;
+}
+
+int
+pgexporter_catalog_write(struct configuration* config, FILE* file)
+{
+   struct prometheus* prom = NULL;
+   struct pg_query_alts** alts = NULL;
+   int n = 0;
+
+   if (config->number_of_metrics == 0)
+   {
+      pgexporter_log_error("No metrics for the catalog");
+      goto error;
+   }
+
+   fprintf(file, "/* Generated by pgexporter-gencatalog from INTERNAL_YAML, do not edit */\n\n");
+   fprintf(file, "#define CATALOG_NUMBER_OF_METRICS      %d\n", config->number_of_metrics);
+   fprintf(file, "#define CATALOG_NUMBER_OF_METRIC_NAMES %d\n\n", config->number_of_metric_names);
+
+   /* Columns, then the queries using them, then the metrics using those */
+   for (int i = 0; i < config->number_of_metrics; i++)
+   {
+      prom = &config->prometheus[i];
+
+      if (prom->ext_root != NULL)
+      {
+         pgexporter_log_error("Extension queries in the catalog: %s", prom->tag);
+         goto error;
+      }
+
+      n = 0;
+      alts = (struct pg_query_alts**)malloc(sizeof(struct pg_query_alts*) * MAX(count_alts(prom->pg_root), 1));
+      if (alts == NULL)
+      {
+         goto error;
+      }
+      collect_alts(prom->pg_root, alts, &n);
+
+      for (int j = 0; j < n; j++)
+      {
+         if (alts[j]->node.n_columns == 0)
+         {
+            continue;
+         }
+
+         fprintf(file, "static const struct catalog_column catalog_columns_%d_%d[] = {\n", i, j);
+         for (int k = 0; k < alts[j]->node.n_columns; k++)
+         {
+            fprintf(file, "   {%s, ", column_type(alts[j]->node.columns[k].type));
+            write_string(file, alts[j]->node.columns[k].name);
+            fprintf(file, ", ");
+            write_string(file, alts[j]->node.columns[k].description);
+            fprintf(file, "},\n");
+         }
+         fprintf(file, "};\n\n");
+      }
+
+      if (n > 0)
+      {
+         fprintf(file, "static const struct catalog_query catalog_queries_%d[] = {\n", i);
+         for (int j = 0; j < n; j++)
+         {
+            fprintf(file, "   {%d, %s,\n    ", alts[j]->pg_version, alts[j]->node.is_histogram ? "true" : "false");
+            write_string(file, alts[j]->node.query);
+            if (alts[j]->node.n_columns > 0)
+            {
+               fprintf(file, ",\n    %d, catalog_columns_%d_%d},\n", alts[j]->node.n_columns, i, j);
+            }
+            else
+            {
+               fprintf(file, ",\n    0, NULL},\n");
+            }
+         }
+         fprintf(file, "};\n\n");
+      }
+
+      free(alts);
+      alts = NULL;
+   }
+
+   fprintf(file, "static const struct catalog_metric catalog_metrics[] = {\n");
+   for (int i = 0; i < config->number_of_metrics; i++)
+   {
+      prom = &config->prometheus[i];
+      n = count_alts(prom->pg_root);
+
+      fprintf(file, "   {");
+      write_string(file, prom->tag);
+      fprintf(file, ", ");
+      write_string(file, prom->collector);
+      fprintf(file, ", %s, %s, %s, %s, %" PRId64 ", %d, ",
+              sort_type(prom->sort_type), server_query_type(prom->server_query_type),
+              prom->exec_on_all_dbs ? "true" : "false", prom->optional ? "true" : "false",
+              prom->interval.ms, n);
+      if (n > 0)
+      {
+         fprintf(file, "catalog_queries_%d},\n", i);
+      }
+      else
+      {
+         fprintf(file, "NULL},\n");
+      }
+   }
+   fprintf(file, "};\n\n");
+
+   fprintf(file, "static const char* const catalog_metric_names[] = {\n");
+   for (int i = 0; i < config->number_of_metric_names; i++)
+   {
+      fprintf(file, "   ");
+      write_string(file, config->metric_names[i]);
+      fprintf(file, ",\n");
+   }
+   if (config->number_of_metric_names == 0)
+   {
+      fprintf(file, "   NULL,\n");
+   }
+   fprintf(file, "};\n");
+
+   if (ferror(file))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+   free(alts);
+
+   return 1;
+}
+
+static char*
+column_type(int type)
+{
+   switch (type)
+   {
+      case COUNTER_TYPE:
+         return "COUNTER_TYPE";
+      case GAUGE_TYPE:
+         return "GAUGE_TYPE";
+      case HISTOGRAM_TYPE:
+         return "HISTOGRAM_TYPE";
+      default:
+         return "LABEL_TYPE";
+   }
+}
+
+static char*
+sort_type(int type)
+{
+   return type == SORT_DATA0 ? "SORT_DATA0" : "SORT_NAME";
+}
+
+static char*
+server_query_type(int type)
+{
+   switch (type)
+   {
+      case SERVER_QUERY_PRIMARY:
+         return "SERVER_QUERY_PRIMARY";
+      case SERVER_QUERY_REPLICA:
+         return "SERVER_QUERY_REPLICA";
+      default:
+         return "SERVER_QUERY_BOTH";
+   }
+}
+
+static int
+count_alts(struct pg_query_alts* root)
+{
+   if (root == NULL)
+   {
+      return 0;
+   }
+
+   return count_alts(root->left) + 1 + count_alts(root->right);
+}
+
+static void
+collect_alts(struct pg_query_alts* root, struct pg_query_alts** alts, int* n)
+{
+   if (root == NULL)
+   {
+      return;
+   }
+
+   collect_alts(root->left, alts, n);
+   alts[(*n)++] = root;
+   collect_alts(root->right, alts, n);
+}
+
+static void
+write_string(FILE* file, char* str)
+{
+   size_t length = strlen(str);
+   unsigned char c;
+
+   fputc('"', file);
+
+   for (size_t i = 0; i < length; i++)
+   {
+      c = (unsigned char)str[i];
+
+      switch (c)
+      {
+         case '"':
+         case '\\':
+         case '?':
+            /* '?' is escaped against trigraphs */
+            fprintf(file, "\\%c", c);
+            break;
+         case '\n':
+            /* One line of a query per literal */
+            if (i + 1 < length)
+            {
+               fprintf(file, "\\n\"\n    \"");
+            }
+            else
+            {
+               fprintf(file, "\\n");
+            }
+            break;
+         case '\t':
+            fprintf(file, "\\t");
+            break;
+         default:
+            if (c < 0x20 || c == 0x7f)
+            {
+               fprintf(file, "\\%03o", c);
+            }
+            else
+            {
+               fputc(c, file);
+            }
+            break;
+      }
+   }
+
+   fputc('"', file);
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgexporter */
+#include <pgexporter.h>
+#include <art.h>
+#include <column_store.h>
+#include <queries.h>
+#include <utils.h>
+
+/* system */
+#include <stdint.h>
+
+void
+pgexporter_column_store_add(struct column_store* store, struct column_node* node, int sort_type)
+{
+   if (!store->columns)
+   {
+      store->columns = node;
+      store->last_column = node;
+      return;
+   }
+
+   if (sort_type == SORT_DATA0)
+   {
+      // SORT_DATA0 means sorting according to the first data (data[0]) in a tuple.
+      // Usually it is the application/database column, so tuples with same such column values
+      // are grouped together. The groups keep the order in which they first appear, with the
+      // NULL group last, and each group grows at its front. A group is found through the node
+      // in front of it, so an insert doesn't walk the list.
+      struct column_node* before = store->last_column;
+      char* cur_d0 = node->tuple != NULL ? pgexporter_get_column(0, node->tuple) : NULL;
+
+      if (node->tuple == NULL)
+      {
+         // Rows without a tuple go last
+      }
+      else if (cur_d0 == NULL)
+      {
+         if (store->has_nulls)
+         {
+            before = store->null_last;
+         }
+         else
+         {
+            store->has_nulls = true;
+            store->null_last = before;
+         }
+      }
+      else
+      {
+         if (store->groups == NULL)
+         {
+            pgexporter_art_create(&store->groups);
+         }
+
+         struct column_node* group = (struct column_node*)pgexporter_art_search(store->groups, cur_d0);
+
+         if (group != NULL)
+         {
+            before = group;
+         }
+         else
+         {
+            // A new group goes in front of the NULL group
+            if (store->has_nulls)
+            {
+               before = store->null_last;
+               store->null_last = node;
+            }
+
+            pgexporter_art_insert(store->groups, cur_d0, (uintptr_t)before, ValueRef);
+         }
+      }
+
+      node->next = before->next;
+      before->next = node;
+
+      if (node->next == NULL)
+      {
+         store->last_column = node;
+      }
+   }
+   else
+   {
+      // The tuple can be null for SORT_NAME
+      // Default sort as SORT_NAME
+      store->last_column->next = node;
+      store->last_column = node;
+   }
+}
+
+int
+pgexporter_column_store_find(struct art* index, char* tag, char* name, int type, int sort_type)
+{
+   char key[2 * PROMETHEUS_LENGTH + 32];
+
+   if (index == NULL)
+   {
+      return -1;
+   }
+
+   pgexporter_snprintf(key, sizeof(key), "%s\x1f%s\x1f%d\x1f%d", tag, name, type, sort_type);
+
+   return (int)pgexporter_art_search(index, key) - 1;
+}
+
+void
+pgexporter_column_store_index(struct art* index, char* tag, char* name, int type, int sort_type, int slot)
+{
+   char key[2 * PROMETHEUS_LENGTH + 32];
+
+   if (index == NULL)
+   {
+      return;
+   }
+
+   pgexporter_snprintf(key, sizeof(key), "%s\x1f%s\x1f%d\x1f%d", tag, name, type, sort_type);
+
+   pgexporter_art_insert(index, key, (uintptr_t)(slot + 1), ValueRef);
+}
+
+void
+pgexporter_column_store_destroy(struct column_store* store, int n)
+{
+   for (int i = 0; i < n; i++)
+   {
+      pgexporter_art_destroy(store[i].groups);
+      store[i].groups = NULL;
+   }
+}
@@ -84,9 +84,9 @@ static int as_milliseconds(char* str, pgexporter_time_t* time, pgexporter_time_t
 static int as_bytes(char* str, long* bytes, long default_bytes);
 static int as_endpoints(char* str, struct configuration* config, bool reload);
 static bool transfer_configuration(struct configuration* config, struct configuration* reload);
+static bool is_same_metrics(struct configuration* config, struct configuration* reload);
 static void copy_server(struct server* dst, struct server* src);
 static void copy_user(struct user* dst, struct user* src);
-static void copy_promethus(struct prometheus* dst, struct prometheus* src);
 static void copy_endpoint(struct endpoint* dst, struct endpoint* src);
 static int restart_bool(char* name, bool e, bool n);
 static int restart_int(char* name, int e, int n);
@@ -95,6 +95,8 @@ static bool is_same_tls(struct server* src, struct server* dst);
 static bool is_same_global_tls(struct configuration* src, struct configuration* dst);
 
 static bool is_empty_string(char* s);
+static void validate_query_workers(struct configuration* config);
+static void validate_http_workers(struct configuration* config);
 
 static void add_configuration_response(struct json* res);
 static void add_servers_configuration_response(struct json* res);
@@ -119,6 +121,11 @@ pgexporter_init_configuration(void* shm)
 
    config->metrics = -1;
    config->metrics_query_timeout = PGEXPORTER_TIME_DISABLED;
+   config->metrics_query_workers = 1;
+   config->metrics_query_async = false;
+   config->metrics_scrape_timeout = PGEXPORTER_TIME_DISABLED;
+   config->metrics_collector_interval = PGEXPORTER_TIME_DISABLED;
+   config->metrics_pool_idle_timeout = PGEXPORTER_TIME_DISABLED;
    config->cache = true;
    config->alerts_enabled = false;
    config->number_of_metric_names = 0;
@@ -140,6 +147,10 @@ pgexporter_init_configuration(void* shm)
 
    config->blocking_timeout = PGEXPORTER_TIME_SEC(30);
    config->authentication_timeout = PGEXPORTER_TIME_SEC(5);
+   config->http_keep_alive_timeout = PGEXPORTER_TIME_DISABLED;
+   config->http_keep_alive_max_requests = 100;
+   config->http_workers = 0;
+   config->http_worker_max_requests = 0;
 
    config->keep_alive = true;
    config->nodelay = true;
@@ -153,6 +164,9 @@ pgexporter_init_configuration(void* shm)
    config->log_level = PGEXPORTER_LOGGING_LEVEL_INFO;
    config->log_mode = PGEXPORTER_LOGGING_MODE_APPEND;
    atomic_init(&config->log_lock, STATE_FREE);
+   atomic_init(&config->scram_keys_lock, STATE_FREE);
+   atomic_init(&config->query_tags_lock, STATE_FREE);
+   atomic_init(&config->number_of_query_tags, 0);
 
    atomic_init(&config->logging_info, 0);
    atomic_init(&config->logging_warn, 0);
@@ -161,6 +175,11 @@ pgexporter_init_configuration(void* shm)
    atomic_init(&config->query_executions_total, 0);
    atomic_init(&config->query_errors_total, 0);
    atomic_init(&config->query_timeouts_total, 0);
+   atomic_init(&config->scrape_allocations, 0);
+   atomic_init(&config->scrape_allocated_bytes, 0);
+   atomic_init(&config->scrape_arena_blocks, 0);
+   atomic_init(&config->metrics_cache_hits, 0);
+   atomic_init(&config->metrics_cache_misses, 0);
 
    for (int i = 0; i < NUMBER_OF_METRICS; i++)
    {
@@ -288,7 +307,7 @@ pgexporter_read_configuration(void* shm, char* filename)
          }
          else
          {
-            if (pgexporter_starts_with(line, "unix_socket_dir") || pgexporter_starts_with(line, "metrics_path") || pgexporter_starts_with(line, "alerts_path") || pgexporter_starts_with(line, "log_path") || pgexporter_starts_with(line, "tls_cert_file") || pgexporter_starts_with(line, "tls_key_file") || pgexporter_starts_with(line, "tls_ca_file") || pgexporter_starts_with(line, "metrics_cert_file") || pgexporter_starts_with(line, "metrics_key_file") || pgexporter_starts_with(line, "metrics_ca_file"))
+            if (pgexporter_starts_with(line, "unix_socket_dir") || pgexporter_starts_with(line, "metrics_path") || pgexporter_starts_with(line, "metrics_yaml_cache") || pgexporter_starts_with(line, "alerts_path") || pgexporter_starts_with(line, "log_path") || pgexporter_starts_with(line, "tls_cert_file") || pgexporter_starts_with(line, "tls_key_file") || pgexporter_starts_with(line, "tls_ca_file") || pgexporter_starts_with(line, "metrics_cert_file") || pgexporter_starts_with(line, "metrics_key_file") || pgexporter_starts_with(line, "metrics_ca_file"))
             {
                extract_syskey_value(line, &key, &value);
             }
@@ -430,6 +449,20 @@ pgexporter_read_configuration(void* shm, char* filename)
                      unknown = true;
                   }
                }
+               else if (!strcmp(key, "metrics_cache_max_stale"))
+               {
+                  if (!strcmp(section, "pgexporter"))
+                  {
+                     if (as_milliseconds(value, &config->metrics_cache_max_stale, PGEXPORTER_TIME_DISABLED))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
                else if (!strcmp(key, "metrics_query_timeout"))
                {
                   if (!strcmp(section, "pgexporter"))
@@ -444,6 +477,76 @@ pgexporter_read_configuration(void* shm, char* filename)
                      unknown = true;
                   }
                }
+               else if (!strcmp(key, "metrics_query_workers"))
+               {
+                  if (!strcmp(section, "pgexporter"))
+                  {
+                     if (as_int(value, &config->metrics_query_workers))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "metrics_query_async"))
+               {
+                  if (!strcmp(section, "pgexporter"))
+                  {
+                     if (as_bool(value, &config->metrics_query_async))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "metrics_scrape_timeout"))
+               {
+                  if (!strcmp(section, "pgexporter"))
+                  {
+                     if (as_milliseconds(value, &config->metrics_scrape_timeout, PGEXPORTER_TIME_DISABLED))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "metrics_collector_interval"))
+               {
+                  if (!strcmp(section, "pgexporter"))
+                  {
+                     if (as_milliseconds(value, &config->metrics_collector_interval, PGEXPORTER_TIME_DISABLED))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "metrics_pool_idle_timeout"))
+               {
+                  if (!strcmp(section, "pgexporter"))
+                  {
+                     if (as_milliseconds(value, &config->metrics_pool_idle_timeout, PGEXPORTER_TIME_DISABLED))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
                else if (!strcmp(key, "bridge"))
                {
                   if (!strcmp(section, "pgexporter"))
@@ -802,6 +905,62 @@ pgexporter_read_configuration(void* shm, char* filename)
                      unknown = true;
                   }
                }
+               else if (!strcmp(key, "http_keep_alive_timeout"))
+               {
+                  if (!strcmp(section, "pgexporter"))
+                  {
+                     if (as_milliseconds(value, &config->http_keep_alive_timeout, PGEXPORTER_TIME_DISABLED))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "http_keep_alive_max_requests"))
+               {
+                  if (!strcmp(section, "pgexporter"))
+                  {
+                     if (as_int(value, &config->http_keep_alive_max_requests))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "http_workers"))
+               {
+                  if (!strcmp(section, "pgexporter"))
+                  {
+                     if (as_int(value, &config->http_workers))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "http_worker_max_requests"))
+               {
+                  if (!strcmp(section, "pgexporter"))
+                  {
+                     if (as_int(value, &config->http_worker_max_requests))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
                else if (!strcmp(key, "pidfile"))
                {
                   if (!strcmp(section, "pgexporter"))
@@ -1081,6 +1240,22 @@ pgexporter_read_configuration(void* shm, char* filename)
                      unknown = true;
                   }
                }
+               else if (!strcmp(key, "metrics_yaml_cache"))
+               {
+                  if (!strcmp(section, "pgexporter"))
+                  {
+                     max = strlen(value);
+                     if (max > MAX_PATH - 1)
+                     {
+                        max = MAX_PATH - 1;
+                     }
+                     memcpy(config->metrics_yaml_cache, value, max);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
                else if (!strcmp(key, "extensions"))
                {
                   if (!strcmp(section, "pgexporter"))
@@ -1356,9 +1531,56 @@ pgexporter_validate_configuration(void* shm)
       pgexporter_log_warn("metrics_query_timeout=%" PRId64 "ms is too low, using 50ms minimum", pgexporter_time_convert(config->metrics_query_timeout, FORMAT_TIME_MS));
       config->metrics_query_timeout = PGEXPORTER_TIME_MS(50);
    }
+
+   validate_query_workers(config);
+
+   if (config->http_keep_alive_max_requests < 1)
+   {
+      pgexporter_log_warn("http_keep_alive_max_requests=%d is too low, using 1", config->http_keep_alive_max_requests);
+      config->http_keep_alive_max_requests = 1;
+   }
+
+   validate_http_workers(config);
+
    return 0;
 }
 
+static void
+validate_query_workers(struct configuration* config)
+{
+   if (config->metrics_query_workers < 1)
+   {
+      pgexporter_log_warn("metrics_query_workers=%d is too low, using 1", config->metrics_query_workers);
+      config->metrics_query_workers = 1;
+   }
+   else if (config->metrics_query_workers > NUMBER_OF_SERVERS)
+   {
+      pgexporter_log_warn("metrics_query_workers=%d is too high, using %d", config->metrics_query_workers, NUMBER_OF_SERVERS);
+      config->metrics_query_workers = NUMBER_OF_SERVERS;
+   }
+}
+
+static void
+validate_http_workers(struct configuration* config)
+{
+   if (config->http_workers < 0)
+   {
+      pgexporter_log_warn("http_workers=%d is too low, using 0", config->http_workers);
+      config->http_workers = 0;
+   }
+   else if (config->http_workers > NUMBER_OF_HTTP_WORKERS)
+   {
+      pgexporter_log_warn("http_workers=%d is too high, using %d", config->http_workers, NUMBER_OF_HTTP_WORKERS);
+      config->http_workers = NUMBER_OF_HTTP_WORKERS;
+   }
+
+   if (config->http_worker_max_requests < 0)
+   {
+      pgexporter_log_warn("http_worker_max_requests=%d is too low, using 0", config->http_worker_max_requests);
+      config->http_worker_max_requests = 0;
+   }
+}
+
 /**
  *
  */
@@ -1866,17 +2088,28 @@ pgexporter_reload_configuration(bool* r)
       }
    }
 
-   if (pgexporter_read_internal_yaml_metrics(reload, true))
+   pgexporter_metrics_stamp(reload->metrics_path, &reload->metrics_stamp);
+
+   /* The internal metrics are part of the binary, so an unchanged set of
+    * metrics files gives the metrics already loaded */
+   if (is_same_metrics(config, reload))
    {
-      goto error;
+      pgexporter_log_debug("Reload: Metrics unchanged");
    }
-
-   if (strlen(reload->metrics_path) > 0)
+   else
    {
-      if (pgexporter_read_metrics_configuration((void*)reload))
+      if (pgexporter_read_internal_yaml_metrics(reload, true))
       {
          goto error;
       }
+
+      if (strlen(reload->metrics_path) > 0)
+      {
+         if (pgexporter_read_metrics_configuration((void*)reload))
+         {
+            goto error;
+         }
+      }
    }
 
    if (pgexporter_validate_configuration(reload))
@@ -1896,11 +2129,8 @@ pgexporter_reload_configuration(bool* r)
 
    *r = transfer_configuration(config, reload);
 
-   /* Free Old Query Alts AVL Tree */
-   for (int i = 0; reload != NULL && i < reload->number_of_metrics; i++)
-   {
-      pgexporter_free_pg_query_alts(reload);
-   }
+   /* Free the Query Alts AVL Trees not moved to the configuration */
+   pgexporter_free_pg_query_alts(reload);
    pgexporter_free_extension_query_alts(reload);
 
    pgexporter_destroy_shared_memory((void*)reload, reload_size);
@@ -1911,12 +2141,12 @@ pgexporter_reload_configuration(bool* r)
 
 error:
 
-   /* Free Old Query Alts AVL Tree */
-   for (int i = 0; reload != NULL && i < reload->number_of_metrics; i++)
+   /* Free the Query Alts AVL Trees */
+   if (reload != NULL)
    {
       pgexporter_free_pg_query_alts(reload);
+      pgexporter_free_extension_query_alts(reload);
    }
-   pgexporter_free_extension_query_alts(reload);
 
    pgexporter_destroy_shared_memory((void*)reload, reload_size);
 
@@ -1925,6 +2155,12 @@ error:
    return 1;
 }
 
+int
+pgexporter_parse_time(char* str, pgexporter_time_t* time)
+{
+   return as_milliseconds(str, time, PGEXPORTER_TIME_DISABLED);
+}
+
 void
 pgexporter_conf_get(SSL* ssl __attribute__((unused)), int client_fd, uint8_t compression, uint8_t encryption, struct json* payload)
 {
@@ -2199,6 +2435,14 @@ pgexporter_conf_set(SSL* ssl __attribute__((unused)), int client_fd, uint8_t com
          }
          pgexporter_json_put(response, key, (uintptr_t)pgexporter_time_convert(config->metrics_cache_max_age, FORMAT_TIME_S), ValueInt64);
       }
+      else if (!strcmp(key, "metrics_cache_max_stale"))
+      {
+         if (as_milliseconds(config_value, &config->metrics_cache_max_stale, PGEXPORTER_TIME_DISABLED))
+         {
+            unknown = true;
+         }
+         pgexporter_json_put(response, key, (uintptr_t)pgexporter_time_convert(config->metrics_cache_max_stale, FORMAT_TIME_S), ValueInt64);
+      }
       else if (!strcmp(key, "metrics_query_timeout"))
       {
          if (as_milliseconds(config_value, &config->metrics_query_timeout, PGEXPORTER_TIME_DISABLED))
@@ -2207,6 +2451,31 @@ pgexporter_conf_set(SSL* ssl __attribute__((unused)), int client_fd, uint8_t com
          }
          pgexporter_json_put(response, key, (uintptr_t)pgexporter_time_convert(config->metrics_query_timeout, FORMAT_TIME_MS), ValueInt64);
       }
+      else if (!strcmp(key, "metrics_query_workers"))
+      {
+         if (as_int(config_value, &config->metrics_query_workers))
+         {
+            unknown = true;
+         }
+         validate_query_workers(config);
+         pgexporter_json_put(response, key, (uintptr_t)config->metrics_query_workers, ValueInt64);
+      }
+      else if (!strcmp(key, "metrics_query_async"))
+      {
+         if (as_bool(config_value, &config->metrics_query_async))
+         {
+            unknown = true;
+         }
+         pgexporter_json_put(response, key, (uintptr_t)config->metrics_query_async, ValueBool);
+      }
+      else if (!strcmp(key, "metrics_scrape_timeout"))
+      {
+         if (as_milliseconds(config_value, &config->metrics_scrape_timeout, PGEXPORTER_TIME_DISABLED))
+         {
+            unknown = true;
+         }
+         pgexporter_json_put(response, key, (uintptr_t)pgexporter_time_convert(config->metrics_scrape_timeout, FORMAT_TIME_MS), ValueInt64);
+      }
       else if (!strcmp(key, "metrics_path"))
       {
          max = strlen(config_value);
@@ -2217,6 +2486,17 @@ pgexporter_conf_set(SSL* ssl __attribute__((unused)), int client_fd, uint8_t com
          memcpy(config->metrics_path, config_value, max);
          pgexporter_json_put(response, key, (uintptr_t)config->metrics_path, ValueString);
       }
+      else if (!strcmp(key, "metrics_yaml_cache"))
+      {
+         max = strlen(config_value);
+         if (max > MAX_PATH - 1)
+         {
+            max = MAX_PATH - 1;
+         }
+         memset(config->metrics_yaml_cache, 0, MAX_PATH);
+         memcpy(config->metrics_yaml_cache, config_value, max);
+         pgexporter_json_put(response, key, (uintptr_t)config->metrics_yaml_cache, ValueString);
+      }
       else if (!strcmp(key, "bridge"))
       {
          if (as_int(config_value, &config->bridge))
@@ -2440,6 +2720,40 @@ pgexporter_conf_set(SSL* ssl __attribute__((unused)), int client_fd, uint8_t com
          }
          pgexporter_json_put(response, key, (uintptr_t)pgexporter_time_convert(config->blocking_timeout, FORMAT_TIME_S), ValueInt64);
       }
+      else if (!strcmp(key, "http_keep_alive_timeout"))
+      {
+         if (as_milliseconds(config_value, &config->http_keep_alive_timeout, PGEXPORTER_TIME_DISABLED))
+         {
+            unknown = true;
+         }
+         pgexporter_json_put(response, key, (uintptr_t)pgexporter_time_convert(config->http_keep_alive_timeout, FORMAT_TIME_S), ValueInt64);
+      }
+      else if (!strcmp(key, "http_keep_alive_max_requests"))
+      {
+         if (as_int(config_value, &config->http_keep_alive_max_requests))
+         {
+            unknown = true;
+         }
+         pgexporter_json_put(response, key, (uintptr_t)config->http_keep_alive_max_requests, ValueInt64);
+      }
+      else if (!strcmp(key, "http_workers"))
+      {
+         if (as_int(config_value, &config->http_workers))
+         {
+            unknown = true;
+         }
+         validate_http_workers(config);
+         pgexporter_json_put(response, key, (uintptr_t)config->http_workers, ValueInt64);
+      }
+      else if (!strcmp(key, "http_worker_max_requests"))
+      {
+         if (as_int(config_value, &config->http_worker_max_requests))
+         {
+            unknown = true;
+         }
+         validate_http_workers(config);
+         pgexporter_json_put(response, key, (uintptr_t)config->http_worker_max_requests, ValueInt64);
+      }
       else if (!strcmp(key, "pidfile"))
       {
          max = strlen(config_value);
@@ -2660,9 +2974,16 @@ add_configuration_response(struct json* res)
    pgexporter_json_put(res, CONFIGURATION_ARGUMENT_UNIX_SOCKET_DIR, (uintptr_t)config->unix_socket_dir, ValueString);
    pgexporter_json_put(res, CONFIGURATION_ARGUMENT_METRICS, (uintptr_t)config->metrics, ValueInt64);
    pgexporter_json_put(res, CONFIGURATION_ARGUMENT_METRICS_PATH, (uintptr_t)config->metrics_path, ValueString);
+   pgexporter_json_put(res, CONFIGURATION_ARGUMENT_METRICS_YAML_CACHE, (uintptr_t)config->metrics_yaml_cache, ValueString);
    pgexporter_json_put_time_value(res, CONFIGURATION_ARGUMENT_METRICS_CACHE_MAX_AGE, config->metrics_cache_max_age, FORMAT_TIME_S);
+   pgexporter_json_put_time_value(res, CONFIGURATION_ARGUMENT_METRICS_CACHE_MAX_STALE, config->metrics_cache_max_stale, FORMAT_TIME_S);
    pgexporter_json_put_size_value(res, CONFIGURATION_ARGUMENT_METRICS_CACHE_MAX_SIZE, config->metrics_cache_max_size);
    pgexporter_json_put_time_value(res, CONFIGURATION_ARGUMENT_METRICS_QUERY_TIMEOUT, config->metrics_query_timeout, FORMAT_TIME_MS);
+   pgexporter_json_put(res, CONFIGURATION_ARGUMENT_METRICS_QUERY_WORKERS, (uintptr_t)config->metrics_query_workers, ValueInt64);
+   pgexporter_json_put(res, CONFIGURATION_ARGUMENT_METRICS_QUERY_ASYNC, (uintptr_t)config->metrics_query_async, ValueBool);
+   pgexporter_json_put_time_value(res, CONFIGURATION_ARGUMENT_METRICS_SCRAPE_TIMEOUT, config->metrics_scrape_timeout, FORMAT_TIME_MS);
+   pgexporter_json_put_time_value(res, CONFIGURATION_ARGUMENT_METRICS_COLLECTOR_INTERVAL, config->metrics_collector_interval, FORMAT_TIME_S);
+   pgexporter_json_put_time_value(res, CONFIGURATION_ARGUMENT_METRICS_POOL_IDLE_TIMEOUT, config->metrics_pool_idle_timeout, FORMAT_TIME_S);
    pgexporter_json_put(res, CONFIGURATION_ARGUMENT_BRIDGE, (uintptr_t)config->bridge, ValueInt64);
 
    if (config->number_of_endpoints > 0)
@@ -2700,6 +3021,10 @@ add_configuration_response(struct json* res)
    pgexporter_json_put(res, CONFIGURATION_ARGUMENT_LOG_LINE_PREFIX, (uintptr_t)config->log_line_prefix, ValueString);
    pgexporter_json_put_enum_value(res, CONFIGURATION_ARGUMENT_LOG_MODE, config->log_mode, to_log_mode);
    pgexporter_json_put_time_value(res, CONFIGURATION_ARGUMENT_BLOCKING_TIMEOUT, config->blocking_timeout, FORMAT_TIME_S);
+   pgexporter_json_put_time_value(res, CONFIGURATION_ARGUMENT_HTTP_KEEP_ALIVE_TIMEOUT, config->http_keep_alive_timeout, FORMAT_TIME_S);
+   pgexporter_json_put(res, CONFIGURATION_ARGUMENT_HTTP_KEEP_ALIVE_MAX_REQS, (uintptr_t)config->http_keep_alive_max_requests, ValueInt64);
+   pgexporter_json_put(res, CONFIGURATION_ARGUMENT_HTTP_WORKERS, (uintptr_t)config->http_workers, ValueInt64);
+   pgexporter_json_put(res, CONFIGURATION_ARGUMENT_HTTP_WORKER_MAX_REQUESTS, (uintptr_t)config->http_worker_max_requests, ValueInt64);
    pgexporter_json_put(res, CONFIGURATION_ARGUMENT_TLS, (uintptr_t)config->tls, ValueBool);
    pgexporter_json_put(res, CONFIGURATION_ARGUMENT_TLS_CERT_FILE, (uintptr_t)config->tls_cert_file, ValueString);
    pgexporter_json_put(res, CONFIGURATION_ARGUMENT_TLS_CA_FILE, (uintptr_t)config->tls_ca_file, ValueString);
@@ -3648,7 +3973,20 @@ transfer_configuration(struct configuration* config, struct configuration* reloa
    memcpy(config->host, reload->host, MISC_LENGTH);
    config->metrics = reload->metrics;
    config->metrics_cache_max_age = reload->metrics_cache_max_age;
+   config->metrics_cache_max_stale = reload->metrics_cache_max_stale;
    config->metrics_query_timeout = reload->metrics_query_timeout;
+   config->metrics_query_workers = reload->metrics_query_workers;
+   config->metrics_query_async = reload->metrics_query_async;
+   config->metrics_scrape_timeout = reload->metrics_scrape_timeout;
+   if (restart_bool("metrics_collector_interval", pgexporter_time_is_valid(config->metrics_collector_interval), pgexporter_time_is_valid(reload->metrics_collector_interval)))
+   {
+      changed = true;
+   }
+   else
+   {
+      config->metrics_collector_interval = reload->metrics_collector_interval;
+   }
+   config->metrics_pool_idle_timeout = reload->metrics_pool_idle_timeout;
    if (restart_int("metrics_cache_max_size", config->metrics_cache_max_size, reload->metrics_cache_max_size))
    {
       changed = true;
@@ -3761,6 +4099,10 @@ transfer_configuration(struct configuration* config, struct configuration* reloa
 
    config->blocking_timeout = reload->blocking_timeout;
    config->authentication_timeout = reload->authentication_timeout;
+   config->http_keep_alive_timeout = reload->http_keep_alive_timeout;
+   config->http_keep_alive_max_requests = reload->http_keep_alive_max_requests;
+   config->http_workers = reload->http_workers;
+   config->http_worker_max_requests = reload->http_worker_max_requests;
    /* pidfile */
    if (restart_string("pidfile", config->pidfile, reload->pidfile))
    {
@@ -3817,6 +4159,15 @@ transfer_configuration(struct configuration* config, struct configuration* reloa
       }
    }
 
+   /* The query latencies follow the index of the server */
+   for (int i = 0; i < config->number_of_servers; i++)
+   {
+      if (i >= reload->number_of_servers || strcmp(config->servers[i].name, reload->servers[i].name))
+      {
+         memset(&config->query_latencies[i][0], 0, sizeof(struct latency_histogram) * NUMBER_OF_QUERY_TAGS);
+      }
+   }
+
    memset(&config->servers[0], 0, sizeof(struct server) * NUMBER_OF_SERVERS);
    for (int i = 0; i < reload->number_of_servers; i++)
    {
@@ -3832,6 +4183,9 @@ transfer_configuration(struct configuration* config, struct configuration* reloa
    }
    config->number_of_users = reload->number_of_users;
 
+   /* A reload may change the passwords */
+   pgexporter_clear_scram_keys();
+
    memset(&config->admins[0], 0, sizeof(struct user) * NUMBER_OF_ADMINS);
    for (int i = 0; i < reload->number_of_admins; i++)
    {
@@ -3840,12 +4194,19 @@ transfer_configuration(struct configuration* config, struct configuration* reloa
    config->number_of_admins = reload->number_of_admins;
 
    /* prometheus */
-   memcpy(config->metrics_path, reload->metrics_path, MAX_PATH);
-   for (int i = 0; i < reload->number_of_metrics; i++)
+   if (!is_same_metrics(config, reload))
    {
-      copy_promethus(&config->prometheus[i], &reload->prometheus[i]);
+      /* Move the Query Alts AVL Trees over, the reloaded configuration
+       * no longer owns them */
+      pgexporter_free_pg_query_alts(config);
+      memset(&config->prometheus[0], 0, sizeof(struct prometheus) * NUMBER_OF_METRICS);
+      memcpy(&config->prometheus[0], &reload->prometheus[0], sizeof(struct prometheus) * reload->number_of_metrics);
+      memset(&reload->prometheus[0], 0, sizeof(struct prometheus) * reload->number_of_metrics);
+      config->number_of_metrics = reload->number_of_metrics;
    }
-   config->number_of_metrics = reload->number_of_metrics;
+   memcpy(config->metrics_path, reload->metrics_path, MAX_PATH);
+   config->metrics_stamp = reload->metrics_stamp;
+   memcpy(config->metrics_yaml_cache, reload->metrics_yaml_cache, MAX_PATH);
 
    /* alerts */
    memcpy(config->alerts_path, reload->alerts_path, MAX_PATH);
@@ -3898,16 +4259,12 @@ copy_user(struct user* dst, struct user* src)
    memcpy(&dst->password[0], &src->password[0], MAX_PASSWORD_LENGTH);
 }
 
-static void
-copy_promethus(struct prometheus* dst, struct prometheus* src)
+static bool
+is_same_metrics(struct configuration* config, struct configuration* reload)
 {
-   memcpy(dst->tag, src->tag, MISC_LENGTH);
-   memcpy(dst->collector, src->collector, MAX_COLLECTOR_LENGTH);
-   dst->sort_type = src->sort_type;
-   dst->server_query_type = src->server_query_type;
-
-   pgexporter_copy_pg_query_alts(&dst->pg_root, src->pg_root);
-   pgexporter_copy_extension_query_alts(src->ext_root, &dst->ext_root);
+   return reload->metrics_stamp != 0 &&
+          reload->metrics_stamp == config->metrics_stamp &&
+          !strcmp(reload->metrics_path, config->metrics_path);
 }
 
 static void
@@ -178,6 +178,8 @@ static int console_generate_html(struct console_page* console, char** html, size
 static int console_generate_json(struct console_page* console, char** json, size_t* json_size);
 static int console_destroy(struct console_page* console);
 
+static bool keep_alive = false;
+
 static int
 resolve_page(struct message* msg)
 {
@@ -192,11 +194,16 @@ resolve_page(struct message* msg)
    index = 4;
    from = (char*)msg->data + index;
 
-   while (pgexporter_read_byte(msg->data + index) != ' ')
+   while (index < msg->length && pgexporter_read_byte(msg->data + index) != ' ')
    {
       index++;
    }
 
+   if (index >= msg->length)
+   {
+      return BAD_REQUEST;
+   }
+
    pgexporter_write_byte(msg->data + index, '\0');
 
    if (strcmp(from, "/") == 0 || strcmp(from, "/index.html") == 0)
@@ -215,18 +222,22 @@ send_http_response(SSL* client_ssl, int client_fd, const char* content_type, voi
 {
    struct message msg;
    char response_header[512];
+   char* connection = NULL;
    int header_len;
    int status = MESSAGE_STATUS_OK;
 
    memset(&msg, 0, sizeof(struct message));
+   connection = pgexporter_http_connection_headers(NULL, keep_alive);
    header_len = pgexporter_snprintf(response_header, sizeof(response_header),
                                     "HTTP/1.1 200 OK\r\n"
                                     "Content-Type: %s\r\n"
                                     "Content-Length: %zu\r\n"
-                                    "Connection: close\r\n"
+                                    "%s"
                                     "\r\n",
                                     content_type,
-                                    body_len);
+                                    body_len,
+                                    connection != NULL ? connection : "Connection: close\r\n");
+   free(connection);
 
    msg.data = response_header;
    msg.length = header_len;
@@ -262,7 +273,8 @@ badrequest_page(SSL* client_ssl, int client_fd)
 
    data = pgexporter_append(data, "HTTP/1.1 400 Bad Request\r\n");
    data = pgexporter_append(data, "Content-Length: 0\r\n");
-   data = pgexporter_append(data, "Connection: close\r\n\r\n");
+   data = pgexporter_http_connection_headers(data, keep_alive);
+   data = pgexporter_append(data, "\r\n");
 
    msg.kind = 0;
    msg.length = strlen(data);
@@ -344,14 +356,14 @@ home_page(SSL* client_ssl, int client_fd)
    if (console_init(0, "pgexporter", "pgexporter_", &console))
    {
       pgexporter_log_error("Failed to initialize console");
-      status = 1;
+      status = MESSAGE_STATUS_ERROR;
       goto error;
    }
 
    if (console_generate_html(console, &html, &html_size))
    {
       pgexporter_log_error("Failed to generate HTML");
-      status = 1;
+      status = MESSAGE_STATUS_ERROR;
       goto error;
    }
 
@@ -382,14 +394,14 @@ api_page(SSL* client_ssl, int client_fd)
    if (console_init(0, "pgexporter", "pgexporter_", &console))
    {
       pgexporter_log_error("Failed to initialize console for API");
-      status = 1;
+      status = MESSAGE_STATUS_ERROR;
       goto error;
    }
 
    if (console_generate_json(console, &json, &json_size))
    {
       pgexporter_log_error("Failed to generate JSON");
-      status = 1;
+      status = MESSAGE_STATUS_ERROR;
       goto error;
    }
 
@@ -2182,14 +2194,33 @@ generate_category_tabs(struct console_page* console)
 
 void
 pgexporter_console(SSL* client_ssl, int client_fd)
+{
+   int requests = 0;
+   int ret;
+
+   pgexporter_start_logging();
+   pgexporter_memory_init();
+
+   ret = pgexporter_console_serve(client_ssl, client_fd, &requests);
+
+   pgexporter_close_ssl(client_ssl);
+   pgexporter_disconnect(client_fd);
+
+   pgexporter_memory_destroy();
+   pgexporter_stop_logging();
+
+   exit(ret);
+}
+
+int
+pgexporter_console_serve(SSL* client_ssl, int client_fd, int* requests)
 {
    struct configuration* config = (struct configuration*)shmem;
    struct message* msg = NULL;
    int page;
    int status = MESSAGE_STATUS_OK;
 
-   pgexporter_start_logging();
-   pgexporter_memory_init();
+   *requests = 0;
 
    if (client_ssl)
    {
@@ -2215,32 +2246,40 @@ pgexporter_console(SSL* client_ssl, int client_fd)
       goto error;
    }
 
-   page = resolve_page(msg);
-
-   if (page == PAGE_HOME)
-   {
-      status = home_page(client_ssl, client_fd);
-   }
-   else if (page == PAGE_API)
-   {
-      status = api_page(client_ssl, client_fd);
-   }
-   else
+   while (true)
    {
-      status = badrequest_page(client_ssl, client_fd);
-   }
+      (*requests)++;
+      keep_alive = pgexporter_http_keep_alive(msg, *requests);
 
-error:
-   pgexporter_close_ssl(client_ssl);
-   pgexporter_disconnect(client_fd);
+      page = resolve_page(msg);
 
-   pgexporter_memory_destroy();
-   pgexporter_stop_logging();
+      if (page == PAGE_HOME)
+      {
+         status = home_page(client_ssl, client_fd);
+      }
+      else if (page == PAGE_API)
+      {
+         status = api_page(client_ssl, client_fd);
+      }
+      else
+      {
+         status = badrequest_page(client_ssl, client_fd);
+      }
 
-   if (status == MESSAGE_STATUS_OK)
-   {
-      exit(0);
+      if (status != MESSAGE_STATUS_OK || !keep_alive || !pgexporter_http_wait_request(client_ssl, client_fd))
+      {
+         break;
+      }
+
+      if (pgexporter_read_timeout_message(client_ssl, client_fd,
+                                          (int)pgexporter_time_convert(config->authentication_timeout, FORMAT_TIME_S),
+                                          &msg) != MESSAGE_STATUS_OK)
+      {
+         break;
+      }
    }
 
-   exit(1);
+error:
+
+   return status == MESSAGE_STATUS_OK ? 0 : 1;
 }
@@ -0,0 +1,523 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgexporter */
+#include <pgexporter.h>
+#include <decoder.h>
+#include <logging.h>
+#include <message.h>
+#include <queries.h>
+#include <utils.h>
+
+/* system */
+#include <stdlib.h>
+#include <string.h>
+
+#define SQLSTATE_QUERY_CANCELED "57014"
+#define QUERY_ARENA_BLOCK_SIZE  8192
+
+static int decode_message(struct decoder* decoder, struct message* msg);
+static int decode_row_description(struct query_request* request, struct message* msg, struct query** query);
+static bool is_query_timeout_error(struct message* error_msg);
+static void pending_append(struct decoder* decoder, void* data, size_t size);
+
+int
+pgexporter_decoder_create(int server, struct query_request* requests, int n,
+                          decoder_row_callback row, void* row_data, struct memory_arena* arena,
+                          struct decoder** decoder)
+{
+   struct decoder* d = NULL;
+
+   *decoder = NULL;
+
+   d = (struct decoder*)malloc(sizeof(struct decoder));
+   if (d == NULL)
+   {
+      goto error;
+   }
+
+   memset(d, 0, sizeof(struct decoder));
+
+   d->server = server;
+   d->requests = requests;
+   d->number_of_requests = n;
+   d->row = row != NULL ? row : pgexporter_decoder_add_tuple;
+   d->row_data = row_data;
+   d->arena = arena;
+   d->mark = pgexporter_monotonic_micros();
+
+   for (int i = 0; i < n; i++)
+   {
+      requests[i].query = NULL;
+      requests[i].error = 1;
+      requests[i].timeout = false;
+      requests[i].duration = -1;
+   }
+
+   *decoder = d;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+int
+pgexporter_decoder_feed(struct decoder* decoder, void* data, size_t size)
+{
+   size_t offset = 0;
+   size_t needed;
+   size_t length;
+   struct message msg;
+
+   /* Complete a message that was split across reads */
+   while (decoder->pending_length > 0 && offset < size)
+   {
+      if (decoder->pending_length < 5)
+      {
+         needed = 5 - decoder->pending_length;
+      }
+      else
+      {
+         needed = 1 + pgexporter_read_int32(decoder->pending + 1) - decoder->pending_length;
+      }
+
+      if (needed > size - offset)
+      {
+         needed = size - offset;
+      }
+
+      pending_append(decoder, data + offset, needed);
+      offset += needed;
+
+      if (decoder->pending_length >= 5)
+      {
+         int32_t l = pgexporter_read_int32(decoder->pending + 1);
+
+         if (l < 4)
+         {
+            goto error;
+         }
+
+         if (decoder->pending_length == (size_t)(1 + l))
+         {
+            msg.kind = (signed char)decoder->pending[0];
+            msg.length = decoder->pending_length;
+            msg.data = decoder->pending;
+
+            decoder->pending_length = 0;
+
+            if (decode_message(decoder, &msg))
+            {
+               goto error;
+            }
+         }
+      }
+   }
+
+   /* Decode the complete messages in place */
+   while (offset + 5 <= size)
+   {
+      int32_t l = pgexporter_read_int32(data + offset + 1);
+
+      if (l < 4)
+      {
+         goto error;
+      }
+
+      length = 1 + (size_t)l;
+
+      if (length > size - offset)
+      {
+         break;
+      }
+
+      msg.kind = (signed char)pgexporter_read_byte(data + offset);
+      msg.length = length;
+      msg.data = data + offset;
+
+      if (decode_message(decoder, &msg))
+      {
+         goto error;
+      }
+
+      offset += length;
+   }
+
+   /* Keep the start of a partial message for the next read */
+   if (offset < size)
+   {
+      pending_append(decoder, data + offset, size - offset);
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+bool
+pgexporter_decoder_done(struct decoder* decoder)
+{
+   return decoder->current >= decoder->number_of_requests;
+}
+
+int
+pgexporter_decoder_add_tuple(struct decoder* decoder, struct query_request* request, struct message* msg)
+{
+   int32_t offset;
+   int32_t length;
+   int32_t size;
+   int16_t fields;
+   struct tuple* tuple = NULL;
+   struct query* query = request->query;
+   struct memory_arena* arena = request->retain ? NULL : decoder->arena;
+
+   if (arena == NULL)
+   {
+      if (query->arena == NULL && pgexporter_memory_arena_create(QUERY_ARENA_BLOCK_SIZE, &query->arena))
+      {
+         goto error;
+      }
+
+      arena = query->arena;
+   }
+
+   fields = pgexporter_read_int16(msg->data + 5);
+   size = (int32_t)msg->length - 7;
+
+   if (size < 0)
+   {
+      goto error;
+   }
+
+   /* The tuple, its cells and a copy of the row share one allocation */
+   tuple = (struct tuple*)pgexporter_memory_arena_alloc(arena, sizeof(struct tuple) +
+                                                        query->number_of_columns * sizeof(struct tuple_cell) +
+                                                        size + 1);
+   if (tuple == NULL)
+   {
+      goto error;
+   }
+
+   tuple->server = decoder->server;
+   tuple->cells = (struct tuple_cell*)(tuple + 1);
+   tuple->row = (char*)(tuple->cells + query->number_of_columns);
+   tuple->next = NULL;
+
+   memcpy(tuple->row, msg->data + 7, size);
+
+   offset = 0;
+   for (int i = 0; i < query->number_of_columns; i++)
+   {
+      tuple->cells[i].offset = 0;
+      tuple->cells[i].length = -1;
+
+      if (i >= fields)
+      {
+         continue;
+      }
+
+      if (4 > size - offset)
+      {
+         goto error;
+      }
+
+      /* The lengths are read from the message, as the copy is terminated in place */
+      length = pgexporter_read_int32(msg->data + 7 + offset);
+      offset += 4;
+
+      if (length > 0)
+      {
+         if (length > size - offset)
+         {
+            goto error;
+         }
+
+         tuple->cells[i].offset = offset;
+         tuple->cells[i].length = length;
+
+         /* Overwrites the length of the next value, or the spare byte for the last one */
+         tuple->row[offset + length] = '\0';
+         offset += length;
+      }
+   }
+
+   if (decoder->last == NULL)
+   {
+      query->tuples = tuple;
+   }
+   else
+   {
+      decoder->last->next = tuple;
+   }
+
+   decoder->last = tuple;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+void
+pgexporter_decoder_destroy(struct decoder* decoder)
+{
+   if (decoder == NULL)
+   {
+      return;
+   }
+
+   /* Discard an incomplete result */
+   if (decoder->current < decoder->number_of_requests)
+   {
+      struct query_request* request = &decoder->requests[decoder->current];
+
+      pgexporter_free_query(request->query);
+      request->query = NULL;
+      request->error = 1;
+   }
+
+   free(decoder->pending);
+   free(decoder);
+}
+
+static int
+decode_message(struct decoder* decoder, struct message* msg)
+{
+   int64_t now;
+   struct query_request* request = NULL;
+
+   if (decoder->current >= decoder->number_of_requests)
+   {
+      /* Nothing is expected after the last result */
+      return 0;
+   }
+
+   request = &decoder->requests[decoder->current];
+
+   switch (msg->kind)
+   {
+      case 'T':
+         /* Only the first result set of a query string is described */
+         if (request->query == NULL && !decoder->failed)
+         {
+            if (decode_row_description(request, msg, &request->query))
+            {
+               decoder->failed = true;
+            }
+         }
+         break;
+      case 'D':
+         if (request->query != NULL && !decoder->failed)
+         {
+            if (decoder->row(decoder, request, msg))
+            {
+               decoder->failed = true;
+            }
+         }
+         break;
+      case 'E':
+         decoder->failed = true;
+         request->timeout = is_query_timeout_error(msg);
+         break;
+      case 'Z':
+         if (decoder->failed || request->query == NULL)
+         {
+            pgexporter_free_query(request->query);
+            request->query = NULL;
+            request->error = 1;
+         }
+         else
+         {
+            request->error = 0;
+         }
+
+         /* The server runs the queries of a pipeline one after the other */
+         now = pgexporter_monotonic_micros();
+         request->duration = now - decoder->mark;
+         decoder->mark = now;
+
+         decoder->failed = false;
+         decoder->last = NULL;
+         decoder->current++;
+         break;
+      default:
+         break;
+   }
+
+   return 0;
+}
+
+static int
+decode_row_description(struct query_request* request, struct message* msg, struct query** query)
+{
+   int cols;
+   int16_t fields;
+   size_t offset;
+   char* name = NULL;
+   struct query* q = NULL;
+
+   *query = NULL;
+
+   fields = pgexporter_read_int16(msg->data + 5);
+
+   if (request->columns <= 0)
+   {
+      cols = fields;
+   }
+   else
+   {
+      cols = request->columns;
+   }
+
+   if (cols > MAX_NUMBER_OF_COLUMNS)
+   {
+      goto error;
+   }
+
+   q = (struct query*)malloc(sizeof(struct query));
+   if (q == NULL)
+   {
+      goto error;
+   }
+
+   memset(q, 0, sizeof(struct query));
+
+   q->number_of_columns = cols;
+   pgexporter_snprintf(&q->tag[0], PROMETHEUS_LENGTH, "%s", request->tag);
+
+   /* name, table oid (4), column (2), type oid (4), size (2), modifier (4), format (2) */
+   offset = 7;
+
+   for (int i = 0; i < cols; i++)
+   {
+      if (i < fields)
+      {
+         name = pgexporter_read_string(msg->data + offset);
+         offset += strlen(name) + 1;
+
+         q->type_oids[i] = pgexporter_read_int32(msg->data + offset + 4 + 2);
+
+         offset += 4 + 2 + 4 + 2 + 4 + 2;
+      }
+      else
+      {
+         name = NULL;
+      }
+
+      if (request->names != NULL)
+      {
+         pgexporter_snprintf(&q->names[i][0], PROMETHEUS_LENGTH, "%s", request->names[i]);
+      }
+      else if (name != NULL)
+      {
+         pgexporter_snprintf(&q->names[i][0], PROMETHEUS_LENGTH, "%s", name);
+      }
+      else
+      {
+         goto error;
+      }
+   }
+
+   *query = q;
+
+   return 0;
+
+error:
+
+   pgexporter_free_query(q);
+
+   return 1;
+}
+
+static bool
+is_query_timeout_error(struct message* error_msg)
+{
+   bool is_timeout = false;
+   if (error_msg != NULL && error_msg->length > 5)
+   {
+      char* payload = (char*)error_msg->data;
+      size_t offset = 5; /* kind (1) + length (4) */
+
+      while (offset < error_msg->length)
+      {
+         char field_type = payload[offset];
+         if (field_type == '\0')
+         {
+            break;
+         }
+
+         char* value = pgexporter_read_string(payload + offset + 1);
+
+         if (field_type == 'C')
+         {
+            if (!strcmp(value, SQLSTATE_QUERY_CANCELED))
+            {
+               is_timeout = true;
+               break;
+            }
+         }
+         else if (field_type == 'M')
+         {
+            if (strstr(value, "statement timeout") != NULL || strstr(value, "canceling statement due to user request") != NULL)
+            {
+               is_timeout = true;
+               break;
+            }
+         }
+
+         offset += 1 + strlen(value) + 1;
+      }
+   }
+
+   return is_timeout;
+}
+
+static void
+pending_append(struct decoder* decoder, void* data, size_t size)
+{
+   if (decoder->pending_length + size > decoder->pending_capacity)
+   {
+      size_t capacity = decoder->pending_capacity == 0 ? 8192 : decoder->pending_capacity;
+
+      while (capacity < decoder->pending_length + size)
+      {
+         capacity *= 2;
+      }
+
+      decoder->pending = realloc(decoder->pending, capacity);
+      decoder->pending_capacity = capacity;
+   }
+
+   memcpy(decoder->pending + decoder->pending_length, data, size);
+   decoder->pending_length += size;
+}
@@ -0,0 +1,722 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgexporter */
+#include <pgexporter.h>
+#include <decoder.h>
+#include <engine.h>
+#include <logging.h>
+#include <message.h>
+#include <network.h>
+#include <queries.h>
+#include <security.h>
+#include <utils.h>
+
+/* system */
+#include <errno.h>
+#include <ev.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <openssl/ssl.h>
+
+static void engine_advance(struct engine_connection* connection);
+static int engine_start(struct engine_connection* connection);
+static void engine_unavailable(struct engine_connection* connection, int status);
+static void engine_complete(struct engine_connection* connection, bool failed);
+static void engine_expire(struct engine_connection* connection);
+static bool engine_expired(struct engine* engine);
+static void engine_deadline_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents);
+static void engine_connect_cb(struct ev_loop* loop, struct ev_io* watcher, int revents);
+static void engine_io_cb(struct ev_loop* loop, struct ev_io* watcher, int revents);
+static int engine_write(struct engine_connection* connection);
+static int engine_read(struct engine_connection* connection);
+
+int
+pgexporter_engine_create(engine_next_callback next, engine_done_callback done, void* data, struct engine** engine)
+{
+   struct engine* e = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   *engine = NULL;
+
+   e = (struct engine*)calloc(1, sizeof(struct engine));
+   if (e == NULL)
+   {
+      goto error;
+   }
+
+   /* A loop of its own, so the watchers of the process are left alone */
+   e->loop = ev_loop_new(pgexporter_libev(config->libev));
+   if (e->loop == NULL)
+   {
+      goto error;
+   }
+
+   e->buffer = (char*)malloc(DEFAULT_BUFFER_SIZE);
+   if (e->buffer == NULL)
+   {
+      goto error;
+   }
+
+   e->next = next;
+   e->done = done;
+   e->data = data;
+
+   for (int i = 0; i < NUMBER_OF_SERVERS; i++)
+   {
+      e->connections[i].engine = e;
+      e->connections[i].server = i;
+      e->connections[i].state = ENGINE_STATE_IDLE;
+   }
+
+   *engine = e;
+
+   return 0;
+
+error:
+
+   pgexporter_engine_destroy(e);
+
+   return 1;
+}
+
+int
+pgexporter_engine_add(struct engine* engine, int server)
+{
+   if (server < 0 || server >= NUMBER_OF_SERVERS)
+   {
+      return 1;
+   }
+
+   engine->connections[server].state = ENGINE_STATE_READY;
+
+   return 0;
+}
+
+int
+pgexporter_engine_run(struct engine* engine, int64_t timeout)
+{
+   engine->expired = false;
+   engine->deadline = 0;
+
+   if (timeout > 0)
+   {
+      /* The loop time is stale since the loop last ran */
+      ev_now_update(engine->loop);
+
+      engine->deadline = ev_time() + timeout / 1000.0;
+
+      /* The timer alone does not keep the loop running */
+      ev_timer_init(&engine->timer, engine_deadline_cb, timeout / 1000.0, 0.0);
+      engine->timer.data = engine;
+      ev_timer_start(engine->loop, &engine->timer);
+      ev_unref(engine->loop);
+   }
+
+   for (int i = 0; i < NUMBER_OF_SERVERS; i++)
+   {
+      if (engine->connections[i].state == ENGINE_STATE_READY)
+      {
+         engine_advance(&engine->connections[i]);
+      }
+   }
+
+   /* Returns once no connection waits for its socket */
+   ev_run(engine->loop, 0);
+
+   if (ev_is_active(&engine->timer))
+   {
+      ev_ref(engine->loop);
+      ev_timer_stop(engine->loop, &engine->timer);
+   }
+
+   for (int i = 0; i < NUMBER_OF_SERVERS; i++)
+   {
+      if (engine->connections[i].state != ENGINE_STATE_IDLE && engine->connections[i].state != ENGINE_STATE_DONE)
+      {
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
+void
+pgexporter_engine_destroy(struct engine* engine)
+{
+   if (engine == NULL)
+   {
+      return;
+   }
+
+   for (int i = 0; i < NUMBER_OF_SERVERS; i++)
+   {
+      struct engine_connection* c = &engine->connections[i];
+
+      if (c->state == ENGINE_STATE_CONNECT)
+      {
+         ev_io_stop(engine->loop, &c->io);
+         pgexporter_server_connect_destroy(c->connect);
+         c->connect = NULL;
+         engine_unavailable(c, ENGINE_BATCH_NO_CONNECTION);
+      }
+      else if (c->state == ENGINE_STATE_QUERY || c->state == ENGINE_STATE_ROWS)
+      {
+         engine_complete(c, true);
+      }
+   }
+
+   if (engine->loop != NULL)
+   {
+      ev_loop_destroy(engine->loop);
+   }
+
+   free(engine->buffer);
+   free(engine);
+}
+
+static void
+engine_advance(struct engine_connection* connection)
+{
+   int ret;
+   int server = connection->server;
+   struct engine* engine = connection->engine;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   memset(&connection->batch, 0, sizeof(struct engine_batch));
+
+   while (engine->next(server, &connection->batch, engine->data))
+   {
+      if (connection->batch.n == 0)
+      {
+         engine->done(server, &connection->batch, ENGINE_BATCH_OK, engine->data);
+         memset(&connection->batch, 0, sizeof(struct engine_batch));
+         continue;
+      }
+
+      /* Nothing new starts once the deadline has passed */
+      if (engine_expired(engine))
+      {
+         engine_unavailable(connection, ENGINE_BATCH_EXPIRED);
+         continue;
+      }
+
+      connection->state = ENGINE_STATE_CONNECT;
+
+      if (connection->batch.database != NULL)
+      {
+         ret = pgexporter_switch_db_start(server, connection->batch.database, &connection->connect);
+      }
+      else
+      {
+         ret = config->servers[server].fd == -1 ? 1 : 0;
+      }
+
+      if (ret != 0)
+      {
+         engine_unavailable(connection, ENGINE_BATCH_NO_CONNECTION);
+         continue;
+      }
+
+      if (connection->connect != NULL)
+      {
+         /* A new connection is set up by the loop, it is writable once connected */
+         ev_io_init(&connection->io, engine_connect_cb, connection->connect->fd, EV_WRITE);
+         ev_io_start(engine->loop, &connection->io);
+         return;
+      }
+
+      if (engine_start(connection) == 0)
+      {
+         /* The socket drives the rest of the batch */
+         return;
+      }
+
+      engine_complete(connection, true);
+      memset(&connection->batch, 0, sizeof(struct engine_batch));
+   }
+
+   connection->state = ENGINE_STATE_DONE;
+}
+
+static int
+engine_start(struct engine_connection* connection)
+{
+   int fd;
+   size_t offset = 0;
+   struct engine_batch* batch = &connection->batch;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   fd = config->servers[connection->server].fd;
+
+   atomic_fetch_add(&config->query_executions_total, batch->n);
+
+   if (pgexporter_decoder_create(connection->server, batch->requests, batch->n, NULL, NULL, batch->arena, &connection->decoder))
+   {
+      goto error;
+   }
+
+   connection->size = 0;
+   connection->offset = 0;
+
+   for (int i = 0; i < batch->n; i++)
+   {
+      connection->size += 1 + 4 + strlen(batch->requests[i].qs) + 1;
+   }
+
+   /* All the queries are written as one pipeline */
+   connection->content = (char*)calloc(1, connection->size);
+   if (connection->content == NULL)
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < batch->n; i++)
+   {
+      size_t length = 1 + 4 + strlen(batch->requests[i].qs) + 1;
+
+      pgexporter_write_byte(connection->content + offset, 'Q');
+      pgexporter_write_int32(connection->content + offset + 1, length - 1);
+      pgexporter_write_string(connection->content + offset + 5, batch->requests[i].qs);
+
+      offset += length;
+   }
+
+   connection->nonblocking = pgexporter_socket_is_nonblocking(fd);
+   pgexporter_socket_nonblocking(fd, true);
+
+   /* The results are read while the pipeline is written, so neither side stalls on a full buffer */
+   connection->state = ENGINE_STATE_QUERY;
+   ev_io_init(&connection->io, engine_io_cb, fd, EV_READ | EV_WRITE);
+   ev_io_start(connection->engine->loop, &connection->io);
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static void
+engine_unavailable(struct engine_connection* connection, int status)
+{
+   struct engine* engine = connection->engine;
+
+   for (int i = 0; i < connection->batch.n; i++)
+   {
+      connection->batch.requests[i].query = NULL;
+      connection->batch.requests[i].error = 1;
+      connection->batch.requests[i].timeout = status == ENGINE_BATCH_EXPIRED;
+   }
+
+   connection->state = ENGINE_STATE_READY;
+   engine->done(connection->server, &connection->batch, status, engine->data);
+   memset(&connection->batch, 0, sizeof(struct engine_batch));
+}
+
+static void
+engine_complete(struct engine_connection* connection, bool failed)
+{
+   int server = connection->server;
+   struct engine* engine = connection->engine;
+   struct engine_batch* batch = &connection->batch;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (connection->state == ENGINE_STATE_QUERY || connection->state == ENGINE_STATE_ROWS)
+   {
+      ev_io_stop(engine->loop, &connection->io);
+      pgexporter_socket_nonblocking(config->servers[server].fd, connection->nonblocking);
+   }
+
+   if (connection->decoder != NULL)
+   {
+      pgexporter_query_latencies(server, batch->requests, batch->n);
+   }
+
+   if (!failed)
+   {
+      for (int i = 0; i < batch->n; i++)
+      {
+         if (batch->requests[i].error != 0)
+         {
+            atomic_fetch_add(&config->query_errors_total, 1);
+         }
+
+         if (batch->requests[i].timeout)
+         {
+            atomic_fetch_add(&config->query_timeouts_total, 1);
+         }
+      }
+   }
+   else
+   {
+      atomic_fetch_add(&config->query_errors_total, batch->n);
+
+      for (int i = 0; i < batch->n; i++)
+      {
+         pgexporter_free_query(batch->requests[i].query);
+         batch->requests[i].query = NULL;
+         batch->requests[i].error = 1;
+      }
+
+      /* The connection is somewhere in the middle of the results */
+      pgexporter_close_connection(server);
+   }
+
+   pgexporter_decoder_destroy(connection->decoder);
+   free(connection->content);
+
+   connection->decoder = NULL;
+   connection->content = NULL;
+   connection->size = 0;
+   connection->offset = 0;
+   connection->state = ENGINE_STATE_READY;
+
+   engine->done(server, batch, ENGINE_BATCH_OK, engine->data);
+}
+
+static void
+engine_expire(struct engine_connection* connection)
+{
+   int server = connection->server;
+   int current = connection->decoder->current;
+   struct engine* engine = connection->engine;
+   struct engine_batch* batch = &connection->batch;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   /* Closing the socket alone leaves the backend running the query until it has output */
+   if (pgexporter_cancel_query(server))
+   {
+      pgexporter_log_debug("Failed to cancel the query of server %s", config->servers[server].name);
+   }
+
+   ev_io_stop(engine->loop, &connection->io);
+   pgexporter_socket_nonblocking(config->servers[server].fd, connection->nonblocking);
+
+   /* The results that were complete are kept */
+   for (int i = 0; i < batch->n; i++)
+   {
+      if (i >= current)
+      {
+         batch->requests[i].error = 1;
+         batch->requests[i].timeout = true;
+         atomic_fetch_add(&config->query_timeouts_total, 1);
+      }
+
+      if (batch->requests[i].error != 0)
+      {
+         atomic_fetch_add(&config->query_errors_total, 1);
+      }
+   }
+
+   pgexporter_query_latencies(server, batch->requests, batch->n);
+
+   pgexporter_decoder_destroy(connection->decoder);
+   free(connection->content);
+
+   /* The connection is somewhere in the middle of the results */
+   pgexporter_close_connection(server);
+
+   connection->decoder = NULL;
+   connection->content = NULL;
+   connection->size = 0;
+   connection->offset = 0;
+   connection->state = ENGINE_STATE_READY;
+
+   engine->done(server, batch, ENGINE_BATCH_EXPIRED, engine->data);
+}
+
+static bool
+engine_expired(struct engine* engine)
+{
+   if (!engine->expired && engine->deadline > 0 && ev_time() >= engine->deadline)
+   {
+      engine->expired = true;
+   }
+
+   return engine->expired;
+}
+
+static void
+engine_deadline_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents __attribute__((unused)))
+{
+   struct engine* engine = (struct engine*)watcher->data;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   /* The timer has stopped itself, so balance the reference dropped when it started */
+   ev_ref(loop);
+
+   engine->expired = true;
+
+   for (int i = 0; i < NUMBER_OF_SERVERS; i++)
+   {
+      struct engine_connection* connection = &engine->connections[i];
+
+      if (connection->state == ENGINE_STATE_CONNECT)
+      {
+         pgexporter_log_debug("Deadline passed connecting to server %s", config->servers[i].name);
+
+         /* No query runs yet, so there is nothing to cancel */
+         ev_io_stop(loop, &connection->io);
+         pgexporter_server_connect_destroy(connection->connect);
+         connection->connect = NULL;
+
+         engine_unavailable(connection, ENGINE_BATCH_EXPIRED);
+         engine_advance(connection);
+      }
+      else if (connection->state == ENGINE_STATE_QUERY || connection->state == ENGINE_STATE_ROWS)
+      {
+         pgexporter_log_debug("Deadline passed for server %s", config->servers[i].name);
+
+         engine_expire(connection);
+         engine_advance(connection);
+      }
+   }
+}
+
+static void
+engine_connect_cb(struct ev_loop* loop, struct ev_io* watcher, int revents __attribute__((unused)))
+{
+   int status;
+   struct engine_connection* connection = (struct engine_connection*)watcher;
+
+   status = pgexporter_server_connect_step(connection->connect);
+
+   if (status == AUTH_WANT_READ || status == AUTH_WANT_WRITE)
+   {
+      ev_io_stop(loop, &connection->io);
+      ev_io_set(&connection->io, watcher->fd, status == AUTH_WANT_READ ? EV_READ : EV_WRITE);
+      ev_io_start(loop, &connection->io);
+      return;
+   }
+
+   ev_io_stop(loop, &connection->io);
+
+   if (status == AUTH_SUCCESS)
+   {
+      pgexporter_switch_db_complete(connection->server, connection->connect);
+      connection->connect = NULL;
+
+      if (engine_start(connection) == 0)
+      {
+         return;
+      }
+
+      engine_complete(connection, true);
+   }
+   else
+   {
+      pgexporter_server_connect_destroy(connection->connect);
+      connection->connect = NULL;
+
+      engine_unavailable(connection, ENGINE_BATCH_NO_CONNECTION);
+   }
+
+   engine_advance(connection);
+}
+
+static void
+engine_io_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
+{
+   struct engine_connection* connection = (struct engine_connection*)watcher;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if ((revents & EV_WRITE) && connection->state == ENGINE_STATE_QUERY)
+   {
+      if (engine_write(connection))
+      {
+         goto failed;
+      }
+
+      if (connection->offset == connection->size)
+      {
+         connection->state = ENGINE_STATE_ROWS;
+
+         ev_io_stop(loop, &connection->io);
+         ev_io_set(&connection->io, watcher->fd, EV_READ);
+         ev_io_start(loop, &connection->io);
+      }
+   }
+
+   if (revents & EV_READ)
+   {
+      if (engine_read(connection))
+      {
+         goto failed;
+      }
+
+      if (pgexporter_decoder_done(connection->decoder))
+      {
+         engine_complete(connection, false);
+         engine_advance(connection);
+      }
+   }
+
+   return;
+
+failed:
+
+   pgexporter_log_error("Failed to query server %s", config->servers[connection->server].name);
+
+   engine_complete(connection, true);
+   engine_advance(connection);
+}
+
+static int
+engine_write(struct engine_connection* connection)
+{
+   int fd;
+   SSL* ssl;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   ssl = config->servers[connection->server].ssl;
+   fd = config->servers[connection->server].fd;
+
+   while (connection->offset < connection->size)
+   {
+      if (ssl != NULL)
+      {
+         int written = SSL_write(ssl, connection->content + connection->offset, connection->size - connection->offset);
+
+         if (written > 0)
+         {
+            connection->offset += written;
+            continue;
+         }
+
+         switch (SSL_get_error(ssl, written))
+         {
+            case SSL_ERROR_WANT_READ:
+            case SSL_ERROR_WANT_WRITE:
+               return 0;
+            default:
+               return 1;
+         }
+      }
+      else
+      {
+         ssize_t written = write(fd, connection->content + connection->offset, connection->size - connection->offset);
+
+         if (written > 0)
+         {
+            connection->offset += written;
+            continue;
+         }
+
+         if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+         {
+            errno = 0;
+            return 0;
+         }
+
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
+static int
+engine_read(struct engine_connection* connection)
+{
+   int fd;
+   SSL* ssl;
+   char* buffer = connection->engine->buffer;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   ssl = config->servers[connection->server].ssl;
+   fd = config->servers[connection->server].fd;
+
+   while (!pgexporter_decoder_done(connection->decoder))
+   {
+      ssize_t numbytes;
+
+      if (ssl != NULL)
+      {
+         numbytes = SSL_read(ssl, buffer, DEFAULT_BUFFER_SIZE);
+
+         if (numbytes <= 0)
+         {
+            switch (SSL_get_error(ssl, numbytes))
+            {
+               case SSL_ERROR_WANT_READ:
+               case SSL_ERROR_WANT_WRITE:
+                  return 0;
+               default:
+                  return 1;
+            }
+         }
+      }
+      else
+      {
+         numbytes = read(fd, buffer, DEFAULT_BUFFER_SIZE);
+
+         if (numbytes == 0)
+         {
+            return 1;
+         }
+         else if (numbytes < 0)
+         {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            {
+               errno = 0;
+               return 0;
+            }
+
+            return 1;
+         }
+      }
+
+      if (pgexporter_decoder_feed(connection->decoder, buffer, numbytes))
+      {
+         return 1;
+      }
+   }
+
+   return 0;
+}
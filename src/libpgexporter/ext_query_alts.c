@@ -245,5 +245,6 @@ pgexporter_free_extension_node_avl(struct ext_query_alts** root)
    pgexporter_free_extension_node_avl(&(*root)->left);
    pgexporter_free_extension_node_avl(&(*root)->right);
 
-   pgexporter_destroy_shared_memory(&root, sizeof(struct ext_query_alts*));
+   pgexporter_destroy_shared_memory(*root, sizeof(struct ext_query_alts));
+   *root = NULL;
 }
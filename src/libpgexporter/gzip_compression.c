@@ -46,6 +46,12 @@
 
 int
 pgexporter_gzip_string(char* s, unsigned char** buffer, size_t* buffer_size)
+{
+   return pgexporter_gzip_string_level(s, Z_BEST_COMPRESSION, buffer, buffer_size);
+}
+
+int
+pgexporter_gzip_string_level(char* s, int level, unsigned char** buffer, size_t* buffer_size)
 {
    int ret;
    z_stream stream;
@@ -68,7 +74,7 @@ pgexporter_gzip_string(char* s, unsigned char** buffer, size_t* buffer_size)
    stream.next_in = (unsigned char*)s;
    stream.avail_in = source_len;
 
-   ret = deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
+   ret = deflateInit2(&stream, level, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
    if (ret != Z_OK)
    {
       free(temp_buffer);
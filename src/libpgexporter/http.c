@@ -36,7 +36,11 @@
 
 /* system */
 #include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <openssl/err.h>
 
@@ -45,6 +49,10 @@ static int http_read_response_body(SSL* ssl, int socket, struct http_response* h
 static int http_read_response_header(SSL* ssl, int socket, char** header_text, struct http_response* http_response);
 static int http_build_request(struct http* connection, struct http_request* request, char** full_request, size_t* full_request_size);
 static char* http_method_to_string(int method);
+static char* http_request_line(struct message* msg, size_t* length);
+static size_t http_request_size(struct message* msg);
+
+static volatile sig_atomic_t http_running = 1;
 
 int
 pgexporter_http_create(char* hostname, int port, bool secure, struct http** result)
@@ -509,6 +517,189 @@ pgexporter_http_destroy(struct http* connection)
 
    return PGEXPORTER_HTTP_STATUS_OK;
 }
+
+char*
+pgexporter_http_get_request_header(struct message* msg, char* name)
+{
+   char* data = NULL;
+   char* value = NULL;
+   size_t length;
+   size_t name_length;
+   size_t start;
+   size_t end;
+
+   if (msg == NULL || msg->data == NULL || msg->length <= 0 || name == NULL)
+   {
+      return NULL;
+   }
+
+   data = (char*)msg->data;
+   length = (size_t)msg->length;
+   name_length = strlen(name);
+
+   for (size_t i = 0; i + 1 < length; i++)
+   {
+      if (data[i] != '\r' || data[i + 1] != '\n')
+      {
+         continue;
+      }
+
+      start = i + 2;
+      if (start + name_length + 1 > length ||
+          strncasecmp(data + start, name, name_length) ||
+          data[start + name_length] != ':')
+      {
+         continue;
+      }
+
+      start += name_length + 1;
+      while (start < length && (data[start] == ' ' || data[start] == '\t'))
+      {
+         start++;
+      }
+
+      end = start;
+      while (end < length && data[end] != '\r' && data[end] != '\n')
+      {
+         end++;
+      }
+      while (end > start && (data[end - 1] == ' ' || data[end - 1] == '\t'))
+      {
+         end--;
+      }
+
+      value = malloc(end - start + 1);
+      if (value == NULL)
+      {
+         return NULL;
+      }
+
+      memcpy(value, data + start, end - start);
+      value[end - start] = '\0';
+
+      return value;
+   }
+
+   return NULL;
+}
+
+bool
+pgexporter_http_keep_alive(struct message* msg, int requests)
+{
+   char* line = NULL;
+   char* connection = NULL;
+   size_t length = 0;
+   bool http11 = false;
+   bool keep_alive = false;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (!pgexporter_time_is_valid(config->http_keep_alive_timeout) ||
+       requests >= config->http_keep_alive_max_requests)
+   {
+      return false;
+   }
+
+   line = http_request_line(msg, &length);
+   if (line == NULL)
+   {
+      return false;
+   }
+
+   /* The next request is already in the buffer, the client has to send it again */
+   if (http_request_size(msg) < (size_t)msg->length)
+   {
+      pgexporter_log_debug("Pipelined HTTP request, closing the connection");
+      return false;
+   }
+
+   http11 = length >= strlen("HTTP/1.1") &&
+            !strncmp(line + length - strlen("HTTP/1.1"), "HTTP/1.1", strlen("HTTP/1.1"));
+
+   /* HTTP/1.1 keeps the connection unless told otherwise, HTTP/1.0 has to ask for it */
+   connection = pgexporter_http_get_request_header(msg, "Connection");
+   if (connection == NULL)
+   {
+      keep_alive = http11;
+   }
+   else if (strcasestr(connection, "close") != NULL)
+   {
+      keep_alive = false;
+   }
+   else
+   {
+      keep_alive = http11 || strcasestr(connection, "keep-alive") != NULL;
+   }
+
+   free(connection);
+
+   return keep_alive;
+}
+
+char*
+pgexporter_http_connection_headers(char* data, bool keep_alive)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (!keep_alive)
+   {
+      return pgexporter_append(data, "Connection: close\r\n");
+   }
+
+   data = pgexporter_append(data, "Connection: keep-alive\r\n");
+   data = pgexporter_format_and_append(data, "Keep-Alive: timeout=%lld\r\n",
+                                       (long long)MAX(pgexporter_time_convert(config->http_keep_alive_timeout, FORMAT_TIME_S), 1));
+
+   return data;
+}
+
+void
+pgexporter_http_shutdown(void)
+{
+   http_running = 0;
+}
+
+bool
+pgexporter_http_wait_request(SSL* ssl, int socket)
+{
+   struct pollfd pfd;
+   int ret;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   /* Bytes already decrypted by OpenSSL never show up on the socket */
+   if (ssl != NULL && SSL_pending(ssl) > 0)
+   {
+      return true;
+   }
+
+   if (!http_running)
+   {
+      return false;
+   }
+
+   pfd.fd = socket;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+
+   do
+   {
+      ret = poll(&pfd, 1, (int)pgexporter_time_convert(config->http_keep_alive_timeout, FORMAT_TIME_MS));
+   }
+   while (ret == -1 && errno == EINTR && http_running);
+
+   if (ret <= 0)
+   {
+      return false;
+   }
+
+   return (pfd.revents & POLLIN) != 0;
+}
+
 static ssize_t
 http_read_bytes(SSL* ssl, int socket, char* buffer, size_t size)
 {
@@ -1026,3 +1217,63 @@ http_method_to_string(int method)
          return NULL;
    }
 }
+
+static char*
+http_request_line(struct message* msg, size_t* length)
+{
+   char* data = NULL;
+
+   if (msg == NULL || msg->data == NULL || msg->length <= 0)
+   {
+      return NULL;
+   }
+
+   data = (char*)msg->data;
+   *length = 0;
+
+   while (*length < (size_t)msg->length && data[*length] != '\r' && data[*length] != '\n')
+   {
+      (*length)++;
+   }
+
+   return data;
+}
+
+static size_t
+http_request_size(struct message* msg)
+{
+   char* data = NULL;
+   size_t length;
+   size_t header_end = 0;
+   size_t content_length = 0;
+
+   data = (char*)msg->data;
+   length = (size_t)msg->length;
+
+   for (size_t i = 0; i + 3 < length; i++)
+   {
+      if (!strncmp(data + i, "\r\n\r\n", 4))
+      {
+         header_end = i + 4;
+         break;
+      }
+   }
+
+   if (header_end == 0)
+   {
+      return length;
+   }
+
+   /* Only the headers of the first request count */
+   for (size_t i = 0; i + 2 < header_end; i++)
+   {
+      if (data[i] == '\n' && i + 1 + strlen("Content-Length:") < header_end &&
+          !strncasecmp(data + i + 1, "Content-Length:", strlen("Content-Length:")))
+      {
+         content_length = strtoul(data + i + 1 + strlen("Content-Length:"), NULL, 10);
+         break;
+      }
+   }
+
+   return header_end + content_length;
+}
@@ -29,6 +29,7 @@
 /* pgexporter */
 #include <pgexporter.h>
 #include <art.h>
+#include <configuration.h>
 #include <internal.h>
 #include <logging.h>
 #include <pg_query_alts.h>
@@ -72,6 +73,7 @@ typedef struct json_metric
    char* sort;
    char* collector;
    char* server;
+   char* interval;
    bool exec_on_all_dbs;
    bool optional;
 } __attribute__((aligned(64))) json_metric_t;
@@ -105,11 +107,11 @@ static void free_json_metrics(json_metric_t** metrics, size_t n_metrics);
 // Free allocated memory for JSON config
 static void free_json_config(json_config_t* config);
 
-// Extract the meaning of the `json_config` and load the metrics into `prometheus`
-static int semantics_json(struct prometheus* prometheus, int prometheus_idx, json_config_t* json_config);
+// Extract the meaning of the `json_config` and load the metrics into `config`
+static int semantics_json(struct configuration* config, int prometheus_idx, json_config_t* json_config);
 
 // Read and parse a single JSON file into the prometheus metrics structure
-int pgexporter_read_json(struct prometheus* prometheus, int prometheus_idx, char* filename, int* number_of_metrics);
+int pgexporter_read_json(struct configuration* config, int prometheus_idx, char* filename, int* number_of_metrics);
 
 // Get all JSON files from a directory
 int get_json_files(char* base, int* number_of_json_files, char*** files);
@@ -136,7 +138,7 @@ pgexporter_read_json_metrics_configuration(void* shmem)
    if (pgexporter_is_file(config->metrics_path))
    {
       number_of_metrics = 0;
-      if (pgexporter_read_json(config->prometheus, idx_metrics, config->metrics_path, &number_of_metrics))
+      if (pgexporter_read_json(config, idx_metrics, config->metrics_path, &number_of_metrics))
       {
          pgexporter_log_error("pgexporter_read_json_metrics_configuration error JSON metrics file: %s", config->metrics_path);
          return 1;
@@ -155,7 +157,7 @@ pgexporter_read_json_metrics_configuration(void* shmem)
                                         "/",
                                         json_files[i]);
 
-         if (pgexporter_read_json(config->prometheus, idx_metrics, json_path, &number_of_metrics))
+         if (pgexporter_read_json(config, idx_metrics, json_path, &number_of_metrics))
          {
             free(json_path);
             json_path = NULL;
@@ -367,7 +369,7 @@ error:
 }
 
 int
-pgexporter_read_json(struct prometheus* prometheus, int prometheus_idx, char* filename, int* number_of_metrics)
+pgexporter_read_json(struct configuration* config, int prometheus_idx, char* filename, int* number_of_metrics)
 {
    struct json* root = NULL;
    json_config_t json_config;
@@ -404,8 +406,6 @@ pgexporter_read_json(struct prometheus* prometheus, int prometheus_idx, char* fi
 
    *number_of_metrics += json_config.n_metrics;
 
-   struct configuration* config = (struct configuration*)shmem;
-
    /* Validate before inserting them */
    if (pgexporter_validate_json_metrics(config, &json_config))
    {
@@ -415,7 +415,7 @@ pgexporter_read_json(struct prometheus* prometheus, int prometheus_idx, char* fi
       return 1;
    }
 
-   ret = semantics_json(prometheus, prometheus_idx, &json_config);
+   ret = semantics_json(config, prometheus_idx, &json_config);
 
    pgexporter_json_destroy(root);
    free_json_config(&json_config);
@@ -586,6 +586,15 @@ parse_metrics(struct json* metrics_array, json_config_t* config)
          current_metric->server = strdup("both"); // default
       }
 
+      if (pgexporter_json_contains_key(metric, "interval"))
+      {
+         current_metric->interval = strdup((char*)pgexporter_json_get(metric, "interval"));
+      }
+      else if (pgexporter_json_contains_key(metric, "ttl"))
+      {
+         current_metric->interval = strdup((char*)pgexporter_json_get(metric, "ttl"));
+      }
+
       if (pgexporter_json_contains_key(metric, "database"))
       {
          char* database = (char*)pgexporter_json_get(metric, "database");
@@ -761,6 +770,10 @@ free_json_metrics(json_metric_t** metrics, size_t n_metrics)
       {
          free((*metrics)[i].server);
       }
+      if ((*metrics)[i].interval)
+      {
+         free((*metrics)[i].interval);
+      }
       if ((*metrics)[i].queries)
       {
          free_json_queries(&(*metrics)[i].queries, (*metrics)[i].n_queries);
@@ -781,7 +794,7 @@ free_json_config(json_config_t* config)
 }
 
 static int
-semantics_json(struct prometheus* prometheus, int prometheus_idx, json_config_t* json_config)
+semantics_json(struct configuration* config, int prometheus_idx, json_config_t* json_config)
 {
    struct prometheus* prom = NULL;
 
@@ -809,7 +822,7 @@ semantics_json(struct prometheus* prometheus, int prometheus_idx, json_config_t*
          return 1;
       }
 
-      prom = &prometheus[prometheus_idx + i];
+      prom = &config->prometheus[prometheus_idx + i];
 
       memcpy(prom->tag, json_config->metrics[i].tag, MIN(PROMETHEUS_LENGTH - 1, strlen(json_config->metrics[i].tag)));
       memcpy(prom->collector, json_config->metrics[i].collector, MIN(MAX_COLLECTOR_LENGTH - 1, strlen(json_config->metrics[i].collector)));
@@ -852,6 +865,12 @@ semantics_json(struct prometheus* prometheus, int prometheus_idx, json_config_t*
       prom->exec_on_all_dbs = json_config->metrics[i].exec_on_all_dbs;
       prom->optional = json_config->metrics[i].optional;
 
+      if (pgexporter_parse_time(json_config->metrics[i].interval, &prom->interval))
+      {
+         pgexporter_log_error("pgexporter: unexpected interval %s", json_config->metrics[i].interval);
+         return 1;
+      }
+
       // Queries
       for (int j = 0; j < json_config->metrics[i].n_queries; j++)
       {
@@ -962,7 +981,6 @@ semantics_json(struct prometheus* prometheus, int prometheus_idx, json_config_t*
                                    "_%s", column_metric_name);
             }
 
-            struct configuration* config = (struct configuration*)shmem;
             if (config->number_of_metric_names < NUMBER_OF_METRIC_NAMES)
             {
                pgexporter_snprintf(config->metric_names[config->number_of_metric_names],
@@ -35,11 +35,26 @@
 #ifdef DEBUG
 #include <assert.h>
 #endif
+#include <stdalign.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
-static struct message* message = NULL;
-static void* data = NULL;
+/** @struct memory_block
+ * A block of an arena
+ */
+struct memory_block
+{
+   struct memory_block* next;        /**< The next block */
+   size_t size;                      /**< The size of the data */
+   size_t used;                      /**< The number of bytes used */
+   alignas(max_align_t) char data[]; /**< The data */
+};
+
+static struct memory_block* memory_block_create(size_t size);
+
+static _Thread_local struct message* message = NULL;
+static _Thread_local void* data = NULL;
 
 void
 pgexporter_memory_init(void)
@@ -153,3 +168,186 @@ pgexporter_memory_dynamic_destroy(void* data)
 {
    free(data);
 }
+
+int
+pgexporter_memory_arena_create(size_t block_size, struct memory_arena** arena)
+{
+   struct memory_arena* a = NULL;
+
+   *arena = NULL;
+
+   a = (struct memory_arena*)malloc(sizeof(struct memory_arena));
+   if (a == NULL)
+   {
+      goto error;
+   }
+
+   memset(a, 0, sizeof(struct memory_arena));
+
+   a->block_size = block_size > 0 ? block_size : MEMORY_ARENA_BLOCK_SIZE;
+
+   *arena = a;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+void*
+pgexporter_memory_arena_alloc(struct memory_arena* arena, size_t size)
+{
+   void* p = NULL;
+   size_t aligned;
+   struct memory_block* block = NULL;
+
+   aligned = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+
+   block = arena->blocks;
+
+   if (aligned > arena->block_size / 4)
+   {
+      /* A large allocation gets its own block, behind the current one */
+      block = memory_block_create(aligned);
+      if (block == NULL)
+      {
+         return NULL;
+      }
+
+      if (arena->blocks != NULL)
+      {
+         block->next = arena->blocks->next;
+         arena->blocks->next = block;
+      }
+      else
+      {
+         arena->blocks = block;
+      }
+
+      arena->number_of_blocks++;
+   }
+   else if (block == NULL || block->used + aligned > block->size)
+   {
+      block = memory_block_create(arena->block_size);
+      if (block == NULL)
+      {
+         return NULL;
+      }
+
+      block->next = arena->blocks;
+      arena->blocks = block;
+
+      arena->number_of_blocks++;
+   }
+
+   p = block->data + block->used;
+   block->used += aligned;
+
+   arena->allocations++;
+   arena->allocated += size;
+
+   memset(p, 0, size);
+
+   return p;
+}
+
+char*
+pgexporter_memory_arena_strdup(struct memory_arena* arena, char* s)
+{
+   size_t length;
+   char* copy = NULL;
+
+   if (s == NULL)
+   {
+      return NULL;
+   }
+
+   length = strlen(s);
+
+   copy = (char*)pgexporter_memory_arena_alloc(arena, length + 1);
+   if (copy != NULL)
+   {
+      memcpy(copy, s, length + 1);
+   }
+
+   return copy;
+}
+
+void
+pgexporter_memory_arena_absorb(struct memory_arena* arena, struct memory_arena* other)
+{
+   struct memory_block* last = NULL;
+
+   if (other == NULL)
+   {
+      return;
+   }
+
+   if (other->blocks != NULL)
+   {
+      /* The blocks go behind the current block, which keeps serving allocations */
+      last = other->blocks;
+      while (last->next != NULL)
+      {
+         last = last->next;
+      }
+
+      if (arena->blocks != NULL)
+      {
+         last->next = arena->blocks->next;
+         arena->blocks->next = other->blocks;
+      }
+      else
+      {
+         arena->blocks = other->blocks;
+      }
+   }
+
+   arena->number_of_blocks += other->number_of_blocks;
+   arena->allocations += other->allocations;
+   arena->allocated += other->allocated;
+
+   other->blocks = NULL;
+   pgexporter_memory_arena_destroy(other);
+}
+
+void
+pgexporter_memory_arena_destroy(struct memory_arena* arena)
+{
+   struct memory_block* block = NULL;
+   struct memory_block* next = NULL;
+
+   if (arena == NULL)
+   {
+      return;
+   }
+
+   block = arena->blocks;
+   while (block != NULL)
+   {
+      next = block->next;
+      free(block);
+      block = next;
+   }
+
+   free(arena);
+}
+
+static struct memory_block*
+memory_block_create(size_t size)
+{
+   struct memory_block* block = NULL;
+
+   block = (struct memory_block*)malloc(sizeof(struct memory_block) + size);
+   if (block == NULL)
+   {
+      return NULL;
+   }
+
+   block->next = NULL;
+   block->size = size;
+   block->used = 0;
+
+   return block;
+}
@@ -297,6 +297,27 @@ pgexporter_write_terminate(SSL* ssl, int socket)
    return ssl_write_message(ssl, &msg);
 }
 
+int
+pgexporter_write_cancel_request(int socket, int pid, int key)
+{
+   char cancel[16];
+   struct message msg;
+
+   memset(&msg, 0, sizeof(struct message));
+   memset(&cancel, 0, sizeof(cancel));
+
+   pgexporter_write_int32(&cancel, 16);
+   pgexporter_write_int32(&(cancel[4]), 80877102);
+   pgexporter_write_int32(&(cancel[8]), pid);
+   pgexporter_write_int32(&(cancel[12]), key);
+
+   msg.kind = 0;
+   msg.length = 16;
+   msg.data = &cancel;
+
+   return write_message(socket, &msg);
+}
+
 int
 pgexporter_write_connection_refused(SSL* ssl, int socket)
 {
@@ -622,6 +643,31 @@ pgexporter_create_startup_message(char* username, char* database, struct message
    return MESSAGE_STATUS_OK;
 }
 
+int
+pgexporter_create_query_message(char* query, struct message** msg)
+{
+   struct message* m = NULL;
+   size_t size;
+
+   size = 1 + 4 + strlen(query) + 1;
+
+   m = (struct message*)malloc(sizeof(struct message));
+   m->data = malloc(size);
+
+   memset(m->data, 0, size);
+
+   m->kind = 'Q';
+   m->length = size;
+
+   pgexporter_write_byte(m->data, 'Q');
+   pgexporter_write_int32(m->data + 1, size - 1);
+   pgexporter_write_string(m->data + 5, query);
+
+   *msg = m;
+
+   return MESSAGE_STATUS_OK;
+}
+
 static int
 read_message(int socket, bool block, int timeout, struct message** msg)
 {
@@ -52,6 +52,7 @@
 #include <netinet/tcp.h>
 
 static int bind_host(const char* hostname, int port, int** fds, int* length);
+static int connect_host(const char* hostname, int port, bool wait, int* fd);
 
 /**
  *
@@ -229,131 +230,16 @@ pgexporter_remove_unix_socket(const char* directory, const char* file)
 int
 pgexporter_connect(const char* hostname, int port, int* fd)
 {
-   struct addrinfo hints = {0};
-   struct addrinfo* servinfo = NULL;
-   struct addrinfo* p = NULL;
-   int yes = 1;
-   socklen_t optlen = sizeof(int);
-   int rv;
-   char sport[6];
-   int error = 0;
-   int default_buffer_size = DEFAULT_BUFFER_SIZE;
-   struct configuration* config;
-
-   config = (struct configuration*)shmem;
-
-   memset(&sport, 0, sizeof(sport));
-   pgexporter_snprintf(&sport[0], sizeof(sport), "%d", port);
-
-   /* Connect to server */
-   memset(&hints, 0, sizeof hints);
-   hints.ai_family = AF_UNSPEC;
-   hints.ai_socktype = SOCK_STREAM;
-
-   if ((rv = getaddrinfo(hostname, &sport[0], &hints, &servinfo)) != 0)
-   {
-      pgexporter_log_debug("getaddrinfo: %s", gai_strerror(rv));
-      if (servinfo != NULL)
-      {
-         freeaddrinfo(servinfo);
-      }
-      return 1;
-   }
-
-   *fd = -1;
-
-   /* Loop through all the results and connect to the first we can */
-   for (p = servinfo; *fd == -1 && p != NULL; p = p->ai_next)
-   {
-      if ((*fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1)
-      {
-         error = errno;
-         errno = 0;
-      }
-
-      if (*fd != -1)
-      {
-         if (config != NULL && config->keep_alive)
-         {
-            if (setsockopt(*fd, SOL_SOCKET, SO_KEEPALIVE, &yes, optlen) == -1)
-            {
-               error = errno;
-               pgexporter_disconnect(*fd);
-               errno = 0;
-               *fd = -1;
-               continue;
-            }
-         }
-
-         if (config != NULL && config->nodelay)
-         {
-            if (setsockopt(*fd, IPPROTO_TCP, TCP_NODELAY, &yes, optlen) == -1)
-            {
-               error = errno;
-               pgexporter_disconnect(*fd);
-               errno = 0;
-               *fd = -1;
-               continue;
-            }
-         }
-
-         if (config != NULL)
-         {
-            if (setsockopt(*fd, SOL_SOCKET, SO_RCVBUF, &default_buffer_size, optlen) == -1)
-            {
-               error = errno;
-               pgexporter_disconnect(*fd);
-               errno = 0;
-               *fd = -1;
-               continue;
-            }
-
-            if (setsockopt(*fd, SOL_SOCKET, SO_SNDBUF, &default_buffer_size, optlen) == -1)
-            {
-               error = errno;
-               pgexporter_disconnect(*fd);
-               errno = 0;
-               *fd = -1;
-               continue;
-            }
-         }
-
-         if (connect(*fd, p->ai_addr, p->ai_addrlen) == -1)
-         {
-            error = errno;
-            pgexporter_disconnect(*fd);
-            errno = 0;
-            *fd = -1;
-            continue;
-         }
-      }
-   }
-
-   if (*fd == -1)
-   {
-      goto error;
-   }
-
-   freeaddrinfo(servinfo);
-
-   /* Set O_NONBLOCK on the socket */
-   if (config != NULL && config->non_blocking)
-   {
-      pgexporter_socket_nonblocking(*fd, true);
-   }
-
-   return 0;
-
-error:
-
-   pgexporter_log_debug("pgexporter_connect: %s", strerror(error));
-
-   if (servinfo != NULL)
-   {
-      freeaddrinfo(servinfo);
-   }
+   return connect_host(hostname, port, true, fd);
+}
 
-   return 1;
+/**
+ *
+ */
+int
+pgexporter_connect_start(const char* hostname, int port, int* fd)
+{
+   return connect_host(hostname, port, false, fd);
 }
 
 /**
@@ -677,3 +563,141 @@ bind_host(const char* hostname, int port, int** fds, int* length)
 
    return 0;
 }
+
+static int
+connect_host(const char* hostname, int port, bool wait, int* fd)
+{
+   struct addrinfo hints = {0};
+   struct addrinfo* servinfo = NULL;
+   struct addrinfo* p = NULL;
+   int yes = 1;
+   socklen_t optlen = sizeof(int);
+   int rv;
+   char sport[6];
+   int error = 0;
+   int default_buffer_size = DEFAULT_BUFFER_SIZE;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   memset(&sport, 0, sizeof(sport));
+   pgexporter_snprintf(&sport[0], sizeof(sport), "%d", port);
+
+   /* Connect to server */
+   memset(&hints, 0, sizeof hints);
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+
+   if ((rv = getaddrinfo(hostname, &sport[0], &hints, &servinfo)) != 0)
+   {
+      pgexporter_log_debug("getaddrinfo: %s", gai_strerror(rv));
+      if (servinfo != NULL)
+      {
+         freeaddrinfo(servinfo);
+      }
+      return 1;
+   }
+
+   *fd = -1;
+
+   /* Loop through all the results and connect to the first we can */
+   for (p = servinfo; *fd == -1 && p != NULL; p = p->ai_next)
+   {
+      if ((*fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1)
+      {
+         error = errno;
+         errno = 0;
+      }
+
+      if (*fd != -1)
+      {
+         if (config != NULL && config->keep_alive)
+         {
+            if (setsockopt(*fd, SOL_SOCKET, SO_KEEPALIVE, &yes, optlen) == -1)
+            {
+               error = errno;
+               pgexporter_disconnect(*fd);
+               errno = 0;
+               *fd = -1;
+               continue;
+            }
+         }
+
+         if (config != NULL && config->nodelay)
+         {
+            if (setsockopt(*fd, IPPROTO_TCP, TCP_NODELAY, &yes, optlen) == -1)
+            {
+               error = errno;
+               pgexporter_disconnect(*fd);
+               errno = 0;
+               *fd = -1;
+               continue;
+            }
+         }
+
+         if (config != NULL)
+         {
+            if (setsockopt(*fd, SOL_SOCKET, SO_RCVBUF, &default_buffer_size, optlen) == -1)
+            {
+               error = errno;
+               pgexporter_disconnect(*fd);
+               errno = 0;
+               *fd = -1;
+               continue;
+            }
+
+            if (setsockopt(*fd, SOL_SOCKET, SO_SNDBUF, &default_buffer_size, optlen) == -1)
+            {
+               error = errno;
+               pgexporter_disconnect(*fd);
+               errno = 0;
+               *fd = -1;
+               continue;
+            }
+         }
+
+         /* The caller waits for the socket to become writable instead */
+         if (!wait)
+         {
+            pgexporter_socket_nonblocking(*fd, true);
+         }
+
+         if (connect(*fd, p->ai_addr, p->ai_addrlen) == -1 && (wait || errno != EINPROGRESS))
+         {
+            error = errno;
+            pgexporter_disconnect(*fd);
+            errno = 0;
+            *fd = -1;
+            continue;
+         }
+      }
+   }
+
+   if (*fd == -1)
+   {
+      goto error;
+   }
+
+   freeaddrinfo(servinfo);
+
+   errno = 0;
+
+   /* Set O_NONBLOCK on the socket */
+   if (wait && config != NULL && config->non_blocking)
+   {
+      pgexporter_socket_nonblocking(*fd, true);
+   }
+
+   return 0;
+
+error:
+
+   pgexporter_log_debug("pgexporter_connect: %s", strerror(error));
+
+   if (servinfo != NULL)
+   {
+      freeaddrinfo(servinfo);
+   }
+
+   return 1;
+}
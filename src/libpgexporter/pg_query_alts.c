@@ -231,5 +231,6 @@ pgexporter_free_pg_node_avl(struct pg_query_alts** root)
    pgexporter_free_pg_node_avl(&(*root)->left);
    pgexporter_free_pg_node_avl(&(*root)->right);
 
-   pgexporter_destroy_shared_memory(&root, sizeof(struct pg_query_alts*));
+   pgexporter_destroy_shared_memory(*root, sizeof(struct pg_query_alts));
+   *root = NULL;
 }
@@ -30,8 +30,10 @@
 #include <openssl/crypto.h>
 #include <pgexporter.h>
 #include <art.h>
+#include <column_store.h>
 #include <extension.h>
 #include <fips.h>
+#include <gzip_compression.h>
 #include <http.h>
 #include <logging.h>
 #include <memory.h>
@@ -44,13 +46,20 @@
 #include <security.h>
 #include <shmem.h>
 #include <cache.h>
+#include <engine.h>
 #include <utils.h>
+#include <zstandard_compression.h>
 
 /* system */
 #include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 
@@ -69,6 +78,18 @@
 #define INPUT_DATA                       1
 #define INPUT_WAL                        2
 
+#define ENGINE_STAGE_OPEN                0
+#define ENGINE_STAGE_GENERAL             1
+#define ENGINE_STAGE_CUSTOM              2
+#define ENGINE_STAGE_EXTENSION           3
+#define ENGINE_STAGE_DONE                4
+
+/* Time kept from the scrape timeout of Prometheus for sending the response */
+#define SCRAPE_TIMEOUT_MARGIN_MS         500
+#define SCRAPE_CANCEL_INTERVAL_MS        100
+
+#define METRICS_GZIP_LEVEL               1
+
 /**
  * This is a linked list of queries with the data received from the server
  * as well as the query sent to the server and other meta data.
@@ -78,43 +99,178 @@ typedef struct query_list
    struct query* query;
    struct query_list* next;
    struct pg_query_alts* query_alt;
-   char tag[PROMETHEUS_LENGTH];
+   struct metric_plan* plan;
+   char* tag;
    int sort_type;
    bool error;
    char database[DB_NAME_LENGTH];
+   int metric;
+   bool cached;
 } query_list_t;
 
 /**
- * This is one of the nodes of a linked list of a column entry.
+ * The last results of a metric with a refresh interval.
+ *
+ * The caches are kept per server by the process that collects the
+ * metrics. Only the collection of a server touches its cache, so the
+ * collection workers don't need any locking. The cache owns the
+ * queries, and the nodes handed out to a collection are marked as cached
+ **/
+typedef struct metric_cache
+{
+   int64_t collected;     /* Monotonic time of the collection in milliseconds */
+   query_list_t* results; /* The results, one node for each database */
+} metric_cache_t;
+
+/**
+ * The version resolved query of a metric on a server, along with what
+ * the collection and the formatting need to know about its columns
+ **/
+typedef struct metric_plan
+{
+   int metric;                            /* The index of the metric, or -1 for an extension metric */
+   struct prometheus* prom;               /* The metric */
+   struct pg_query_alts* query_alt;       /* The query for the version of the server */
+   char* extension;                       /* The extension of the metric, or NULL */
+   char* key;                             /* The key of the metric in the metric cache */
+   char* names[MAX_NUMBER_OF_COLUMNS];    /* The column names of the request */
+   int n_labels;                          /* The number of label columns */
+   int labels[MAX_NUMBER_OF_COLUMNS];     /* The label columns */
+   bool database_label;                   /* Is one of the labels named database */
+   char* prefixes[MAX_NUMBER_OF_COLUMNS]; /* The metric name of each value column */
+} metric_plan_t;
+
+/**
+ * An extension as it was detected when a query plan was made
+ **/
+typedef struct plan_extension
+{
+   char name[MISC_LENGTH]; /* The name */
+   bool enabled;           /* Is the extension enabled */
+   struct version version; /* The installed version */
+} plan_extension_t;
+
+/**
+ * The queries of a server, resolved for its version.
  *
- * Since columns are the fundamental unit in a metric and since
- * due to different versions of servers, each query might have
- * a variable structure, dividing each query into its constituent
- * columns is needed.
+ * Which query a metric runs only depends on what was detected about the
+ * server when it was connected, so the plan is made once and reused by
+ * every collection until the version, the role or the extensions of the
+ * server change. The plans are kept per server by the process that
+ * collects the metrics, like the metric caches, and a reload starts that
+ * process over
+ **/
+typedef struct query_plan
+{
+   int version;                                       /* The major version of the server */
+   int minor_version;                                 /* The minor version of the server */
+   int state;                                         /* The state of the server */
+   int number_of_extensions;                          /* The number of extensions */
+   plan_extension_t extensions[NUMBER_OF_EXTENSIONS]; /* The extensions */
+   int number_of_metrics;                             /* The number of metrics that run on the server */
+   metric_plan_t* metrics;                            /* The metrics, ordered by index */
+   int number_of_extension_metrics;                   /* The number of extension metrics that run on the server */
+   metric_plan_t* extension_metrics;                  /* The extension metrics */
+} query_plan_t;
+
+/**
+ * The results of the queries executed against a single server.
  *
- * Then each received tuple can have their individual column values
- * appended to the suitable linked list of `column_node_t`.
+ * The collection is filled in by `collect_server()`, either directly
+ * or from one of the collection workers, and is consumed when the
+ * metrics are formatted. Each server only touches its own collection,
+ * so the workers don't need any locking. Only the querying flag is
+ * read by the watchdog that cancels the queries at the deadline.
  **/
-typedef struct column_node
+typedef struct server_collection
 {
-   char* data;
-   struct tuple* tuple;
-   struct column_node* next;
-} column_node_t;
+   struct query* version;
+   struct query* uptime;
+   struct query* primary;
+   struct query* settings;
+   bool fips;
+   query_list_t* custom;
+   query_list_t* extension;
+   int alerts[NUMBER_OF_ALERTS];
+   struct memory_arena* arena;
+   atomic_bool querying;
+} server_collection_t;
 
 /**
- * It stores the metadata of a `column_node_t` linked list.
- * Meant to be used as part of an array
+ * The work queue shared by the collection workers and the watchdog
  **/
-typedef struct column_store
+typedef struct collection_pool
 {
-   column_node_t* columns;
-   column_node_t* last_column;
-   char tag[PROMETHEUS_LENGTH];
-   int type;
-   char name[PROMETHEUS_LENGTH];
-   int sort_type;
-} column_store_t;
+   server_collection_t* collections;
+   int number_of_servers;
+   atomic_int next;
+   bool finished;
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+} collection_pool_t;
+
+/**
+ * The custom metrics of a server while they are collected.
+ *
+ * The plan is made once, and the requests are then built for one
+ * database at a time, so the same state drives both the blocking
+ * collection and the event driven engine
+ **/
+typedef struct custom_collection
+{
+   int64_t now;                                      /* Monotonic time of the collection in milliseconds */
+   int database;                                     /* The index of the next database */
+   int n_requests;                                   /* The number of requests for the current database */
+   query_plan_t* query_plan;                         /* The plan of the server */
+   metric_plan_t* plan[NUMBER_OF_METRICS];           /* The plan of each metric, or NULL */
+   metric_cache_t* hits[NUMBER_OF_METRICS];          /* The cached results of each metric, or NULL */
+   bool failed[NUMBER_OF_METRICS];                   /* Did a query of the metric fail */
+   query_list_t* heads[NUMBER_OF_METRICS];           /* The first result of each metric */
+   query_list_t* tails[NUMBER_OF_METRICS];           /* The last result of each metric */
+   struct query_request requests[NUMBER_OF_METRICS]; /* The requests for the current database */
+   int metrics[NUMBER_OF_METRICS];                   /* The metric of each request */
+} custom_collection_t;
+
+/**
+ * The extension metrics of a server while they are collected
+ **/
+typedef struct extension_collection
+{
+   int64_t now;                    /* Monotonic time of the collection in milliseconds */
+   int n_entries;                  /* The number of metrics */
+   int n_requests;                 /* The number of requests */
+   struct query_request* requests; /* The requests */
+   metric_plan_t** plans;          /* The plan of each entry */
+   metric_cache_t** hits;          /* The cached results of each entry, or NULL */
+   int* slots;                     /* The request of each entry, or -1 */
+} extension_collection_t;
+
+/**
+ * The collection of a server run by the event driven engine
+ **/
+typedef struct engine_collection
+{
+   int stage;                                           /* The stage */
+   server_collection_t* collection;                     /* The collection */
+   bool opened;                                         /* Was the connection opened by this collection */
+   struct query_request open[OPEN_CONNECTION_REQUESTS]; /* The requests of a new connection */
+   struct query_request general[4];                     /* The version, uptime, primary and settings requests */
+   int n_general;                                       /* The number of general requests */
+   custom_collection_t* custom;                         /* The custom metrics */
+   extension_collection_t* extension;                   /* The extension metrics */
+} engine_collection_t;
+
+/**
+ * The arena used while the metrics of a collection are formatted.
+ *
+ * Column nodes and escaped keys only live until the exposition is
+ * assembled, so they are taken from the arena when one is active
+ * and released all at once with it.
+ **/
+static _Thread_local struct memory_arena* scrape_arena = NULL;
+
+typedef struct column_node column_node_t;
+typedef struct column_store column_store_t;
 
 /**
  * ART-based metric value with timestamp
@@ -153,44 +309,99 @@ static int create_metrics_container(prometheus_metrics_container_t** container);
 static void destroy_metrics_container(prometheus_metrics_container_t* container);
 static int add_metric_to_art(struct art* art_tree, char* key, char* value,
                              char* help, char* type, int sort_type);
-static void output_art_metrics(SSL* client_ssl, int client_fd, struct art* art_tree);
-static void output_all_metrics(SSL* client_ssl, int client_fd, prometheus_metrics_container_t* container);
+static void output_art_metrics(struct art* art_tree, struct string_builder* sb);
+static void output_all_metrics(prometheus_metrics_container_t* container, struct string_builder* sb);
 
 static int resolve_page(struct message* msg);
+static int resolve_encoding(struct message* msg);
+static int64_t resolve_scrape_timeout(struct message* msg);
+static int accepted_encoding(char* value, size_t length);
 static int badrequest_page(SSL* client_ssl, int client_fd);
 static int unknown_page(SSL* client_ssl, int client_fd);
 static int home_page(SSL* client_ssl, int client_fd);
-static int metrics_page(SSL* client_ssl, int client_fd);
+static int metrics_page(SSL* client_ssl, int client_fd, int encoding, int64_t timeout);
+static int snapshot_page(SSL* client_ssl, int client_fd, int encoding, int64_t timeout);
+static int collect_metrics_page(SSL* client_ssl, int client_fd, int encoding, int64_t timeout);
+static int metrics_body_page(SSL* client_ssl, int client_fd, char* body, size_t length, time_t age, int encoding);
+static int metrics_stored_body_page(SSL* client_ssl, int client_fd, char* body, size_t length, time_t age, int body_encoding, int encoding);
+static int metrics_encode(char* data, int encoding, unsigned char** buffer, size_t* buffer_size);
+static void metrics_encode_requested(char* data, unsigned char** encoded, size_t* encoded_length);
+static void metrics_encoded_free(unsigned char** encoded);
 static int bad_request(SSL* client_ssl, int client_fd);
+static int unavailable_page(SSL* client_ssl, int client_fd);
+static bool waited_too_long(int64_t start, int64_t timeout);
 static int redirect_page(SSL* client_ssl, int client_fd, char* path);
 
 static bool allowed_collector(const char* collector);
 static bool excluded_collector(const char* collector);
 static bool collector_pass(const char* collector);
+static bool evaluate_alert(int64_t value, enum alert_operator op, int64_t threshold);
 
 static void add_column_to_store(column_store_t* store, int n_store, char* data, int sort_type, struct tuple* current);
 
+static int collect_metrics(int64_t timeout, char** body);
+static int64_t configured_scrape_timeout(void);
+static bool scrape_deadline_passed(void);
+static int create_collections(server_collection_t** collections);
+static void destroy_query_list(query_list_t* list);
+static void destroy_collections(server_collection_t* collections);
+static void collect_servers(server_collection_t* collections);
+static void* collection_worker(void* arg);
+static void collection_run(collection_pool_t* pool);
+static void* collection_watchdog(void* arg);
+static void collection_cancel(collection_pool_t* pool);
+static void collect_server(int server, server_collection_t* collection);
+static void collect_fips(int server, server_collection_t* collection);
+static void collect_servers_engine(server_collection_t* collections);
+static bool engine_next_cb(int server, struct engine_batch* batch, void* data);
+static void engine_done_cb(int server, struct engine_batch* batch, int status, void* data);
+static void collect_custom_metrics(int server, server_collection_t* collection);
+static custom_collection_t* custom_metrics_plan(int server);
+static char* custom_metrics_next(int server, custom_collection_t* custom);
+static void custom_metrics_results(int server, custom_collection_t* custom, char* database, int ret);
+static void custom_metrics_finish(int server, custom_collection_t* custom, server_collection_t* collection);
+static void collect_extension_metrics(int server, server_collection_t* collection);
+static extension_collection_t* extension_metrics_plan(int server);
+static void extension_metrics_finish(int server, extension_collection_t* extension, server_collection_t* collection);
+static void collect_alerts(int server, server_collection_t* collection);
+
+static int64_t monotonic_milliseconds(void);
+static metric_cache_t* metric_cache_lookup(int server, char* key, pgexporter_time_t interval, int64_t now);
+static void metric_cache_store(int server, char* key, query_list_t* results, int64_t now);
+static query_list_t* metric_cache_results(metric_cache_t* cache, query_list_t** tail);
+static void metric_cache_destroy_cb(uintptr_t data);
+static void destroy_metric_caches(void);
+static bool metric_interval_active(struct prometheus* prom);
+static query_plan_t* query_plan(int server);
+static bool query_plan_is_valid(query_plan_t* plan, int server);
+static query_plan_t* query_plan_create(int server);
+static int metric_plan_init(metric_plan_t* mp, int metric, struct prometheus* prom, struct pg_query_alts* query_alt, char* extension);
+static void query_plan_destroy(query_plan_t* plan);
+static void destroy_query_plans(void);
+
 static void query_statistics_information(prometheus_metrics_container_t* container);
 static void general_information(prometheus_metrics_container_t* container);
+static void append_latency_histogram(struct string_builder* sb, char* name, char* labels, struct latency_histogram* histogram);
 static void core_information(prometheus_metrics_container_t* container);
 static void extension_list_information(prometheus_metrics_container_t* container);
 static void server_information(prometheus_metrics_container_t* container);
-static void version_information(prometheus_metrics_container_t* container);
-static void uptime_information(prometheus_metrics_container_t* container);
-static void primary_information(prometheus_metrics_container_t* container);
-static void settings_information(prometheus_metrics_container_t* container);
-static void fips_information(prometheus_metrics_container_t* container);
-static void custom_metrics(prometheus_metrics_container_t* container); // Handles custom metrics provided in YAML format, both internal and external
-static void extension_metrics(prometheus_metrics_container_t* container);
-static void alert_information(prometheus_metrics_container_t* container);
-static void prometheus_endpoints_information(SSL* client_ssl, int client_fd);
+static void version_information(prometheus_metrics_container_t* container, server_collection_t* collections);
+static void uptime_information(prometheus_metrics_container_t* container, server_collection_t* collections);
+static void primary_information(prometheus_metrics_container_t* container, server_collection_t* collections);
+static void settings_information(prometheus_metrics_container_t* container, server_collection_t* collections);
+static void fips_information(prometheus_metrics_container_t* container, server_collection_t* collections);
+static void custom_metrics(prometheus_metrics_container_t* container, server_collection_t* collections); // Handles custom metrics provided in YAML format, both internal and external
+static void extension_metrics(prometheus_metrics_container_t* container, server_collection_t* collections);
+static void alert_information(prometheus_metrics_container_t* container, server_collection_t* collections);
+static void prometheus_endpoints_information(struct string_builder* sb);
 static void append_help_info(char** data, char* tag, char* name, char* description);
 static void append_type_info(char** data, char* tag, char* name, int typeId);
 
-static void handle_histogram(column_store_t* store, int* n_store, query_list_t* temp);
-static void handle_default_histogram(column_store_t* store, int* n_store, query_list_t* temp);
-static void handle_gauge_counter(column_store_t* store, int* n_store, query_list_t* temp);
-static void handle_default_gauge_counter(column_store_t* store, int* n_store, query_list_t* temp);
+static void handle_histogram(column_store_t* store, int* n_store, struct art* index, query_list_t* temp);
+static void append_histogram_labels(struct string_builder* sb, query_list_t* temp, struct tuple* current, int h_idx);
+static void handle_default_histogram(column_store_t* store, int* n_store, struct art* index, query_list_t* temp);
+static void handle_gauge_counter(column_store_t* store, int* n_store, struct art* index, query_list_t* temp);
+static void handle_default_gauge_counter(column_store_t* store, int* n_store, struct art* index, query_list_t* temp);
 
 static int send_chunk(SSL* client_ssl, int client_fd, char* data);
 static int parse_list(char* list_str, char** strs, int* n_strs);
@@ -198,26 +409,65 @@ static int parse_list(char* list_str, char** strs, int* n_strs);
 static char* get_value(char* tag, char* name, char* val);
 static int safe_prometheus_key_additional_length(char* key);
 static char* safe_prometheus_key(char* key);
-static char* safe_prometheus_attribute(char* attr, int type_oid);
+static void append_safe_attribute(struct string_builder* sb, char* attr, int type_oid);
 static void safe_prometheus_key_free(char* key);
+static void* scrape_alloc(size_t size);
+static void scrape_free(void* ptr);
+static void scrape_statistics(server_collection_t* collections);
 
 static bool is_metrics_cache_configured(void);
 static bool is_metrics_cache_valid(void);
-static bool metrics_cache_append(char* data);
-static bool metrics_cache_finalize(void);
+static bool is_metrics_cache_stale(void);
+static int metrics_cache_get(int encoding, char** body, size_t* length, time_t* created, time_t* valid_until, int* body_encoding);
+static bool metrics_cache_publish(char* data, unsigned char** encoded, size_t* encoded_length);
 static size_t metrics_cache_size_to_alloc(void);
 static void metrics_cache_invalidate(void);
 
+static bool metrics_snapshot_publish(char* data);
+static void collector_shutdown_cb(int signum);
+
+static volatile sig_atomic_t collector_running = 1;
+static bool keep_alive = false;
+
+/* The deadline of the collection in monotonic milliseconds, or 0 for none */
+static int64_t scrape_deadline = 0;
+static atomic_bool scrape_partial = false;
+
+static struct art* metric_caches[NUMBER_OF_SERVERS];
+static query_plan_t* query_plans[NUMBER_OF_SERVERS];
+
 void
 pgexporter_prometheus(SSL* client_ssl, int client_fd)
+{
+   int requests = 0;
+   int ret;
+
+   pgexporter_start_logging();
+   pgexporter_memory_init();
+
+   ret = pgexporter_prometheus_serve(client_ssl, client_fd, &requests);
+
+   pgexporter_close_ssl(client_ssl);
+   pgexporter_disconnect(client_fd);
+
+   pgexporter_memory_destroy();
+   pgexporter_stop_logging();
+
+   OPENSSL_cleanup();
+
+   exit(ret);
+}
+
+int
+pgexporter_prometheus_serve(SSL* client_ssl, int client_fd, int* requests)
 {
    int status;
    int page;
+   int encoding;
    struct message* msg = NULL;
    struct configuration* config;
 
-   pgexporter_start_logging();
-   pgexporter_memory_init();
+   *requests = 0;
 
    config = (struct configuration*)shmem;
    if (client_ssl)
@@ -266,15 +516,9 @@ pgexporter_prometheus(SSL* client_ssl, int client_fd)
             goto error;
          }
 
-         pgexporter_close_ssl(client_ssl);
-         pgexporter_disconnect(client_fd);
-
-         pgexporter_memory_destroy();
-         pgexporter_stop_logging();
-
          free(base_url);
 
-         exit(0);
+         return 0;
       }
    }
    status = pgexporter_read_timeout_message(client_ssl, client_fd, (int)pgexporter_time_convert(config->authentication_timeout, FORMAT_TIME_S), &msg);
@@ -284,48 +528,51 @@ pgexporter_prometheus(SSL* client_ssl, int client_fd)
       goto error;
    }
 
-   page = resolve_page(msg);
-
-   if (page == PAGE_HOME)
-   {
-      home_page(client_ssl, client_fd);
-   }
-   else if (page == PAGE_METRICS)
-   {
-      metrics_page(client_ssl, client_fd);
-   }
-   else if (page == PAGE_UNKNOWN)
-   {
-      unknown_page(client_ssl, client_fd);
-   }
-   else
+   while (true)
    {
-      bad_request(client_ssl, client_fd);
-   }
+      (*requests)++;
+      keep_alive = pgexporter_http_keep_alive(msg, *requests);
 
-   pgexporter_close_ssl(client_ssl);
-   pgexporter_disconnect(client_fd);
+      encoding = resolve_encoding(msg);
+      page = resolve_page(msg);
 
-   pgexporter_memory_destroy();
-   pgexporter_stop_logging();
+      if (page == PAGE_HOME)
+      {
+         status = home_page(client_ssl, client_fd);
+      }
+      else if (page == PAGE_METRICS)
+      {
+         status = metrics_page(client_ssl, client_fd, encoding, resolve_scrape_timeout(msg));
+      }
+      else if (page == PAGE_UNKNOWN)
+      {
+         status = unknown_page(client_ssl, client_fd);
+      }
+      else
+      {
+         status = bad_request(client_ssl, client_fd);
+      }
 
-   OPENSSL_cleanup();
+      /* Serve the next request on the same connection until it goes idle */
+      if (status || !keep_alive ||
+          !pgexporter_http_wait_request(client_ssl, client_fd))
+      {
+         break;
+      }
 
-   exit(0);
+      if (pgexporter_read_timeout_message(client_ssl, client_fd, (int)pgexporter_time_convert(config->authentication_timeout, FORMAT_TIME_S), &msg) != MESSAGE_STATUS_OK)
+      {
+         break;
+      }
+   }
+
+   return 0;
 
 error:
 
    badrequest_page(client_ssl, client_fd);
 
-   pgexporter_close_ssl(client_ssl);
-   pgexporter_disconnect(client_fd);
-
-   pgexporter_memory_destroy();
-   pgexporter_stop_logging();
-
-   OPENSSL_cleanup();
-
-   exit(1);
+   return 1;
 }
 
 void
@@ -464,6 +711,145 @@ resolve_page(struct message* msg)
    return PAGE_UNKNOWN;
 }
 
+/**
+ * Resolves the content encoding of the response from the
+ * Accept-Encoding header of the request.
+ *
+ * @param msg the request
+ * @return the content encoding, CONTENT_ENCODING_IDENTITY if none is accepted
+ */
+static int
+resolve_encoding(struct message* msg)
+{
+   char* value = NULL;
+   int encoding = CONTENT_ENCODING_IDENTITY;
+
+   value = pgexporter_http_get_request_header(msg, "Accept-Encoding");
+   if (value != NULL)
+   {
+      encoding = accepted_encoding(value, strlen(value));
+      free(value);
+   }
+
+   return encoding;
+}
+
+/**
+ * Resolves the time budget of a scrape. The X-Prometheus-Scrape-Timeout-Seconds
+ * header of the request lowers the configured budget, less a margin for
+ * sending the response.
+ *
+ * @param msg the request
+ * @return the budget in milliseconds, 0 if the scrape has none
+ */
+static int64_t
+resolve_scrape_timeout(struct message* msg)
+{
+   char* value = NULL;
+   double seconds;
+   int64_t header;
+   int64_t timeout;
+
+   timeout = configured_scrape_timeout();
+   if (timeout <= 0)
+   {
+      return 0;
+   }
+
+   value = pgexporter_http_get_request_header(msg, "X-Prometheus-Scrape-Timeout-Seconds");
+   if (value != NULL)
+   {
+      seconds = strtod(value, NULL);
+      free(value);
+
+      if (seconds > 0.0)
+      {
+         header = (int64_t)(seconds * 1000.0);
+         header = MAX(header - SCRAPE_TIMEOUT_MARGIN_MS, header / 2);
+
+         timeout = MIN(timeout, header);
+      }
+   }
+
+   return timeout;
+}
+
+/**
+ * Picks the preferred content encoding from the value of
+ * an Accept-Encoding header. zstd is preferred over gzip,
+ * and codings with a zero quality value are refused.
+ *
+ * @param value the header value
+ * @param length the length of the header value
+ * @return the content encoding
+ */
+static int
+accepted_encoding(char* value, size_t length)
+{
+   char buffer[MISC_LENGTH];
+   char* token = NULL;
+   char* params = NULL;
+   char* saveptr = NULL;
+   char* quality = NULL;
+   bool gzip = false;
+   bool zstd = false;
+
+   length = MIN(length, sizeof(buffer) - 1);
+   memcpy(buffer, value, length);
+   buffer[length] = '\0';
+
+   token = strtok_r(buffer, ",", &saveptr);
+   while (token != NULL)
+   {
+      bool accepted = true;
+
+      params = strchr(token, ';');
+      if (params != NULL)
+      {
+         *params = '\0';
+         quality = strstr(params + 1, "q=");
+         if (quality != NULL && strtod(quality + 2, NULL) <= 0.0)
+         {
+            accepted = false;
+         }
+      }
+
+      while (*token == ' ' || *token == '\t')
+      {
+         token++;
+      }
+      for (char* e = token + strlen(token); e > token && (*(e - 1) == ' ' || *(e - 1) == '\t'); e--)
+      {
+         *(e - 1) = '\0';
+      }
+
+      if (accepted)
+      {
+         if (!strcasecmp(token, "zstd"))
+         {
+            zstd = true;
+         }
+         else if (!strcasecmp(token, "gzip") || !strcasecmp(token, "x-gzip") || !strcmp(token, "*"))
+         {
+            gzip = true;
+         }
+      }
+
+      token = strtok_r(NULL, ",", &saveptr);
+   }
+
+   if (zstd)
+   {
+      return CONTENT_ENCODING_ZSTD;
+   }
+   else if (gzip)
+   {
+      return CONTENT_ENCODING_GZIP;
+   }
+
+   return CONTENT_ENCODING_IDENTITY;
+}
+
 static int
 badrequest_page(SSL* client_ssl, int client_fd)
 {
@@ -482,11 +868,14 @@ badrequest_page(SSL* client_ssl, int client_fd)
    ctime_r(&now, &time_buf[0]);
    time_buf[strlen(time_buf) - 1] = 0;
 
-   data = pgexporter_vappend(data, 4,
+   data = pgexporter_vappend(data, 5,
                              "HTTP/1.1 400 Bad Request\r\n",
                              "Date: ",
                              &time_buf[0],
-                             "\r\n");
+                             "\r\n",
+                             "Content-Length: 0\r\n");
+   data = pgexporter_http_connection_headers(data, keep_alive);
+   data = pgexporter_append(data, "\r\n");
 
    msg.kind = 0;
    msg.length = strlen(data);
@@ -496,7 +885,7 @@ badrequest_page(SSL* client_ssl, int client_fd)
 
    free(data);
 
-   return status;
+   return status == MESSAGE_STATUS_OK ? 0 : 1;
 }
 
 static int
@@ -517,11 +906,14 @@ unknown_page(SSL* client_ssl, int client_fd)
    ctime_r(&now, &time_buf[0]);
    time_buf[strlen(time_buf) - 1] = 0;
 
-   data = pgexporter_vappend(data, 4,
+   data = pgexporter_vappend(data, 5,
                              "HTTP/1.1 403 Forbidden\r\n",
                              "Date: ",
                              &time_buf[0],
-                             "\r\n");
+                             "\r\n",
+                             "Content-Length: 0\r\n");
+   data = pgexporter_http_connection_headers(data, keep_alive);
+   data = pgexporter_append(data, "\r\n");
 
    msg.kind = 0;
    msg.length = strlen(data);
@@ -531,7 +923,7 @@ unknown_page(SSL* client_ssl, int client_fd)
 
    free(data);
 
-   return status;
+   return status == MESSAGE_STATUS_OK ? 0 : 1;
 }
 
 static int
@@ -552,14 +944,15 @@ home_page(SSL* client_ssl, int client_fd)
    ctime_r(&now, &time_buf[0]);
    time_buf[strlen(time_buf) - 1] = 0;
 
-   data = pgexporter_vappend(data, 7,
+   data = pgexporter_vappend(data, 6,
                              "HTTP/1.1 200 OK\r\n",
                              "Content-Type: text/html; charset=utf-8\r\n",
                              "Date: ",
                              &time_buf[0],
                              "\r\n",
-                             "Transfer-Encoding: chunked\r\n",
-                             "\r\n");
+                             "Transfer-Encoding: chunked\r\n");
+   data = pgexporter_http_connection_headers(data, keep_alive);
+   data = pgexporter_append(data, "\r\n");
 
    msg.kind = 0;
    msg.length = strlen(data);
@@ -598,11 +991,23 @@ home_page(SSL* client_ssl, int client_fd)
                              "  <li>pgexporter_logging_error</li>\n",
                              "  <li>pgexporter_logging_fatal</li>\n");
 
+   data = pgexporter_vappend(data, 4,
+                             "  <li>pgexporter_metrics_cache_hits_total</li>\n",
+                             "  <li>pgexporter_metrics_cache_misses_total</li>\n",
+                             "  <li>pgexporter_scrape_phase_seconds</li>\n",
+                             "  <li>pgexporter_query_duration_seconds</li>\n");
+
    data = pgexporter_vappend(data, 3,
                              "  <li>pgexporter_query_executions_total</li>\n",
                              "  <li>pgexporter_query_errors_total</li>\n",
                              "  <li>pgexporter_query_timeouts_total</li>\n");
 
+   data = pgexporter_vappend(data, 4,
+                             "  <li>pgexporter_scrape_allocations</li>\n",
+                             "  <li>pgexporter_scrape_allocated_bytes</li>\n",
+                             "  <li>pgexporter_scrape_arena_blocks</li>\n",
+                             "  <li>pgexporter_scrape_partial</li>\n");
+
    data = pgexporter_vappend(data, 7,
                              "  <li>pgexporter_alert_postgresql_down</li>\n",
                              "  <li>pgexporter_alert_connections_high</li>\n",
@@ -649,13 +1054,16 @@ home_page(SSL* client_ssl, int client_fd)
                              "</body>\n",
                              "</html>\n");
 
-   /* Footer */
-   data = pgexporter_append(data, "\r\n\r\n");
-
    send_chunk(client_ssl, client_fd, data);
    free(data);
    data = NULL;
 
+   /* The last chunk is empty, so the client knows where the page ends */
+   if (send_chunk(client_ssl, client_fd, "") != MESSAGE_STATUS_OK)
+   {
+      goto error;
+   }
+
    return 0;
 
 error:
@@ -666,163 +1074,364 @@ error:
 }
 
 static int
-metrics_page(SSL* client_ssl, int client_fd)
+metrics_page(SSL* client_ssl, int client_fd, int encoding, int64_t timeout)
 {
-   char* data = NULL;
-   time_t start_time;
-   int dt;
-   time_t now;
-   char time_buf[32];
-   int status;
-   struct message msg;
+   char* body = NULL;
+   size_t length = 0;
+   time_t created = 0;
+   time_t valid_until = 0;
+   int body_encoding = CONTENT_ENCODING_IDENTITY;
+   bool fresh = false;
+   int64_t start;
+   int ret;
    struct prometheus_cache* cache;
-   signed char cache_is_free;
+   signed char refresh_is_free;
    struct configuration* config;
 
    config = (struct configuration*)shmem;
    cache = (struct prometheus_cache*)prometheus_cache_shmem;
 
-   memset(&msg, 0, sizeof(struct message));
+   /* The background collector owns the connections to the servers */
+   if (prometheus_snapshot_shmem != NULL)
+   {
+      return snapshot_page(client_ssl, client_fd, encoding, timeout);
+   }
+
+   /* Without a cache every scrape collects for itself */
+   if (!is_metrics_cache_configured())
+   {
+      return collect_metrics_page(client_ssl, client_fd, encoding, timeout);
+   }
 
-   start_time = time(NULL);
+   start = monotonic_milliseconds();
 
 retry_cache_locking:
-   cache_is_free = STATE_FREE;
-   if (atomic_compare_exchange_strong(&cache->lock, &cache_is_free, STATE_IN_USE))
+   free(body);
+   body = NULL;
+
+   /* The published payload is copied without taking the lock */
+   if (!metrics_cache_get(encoding, &body, &length, &created, &valid_until, &body_encoding))
    {
-      // can serve the message out of cache?
-      if (is_metrics_cache_configured() && is_metrics_cache_valid())
+      fresh = time(NULL) <= valid_until;
+
+      if (!fresh && !is_metrics_cache_stale())
       {
-         // serve the message directly out of the cache
-         pgexporter_log_debug("Serving metrics out of cache (%d/%d bytes valid until %lld)",
-                              strlen(cache->data),
-                              cache->size,
-                              cache->valid_until);
+         free(body);
+         body = NULL;
+      }
+   }
 
-         msg.kind = 0;
-         msg.length = strlen(cache->data);
-         msg.data = cache->data;
+   if (body != NULL && fresh)
+   {
+      pgexporter_log_debug("Serving metrics out of cache (%zu/%zu bytes valid until %lld)",
+                           length,
+                           cache->size,
+                           (long long)valid_until);
 
-         status = pgexporter_write_message(client_ssl, client_fd, &msg);
-         if (status != MESSAGE_STATUS_OK)
-         {
-            goto error;
-         }
-      }
-      else
-      {
-         // build the message without the cache
-         metrics_cache_invalidate();
+      atomic_fetch_add(&config->metrics_cache_hits, 1);
 
-         now = time(NULL);
+      ret = metrics_stored_body_page(client_ssl, client_fd, body, length, time(NULL) - created, body_encoding, encoding);
+      free(body);
 
-         memset(&time_buf, 0, sizeof(time_buf));
-         ctime_r(&now, &time_buf[0]);
-         time_buf[strlen(time_buf) - 1] = 0;
+      return ret;
+   }
 
-         data = pgexporter_vappend(data, 5,
-                                   "HTTP/1.1 200 OK\r\n",
-                                   "Content-Type: text/plain; version=0.0.1; charset=utf-8\r\n",
-                                   "Date: ",
-                                   &time_buf[0],
-                                   "\r\n");
-         metrics_cache_append(data); // cache here to avoid the chunking for the cache
-         data = pgexporter_vappend(data, 2,
-                                   "Transfer-Encoding: chunked\r\n",
-                                   "\r\n");
+   /* Only one process collects, the others wait for it or get the stale payload */
+   refresh_is_free = STATE_FREE;
+   if (atomic_compare_exchange_strong(&cache->refresh, &refresh_is_free, STATE_IN_USE))
+   {
+      free(body);
+      body = NULL;
 
-         msg.kind = 0;
-         msg.length = strlen(data);
-         msg.data = data;
+      if (is_metrics_cache_valid())
+      {
+         /* Refreshed by another process in the meantime */
+         atomic_store(&cache->refresh, STATE_FREE);
+         goto retry_cache_locking;
+      }
 
-         status = pgexporter_write_message(client_ssl, client_fd, &msg);
-         if (status != MESSAGE_STATUS_OK)
-         {
-            goto error;
-         }
+      atomic_fetch_add(&config->metrics_cache_misses, 1);
 
-         free(data);
-         data = NULL;
+      ret = collect_metrics_page(client_ssl, client_fd, encoding, timeout);
 
-         pgexporter_open_connections();
+      atomic_store(&cache->refresh, STATE_FREE);
 
-         /* ART-based metrics container */
-         prometheus_metrics_container_t* container = NULL;
-         if (create_metrics_container(&container))
-         {
-            pgexporter_log_error("Failed to create metrics container");
-            goto error;
-         }
+      return ret;
+   }
+
+   if (body != NULL)
+   {
+      pgexporter_log_debug("Serving stale metrics out of cache (%zu bytes, %lld seconds old)",
+                           length,
+                           (long long)(time(NULL) - created));
 
-         /* General Metric Collector */
-         general_information(container);
-         version_information(container);
-         uptime_information(container);
-         primary_information(container);
-         fips_information(container);
-         server_information(container);
-         core_information(container);
-         extension_list_information(container);
-         settings_information(container);
-         custom_metrics(container);
-         extension_metrics(container);
-         query_statistics_information(container);
-         alert_information(container);
+      atomic_fetch_add(&config->metrics_cache_hits, 1);
 
-         /* Output ART metrics */
-         output_all_metrics(client_ssl, client_fd, container);
+      ret = metrics_stored_body_page(client_ssl, client_fd, body, length, time(NULL) - created, body_encoding, encoding);
+      free(body);
 
-         /* Destroy container */
-         destroy_metrics_container(container);
+      return ret;
+   }
 
-         pgexporter_close_connections();
+   if (waited_too_long(start, timeout))
+   {
+      pgexporter_log_debug("Gave up waiting for the metrics cache refresh");
+      unavailable_page(client_ssl, client_fd);
+      return 1;
+   }
 
-         prometheus_endpoints_information(client_ssl, client_fd);
+   /* Sleep for 10ms */
+   SLEEP_AND_GOTO(10000000L, retry_cache_locking);
+}
 
-         /* Footer */
-         data = pgexporter_append(data, "0\r\n\r\n");
+static int
+collect_metrics_page(SSL* client_ssl, int client_fd, int encoding, int64_t timeout)
+{
+   char* data = NULL;
+   unsigned char* encoded[NUMBER_OF_CONTENT_ENCODINGS] = {0};
+   size_t encoded_length[NUMBER_OF_CONTENT_ENCODINGS] = {0};
+   int ret;
+   struct configuration* config;
 
-         msg.kind = 0;
-         msg.length = strlen(data);
-         msg.data = data;
+   config = (struct configuration*)shmem;
 
-         status = pgexporter_write_message(client_ssl, client_fd, &msg);
-         if (status != MESSAGE_STATUS_OK)
-         {
-            goto error;
-         }
+   ret = collect_metrics(timeout, &data);
 
-         metrics_cache_finalize();
-      }
+   pgexporter_close_connections();
 
-      // free the cache
-      atomic_store(&cache->lock, STATE_FREE);
-   }
-   else
+   if (ret || data == NULL)
    {
-      dt = (int)difftime(time(NULL), start_time);
-      if (dt >= (pgexporter_time_convert(config->blocking_timeout, FORMAT_TIME_S) > 0 ? pgexporter_time_convert(config->blocking_timeout, FORMAT_TIME_S) : DEFAULT_BLOCKING_TIMEOUT_SECONDS))
-      {
-         goto error;
+      goto error;
+   }
+
+   /* The cache keeps a compressed copy for every encoding asked for, so later scrapes do not compress again */
+   if (is_metrics_cache_configured())
+   {
+      if (encoding != CONTENT_ENCODING_IDENTITY)
+      {
+         atomic_fetch_or(&config->metrics_encodings, 1U << encoding);
       }
 
-      /* Sleep for 10ms */
-      SLEEP_AND_GOTO(10000000L, retry_cache_locking);
+      metrics_encode_requested(data, encoded, encoded_length);
+   }
+   else if (encoding != CONTENT_ENCODING_IDENTITY)
+   {
+      metrics_encode(data, encoding, &encoded[encoding], &encoded_length[encoding]);
+   }
+
+   /* A partial response is only good for the scrape that ran out of time */
+   if (!atomic_load(&scrape_partial))
+   {
+      metrics_cache_publish(data, encoded, encoded_length);
+   }
+
+   if (encoded[encoding] != NULL)
+   {
+      ret = metrics_body_page(client_ssl, client_fd, (char*)encoded[encoding], encoded_length[encoding], 0, encoding);
+   }
+   else
+   {
+      ret = metrics_body_page(client_ssl, client_fd, data, strlen(data), 0, CONTENT_ENCODING_IDENTITY);
    }
 
+   metrics_encoded_free(encoded);
    free(data);
 
-   return 0;
+   return ret;
 
 error:
 
-   pgexporter_close_connections();
+   free(data);
+
+   return 1;
+}
+
+static int
+metrics_body_page(SSL* client_ssl, int client_fd, char* body, size_t length, time_t age, int encoding)
+{
+   char* data = NULL;
+   time_t now;
+   char time_buf[32];
+   int status;
+   int64_t start;
+   struct message msg;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   memset(&msg, 0, sizeof(struct message));
+
+   start = pgexporter_monotonic_micros();
+
+   now = time(NULL);
+
+   memset(&time_buf, 0, sizeof(time_buf));
+   ctime_r(&now, &time_buf[0]);
+   time_buf[strlen(time_buf) - 1] = 0;
+
+   data = pgexporter_vappend(data, 5,
+                             "HTTP/1.1 200 OK\r\n",
+                             "Content-Type: text/plain; version=0.0.1; charset=utf-8\r\n",
+                             "Date: ",
+                             &time_buf[0],
+                             "\r\n");
+   data = pgexporter_format_and_append(data, "Age: %lld\r\n", (long long)(age > 0 ? age : 0));
+   if (encoding == CONTENT_ENCODING_GZIP)
+   {
+      data = pgexporter_append(data, "Content-Encoding: gzip\r\n");
+   }
+   else if (encoding == CONTENT_ENCODING_ZSTD)
+   {
+      data = pgexporter_append(data, "Content-Encoding: zstd\r\n");
+   }
+   data = pgexporter_append(data, "Vary: Accept-Encoding\r\n");
+   data = pgexporter_http_connection_headers(data, keep_alive);
+   data = pgexporter_format_and_append(data, "Content-Length: %zu\r\n\r\n", length);
+
+   msg.kind = 0;
+   msg.length = strlen(data);
+   msg.data = data;
+
+   status = pgexporter_write_message(client_ssl, client_fd, &msg);
+   if (status != MESSAGE_STATUS_OK)
+   {
+      goto error;
+   }
+
+   msg.kind = 0;
+   msg.length = length;
+   msg.data = body;
+
+   status = pgexporter_write_message(client_ssl, client_fd, &msg);
+   if (status != MESSAGE_STATUS_OK)
+   {
+      goto error;
+   }
+
+   pgexporter_latency_observe(&config->scrape_phases[SCRAPE_PHASE_SEND], pgexporter_monotonic_micros() - start);
+
+   free(data);
+
+   return 0;
+
+error:
 
    free(data);
 
    return 1;
 }
 
+/**
+ * Sends a stored response body. When there is no copy of it in the
+ * encoding the client asked for, the body is compressed for this
+ * response, and the next stored body has a copy in that encoding.
+ *
+ * @param client_ssl the SSL connection
+ * @param client_fd the client descriptor
+ * @param body the body, terminated
+ * @param length the length of the body
+ * @param age the age of the body
+ * @param body_encoding the content encoding of the body
+ * @param encoding the content encoding the client asked for
+ * @return 0 on success, otherwise 1
+ */
+static int
+metrics_stored_body_page(SSL* client_ssl, int client_fd, char* body, size_t length, time_t age, int body_encoding, int encoding)
+{
+   unsigned char* encoded = NULL;
+   size_t encoded_length = 0;
+   int ret;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (body_encoding != encoding)
+   {
+      atomic_fetch_or(&config->metrics_encodings, 1U << encoding);
+
+      if (!metrics_encode(body, encoding, &encoded, &encoded_length))
+      {
+         ret = metrics_body_page(client_ssl, client_fd, (char*)encoded, encoded_length, age, encoding);
+         free(encoded);
+
+         return ret;
+      }
+
+      free(encoded);
+   }
+
+   return metrics_body_page(client_ssl, client_fd, body, length, age, body_encoding);
+}
+
+static int
+snapshot_page(SSL* client_ssl, int client_fd, int encoding, int64_t timeout)
+{
+   char* body = NULL;
+   size_t length = 0;
+   size_t offset = 0;
+   int body_encoding = CONTENT_ENCODING_IDENTITY;
+   time_t collected = 0;
+   int64_t start_time;
+   int ret;
+   struct prometheus_snapshot* snapshot;
+   signed char snapshot_is_free;
+
+   snapshot = (struct prometheus_snapshot*)prometheus_snapshot_shmem;
+
+   start_time = monotonic_milliseconds();
+
+retry_snapshot_locking:
+   snapshot_is_free = STATE_FREE;
+   if (atomic_compare_exchange_strong(&snapshot->lock, &snapshot_is_free, STATE_IN_USE))
+   {
+      if (snapshot->length > 0)
+      {
+         length = snapshot->length;
+
+         /* The compressed copies follow the snapshot in the order of their encoding */
+         if (encoding != CONTENT_ENCODING_IDENTITY && snapshot->encoded_length[encoding] > 0)
+         {
+            offset = snapshot->length;
+            for (int i = CONTENT_ENCODING_IDENTITY + 1; i < encoding; i++)
+            {
+               offset += snapshot->encoded_length[i];
+            }
+            length = snapshot->encoded_length[encoding];
+            body_encoding = encoding;
+         }
+
+         body = malloc(length + 1);
+         if (body != NULL)
+         {
+            memcpy(body, snapshot->data + offset, length);
+            body[length] = '\0';
+            collected = snapshot->collected;
+         }
+      }
+
+      atomic_store(&snapshot->lock, STATE_FREE);
+   }
+
+   if (body == NULL)
+   {
+      /* Wait for the collector to publish its first snapshot */
+      if (waited_too_long(start_time, timeout))
+      {
+         pgexporter_log_warn("No metrics snapshot available");
+         unavailable_page(client_ssl, client_fd);
+         return 1;
+      }
+
+      SLEEP_AND_GOTO(10000000L, retry_snapshot_locking);
+   }
+
+   ret = metrics_stored_body_page(client_ssl, client_fd, body, length, time(NULL) - collected, body_encoding, encoding);
+
+   free(body);
+
+   return ret;
+}
+
 static int
 bad_request(SSL* client_ssl, int client_fd)
 {
@@ -841,11 +1450,14 @@ bad_request(SSL* client_ssl, int client_fd)
    ctime_r(&now, &time_buf[0]);
    time_buf[strlen(time_buf) - 1] = 0;
 
-   data = pgexporter_vappend(data, 4,
+   data = pgexporter_vappend(data, 5,
                              "HTTP/1.1 400 Bad Request\r\n",
                              "Date: ",
                              &time_buf[0],
-                             "\r\n");
+                             "\r\n",
+                             "Content-Length: 0\r\n");
+   data = pgexporter_http_connection_headers(data, keep_alive);
+   data = pgexporter_append(data, "\r\n");
 
    msg.kind = 0;
    msg.length = strlen(data);
@@ -855,7 +1467,75 @@ bad_request(SSL* client_ssl, int client_fd)
 
    free(data);
 
-   return status;
+   return status == MESSAGE_STATUS_OK ? 0 : 1;
+}
+
+static int
+unavailable_page(SSL* client_ssl, int client_fd)
+{
+   char* data = NULL;
+   time_t now;
+   char time_buf[32];
+   int status;
+   struct message msg;
+
+   memset(&msg, 0, sizeof(struct message));
+
+   now = time(NULL);
+
+   memset(&time_buf, 0, sizeof(time_buf));
+   ctime_r(&now, &time_buf[0]);
+   time_buf[strlen(time_buf) - 1] = 0;
+
+   data = pgexporter_vappend(data, 5,
+                             "HTTP/1.1 503 Service Unavailable\r\n",
+                             "Date: ",
+                             &time_buf[0],
+                             "\r\n",
+                             "Content-Length: 0\r\n");
+   data = pgexporter_http_connection_headers(data, keep_alive);
+   data = pgexporter_append(data, "\r\n");
+
+   msg.kind = 0;
+   msg.length = strlen(data);
+   msg.data = data;
+
+   status = pgexporter_write_message(client_ssl, client_fd, &msg);
+
+   free(data);
+
+   return status == MESSAGE_STATUS_OK ? 0 : 1;
+}
+
+/**
+ * Has a scrape waited longer than the blocking timeout, or its own timeout
+ * @param start The start of the wait in milliseconds
+ * @param timeout The scrape timeout in milliseconds, 0 for none
+ * @return true if the scrape should stop waiting
+ */
+static bool
+waited_too_long(int64_t start, int64_t timeout)
+{
+   int64_t limit;
+   int64_t elapsed;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   limit = pgexporter_time_convert(config->blocking_timeout, FORMAT_TIME_MS);
+   if (limit <= 0)
+   {
+      limit = DEFAULT_BLOCKING_TIMEOUT_SECONDS * 1000;
+   }
+
+   if (timeout > 0 && timeout < limit)
+   {
+      limit = timeout;
+   }
+
+   elapsed = monotonic_milliseconds() - start;
+
+   return elapsed >= limit;
 }
 
 static bool
@@ -901,37 +1581,1873 @@ excluded_collector(const char* collector)
       }
    }
 
-   return false;
+   return false;
+}
+
+static bool
+collector_pass(const char* name)
+{
+   struct configuration* config = (struct configuration*)shmem;
+
+   if (config->number_of_allowed_collectors == 0)
+   {
+      return !excluded_collector(name);
+   }
+
+   bool is_allowed = allowed_collector(name);
+   bool is_excluded = excluded_collector(name);
+
+   if (is_allowed && is_excluded)
+   {
+      goto error;
+   }
+
+   return is_allowed;
+
+error:
+   exit(1);
+}
+
+static int
+collect_metrics(int64_t timeout, char** body)
+{
+   int64_t start;
+   int64_t collected;
+   struct string_builder* sb = NULL;
+   server_collection_t* collections = NULL;
+   prometheus_metrics_container_t* container = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   *body = NULL;
+
+   scrape_deadline = timeout > 0 ? monotonic_milliseconds() + timeout : 0;
+   atomic_store(&scrape_partial, false);
+
+   /* Run the queries against the servers */
+   if (create_collections(&collections))
+   {
+      pgexporter_log_error("Failed to create server collections");
+      goto error;
+   }
+
+   start = pgexporter_monotonic_micros();
+
+   collect_servers(collections);
+
+   collected = pgexporter_monotonic_micros();
+   pgexporter_latency_observe(&config->scrape_phases[SCRAPE_PHASE_QUERY], collected - start);
+
+   /* ART-based metrics container */
+   if (create_metrics_container(&container))
+   {
+      pgexporter_log_error("Failed to create metrics container");
+      goto error;
+   }
+
+   if (pgexporter_memory_arena_create(MEMORY_ARENA_BLOCK_SIZE, &scrape_arena))
+   {
+      pgexporter_log_debug("Formatting the metrics without an arena");
+   }
+
+   /* General Metric Collector */
+   general_information(container);
+   version_information(container, collections);
+   uptime_information(container, collections);
+   primary_information(container, collections);
+   fips_information(container, collections);
+   server_information(container);
+   core_information(container);
+   extension_list_information(container);
+   settings_information(container, collections);
+   custom_metrics(container, collections);
+   extension_metrics(container, collections);
+   query_statistics_information(container);
+   alert_information(container, collections);
+
+   /* Output ART metrics */
+   if (pgexporter_string_builder_create(CHUNK_SIZE, &sb))
+   {
+      pgexporter_log_error("Failed to create the metrics output");
+      goto error;
+   }
+
+   output_all_metrics(container, sb);
+
+   scrape_statistics(collections);
+
+   destroy_metrics_container(container);
+   destroy_collections(collections);
+
+   prometheus_endpoints_information(sb);
+
+   *body = pgexporter_string_builder_release(sb);
+
+   pgexporter_latency_observe(&config->scrape_phases[SCRAPE_PHASE_FORMAT], pgexporter_monotonic_micros() - collected);
+
+   return 0;
+
+error:
+
+   destroy_metrics_container(container);
+   destroy_collections(collections);
+
+   pgexporter_memory_arena_destroy(scrape_arena);
+   scrape_arena = NULL;
+
+   pgexporter_string_builder_destroy(sb);
+
+   return 1;
+}
+
+static int64_t
+configured_scrape_timeout(void)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (!pgexporter_time_is_valid(config->metrics_scrape_timeout))
+   {
+      return 0;
+   }
+
+   return pgexporter_time_convert(config->metrics_scrape_timeout, FORMAT_TIME_MS);
+}
+
+/**
+ * Has the deadline of the collection passed. The callers skip
+ * their queries when it has, so the collection becomes partial
+ **/
+static bool
+scrape_deadline_passed(void)
+{
+   if (scrape_deadline > 0 && monotonic_milliseconds() >= scrape_deadline)
+   {
+      atomic_store(&scrape_partial, true);
+      return true;
+   }
+
+   return false;
+}
+
+static void
+scrape_statistics(server_collection_t* collections)
+{
+   unsigned long allocations = 0;
+   unsigned long allocated = 0;
+   unsigned long blocks = 0;
+   struct memory_arena* arena = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   for (int server = 0; server <= NUMBER_OF_SERVERS; server++)
+   {
+      arena = server < NUMBER_OF_SERVERS ? collections[server].arena : scrape_arena;
+
+      if (arena != NULL)
+      {
+         allocations += arena->allocations;
+         allocated += arena->allocated;
+         blocks += arena->number_of_blocks;
+      }
+   }
+
+   atomic_store(&config->scrape_allocations, allocations);
+   atomic_store(&config->scrape_allocated_bytes, allocated);
+   atomic_store(&config->scrape_arena_blocks, blocks);
+
+   pgexporter_memory_arena_destroy(scrape_arena);
+   scrape_arena = NULL;
+}
+
+static int
+create_collections(server_collection_t** collections)
+{
+   server_collection_t* c = NULL;
+
+   *collections = NULL;
+
+   c = (server_collection_t*)calloc(NUMBER_OF_SERVERS, sizeof(server_collection_t));
+   if (c == NULL)
+   {
+      goto error;
+   }
+
+   for (int server = 0; server < NUMBER_OF_SERVERS; server++)
+   {
+      for (int a = 0; a < NUMBER_OF_ALERTS; a++)
+      {
+         c[server].alerts[a] = -1;
+      }
+   }
+
+   *collections = c;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static void
+destroy_query_list(query_list_t* list)
+{
+   query_list_t* last = NULL;
+
+   while (list != NULL)
+   {
+      if (!list->cached)
+      {
+         pgexporter_free_query(list->query);
+      }
+
+      last = list;
+      list = list->next;
+
+      free(last);
+   }
+}
+
+static void
+destroy_collections(server_collection_t* collections)
+{
+   if (collections == NULL)
+   {
+      return;
+   }
+
+   for (int server = 0; server < NUMBER_OF_SERVERS; server++)
+   {
+      pgexporter_free_query(collections[server].version);
+      pgexporter_free_query(collections[server].uptime);
+      pgexporter_free_query(collections[server].primary);
+      pgexporter_free_query(collections[server].settings);
+      destroy_query_list(collections[server].custom);
+      destroy_query_list(collections[server].extension);
+
+      /* The tuples of the queries above live in the arena */
+      pgexporter_memory_arena_destroy(collections[server].arena);
+   }
+
+   free(collections);
+}
+
+static void
+collect_servers(server_collection_t* collections)
+{
+   int workers;
+   int started = 0;
+   bool watching = false;
+   pthread_t threads[NUMBER_OF_SERVERS];
+   pthread_t watchdog;
+   collection_pool_t pool;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   workers = config->metrics_query_workers;
+   if (workers > config->number_of_servers)
+   {
+      workers = config->number_of_servers;
+   }
+
+   if (config->metrics_query_async)
+   {
+      collect_servers_engine(collections);
+
+      return;
+   }
+
+   pool.collections = collections;
+   pool.number_of_servers = config->number_of_servers;
+   atomic_init(&pool.next, 0);
+   pool.finished = false;
+   pthread_mutex_init(&pool.lock, NULL);
+   pthread_cond_init(&pool.cond, NULL);
+
+   /* The queries still running at the deadline are canceled */
+   if (scrape_deadline > 0)
+   {
+      if (pthread_create(&watchdog, NULL, collection_watchdog, &pool))
+      {
+         pgexporter_log_warn("Failed to start the collection watchdog");
+      }
+      else
+      {
+         watching = true;
+      }
+   }
+
+   /* The calling thread is one of the workers */
+   for (int i = 0; i < workers - 1; i++)
+   {
+      if (pthread_create(&threads[i], NULL, collection_worker, &pool))
+      {
+         pgexporter_log_warn("Failed to start collection worker (%d of %d)", i + 1, workers - 1);
+         break;
+      }
+      started++;
+   }
+
+   if (started > 0)
+   {
+      pgexporter_log_debug("Collecting %d servers using %d workers", config->number_of_servers, started + 1);
+   }
+
+   collection_run(&pool);
+
+   for (int i = 0; i < started; i++)
+   {
+      pthread_join(threads[i], NULL);
+   }
+
+   if (watching)
+   {
+      pthread_mutex_lock(&pool.lock);
+      pool.finished = true;
+      pthread_cond_signal(&pool.cond);
+      pthread_mutex_unlock(&pool.lock);
+
+      pthread_join(watchdog, NULL);
+   }
+
+   pthread_cond_destroy(&pool.cond);
+   pthread_mutex_destroy(&pool.lock);
+}
+
+static void*
+collection_worker(void* arg)
+{
+   collection_pool_t* pool = (collection_pool_t*)arg;
+
+   /* The message buffer is thread local */
+   pgexporter_memory_init();
+
+   collection_run(pool);
+
+   pgexporter_memory_destroy();
+
+   return NULL;
+}
+
+static void
+collection_run(collection_pool_t* pool)
+{
+   int server;
+
+   while ((server = atomic_fetch_add(&pool->next, 1)) < pool->number_of_servers)
+   {
+      collect_server(server, &pool->collections[server]);
+   }
+}
+
+/**
+ * Wait for the collection to finish. Once the deadline passes the
+ * queries of the servers still querying are canceled, and again every
+ * SCRAPE_CANCEL_INTERVAL_MS for a query that started in between
+ **/
+static void*
+collection_watchdog(void* arg)
+{
+   int64_t next;
+   int64_t wait;
+   struct timespec ts;
+   collection_pool_t* pool = (collection_pool_t*)arg;
+
+   next = scrape_deadline;
+
+   pthread_mutex_lock(&pool->lock);
+
+   while (!pool->finished)
+   {
+      wait = next - monotonic_milliseconds();
+
+      if (wait > 0)
+      {
+         /* The condition variable waits on the realtime clock */
+         clock_gettime(CLOCK_REALTIME, &ts);
+         ts.tv_sec += wait / 1000;
+         ts.tv_nsec += (wait % 1000) * 1000000;
+         if (ts.tv_nsec >= 1000000000)
+         {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+         }
+
+         pthread_cond_timedwait(&pool->cond, &pool->lock, &ts);
+         continue;
+      }
+
+      pthread_mutex_unlock(&pool->lock);
+      collection_cancel(pool);
+      pthread_mutex_lock(&pool->lock);
+
+      next = monotonic_milliseconds() + SCRAPE_CANCEL_INTERVAL_MS;
+   }
+
+   pthread_mutex_unlock(&pool->lock);
+
+   return NULL;
+}
+
+static void
+collection_cancel(collection_pool_t* pool)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   for (int server = 0; server < pool->number_of_servers; server++)
+   {
+      if (atomic_load(&pool->collections[server].querying))
+      {
+         atomic_store(&scrape_partial, true);
+
+         if (pgexporter_cancel_query(server))
+         {
+            pgexporter_log_debug("Deadline passed, no query to cancel for server %s", config->servers[server].name);
+         }
+      }
+   }
+}
+
+static void
+collect_server(int server, server_collection_t* collection)
+{
+   int ret;
+   struct query* query = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (scrape_deadline_passed())
+   {
+      pgexporter_log_debug("Deadline passed, skipping server %s", config->servers[server].name);
+      return;
+   }
+
+   if (collection->arena == NULL && pgexporter_memory_arena_create(MEMORY_ARENA_BLOCK_SIZE, &collection->arena))
+   {
+      pgexporter_log_debug("Collecting server %s without an arena", config->servers[server].name);
+   }
+
+   if (pgexporter_open_connection(server))
+   {
+      pgexporter_log_debug("Skipping server %s", config->servers[server].name);
+      return;
+   }
+
+   /* The connection setup is not canceled, a failed check skips the server */
+   atomic_store(&collection->querying, true);
+
+   if (config->servers[server].fd != -1 && !scrape_deadline_passed())
+   {
+      ret = pgexporter_query_version(server, &query);
+      if (ret == 0)
+      {
+         collection->version = query;
+      }
+      else
+      {
+         pgexporter_log_error("Failed to query version for server %s", config->servers[server].name);
+      }
+      query = NULL;
+
+      ret = pgexporter_query_uptime(server, &query);
+      if (ret == 0)
+      {
+         collection->uptime = query;
+      }
+      else
+      {
+         pgexporter_log_error("Failed to query uptime for server %s", config->servers[server].name);
+      }
+      query = NULL;
+
+      ret = pgexporter_query_primary(server, &query);
+      if (ret == 0)
+      {
+         collection->primary = query;
+      }
+      else
+      {
+         pgexporter_log_error("Failed to query primary for server %s", config->servers[server].name);
+      }
+      query = NULL;
+
+      collect_fips(server, collection);
+
+      if (collector_pass("settings"))
+      {
+         ret = pgexporter_query_settings(server, &query);
+         if (ret == 0)
+         {
+            collection->settings = query;
+         }
+         else
+         {
+            pgexporter_log_error("Failed to query settings for server %s", config->servers[server].name);
+         }
+         query = NULL;
+      }
+   }
+
+   collect_custom_metrics(server, collection);
+   collect_extension_metrics(server, collection);
+
+   if (!scrape_deadline_passed())
+   {
+      collect_alerts(server, collection);
+   }
+
+   atomic_store(&collection->querying, false);
+}
+
+static void
+collect_fips(int server, server_collection_t* collection)
+{
+   int ret;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   ret = pgexporter_fips_server(server, &collection->fips);
+   if (ret != 0)
+   {
+      pgexporter_log_debug("FIPS status unavailable for server %s",
+                           config->servers[server].name);
+      collection->fips = false;
+   }
+}
+
+static void
+collect_servers_engine(server_collection_t* collections)
+{
+   int n = 0;
+   int64_t timeout = 0;
+   struct engine* engine = NULL;
+   engine_collection_t* states = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   states = (engine_collection_t*)calloc(config->number_of_servers, sizeof(engine_collection_t));
+   if (states == NULL || pgexporter_engine_create(engine_next_cb, engine_done_cb, states, &engine))
+   {
+      pgexporter_log_warn("Failed to create the query engine");
+
+      free(states);
+
+      for (int server = 0; server < config->number_of_servers; server++)
+      {
+         collect_server(server, &collections[server]);
+      }
+
+      return;
+   }
+
+   for (int server = 0; server < config->number_of_servers; server++)
+   {
+      server_collection_t* collection = &collections[server];
+
+      /* A server without a connection starts by opening one, in the engine like its queries */
+      states[server].stage = config->servers[server].fd != -1 ? ENGINE_STAGE_GENERAL : ENGINE_STAGE_OPEN;
+      states[server].collection = collection;
+
+      if (config->servers[server].type == SERVER_TYPE_PROMETHEUS)
+      {
+         continue;
+      }
+
+      if (scrape_deadline_passed())
+      {
+         pgexporter_log_debug("Deadline passed, skipping server %s", config->servers[server].name);
+         continue;
+      }
+
+      if (collection->arena == NULL && pgexporter_memory_arena_create(MEMORY_ARENA_BLOCK_SIZE, &collection->arena))
+      {
+         pgexporter_log_debug("Collecting server %s without an arena", config->servers[server].name);
+      }
+
+      if (pgexporter_engine_add(engine, server) == 0)
+      {
+         n++;
+      }
+   }
+
+   pgexporter_log_debug("Collecting %d servers using the query engine", n);
+
+   if (scrape_deadline > 0)
+   {
+      timeout = MAX(scrape_deadline - monotonic_milliseconds(), 1);
+   }
+
+   if (pgexporter_engine_run(engine, timeout))
+   {
+      pgexporter_log_warn("The query engine did not complete all the servers");
+   }
+
+   pgexporter_engine_destroy(engine);
+
+   for (int server = 0; server < config->number_of_servers; server++)
+   {
+      /* A server that did not complete keeps what it collected so far */
+      if (states[server].custom != NULL)
+      {
+         custom_metrics_finish(server, states[server].custom, &collections[server]);
+      }
+
+      if (states[server].extension != NULL)
+      {
+         extension_metrics_finish(server, states[server].extension, &collections[server]);
+      }
+
+      if (scrape_deadline_passed())
+      {
+         continue;
+      }
+
+      if (config->servers[server].fd != -1)
+      {
+         collect_fips(server, &collections[server]);
+      }
+
+      collect_alerts(server, &collections[server]);
+   }
+
+   free(states);
+}
+
+static bool
+engine_next_cb(int server, struct engine_batch* batch, void* data)
+{
+   char* database = NULL;
+   engine_collection_t* state = &((engine_collection_t*)data)[server];
+
+   switch (state->stage)
+   {
+      case ENGINE_STAGE_OPEN:
+         pgexporter_open_connection_requests(&state->open[0]);
+         state->opened = true;
+
+         batch->database = "postgres";
+         batch->requests = state->open;
+         batch->n = OPEN_CONNECTION_REQUESTS;
+         batch->arena = NULL;
+
+         return true;
+      case ENGINE_STAGE_GENERAL:
+         pgexporter_query_version_request(&state->general[0]);
+         pgexporter_query_uptime_request(&state->general[1]);
+         pgexporter_query_primary_request(&state->general[2]);
+         state->n_general = 3;
+
+         if (collector_pass("settings"))
+         {
+            pgexporter_query_settings_request(&state->general[3]);
+            state->n_general = 4;
+         }
+
+         batch->database = NULL;
+         batch->requests = state->general;
+         batch->n = state->n_general;
+         batch->arena = NULL;
+
+         return true;
+      case ENGINE_STAGE_CUSTOM:
+         if (state->custom != NULL && (database = custom_metrics_next(server, state->custom)) != NULL)
+         {
+            batch->database = database;
+            batch->requests = state->custom->requests;
+            batch->n = state->custom->n_requests;
+            batch->arena = state->collection->arena;
+
+            return true;
+         }
+
+         if (state->custom != NULL)
+         {
+            custom_metrics_finish(server, state->custom, state->collection);
+            state->custom = NULL;
+         }
+
+         state->stage = ENGINE_STAGE_EXTENSION;
+         state->extension = extension_metrics_plan(server);
+
+         if (state->extension != NULL && state->extension->n_requests > 0)
+         {
+            /* The extensions are queried on the last database of the custom metrics */
+            batch->database = NULL;
+            batch->requests = state->extension->requests;
+            batch->n = state->extension->n_requests;
+            batch->arena = state->collection->arena;
+
+            return true;
+         }
+
+         if (state->extension != NULL)
+         {
+            extension_metrics_finish(server, state->extension, state->collection);
+            state->extension = NULL;
+         }
+
+         state->stage = ENGINE_STAGE_DONE;
+
+         return false;
+      default:
+         return false;
+   }
+}
+
+static void
+engine_done_cb(int server, struct engine_batch* batch, int status, void* data)
+{
+   char* names[] = {"version", "uptime", "primary", "settings"};
+   struct query** results[4];
+   engine_collection_t* state = &((engine_collection_t*)data)[server];
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (status == ENGINE_BATCH_EXPIRED)
+   {
+      atomic_store(&scrape_partial, true);
+   }
+
+   switch (state->stage)
+   {
+      case ENGINE_STAGE_OPEN:
+         if (status != ENGINE_BATCH_OK)
+         {
+            if (status == ENGINE_BATCH_NO_CONNECTION)
+            {
+               pgexporter_log_error("Failed login for '%s' on server '%s'", config->servers[server].username, config->servers[server].name);
+            }
+
+            for (int i = 0; i < OPEN_CONNECTION_REQUESTS; i++)
+            {
+               pgexporter_free_query(state->open[i].query);
+               state->open[i].query = NULL;
+            }
+
+            pgexporter_log_debug("Skipping server %s", config->servers[server].name);
+            state->stage = ENGINE_STAGE_DONE;
+            break;
+         }
+
+         if (pgexporter_open_connection_finish(server, state->open))
+         {
+            pgexporter_log_debug("Skipping server %s", config->servers[server].name);
+            state->stage = ENGINE_STAGE_DONE;
+            break;
+         }
+
+         state->stage = ENGINE_STAGE_GENERAL;
+         break;
+      case ENGINE_STAGE_GENERAL:
+         if (status == ENGINE_BATCH_OK && !state->opened && config->servers[server].fd == -1)
+         {
+            /* The connection kept from a previous collection failed, so it is opened again */
+            for (int i = 0; i < state->n_general; i++)
+            {
+               pgexporter_free_query(state->general[i].query);
+               state->general[i].query = NULL;
+            }
+
+            state->stage = ENGINE_STAGE_OPEN;
+            break;
+         }
+
+         results[0] = &state->collection->version;
+         results[1] = &state->collection->uptime;
+         results[2] = &state->collection->primary;
+         results[3] = &state->collection->settings;
+
+         for (int i = 0; i < state->n_general; i++)
+         {
+            if (state->general[i].error == 0)
+            {
+               *results[i] = state->general[i].query;
+            }
+            else
+            {
+               pgexporter_log_error("Failed to query %s for server %s", names[i], config->servers[server].name);
+               pgexporter_free_query(state->general[i].query);
+            }
+
+            state->general[i].query = NULL;
+         }
+
+         state->stage = ENGINE_STAGE_CUSTOM;
+         state->custom = custom_metrics_plan(server);
+         break;
+      case ENGINE_STAGE_CUSTOM:
+         if (status == ENGINE_BATCH_NO_CONNECTION)
+         {
+            pgexporter_log_info("Error connecting to server: %s, database: %s", config->servers[server].name, batch->database);
+         }
+
+         custom_metrics_results(server, state->custom, batch->database, status);
+         break;
+      case ENGINE_STAGE_EXTENSION:
+         extension_metrics_finish(server, state->extension, state->collection);
+         state->extension = NULL;
+         state->stage = ENGINE_STAGE_DONE;
+         break;
+      default:
+         break;
+   }
+}
+
+static void
+collect_custom_metrics(int server, server_collection_t* collection)
+{
+   int ret;
+   char* database = NULL;
+   custom_collection_t* custom = NULL;
+   struct configuration* config = NULL;
+
+   config = (struct configuration*)shmem;
+
+   custom = custom_metrics_plan(server);
+   if (custom == NULL)
+   {
+      return;
+   }
+
+   while ((database = custom_metrics_next(server, custom)) != NULL)
+   {
+      if (scrape_deadline_passed())
+      {
+         custom_metrics_results(server, custom, database, 1);
+         continue;
+      }
+
+      ret = pgexporter_switch_db(server, database);
+      if (ret != 0)
+      {
+         pgexporter_log_info("Error connecting to server: %s, database: %s", config->servers[server].name, database);
+      }
+      else
+      {
+         pgexporter_custom_query_pipeline(server, custom->requests, custom->n_requests, collection->arena);
+      }
+
+      custom_metrics_results(server, custom, database, ret);
+   }
+
+   custom_metrics_finish(server, custom, collection);
+}
+
+static custom_collection_t*
+custom_metrics_plan(int server)
+{
+   int n_db;
+   bool all_dbs = false;
+   query_plan_t* plan = NULL;
+   custom_collection_t* custom = NULL;
+   struct configuration* config = NULL;
+
+   config = (struct configuration*)shmem;
+
+   if (config->servers[server].fd == -1)
+   {
+      return NULL;
+   }
+
+   plan = query_plan(server);
+   if (plan == NULL)
+   {
+      return NULL;
+   }
+
+   custom = (custom_collection_t*)calloc(1, sizeof(custom_collection_t));
+   if (custom == NULL)
+   {
+      pgexporter_log_error("Failed to plan the custom metrics for server %s", config->servers[server].name);
+      return NULL;
+   }
+
+   n_db = config->servers[server].number_of_databases;
+   custom->now = monotonic_milliseconds();
+   custom->query_plan = plan;
+
+   for (int m = 0; m < plan->number_of_metrics; m++)
+   {
+      metric_plan_t* mp = &plan->metrics[m];
+      int i = mp->metric;
+
+      custom->plan[i] = mp;
+
+      if (metric_interval_active(mp->prom))
+      {
+         custom->hits[i] = metric_cache_lookup(server, mp->key, mp->prom->interval, custom->now);
+      }
+
+      if (custom->hits[i] == NULL && mp->prom->exec_on_all_dbs)
+      {
+         all_dbs = true;
+      }
+   }
+
+   // Visit each database once and send all of its queries as one pipeline.
+   // Metrics that do not run on all databases use the last database, which
+   // is always 'postgres'
+   custom->database = all_dbs ? 0 : n_db - 1;
+
+   return custom;
+}
+
+static char*
+custom_metrics_next(int server, custom_collection_t* custom)
+{
+   int n_db;
+   struct configuration* config = NULL;
+
+   config = (struct configuration*)shmem;
+
+   n_db = config->servers[server].number_of_databases;
+
+   while (custom->database < n_db)
+   {
+      int db_idx = custom->database++;
+      char* database = config->servers[server].databases[db_idx];
+
+      custom->n_requests = 0;
+
+      for (int m = 0; m < custom->query_plan->number_of_metrics; m++)
+      {
+         metric_plan_t* mp = &custom->query_plan->metrics[m];
+         struct query_request* request = &custom->requests[custom->n_requests];
+
+         if (custom->hits[mp->metric] != NULL || (!mp->prom->exec_on_all_dbs && db_idx != n_db - 1))
+         {
+            /* Skip */
+            continue;
+         }
+
+         memset(request, 0, sizeof(struct query_request));
+         request->qs = mp->query_alt->node.query;
+         request->tag = mp->prom->tag;
+         request->retain = metric_interval_active(mp->prom);
+
+         if (mp->query_alt->node.is_histogram)
+         {
+            request->columns = -1;
+         }
+         else
+         {
+            request->columns = mp->query_alt->node.n_columns;
+            request->names = mp->names;
+         }
+
+         custom->metrics[custom->n_requests] = mp->metric;
+         custom->n_requests++;
+      }
+
+      if (custom->n_requests == 0)
+      {
+         continue;
+      }
+
+      pgexporter_log_debug("Querying server: %s, db: %s (%d / %d)", config->servers[server].name, database, db_idx + 1, n_db);
+
+      return database;
+   }
+
+   return NULL;
+}
+
+static void
+custom_metrics_results(int server, custom_collection_t* custom, char* database, int ret)
+{
+   query_list_t* temp = NULL;
+   struct configuration* config = NULL;
+
+   config = (struct configuration*)shmem;
+
+   // Each query's result (linked list of tuples in it) becomes a node
+   for (int r = 0; r < custom->n_requests; r++)
+   {
+      int i = custom->metrics[r];
+      struct prometheus* prom = &config->prometheus[i];
+      struct query_request* request = &custom->requests[r];
+
+      /* A batch cut short by the deadline keeps the results that were complete */
+      if (ret != 0 && request->query == NULL)
+      {
+         custom->failed[i] = true;
+         continue;
+      }
+
+      if (request->error != 0)
+      {
+         custom->failed[i] = true;
+
+         if (prom->optional)
+         {
+            pgexporter_log_debug("Failed to execute custom query for server %s, database %s, tag %s", config->servers[server].name, database, prom->tag);
+         }
+         else
+         {
+            pgexporter_log_warn("Failed to execute custom query for server %s, database %s, tag %s", config->servers[server].name, database, prom->tag);
+         }
+      }
+
+      if (request->query == NULL)
+      {
+         continue;
+      }
+
+      temp = malloc(sizeof(query_list_t));
+      memset(temp, 0, sizeof(query_list_t));
+
+      temp->tag = prom->tag;
+      temp->query = request->query;
+      temp->query_alt = custom->plan[i]->query_alt;
+      temp->plan = custom->plan[i];
+      temp->metric = i;
+      temp->sort_type = prom->sort_type;
+      temp->error = request->error;
+      pgexporter_snprintf(temp->database, DB_NAME_LENGTH, "%s", database);
+
+      if (custom->heads[i] == NULL)
+      {
+         custom->heads[i] = temp;
+      }
+      else
+      {
+         custom->tails[i]->next = temp;
+      }
+      custom->tails[i] = temp;
+   }
+
+   custom->n_requests = 0;
+}
+
+static void
+custom_metrics_finish(int server, custom_collection_t* custom, server_collection_t* collection)
+{
+   query_list_t* q_list = NULL;
+   query_list_t* temp = NULL;
+   struct configuration* config = NULL;
+
+   config = (struct configuration*)shmem;
+
+   // Metrics with a refresh interval reuse their results until it expires
+   for (int i = 0; i < config->number_of_metrics; i++)
+   {
+      struct prometheus* prom = &config->prometheus[i];
+
+      if (custom->hits[i] != NULL)
+      {
+         custom->heads[i] = metric_cache_results(custom->hits[i], &custom->tails[i]);
+      }
+      else if (custom->plan[i] != NULL && !custom->failed[i] && metric_interval_active(prom))
+      {
+         metric_cache_store(server, custom->plan[i]->key, custom->heads[i], custom->now);
+      }
+   }
+
+   // Link the results ordered by metric, then by database
+   for (int i = 0; i < config->number_of_metrics; i++)
+   {
+      if (custom->heads[i] == NULL)
+      {
+         continue;
+      }
+
+      if (q_list == NULL)
+      {
+         q_list = custom->heads[i];
+      }
+      else
+      {
+         temp->next = custom->heads[i];
+      }
+      temp = custom->tails[i];
+   }
+
+   collection->custom = q_list;
+
+   free(custom);
+}
+
+static void
+collect_extension_metrics(int server, server_collection_t* collection)
+{
+   extension_collection_t* extension = NULL;
+
+   extension = extension_metrics_plan(server);
+   if (extension == NULL)
+   {
+      return;
+   }
+
+   if (extension->n_requests > 0 && !scrape_deadline_passed())
+   {
+      pgexporter_custom_query_pipeline(server, extension->requests, extension->n_requests, collection->arena);
+   }
+
+   extension_metrics_finish(server, extension, collection);
+}
+
+static extension_collection_t*
+extension_metrics_plan(int server)
+{
+   int n;
+   query_plan_t* plan = NULL;
+   extension_collection_t* e = NULL;
+   struct configuration* config = NULL;
+
+   config = (struct configuration*)shmem;
+
+   /* The plan was checked when the custom metrics were planned */
+   plan = query_plans[server];
+
+   if (config->servers[server].fd == -1 || plan == NULL)
+   {
+      return NULL;
+   }
+
+   e = (extension_collection_t*)calloc(1, sizeof(extension_collection_t));
+   if (e == NULL)
+   {
+      goto error;
+   }
+
+   e->now = monotonic_milliseconds();
+
+   n = plan->number_of_extension_metrics;
+   if (n == 0)
+   {
+      return e;
+   }
+
+   e->requests = (struct query_request*)calloc(n, sizeof(struct query_request));
+   e->plans = (metric_plan_t**)calloc(n, sizeof(metric_plan_t*));
+   e->hits = (metric_cache_t**)calloc(n, sizeof(metric_cache_t*));
+   e->slots = (int*)calloc(n, sizeof(int));
+
+   if (e->requests == NULL || e->plans == NULL || e->hits == NULL || e->slots == NULL)
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < n; i++)
+   {
+      metric_plan_t* mp = &plan->extension_metrics[i];
+      struct query_request* request = &e->requests[e->n_requests];
+
+      e->plans[e->n_entries] = mp;
+      e->hits[e->n_entries] = NULL;
+      e->slots[e->n_entries] = -1;
+
+      if (metric_interval_active(mp->prom))
+      {
+         e->hits[e->n_entries] = metric_cache_lookup(server, mp->key, mp->prom->interval, e->now);
+      }
+
+      if (e->hits[e->n_entries] != NULL)
+      {
+         e->n_entries++;
+         continue;
+      }
+
+      request->qs = mp->query_alt->node.query;
+      request->tag = mp->prom->tag;
+      request->retain = metric_interval_active(mp->prom);
+
+      if (mp->query_alt->node.is_histogram)
+      {
+         request->columns = -1;
+      }
+      else
+      {
+         request->columns = mp->query_alt->node.n_columns;
+         request->names = mp->names;
+      }
+
+      e->slots[e->n_entries] = e->n_requests;
+      e->n_entries++;
+      e->n_requests++;
+   }
+
+   return e;
+
+error:
+
+   pgexporter_log_error("Failed to plan the extension metrics for server %s", config->servers[server].name);
+
+   if (e != NULL)
+   {
+      free(e->requests);
+      free(e->plans);
+      free(e->hits);
+      free(e->slots);
+      free(e);
+   }
+
+   return NULL;
+}
+
+static void
+extension_metrics_finish(int server, extension_collection_t* e, server_collection_t* collection)
+{
+   query_list_t* ext_q_list = NULL;
+   query_list_t* ext_temp = NULL;
+   struct configuration* config = NULL;
+
+   config = (struct configuration*)shmem;
+
+   for (int i = 0; i < e->n_entries; i++)
+   {
+      metric_plan_t* mp = e->plans[i];
+      struct prometheus* prom = mp->prom;
+      int r = e->slots[i];
+      query_list_t* next = NULL;
+      query_list_t* last = NULL;
+
+      if (e->hits[i] != NULL)
+      {
+         next = metric_cache_results(e->hits[i], &last);
+      }
+      else
+      {
+         if (e->requests[r].error != 0)
+         {
+            pgexporter_log_error("Failed to execute extension query for server %s, extension %s, tag %s", config->servers[server].name, mp->extension, prom->tag);
+         }
+
+         if (e->requests[r].query == NULL)
+         {
+            continue;
+         }
+
+         next = malloc(sizeof(query_list_t));
+         memset(next, 0, sizeof(query_list_t));
+
+         next->tag = prom->tag;
+         next->query = e->requests[r].query;
+         next->query_alt = mp->query_alt;
+         next->plan = mp;
+         next->sort_type = prom->sort_type;
+         next->error = e->requests[r].error;
+         last = next;
+
+         if (e->requests[r].error == 0 && metric_interval_active(prom))
+         {
+            metric_cache_store(server, mp->key, next, e->now);
+         }
+      }
+
+      if (next == NULL)
+      {
+         continue;
+      }
+
+      if (!ext_q_list)
+      {
+         ext_q_list = next;
+      }
+      else
+      {
+         ext_temp->next = next;
+      }
+      ext_temp = last;
+   }
+
+   free(e->requests);
+   free(e->plans);
+   free(e->hits);
+   free(e->slots);
+   free(e);
+
+   collection->extension = ext_q_list;
+}
+
+static void
+collect_alerts(int server, server_collection_t* collection)
+{
+   int ret;
+   int conn_valid = -1;
+   struct query* query = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (!config->alerts_enabled || config->number_of_alerts == 0)
+   {
+      return;
+   }
+
+   for (int a = 0; a < config->number_of_alerts; a++)
+   {
+      struct alert_definition* alert = &config->alerts[a];
+      int firing = 0;
+
+      /* Server name filter */
+      if (!alert->servers_all && alert->number_of_servers > 0)
+      {
+         bool match = false;
+         for (int s = 0; s < alert->number_of_servers; s++)
+         {
+            if (!strcmp(alert->servers[s], config->servers[server].name))
+            {
+               match = true;
+               break;
+            }
+         }
+         if (!match)
+         {
+            continue;
+         }
+      }
+
+      /* Lazy connection validity check */
+      if (conn_valid == -1)
+      {
+         conn_valid = pgexporter_connection_isvalid(config->servers[server].ssl, config->servers[server].fd) ? 1 : 0;
+      }
+
+      if (alert->alert_type == ALERT_TYPE_CONNECTION)
+      {
+         firing = conn_valid ? 0 : 1;
+      }
+      else if (alert->alert_type == ALERT_TYPE_QUERY)
+      {
+         if (!conn_valid)
+         {
+            /* Server is down, skip query-based alerts */
+            firing = -1;
+         }
+         else
+         {
+            query = NULL;
+            ret = pgexporter_query_execute(server, alert->query, alert->name, &query);
+
+            if (ret == 0 && query != NULL && query->tuples != NULL)
+            {
+               char* result_str = pgexporter_get_column(0, query->tuples);
+               if (result_str != NULL)
+               {
+                  int64_t value = strtoll(result_str, NULL, 10);
+                  firing = evaluate_alert(value, alert->operator, alert->threshold) ? 1 : 0;
+               }
+            }
+            else
+            {
+               pgexporter_log_warn("Failed to query alert '%s' for server %s",
+                                   alert->name, config->servers[server].name);
+               firing = -1;
+            }
+
+            pgexporter_free_query(query);
+            query = NULL;
+         }
+      }
+
+      collection->alerts[a] = firing;
+   }
+}
+
+static int64_t
+monotonic_milliseconds(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static metric_cache_t*
+metric_cache_lookup(int server, char* key, pgexporter_time_t interval, int64_t now)
+{
+   metric_cache_t* cache = NULL;
+
+   if (metric_caches[server] == NULL)
+   {
+      return NULL;
+   }
+
+   cache = (metric_cache_t*)pgexporter_art_search(metric_caches[server], key);
+
+   if (cache == NULL || now - cache->collected >= pgexporter_time_convert(interval, FORMAT_TIME_MS))
+   {
+      return NULL;
+   }
+
+   return cache;
+}
+
+static void
+metric_cache_store(int server, char* key, query_list_t* results, int64_t now)
+{
+   metric_cache_t* cache = NULL;
+   query_list_t* last = NULL;
+   struct value_config vc = {.destroy_data = &metric_cache_destroy_cb,
+                             .to_string = NULL};
+
+   if (metric_caches[server] == NULL && pgexporter_art_create(&metric_caches[server]))
+   {
+      return;
+   }
+
+   cache = (metric_cache_t*)malloc(sizeof(metric_cache_t));
+   if (cache == NULL)
+   {
+      return;
+   }
+
+   cache->collected = now;
+   cache->results = NULL;
+
+   /* The cache takes over the queries, the collection keeps its nodes */
+   for (query_list_t* node = results; node != NULL; node = node->next)
+   {
+      query_list_t* copy = (query_list_t*)malloc(sizeof(query_list_t));
+
+      if (copy == NULL)
+      {
+         break;
+      }
+
+      memcpy(copy, node, sizeof(query_list_t));
+      copy->next = NULL;
+      node->cached = true;
+
+      if (last == NULL)
+      {
+         cache->results = copy;
+      }
+      else
+      {
+         last->next = copy;
+      }
+      last = copy;
+   }
+
+   /* A previous entry is destroyed when it is replaced */
+   if (pgexporter_art_insert_with_config(metric_caches[server], key, (uintptr_t)cache, &vc))
+   {
+      metric_cache_destroy_cb((uintptr_t)cache);
+   }
+}
+
+static query_list_t*
+metric_cache_results(metric_cache_t* cache, query_list_t** tail)
+{
+   query_list_t* head = NULL;
+   query_list_t* last = NULL;
+
+   for (query_list_t* node = cache->results; node != NULL; node = node->next)
+   {
+      query_list_t* copy = (query_list_t*)malloc(sizeof(query_list_t));
+
+      if (copy == NULL)
+      {
+         break;
+      }
+
+      memcpy(copy, node, sizeof(query_list_t));
+      copy->next = NULL;
+      copy->cached = true;
+
+      if (last == NULL)
+      {
+         head = copy;
+      }
+      else
+      {
+         last->next = copy;
+      }
+      last = copy;
+   }
+
+   *tail = last;
+
+   return head;
+}
+
+static void
+metric_cache_destroy_cb(uintptr_t data)
+{
+   metric_cache_t* cache = (metric_cache_t*)data;
+   query_list_t* last = NULL;
+
+   if (cache == NULL)
+   {
+      return;
+   }
+
+   while (cache->results != NULL)
+   {
+      pgexporter_free_query(cache->results->query);
+
+      last = cache->results;
+      cache->results = cache->results->next;
+
+      free(last);
+   }
+
+   free(cache);
+}
+
+/**
+ * Are the results of a metric reused for its interval. The cache lives in
+ * the collecting process, so only the background collector keeps it
+ * from one collection to the next
+ * @param prom The metric
+ * @return true if the metric has an interval that takes effect
+ */
+static bool
+metric_interval_active(struct prometheus* prom)
+{
+   return prometheus_snapshot_shmem != NULL && pgexporter_time_is_valid(prom->interval);
+}
+
+static void
+destroy_metric_caches(void)
+{
+   for (int server = 0; server < NUMBER_OF_SERVERS; server++)
+   {
+      pgexporter_art_destroy(metric_caches[server]);
+      metric_caches[server] = NULL;
+   }
+}
+
+static query_plan_t*
+query_plan(int server)
+{
+   struct configuration* config = NULL;
+
+   config = (struct configuration*)shmem;
+
+   if (query_plans[server] != NULL && query_plan_is_valid(query_plans[server], server))
+   {
+      return query_plans[server];
+   }
+
+   if (query_plans[server] != NULL)
+   {
+      pgexporter_log_debug("Server %s changed, planning its queries again", config->servers[server].name);
+
+      /* The cached results may be of queries that the server no longer runs */
+      pgexporter_art_destroy(metric_caches[server]);
+      metric_caches[server] = NULL;
+
+      query_plan_destroy(query_plans[server]);
+      query_plans[server] = NULL;
+   }
+
+   query_plans[server] = query_plan_create(server);
+
+   return query_plans[server];
+}
+
+static bool
+query_plan_is_valid(query_plan_t* plan, int server)
+{
+   struct configuration* config = NULL;
+
+   config = (struct configuration*)shmem;
+
+   if (plan->version != config->servers[server].version ||
+       plan->minor_version != config->servers[server].minor_version ||
+       plan->state != config->servers[server].state ||
+       plan->number_of_extensions != config->servers[server].number_of_extensions)
+   {
+      return false;
+   }
+
+   for (int i = 0; i < plan->number_of_extensions; i++)
+   {
+      struct extension_info* ext_info = &config->servers[server].extensions[i];
+
+      if (plan->extensions[i].enabled != ext_info->enabled ||
+          plan->extensions[i].version.major != ext_info->installed_version.major ||
+          plan->extensions[i].version.minor != ext_info->installed_version.minor ||
+          plan->extensions[i].version.patch != ext_info->installed_version.patch ||
+          strcmp(plan->extensions[i].name, ext_info->name))
+      {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+static query_plan_t*
+query_plan_create(int server)
+{
+   int n;
+   query_plan_t* plan = NULL;
+   struct configuration* config = NULL;
+
+   config = (struct configuration*)shmem;
+
+   plan = (query_plan_t*)calloc(1, sizeof(query_plan_t));
+   if (plan == NULL)
+   {
+      goto error;
+   }
+
+   plan->version = config->servers[server].version;
+   plan->minor_version = config->servers[server].minor_version;
+   plan->state = config->servers[server].state;
+   plan->number_of_extensions = config->servers[server].number_of_extensions;
+
+   for (int i = 0; i < plan->number_of_extensions; i++)
+   {
+      struct extension_info* ext_info = &config->servers[server].extensions[i];
+
+      pgexporter_snprintf(plan->extensions[i].name, MISC_LENGTH, "%s", ext_info->name);
+      plan->extensions[i].enabled = ext_info->enabled;
+      plan->extensions[i].version = ext_info->installed_version;
+   }
+
+   /* Metrics, there is room for one more entry so a failed entry is released with the others */
+   plan->metrics = (metric_plan_t*)calloc(config->number_of_metrics + 1, sizeof(metric_plan_t));
+   if (plan->metrics == NULL)
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < config->number_of_metrics; i++)
+   {
+      struct prometheus* prom = &config->prometheus[i];
+      struct pg_query_alts* query_alt = NULL;
+
+      /* Expose only if default or specified */
+      if (!collector_pass(prom->collector))
+      {
+         continue;
+      }
+
+      if ((prom->server_query_type == SERVER_QUERY_PRIMARY && plan->state != SERVER_PRIMARY) ||
+          (prom->server_query_type == SERVER_QUERY_REPLICA && plan->state != SERVER_REPLICA))
+      {
+         continue;
+      }
+
+      query_alt = pgexporter_get_pg_query_alt(prom->pg_root, server);
+      if (query_alt == NULL)
+      {
+         continue;
+      }
+
+      pgexporter_log_debug("Querying on all databases for tag %s: %s", prom->tag, prom->exec_on_all_dbs ? "ENABLED" : "DISABLED");
+
+      if (metric_plan_init(&plan->metrics[plan->number_of_metrics], i, prom, query_alt, NULL))
+      {
+         goto error;
+      }
+
+      plan->number_of_metrics++;
+   }
+
+   /* Extension metrics */
+   n = 0;
+   for (int i = 0; i < config->number_of_extensions; i++)
+   {
+      n += config->extensions[i].number_of_metrics;
+   }
+
+   plan->extension_metrics = (metric_plan_t*)calloc(n + 1, sizeof(metric_plan_t));
+   if (plan->extension_metrics == NULL)
+   {
+      goto error;
+   }
+
+   for (int ext_idx = 0; ext_idx < plan->number_of_extensions; ext_idx++)
+   {
+      struct extension_info* ext_info = &config->servers[server].extensions[ext_idx];
+      struct extension_metrics* ext_metrics = NULL;
+
+      if (!ext_info->enabled)
+      {
+         continue;
+      }
+
+      for (int i = 0; i < config->number_of_extensions; i++)
+      {
+         if (!strcmp(config->extensions[i].extension_name, ext_info->name))
+         {
+            ext_metrics = &config->extensions[i];
+            break;
+         }
+      }
+
+      if (ext_metrics == NULL)
+      {
+         continue;
+      }
+
+      for (int metric_idx = 0; metric_idx < ext_metrics->number_of_metrics; metric_idx++)
+      {
+         struct prometheus* prom = &ext_metrics->metrics[metric_idx];
+         struct ext_query_alts* query_alt = NULL;
+
+         if (!collector_pass(prom->collector))
+         {
+            continue;
+         }
+
+         if ((prom->server_query_type == SERVER_QUERY_PRIMARY && plan->state != SERVER_PRIMARY) ||
+             (prom->server_query_type == SERVER_QUERY_REPLICA && plan->state != SERVER_REPLICA))
+         {
+            continue;
+         }
+
+         query_alt = pgexporter_get_extension_query_alt(prom->ext_root, &ext_info->installed_version);
+         if (query_alt == NULL)
+         {
+            continue;
+         }
+
+         if (metric_plan_init(&plan->extension_metrics[plan->number_of_extension_metrics], -1, prom,
+                              (struct pg_query_alts*)query_alt, plan->extensions[ext_idx].name))
+         {
+            goto error;
+         }
+
+         plan->number_of_extension_metrics++;
+      }
+   }
+
+   pgexporter_log_debug("Planned %d metrics and %d extension metrics for server %s (version %d.%d)",
+                        plan->number_of_metrics, plan->number_of_extension_metrics,
+                        config->servers[server].name, plan->version, plan->minor_version);
+
+   return plan;
+
+error:
+
+   pgexporter_log_error("Failed to plan the queries for server %s", config->servers[server].name);
+
+   query_plan_destroy(plan);
+
+   return NULL;
+}
+
+static int
+metric_plan_init(metric_plan_t* mp, int metric, struct prometheus* prom, struct pg_query_alts* query_alt, char* extension)
+{
+   char key[PROMETHEUS_LENGTH + MISC_LENGTH];
+   struct column* columns = query_alt->node.columns;
+
+   mp->metric = metric;
+   mp->prom = prom;
+   mp->query_alt = query_alt;
+   mp->extension = extension;
+
+   if (extension != NULL)
+   {
+      pgexporter_snprintf(key, sizeof(key), "%s\x1f%s", extension, prom->tag);
+   }
+   else
+   {
+      pgexporter_snprintf(key, sizeof(key), "%d\x1f%s", metric, prom->tag);
+   }
+
+   mp->key = strdup(key);
+   if (mp->key == NULL)
+   {
+      return 1;
+   }
+
+   for (int i = 0; i < query_alt->node.n_columns; i++)
+   {
+      mp->names[i] = columns[i].name;
+
+      if (columns[i].type == LABEL_TYPE)
+      {
+         if (!strcmp("database", columns[i].name))
+         {
+            mp->database_label = true;
+         }
+
+         mp->labels[mp->n_labels++] = i;
+      }
+      else
+      {
+         if (strlen(columns[i].name) > 0)
+         {
+            mp->prefixes[i] = pgexporter_vappend(NULL, 4, "pgexporter_", prom->tag, "_", columns[i].name);
+         }
+         else
+         {
+            mp->prefixes[i] = pgexporter_vappend(NULL, 2, "pgexporter_", prom->tag);
+         }
+
+         if (mp->prefixes[i] == NULL)
+         {
+            return 1;
+         }
+      }
+   }
+
+   return 0;
 }
 
-static bool
-collector_pass(const char* name)
+static void
+query_plan_destroy(query_plan_t* plan)
 {
-   struct configuration* config = (struct configuration*)shmem;
+   metric_plan_t* lists[2];
+   int sizes[2];
 
-   if (config->number_of_allowed_collectors == 0)
+   if (plan == NULL)
    {
-      return !excluded_collector(name);
+      return;
    }
 
-   bool is_allowed = allowed_collector(name);
-   bool is_excluded = excluded_collector(name);
+   lists[0] = plan->metrics;
+   sizes[0] = plan->metrics != NULL ? plan->number_of_metrics + 1 : 0;
+   lists[1] = plan->extension_metrics;
+   sizes[1] = plan->extension_metrics != NULL ? plan->number_of_extension_metrics + 1 : 0;
 
-   if (is_allowed && is_excluded)
+   for (int l = 0; l < 2; l++)
    {
-      goto error;
+      for (int i = 0; i < sizes[l]; i++)
+      {
+         free(lists[l][i].key);
+
+         for (int j = 0; j < MAX_NUMBER_OF_COLUMNS; j++)
+         {
+            free(lists[l][i].prefixes[j]);
+         }
+      }
+
+      free(lists[l]);
    }
 
-   return is_allowed;
+   free(plan);
+}
 
-error:
-   exit(1);
+static void
+destroy_query_plans(void)
+{
+   for (int server = 0; server < NUMBER_OF_SERVERS; server++)
+   {
+      query_plan_destroy(query_plans[server]);
+      query_plans[server] = NULL;
+   }
 }
 
 static void
 general_information(prometheus_metrics_container_t* container)
 {
+   int n_tags;
    char* data = NULL;
+   char* phases[] = {"connect", "auth", "query", "format", "send"};
+   struct string_builder* sb = NULL;
+   struct string_builder* labels = NULL;
    struct configuration* config;
 
    config = (struct configuration*)shmem;
@@ -988,6 +3504,139 @@ general_information(prometheus_metrics_container_t* container)
    add_metric_to_art(container->general_metrics, "pgexporter_logging_fatal", data, NULL, NULL, 0);
    free(data);
    data = NULL;
+
+   /* pgexporter_metrics_cache_hits_total */
+   data = pgexporter_vappend(data, 3,
+                             "#HELP pgexporter_metrics_cache_hits_total The number of scrapes served out of the metrics cache\n",
+                             "#TYPE pgexporter_metrics_cache_hits_total counter\n",
+                             "pgexporter_metrics_cache_hits_total ");
+   data = pgexporter_append_ulong(data, atomic_load(&config->metrics_cache_hits));
+   data = pgexporter_append(data, "\n");
+   add_metric_to_art(container->general_metrics, "pgexporter_metrics_cache_hits_total", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
+
+   /* pgexporter_metrics_cache_misses_total */
+   data = pgexporter_vappend(data, 3,
+                             "#HELP pgexporter_metrics_cache_misses_total The number of scrapes that collected because the metrics cache had nothing to serve\n",
+                             "#TYPE pgexporter_metrics_cache_misses_total counter\n",
+                             "pgexporter_metrics_cache_misses_total ");
+   data = pgexporter_append_ulong(data, atomic_load(&config->metrics_cache_misses));
+   data = pgexporter_append(data, "\n");
+   add_metric_to_art(container->general_metrics, "pgexporter_metrics_cache_misses_total", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
+
+   if (pgexporter_string_builder_create(CHUNK_SIZE, &sb) || pgexporter_string_builder_create(0, &labels))
+   {
+      goto error;
+   }
+
+   /* pgexporter_scrape_phase_seconds */
+   pgexporter_string_builder_append(sb, "#HELP pgexporter_scrape_phase_seconds The duration of the phases of a scrape. The query phase includes the connects\n");
+   pgexporter_string_builder_append(sb, "#TYPE pgexporter_scrape_phase_seconds histogram\n");
+
+   for (int i = 0; i < NUMBER_OF_SCRAPE_PHASES; i++)
+   {
+      pgexporter_string_builder_reset(labels);
+      pgexporter_string_builder_append(labels, "phase=\"");
+      pgexporter_string_builder_append(labels, phases[i]);
+      pgexporter_string_builder_append_char(labels, '"');
+
+      append_latency_histogram(sb, "pgexporter_scrape_phase_seconds", labels->buffer, &config->scrape_phases[i]);
+   }
+
+   add_metric_to_art(container->general_metrics, "pgexporter_scrape_phase_seconds", sb->buffer, NULL, NULL, 0);
+
+   /* pgexporter_query_duration_seconds */
+   pgexporter_string_builder_reset(sb);
+   pgexporter_string_builder_append(sb, "#HELP pgexporter_query_duration_seconds The time the server took for the result of a metric query\n");
+   pgexporter_string_builder_append(sb, "#TYPE pgexporter_query_duration_seconds histogram\n");
+
+   n_tags = MIN(atomic_load(&config->number_of_query_tags), NUMBER_OF_QUERY_TAGS);
+
+   for (int server = 0; server < config->number_of_servers; server++)
+   {
+      for (int tag = 0; tag < n_tags; tag++)
+      {
+         /* Only the queries that ran on the server. An observation adds to the sum, or is in the first bucket */
+         if (atomic_load(&config->query_latencies[server][tag].sum) == 0 && atomic_load(&config->query_latencies[server][tag].buckets[0]) == 0)
+         {
+            continue;
+         }
+
+         pgexporter_string_builder_reset(labels);
+         pgexporter_string_builder_append(labels, "server=\"");
+         pgexporter_string_builder_append_escaped(labels, &config->servers[server].name[0]);
+         pgexporter_string_builder_append(labels, "\", tag=\"");
+         pgexporter_string_builder_append_escaped(labels, config->query_tags[tag]);
+         pgexporter_string_builder_append_char(labels, '"');
+
+         append_latency_histogram(sb, "pgexporter_query_duration_seconds", labels->buffer, &config->query_latencies[server][tag]);
+      }
+   }
+
+   add_metric_to_art(container->general_metrics, "pgexporter_query_duration_seconds", sb->buffer, NULL, NULL, 0);
+
+error:
+
+   pgexporter_string_builder_destroy(sb);
+   pgexporter_string_builder_destroy(labels);
+}
+
+/**
+ * Append the samples of a latency histogram. The buckets of
+ * the histogram are made cumulative
+ *
+ * @param sb The string builder
+ * @param name The name of the metric
+ * @param labels The labels, formatted as name="value" pairs
+ * @param histogram The histogram
+ */
+static void
+append_latency_histogram(struct string_builder* sb, char* name, char* labels, struct latency_histogram* histogram)
+{
+   char number[MISC_LENGTH];
+   unsigned long count = 0;
+
+   for (int i = 0; i <= NUMBER_OF_LATENCY_BUCKETS; i++)
+   {
+      count += atomic_load(&histogram->buckets[i]);
+
+      if (i < NUMBER_OF_LATENCY_BUCKETS)
+      {
+         pgexporter_snprintf(number, sizeof(number), "%g", pgexporter_latency_bucket(i) / 1000000.0);
+      }
+      else
+      {
+         pgexporter_snprintf(number, sizeof(number), "+Inf");
+      }
+
+      pgexporter_string_builder_append(sb, name);
+      pgexporter_string_builder_append(sb, "_bucket{le=\"");
+      pgexporter_string_builder_append(sb, number);
+      pgexporter_string_builder_append(sb, "\", ");
+      pgexporter_string_builder_append(sb, labels);
+      pgexporter_string_builder_append(sb, "} ");
+      pgexporter_string_builder_append_int(sb, (int64_t)count);
+      pgexporter_string_builder_append_char(sb, '\n');
+   }
+
+   pgexporter_snprintf(number, sizeof(number), "%.6f", atomic_load(&histogram->sum) / 1000000.0);
+
+   pgexporter_string_builder_append(sb, name);
+   pgexporter_string_builder_append(sb, "_sum{");
+   pgexporter_string_builder_append(sb, labels);
+   pgexporter_string_builder_append(sb, "} ");
+   pgexporter_string_builder_append(sb, number);
+   pgexporter_string_builder_append_char(sb, '\n');
+
+   pgexporter_string_builder_append(sb, name);
+   pgexporter_string_builder_append(sb, "_count{");
+   pgexporter_string_builder_append(sb, labels);
+   pgexporter_string_builder_append(sb, "} ");
+   pgexporter_string_builder_append_int(sb, (int64_t)count);
+   pgexporter_string_builder_append_char(sb, '\n');
 }
 
 static void
@@ -1030,6 +3679,50 @@ query_statistics_information(prometheus_metrics_container_t* container)
    add_metric_to_art(container->general_metrics, "pgexporter_query_timeouts_total", data, NULL, NULL, 0);
    free(data);
    data = NULL;
+
+   /* pgexporter_scrape_allocations */
+   data = pgexporter_vappend(data, 3,
+                             "#HELP pgexporter_scrape_allocations The number of arena allocations of the last collection\n",
+                             "#TYPE pgexporter_scrape_allocations gauge\n",
+                             "pgexporter_scrape_allocations ");
+   data = pgexporter_append_ulong(data, atomic_load(&config->scrape_allocations));
+   data = pgexporter_append(data, "\n");
+   add_metric_to_art(container->general_metrics, "pgexporter_scrape_allocations", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
+
+   /* pgexporter_scrape_allocated_bytes */
+   data = pgexporter_vappend(data, 3,
+                             "#HELP pgexporter_scrape_allocated_bytes The number of bytes allocated from arenas by the last collection\n",
+                             "#TYPE pgexporter_scrape_allocated_bytes gauge\n",
+                             "pgexporter_scrape_allocated_bytes ");
+   data = pgexporter_append_ulong(data, atomic_load(&config->scrape_allocated_bytes));
+   data = pgexporter_append(data, "\n");
+   add_metric_to_art(container->general_metrics, "pgexporter_scrape_allocated_bytes", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
+
+   /* pgexporter_scrape_arena_blocks */
+   data = pgexporter_vappend(data, 3,
+                             "#HELP pgexporter_scrape_arena_blocks The number of arena blocks used by the last collection\n",
+                             "#TYPE pgexporter_scrape_arena_blocks gauge\n",
+                             "pgexporter_scrape_arena_blocks ");
+   data = pgexporter_append_ulong(data, atomic_load(&config->scrape_arena_blocks));
+   data = pgexporter_append(data, "\n");
+   add_metric_to_art(container->general_metrics, "pgexporter_scrape_arena_blocks", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
+
+   /* pgexporter_scrape_partial */
+   data = pgexporter_vappend(data, 3,
+                             "#HELP pgexporter_scrape_partial Whether the last collection ran out of time and only has part of the metrics\n",
+                             "#TYPE pgexporter_scrape_partial gauge\n",
+                             "pgexporter_scrape_partial ");
+   data = pgexporter_append_int(data, atomic_load(&scrape_partial) ? 1 : 0);
+   data = pgexporter_append(data, "\n");
+   add_metric_to_art(container->general_metrics, "pgexporter_scrape_partial", data, NULL, NULL, 0);
+   free(data);
+   data = NULL;
 }
 
 static void
@@ -1070,15 +3763,13 @@ server_information(prometheus_metrics_container_t* container)
 }
 
 static void
-version_information(prometheus_metrics_container_t* container)
+version_information(prometheus_metrics_container_t* container, server_collection_t* collections)
 {
-   int ret;
    int server;
    char* data = NULL;
    char* safe_key1 = NULL;
    char* safe_key2 = NULL;
    struct query* all = NULL;
-   struct query* query = NULL;
    struct tuple* current = NULL;
    struct configuration* config;
 
@@ -1086,19 +3777,8 @@ version_information(prometheus_metrics_container_t* container)
 
    for (server = 0; server < config->number_of_servers; server++)
    {
-      if (config->servers[server].fd != -1)
-      {
-         ret = pgexporter_query_version(server, &query);
-         if (ret == 0)
-         {
-            all = pgexporter_merge_queries(all, query, SORT_NAME);
-         }
-         else
-         {
-            pgexporter_log_error("Failed to query version for server %s", config->servers[server].name);
-         }
-         query = NULL;
-      }
+      all = pgexporter_merge_queries(all, collections[server].version, SORT_NAME);
+      collections[server].version = NULL;
    }
 
    if (all != NULL)
@@ -1145,14 +3825,12 @@ version_information(prometheus_metrics_container_t* container)
 }
 
 static void
-uptime_information(prometheus_metrics_container_t* container)
+uptime_information(prometheus_metrics_container_t* container, server_collection_t* collections)
 {
-   int ret;
    int server;
    char* data = NULL;
    char* safe_key = NULL;
    struct query* all = NULL;
-   struct query* query = NULL;
    struct tuple* current = NULL;
    struct configuration* config;
 
@@ -1160,19 +3838,8 @@ uptime_information(prometheus_metrics_container_t* container)
 
    for (server = 0; server < config->number_of_servers; server++)
    {
-      if (config->servers[server].fd != -1)
-      {
-         ret = pgexporter_query_uptime(server, &query);
-         if (ret == 0)
-         {
-            all = pgexporter_merge_queries(all, query, SORT_NAME);
-         }
-         else
-         {
-            pgexporter_log_error("Failed to query uptime for server %s", config->servers[server].name);
-         }
-         query = NULL;
-      }
+      all = pgexporter_merge_queries(all, collections[server].uptime, SORT_NAME);
+      collections[server].uptime = NULL;
    }
 
    if (all != NULL)
@@ -1214,13 +3881,11 @@ uptime_information(prometheus_metrics_container_t* container)
 }
 
 static void
-primary_information(prometheus_metrics_container_t* container)
+primary_information(prometheus_metrics_container_t* container, server_collection_t* collections)
 {
-   int ret;
    int server;
    char* data = NULL;
    struct query* all = NULL;
-   struct query* query = NULL;
    struct tuple* current = NULL;
    struct configuration* config;
 
@@ -1228,19 +3893,8 @@ primary_information(prometheus_metrics_container_t* container)
 
    for (server = 0; server < config->number_of_servers; server++)
    {
-      if (config->servers[server].fd != -1)
-      {
-         ret = pgexporter_query_primary(server, &query);
-         if (ret == 0)
-         {
-            all = pgexporter_merge_queries(all, query, SORT_NAME);
-         }
-         else
-         {
-            pgexporter_log_error("Failed to query primary for server %s", config->servers[server].name);
-         }
-         query = NULL;
-      }
+      all = pgexporter_merge_queries(all, collections[server].primary, SORT_NAME);
+      collections[server].primary = NULL;
    }
 
    if (all != NULL)
@@ -1288,13 +3942,11 @@ primary_information(prometheus_metrics_container_t* container)
 }
 
 static void
-fips_information(prometheus_metrics_container_t* container)
+fips_information(prometheus_metrics_container_t* container, server_collection_t* collections)
 {
-   int ret;
    int server;
    char* data = NULL;
    bool openssl_fips = false;
-   bool pg_fips = false;
    struct configuration* config;
 
    config = (struct configuration*)shmem;
@@ -1325,19 +3977,11 @@ fips_information(prometheus_metrics_container_t* container)
    {
       if (config->servers[server].fd != -1)
       {
-         ret = pgexporter_fips_server(server, &pg_fips);
-         if (ret != 0)
-         {
-            pgexporter_log_debug("FIPS status unavailable for server %s",
-                                 config->servers[server].name);
-            pg_fips = false;
-         }
-
          data = pgexporter_vappend(data, 3,
                                    "pgexporter_postgresql_fips{server=\"",
                                    &config->servers[server].name[0],
                                    "\"} ");
-         data = pgexporter_append(data, pg_fips ? "1" : "0");
+         data = pgexporter_append(data, collections[server].fips ? "1" : "0");
          data = pgexporter_append(data, "\n");
       }
    }
@@ -1437,14 +4081,12 @@ extension_list_information(prometheus_metrics_container_t* container)
 }
 
 static void
-settings_information(prometheus_metrics_container_t* container)
+settings_information(prometheus_metrics_container_t* container, server_collection_t* collections)
 {
-   int ret;
    char* data = NULL;
    char* safe_key = NULL;
    char* metric_key = NULL;
    struct query* all = NULL;
-   struct query* query = NULL;
    struct tuple* current = NULL;
    struct configuration* config;
 
@@ -1458,19 +4100,8 @@ settings_information(prometheus_metrics_container_t* container)
 
    for (int server = 0; server < config->number_of_servers; server++)
    {
-      if (config->servers[server].fd != -1)
-      {
-         ret = pgexporter_query_settings(server, &query);
-         if (ret == 0)
-         {
-            all = pgexporter_merge_queries(all, query, SORT_DATA0);
-         }
-         else
-         {
-            pgexporter_log_error("Failed to query settings for server %s", config->servers[server].name);
-         }
-         query = NULL;
-      }
+      all = pgexporter_merge_queries(all, collections[server].settings, SORT_DATA0);
+      collections[server].settings = NULL;
    }
 
    if (all != NULL)
@@ -1569,12 +4200,10 @@ evaluate_alert(int64_t value, enum alert_operator op, int64_t threshold)
 }
 
 static void
-alert_information(prometheus_metrics_container_t* container)
+alert_information(prometheus_metrics_container_t* container, server_collection_t* collections)
 {
-   int ret;
    int server;
-   char* data = NULL;
-   struct query* query = NULL;
+   struct string_builder* sb = NULL;
    struct configuration* config;
    char metric_name[PROMETHEUS_LENGTH];
 
@@ -1585,8 +4214,10 @@ alert_information(prometheus_metrics_container_t* container)
       return;
    }
 
-   int server_conn_valid[NUMBER_OF_SERVERS];
-   memset(server_conn_valid, -1, sizeof(server_conn_valid));
+   if (pgexporter_string_builder_create(0, &sb))
+   {
+      return;
+   }
 
    for (int a = 0; a < config->number_of_alerts; a++)
    {
@@ -1594,220 +4225,94 @@ alert_information(prometheus_metrics_container_t* container)
 
       pgexporter_snprintf(metric_name, sizeof(metric_name), "pgexporter_alert_%s", alert->name);
 
-      data = pgexporter_vappend(data, 5,
-                                "#HELP ", metric_name, " ", alert->description, "\n");
-      data = pgexporter_vappend(data, 3,
-                                "#TYPE ", metric_name, " gauge\n");
+      pgexporter_string_builder_reset(sb);
+
+      pgexporter_string_builder_append(sb, "#HELP ");
+      pgexporter_string_builder_append(sb, metric_name);
+      pgexporter_string_builder_append_char(sb, ' ');
+      pgexporter_string_builder_append(sb, alert->description);
+      pgexporter_string_builder_append(sb, "\n#TYPE ");
+      pgexporter_string_builder_append(sb, metric_name);
+      pgexporter_string_builder_append(sb, " gauge\n");
 
       for (server = 0; server < config->number_of_servers; server++)
       {
-         int firing = 0;
-
-         /* Server name filter */
-         if (!alert->servers_all && alert->number_of_servers > 0)
-         {
-            bool match = false;
-            for (int s = 0; s < alert->number_of_servers; s++)
-            {
-               if (!strcmp(alert->servers[s], config->servers[server].name))
-               {
-                  match = true;
-                  break;
-               }
-            }
-            if (!match)
-            {
-               continue;
-            }
-         }
-
-         /* Lazy connection validity check */
-         if (server_conn_valid[server] == -1)
-         {
-            server_conn_valid[server] = pgexporter_connection_isvalid(config->servers[server].ssl, config->servers[server].fd) ? 1 : 0;
-         }
-         bool conn_valid = (server_conn_valid[server] == 1);
-
-         if (alert->alert_type == ALERT_TYPE_CONNECTION)
-         {
-            firing = conn_valid ? 0 : 1;
-         }
-         else if (alert->alert_type == ALERT_TYPE_QUERY)
-         {
-            if (!conn_valid)
-            {
-               /* Server is down, skip query-based alerts */
-               firing = -1;
-            }
-            else
-            {
-               query = NULL;
-               ret = pgexporter_query_execute(server, alert->query, alert->name, &query);
-
-               if (ret == 0 && query != NULL && query->tuples != NULL)
-               {
-                  char* result_str = pgexporter_get_column(0, query->tuples);
-                  if (result_str != NULL)
-                  {
-                     int64_t value = strtoll(result_str, NULL, 10);
-                     firing = evaluate_alert(value, alert->operator, alert->threshold) ? 1 : 0;
-                  }
-               }
-               else
-               {
-                  pgexporter_log_warn("Failed to query alert '%s' for server %s",
-                                      alert->name, config->servers[server].name);
-                  firing = -1;
-               }
-
-               pgexporter_free_query(query);
-               query = NULL;
-            }
-         }
+         int firing = collections[server].alerts[a];
 
          if (firing >= 0)
          {
             char* type_str = (alert->alert_type == ALERT_TYPE_CONNECTION) ? "connection" : "query";
-            data = pgexporter_vappend(data, 3,
-                                      metric_name, "{server=\"",
-                                      &config->servers[server].name[0]);
-            data = pgexporter_vappend(data, 5,
-                                      "\",alert=\"", alert->name,
-                                      "\",type=\"", type_str,
-                                      "\"} ");
-            data = pgexporter_append(data, firing ? "1" : "0");
-            data = pgexporter_append(data, "\n");
+
+            pgexporter_string_builder_append(sb, metric_name);
+            pgexporter_string_builder_append(sb, "{server=\"");
+            pgexporter_string_builder_append_escaped(sb, &config->servers[server].name[0]);
+            pgexporter_string_builder_append(sb, "\",alert=\"");
+            pgexporter_string_builder_append_escaped(sb, alert->name);
+            pgexporter_string_builder_append(sb, "\",type=\"");
+            pgexporter_string_builder_append(sb, type_str);
+            pgexporter_string_builder_append(sb, "\"} ");
+            pgexporter_string_builder_append_int(sb, firing ? 1 : 0);
+            pgexporter_string_builder_append_char(sb, '\n');
          }
       }
 
-      data = pgexporter_append(data, "\n");
+      pgexporter_string_builder_append_char(sb, '\n');
 
-      if (data != NULL)
-      {
-         add_metric_to_art(container->alert_metrics, metric_name, data, NULL, NULL, 0);
-         free(data);
-         data = NULL;
-      }
+      add_metric_to_art(container->alert_metrics, metric_name, sb->buffer, NULL, NULL, 0);
    }
+
+   pgexporter_string_builder_destroy(sb);
 }
 
 static void
-extension_metrics(prometheus_metrics_container_t* container)
+extension_metrics(prometheus_metrics_container_t* container, server_collection_t* collections)
 {
    struct configuration* config = NULL;
-   char* data = NULL;
+   struct string_builder* sb = NULL;
 
    config = (struct configuration*)shmem;
 
-   query_list_t* ext_q_list = NULL;
-   query_list_t* ext_temp = NULL;
-
-   for (int server = 0; server < config->number_of_servers; server++)
+   /* The query lists stay with the collections when there is no builder */
+   if (pgexporter_string_builder_create(CHUNK_SIZE, &sb))
    {
-      if (config->servers[server].fd == -1)
-      {
-         continue;
-      }
-
-      for (int ext_idx = 0; ext_idx < config->servers[server].number_of_extensions; ext_idx++)
-      {
-         struct extension_info* ext_info = &config->servers[server].extensions[ext_idx];
-
-         if (!ext_info->enabled)
-         {
-            continue;
-         }
-
-         struct extension_metrics* ext_metrics = NULL;
-         for (int i = 0; i < config->number_of_extensions; i++)
-         {
-            if (!strcmp(config->extensions[i].extension_name, ext_info->name))
-            {
-               ext_metrics = &config->extensions[i];
-               break;
-            }
-         }
-
-         if (!ext_metrics)
-         {
-            continue;
-         }
-
-         for (int metric_idx = 0; metric_idx < ext_metrics->number_of_metrics; metric_idx++)
-         {
-            struct prometheus* prom = &ext_metrics->metrics[metric_idx];
-
-            if (!collector_pass(prom->collector))
-            {
-               continue;
-            }
-
-            if ((prom->server_query_type == SERVER_QUERY_PRIMARY && config->servers[server].state != SERVER_PRIMARY) ||
-                (prom->server_query_type == SERVER_QUERY_REPLICA && config->servers[server].state != SERVER_REPLICA))
-            {
-               continue;
-            }
-
-            struct ext_query_alts* query_alt = pgexporter_get_extension_query_alt(prom->ext_root, &ext_info->installed_version);
-
-            if (!query_alt)
-            {
-               continue;
-            }
-
-            query_list_t* next = malloc(sizeof(query_list_t));
-            memset(next, 0, sizeof(query_list_t));
-
-            if (!ext_q_list)
-            {
-               ext_q_list = next;
-               ext_temp = ext_q_list;
-            }
-            else if (ext_temp && ext_temp->query)
-            {
-               ext_temp->next = next;
-               ext_temp = next;
-            }
-            else if (ext_temp && !ext_temp->query)
-            {
-               free(next);
-               next = NULL;
-               memset(ext_temp, 0, sizeof(query_list_t));
-            }
+      return;
+   }
 
-            char** names = malloc(query_alt->node.n_columns * sizeof(char*));
-            for (int j = 0; j < query_alt->node.n_columns; j++)
-            {
-               names[j] = query_alt->node.columns[j].name;
-            }
-            memcpy(ext_temp->tag, prom->tag, PROMETHEUS_LENGTH);
-            ext_temp->query_alt = (struct pg_query_alts*)query_alt;
+   query_list_t* ext_q_list = NULL;
+   query_list_t* ext_temp = NULL;
 
-            if (query_alt->node.is_histogram)
-            {
-               ext_temp->error = pgexporter_custom_query(server, query_alt->node.query, prom->tag, -1, NULL, &ext_temp->query);
-               ext_temp->sort_type = prom->sort_type;
-            }
-            else
-            {
-               ext_temp->error = pgexporter_custom_query(server, query_alt->node.query, prom->tag, query_alt->node.n_columns, names, &ext_temp->query);
-               ext_temp->sort_type = prom->sort_type;
-            }
+   /* The servers were collected in order, so their lists can be chained as is */
+   for (int server = 0; server < config->number_of_servers; server++)
+   {
+      if (collections[server].extension == NULL)
+      {
+         continue;
+      }
 
-            if (ext_temp->error != 0)
-            {
-               pgexporter_log_error("Failed to execute extension query for server %s, extension %s, tag %s", config->servers[server].name, ext_info->name, prom->tag);
-            }
+      if (ext_q_list == NULL)
+      {
+         ext_q_list = collections[server].extension;
+      }
+      else
+      {
+         ext_temp->next = collections[server].extension;
+      }
 
-            free(names);
-            names = NULL;
-         }
+      ext_temp = collections[server].extension;
+      while (ext_temp->next != NULL)
+      {
+         ext_temp = ext_temp->next;
       }
+
+      collections[server].extension = NULL;
    }
 
    ext_temp = ext_q_list;
    column_store_t ext_store[MAX_METRIC_COLUMNS] = {0};
    int ext_n_store = 0;
+   struct art* ext_index = NULL;
+
+   pgexporter_art_create(&ext_index);
 
    while (ext_temp)
    {
@@ -1817,22 +4322,22 @@ extension_metrics(prometheus_metrics_container_t* container)
          {
             if (ext_temp->query_alt->node.is_histogram)
             {
-               handle_default_histogram(ext_store, &ext_n_store, ext_temp);
+               handle_default_histogram(ext_store, &ext_n_store, ext_index, ext_temp);
             }
             else
             {
-               handle_default_gauge_counter(ext_store, &ext_n_store, ext_temp);
+               handle_default_gauge_counter(ext_store, &ext_n_store, ext_index, ext_temp);
             }
          }
          else
          {
             if (ext_temp->query_alt->node.is_histogram)
             {
-               handle_histogram(ext_store, &ext_n_store, ext_temp);
+               handle_histogram(ext_store, &ext_n_store, ext_index, ext_temp);
             }
             else
             {
-               handle_gauge_counter(ext_store, &ext_n_store, ext_temp);
+               handle_gauge_counter(ext_store, &ext_n_store, ext_index, ext_temp);
             }
          }
       }
@@ -1846,28 +4351,34 @@ extension_metrics(prometheus_metrics_container_t* container)
 
       while (temp)
       {
-         data = pgexporter_append(data, temp->data);
+         pgexporter_string_builder_append(sb, temp->data);
          last = temp;
          temp = temp->next;
 
          free(last->data);
-         free(last);
+         scrape_free(last);
       }
-      data = pgexporter_append(data, "\n");
+      pgexporter_string_builder_append_char(sb, '\n');
    }
 
-   if (data)
+   pgexporter_column_store_destroy(ext_store, ext_n_store);
+   pgexporter_art_destroy(ext_index);
+
+   if (sb->length > 0)
    {
-      add_metric_to_art(container->extension_metrics, "extension_metrics", data, NULL, NULL, 0);
-      free(data);
-      data = NULL;
+      add_metric_to_art(container->extension_metrics, "extension_metrics", sb->buffer, NULL, NULL, 0);
    }
 
+   pgexporter_string_builder_destroy(sb);
+
    ext_temp = ext_q_list;
    query_list_t* ext_last = NULL;
    while (ext_temp)
    {
-      pgexporter_free_query(ext_temp->query);
+      if (!ext_temp->cached)
+      {
+         pgexporter_free_query(ext_temp->query);
+      }
 
       ext_last = ext_temp;
       ext_temp = ext_temp->next;
@@ -1879,142 +4390,48 @@ extension_metrics(prometheus_metrics_container_t* container)
 }
 
 static void
-custom_metrics(prometheus_metrics_container_t* container)
+custom_metrics(prometheus_metrics_container_t* container, server_collection_t* collections)
 {
    struct configuration* config = NULL;
-   char* data = NULL;
-   int ret = 0;
+   struct string_builder* sb = NULL;
+   query_list_t* cursors[NUMBER_OF_SERVERS];
 
    config = (struct configuration*)shmem;
 
+   /* The query lists stay with the collections when there is no builder */
+   if (pgexporter_string_builder_create(CHUNK_SIZE, &sb))
+   {
+      return;
+   }
+
    query_list_t* q_list = NULL;
    query_list_t* temp = q_list;
 
-   // Iterate through each metric to send its query to PostgreSQL server
-   for (int i = 0; i < config->number_of_metrics; i++)
+   for (int server = 0; server < config->number_of_servers; server++)
    {
-      struct prometheus* prom = &config->prometheus[i];
-
-      /* Expose only if default or specified */
-      if (!collector_pass(prom->collector))
-      {
-         continue;
-      }
+      cursors[server] = collections[server].custom;
+      collections[server].custom = NULL;
+   }
 
-      // Iterate through each server and send appropriate query to PostgreSQL server
+   // Interleave the per-server lists so the queries are ordered by metric, then by server
+   for (int i = 0; i < config->number_of_metrics; i++)
+   {
       for (int server = 0; server < config->number_of_servers; server++)
       {
-         // Database execution
-         int n_db = config->servers[server].number_of_databases;
-         if (prom->exec_on_all_dbs)
-         {
-            pgexporter_log_debug("Querying on all databases for tag %s: ENABLED", prom->tag);
-         }
-         else
-         {
-            pgexporter_log_debug("Querying on all databases for tag %s: DISABLED", prom->tag);
-         }
-
-         for (int db_idx = prom->exec_on_all_dbs ? 0 : n_db - 1; db_idx < n_db; db_idx++)
+         while (cursors[server] != NULL && cursors[server]->metric == i)
          {
-            if (config->servers[server].fd == -1)
-            {
-               /* Skip */
-               continue;
-            }
-
-            if ((prom->server_query_type == SERVER_QUERY_PRIMARY && config->servers[server].state != SERVER_PRIMARY) ||
-                (prom->server_query_type == SERVER_QUERY_REPLICA && config->servers[server].state != SERVER_REPLICA))
-            {
-               /* Skip */
-               continue;
-            }
-
-            struct pg_query_alts* query_alt = pgexporter_get_pg_query_alt(prom->pg_root, server);
-
-            if (!query_alt)
-            {
-               /* Skip */
-               continue;
-            }
-
-            // Setting Temp's value
-            query_list_t* next = malloc(sizeof(query_list_t));
-            memset(next, 0, sizeof(query_list_t));
-
             if (!q_list)
             {
-               q_list = next;
-               temp = q_list;
-            }
-            else if (temp && temp->query)
-            {
-               temp->next = next;
-               temp = next;
-            }
-            else if (temp && !temp->query)
-            {
-               free(next);
-               next = NULL;
-               memset(temp, 0, sizeof(query_list_t));
-            }
-
-            /* Names */
-            char** names = malloc(query_alt->node.n_columns * sizeof(char*));
-            for (int j = 0; j < query_alt->node.n_columns; j++)
-            {
-               names[j] = query_alt->node.columns[j].name;
-            }
-            memcpy(temp->tag, prom->tag, PROMETHEUS_LENGTH);
-            temp->query_alt = query_alt;
-
-            char* database = config->servers[server].databases[db_idx];
-
-            if (prom->exec_on_all_dbs)
-            {
-               pgexporter_log_debug("Querying server: %s, db: %s (%d / %d)", config->servers[server].name, database, db_idx + 1, n_db);
-            }
-            else
-            {
-               pgexporter_log_debug("Querying server: %s", config->servers[server].name);
-            }
-
-            ret = pgexporter_switch_db(server, database);
-            if (ret != 0)
-            {
-               pgexporter_log_info("Error connecting to server: %s, database: %s", config->servers[server].name, database);
-               free(names);
-               break;
-            }
-
-            // Gather all the queries in a linked list, with each query's result (linked list of tuples in it) as a node.
-            if (query_alt->node.is_histogram)
-            {
-               temp->error = pgexporter_custom_query(server, query_alt->node.query, prom->tag, -1, NULL, &temp->query);
-               temp->sort_type = prom->sort_type;
+               q_list = cursors[server];
             }
             else
             {
-               temp->error = pgexporter_custom_query(server, query_alt->node.query, prom->tag, query_alt->node.n_columns, names, &temp->query);
-               temp->sort_type = prom->sort_type;
-            }
-
-            if (temp->error != 0)
-            {
-               if (prom->optional)
-               {
-                  pgexporter_log_debug("Failed to execute custom query for server %s, database %s, tag %s", config->servers[server].name, database, prom->tag);
-               }
-               else
-               {
-                  pgexporter_log_warn("Failed to execute custom query for server %s, database %s, tag %s", config->servers[server].name, database, prom->tag);
-               }
+               temp->next = cursors[server];
             }
 
-            pgexporter_snprintf(temp->database, DB_NAME_LENGTH, "%s", database);
-
-            free(names);
-            names = NULL;
+            temp = cursors[server];
+            cursors[server] = cursors[server]->next;
+            temp->next = NULL;
          }
       }
    }
@@ -2023,6 +4440,9 @@ custom_metrics(prometheus_metrics_container_t* container)
    temp = q_list;
    column_store_t store[MAX_METRIC_COLUMNS] = {0};
    int n_store = 0;
+   struct art* index = NULL;
+
+   pgexporter_art_create(&index);
 
    while (temp)
    {
@@ -2032,22 +4452,22 @@ custom_metrics(prometheus_metrics_container_t* container)
          {
             if (temp->query_alt->node.is_histogram)
             {
-               handle_default_histogram(store, &n_store, temp);
+               handle_default_histogram(store, &n_store, index, temp);
             }
             else
             {
-               handle_default_gauge_counter(store, &n_store, temp);
+               handle_default_gauge_counter(store, &n_store, index, temp);
             }
          }
          else
          {
             if (temp->query_alt->node.is_histogram)
             {
-               handle_histogram(store, &n_store, temp);
+               handle_histogram(store, &n_store, index, temp);
             }
             else
             {
-               handle_gauge_counter(store, &n_store, temp);
+               handle_gauge_counter(store, &n_store, index, temp);
             }
          }
       }
@@ -2061,29 +4481,35 @@ custom_metrics(prometheus_metrics_container_t* container)
 
       while (temp)
       {
-         data = pgexporter_append(data, temp->data);
+         pgexporter_string_builder_append(sb, temp->data);
          last = temp;
          temp = temp->next;
 
          // Free it
          free(last->data);
-         free(last);
+         scrape_free(last);
       }
-      data = pgexporter_append(data, "\n");
+      pgexporter_string_builder_append_char(sb, '\n');
    }
 
-   if (data)
+   pgexporter_column_store_destroy(store, n_store);
+   pgexporter_art_destroy(index);
+
+   if (sb->length > 0)
    {
-      add_metric_to_art(container->custom_metrics, "custom_metrics", data, NULL, NULL, 0);
-      free(data);
-      data = NULL;
+      add_metric_to_art(container->custom_metrics, "custom_metrics", sb->buffer, NULL, NULL, 0);
    }
 
+   pgexporter_string_builder_destroy(sb);
+
    temp = q_list;
    query_list_t* last = NULL;
    while (temp)
    {
-      pgexporter_free_query(temp->query);
+      if (!temp->cached)
+      {
+         pgexporter_free_query(temp->query);
+      }
       // temp->query_alt // Not freed here, but when program ends
 
       last = temp;
@@ -2138,94 +4564,26 @@ parse_list(char* list_str, char** strs, int* n_strs)
 static void
 add_column_to_store(column_store_t* store, int store_idx, char* data, int sort_type, struct tuple* current)
 {
-   column_node_t* new_node = malloc(sizeof(column_node_t));
-   memset(new_node, 0, sizeof(column_node_t));
+   column_node_t* new_node = scrape_alloc(sizeof(column_node_t));
 
    new_node->data = data;
    new_node->tuple = current;
+   new_node->next = NULL;
 
-   if (!store[store_idx].columns)
-   {
-      store[store_idx].columns = new_node;
-      store[store_idx].last_column = new_node;
-      return;
-   }
-
-   if (sort_type == SORT_DATA0)
-   {
-      // SORT_DATA0 means sorting according to the first data (data[0]) in a tuple.
-      // Usually it is the application/database column, so tuples with same such column values
-      // are grouped together.
-      column_node_t* temp = store[store_idx].columns;
-
-      // first node is for help/type info
-      if (!temp->next)
-      {
-         temp->next = new_node;
-         store[store_idx].last_column = new_node;
-      }
-      else
-      {
-         while (temp->next)
-         {
-            if (temp->next->tuple != NULL && current != NULL)
-            {
-               char* next_d0 = temp->next->tuple->data[0];
-               char* cur_d0 = current->data[0];
-
-               if (next_d0 == NULL && cur_d0 == NULL)
-               {
-                  // both are NULL, group them together
-                  break;
-               }
-               else if (next_d0 == NULL && cur_d0 != NULL)
-               {
-                  // insert non-NULL before NULL, NULLs go last
-                  break;
-               }
-               else if (next_d0 != NULL && cur_d0 != NULL && !strcmp(next_d0, cur_d0))
-               {
-                  // both are non-NULL and equal, group them together
-                  break;
-               }
-               // cur is NULL but next is not, keep searching to put NULL last
-            }
-            temp = temp->next;
-         }
-
-         if (!temp->next)
-         {
-            temp->next = new_node;
-            store[store_idx].last_column = new_node;
-         }
-         else
-         {
-            new_node->next = temp->next;
-            temp->next = new_node;
-         }
-      }
-   }
-   else
-   {
-      // Current can be null for SORT_NAME
-      // Default sort as SORT_NAME
-      store[store_idx].last_column->next = new_node;
-      store[store_idx].last_column = new_node;
-   }
+   pgexporter_column_store_add(&store[store_idx], new_node, sort_type);
 }
 
 static void
-handle_histogram(column_store_t* store, int* n_store, query_list_t* temp)
+handle_histogram(column_store_t* store, int* n_store, struct art* index, query_list_t* temp)
 {
    char* data = NULL;
-   char* safe_key = NULL;
    struct configuration* config;
    int n_bounds = 0;
    int n_buckets = 0;
    char* bounds_arr[MAX_ARR_LENGTH] = {0};
    char* buckets_arr[MAX_ARR_LENGTH] = {0};
    int idx = 0;
-   bool db_key_present = false;
+   struct string_builder* sb = NULL;
 
    config = (struct configuration*)shmem;
 
@@ -2250,6 +4608,11 @@ handle_histogram(column_store_t* store, int* n_store, query_list_t* temp)
       return;
    }
 
+   if (pgexporter_string_builder_create(0, &sb))
+   {
+      return;
+   }
+
    char* names[4] = {0};
 
    /* generate column names X_sum, X_count, X, X_bucket*/
@@ -2265,15 +4628,10 @@ handle_histogram(column_store_t* store, int* n_store, query_list_t* temp)
                                  temp->query_alt->node.columns[h_idx].name,
                                  "_bucket");
 
-   for (; idx < *n_store; idx++)
+   idx = pgexporter_column_store_find(index, temp->tag, temp->query_alt->node.columns[h_idx].name, HISTOGRAM_TYPE, temp->sort_type);
+   if (idx < 0)
    {
-      if (store[idx].type == HISTOGRAM_TYPE &&
-          store[idx].sort_type == temp->sort_type &&
-          !strcmp(store[idx].tag, temp->tag) &&
-          !strcmp(store[idx].name, temp->query_alt->node.columns[h_idx].name))
-      {
-         break;
-      }
+      idx = *n_store;
    }
 
 append:
@@ -2304,176 +4662,64 @@ append:
          char* buckets_str = pgexporter_get_column_by_name(names[3], temp->query, current);
          parse_list(buckets_str, buckets_arr, &n_buckets);
 
+         pgexporter_string_builder_reset(sb);
+
          for (int i = 0; i < n_bounds; i++)
          {
-            data = pgexporter_vappend(data, 8,
-                                      "pgexporter_",
-                                      temp->tag,
-                                      "_bucket{le=\"",
-                                      bounds_arr[i],
-                                      "\", ",
-                                      "server=\"",
-                                      &config->servers[current->server].name[0],
-                                      "\"");
-
-            db_key_present = false;
-            for (int j = 0; j < h_idx; j++)
-            {
-               if (!db_key_present && !strcmp("database", temp->query_alt->node.columns[j].name))
-               {
-                  db_key_present = true;
-               }
-
-               safe_key = safe_prometheus_attribute(pgexporter_get_column(j, current),
-                                                    temp->query->type_oids[j]);
-               data = pgexporter_vappend(data, 5,
-                                         ", ",
-                                         temp->query_alt->node.columns[j].name,
-                                         "=\"",
-                                         safe_key,
-                                         "\"");
-               safe_prometheus_key_free(safe_key);
-            }
-
-            // Database
-            if (!db_key_present)
-            {
-               data = pgexporter_vappend(data, 3,
-                                         ", database=\"",
-                                         temp->database,
-                                         "\"");
-            }
-
-            data = pgexporter_vappend(data, 3,
-                                      "} ",
-                                      buckets_arr[i],
-                                      "\n");
+            pgexporter_string_builder_append(sb, "pgexporter_");
+            pgexporter_string_builder_append(sb, temp->tag);
+            pgexporter_string_builder_append(sb, "_bucket{le=\"");
+            pgexporter_string_builder_append(sb, bounds_arr[i]);
+            pgexporter_string_builder_append(sb, "\", server=\"");
+            pgexporter_string_builder_append_escaped(sb, &config->servers[current->server].name[0]);
+            pgexporter_string_builder_append_char(sb, '"');
+
+            append_histogram_labels(sb, temp, current, h_idx);
+
+            pgexporter_string_builder_append(sb, "} ");
+            pgexporter_string_builder_append(sb, buckets_arr[i]);
+            pgexporter_string_builder_append_char(sb, '\n');
          }
 
-         data = pgexporter_vappend(data, 6,
-                                   "pgexporter_",
-                                   temp->tag,
-                                   "_bucket{le=\"+Inf\", ",
-                                   "server=\"",
-                                   &config->servers[current->server].name[0],
-                                   "\"");
-
-         db_key_present = false;
-         for (int j = 0; j < h_idx; j++)
-         {
-            if (!db_key_present && !strcmp("database", temp->query_alt->node.columns[j].name))
-            {
-               db_key_present = true;
-            }
-
-            safe_key = safe_prometheus_attribute(pgexporter_get_column(j, current),
-                                                 temp->query->type_oids[j]);
-            data = pgexporter_vappend(data, 5,
-                                      ", ",
-                                      temp->query_alt->node.columns[j].name,
-                                      "=\"",
-                                      safe_key,
-                                      "\"");
-            safe_prometheus_key_free(safe_key);
-         }
+         pgexporter_string_builder_append(sb, "pgexporter_");
+         pgexporter_string_builder_append(sb, temp->tag);
+         pgexporter_string_builder_append(sb, "_bucket{le=\"+Inf\", server=\"");
+         pgexporter_string_builder_append_escaped(sb, &config->servers[current->server].name[0]);
+         pgexporter_string_builder_append_char(sb, '"');
 
-         // Database
-         if (!db_key_present)
-         {
-            data = pgexporter_vappend(data, 3,
-                                      ", database=\"",
-                                      temp->database,
-                                      "\"");
-         }
+         append_histogram_labels(sb, temp, current, h_idx);
 
-         data = pgexporter_vappend(data, 3,
-                                   "} ",
-                                   pgexporter_get_column_by_name(names[1], temp->query, current),
-                                   "\n");
+         pgexporter_string_builder_append(sb, "} ");
+         pgexporter_string_builder_append(sb, pgexporter_get_column_by_name(names[1], temp->query, current));
+         pgexporter_string_builder_append_char(sb, '\n');
 
          /* sum */
-         data = pgexporter_vappend(data, 6,
-                                   "pgexporter_",
-                                   temp->tag,
-                                   "_sum",
-                                   "{server=\"",
-                                   &config->servers[current->server].name[0],
-                                   "\"");
-
-         db_key_present = false;
-         for (int j = 0; j < h_idx; j++)
-         {
-            if (!db_key_present && !strcmp("database", temp->query_alt->node.columns[j].name))
-            {
-               db_key_present = true;
-            }
-
-            safe_key = safe_prometheus_attribute(pgexporter_get_column(j, current),
-                                                 temp->query->type_oids[j]);
-            data = pgexporter_vappend(data, 5,
-                                      ", ",
-                                      temp->query_alt->node.columns[j].name,
-                                      "=\"",
-                                      safe_key,
-                                      "\"");
-            safe_prometheus_key_free(safe_key);
-         }
+         pgexporter_string_builder_append(sb, "pgexporter_");
+         pgexporter_string_builder_append(sb, temp->tag);
+         pgexporter_string_builder_append(sb, "_sum{server=\"");
+         pgexporter_string_builder_append_escaped(sb, &config->servers[current->server].name[0]);
+         pgexporter_string_builder_append_char(sb, '"');
 
-         // Database
-         if (!db_key_present)
-         {
-            data = pgexporter_vappend(data, 3,
-                                      ", database=\"",
-                                      temp->database,
-                                      "\"");
-         }
+         append_histogram_labels(sb, temp, current, h_idx);
 
-         data = pgexporter_vappend(data, 3,
-                                   "} ",
-                                   pgexporter_get_column_by_name(names[0], temp->query, current),
-                                   "\n");
+         pgexporter_string_builder_append(sb, "} ");
+         pgexporter_string_builder_append(sb, pgexporter_get_column_by_name(names[0], temp->query, current));
+         pgexporter_string_builder_append_char(sb, '\n');
 
          /* count */
-         data = pgexporter_vappend(data, 6,
-                                   "pgexporter_",
-                                   temp->tag,
-                                   "_count",
-                                   "{server=\"",
-                                   &config->servers[current->server].name[0],
-                                   "\"");
-
-         db_key_present = false;
-         for (int j = 0; j < h_idx; j++)
-         {
-            if (!db_key_present && !strcmp("database", temp->query_alt->node.columns[j].name))
-            {
-               db_key_present = true;
-            }
+         pgexporter_string_builder_append(sb, "pgexporter_");
+         pgexporter_string_builder_append(sb, temp->tag);
+         pgexporter_string_builder_append(sb, "_count{server=\"");
+         pgexporter_string_builder_append_escaped(sb, &config->servers[current->server].name[0]);
+         pgexporter_string_builder_append_char(sb, '"');
 
-            safe_key = safe_prometheus_attribute(pgexporter_get_column(j, current),
-                                                 temp->query->type_oids[j]);
-            data = pgexporter_vappend(data, 5,
-                                      ", ",
-                                      temp->query_alt->node.columns[j].name,
-                                      "=\"",
-                                      safe_key,
-                                      "\"");
-            safe_prometheus_key_free(safe_key);
-         }
+         append_histogram_labels(sb, temp, current, h_idx);
 
-         // Database
-         if (!db_key_present)
-         {
-            data = pgexporter_vappend(data, 3,
-                                      ", database=\"",
-                                      temp->database,
-                                      "\"");
-         }
+         pgexporter_string_builder_append(sb, "} ");
+         pgexporter_string_builder_append(sb, pgexporter_get_column_by_name(names[1], temp->query, current));
+         pgexporter_string_builder_append_char(sb, '\n');
 
-         data = pgexporter_vappend(data, 3,
-                                   "} ",
-                                   pgexporter_get_column_by_name(names[1], temp->query, current),
-                                   "\n");
+         data = pgexporter_string_builder_copy(sb);
 
          add_column_to_store(store, idx, data, temp->sort_type, current);
 
@@ -2506,6 +4752,7 @@ append:
       }
 
       (*n_store)++;
+      pgexporter_column_store_index(index, temp->tag, temp->query_alt->node.columns[h_idx].name, HISTOGRAM_TYPE, temp->sort_type, idx);
 
       store[idx].type = HISTOGRAM_TYPE;
       store[idx].sort_type = temp->sort_type;
@@ -2529,10 +4776,40 @@ append:
    free(names[1]);
    free(names[2]);
    free(names[3]);
+
+   pgexporter_string_builder_destroy(sb);
+}
+
+static void
+append_histogram_labels(struct string_builder* sb, query_list_t* temp, struct tuple* current, int h_idx)
+{
+   bool db_key_present = false;
+
+   for (int j = 0; j < h_idx; j++)
+   {
+      if (!db_key_present && !strcmp("database", temp->query_alt->node.columns[j].name))
+      {
+         db_key_present = true;
+      }
+
+      pgexporter_string_builder_append(sb, ", ");
+      pgexporter_string_builder_append(sb, temp->query_alt->node.columns[j].name);
+      pgexporter_string_builder_append(sb, "=\"");
+      append_safe_attribute(sb, pgexporter_get_column(j, current), temp->query->type_oids[j]);
+      pgexporter_string_builder_append_char(sb, '"');
+   }
+
+   // Database
+   if (!db_key_present)
+   {
+      pgexporter_string_builder_append(sb, ", database=\"");
+      pgexporter_string_builder_append(sb, temp->database);
+      pgexporter_string_builder_append_char(sb, '"');
+   }
 }
 
 static void
-handle_default_gauge_counter(column_store_t* store, int* n_store, query_list_t* temp)
+handle_default_gauge_counter(column_store_t* store, int* n_store, struct art* index, query_list_t* temp)
 {
    char* data = NULL;
    struct configuration* config;
@@ -2547,16 +4824,10 @@ handle_default_gauge_counter(column_store_t* store, int* n_store, query_list_t*
          continue;
       }
 
-      int idx = 0;
-      for (; idx < (*n_store); idx++)
+      int idx = pgexporter_column_store_find(index, temp->tag, temp->query_alt->node.columns[i].name, temp->query_alt->node.columns[i].type, -1);
+      if (idx < 0)
       {
-         if (!strcmp(store[idx].tag, temp->tag) &&
-             ((strlen(store[idx].name) == 0 && strlen(temp->query_alt->node.columns[i].name) == 0) ||
-              !strcmp(store[idx].name, temp->query_alt->node.columns[i].name)) &&
-             store[idx].type == temp->query_alt->node.columns[i].type)
-         {
-            break;
-         }
+         idx = *n_store;
       }
 
       if (idx >= (*n_store))
@@ -2568,6 +4839,7 @@ handle_default_gauge_counter(column_store_t* store, int* n_store, query_list_t*
          }
 
          (*n_store)++;
+         pgexporter_column_store_index(index, temp->tag, temp->query_alt->node.columns[i].name, temp->query_alt->node.columns[i].type, -1, idx);
          memcpy(store[idx].name, temp->query_alt->node.columns[i].name, MISC_LENGTH);
          store[idx].type = temp->query_alt->node.columns[i].type;
          memcpy(store[idx].tag, temp->tag, MISC_LENGTH);
@@ -2639,7 +4911,7 @@ handle_default_gauge_counter(column_store_t* store, int* n_store, query_list_t*
 }
 
 static void
-handle_default_histogram(column_store_t* store, int* n_store, query_list_t* temp)
+handle_default_histogram(column_store_t* store, int* n_store, struct art* index, query_list_t* temp)
 {
    char* data = NULL;
    struct configuration* config;
@@ -2656,16 +4928,10 @@ handle_default_histogram(column_store_t* store, int* n_store, query_list_t* temp
       }
    }
 
-   int idx = 0;
-   for (; idx < *n_store; idx++)
+   int idx = pgexporter_column_store_find(index, temp->tag, temp->query_alt->node.columns[h_idx].name, HISTOGRAM_TYPE, temp->sort_type);
+   if (idx < 0)
    {
-      if (store[idx].type == HISTOGRAM_TYPE &&
-          store[idx].sort_type == temp->sort_type &&
-          !strcmp(store[idx].tag, temp->tag) &&
-          !strcmp(store[idx].name, temp->query_alt->node.columns[h_idx].name))
-      {
-         break;
-      }
+      idx = *n_store;
    }
 
    if (idx >= (*n_store))
@@ -2677,6 +4943,7 @@ handle_default_histogram(column_store_t* store, int* n_store, query_list_t* temp
       }
 
       (*n_store)++;
+      pgexporter_column_store_index(index, temp->tag, temp->query_alt->node.columns[h_idx].name, HISTOGRAM_TYPE, temp->sort_type, idx);
 
       store[idx].type = HISTOGRAM_TYPE;
       store[idx].sort_type = temp->sort_type;
@@ -2825,14 +5092,20 @@ handle_default_histogram(column_store_t* store, int* n_store, query_list_t* temp
 }
 
 static void
-handle_gauge_counter(column_store_t* store, int* n_store, query_list_t* temp)
+handle_gauge_counter(column_store_t* store, int* n_store, struct art* index, query_list_t* temp)
 {
    char* data = NULL;
    char* safe_key = NULL;
    struct configuration* config;
-   bool db_key_present = false;
+   metric_plan_t* plan = temp->plan;
+   struct string_builder* sb = NULL;
    config = (struct configuration*)shmem;
 
+   if (pgexporter_string_builder_create(0, &sb))
+   {
+      return;
+   }
+
    for (int i = 0; i < temp->query_alt->node.n_columns; i++)
    {
       if (temp->query_alt->node.columns[i].type == LABEL_TYPE)
@@ -2841,16 +5114,10 @@ handle_gauge_counter(column_store_t* store, int* n_store, query_list_t* temp)
          continue;
       }
 
-      int idx = 0;
-      for (; idx < (*n_store); idx++)
+      int idx = pgexporter_column_store_find(index, temp->tag, temp->query_alt->node.columns[i].name, temp->query_alt->node.columns[i].type, -1);
+      if (idx < 0)
       {
-         if (!strcmp(store[idx].tag, temp->tag) &&
-             ((strlen(store[idx].name) == 0 && strlen(temp->query_alt->node.columns[i].name) == 0) ||
-              !strcmp(store[idx].name, temp->query_alt->node.columns[i].name)) &&
-             store[idx].type == temp->query_alt->node.columns[i].type)
-         {
-            break;
-         }
+         idx = *n_store;
       }
 
 append:
@@ -2878,64 +5145,41 @@ append:
                continue;
             }
 
-            data = NULL;
-
-            data = pgexporter_vappend(data, 2,
-                                      "pgexporter_",
-                                      store[idx].tag);
-
-            if (strlen(store[idx].name) > 0)
-            {
-               data = pgexporter_vappend(data, 2,
-                                         "_",
-                                         store[idx].name);
-            }
+            pgexporter_string_builder_reset(sb);
 
-            data = pgexporter_vappend(data, 3,
-                                      "{server=\"",
-                                      config->servers[temp->query->tuples->server].name,
-                                      "\"");
+            pgexporter_string_builder_append(sb, plan->prefixes[i]);
 
-            /* Labels */
-            for (int j = 0; j < temp->query_alt->node.n_columns; j++)
-            {
-               if (temp->query_alt->node.columns[j].type != LABEL_TYPE)
-               {
-                  continue;
-               }
+            pgexporter_string_builder_append(sb, "{server=\"");
+            pgexporter_string_builder_append_escaped(sb, config->servers[temp->query->tuples->server].name);
+            pgexporter_string_builder_append_char(sb, '"');
 
-               if (!db_key_present && !strcmp("database", temp->query_alt->node.columns[j].name))
-               {
-                  db_key_present = true;
-               }
+            /* Labels */
+            for (int l = 0; l < plan->n_labels; l++)
+            {
+               int j = plan->labels[l];
 
-               safe_key = safe_prometheus_attribute(pgexporter_get_column(j, tuple),
-                                                    temp->query->type_oids[j]);
-               data = pgexporter_vappend(data, 5,
-                                         ", ",
-                                         temp->query_alt->node.columns[j].name,
-                                         "=\"",
-                                         safe_key,
-                                         "\"");
-               safe_prometheus_key_free(safe_key);
+               pgexporter_string_builder_append(sb, ", ");
+               pgexporter_string_builder_append(sb, plan->names[j]);
+               pgexporter_string_builder_append(sb, "=\"");
+               append_safe_attribute(sb, pgexporter_get_column(j, tuple), temp->query->type_oids[j]);
+               pgexporter_string_builder_append_char(sb, '"');
             }
 
             // Database
-            if (!db_key_present)
+            if (!plan->database_label)
             {
-               data = pgexporter_vappend(data, 3,
-                                         ", database=\"",
-                                         temp->database,
-                                         "\"");
+               pgexporter_string_builder_append(sb, ", database=\"");
+               pgexporter_string_builder_append(sb, temp->database);
+               pgexporter_string_builder_append_char(sb, '"');
             }
 
             safe_key = safe_prometheus_key(metric_val);
-            data = pgexporter_vappend(data, 3,
-                                      "} ",
-                                      get_value(store[idx].tag, store[idx].name, safe_key),
-                                      "\n");
+            pgexporter_string_builder_append(sb, "} ");
+            pgexporter_string_builder_append(sb, get_value(store[idx].tag, store[idx].name, safe_key));
+            pgexporter_string_builder_append_char(sb, '\n');
             safe_prometheus_key_free(safe_key);
 
+            data = pgexporter_string_builder_copy(sb);
             add_column_to_store(store, idx, data, temp->sort_type, tuple);
 
             tuple = tuple->next;
@@ -2951,6 +5195,7 @@ append:
          }
 
          (*n_store)++;
+         pgexporter_column_store_index(index, temp->tag, temp->query_alt->node.columns[i].name, temp->query_alt->node.columns[i].type, -1, idx);
 
          memcpy(store[idx].name, temp->query_alt->node.columns[i].name, MIN(PROMETHEUS_LENGTH - 1, strlen(temp->query_alt->node.columns[i].name)));
          store[idx].name[MIN(PROMETHEUS_LENGTH - 1, strlen(temp->query_alt->node.columns[i].name))] = '\0';
@@ -2971,6 +5216,8 @@ append:
          goto append;
       }
    }
+
+   pgexporter_string_builder_destroy(sb);
 }
 
 static void
@@ -3167,7 +5414,7 @@ safe_prometheus_key(char* key)
       return "";
    }
 
-   escaped = (char*)malloc(strlen(key) + safe_prometheus_key_additional_length(key) + 1);
+   escaped = (char*)scrape_alloc(strlen(key) + safe_prometheus_key_additional_length(key) + 1);
    while (key[i] != '\0')
    {
       if (key[i] == '.')
@@ -3198,20 +5445,41 @@ safe_prometheus_key(char* key)
    return escaped;
 }
 
-static char*
-safe_prometheus_attribute(char* attr, int type_oid)
+/**
+ * Append an attribute escaped like safe_prometheus_key() does,
+ * using a placeholder for empty values
+ */
+static void
+append_safe_attribute(struct string_builder* sb, char* attr, int type_oid)
 {
-   if (attr != NULL && strlen(attr) > 0)
+   size_t length;
+
+   if (attr == NULL || strlen(attr) == 0)
    {
-      return safe_prometheus_key(attr);
+      pgexporter_string_builder_append(sb, type_oid == 3220 ? "0/0" : "n/a");
+      return;
    }
 
-   switch (type_oid)
+   length = strlen(attr);
+
+   for (size_t i = 0; i < length; i++)
    {
-      case 3220: /* pg_lsn */
-         return strdup("0/0");
-      default: /* text, name, varchar, etc. */
-         return strdup("n/a");
+      if (attr[i] == '.')
+      {
+         /* A trailing dot is dropped */
+         if (i < length - 1)
+         {
+            pgexporter_string_builder_append_char(sb, '_');
+         }
+      }
+      else
+      {
+         if (attr[i] == '"' || attr[i] == '\\')
+         {
+            pgexporter_string_builder_append_char(sb, '\\');
+         }
+         pgexporter_string_builder_append_char(sb, attr[i]);
+      }
    }
 }
 
@@ -3220,7 +5488,27 @@ safe_prometheus_key_free(char* key)
 {
    if (key != NULL && strlen(key) > 0)
    {
-      free(key);
+      scrape_free(key);
+   }
+}
+
+static void*
+scrape_alloc(size_t size)
+{
+   if (scrape_arena != NULL)
+   {
+      return pgexporter_memory_arena_alloc(scrape_arena, size);
+   }
+
+   return calloc(1, size);
+}
+
+static void
+scrape_free(void* ptr)
+{
+   if (scrape_arena == NULL)
+   {
+      free(ptr);
    }
 }
 
@@ -3265,6 +5553,25 @@ is_metrics_cache_valid(void)
 
    return pgexporter_cache_is_valid(cache);
 }
+
+/**
+ * Checks if the expired cache may still be served
+ * while another process collects a new response.
+ *
+ * @return true if the cache is within `metrics_cache_max_stale`
+ */
+static bool
+is_metrics_cache_stale(void)
+{
+   struct configuration* config;
+   struct prometheus_cache* cache;
+
+   cache = (struct prometheus_cache*)prometheus_cache_shmem;
+   config = (struct configuration*)shmem;
+
+   return pgexporter_cache_is_stale(cache, config->metrics_cache_max_stale);
+}
+
 int
 pgexporter_init_prometheus_cache(size_t* p_size, void** p_shmem)
 {
@@ -3286,6 +5593,226 @@ pgexporter_init_prometheus_cache(size_t* p_size, void** p_shmem)
    return 0;
 }
 
+int
+pgexporter_init_prometheus_snapshot(size_t* p_size, void** p_shmem)
+{
+   struct prometheus_snapshot* snapshot = NULL;
+   struct configuration* config;
+   size_t struct_size = 0;
+
+   config = (struct configuration*)shmem;
+   struct_size = sizeof(struct prometheus_snapshot);
+
+   if (pgexporter_create_shared_memory(struct_size + PROMETHEUS_SNAPSHOT_SIZE, config->hugepage, (void*)&snapshot))
+   {
+      pgexporter_log_error("Cannot allocate shared memory for the Prometheus snapshot!");
+      goto error;
+   }
+
+   memset(snapshot, 0, struct_size);
+   snapshot->collected = 0;
+   snapshot->size = PROMETHEUS_SNAPSHOT_SIZE;
+   snapshot->length = 0;
+   atomic_init(&snapshot->lock, STATE_FREE);
+
+   *p_shmem = snapshot;
+   *p_size = struct_size + PROMETHEUS_SNAPSHOT_SIZE;
+
+   return 0;
+
+error:
+
+   *p_size = 0;
+   *p_shmem = NULL;
+
+   return 1;
+}
+
+void
+pgexporter_prometheus_warn_intervals(void)
+{
+   int ignored = 0;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (pgexporter_time_is_valid(config->metrics_collector_interval))
+   {
+      return;
+   }
+
+   for (int i = 0; i < config->number_of_metrics; i++)
+   {
+      if (pgexporter_time_is_valid(config->prometheus[i].interval))
+      {
+         pgexporter_log_warn("Metric %s: interval is ignored without metrics_collector_interval", config->prometheus[i].tag);
+         ignored++;
+      }
+   }
+
+   for (int i = 0; i < config->number_of_extensions; i++)
+   {
+      for (int j = 0; j < config->extensions[i].number_of_metrics; j++)
+      {
+         if (pgexporter_time_is_valid(config->extensions[i].metrics[j].interval))
+         {
+            pgexporter_log_warn("Metric %s: interval is ignored without metrics_collector_interval",
+                                config->extensions[i].metrics[j].tag);
+            ignored++;
+         }
+      }
+   }
+
+   if (ignored > 0)
+   {
+      pgexporter_log_warn("%d metric interval(s) ignored, every scrape runs their queries", ignored);
+   }
+}
+
+void
+pgexporter_prometheus_collector(void)
+{
+   char* data = NULL;
+   int64_t interval;
+   struct timespec start;
+   struct timespec end;
+   int64_t elapsed;
+   struct sigaction sa;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = collector_shutdown_cb;
+   sigemptyset(&sa.sa_mask);
+   sigaction(SIGTERM, &sa, NULL);
+   sigaction(SIGINT, &sa, NULL);
+
+   pgexporter_start_logging();
+   pgexporter_memory_init();
+
+   pgexporter_log_debug("Metrics collector started (pid %d)", getpid());
+
+   while (collector_running)
+   {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+
+      if (collect_metrics(configured_scrape_timeout(), &data))
+      {
+         pgexporter_log_error("Metrics collector failed to collect metrics");
+      }
+      else if (!metrics_snapshot_publish(data))
+      {
+         pgexporter_log_error("Metrics snapshot too large (%zu bytes)", data != NULL ? strlen(data) : (size_t)0);
+      }
+
+      free(data);
+      data = NULL;
+
+      clock_gettime(CLOCK_MONOTONIC, &end);
+
+      elapsed = (int64_t)(end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+      interval = pgexporter_time_convert(config->metrics_collector_interval, FORMAT_TIME_MS);
+
+      pgexporter_log_debug("Metrics collected in %" PRId64 "ms", elapsed);
+
+      /* Sleep in small steps so a shutdown request is handled promptly */
+      while (collector_running && elapsed < interval)
+      {
+         SLEEP(100000000L);
+         elapsed += 100;
+
+         pgexporter_close_idle_connections();
+      }
+   }
+
+   pgexporter_log_debug("Metrics collector stopped (pid %d)", getpid());
+
+   pgexporter_close_connections();
+   destroy_metric_caches();
+   destroy_query_plans();
+
+   pgexporter_memory_destroy();
+   pgexporter_stop_logging();
+
+   OPENSSL_cleanup();
+
+   exit(0);
+}
+
+/**
+ * Publishes a complete exposition as the current snapshot.
+ *
+ * The snapshot is replaced as a whole while holding the lock,
+ * so readers never see a partial exposition.
+ *
+ * @param data the exposition to publish
+ * @return true on success, false if the exposition does not fit
+ */
+static bool
+metrics_snapshot_publish(char* data)
+{
+   size_t length;
+   size_t offset;
+   unsigned char* encoded[NUMBER_OF_CONTENT_ENCODINGS] = {0};
+   size_t encoded_length[NUMBER_OF_CONTENT_ENCODINGS] = {0};
+   signed char snapshot_is_free;
+   struct prometheus_snapshot* snapshot;
+
+   snapshot = (struct prometheus_snapshot*)prometheus_snapshot_shmem;
+   length = data != NULL ? strlen(data) : 0;
+
+   if (length > snapshot->size)
+   {
+      return false;
+   }
+
+   /* Compressed outside of the lock, so scrapes are not held up */
+   if (length > 0)
+   {
+      metrics_encode_requested(data, encoded, encoded_length);
+   }
+
+retry_snapshot_locking:
+   snapshot_is_free = STATE_FREE;
+   if (!atomic_compare_exchange_strong(&snapshot->lock, &snapshot_is_free, STATE_IN_USE))
+   {
+      SLEEP_AND_GOTO(1000000L, retry_snapshot_locking);
+   }
+
+   if (length > 0)
+   {
+      memcpy(snapshot->data, data, length);
+   }
+   snapshot->length = length;
+   snapshot->collected = time(NULL);
+
+   offset = length;
+   for (int i = 0; i < NUMBER_OF_CONTENT_ENCODINGS; i++)
+   {
+      snapshot->encoded_length[i] = 0;
+
+      if (encoded[i] != NULL && offset + encoded_length[i] <= snapshot->size)
+      {
+         memcpy(snapshot->data + offset, encoded[i], encoded_length[i]);
+         snapshot->encoded_length[i] = encoded_length[i];
+         offset += encoded_length[i];
+      }
+   }
+
+   atomic_store(&snapshot->lock, STATE_FREE);
+
+   metrics_encoded_free(encoded);
+
+   return true;
+}
+
+static void
+collector_shutdown_cb(int signum __attribute__((unused)))
+{
+   collector_running = 0;
+}
+
 /**
  * Provides the size of the cache to allocate.
  *
@@ -3336,52 +5863,59 @@ metrics_cache_invalidate(void)
 }
 
 /**
- * Appends data to the cache.
+ * Copies the published response body out of the cache.
  *
- * Requires the caller to hold the lock on the cache!
- *
- * If the input data is empty, nothing happens.
- * The data is appended only if the cache does not overflows, that
- * means the current size of the cache plus the size of the data
- * to append does not exceed the current cache size.
- * If the cache overflows, the cache is flushed and marked
- * as invalid.
- * This makes safe to call this method along the workflow of
- * building the Prometheus response.
+ * The compressed copy is returned when there is one for the
+ * requested encoding, otherwise the plain body is.
  *
- * @param data the string to append to the cache
- * @return true on success
+ * @param encoding the requested content encoding
+ * @param body [out] the copy of the body
+ * @param length [out] the length of the body
+ * @param created [out] when the body was published
+ * @param valid_until [out] when the body will become not valid
+ * @param body_encoding [out] the content encoding of the copy
+ * @return 0 if a body was copied, otherwise 1
  */
-static bool
-metrics_cache_append(char* data)
+static int
+metrics_cache_get(int encoding, char** body, size_t* length, time_t* created, time_t* valid_until, int* body_encoding)
 {
    struct prometheus_cache* cache;
 
    cache = (struct prometheus_cache*)prometheus_cache_shmem;
 
-   if (!is_metrics_cache_configured())
+   *body_encoding = encoding;
+
+   if (encoding != CONTENT_ENCODING_IDENTITY &&
+       !pgexporter_cache_get_encoded(cache, encoding, body, length, created, valid_until))
    {
-      return false;
+      return 0;
    }
 
-   return pgexporter_cache_append(cache, data);
+   *body_encoding = CONTENT_ENCODING_IDENTITY;
+
+   return pgexporter_cache_get(cache, body, length, created, valid_until);
 }
 
 /**
- * Finalizes the cache.
+ * Publishes a complete response body as the cache payload.
  *
- * Requires the caller to hold the lock on the cache!
- *
- * This method should be invoked when the cache is complete
- * and therefore can be served.
+ * The body is built outside of the cache, so the lock is only
+ * held while it is copied in and readers never wait for a
+ * collection.
+ * If the body does not fit, the cache is left invalid.
  *
+ * @param data the response body
+ * @param encoded the compressed copies of the body, indexed by encoding
+ * @param encoded_length the lengths of the compressed copies
  * @return true if the cache has a validity
  */
 static bool
-metrics_cache_finalize(void)
+metrics_cache_publish(char* data, unsigned char** encoded, size_t* encoded_length)
 {
+   bool published = false;
    struct configuration* config;
    struct prometheus_cache* cache;
+   signed char cache_is_free;
 
    cache = (struct prometheus_cache*)prometheus_cache_shmem;
    config = (struct configuration*)shmem;
@@ -3391,12 +5925,114 @@ metrics_cache_finalize(void)
       return false;
    }
 
-   return pgexporter_cache_finalize(cache, config->metrics_cache_max_age);
+retry_cache_locking:
+   cache_is_free = STATE_FREE;
+   if (atomic_compare_exchange_strong(&cache->lock, &cache_is_free, STATE_IN_USE))
+   {
+      /* The new payload is built in the back buffer, so readers keep the old one */
+      if (pgexporter_cache_append(cache, data))
+      {
+         for (int i = CONTENT_ENCODING_IDENTITY + 1; i < NUMBER_OF_CONTENT_ENCODINGS; i++)
+         {
+            if (encoded[i] != NULL)
+            {
+               pgexporter_cache_append_encoded(cache, i, encoded[i], encoded_length[i]);
+            }
+         }
+
+         published = pgexporter_cache_finalize(cache, config->metrics_cache_max_age);
+      }
+
+      atomic_store(&cache->lock, STATE_FREE);
+   }
+   else
+   {
+      /* Sleep for 1ms */
+      SLEEP_AND_GOTO(1000000L, retry_cache_locking);
+   }
+
+   return published;
+}
+
+/**
+ * Compresses a response body.
+ *
+ * @param data the response body
+ * @param encoding the content encoding
+ * @param buffer [out] the compressed body
+ * @param buffer_size [out] the length of the compressed body
+ * @return 0 on success, otherwise 1
+ */
+static int
+metrics_encode(char* data, int encoding, unsigned char** buffer, size_t* buffer_size)
+{
+   *buffer = NULL;
+   *buffer_size = 0;
+
+   switch (encoding)
+   {
+      case CONTENT_ENCODING_GZIP:
+         return pgexporter_gzip_string_level(data, METRICS_GZIP_LEVEL, buffer, buffer_size);
+      case CONTENT_ENCODING_ZSTD:
+         return pgexporter_zstdc_string(data, buffer, buffer_size);
+      default:
+         break;
+   }
+
+   return 1;
 }
+
+/**
+ * Compresses a response body in every encoding that a scrape
+ * has asked for.
+ *
+ * An encoding that fails is left NULL, and is then served
+ * uncompressed.
+ *
+ * @param data the response body
+ * @param encoded [out] the compressed bodies, indexed by encoding
+ * @param encoded_length [out] the lengths of the compressed bodies
+ */
 static void
-prometheus_endpoints_information(SSL* client_ssl, int client_fd)
+metrics_encode_requested(char* data, unsigned char** encoded, size_t* encoded_length)
+{
+   unsigned int encodings;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   encodings = atomic_load(&config->metrics_encodings);
+
+   for (int i = CONTENT_ENCODING_IDENTITY + 1; i < NUMBER_OF_CONTENT_ENCODINGS; i++)
+   {
+      if (!(encodings & (1U << i)))
+      {
+         continue;
+      }
+
+      if (metrics_encode(data, i, &encoded[i], &encoded_length[i]))
+      {
+         pgexporter_log_debug("Failed to compress the metrics (encoding %d)", i);
+         free(encoded[i]);
+         encoded[i] = NULL;
+         encoded_length[i] = 0;
+      }
+   }
+}
+
+static void
+metrics_encoded_free(unsigned char** encoded)
+{
+   for (int i = 0; i < NUMBER_OF_CONTENT_ENCODINGS; i++)
+   {
+      free(encoded[i]);
+      encoded[i] = NULL;
+   }
+}
+
+static void
+prometheus_endpoints_information(struct string_builder* sb)
 {
-   char* data = NULL;
    struct http* connection = NULL;
    struct http_request* request = NULL;
    struct http_response* response = NULL;
@@ -3456,22 +6092,17 @@ prometheus_endpoints_information(SSL* client_ssl, int client_fd)
          {
             if (!first_line && strncmp(line, "#HELP", 5) == 0)
             {
-               data = pgexporter_append(data, "\n");
+               pgexporter_string_builder_append_char(sb, '\n');
             }
 
-            data = pgexporter_append(data, line);
-            data = pgexporter_append(data, "\n");
+            pgexporter_string_builder_append(sb, line);
+            pgexporter_string_builder_append_char(sb, '\n');
 
             first_line = false;
             line = strtok_r(NULL, "\n", &saveptr);
          }
 
          free(body_copy);
-
-         send_chunk(client_ssl, client_fd, data);
-         metrics_cache_append(data);
-         free(data);
-         data = NULL;
       }
 
 next:
@@ -3661,9 +6292,8 @@ error:
  * Output all metrics from an ART in sorted order
  */
 static void
-output_art_metrics(SSL* client_ssl, int client_fd, struct art* art_tree)
+output_art_metrics(struct art* art_tree, struct string_builder* sb)
 {
-   char* data = NULL;
    struct art_iterator* iter = NULL;
 
    if (art_tree == NULL)
@@ -3682,18 +6312,11 @@ output_art_metrics(SSL* client_ssl, int client_fd, struct art* art_tree)
 
       if (m != NULL && m->value != NULL)
       {
-         data = pgexporter_append(data, m->value);
-         data = pgexporter_append(data, "\n");
+         pgexporter_string_builder_append(sb, m->value);
+         pgexporter_string_builder_append_char(sb, '\n');
       }
    }
 
-   if (data != NULL)
-   {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-   }
-
    pgexporter_art_iterator_destroy(iter);
 }
 
@@ -3701,23 +6324,23 @@ output_art_metrics(SSL* client_ssl, int client_fd, struct art* art_tree)
  * Output all metrics from all categories in the container
  */
 static void
-output_all_metrics(SSL* client_ssl, int client_fd, prometheus_metrics_container_t* container)
+output_all_metrics(prometheus_metrics_container_t* container, struct string_builder* sb)
 {
    if (container == NULL)
    {
       return;
    }
 
-   output_art_metrics(client_ssl, client_fd, container->general_metrics);
-   output_art_metrics(client_ssl, client_fd, container->server_metrics);
-   output_art_metrics(client_ssl, client_fd, container->version_metrics);
-   output_art_metrics(client_ssl, client_fd, container->uptime_metrics);
-   output_art_metrics(client_ssl, client_fd, container->primary_metrics);
-   output_art_metrics(client_ssl, client_fd, container->fips_metrics);
-   output_art_metrics(client_ssl, client_fd, container->core_metrics);
-   output_art_metrics(client_ssl, client_fd, container->extension_metrics);
-   output_art_metrics(client_ssl, client_fd, container->extension_list_metrics);
-   output_art_metrics(client_ssl, client_fd, container->settings_metrics);
-   output_art_metrics(client_ssl, client_fd, container->custom_metrics);
-   output_art_metrics(client_ssl, client_fd, container->alert_metrics);
+   output_art_metrics(container->general_metrics, sb);
+   output_art_metrics(container->server_metrics, sb);
+   output_art_metrics(container->version_metrics, sb);
+   output_art_metrics(container->uptime_metrics, sb);
+   output_art_metrics(container->primary_metrics, sb);
+   output_art_metrics(container->fips_metrics, sb);
+   output_art_metrics(container->core_metrics, sb);
+   output_art_metrics(container->extension_metrics, sb);
+   output_art_metrics(container->extension_list_metrics, sb);
+   output_art_metrics(container->settings_metrics, sb);
+   output_art_metrics(container->custom_metrics, sb);
+   output_art_metrics(container->alert_metrics, sb);
 }
@@ -29,6 +29,7 @@
 /* pgexporter */
 #include <pgexporter.h>
 #include <connection.h>
+#include <decoder.h>
 #include <deque.h>
 #include <extension.h>
 #include <logging.h>
@@ -36,34 +37,60 @@
 #include <network.h>
 #include <queries.h>
 #include <security.h>
-#include <server.h>
 #include <string.h>
 #include <utils.h>
 
 /* system */
 #include <stdlib.h>
+#include <time.h>
 
-#define SQLSTATE_QUERY_CANCELED "57014"
+/* Bound the query bytes in flight so the server can always buffer them */
+#define MAX_PIPELINE_SIZE 32768
+
+/** @struct pooled_connection
+ * An open connection to a database that is not in use.
+ * A free slot has an empty database name
+ */
+struct pooled_connection
+{
+   char database[DB_NAME_LENGTH]; /**< The database */
+   SSL* ssl;                      /**< The SSL structure */
+   int fd;                        /**< The socket descriptor */
+   int backend_pid;               /**< The process id of the backend */
+   int backend_key;               /**< The cancel key of the backend */
+   time_t last_used;              /**< The time the connection was last used */
+};
+
+/* The connections are only valid in the process that opened them */
+static struct pooled_connection pooled_connections[NUMBER_OF_SERVERS][NUMBER_OF_DATABASES];
 
 static int query_execute(int server, char* qs, char* tag, int columns, char* names[], struct query** query);
-static bool is_query_timeout_error(struct message* error_msg);
+static int query_pipeline(int server, struct query_request* requests, int n, struct memory_arena* arena);
 static void* data_append(void* orig, size_t orig_size, void* n, size_t n_size);
-static int create_D_tuple(int server, int number_of_columns, struct message* msg, struct tuple** tuple);
-static int get_number_of_columns(struct message* msg);
-static int get_column_name(struct message* msg, int index, char** name);
-static int get_column_type_oid(struct message* msg, int index);
 static int process_server_parameters(int server, struct deque* server_parameters);
-static int pgexporter_detect_databases(int server);
-static int pgexporter_detect_extensions(int server);
+static void monitor_role_request(struct query_request* request);
+static void database_list_request(struct query_request* request);
+static void extensions_list_request(struct query_request* request);
+static int check_pg_monitor_role(int server, struct query* query);
+static int pgexporter_detect_databases(int server, struct query* query);
+static int pgexporter_detect_extensions(int server, struct query* query);
 static int pgexporter_connect_db(int server, char* database);
-static void pgexporter_apply_metrics_timeout(int server);
+static int server_user(int server);
+static char* metrics_timeout_query(void);
+static bool reuse_connection(int server, char* database);
+static void close_connection(int server);
+static bool park_connection(int server);
+static bool unpark_connection(int server, char* database);
+static void close_pooled_connection(struct pooled_connection* pc);
+static int query_tag_index(char* tag);
 
 int
 pgexporter_check_pg_monitor_role(int server)
 {
-   struct query* q = NULL;
+   int ret;
+   struct query* query = NULL;
+   struct query_request request;
    struct configuration* config;
-   int ret = 1;
 
    config = (struct configuration*)shmem;
 
@@ -74,165 +101,281 @@ pgexporter_check_pg_monitor_role(int server)
       return 1;
    }
 
-   if (pgexporter_query_execute(server,
-                                "SELECT pg_has_role(current_user, 'pg_monitor', 'USAGE') AS has_pg_monitor;",
-                                "pg_monitor_check", &q) == 0 &&
-       q != NULL)
+   monitor_role_request(&request);
+
+   ret = query_execute(server, request.qs, request.tag, request.columns, NULL, &query);
+
+   ret = check_pg_monitor_role(server, ret == 0 ? query : NULL);
+
+   pgexporter_free_query(query);
+
+   return ret;
+}
+
+void
+pgexporter_open_connections(void)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   for (int server = 0; server < config->number_of_servers; server++)
+   {
+      pgexporter_open_connection(server);
+   }
+}
+
+int
+pgexporter_open_connection(int server)
+{
+   int status;
+   struct server_connect* connect = NULL;
+   struct query_request requests[OPEN_CONNECTION_REQUESTS];
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (config->servers[server].type == SERVER_TYPE_PROMETHEUS)
+   {
+      return 0;
+   }
+
+   if (config->servers[server].fd != -1)
    {
-      if (q->tuples != NULL && q->tuples->data != NULL && q->tuples->data[0] != NULL)
+      if (!pgexporter_connection_isvalid(config->servers[server].ssl, config->servers[server].fd))
       {
-         if (strcmp(q->tuples->data[0], "t") == 0)
-         {
-            ret = 0;
-            pgexporter_log_debug("User has pg_monitor role on server '%s'", &config->servers[server].name[0]);
-         }
-         else
+         pgexporter_disconnect(config->servers[server].fd);
+         if (config->servers[server].ssl != NULL)
          {
-            pgexporter_log_error("User '%s' lacks pg_monitor role on server '%s'. "
-                                 "Grant pg_monitor role: GRANT pg_monitor TO %s;",
-                                 &config->servers[server].username[0],
-                                 &config->servers[server].name[0],
-                                 &config->servers[server].username[0]);
-            ret = 1;
+            pgexporter_close_ssl(config->servers[server].ssl);
+            config->servers[server].ssl = NULL;
          }
+         config->servers[server].fd = -1;
+         config->servers[server].database[0] = '\0';
       }
       else
       {
-         pgexporter_log_error("Failed to check pg_monitor role on server '%s': empty result",
-                              &config->servers[server].name[0]);
-         ret = 1;
+         config->servers[server].last_used = time(NULL);
+         return 0;
       }
+   }
+
+   config->servers[server].new = false;
 
-      pgexporter_free_query(q);
+   /* The same steps as the query engine takes, waiting for each of them */
+   if (pgexporter_switch_db_start(server, "postgres", &connect))
+   {
+      goto error;
    }
-   else
+
+   if (connect != NULL)
    {
-      pgexporter_log_error("Failed to execute pg_monitor role check query on server '%s'",
+      status = pgexporter_server_connect_run(connect);
+      if (status != AUTH_SUCCESS)
+      {
+         pgexporter_server_connect_destroy(connect);
+         goto error;
+      }
+
+      pgexporter_switch_db_complete(server, connect);
+   }
+
+   pgexporter_open_connection_requests(&requests[0]);
+   query_pipeline(server, &requests[0], OPEN_CONNECTION_REQUESTS, NULL);
+
+   return pgexporter_open_connection_finish(server, &requests[0]);
+
+error:
+
+   pgexporter_log_error("Failed login for '%s' on server '%s'", &config->servers[server].username[0], &config->servers[server].name[0]);
+
+   return 1;
+}
+
+void
+pgexporter_open_connection_requests(struct query_request* requests)
+{
+   pgexporter_query_primary_request(&requests[0]);
+   monitor_role_request(&requests[1]);
+   database_list_request(&requests[2]);
+   extensions_list_request(&requests[3]);
+}
+
+int
+pgexporter_open_connection_finish(int server, struct query_request* requests)
+{
+   int ret = 0;
+   struct query* primary = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   config->servers[server].new = true;
+
+   primary = requests[0].error == 0 ? requests[0].query : NULL;
+   if (primary != NULL && primary->tuples != NULL && pgexporter_get_column(0, primary->tuples) != NULL)
+   {
+      if (!strcmp(pgexporter_get_column(0, primary->tuples), "t"))
+      {
+         config->servers[server].state = SERVER_PRIMARY;
+      }
+      else
+      {
+         config->servers[server].state = SERVER_REPLICA;
+      }
+   }
+
+   if (check_pg_monitor_role(server, requests[1].error == 0 ? requests[1].query : NULL) != 0)
+   {
+      pgexporter_log_error("Server '%s': pg_monitor role check failed, skipping the server",
                            &config->servers[server].name[0]);
+      if (config->servers[server].fd != -1)
+      {
+         close_connection(server);
+      }
+      config->servers[server].new = false;
       ret = 1;
    }
+   else
+   {
+      pgexporter_detect_databases(server, requests[2].error == 0 ? requests[2].query : NULL);
+      pgexporter_detect_extensions(server, requests[3].error == 0 ? requests[3].query : NULL);
+   }
+
+   for (int i = 0; i < OPEN_CONNECTION_REQUESTS; i++)
+   {
+      pgexporter_free_query(requests[i].query);
+      requests[i].query = NULL;
+   }
 
    return ret;
 }
 
 void
-pgexporter_open_connections(void)
+pgexporter_close_connections(void)
 {
-   int ret;
-   int user;
    struct configuration* config;
-   struct deque* server_parameters;
 
    config = (struct configuration*)shmem;
 
    for (int server = 0; server < config->number_of_servers; server++)
    {
-      if (config->servers[server].type == SERVER_TYPE_PROMETHEUS)
+      if (config->servers[server].fd != -1)
       {
-         continue;
+         close_connection(server);
       }
 
-      if (config->servers[server].fd != -1)
+      for (int i = 0; i < NUMBER_OF_DATABASES; i++)
       {
-         if (!pgexporter_connection_isvalid(config->servers[server].ssl, config->servers[server].fd))
+         if (pooled_connections[server][i].database[0] != '\0')
          {
-            pgexporter_disconnect(config->servers[server].fd);
-            if (config->servers[server].ssl != NULL)
-            {
-               pgexporter_close_ssl(config->servers[server].ssl);
-               config->servers[server].ssl = NULL;
-            }
-            config->servers[server].fd = -1;
+            close_pooled_connection(&pooled_connections[server][i]);
          }
       }
+   }
+}
 
-      if (config->servers[server].fd == -1)
-      {
-         user = -1;
-         for (int usr = 0; user == -1 && usr < config->number_of_users; usr++)
-         {
-            if (!strcmp(&config->users[usr].username[0], &config->servers[server].username[0]))
-            {
-               user = usr;
-            }
-         }
-         if (user == -1)
-         {
-            pgexporter_log_error("No user '%s' configured for server '%s'",
-                                 &config->servers[server].username[0],
-                                 &config->servers[server].name[0]);
-            continue;
-         }
+void
+pgexporter_close_connection(int server)
+{
+   struct configuration* config;
 
-         config->servers[server].new = false;
+   config = (struct configuration*)shmem;
 
-         ret = pgexporter_server_authenticate(server, "postgres",
-                                              &config->users[user].username[0], &config->users[user].password[0],
-                                              &config->servers[server].ssl,
-                                              &config->servers[server].fd);
-         if (ret == AUTH_SUCCESS)
-         {
-            config->servers[server].new = true;
-            pgexporter_server_info(server);
-            if (!pgexporter_extract_server_parameters(&server_parameters))
-            {
-               process_server_parameters(server, server_parameters);
-               pgexporter_deque_destroy(server_parameters);
-            }
+   if (config->servers[server].fd != -1)
+   {
+      close_connection(server);
+   }
+}
 
-            if (pgexporter_check_pg_monitor_role(server) != 0)
-            {
-               pgexporter_log_fatal("Server '%s': pg_monitor role check failed. pgexporter cannot function without proper permissions.",
-                                    &config->servers[server].name[0]);
-               if (config->servers[server].ssl != NULL)
-               {
-                  pgexporter_close_ssl(config->servers[server].ssl);
-                  config->servers[server].ssl = NULL;
-               }
-               pgexporter_disconnect(config->servers[server].fd);
-               config->servers[server].fd = -1;
-               config->servers[server].new = false;
-               config->servers[server].state = SERVER_UNKNOWN;
-               pgexporter_close_connections();
-               exit(1);
-            }
+int
+pgexporter_cancel_query(int server)
+{
+   int ret;
+   int fd = -1;
+   char pgsql[MISC_LENGTH];
+   struct configuration* config;
 
-            pgexporter_detect_databases(server);
-            pgexporter_detect_extensions(server);
+   config = (struct configuration*)shmem;
 
-            pgexporter_apply_metrics_timeout(server);
-         }
-         else
-         {
-            pgexporter_log_error("Failed login for '%s' on server '%s'", &config->users[user].username, &config->servers[server].name);
-         }
-      }
+   if (config->servers[server].fd == -1 || config->servers[server].backend_pid == 0)
+   {
+      goto error;
+   }
+
+   /* The request goes on a connection of its own, the server closes it right away */
+   if (config->servers[server].host[0] == '/')
+   {
+      memset(&pgsql, 0, sizeof(pgsql));
+      pgexporter_snprintf(&pgsql[0], sizeof(pgsql), ".s.PGSQL.%d", config->servers[server].port);
+      ret = pgexporter_connect_unix_socket(config->servers[server].host, &pgsql[0], &fd);
+   }
+   else
+   {
+      ret = pgexporter_connect(config->servers[server].host, config->servers[server].port, &fd);
+   }
+
+   if (ret != 0)
+   {
+      goto error;
+   }
+
+   if (pgexporter_write_cancel_request(fd, config->servers[server].backend_pid, config->servers[server].backend_key) != MESSAGE_STATUS_OK)
+   {
+      goto error;
+   }
+
+   pgexporter_disconnect(fd);
+
+   pgexporter_log_debug("Canceled the query of server '%s' (backend %d)", &config->servers[server].name[0], config->servers[server].backend_pid);
+
+   return 0;
+
+error:
+
+   if (fd != -1)
+   {
+      pgexporter_disconnect(fd);
    }
+
+   return 1;
 }
 
 void
-pgexporter_close_connections(void)
+pgexporter_close_idle_connections(void)
 {
+   time_t now;
+   int64_t idle;
    struct configuration* config;
 
    config = (struct configuration*)shmem;
 
+   if (!pgexporter_time_is_valid(config->metrics_pool_idle_timeout))
+   {
+      return;
+   }
+
+   now = time(NULL);
+   idle = pgexporter_time_convert(config->metrics_pool_idle_timeout, FORMAT_TIME_S);
+
    for (int server = 0; server < config->number_of_servers; server++)
    {
-      if (config->servers[server].fd != -1)
+      if (config->servers[server].fd != -1 && now - config->servers[server].last_used >= idle)
       {
-         pgexporter_write_terminate(config->servers[server].ssl, config->servers[server].fd);
+         pgexporter_log_debug("Closing idle connection to server '%s'", &config->servers[server].name[0]);
+         close_connection(server);
+      }
 
-         if (config->servers[server].ssl != NULL)
+      for (int i = 0; i < NUMBER_OF_DATABASES; i++)
+      {
+         struct pooled_connection* pc = &pooled_connections[server][i];
+
+         if (pc->database[0] != '\0' && now - pc->last_used >= idle)
          {
-            pgexporter_close_ssl(config->servers[server].ssl);
-            config->servers[server].ssl = NULL;
+            pgexporter_log_debug("Closing idle connection to server '%s', database '%s'",
+                                 &config->servers[server].name[0], &pc->database[0]);
+            close_pooled_connection(pc);
          }
-
-         pgexporter_disconnect(config->servers[server].fd);
-         config->servers[server].fd = -1;
-         config->servers[server].new = false;
-         config->servers[server].state = SERVER_UNKNOWN;
       }
    }
 }
@@ -332,24 +475,62 @@ error:
 int
 pgexporter_query_version(int server, struct query** query)
 {
-   return query_execute(server, "SELECT split_part(split_part(version(), ' ', 2), '.', 1) AS major, "
-                                "split_part(split_part(version(), ' ', 2), '.', 2) AS minor;",
-                        "pg_version",
-                        2, NULL, query);
+   struct query_request request;
+
+   pgexporter_query_version_request(&request);
+
+   return query_execute(server, request.qs, request.tag, request.columns, NULL, query);
+}
+
+void
+pgexporter_query_version_request(struct query_request* request)
+{
+   memset(request, 0, sizeof(struct query_request));
+
+   request->qs = "SELECT split_part(split_part(version(), ' ', 2), '.', 1) AS major, "
+                 "split_part(split_part(version(), ' ', 2), '.', 2) AS minor;";
+   request->tag = "pg_version";
+   request->columns = 2;
 }
 
 int
 pgexporter_query_uptime(int server, struct query** query)
 {
-   return query_execute(server, "SELECT FLOOR(EXTRACT(EPOCH FROM now() - pg_postmaster_start_time)) FROM pg_postmaster_start_time();",
-                        "pg_uptime", 1, NULL, query);
+   struct query_request request;
+
+   pgexporter_query_uptime_request(&request);
+
+   return query_execute(server, request.qs, request.tag, request.columns, NULL, query);
+}
+
+void
+pgexporter_query_uptime_request(struct query_request* request)
+{
+   memset(request, 0, sizeof(struct query_request));
+
+   request->qs = "SELECT FLOOR(EXTRACT(EPOCH FROM now() - pg_postmaster_start_time)) FROM pg_postmaster_start_time();";
+   request->tag = "pg_uptime";
+   request->columns = 1;
 }
 
 int
 pgexporter_query_primary(int server, struct query** query)
 {
-   return query_execute(server, "SELECT (CASE pg_is_in_recovery() WHEN 'f' THEN 't' ELSE 'f' END);",
-                        "pg_primary", 1, NULL, query);
+   struct query_request request;
+
+   pgexporter_query_primary_request(&request);
+
+   return query_execute(server, request.qs, request.tag, request.columns, NULL, query);
+}
+
+void
+pgexporter_query_primary_request(struct query_request* request)
+{
+   memset(request, 0, sizeof(struct query_request));
+
+   request->qs = "SELECT (CASE pg_is_in_recovery() WHEN 'f' THEN 't' ELSE 'f' END);";
+   request->tag = "pg_primary";
+   request->columns = 1;
 }
 
 int
@@ -362,22 +543,21 @@ pgexporter_query_database_size(int server, struct query** query)
 int
 pgexporter_query_database_list(int server, struct query** query)
 {
-   return query_execute(server, "SELECT datname "
-                                "FROM pg_database "
-                                "WHERE datistemplate = false AND datname != 'postgres';",
-                        "pg_db_list",
-                        1, NULL, query);
+   struct query_request request;
+
+   database_list_request(&request);
+
+   return query_execute(server, request.qs, request.tag, request.columns, NULL, query);
 }
 
 int
 pgexporter_query_extensions_list(int server, struct query** query)
 {
-   return query_execute(server, "SELECT name, installed_version, comment "
-                                "FROM pg_available_extensions "
-                                "WHERE installed_version IS NOT NULL "
-                                "ORDER BY name;",
-                        "pg_extensions_list",
-                        3, NULL, query);
+   struct query_request request;
+
+   extensions_list_request(&request);
+
+   return query_execute(server, request.qs, request.tag, request.columns, NULL, query);
 }
 
 int
@@ -491,8 +671,21 @@ pgexporter_query_stat_database_conflicts(int server, struct query** query)
 int
 pgexporter_query_settings(int server, struct query** query)
 {
-   return query_execute(server, "SELECT name,setting,short_desc FROM pg_settings;",
-                        "pg_settings", 3, NULL, query);
+   struct query_request request;
+
+   pgexporter_query_settings_request(&request);
+
+   return query_execute(server, request.qs, request.tag, request.columns, NULL, query);
+}
+
+void
+pgexporter_query_settings_request(struct query_request* request)
+{
+   memset(request, 0, sizeof(struct query_request));
+
+   request->qs = "SELECT name,setting,short_desc FROM pg_settings;";
+   request->tag = "pg_settings";
+   request->columns = 3;
 }
 
 int
@@ -501,6 +694,64 @@ pgexporter_custom_query(int server, char* qs, char* tag, int columns, char** nam
    return query_execute(server, qs, tag, columns, names, query);
 }
 
+int
+pgexporter_custom_query_pipeline(int server, struct query_request* requests, int n, struct memory_arena* arena)
+{
+   int first = 0;
+   int last;
+   size_t size;
+
+   while (first < n)
+   {
+      size = 0;
+      last = first;
+
+      while (last < n && (last == first || size + 1 + 4 + strlen(requests[last].qs) + 1 <= MAX_PIPELINE_SIZE))
+      {
+         size += 1 + 4 + strlen(requests[last].qs) + 1;
+         last++;
+      }
+
+      if (query_pipeline(server, &requests[first], last - first, arena))
+      {
+         for (int i = last; i < n; i++)
+         {
+            requests[i].query = NULL;
+            requests[i].error = 1;
+         }
+
+         return 1;
+      }
+
+      first = last;
+   }
+
+   return 0;
+}
+
+void
+pgexporter_query_latencies(int server, struct query_request* requests, int n)
+{
+   int tag;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   for (int i = 0; i < n; i++)
+   {
+      if (requests[i].duration < 0 || requests[i].tag == NULL)
+      {
+         continue;
+      }
+
+      tag = query_tag_index(requests[i].tag);
+      if (tag != -1)
+      {
+         pgexporter_latency_observe(&config->query_latencies[server][tag], requests[i].duration);
+      }
+   }
+}
+
 struct query*
 pgexporter_merge_queries(struct query* q1, struct query* q2, int sort)
 {
@@ -541,14 +792,14 @@ pgexporter_merge_queries(struct query* q1, struct query* q2, int sort)
          {
             tmp1 = ct1;
 
-            if (strcmp(tmp1->data[0], ct2->data[0]))
+            if (strcmp(pgexporter_get_column(0, tmp1), pgexporter_get_column(0, ct2)))
             {
-               while (tmp1 != NULL && tmp1->next != NULL && strcmp(tmp1->next->data[0], ct2->data[0]))
+               while (tmp1 != NULL && tmp1->next != NULL && strcmp(pgexporter_get_column(0, tmp1->next), pgexporter_get_column(0, ct2)))
                {
                   tmp1 = tmp1->next;
                }
             }
-            while (tmp1 != NULL && tmp1->next != NULL && !strcmp(tmp1->next->data[0], ct2->data[0]))
+            while (tmp1 != NULL && tmp1->next != NULL && !strcmp(pgexporter_get_column(0, tmp1->next), pgexporter_get_column(0, ct2)))
             {
                tmp1 = tmp1->next;
             }
@@ -572,11 +823,25 @@ pgexporter_merge_queries(struct query* q1, struct query* q2, int sort)
       }
    }
 
-   q2->tuples = NULL;
-   pgexporter_free_query(q2);
-
-   return q1;
-}
+   /* The tuples of q2 now live in q1, so q1 takes over their memory */
+   if (q2->arena != NULL)
+   {
+      if (q1->arena == NULL)
+      {
+         q1->arena = q2->arena;
+      }
+      else
+      {
+         pgexporter_memory_arena_absorb(q1->arena, q2->arena);
+      }
+      q2->arena = NULL;
+   }
+
+   q2->tuples = NULL;
+   pgexporter_free_query(q2);
+
+   return q1;
+}
 
 int
 pgexporter_free_query(struct query* query)
@@ -584,6 +849,7 @@ pgexporter_free_query(struct query* query)
    if (query != NULL)
    {
       pgexporter_free_tuples(&query->tuples, query->number_of_columns);
+      pgexporter_memory_arena_destroy(query->arena);
       free(query);
    }
 
@@ -591,25 +857,10 @@ pgexporter_free_query(struct query* query)
 }
 
 int
-pgexporter_free_tuples(struct tuple** tuples, int n_columns)
+pgexporter_free_tuples(struct tuple** tuples, int n_columns __attribute__((unused)))
 {
-   struct tuple* next = NULL;
-   struct tuple* current = NULL;
-   current = *tuples;
-
-   while (current != NULL)
-   {
-      next = current->next;
-
-      for (int i = 0; i < n_columns; i++)
-      {
-         free(current->data[i]);
-      }
-      free(current->data);
-      free(current);
-
-      current = next;
-   }
+   /* The tuples are released together with the arena that holds them */
+   *tuples = NULL;
 
    return 0;
 }
@@ -617,7 +868,18 @@ pgexporter_free_tuples(struct tuple** tuples, int n_columns)
 char*
 pgexporter_get_column(int col, struct tuple* tuple)
 {
-   return tuple->data[col];
+   if (tuple->cells[col].length < 0)
+   {
+      return NULL;
+   }
+
+   return tuple->row + tuple->cells[col].offset;
+}
+
+int
+pgexporter_get_column_length(int col, struct tuple* tuple)
+{
+   return tuple->cells[col].length;
 }
 
 void
@@ -664,84 +926,66 @@ pgexporter_get_column_by_name(char* name, struct query* query, struct tuple* tup
    return NULL;
 }
 
-static bool
-is_query_timeout_error(struct message* error_msg)
+static int
+query_execute(int server, char* qs, char* tag, int columns, char* names[], struct query** query)
 {
-   bool is_timeout = false;
-   if (error_msg != NULL && error_msg->length > 5)
-   {
-      char* payload = (char*)error_msg->data;
-      size_t offset = 5; /* kind (1) + length (4) */
+   int ret;
+   struct query_request request;
 
-      while (offset < error_msg->length)
-      {
-         char field_type = payload[offset];
-         if (field_type == '\0')
-         {
-            break;
-         }
+   memset(&request, 0, sizeof(struct query_request));
 
-         char* value = pgexporter_read_string(payload + offset + 1);
+   request.qs = qs;
+   request.tag = tag;
+   request.columns = columns;
+   request.names = names;
 
-         if (field_type == 'C')
-         {
-            if (!strcmp(value, SQLSTATE_QUERY_CANCELED))
-            {
-               is_timeout = true;
-               break;
-            }
-         }
-         else if (field_type == 'M')
-         {
-            if (strstr(value, "statement timeout") != NULL || strstr(value, "canceling statement due to user request") != NULL)
-            {
-               is_timeout = true;
-               break;
-            }
-         }
+   ret = query_pipeline(server, &request, 1, NULL);
 
-         offset += 1 + strlen(value) + 1;
-      }
-   }
+   *query = request.query;
 
-   return is_timeout;
+   return ret != 0 ? ret : request.error;
 }
 
 static int
-query_execute(int server, char* qs, char* tag, int columns, char* names[], struct query** query)
+query_pipeline(int server, struct query_request* requests, int n, struct memory_arena* arena)
 {
    int status;
-   bool cont;
-   int cols;
-   char* name = NULL;
-   struct message qmsg = {0};
-   struct message* tmsg = NULL;
    size_t size = 0;
+   size_t offset = 0;
    char* content = NULL;
+   struct message qmsg = {0};
    struct message* msg = NULL;
-   struct query* q = NULL;
-   struct tuple* current = NULL;
-   void* data = NULL;
-   size_t data_size = 0;
-   size_t offset = 0;
+   struct decoder* decoder = NULL;
    struct configuration* config;
-   bool query_timeout = false;
 
    config = (struct configuration*)shmem;
 
-   atomic_fetch_add(&config->query_executions_total, 1);
+   atomic_fetch_add(&config->query_executions_total, n);
 
-   *query = NULL;
+   if (pgexporter_decoder_create(server, requests, n, NULL, NULL, arena, &decoder))
+   {
+      goto error;
+   }
 
-   memset(&qmsg, 0, sizeof(struct message));
+   for (int i = 0; i < n; i++)
+   {
+      size += 1 + 4 + strlen(requests[i].qs) + 1;
+   }
 
-   size = 1 + 4 + strlen(qs) + 1;
+   /* All the queries are written at once */
    content = (char*)malloc(size);
    memset(content, 0, size);
 
-   pgexporter_write_byte(content, 'Q');
-   pgexporter_write_int32(content + 1, size - 1);
-   pgexporter_write_string(content + 5, qs);
+   for (int i = 0; i < n; i++)
+   {
+      size_t length = 1 + 4 + strlen(requests[i].qs) + 1;
+
+      pgexporter_write_byte(content + offset, 'Q');
+      pgexporter_write_int32(content + offset + 1, length - 1);
+      pgexporter_write_string(content + offset + 5, requests[i].qs);
+
+      offset += length;
+   }
 
    qmsg.kind = 'Q';
    qmsg.length = size;
@@ -753,22 +997,17 @@ query_execute(int server, char* qs, char* tag, int columns, char* names[], struc
       goto error;
    }
 
-   cont = true;
-   while (cont)
+   /* The results are decoded as they arrive */
+   while (!pgexporter_decoder_done(decoder))
    {
       status = pgexporter_read_block_message(config->servers[server].ssl, config->servers[server].fd, &msg);
 
-      if (status == MESSAGE_STATUS_OK)
+      if (status != MESSAGE_STATUS_OK)
       {
-         data = data_append(data, data_size, msg->data, msg->length);
-         data_size += msg->length;
-
-         if (pgexporter_has_message('Z', data, data_size))
-         {
-            cont = false;
-         }
+         goto error;
       }
-      else
+
+      if (pgexporter_decoder_feed(decoder, msg->data, msg->length))
       {
          goto error;
       }
@@ -777,108 +1016,42 @@ query_execute(int server, char* qs, char* tag, int columns, char* names[], struc
       msg = NULL;
    }
 
-   if (pgexporter_has_message('E', data, data_size))
-   {
-      struct message* error_msg = NULL;
-      if (!pgexporter_extract_message_from_data('E', data, data_size, &error_msg))
-      {
-         query_timeout = is_query_timeout_error(error_msg);
-         pgexporter_free_message(error_msg);
-      }
-      goto error;
-   }
-
-   if (pgexporter_extract_message_from_data('T', data, data_size, &tmsg))
+   for (int i = 0; i < n; i++)
    {
-      goto error;
-   }
-
-   if (columns <= 0)
-   {
-      cols = get_number_of_columns(tmsg);
-   }
-   else
-   {
-      cols = columns;
-   }
-
-   q = (struct query*)malloc(sizeof(struct query));
-   memset(q, 0, sizeof(struct query));
-
-   q->number_of_columns = cols;
-   pgexporter_snprintf(&q->tag[0], PROMETHEUS_LENGTH, "%s", tag);
-
-   for (int i = 0; i < cols; i++)
-   {
-      q->type_oids[i] = get_column_type_oid(tmsg, i);
-
-      if (names != NULL)
-      {
-         pgexporter_snprintf(&q->names[i][0], PROMETHEUS_LENGTH, "%s", names[i]);
-      }
-      else
+      if (requests[i].error != 0)
       {
-         if (get_column_name(tmsg, i, &name))
-         {
-            goto error;
-         }
-
-         pgexporter_snprintf(&q->names[i][0], PROMETHEUS_LENGTH, "%s", name);
-
-         free(name);
-         name = NULL;
+         atomic_fetch_add(&config->query_errors_total, 1);
       }
-   }
 
-   while (offset < data_size)
-   {
-      offset = pgexporter_extract_message_offset(offset, data, &msg);
-
-      if (msg != NULL && msg->kind == 'D')
+      if (requests[i].timeout)
       {
-         struct tuple* dtuple = NULL;
-
-         create_D_tuple(server, cols, msg, &dtuple);
-
-         if (q->tuples == NULL)
-         {
-            q->tuples = dtuple;
-         }
-         else
-         {
-            current->next = dtuple;
-         }
-
-         current = dtuple;
+         atomic_fetch_add(&config->query_timeouts_total, 1);
       }
-
-      pgexporter_free_message(msg);
-      msg = NULL;
    }
 
-   *query = q;
-
-   pgexporter_free_message(tmsg);
+   pgexporter_query_latencies(server, requests, n);
 
+   pgexporter_decoder_destroy(decoder);
    free(content);
-   free(data);
 
    return 0;
 
 error:
-   atomic_fetch_add(&config->query_errors_total, 1);
-   if (query_timeout)
+   atomic_fetch_add(&config->query_errors_total, n);
+   if (decoder != NULL)
    {
-      atomic_fetch_add(&config->query_timeouts_total, 1);
-   }
-   if (q != NULL)
-   {
-      pgexporter_free_query(q);
+      pgexporter_query_latencies(server, requests, n);
    }
    pgexporter_clear_message();
-   pgexporter_free_message(tmsg);
+   pgexporter_decoder_destroy(decoder);
    free(content);
-   free(data);
+
+   for (int i = 0; i < n; i++)
+   {
+      pgexporter_free_query(requests[i].query);
+      requests[i].query = NULL;
+      requests[i].error = 1;
+   }
 
    return 1;
 }
@@ -897,144 +1070,6 @@ data_append(void* orig, size_t orig_size, void* n, size_t n_size)
    return d;
 }
 
-static int
-create_D_tuple(int server, int number_of_columns, struct message* msg, struct tuple** tuple)
-{
-   int offset;
-   int length;
-   struct tuple* result = NULL;
-
-   result = (struct tuple*)malloc(sizeof(struct tuple));
-   memset(result, 0, sizeof(struct tuple));
-
-   result->server = server;
-   result->data = (char**)malloc(number_of_columns * sizeof(char*));
-   result->next = NULL;
-
-   offset = 7;
-
-   for (int i = 0; i < number_of_columns; i++)
-   {
-      length = pgexporter_read_int32(msg->data + offset);
-      offset += 4;
-
-      if (length > 0)
-      {
-         result->data[i] = (char*)malloc(length + 1);
-         memset(result->data[i], 0, length + 1);
-         memcpy(result->data[i], msg->data + offset, length);
-         offset += length;
-      }
-      else
-      {
-         result->data[i] = NULL;
-      }
-   }
-
-   *tuple = result;
-
-   return 0;
-}
-
-static int
-get_number_of_columns(struct message* msg)
-{
-   if (msg->kind == 'T')
-   {
-      return pgexporter_read_int16(msg->data + 5);
-   }
-
-   return 0;
-}
-
-static int
-get_column_name(struct message* msg, int index, char** name)
-{
-   int current = 0;
-   int offset;
-   int16_t cols;
-   char* tmp = NULL;
-
-   *name = NULL;
-
-   if (msg->kind == 'T')
-   {
-      cols = pgexporter_read_int16(msg->data + 5);
-
-      if (index < cols)
-      {
-         offset = 7;
-
-         while (current < index)
-         {
-            tmp = pgexporter_read_string(msg->data + offset);
-
-            offset += strlen(tmp) + 1;
-            offset += 4;
-            offset += 2;
-            offset += 4;
-            offset += 2;
-            offset += 4;
-            offset += 2;
-
-            current++;
-         }
-
-         tmp = pgexporter_read_string(msg->data + offset);
-
-         *name = pgexporter_append(*name, tmp);
-
-         return 0;
-      }
-   }
-
-   return 1;
-}
-
-static int
-get_column_type_oid(struct message* msg, int index)
-{
-   int current = 0;
-   int offset;
-   int16_t cols;
-   char* tmp = NULL;
-
-   if (msg->kind == 'T')
-   {
-      cols = pgexporter_read_int16(msg->data + 5);
-
-      if (index < cols)
-      {
-         offset = 7;
-
-         while (current < index)
-         {
-            tmp = pgexporter_read_string(msg->data + offset);
-
-            offset += strlen(tmp) + 1;
-            offset += 4;
-            offset += 2;
-            offset += 4;
-            offset += 2;
-            offset += 4;
-            offset += 2;
-
-            current++;
-         }
-
-         tmp = pgexporter_read_string(msg->data + offset);
-
-         offset += strlen(tmp) + 1;
-         offset += 4;
-         offset += 2;
-
-         return pgexporter_read_int32(msg->data + offset);
-      }
-   }
-
-   return 0;
-}
-
 static int
 process_server_parameters(int server, struct deque* server_parameters)
 {
@@ -1075,11 +1110,80 @@ process_server_parameters(int server, struct deque* server_parameters)
    return status;
 }
 
+static void
+monitor_role_request(struct query_request* request)
+{
+   memset(request, 0, sizeof(struct query_request));
+
+   request->qs = "SELECT pg_has_role(current_user, 'pg_monitor', 'USAGE') AS has_pg_monitor;";
+   request->tag = "pg_monitor_check";
+   request->columns = 1;
+}
+
+static void
+database_list_request(struct query_request* request)
+{
+   memset(request, 0, sizeof(struct query_request));
+
+   request->qs = "SELECT datname "
+                 "FROM pg_database "
+                 "WHERE datistemplate = false AND datname != 'postgres';";
+   request->tag = "pg_db_list";
+   request->columns = 1;
+}
+
+static void
+extensions_list_request(struct query_request* request)
+{
+   memset(request, 0, sizeof(struct query_request));
+
+   request->qs = "SELECT name, installed_version, comment "
+                 "FROM pg_available_extensions "
+                 "WHERE installed_version IS NOT NULL "
+                 "ORDER BY name;";
+   request->tag = "pg_extensions_list";
+   request->columns = 3;
+}
+
 static int
-pgexporter_detect_extensions(int server)
+check_pg_monitor_role(int server, struct query* query)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (query == NULL)
+   {
+      pgexporter_log_error("Failed to execute pg_monitor role check query on server '%s'",
+                           &config->servers[server].name[0]);
+      return 1;
+   }
+
+   if (query->tuples == NULL || pgexporter_get_column(0, query->tuples) == NULL)
+   {
+      pgexporter_log_error("Failed to check pg_monitor role on server '%s': empty result",
+                           &config->servers[server].name[0]);
+      return 1;
+   }
+
+   if (strcmp(pgexporter_get_column(0, query->tuples), "t") != 0)
+   {
+      pgexporter_log_error("User '%s' lacks pg_monitor role on server '%s'. "
+                           "Grant pg_monitor role: GRANT pg_monitor TO %s;",
+                           &config->servers[server].username[0],
+                           &config->servers[server].name[0],
+                           &config->servers[server].username[0]);
+      return 1;
+   }
+
+   pgexporter_log_debug("User has pg_monitor role on server '%s'", &config->servers[server].name[0]);
+
+   return 0;
+}
+
+static int
+pgexporter_detect_extensions(int server, struct query* query)
 {
-   int ret;
-   struct query* query = NULL;
    struct tuple* current = NULL;
    struct configuration* config;
    int extension_idx;
@@ -1088,11 +1192,10 @@ pgexporter_detect_extensions(int server)
 
    config->servers[server].number_of_extensions = 0;
 
-   ret = pgexporter_query_extensions_list(server, &query);
-   if (ret != 0)
+   if (query == NULL)
    {
       pgexporter_log_warn("Failed to detect extensions for server %s", config->servers[server].name);
-      goto error;
+      return 1;
    }
 
    current = query->tuples;
@@ -1102,7 +1205,7 @@ pgexporter_detect_extensions(int server)
       {
          pgexporter_log_warn("Maximum number of extensions reached for server %s (%d)",
                              config->servers[server].name, NUMBER_OF_EXTENSIONS);
-         goto error;
+         return 1;
       }
 
       extension_idx = config->servers[server].number_of_extensions;
@@ -1149,19 +1252,12 @@ pgexporter_detect_extensions(int server)
                            config->servers[server].extensions[i].comment);
    }
 
-   pgexporter_free_query(query);
    return 0;
-
-error:
-   pgexporter_free_query(query);
-   return 1;
 }
 
 static int
-pgexporter_detect_databases(int server)
+pgexporter_detect_databases(int server, struct query* query)
 {
-   int ret;
-   struct query* query = NULL;
    struct tuple* current = NULL;
    struct configuration* config;
    int db_idx;
@@ -1170,11 +1266,10 @@ pgexporter_detect_databases(int server)
 
    config->servers[server].number_of_databases = 0;
 
-   ret = pgexporter_query_database_list(server, &query);
-   if (ret != 0)
+   if (query == NULL)
    {
       pgexporter_log_warn("Failed to detect databases for server %s", config->servers[server].name);
-      goto error;
+      return 1;
    }
 
    db_idx = config->servers[server].number_of_databases;
@@ -1186,7 +1281,7 @@ pgexporter_detect_databases(int server)
       {
          pgexporter_log_warn("Maximum number of databases reached for server %s (%d)",
                              config->servers[server].name, NUMBER_OF_DATABASES);
-         goto error;
+         return 1;
       }
 
       db_idx = config->servers[server].number_of_databases;
@@ -1208,71 +1303,233 @@ pgexporter_detect_databases(int server)
       pgexporter_log_debug("  - %s", config->servers[server].databases[i]);
    }
 
-   pgexporter_free_query(query);
    return 0;
+}
 
-error:
-   pgexporter_free_query(query);
-   return 1;
+static void
+close_connection(int server)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   pgexporter_write_terminate(config->servers[server].ssl, config->servers[server].fd);
+
+   if (config->servers[server].ssl != NULL)
+   {
+      pgexporter_close_ssl(config->servers[server].ssl);
+      config->servers[server].ssl = NULL;
+   }
+
+   pgexporter_disconnect(config->servers[server].fd);
+   config->servers[server].fd = -1;
+   config->servers[server].new = false;
+   config->servers[server].state = SERVER_UNKNOWN;
+   config->servers[server].database[0] = '\0';
+   config->servers[server].backend_pid = 0;
+   config->servers[server].backend_key = 0;
 }
 
+/**
+ * Look up the slot of a tag in the query latencies. The tags are
+ * only ever added, so the lookup needs no lock
+ * @param tag The tag
+ * @return The slot, or -1 if all are taken
+ */
 static int
-pgexporter_connect_db(int server, char* database)
+query_tag_index(char* tag)
 {
-   int user;
+   int n;
+   int index = -1;
+   signed char isfree;
    struct configuration* config;
 
    config = (struct configuration*)shmem;
 
-   user = -1;
-   for (int usr = 0; user == -1 && usr < config->number_of_users; usr++)
+   n = atomic_load(&config->number_of_query_tags);
+   for (int i = 0; i < n; i++)
    {
-      if (!strcmp(&config->users[usr].username[0], &config->servers[server].username[0]))
+      if (!strcmp(config->query_tags[i], tag))
       {
-         user = usr;
+         return i;
       }
    }
-   if (user == -1)
+
+retry:
+   isfree = STATE_FREE;
+
+   if (!atomic_compare_exchange_strong(&config->query_tags_lock, &isfree, STATE_IN_USE))
    {
-      pgexporter_log_error("No user '%s' configured for server '%s'",
-                           &config->servers[server].username[0],
-                           &config->servers[server].name[0]);
-      return AUTH_ERROR;
+      SLEEP_AND_GOTO(1000L, retry)
    }
 
-   int ret = pgexporter_server_authenticate(server, database == NULL ? "postgres" : database,
-                                            &config->users[user].username[0], &config->users[user].password[0],
-                                            &config->servers[server].ssl,
-                                            &config->servers[server].fd);
-   if (ret == 0)
+   /* Another process may have added it in the meantime */
+   n = atomic_load(&config->number_of_query_tags);
+   for (int i = 0; index == -1 && i < n; i++)
    {
-      pgexporter_apply_metrics_timeout(server);
+      if (!strcmp(config->query_tags[i], tag))
+      {
+         index = i;
+      }
    }
-   return ret;
+
+   if (index == -1 && n < NUMBER_OF_QUERY_TAGS)
+   {
+      pgexporter_snprintf(config->query_tags[n], PROMETHEUS_LENGTH, "%s", tag);
+      atomic_store(&config->number_of_query_tags, n + 1);
+      index = n;
+   }
+
+   atomic_store(&config->query_tags_lock, STATE_FREE);
+
+   return index;
 }
 
-int
-pgexporter_switch_db(int server, char* database)
+static bool
+park_connection(int server)
 {
-   int ret;
+   struct pooled_connection* slot = NULL;
    struct configuration* config;
 
    config = (struct configuration*)shmem;
 
-   if (config->servers[server].fd != -1)
+   for (int i = 0; i < NUMBER_OF_DATABASES; i++)
    {
-      pgexporter_write_terminate(config->servers[server].ssl, config->servers[server].fd);
-      if (config->servers[server].ssl != NULL)
+      struct pooled_connection* pc = &pooled_connections[server][i];
+
+      if (pc->database[0] != '\0' && !strcmp(pc->database, config->servers[server].database))
       {
-         pgexporter_close_ssl(config->servers[server].ssl);
-         pgexporter_disconnect(config->servers[server].fd);
+         /* Only keep one connection per database */
+         close_pooled_connection(pc);
+         slot = pc;
+         break;
       }
-      else
+      else if (slot == NULL && pc->database[0] == '\0')
       {
-         pgexporter_disconnect(config->servers[server].fd);
+         slot = pc;
       }
-      config->servers[server].ssl = NULL;
-      config->servers[server].fd = -1;
+   }
+
+   if (slot == NULL)
+   {
+      return false;
+   }
+
+   pgexporter_snprintf(slot->database, DB_NAME_LENGTH, "%s", config->servers[server].database);
+   slot->ssl = config->servers[server].ssl;
+   slot->fd = config->servers[server].fd;
+   slot->backend_pid = config->servers[server].backend_pid;
+   slot->backend_key = config->servers[server].backend_key;
+   slot->last_used = config->servers[server].last_used;
+
+   config->servers[server].ssl = NULL;
+   config->servers[server].fd = -1;
+   config->servers[server].database[0] = '\0';
+
+   return true;
+}
+
+static bool
+unpark_connection(int server, char* database)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   for (int i = 0; i < NUMBER_OF_DATABASES; i++)
+   {
+      struct pooled_connection* pc = &pooled_connections[server][i];
+
+      if (pc->database[0] != '\0' && !strcmp(pc->database, database))
+      {
+         if (!pgexporter_connection_isvalid(pc->ssl, pc->fd))
+         {
+            close_pooled_connection(pc);
+            return false;
+         }
+
+         pgexporter_snprintf(config->servers[server].database, DB_NAME_LENGTH, "%s", pc->database);
+         config->servers[server].ssl = pc->ssl;
+         config->servers[server].fd = pc->fd;
+         config->servers[server].backend_pid = pc->backend_pid;
+         config->servers[server].backend_key = pc->backend_key;
+         config->servers[server].last_used = time(NULL);
+
+         memset(pc, 0, sizeof(struct pooled_connection));
+
+         return true;
+      }
+   }
+
+   return false;
+}
+
+static void
+close_pooled_connection(struct pooled_connection* pc)
+{
+   pgexporter_write_terminate(pc->ssl, pc->fd);
+
+   if (pc->ssl != NULL)
+   {
+      pgexporter_close_ssl(pc->ssl);
+   }
+
+   pgexporter_disconnect(pc->fd);
+
+   memset(pc, 0, sizeof(struct pooled_connection));
+}
+
+static int
+pgexporter_connect_db(int server, char* database)
+{
+   int user;
+   int ret;
+   char* setup = NULL;
+   struct server_connect* connect = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   user = server_user(server);
+   if (user == -1)
+   {
+      return AUTH_ERROR;
+   }
+
+   /* The statement timeout is set before the connection is handed over */
+   setup = metrics_timeout_query();
+
+   ret = pgexporter_server_connect_start(server, database == NULL ? "postgres" : database,
+                                         &config->users[user].username[0], &config->users[user].password[0],
+                                         setup, &connect);
+
+   free(setup);
+
+   if (ret != 0)
+   {
+      return AUTH_ERROR;
+   }
+
+   ret = pgexporter_server_connect_run(connect);
+   if (ret != AUTH_SUCCESS)
+   {
+      pgexporter_server_connect_destroy(connect);
+      return ret;
+   }
+
+   pgexporter_switch_db_complete(server, connect);
+
+   return AUTH_SUCCESS;
+}
+
+int
+pgexporter_switch_db(int server, char* database)
+{
+   int ret;
+
+   if (reuse_connection(server, database))
+   {
+      return 0;
    }
 
    ret = pgexporter_connect_db(server, database);
@@ -1287,28 +1544,146 @@ error:
    return ret;
 }
 
-static void
-pgexporter_apply_metrics_timeout(int server)
+int
+pgexporter_switch_db_start(int server, char* database, struct server_connect** connect)
+{
+   int user;
+   int ret;
+   char* setup = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   *connect = NULL;
+
+   if (reuse_connection(server, database))
+   {
+      return 0;
+   }
+
+   user = server_user(server);
+   if (user == -1)
+   {
+      return 1;
+   }
+
+   /* The statement timeout is set before the connection is handed over */
+   setup = metrics_timeout_query();
+
+   ret = pgexporter_server_connect_start(server, database == NULL ? "postgres" : database,
+                                         &config->users[user].username[0], &config->users[user].password[0],
+                                         setup, connect);
+
+   free(setup);
+
+   return ret;
+}
+
+void
+pgexporter_switch_db_complete(int server, struct server_connect* connect)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   config->servers[server].fd = connect->fd;
+   config->servers[server].ssl = connect->ssl;
+   config->servers[server].backend_pid = connect->backend_pid;
+   config->servers[server].backend_key = connect->backend_key;
+   config->servers[server].last_used = time(NULL);
+   pgexporter_snprintf(config->servers[server].database, DB_NAME_LENGTH, "%s", connect->database);
+
+   process_server_parameters(server, connect->parameters);
+
+   /* The connection was set up non blocking, the rest of the code expects the configured mode */
+   pgexporter_socket_nonblocking(connect->fd, config->non_blocking);
+
+   connect->fd = -1;
+   connect->ssl = NULL;
+
+   pgexporter_server_connect_destroy(connect);
+}
+
+static int
+server_user(int server)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   for (int usr = 0; usr < config->number_of_users; usr++)
+   {
+      if (!strcmp(&config->users[usr].username[0], &config->servers[server].username[0]))
+      {
+         return usr;
+      }
+   }
+
+   pgexporter_log_error("No user '%s' configured for server '%s'",
+                        &config->servers[server].username[0],
+                        &config->servers[server].name[0]);
+
+   return -1;
+}
+
+static char*
+metrics_timeout_query(void)
 {
+   char* query = NULL;
    struct configuration* config;
 
    config = (struct configuration*)shmem;
 
    if (pgexporter_time_is_valid(config->metrics_query_timeout))
    {
-      char* set_query = pgexporter_append(NULL, "SET statement_timeout = ");
-      set_query = pgexporter_append_int(set_query, (int)pgexporter_time_convert(config->metrics_query_timeout, FORMAT_TIME_MS));
-      set_query = pgexporter_append(set_query, ";");
-      if (pgexporter_execute_command(server, set_query) != 0)
+      query = pgexporter_append(NULL, "SET statement_timeout = ");
+      query = pgexporter_append_int(query, (int)pgexporter_time_convert(config->metrics_query_timeout, FORMAT_TIME_MS));
+      query = pgexporter_append(query, ";");
+   }
+
+   return query;
+}
+
+static bool
+reuse_connection(int server, char* database)
+{
+   bool pooling;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   /* Connections only outlive a collection in the background collector */
+   pooling = pgexporter_time_is_valid(config->metrics_collector_interval);
+
+   /* Reuse the connection if it is already connected to the database */
+   if (config->servers[server].fd != -1 &&
+       !strcmp(config->servers[server].database, database == NULL ? "postgres" : database))
+   {
+      config->servers[server].last_used = time(NULL);
+      return true;
+   }
+
+   if (config->servers[server].fd != -1 && pooling && park_connection(server))
+   {
+      /* Kept open for the next collection */
+   }
+   else if (config->servers[server].fd != -1)
+   {
+      pgexporter_write_terminate(config->servers[server].ssl, config->servers[server].fd);
+      if (config->servers[server].ssl != NULL)
       {
-         pgexporter_log_debug("Failed to set statement_timeout=%" PRId64 "ms on server '%s'",
-                              pgexporter_time_convert(config->metrics_query_timeout, FORMAT_TIME_MS), &config->servers[server].name[0]);
+         pgexporter_close_ssl(config->servers[server].ssl);
+         pgexporter_disconnect(config->servers[server].fd);
       }
       else
       {
-         pgexporter_log_debug("Set statement_timeout=%" PRId64 "ms on server '%s'",
-                              pgexporter_time_convert(config->metrics_query_timeout, FORMAT_TIME_MS), &config->servers[server].name[0]);
+         pgexporter_disconnect(config->servers[server].fd);
       }
-      free(set_query);
+      config->servers[server].ssl = NULL;
+      config->servers[server].fd = -1;
+      config->servers[server].database[0] = '\0';
    }
+
+   return pooling && unpark_connection(server, database == NULL ? "postgres" : database);
 }
+
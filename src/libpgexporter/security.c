@@ -39,6 +39,7 @@
 #include <utils.h>
 
 /* system */
+#include <errno.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -46,6 +47,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <poll.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <openssl/err.h>
@@ -68,30 +70,34 @@
 #define SECURITY_SCRAM256           10
 #define SECURITY_ALL                99
 
-#define NUMBER_OF_SECURITY_MESSAGES 5
-#define SECURITY_BUFFER_SIZE        1024
+/* The state changed, so the next state runs right away */
+#define CONNECT_NEXT                -1
 
-static signed char has_security;
-static ssize_t security_lengths[NUMBER_OF_SECURITY_MESSAGES];
-static char security_messages[NUMBER_OF_SECURITY_MESSAGES][SECURITY_BUFFER_SIZE];
-
-static int get_auth_type(struct message* msg, int* auth_type);
-static int get_salt(void* data, char** salt);
 static int generate_md5(char* str, int length, char** md5);
 
 static int client_scram256(SSL* c_ssl, int client_fd, char* username, char* password, int slot);
 
-static int server_trust(void);
-static int server_password(char* username, char* password, SSL* ssl, int server_fd);
-static int server_md5(char* username, char* password, SSL* ssl, int server_fd);
-static int server_scram256(char* username, char* password, SSL* ssl, int server_fd);
-
 static char* get_admin_password(char* username);
 
+static int connect_socket(struct server_connect* connect);
+static int connect_tls(struct server_connect* connect);
+static int connect_handshake(struct server_connect* connect);
+static int connect_exchange(struct server_connect* connect);
+static int connect_message(struct server_connect* connect, struct message* msg);
+static int connect_authentication(struct server_connect* connect, struct message* msg);
+static int connect_scram256_first(struct server_connect* connect, struct message* msg);
+static int connect_scram256_continue(struct server_connect* connect, struct message* msg);
+static int connect_scram256_final(struct server_connect* connect, struct message* msg);
+static void connect_startup(struct server_connect* connect);
+static int connect_queue(struct server_connect* connect, struct message* msg);
+static int connect_flush(struct server_connect* connect);
+static int connect_read(struct server_connect* connect);
+
 static int sasl_prep(char* password, char** password_prep);
 static int generate_nounce(char** nounce);
 static int get_scram_attribute(char attribute, char* input, size_t size, char** value);
 static int client_proof(char* password, char* salt, int salt_length, int iterations,
+                        unsigned char* client_key, int client_key_length,
                         char* client_first_message_bare, size_t client_first_message_bare_length,
                         char* server_first_message, size_t server_first_message_length,
                         char* client_final_message_wo_proof, size_t client_final_message_wo_proof_length,
@@ -101,6 +107,8 @@ static int salted_password_key(unsigned char* salted_password, int salted_passwo
                                unsigned char** result, int* result_length);
 static int stored_key(unsigned char* client_key, int client_key_length, unsigned char** result, int* result_length);
 static int generate_salt(char** salt, int* size);
+static void evict_scram_keys(char* username, char* salt, int salt_length, int iterations);
+static void lock_scram_keys(struct configuration* config);
 static int server_signature(char* password, char* salt, int salt_length, int iterations,
                             char* server_key, int server_key_length,
                             char* client_first_message_bare, size_t client_first_message_bare_length,
@@ -109,6 +117,9 @@ static int server_signature(char* password, char* salt, int salt_length, int ite
                             unsigned char** result, size_t* result_length);
 
 static int create_ssl_client(SSL_CTX* ctx, char* key, char* cert, char* root, int socket, SSL** ssl);
+static int load_server_certificates(SSL_CTX* ctx, char* key, char* cert, char* root);
+static void ticket_key_copy(struct ticket_keys* ticket_keys, int index, unsigned char* key);
+static int ticket_key_cb(SSL* ssl, unsigned char* key_name, unsigned char* iv, EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int enc);
 
 int
 pgexporter_remote_management_auth(int client_fd, char* address, SSL** client_ssl)
@@ -513,6 +524,7 @@ pgexporter_remote_management_scram_sha256(char* username, char* password, int se
    server_first_message = sasl_continue->data + 9;
 
    if (client_proof(password_prep, salt, salt_length, iteration,
+                    NULL, 0,
                     client_first_message_bare, sasl_response->length - 26,
                     server_first_message, sasl_continue->length - 9,
                     &wo_proof[0], strlen(wo_proof),
@@ -652,116 +664,6 @@ error:
    return AUTH_ERROR;
 }
 
-static int
-get_auth_type(struct message* msg, int* auth_type)
-{
-   int32_t length;
-   int32_t type = -1;
-   int offset;
-
-   if (msg->kind != 'R')
-   {
-      return 1;
-   }
-
-   length = pgexporter_read_int32(msg->data + 1);
-   type = pgexporter_read_int32(msg->data + 5);
-   offset = 9;
-
-   if (type == 0 && msg->length > 8)
-   {
-      if ('E' == pgexporter_read_byte(msg->data + 9))
-      {
-         *auth_type = -1;
-         return 0;
-      }
-   }
-
-   switch (type)
-   {
-      case 0:
-         pgexporter_log_trace("Backend: R - Success");
-         break;
-      case 2:
-         pgexporter_log_trace("Backend: R - KerberosV5");
-         break;
-      case 3:
-         pgexporter_log_trace("Backend: R - CleartextPassword");
-         break;
-      case 5:
-         pgexporter_log_trace("Backend: R - MD5Password");
-         pgexporter_log_trace("             Salt %02hhx%02hhx%02hhx%02hhx",
-                              (signed char)(pgexporter_read_byte(msg->data + 9) & 0xFF),
-                              (signed char)(pgexporter_read_byte(msg->data + 10) & 0xFF),
-                              (signed char)(pgexporter_read_byte(msg->data + 11) & 0xFF),
-                              (signed char)(pgexporter_read_byte(msg->data + 12) & 0xFF));
-         break;
-      case 6:
-         pgexporter_log_trace("Backend: R - SCMCredential");
-         break;
-      case 7:
-         pgexporter_log_trace("Backend: R - GSS");
-         break;
-      case 8:
-         pgexporter_log_trace("Backend: R - GSSContinue");
-         break;
-      case 9:
-         pgexporter_log_trace("Backend: R - SSPI");
-         break;
-      case 10:
-         pgexporter_log_trace("Backend: R - SASL");
-         while (offset < length - 8)
-         {
-            char* mechanism = pgexporter_read_string(msg->data + offset);
-            pgexporter_log_trace("             %s", mechanism);
-            offset += strlen(mechanism) + 1;
-         }
-         break;
-      case 11:
-         pgexporter_log_trace("Backend: R - SASLContinue");
-         break;
-      case 12:
-         pgexporter_log_trace("Backend: R - SASLFinal");
-         offset += length - 8;
-
-         if (offset < msg->length)
-         {
-            signed char peek = pgexporter_read_byte(msg->data + offset);
-            switch (peek)
-            {
-               case 'R':
-                  type = pgexporter_read_int32(msg->data + offset + 5);
-                  break;
-               default:
-                  break;
-            }
-         }
-
-         break;
-      default:
-         break;
-   }
-
-   *auth_type = type;
-
-   return 0;
-}
-
-static int
-get_salt(void* data, char** salt)
-{
-   char* result;
-
-   result = malloc(4);
-   memset(result, 0, 4);
-
-   memcpy(result, data + 9, 4);
-
-   *salt = result;
-
-   return 0;
-}
-
 static int
 generate_md5(char* str, int length, char** md5)
 {
@@ -904,6 +806,7 @@ retry:
    sasl_prep(password, &password_prep);
 
    if (client_proof(password_prep, salt, salt_length, 4096,
+                    NULL, 0,
                     client_first_message_bare, strlen(client_first_message_bare),
                     server_first_message, strlen(server_first_message),
                     client_final_message_without_proof, strlen(client_final_message_without_proof),
@@ -1012,234 +915,347 @@ error:
 int
 pgexporter_server_authenticate(int server, char* database, char* username, char* password, SSL** ssl, int* fd)
 {
-   int server_fd;
-   int auth_type;
-   int ret;
-   int status = AUTH_ERROR;
-   int connect;
-   SSL* c_ssl = NULL;
-   struct message* ssl_msg = NULL;
-   struct message* startup_msg = NULL;
-   struct message* msg = NULL;
+   int status;
+   struct server_connect* connect = NULL;
    struct configuration* config;
 
+   config = (struct configuration*)shmem;
+
    *ssl = NULL;
    *fd = -1;
 
-   auth_type = SECURITY_INVALID;
-   server_fd = -1;
-   config = (struct configuration*)shmem;
-
-   for (int i = 0; i < NUMBER_OF_SECURITY_MESSAGES; i++)
+   if (pgexporter_server_connect_start(server, database, username, password, NULL, &connect))
    {
-      memset(&security_messages[i], 0, SECURITY_BUFFER_SIZE);
+      return AUTH_ERROR;
    }
 
-   if (config->servers[server].host[0] == '/')
+   status = pgexporter_server_connect_run(connect);
+
+   if (status == AUTH_SUCCESS)
    {
-      char pgsql[MISC_LENGTH];
+      /* The connection was set up non blocking, the caller expects the configured mode */
+      pgexporter_socket_nonblocking(connect->fd, config->non_blocking);
 
-      memset(&pgsql, 0, sizeof(pgsql));
-      pgexporter_snprintf(&pgsql[0], sizeof(pgsql), ".s.PGSQL.%d", config->servers[server].port);
-      ret = pgexporter_connect_unix_socket(config->servers[server].host, &pgsql[0], &server_fd);
+      *ssl = connect->ssl;
+      *fd = connect->fd;
+
+      connect->ssl = NULL;
+      connect->fd = -1;
    }
-   else
+
+   pgexporter_server_connect_destroy(connect);
+
+   return status;
+}
+
+int
+pgexporter_server_connect_start(int server, char* database, char* username, char* password, char* setup,
+                                struct server_connect** connect)
+{
+   int ret;
+   struct server_connect* c = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   *connect = NULL;
+
+   if (config->servers[server].tls_mode == SERVER_TLS_ON &&
+       strlen(config->servers[server].tls_ca_file) == 0)
    {
-      ret = pgexporter_connect(config->servers[server].host, config->servers[server].port, &server_fd);
+      pgexporter_log_error("%s: tls=on requires tls_ca_file to be set", config->servers[server].name);
+      goto error;
    }
 
-   if (ret != 0)
+   c = (struct server_connect*)calloc(1, sizeof(struct server_connect));
+   if (c == NULL)
    {
       goto error;
    }
 
-   if (config->servers[server].tls_mode == SERVER_TLS_ON &&
-       strlen(config->servers[server].tls_ca_file) == 0)
+   c->server = server;
+   c->fd = -1;
+   c->start = pgexporter_monotonic_micros();
+   pgexporter_snprintf(&c->database[0], sizeof(c->database), "%s", database);
+   pgexporter_snprintf(&c->username[0], sizeof(c->username), "%s", username);
+   pgexporter_snprintf(&c->password[0], sizeof(c->password), "%s", password);
+
+   if (pgexporter_deque_create(false, &c->parameters))
    {
-      pgexporter_log_error("%s: tls=on requires tls_ca_file to be set", config->servers[server].name);
       goto error;
    }
 
-   if (config->servers[server].tls_mode != SERVER_TLS_OFF)
+   if (setup != NULL)
    {
-      ret = pgexporter_create_ssl_message(&ssl_msg);
-      if (ret != MESSAGE_STATUS_OK)
+      c->setup = strdup(setup);
+      if (c->setup == NULL)
       {
          goto error;
       }
+   }
 
-      ret = pgexporter_write_message(NULL, server_fd, ssl_msg);
-      if (ret != MESSAGE_STATUS_OK)
-      {
-         goto error;
-      }
+   if (config->servers[server].host[0] == '/')
+   {
+      char pgsql[MISC_LENGTH];
 
-      ret = pgexporter_read_block_message(NULL, server_fd, &msg);
-      if (ret != MESSAGE_STATUS_OK)
-      {
-         goto error;
-      }
+      /* A Unix Domain Socket connects right away */
+      memset(&pgsql, 0, sizeof(pgsql));
+      pgexporter_snprintf(&pgsql[0], sizeof(pgsql), ".s.PGSQL.%d", config->servers[server].port);
+      ret = pgexporter_connect_unix_socket(config->servers[server].host, &pgsql[0], &c->fd);
 
-      if (msg->kind != 'S' && config->servers[server].tls_mode == SERVER_TLS_ON)
+      if (ret == 0)
       {
-         pgexporter_log_error("%s: tls=on requested but server declined TLS", config->servers[server].name);
-         goto error;
+         pgexporter_socket_nonblocking(c->fd, true);
       }
+   }
+   else
+   {
+      ret = pgexporter_connect_start(config->servers[server].host, config->servers[server].port, &c->fd);
+   }
 
-      if (msg->kind == 'S')
-      {
-         SSL_CTX* ctx = NULL;
+   if (ret != 0)
+   {
+      goto error;
+   }
 
-         if (pgexporter_create_ssl_ctx(true, &ctx))
-         {
-            goto error;
-         }
+   c->state = SERVER_CONNECT_SOCKET;
 
-         pgexporter_log_trace("%s: Key file @ %s", config->servers[server].name, config->servers[server].tls_key_file);
-         pgexporter_log_trace("%s: Certificate file @ %s", config->servers[server].name, config->servers[server].tls_cert_file);
-         pgexporter_log_trace("%s: CA file @ %s", config->servers[server].name, config->servers[server].tls_ca_file);
+   *connect = c;
 
-         if (create_ssl_client(ctx, config->servers[server].tls_key_file, config->servers[server].tls_cert_file, config->servers[server].tls_ca_file, server_fd, &c_ssl))
-         {
-            goto error;
-         }
+   return 0;
 
-         do
-         {
-            connect = SSL_connect(c_ssl);
+error:
 
-            if (connect != 1)
-            {
-               int err = SSL_get_error(c_ssl, connect);
-               switch (err)
-               {
-                  case SSL_ERROR_ZERO_RETURN:
-                  case SSL_ERROR_WANT_READ:
-                  case SSL_ERROR_WANT_WRITE:
-                  case SSL_ERROR_WANT_CONNECT:
-                  case SSL_ERROR_WANT_ACCEPT:
-                  case SSL_ERROR_WANT_X509_LOOKUP:
-#ifndef HAVE_OPENBSD
-                  case SSL_ERROR_WANT_ASYNC:
-                  case SSL_ERROR_WANT_ASYNC_JOB:
-                  case SSL_ERROR_WANT_CLIENT_HELLO_CB:
-#endif
-                     break;
-                  case SSL_ERROR_SYSCALL:
-                     pgexporter_log_error("SSL_ERROR_SYSCALL: %s (%d)", strerror(errno), server_fd);
-                     errno = 0;
-                     goto error;
-                     break;
-                  case SSL_ERROR_SSL:
-                     pgexporter_log_error("SSL_ERROR_SSL: %s (%d)", strerror(errno), server_fd);
-                     pgexporter_log_error("%s", ERR_error_string(err, NULL));
-                     pgexporter_log_error("%s", ERR_lib_error_string(err));
-                     pgexporter_log_error("%s", ERR_reason_error_string(err));
-                     errno = 0;
-                     goto error;
-                     break;
-               }
-               ERR_clear_error();
-            }
-         }
-         while (connect != 1);
-      }
-   }
+   pgexporter_server_connect_destroy(c);
 
-   ret = pgexporter_create_startup_message(username, database, &startup_msg);
-   if (ret != MESSAGE_STATUS_OK)
-   {
-      goto error;
-   }
+   return 1;
+}
+
+int
+pgexporter_server_connect_step(struct server_connect* connect)
+{
+   int status;
 
-   ret = pgexporter_write_message(c_ssl, server_fd, startup_msg);
-   if (ret != MESSAGE_STATUS_OK)
+   do
    {
-      goto error;
+      switch (connect->state)
+      {
+         case SERVER_CONNECT_SOCKET:
+            status = connect_socket(connect);
+            break;
+         case SERVER_CONNECT_TLS:
+            status = connect_tls(connect);
+            break;
+         case SERVER_CONNECT_HANDSHAKE:
+            status = connect_handshake(connect);
+            break;
+         default:
+            status = connect_exchange(connect);
+            break;
+      }
    }
+   while (status == CONNECT_NEXT);
 
-   ret = pgexporter_read_block_message(c_ssl, server_fd, &msg);
-   if (ret != MESSAGE_STATUS_OK)
+   /* The keys may have been derived from a password the server no longer accepts */
+   if ((status == AUTH_ERROR || status == AUTH_BAD_PASSWORD) && connect->derived && !connect->authenticated)
    {
-      goto error;
+      evict_scram_keys(connect->username, connect->salt, connect->salt_length, connect->iterations);
    }
 
-   get_auth_type(msg, &auth_type);
+   return status;
+}
+
+int
+pgexporter_server_connect_run(struct server_connect* connect)
+{
+   int ret;
+   int status;
+   int64_t deadline = 0;
+   int64_t wait = -1;
+   struct pollfd pfd;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
 
-   if (auth_type == -1)
+   if (pgexporter_time_is_valid(config->authentication_timeout))
    {
-      goto error;
+      deadline = pgexporter_monotonic_micros() + pgexporter_time_convert(config->authentication_timeout, FORMAT_TIME_MS) * 1000;
    }
-   else if (auth_type != SECURITY_TRUST && auth_type != SECURITY_PASSWORD && auth_type != SECURITY_MD5 && auth_type != SECURITY_SCRAM256)
+
+   /* The socket is writable once it has connected */
+   status = AUTH_WANT_WRITE;
+
+   while (status == AUTH_WANT_READ || status == AUTH_WANT_WRITE)
    {
-      goto error;
+      if (deadline > 0)
+      {
+         wait = (deadline - pgexporter_monotonic_micros()) / 1000;
+         if (wait <= 0)
+         {
+            pgexporter_log_debug("%s: Authentication timed out", config->servers[connect->server].name);
+            return AUTH_ERROR;
+         }
+      }
+
+      pfd.fd = connect->fd;
+      pfd.events = status == AUTH_WANT_READ ? POLLIN : POLLOUT;
+      pfd.revents = 0;
+
+      ret = poll(&pfd, 1, (int)wait);
+      if (ret == -1 && errno == EINTR)
+      {
+         errno = 0;
+         continue;
+      }
+      else if (ret == -1)
+      {
+         return AUTH_ERROR;
+      }
+      else if (ret == 0)
+      {
+         continue;
+      }
+
+      status = pgexporter_server_connect_step(connect);
    }
 
-   security_lengths[0] = msg->length;
-   memcpy(&security_messages[0], msg->data, msg->length);
+   return status;
+}
 
-   if (auth_type == SECURITY_TRUST)
+void
+pgexporter_server_connect_destroy(struct server_connect* connect)
+{
+   if (connect == NULL)
    {
-      status = server_trust();
+      return;
    }
-   else if (auth_type == SECURITY_PASSWORD)
+
+   pgexporter_close_ssl(connect->ssl);
+   if (connect->fd != -1)
    {
-      status = server_password(username, password, c_ssl, server_fd);
+      pgexporter_disconnect(connect->fd);
    }
-   else if (auth_type == SECURITY_MD5)
+
+   pgexporter_deque_destroy(connect->parameters);
+   free(connect->setup);
+   free(connect->output);
+   free(connect->input);
+   free(connect->password_prep);
+   free(connect->client_first);
+   free(connect->server_first);
+   free(connect->wo_proof);
+   free(connect->salt);
+   free(connect);
+}
+
+int
+pgexporter_scram_keys(char* username, char* password, char* salt, int salt_length, int iterations,
+                      unsigned char* client_key, unsigned char* server_key)
+{
+   bool found = false;
+   unsigned char* s_p = NULL;
+   int s_p_length;
+   unsigned char* c_k = NULL;
+   int c_k_length;
+   unsigned char* s_k = NULL;
+   int s_k_length;
+   struct scram_keys* keys = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (config != NULL && salt_length <= SCRAM_SALT_LENGTH)
    {
-      status = server_md5(username, password, c_ssl, server_fd);
+      lock_scram_keys(config);
+
+      for (int i = 0; !found && i < NUMBER_OF_SCRAM_KEYS; i++)
+      {
+         keys = &config->scram_keys[i];
+
+         if (keys->salt_length == salt_length && keys->iterations == iterations &&
+             !strcmp(keys->username, username) && !memcmp(keys->salt, salt, salt_length))
+         {
+            memcpy(client_key, keys->client_key, SCRAM_KEY_LENGTH);
+            memcpy(server_key, keys->server_key, SCRAM_KEY_LENGTH);
+            found = true;
+         }
+      }
+
+      atomic_store(&config->scram_keys_lock, STATE_FREE);
+
+      if (found)
+      {
+         pgexporter_log_trace("SCRAM-SHA-256: Reusing the keys of %s", username);
+         return 0;
+      }
    }
-   else if (auth_type == SECURITY_SCRAM256)
+
+   /* SaltedPassword is the expensive part, ClientKey and ServerKey follow from it */
+   if (salted_password(password, salt, salt_length, iterations, &s_p, &s_p_length))
    {
-      status = server_scram256(username, password, c_ssl, server_fd);
+      goto error;
    }
 
-   if (status == AUTH_BAD_PASSWORD)
+   if (salted_password_key(s_p, s_p_length, "Client Key", &c_k, &c_k_length))
    {
-      goto bad_password;
+      goto error;
    }
-   else if (status == AUTH_ERROR)
+
+   if (salted_password_key(s_p, s_p_length, "Server Key", &s_k, &s_k_length))
    {
       goto error;
    }
 
-   *ssl = c_ssl;
-   *fd = server_fd;
-
-   pgexporter_free_message(ssl_msg);
-   pgexporter_free_message(startup_msg);
-   pgexporter_clear_message();
+   memcpy(client_key, c_k, SCRAM_KEY_LENGTH);
+   memcpy(server_key, s_k, SCRAM_KEY_LENGTH);
 
-   return AUTH_SUCCESS;
+   if (config != NULL && salt_length <= SCRAM_SALT_LENGTH &&
+       strlen(username) < MAX_USERNAME_LENGTH)
+   {
+      lock_scram_keys(config);
 
-bad_password:
+      keys = &config->scram_keys[config->scram_keys_next];
+      config->scram_keys_next = (config->scram_keys_next + 1) % NUMBER_OF_SCRAM_KEYS;
 
-   pgexporter_free_message(ssl_msg);
-   pgexporter_free_message(startup_msg);
-   pgexporter_clear_message();
+      memset(keys, 0, sizeof(struct scram_keys));
+      memcpy(keys->username, username, strlen(username));
+      memcpy(keys->salt, salt, salt_length);
+      keys->salt_length = salt_length;
+      keys->iterations = iterations;
+      memcpy(keys->client_key, c_k, SCRAM_KEY_LENGTH);
+      memcpy(keys->server_key, s_k, SCRAM_KEY_LENGTH);
 
-   pgexporter_close_ssl(c_ssl);
-   if (server_fd != -1)
-   {
-      pgexporter_disconnect(server_fd);
+      atomic_store(&config->scram_keys_lock, STATE_FREE);
    }
 
-   return AUTH_BAD_PASSWORD;
+   free(s_p);
+   free(c_k);
+   free(s_k);
+
+   return 0;
 
 error:
 
-   pgexporter_free_message(ssl_msg);
-   pgexporter_free_message(startup_msg);
-   pgexporter_clear_message();
+   free(s_p);
+   free(c_k);
+   free(s_k);
 
-   pgexporter_close_ssl(c_ssl);
-   if (server_fd != -1)
-   {
-      pgexporter_disconnect(server_fd);
-   }
+   return 1;
+}
 
-   return AUTH_ERROR;
+void
+pgexporter_clear_scram_keys(void)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   lock_scram_keys(config);
+
+   memset(&config->scram_keys[0], 0, sizeof(struct scram_keys) * NUMBER_OF_SCRAM_KEYS);
+   config->scram_keys_next = 0;
+
+   atomic_store(&config->scram_keys_lock, STATE_FREE);
 }
 
 void
@@ -1262,327 +1278,502 @@ pgexporter_close_ssl(SSL* ssl)
 }
 
 static int
-server_trust(void)
+connect_socket(struct server_connect* connect)
 {
-   pgexporter_log_trace("server_trust");
+   struct message* msg = NULL;
+   struct configuration* config;
 
-   has_security = SECURITY_TRUST;
+   config = (struct configuration*)shmem;
 
-   return AUTH_SUCCESS;
-}
+   /* Writable, so the connect has completed one way or the other */
+   if (pgexporter_socket_has_error(connect->fd))
+   {
+      pgexporter_log_debug("%s: Failed to connect", config->servers[connect->server].name);
+      return AUTH_ERROR;
+   }
+
+   if (config->servers[connect->server].tls_mode == SERVER_TLS_OFF)
+   {
+      connect_startup(connect);
+      return connect->output == NULL ? AUTH_ERROR : CONNECT_NEXT;
+   }
+
+   if (pgexporter_create_ssl_message(&msg) != MESSAGE_STATUS_OK || connect_queue(connect, msg))
+   {
+      pgexporter_free_message(msg);
+      return AUTH_ERROR;
+   }
+
+   pgexporter_free_message(msg);
+
+   connect->state = SERVER_CONNECT_TLS;
+
+   return CONNECT_NEXT;
+}
 
 static int
-server_password(char* username, char* password, SSL* ssl, int server_fd)
+connect_tls(struct server_connect* connect)
 {
-   int status = MESSAGE_STATUS_ERROR;
-   int auth_index = 1;
-   int auth_response = -1;
-   struct message* auth_msg = NULL;
-   struct message* password_msg = NULL;
+   int status;
+   char response;
+   ssize_t numbytes;
+   SSL_CTX* ctx = NULL;
+   struct configuration* config;
 
-   pgexporter_log_trace("server_password");
+   config = (struct configuration*)shmem;
 
-   status = pgexporter_create_auth_password_response(password, &password_msg);
-   if (status != MESSAGE_STATUS_OK)
+   status = connect_flush(connect);
+   if (status != 0)
    {
-      goto error;
+      return status;
    }
 
-   status = pgexporter_write_message(ssl, server_fd, password_msg);
-   if (status != MESSAGE_STATUS_OK)
+   /* The answer is a single byte, the handshake follows it */
+   numbytes = read(connect->fd, &response, 1);
+   if (numbytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
    {
-      goto error;
+      errno = 0;
+      return AUTH_WANT_READ;
+   }
+   else if (numbytes != 1)
+   {
+      return AUTH_ERROR;
    }
 
-   security_lengths[auth_index] = password_msg->length;
-   memcpy(&security_messages[auth_index], password_msg->data, password_msg->length);
-   auth_index++;
+   if (response != 'S')
+   {
+      if (config->servers[connect->server].tls_mode == SERVER_TLS_ON)
+      {
+         pgexporter_log_error("%s: tls=on requested but server declined TLS", config->servers[connect->server].name);
+         return AUTH_ERROR;
+      }
+
+      connect_startup(connect);
+      return connect->output == NULL ? AUTH_ERROR : CONNECT_NEXT;
+   }
 
-   status = pgexporter_read_block_message(ssl, server_fd, &auth_msg);
-   if (auth_msg->length > SECURITY_BUFFER_SIZE)
+   if (pgexporter_create_ssl_ctx(true, &ctx))
    {
-      pgexporter_log_message(auth_msg);
-      pgexporter_log_error("Security message too large: %ld", auth_msg->length);
-      goto error;
+      return AUTH_ERROR;
+   }
+
+   if (create_ssl_client(ctx, config->servers[connect->server].tls_key_file, config->servers[connect->server].tls_cert_file,
+                         config->servers[connect->server].tls_ca_file, connect->fd, &connect->ssl))
+   {
+      SSL_CTX_free(ctx);
+      return AUTH_ERROR;
+   }
+
+   connect->state = SERVER_CONNECT_HANDSHAKE;
+
+   return CONNECT_NEXT;
+}
+
+static int
+connect_handshake(struct server_connect* connect)
+{
+   int ret;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   ret = SSL_connect(connect->ssl);
+   if (ret == 1)
+   {
+      connect_startup(connect);
+      return connect->output == NULL ? AUTH_ERROR : CONNECT_NEXT;
+   }
+
+   switch (SSL_get_error(connect->ssl, ret))
+   {
+      case SSL_ERROR_WANT_READ:
+         return AUTH_WANT_READ;
+      case SSL_ERROR_WANT_WRITE:
+         return AUTH_WANT_WRITE;
+      default:
+         pgexporter_log_error("%s: TLS handshake failed", config->servers[connect->server].name);
+         return AUTH_ERROR;
    }
+}
 
-   get_auth_type(auth_msg, &auth_response);
-   pgexporter_log_trace("authenticate: auth response %d", auth_response);
+static int
+connect_exchange(struct server_connect* connect)
+{
+   int status;
+   int read_status;
+   int32_t length;
+   size_t offset = 0;
+   struct message msg;
 
-   if (auth_response == 0)
+   status = connect_flush(connect);
+   if (status != 0)
    {
-      if (auth_msg->length > SECURITY_BUFFER_SIZE)
+      return status;
+   }
+
+   read_status = connect_read(connect);
+
+   /* The messages that did arrive are handled, even if the server closed the connection after them */
+   status = CONNECT_NEXT;
+   while (status == CONNECT_NEXT && connect->input_length - offset >= 5)
+   {
+      length = pgexporter_read_int32(connect->input + offset + 1);
+      if (length < 4 || length > DEFAULT_BUFFER_SIZE)
       {
-         pgexporter_log_message(auth_msg);
-         pgexporter_log_error("Security message too large: %ld", auth_msg->length);
-         goto error;
+         return AUTH_ERROR;
       }
 
-      security_lengths[auth_index] = auth_msg->length;
-      memcpy(&security_messages[auth_index], auth_msg->data, auth_msg->length);
+      if (connect->input_length - offset < (size_t)length + 1)
+      {
+         break;
+      }
+
+      msg.kind = pgexporter_read_byte(connect->input + offset);
+      msg.length = length + 1;
+      msg.data = connect->input + offset;
+
+      status = connect_message(connect, &msg);
 
-      has_security = SECURITY_PASSWORD;
+      offset += length + 1;
    }
-   else
+
+   memmove(connect->input, connect->input + offset, connect->input_length - offset);
+   connect->input_length -= offset;
+
+   if (status != CONNECT_NEXT)
    {
-      goto bad_password;
+      return status;
    }
 
-   pgexporter_free_message(password_msg);
-   pgexporter_clear_message();
+   /* An answer was queued */
+   if (connect->output_length > 0)
+   {
+      return CONNECT_NEXT;
+   }
 
-   return AUTH_SUCCESS;
+   return read_status;
+}
 
-bad_password:
+static int
+connect_message(struct server_connect* connect, struct message* msg)
+{
+   char* name = NULL;
+   char* value = NULL;
+   char* field = NULL;
+   char* sqlstate = NULL;
+   char* text = NULL;
+   struct message* query = NULL;
+   struct configuration* config;
 
-   pgexporter_log_warn("Wrong password for user: %s", username);
+   config = (struct configuration*)shmem;
 
-   pgexporter_free_message(password_msg);
-   pgexporter_clear_message();
+   switch (msg->kind)
+   {
+      case 'R':
+         if (connect->state == SERVER_CONNECT_SETUP)
+         {
+            return AUTH_ERROR;
+         }
 
-   return AUTH_BAD_PASSWORD;
+         connect->state = SERVER_CONNECT_AUTH;
 
-error:
+         return connect_authentication(connect, msg);
+      case 'S':
+         name = (char*)msg->data + 5;
+         value = name + strlen(name) + 1;
+         if (value < (char*)msg->data + msg->length)
+         {
+            pgexporter_deque_add(connect->parameters, name, (uintptr_t)value, ValueString);
+         }
+         break;
+      case 'K':
+         connect->backend_pid = pgexporter_read_int32(msg->data + 5);
+         connect->backend_key = pgexporter_read_int32(msg->data + 9);
+         break;
+      case 'E':
+         for (field = (char*)msg->data + 5; field < (char*)msg->data + msg->length && *field != '\0'; field += strlen(field) + 1)
+         {
+            if (*field == 'C')
+            {
+               sqlstate = field + 1;
+            }
+            else if (*field == 'M')
+            {
+               text = field + 1;
+            }
+         }
 
-   pgexporter_free_message(password_msg);
-   pgexporter_clear_message();
+         if (connect->state == SERVER_CONNECT_SETUP)
+         {
+            /* Like a failed SET, the connection is still usable */
+            pgexporter_log_debug("%s: Setup failed: %s", config->servers[connect->server].name, text != NULL ? text : "");
+            break;
+         }
 
-   return AUTH_ERROR;
+         pgexporter_log_debug("%s: %s", config->servers[connect->server].name, text != NULL ? text : "Connection refused");
+
+         if (!connect->authenticated && sqlstate != NULL && !strcmp(sqlstate, "28P01"))
+         {
+            pgexporter_log_warn("Wrong password for user: %s", connect->username);
+            return AUTH_BAD_PASSWORD;
+         }
+
+         return AUTH_ERROR;
+      case 'Z':
+         if (!connect->authenticated)
+         {
+            return AUTH_ERROR;
+         }
+
+         if (connect->setup == NULL || connect->state == SERVER_CONNECT_SETUP)
+         {
+            return AUTH_SUCCESS;
+         }
+
+         if (pgexporter_create_query_message(connect->setup, &query) != MESSAGE_STATUS_OK || connect_queue(connect, query))
+         {
+            pgexporter_free_message(query);
+            return AUTH_ERROR;
+         }
+
+         pgexporter_free_message(query);
+
+         connect->state = SERVER_CONNECT_SETUP;
+         break;
+      default:
+         /* NoticeResponse and the results of the setup query */
+         break;
+   }
+
+   return CONNECT_NEXT;
 }
 
 static int
-server_md5(char* username, char* password, SSL* ssl, int server_fd)
+connect_authentication(struct server_connect* connect, struct message* msg)
 {
-   int status = MESSAGE_STATUS_ERROR;
-   int auth_index = 1;
-   int auth_response = -1;
+   int32_t type;
    size_t size;
    char* pwdusr = NULL;
    char* shadow = NULL;
-   char* md5_req = NULL;
    char* md5 = NULL;
+   char md5_req[36];
    char md5str[36];
-   char* salt = NULL;
-   struct message* auth_msg = NULL;
-   struct message* md5_msg = NULL;
+   struct message* response = NULL;
+   struct configuration* config;
 
-   pgexporter_log_trace("server_md5");
+   config = (struct configuration*)shmem;
 
-   if (get_salt(security_messages[0], &salt))
+   if (msg->length < 9)
    {
-      goto error;
+      return AUTH_ERROR;
    }
 
-   size = strlen(username) + strlen(password) + 1;
-   pwdusr = malloc(size);
-   memset(pwdusr, 0, size);
-
-   pgexporter_snprintf(pwdusr, size, "%s%s", password, username);
+   type = pgexporter_read_int32(msg->data + 5);
 
-   if (generate_md5(pwdusr, strlen(pwdusr), &shadow))
+   switch (type)
    {
-      goto error;
-   }
+      case SECURITY_TRUST:
+         connect->authenticated = true;
+         pgexporter_latency_observe(&config->scrape_phases[SCRAPE_PHASE_AUTH], pgexporter_monotonic_micros() - connect->connected);
+         return CONNECT_NEXT;
+      case SECURITY_PASSWORD:
+         if (pgexporter_create_auth_password_response(connect->password, &response) != MESSAGE_STATUS_OK)
+         {
+            goto error;
+         }
+         break;
+      case SECURITY_MD5:
+         if (msg->length < 13)
+         {
+            goto error;
+         }
+
+         size = strlen(connect->username) + strlen(connect->password) + 1;
+         pwdusr = calloc(1, size);
+         if (pwdusr == NULL)
+         {
+            goto error;
+         }
 
-   md5_req = malloc(36);
-   memset(md5_req, 0, 36);
-   memcpy(md5_req, shadow, 32);
-   memcpy(md5_req + 32, salt, 4);
+         pgexporter_snprintf(pwdusr, size, "%s%s", connect->password, connect->username);
 
-   if (generate_md5(md5_req, 36, &md5))
+         if (generate_md5(pwdusr, strlen(pwdusr), &shadow))
+         {
+            goto error;
+         }
+
+         memcpy(&md5_req[0], shadow, 32);
+         memcpy(&md5_req[32], msg->data + 9, 4);
+
+         if (generate_md5(&md5_req[0], 36, &md5))
+         {
+            goto error;
+         }
+
+         memset(&md5str, 0, sizeof(md5str));
+         pgexporter_snprintf(&md5str[0], 36, "md5%s", md5);
+
+         if (pgexporter_create_auth_md5_response(&md5str[0], &response) != MESSAGE_STATUS_OK)
+         {
+            goto error;
+         }
+         break;
+      case SECURITY_SCRAM256:
+         return connect_scram256_first(connect, msg);
+      case 11:
+         return connect_scram256_continue(connect, msg);
+      case 12:
+         return connect_scram256_final(connect, msg);
+      default:
+         pgexporter_log_error("%s: Unsupported authentication %d", config->servers[connect->server].name, type);
+         goto error;
+   }
+
+   if (connect_queue(connect, response))
    {
       goto error;
    }
 
-   memset(&md5str, 0, sizeof(md5str));
-   pgexporter_snprintf(&md5str[0], 36, "md5%s", md5);
+   free(pwdusr);
+   free(shadow);
+   free(md5);
+   pgexporter_free_message(response);
 
-   status = pgexporter_create_auth_md5_response(md5str, &md5_msg);
-   if (status != MESSAGE_STATUS_OK)
+   return CONNECT_NEXT;
+
+error:
+
+   free(pwdusr);
+   free(shadow);
+   free(md5);
+   pgexporter_free_message(response);
+
+   return AUTH_ERROR;
+}
+
+static int
+connect_scram256_first(struct server_connect* connect, struct message* msg)
+{
+   bool found = false;
+   char* mechanism = NULL;
+   char* client_nounce = NULL;
+   struct message* response = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   for (mechanism = (char*)msg->data + 9; !found && mechanism < (char*)msg->data + msg->length && *mechanism != '\0';
+        mechanism += strlen(mechanism) + 1)
    {
-      goto error;
+      found = !strcmp(mechanism, "SCRAM-SHA-256");
    }
 
-   status = pgexporter_write_message(ssl, server_fd, md5_msg);
-   if (status != MESSAGE_STATUS_OK)
+   if (!found)
    {
+      pgexporter_log_error("%s: SCRAM-SHA-256 is not offered", config->servers[connect->server].name);
       goto error;
    }
 
-   security_lengths[auth_index] = md5_msg->length;
-   memcpy(&security_messages[auth_index], md5_msg->data, md5_msg->length);
-   auth_index++;
-
-   status = pgexporter_read_block_message(ssl, server_fd, &auth_msg);
-   if (auth_msg->length > SECURITY_BUFFER_SIZE)
+   if (sasl_prep(connect->password, &connect->password_prep))
    {
-      pgexporter_log_message(auth_msg);
-      pgexporter_log_error("Security message too large: %ld", auth_msg->length);
       goto error;
    }
 
-   get_auth_type(auth_msg, &auth_response);
-   pgexporter_log_trace("authenticate: auth response %d", auth_response);
+   generate_nounce(&client_nounce);
 
-   if (auth_response == 0)
+   if (pgexporter_create_auth_scram256_response(client_nounce, &response) != MESSAGE_STATUS_OK)
    {
-      if (auth_msg->length > SECURITY_BUFFER_SIZE)
-      {
-         pgexporter_log_message(auth_msg);
-         pgexporter_log_error("Security message too large: %ld", auth_msg->length);
-         goto error;
-      }
-
-      security_lengths[auth_index] = auth_msg->length;
-      memcpy(&security_messages[auth_index], auth_msg->data, auth_msg->length);
-
-      has_security = SECURITY_MD5;
+      goto error;
    }
-   else
+
+   /* n=,r=... */
+   connect->client_first = strndup((char*)response->data + 26, response->length - 26);
+   if (connect->client_first == NULL || connect_queue(connect, response))
    {
-      goto bad_password;
+      goto error;
    }
 
-   free(pwdusr);
-   free(shadow);
-   free(md5_req);
-   free(md5);
-   free(salt);
-
-   pgexporter_free_message(md5_msg);
-   pgexporter_clear_message();
-
-   return AUTH_SUCCESS;
-
-bad_password:
-
-   pgexporter_log_warn("Wrong password for user: %s", username);
-
-   free(pwdusr);
-   free(shadow);
-   free(md5_req);
-   free(md5);
-   free(salt);
-
-   pgexporter_free_message(md5_msg);
-   pgexporter_clear_message();
+   free(client_nounce);
+   pgexporter_free_message(response);
 
-   return AUTH_BAD_PASSWORD;
+   return CONNECT_NEXT;
 
 error:
 
-   free(pwdusr);
-   free(shadow);
-   free(md5_req);
-   free(md5);
-   free(salt);
-
-   pgexporter_free_message(md5_msg);
-   pgexporter_clear_message();
+   free(client_nounce);
+   pgexporter_free_message(response);
 
    return AUTH_ERROR;
 }
 
 static int
-server_scram256(char* username, char* password, SSL* ssl, int server_fd)
+connect_scram256_continue(struct server_connect* connect, struct message* msg)
 {
-   int status = MESSAGE_STATUS_ERROR;
-   int auth_index = 1;
-   char* salt = NULL;
-   size_t salt_length = 0;
-   char* password_prep = NULL;
-   char* client_nounce = NULL;
    char* combined_nounce = NULL;
    char* base64_salt = NULL;
    char* iteration_string = NULL;
    char* err = NULL;
-   int iteration;
-   char* client_first_message_bare = NULL;
-   char* server_first_message = NULL;
-   char wo_proof[58];
+   unsigned char client_key[SCRAM_KEY_LENGTH];
    unsigned char* proof = NULL;
    size_t proof_length;
    char* proof_base = NULL;
    size_t proof_base_length;
-   char* base64_server_signature = NULL;
-   char* server_signature_received = NULL;
-   size_t server_signature_received_length;
-   unsigned char* server_signature_calc = NULL;
-   size_t server_signature_calc_length;
-   struct message* sasl_response = NULL;
-   struct message* sasl_continue = NULL;
-   struct message* sasl_continue_response = NULL;
-   struct message* sasl_final = NULL;
-   struct message* msg = NULL;
+   struct message* response = NULL;
+   struct configuration* config;
 
-   pgexporter_log_trace("server_scram256");
+   config = (struct configuration*)shmem;
 
-   status = sasl_prep(password, &password_prep);
-   if (status)
+   if (connect->client_first == NULL || connect->server_first != NULL)
    {
       goto error;
    }
 
-   generate_nounce(&client_nounce);
-
-   status = pgexporter_create_auth_scram256_response(client_nounce, &sasl_response);
-   if (status != MESSAGE_STATUS_OK)
+   /* r=...,s=...,i=4096 */
+   connect->server_first = strndup((char*)msg->data + 9, msg->length - 9);
+   if (connect->server_first == NULL)
    {
       goto error;
    }
 
-   security_lengths[auth_index] = sasl_response->length;
-   memcpy(&security_messages[auth_index], sasl_response->data, sasl_response->length);
-   auth_index++;
+   get_scram_attribute('r', connect->server_first, strlen(connect->server_first), &combined_nounce);
+   get_scram_attribute('s', connect->server_first, strlen(connect->server_first), &base64_salt);
+   get_scram_attribute('i', connect->server_first, strlen(connect->server_first), &iteration_string);
+   get_scram_attribute('e', connect->server_first, strlen(connect->server_first), &err);
 
-   status = pgexporter_write_message(ssl, server_fd, sasl_response);
-   if (status != MESSAGE_STATUS_OK)
+   if (err != NULL)
    {
+      pgexporter_log_error("SCRAM-SHA-256: %s", err);
       goto error;
    }
 
-   status = pgexporter_read_block_message(ssl, server_fd, &msg);
-   if (msg->length > SECURITY_BUFFER_SIZE)
+   if (combined_nounce == NULL || base64_salt == NULL || iteration_string == NULL)
    {
-      pgexporter_log_message(msg);
-      pgexporter_log_error("Security message too large: %ld", msg->length);
+      pgexporter_log_error("%s: Invalid SCRAM-SHA-256 challenge", config->servers[connect->server].name);
       goto error;
    }
 
-   sasl_continue = pgexporter_copy_message(msg);
-
-   security_lengths[auth_index] = sasl_continue->length;
-   memcpy(&security_messages[auth_index], sasl_continue->data, sasl_continue->length);
-   auth_index++;
-
-   get_scram_attribute('r', (char*)(sasl_continue->data + 9), sasl_continue->length - 9, &combined_nounce);
-   get_scram_attribute('s', (char*)(sasl_continue->data + 9), sasl_continue->length - 9, &base64_salt);
-   get_scram_attribute('i', (char*)(sasl_continue->data + 9), sasl_continue->length - 9, &iteration_string);
-   get_scram_attribute('e', (char*)(sasl_continue->data + 9), sasl_continue->length - 9, &err);
-
-   if (err != NULL)
+   if (pgexporter_base64_decode(base64_salt, strlen(base64_salt), (void**)&connect->salt, &connect->salt_length))
    {
-      pgexporter_log_error("SCRAM-SHA-256: %s", err);
       goto error;
    }
 
-   pgexporter_base64_decode(base64_salt, strlen(base64_salt), (void**)&salt, &salt_length);
-
-   iteration = atoi(iteration_string);
-
-   memset(&wo_proof[0], 0, sizeof(wo_proof));
-   pgexporter_snprintf(&wo_proof[0], sizeof(wo_proof), "c=biws,r=%s", combined_nounce);
+   connect->iterations = atoi(iteration_string);
 
-   /* n=,r=... */
-   client_first_message_bare = security_messages[1] + 26;
+   connect->wo_proof = pgexporter_append(NULL, "c=biws,r=");
+   connect->wo_proof = pgexporter_append(connect->wo_proof, combined_nounce);
 
-   /* r=...,s=...,i=4096 */
-   server_first_message = security_messages[2] + 9;
+   if (pgexporter_scram_keys(connect->username, connect->password_prep, connect->salt, connect->salt_length, connect->iterations,
+                             &client_key[0], &connect->server_key[0]))
+   {
+      goto error;
+   }
+   connect->derived = true;
 
-   if (client_proof(password_prep, salt, salt_length, iteration,
-                    client_first_message_bare, security_lengths[1] - 26,
-                    server_first_message, security_lengths[2] - 9,
-                    &wo_proof[0], strlen(wo_proof),
+   if (client_proof(NULL, NULL, 0, 0,
+                    &client_key[0], SCRAM_KEY_LENGTH,
+                    connect->client_first, strlen(connect->client_first),
+                    connect->server_first, strlen(connect->server_first),
+                    connect->wo_proof, strlen(connect->wo_proof),
                     &proof, &proof_length))
    {
       goto error;
@@ -1590,49 +1781,59 @@ server_scram256(char* username, char* password, SSL* ssl, int server_fd)
 
    pgexporter_base64_encode((char*)proof, proof_length, &proof_base, &proof_base_length);
 
-   status = pgexporter_create_auth_scram256_continue_response(&wo_proof[0], (char*)proof_base, &sasl_continue_response);
-   if (status != MESSAGE_STATUS_OK)
+   if (pgexporter_create_auth_scram256_continue_response(connect->wo_proof, proof_base, &response) != MESSAGE_STATUS_OK ||
+       connect_queue(connect, response))
    {
       goto error;
    }
 
-   security_lengths[auth_index] = sasl_continue_response->length;
-   memcpy(&security_messages[auth_index], sasl_continue_response->data, sasl_continue_response->length);
-   auth_index++;
+   free(combined_nounce);
+   free(base64_salt);
+   free(iteration_string);
+   free(proof);
+   free(proof_base);
+   pgexporter_free_message(response);
 
-   status = pgexporter_write_message(ssl, server_fd, sasl_continue_response);
-   if (status != MESSAGE_STATUS_OK)
-   {
-      goto error;
-   }
+   return CONNECT_NEXT;
 
-   status = pgexporter_read_block_message(ssl, server_fd, &msg);
-   if (msg->length > SECURITY_BUFFER_SIZE)
+error:
+
+   free(combined_nounce);
+   free(base64_salt);
+   free(iteration_string);
+   free(err);
+   free(proof);
+   free(proof_base);
+   pgexporter_free_message(response);
+
+   return AUTH_ERROR;
+}
+
+static int
+connect_scram256_final(struct server_connect* connect, struct message* msg)
+{
+   char* server_signature_received = NULL;
+   size_t server_signature_received_length;
+   unsigned char* server_signature_calc = NULL;
+   size_t server_signature_calc_length;
+
+   if (connect->wo_proof == NULL || msg->length <= 11)
    {
-      pgexporter_log_message(msg);
-      pgexporter_log_error("Security message too large: %ld", msg->length);
       goto error;
    }
 
-   security_lengths[auth_index] = msg->length;
-   memcpy(&security_messages[auth_index], msg->data, msg->length);
-   auth_index++;
-
-   if (pgexporter_extract_message('R', msg, &sasl_final))
+   /* v=... */
+   if (pgexporter_base64_decode((char*)msg->data + 11, msg->length - 11,
+                                (void**)&server_signature_received, &server_signature_received_length))
    {
       goto error;
    }
 
-   /* Get 'v' attribute */
-   base64_server_signature = sasl_final->data + 11;
-   pgexporter_base64_decode(base64_server_signature, sasl_final->length - 11,
-                            (void**)&server_signature_received, &server_signature_received_length);
-
-   if (server_signature(password_prep, salt, salt_length, iteration,
-                        NULL, 0,
-                        client_first_message_bare, security_lengths[1] - 26,
-                        server_first_message, security_lengths[2] - 9,
-                        &wo_proof[0], strlen(wo_proof),
+   if (server_signature(NULL, NULL, 0, 0,
+                        (char*)&connect->server_key[0], SCRAM_KEY_LENGTH,
+                        connect->client_first, strlen(connect->client_first),
+                        connect->server_first, strlen(connect->server_first),
+                        connect->wo_proof, strlen(connect->wo_proof),
                         &server_signature_calc, &server_signature_calc_length))
    {
       goto error;
@@ -1641,73 +1842,172 @@ server_scram256(char* username, char* password, SSL* ssl, int server_fd)
    if (server_signature_calc_length != server_signature_received_length ||
        memcmp(server_signature_received, server_signature_calc, server_signature_calc_length) != 0)
    {
-      goto bad_password;
+      pgexporter_log_warn("Wrong password for user: %s", connect->username);
+
+      free(server_signature_received);
+      free(server_signature_calc);
+
+      return AUTH_BAD_PASSWORD;
    }
 
-   has_security = SECURITY_SCRAM256;
+   free(server_signature_received);
+   free(server_signature_calc);
+
+   return CONNECT_NEXT;
+
+error:
 
-   free(salt);
-   free(err);
-   free(password_prep);
-   free(client_nounce);
-   free(combined_nounce);
-   free(base64_salt);
-   free(iteration_string);
-   free(proof);
-   free(proof_base);
    free(server_signature_received);
    free(server_signature_calc);
 
-   pgexporter_free_message(sasl_response);
-   pgexporter_free_message(sasl_continue);
-   pgexporter_free_message(sasl_continue_response);
-   pgexporter_free_message(sasl_final);
+   return AUTH_ERROR;
+}
+
+static void
+connect_startup(struct server_connect* connect)
+{
+   struct message* msg = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   /* The TLS handshake counts as part of the connect */
+   connect->connected = pgexporter_monotonic_micros();
+   pgexporter_latency_observe(&config->scrape_phases[SCRAPE_PHASE_CONNECT], connect->connected - connect->start);
+
+   connect->state = SERVER_CONNECT_STARTUP;
+
+   if (pgexporter_create_startup_message(connect->username, connect->database, &msg) == MESSAGE_STATUS_OK)
+   {
+      connect_queue(connect, msg);
+   }
+
+   pgexporter_free_message(msg);
+}
+
+static int
+connect_queue(struct server_connect* connect, struct message* msg)
+{
+   char* output = NULL;
+
+   output = (char*)realloc(connect->output, connect->output_length + msg->length);
+   if (output == NULL)
+   {
+      return 1;
+   }
+
+   memcpy(output + connect->output_length, msg->data, msg->length);
+
+   connect->output = output;
+   connect->output_length += msg->length;
+
+   return 0;
+}
+
+static int
+connect_flush(struct server_connect* connect)
+{
+   ssize_t written;
+
+   while (connect->output_offset < connect->output_length)
+   {
+      if (connect->ssl != NULL)
+      {
+         written = SSL_write(connect->ssl, connect->output + connect->output_offset, connect->output_length - connect->output_offset);
+
+         if (written <= 0)
+         {
+            switch (SSL_get_error(connect->ssl, written))
+            {
+               case SSL_ERROR_WANT_READ:
+                  return AUTH_WANT_READ;
+               case SSL_ERROR_WANT_WRITE:
+                  return AUTH_WANT_WRITE;
+               default:
+                  return AUTH_ERROR;
+            }
+         }
+      }
+      else
+      {
+         written = write(connect->fd, connect->output + connect->output_offset, connect->output_length - connect->output_offset);
+
+         if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+         {
+            errno = 0;
+            return AUTH_WANT_WRITE;
+         }
+         else if (written <= 0)
+         {
+            return AUTH_ERROR;
+         }
+      }
 
-   return AUTH_SUCCESS;
+      connect->output_offset += written;
+   }
 
-bad_password:
+   free(connect->output);
+   connect->output = NULL;
+   connect->output_length = 0;
+   connect->output_offset = 0;
 
-   pgexporter_log_warn("Wrong password for user: %s", username);
+   return 0;
+}
 
-   free(salt);
-   free(err);
-   free(password_prep);
-   free(client_nounce);
-   free(combined_nounce);
-   free(base64_salt);
-   free(iteration_string);
-   free(proof);
-   free(proof_base);
-   free(server_signature_received);
-   free(server_signature_calc);
+static int
+connect_read(struct server_connect* connect)
+{
+   char* input = NULL;
+   ssize_t numbytes;
 
-   pgexporter_free_message(sasl_response);
-   pgexporter_free_message(sasl_continue);
-   pgexporter_free_message(sasl_continue_response);
-   pgexporter_free_message(sasl_final);
+   while (true)
+   {
+      if (connect->input_size - connect->input_length < DEFAULT_BUFFER_SIZE)
+      {
+         input = (char*)realloc(connect->input, connect->input_length + DEFAULT_BUFFER_SIZE);
+         if (input == NULL)
+         {
+            return AUTH_ERROR;
+         }
 
-   return AUTH_BAD_PASSWORD;
+         connect->input = input;
+         connect->input_size = connect->input_length + DEFAULT_BUFFER_SIZE;
+      }
 
-error:
+      if (connect->ssl != NULL)
+      {
+         numbytes = SSL_read(connect->ssl, connect->input + connect->input_length, connect->input_size - connect->input_length);
 
-   free(salt);
-   free(err);
-   free(password_prep);
-   free(client_nounce);
-   free(combined_nounce);
-   free(base64_salt);
-   free(iteration_string);
-   free(proof);
-   free(proof_base);
-   free(server_signature_received);
-   free(server_signature_calc);
+         if (numbytes <= 0)
+         {
+            switch (SSL_get_error(connect->ssl, numbytes))
+            {
+               case SSL_ERROR_WANT_READ:
+                  return AUTH_WANT_READ;
+               case SSL_ERROR_WANT_WRITE:
+                  return AUTH_WANT_WRITE;
+               default:
+                  return AUTH_ERROR;
+            }
+         }
+      }
+      else
+      {
+         numbytes = read(connect->fd, connect->input + connect->input_length, connect->input_size - connect->input_length);
 
-   pgexporter_free_message(sasl_response);
-   pgexporter_free_message(sasl_continue);
-   pgexporter_free_message(sasl_continue_response);
-   pgexporter_free_message(sasl_final);
+         if (numbytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+         {
+            errno = 0;
+            return AUTH_WANT_READ;
+         }
+         else if (numbytes <= 0)
+         {
+            return AUTH_ERROR;
+         }
+      }
 
-   return AUTH_ERROR;
+      connect->input_length += numbytes;
+   }
 }
 
 static char*
@@ -2134,6 +2434,7 @@ error:
 
 static int
 client_proof(char* password, char* salt, int salt_length, int iterations,
+             unsigned char* client_key, int client_key_length,
              char* client_first_message_bare, size_t client_first_message_bare_length,
              char* server_first_message, size_t server_first_message_length,
              char* client_final_message_wo_proof, size_t client_final_message_wo_proof_length,
@@ -2149,6 +2450,7 @@ client_proof(char* password, char* salt, int salt_length, int iterations,
    unsigned char* c_s = NULL;
    size_t length;
    unsigned char* r = NULL;
+   bool do_free = true;
    EVP_MAC_CTX* ctx = NULL;
    EVP_MAC* mac = NULL;
    mac = EVP_MAC_fetch(NULL, "HMAC", NULL);
@@ -2164,14 +2466,23 @@ client_proof(char* password, char* salt, int salt_length, int iterations,
    OSSL_PARAM params[2];
    params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0);
    params[1] = OSSL_PARAM_construct_end();
-   if (salted_password(password, salt, salt_length, iterations, &s_p, &s_p_length))
+   if (password != NULL)
    {
-      goto error;
-   }
+      if (salted_password(password, salt, salt_length, iterations, &s_p, &s_p_length))
+      {
+         goto error;
+      }
 
-   if (salted_password_key(s_p, s_p_length, "Client Key", &c_k, &c_k_length))
+      if (salted_password_key(s_p, s_p_length, "Client Key", &c_k, &c_k_length))
+      {
+         goto error;
+      }
+   }
+   else
    {
-      goto error;
+      do_free = false;
+      c_k = client_key;
+      c_k_length = client_key_length;
    }
 
    if (stored_key(c_k, c_k_length, &s_k, &s_k_length))
@@ -2234,7 +2545,10 @@ client_proof(char* password, char* salt, int salt_length, int iterations,
    EVP_MAC_free(mac);
 
    free(s_p);
-   free(c_k);
+   if (do_free)
+   {
+      free(c_k);
+   }
    free(s_k);
    free(c_s);
 
@@ -2254,7 +2568,10 @@ error:
    }
 
    free(s_p);
-   free(c_k);
+   if (do_free)
+   {
+      free(c_k);
+   }
    free(s_k);
    free(c_s);
 
@@ -2494,6 +2811,50 @@ error:
 
    return 1;
 }
+
+static void
+evict_scram_keys(char* username, char* salt, int salt_length, int iterations)
+{
+   struct scram_keys* keys = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (config == NULL || salt == NULL)
+   {
+      return;
+   }
+
+   lock_scram_keys(config);
+
+   for (int i = 0; i < NUMBER_OF_SCRAM_KEYS; i++)
+   {
+      keys = &config->scram_keys[i];
+
+      if (keys->salt_length == salt_length && keys->iterations == iterations &&
+          !strcmp(keys->username, username) && !memcmp(keys->salt, salt, salt_length))
+      {
+         memset(keys, 0, sizeof(struct scram_keys));
+      }
+   }
+
+   atomic_store(&config->scram_keys_lock, STATE_FREE);
+}
+
+static void
+lock_scram_keys(struct configuration* config)
+{
+   signed char isfree;
+
+retry:
+   isfree = STATE_FREE;
+
+   if (!atomic_compare_exchange_strong(&config->scram_keys_lock, &isfree, STATE_IN_USE))
+   {
+      SLEEP_AND_GOTO(1000L, retry)
+   }
+}
+
 static int
 server_signature(char* password, char* salt, int salt_length, int iterations,
                  char* s_key, int s_key_length,
@@ -2750,10 +3111,9 @@ error:
    return 1;
 }
 
-int
-pgexporter_create_ssl_server(SSL_CTX* ctx, char* key, char* cert, char* root, int socket, SSL** ssl)
+static int
+load_server_certificates(SSL_CTX* ctx, char* key, char* cert, char* root)
 {
-   SSL* s = NULL;
    STACK_OF(X509_NAME)* root_cert_list = NULL;
 
    if (strlen(cert) == 0)
@@ -2825,6 +3185,23 @@ pgexporter_create_ssl_server(SSL_CTX* ctx, char* key, char* cert, char* root, in
       SSL_CTX_set_client_CA_list(ctx, root_cert_list);
    }
 
+   return 0;
+
+error:
+
+   return 1;
+}
+
+int
+pgexporter_create_ssl_server(SSL_CTX* ctx, char* key, char* cert, char* root, int socket, SSL** ssl)
+{
+   SSL* s = NULL;
+
+   if (load_server_certificates(ctx, key, cert, root))
+   {
+      goto error;
+   }
+
    s = SSL_new(ctx);
 
    if (s == NULL)
@@ -2849,44 +3226,205 @@ error:
 }
 
 int
-pgexporter_extract_server_parameters(struct deque** server_parameters)
+pgexporter_create_ssl_server_ctx(char* key, char* cert, char* root, struct ticket_keys* ticket_keys, SSL_CTX** ctx)
 {
-   int i;
-   char* data = NULL;
-   ssize_t data_length;
-   size_t offset;
-   char* name = NULL;
-   char* value = NULL;
-   struct message* msg = NULL;
-   struct deque* sp = NULL;
-   *server_parameters = NULL;
+   SSL_CTX* c = NULL;
+
+   if (pgexporter_create_ssl_ctx(false, &c))
+   {
+      goto error;
+   }
+
+   if (load_server_certificates(c, key, cert, root))
+   {
+      goto error;
+   }
+
+   /* Resumed sessions must belong to this endpoint, also when client certificates are verified */
+   if (SSL_CTX_set_session_id_context(c, (const unsigned char*)"pgexporter", strlen("pgexporter")) != 1)
+   {
+      goto error;
+   }
+
+   if (ticket_keys != NULL)
+   {
+      /* Every process encrypts and decrypts the tickets with the shared keys, which rotate */
+      SSL_CTX_set_app_data(c, ticket_keys);
+
+      if (SSL_CTX_set_tlsext_ticket_key_evp_cb(c, ticket_key_cb) != 1)
+      {
+         pgexporter_log_error("Couldn't set the TLS session ticket keys");
+         goto error;
+      }
+
+      /* A ticket is decrypted by the current or the previous key for at least a rotation */
+      SSL_CTX_set_timeout(c, TLS_TICKET_KEY_ROTATION);
+      SSL_CTX_clear_options(c, SSL_OP_NO_TICKET);
+   }
+
+   *ctx = c;
+
+   return 0;
 
-   if (pgexporter_deque_create(false, &sp))
+error:
+
+   if (c != NULL)
+   {
+      SSL_CTX_free(c);
+   }
+
+   return 1;
+}
+
+int
+pgexporter_rotate_ticket_keys(struct ticket_keys* ticket_keys)
+{
+   int next;
+   unsigned char key[TLS_TICKET_KEYS_LENGTH];
+
+   next = 1 - atomic_load(&ticket_keys->current);
+
+   if (RAND_bytes(key, TLS_TICKET_KEYS_LENGTH) != 1)
    {
+      pgexporter_log_error("Couldn't generate the TLS session ticket keys");
       return 1;
    }
 
-   for (i = 0; i < NUMBER_OF_SECURITY_MESSAGES; ++i)
+   /* Other processes may still decrypt with the previous key, so they see the write */
+   atomic_fetch_add(&ticket_keys->sequence[next], 1);
+   atomic_thread_fence(memory_order_release);
+
+   memcpy(ticket_keys->keys[next], key, TLS_TICKET_KEYS_LENGTH);
+
+   atomic_thread_fence(memory_order_release);
+   atomic_fetch_add(&ticket_keys->sequence[next], 1);
+
+   atomic_store(&ticket_keys->current, next);
+
+   OPENSSL_cleanse(key, sizeof(key));
+
+   return 0;
+}
+
+int
+pgexporter_create_ssl_server_session(SSL_CTX* ctx, int socket, SSL** ssl)
+{
+   SSL* s = NULL;
+
+   if (ctx == NULL)
+   {
+      goto error;
+   }
+
+   s = SSL_new(ctx);
+
+   if (s == NULL)
+   {
+      goto error;
+   }
+
+   /* pgexporter_close_ssl() releases a reference on the context as well */
+   SSL_CTX_up_ref(ctx);
+
+   if (SSL_set_fd(s, socket) == 0)
+   {
+      goto error;
+   }
+
+   *ssl = s;
+
+   return 0;
+
+error:
+
+   pgexporter_close_ssl(s);
+
+   return 1;
+}
+
+static void
+ticket_key_copy(struct ticket_keys* ticket_keys, int index, unsigned char* key)
+{
+   unsigned int sequence;
+
+   for (;;)
    {
-      if ((data_length = security_lengths[i]) > 0)
+      sequence = atomic_load(&ticket_keys->sequence[index]);
+      if (sequence & 1)
       {
-         data = &security_messages[i][0];
-         offset = 0;
+         continue;
+      }
 
-         while (offset < (size_t)data_length)
-         {
-            offset = pgexporter_extract_message_offset(offset, data, &msg);
-            if (msg->kind == 'S')
-            {
-               name = pgexporter_read_string(msg->data + 5); // 1 byte for kind + 4 bytes for length
-               value = pgexporter_read_string(msg->data + strlen(name) + 6);
-               pgexporter_deque_add(sp, name, (uintptr_t)value, ValueString);
-            }
-            pgexporter_free_message(msg);
-         }
+      memcpy(key, ticket_keys->keys[index], TLS_TICKET_KEYS_LENGTH);
+
+      atomic_thread_fence(memory_order_acquire);
+
+      if (atomic_load(&ticket_keys->sequence[index]) == sequence)
+      {
+         return;
       }
    }
+}
 
-   *server_parameters = sp;
-   return 0;
+static int
+ticket_key_cb(SSL* ssl, unsigned char* key_name, unsigned char* iv, EVP_CIPHER_CTX* cipher, EVP_MAC_CTX* mac, int enc)
+{
+   int current;
+   int ret = 1;
+   unsigned char key[TLS_TICKET_KEYS_LENGTH];
+   OSSL_PARAM params[3];
+   struct ticket_keys* ticket_keys = NULL;
+
+   ticket_keys = (struct ticket_keys*)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+   current = atomic_load(&ticket_keys->current);
+
+   /* The keys are copied, a rotation in another process can write them at any time */
+   ticket_key_copy(ticket_keys, current, key);
+
+   if (enc)
+   {
+      if (RAND_bytes(iv, EVP_CIPHER_get_iv_length(EVP_aes_256_cbc())) != 1)
+      {
+         ret = -1;
+         goto done;
+      }
+
+      memcpy(key_name, key, 16);
+   }
+   else if (memcmp(key_name, key, 16))
+   {
+      ticket_key_copy(ticket_keys, 1 - current, key);
+
+      if (memcmp(key_name, key, 16))
+      {
+         /* The key has been rotated out, so the handshake is a full one */
+         ret = 0;
+         goto done;
+      }
+
+      /* Issue a ticket with the current key */
+      ret = 2;
+   }
+
+   params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key + 16, 32);
+   params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0);
+   params[2] = OSSL_PARAM_construct_end();
+
+   if (EVP_MAC_CTX_set_params(mac, params) != 1)
+   {
+      ret = -1;
+      goto done;
+   }
+
+   if (EVP_CipherInit_ex(cipher, EVP_aes_256_cbc(), NULL, key + 48, iv, enc) != 1)
+   {
+      ret = -1;
+      goto done;
+   }
+
+done:
+
+   OPENSSL_cleanse(key, sizeof(key));
+
+   return ret;
 }
@@ -37,6 +37,7 @@
 
 void* shmem = NULL;
 void* prometheus_cache_shmem = NULL;
+void* prometheus_snapshot_shmem = NULL;
 void* bridge_cache_shmem = NULL;
 void* bridge_json_cache_shmem = NULL;
 
@@ -80,8 +81,8 @@ pgexporter_create_shared_memory(size_t size, unsigned char hp, void** shmem)
       }
    }
 
-   memset(s, 0, size);
-
+   /* Anonymous mappings are zero filled, so the pages are only touched
+    * when they are used */
    *shmem = s;
 
    return 0;
@@ -67,6 +67,8 @@
 #define EVBACKEND_IOURING 0x00000080U
 #endif
 
+#define STRING_BUILDER_CAPACITY 256
+
 extern char** environ;
 #ifdef HAVE_LINUX
 static bool env_changed = false;
@@ -75,10 +77,15 @@ static char** proc_title_environ = NULL;
 static int proc_title_environ_size = 0;
 #endif
 
+/* The upper bounds of the latency buckets in microseconds */
+static const int64_t latency_buckets[NUMBER_OF_LATENCY_BUCKETS] = {1000, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 5000000};
+
 static int string_compare(const void* a, const void* b);
 
 static bool is_wal_file(char* file);
 
+static int string_builder_reserve(struct string_builder* sb, size_t size);
+
 int32_t
 pgexporter_get_request(struct message* msg)
 {
@@ -1124,6 +1131,181 @@ pgexporter_append_char(char* orig, char c)
    return orig;
 }
 
+int
+pgexporter_string_builder_create(size_t capacity, struct string_builder** sb)
+{
+   struct string_builder* s = NULL;
+
+   *sb = NULL;
+
+   s = (struct string_builder*)malloc(sizeof(struct string_builder));
+   if (s == NULL)
+   {
+      goto error;
+   }
+
+   s->length = 0;
+   s->capacity = capacity > 0 ? capacity : STRING_BUILDER_CAPACITY;
+   s->buffer = (char*)malloc(s->capacity);
+
+   if (s->buffer == NULL)
+   {
+      goto error;
+   }
+
+   s->buffer[0] = '\0';
+
+   *sb = s;
+
+   return 0;
+
+error:
+
+   free(s);
+
+   return 1;
+}
+
+int
+pgexporter_string_builder_append(struct string_builder* sb, char* s)
+{
+   if (s == NULL)
+   {
+      return 0;
+   }
+
+   return pgexporter_string_builder_append_length(sb, s, strlen(s));
+}
+
+int
+pgexporter_string_builder_append_length(struct string_builder* sb, char* s, size_t length)
+{
+   if (string_builder_reserve(sb, length))
+   {
+      return 1;
+   }
+
+   memcpy(sb->buffer + sb->length, s, length);
+   sb->length += length;
+   sb->buffer[sb->length] = '\0';
+
+   return 0;
+}
+
+int
+pgexporter_string_builder_append_char(struct string_builder* sb, char c)
+{
+   if (string_builder_reserve(sb, 1))
+   {
+      return 1;
+   }
+
+   sb->buffer[sb->length++] = c;
+   sb->buffer[sb->length] = '\0';
+
+   return 0;
+}
+
+int
+pgexporter_string_builder_append_int(struct string_builder* sb, int64_t i)
+{
+   char number[21];
+   int length;
+
+   length = snprintf(&number[0], sizeof(number), "%" PRId64, i);
+
+   return pgexporter_string_builder_append_length(sb, &number[0], length);
+}
+
+int
+pgexporter_string_builder_append_escaped(struct string_builder* sb, char* s)
+{
+   size_t start = 0;
+   size_t i = 0;
+
+   if (s == NULL)
+   {
+      return 0;
+   }
+
+   /* Copy the runs between the characters that need an escape in one go */
+   for (; s[i] != '\0'; i++)
+   {
+      if (s[i] == '\\' || s[i] == '"' || s[i] == '\n')
+      {
+         if (pgexporter_string_builder_append_length(sb, s + start, i - start) ||
+             pgexporter_string_builder_append_char(sb, '\\') ||
+             pgexporter_string_builder_append_char(sb, s[i] == '\n' ? 'n' : s[i]))
+         {
+            return 1;
+         }
+
+         start = i + 1;
+      }
+   }
+
+   return pgexporter_string_builder_append_length(sb, s + start, i - start);
+}
+
+char*
+pgexporter_string_builder_copy(struct string_builder* sb)
+{
+   char* copy = NULL;
+
+   if (sb == NULL || sb->length == 0)
+   {
+      return NULL;
+   }
+
+   copy = (char*)malloc(sb->length + 1);
+   if (copy != NULL)
+   {
+      memcpy(copy, sb->buffer, sb->length + 1);
+   }
+
+   return copy;
+}
+
+char*
+pgexporter_string_builder_release(struct string_builder* sb)
+{
+   char* buffer = NULL;
+
+   if (sb == NULL)
+   {
+      return NULL;
+   }
+
+   if (sb->length > 0)
+   {
+      buffer = sb->buffer;
+      sb->buffer = NULL;
+   }
+
+   pgexporter_string_builder_destroy(sb);
+
+   return buffer;
+}
+
+void
+pgexporter_string_builder_reset(struct string_builder* sb)
+{
+   sb->length = 0;
+   sb->buffer[0] = '\0';
+}
+
+void
+pgexporter_string_builder_destroy(struct string_builder* sb)
+{
+   if (sb == NULL)
+   {
+      return;
+   }
+
+   free(sb->buffer);
+   free(sb);
+}
+
 char*
 pgexporter_indent(char* str, char* tag, int indent)
 {
@@ -3525,6 +3707,41 @@ pgexporter_time_format(pgexporter_time_t t, enum pgexporter_time_format_t fmt, c
    return 0;
 }
 
+int64_t
+pgexporter_monotonic_micros(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void
+pgexporter_latency_observe(struct latency_histogram* histogram, int64_t duration)
+{
+   int bucket = 0;
+
+   if (duration < 0)
+   {
+      duration = 0;
+   }
+
+   while (bucket < NUMBER_OF_LATENCY_BUCKETS && duration > latency_buckets[bucket])
+   {
+      bucket++;
+   }
+
+   atomic_fetch_add(&histogram->buckets[bucket], 1);
+   atomic_fetch_add(&histogram->sum, (unsigned long)duration);
+}
+
+int64_t
+pgexporter_latency_bucket(int bucket)
+{
+   return latency_buckets[bucket];
+}
+
 #ifdef HAVE_LINUX
 void
 pgexporter_free_proc_title(void)
@@ -3546,3 +3763,34 @@ pgexporter_cleanse(void* data, size_t size)
       OPENSSL_cleanse(data, size);
    }
 }
+
+static int
+string_builder_reserve(struct string_builder* sb, size_t size)
+{
+   size_t capacity;
+   char* buffer = NULL;
+
+   if (sb->length + size + 1 <= sb->capacity)
+   {
+      return 0;
+   }
+
+   /* Doubling keeps the total copying linear in the final length */
+   capacity = sb->capacity;
+   while (capacity < sb->length + size + 1)
+   {
+      capacity *= 2;
+   }
+
+   buffer = (char*)realloc(sb->buffer, capacity);
+   if (buffer == NULL)
+   {
+      pgexporter_log_error("realloc failed for string builder");
+      return 1;
+   }
+
+   sb->buffer = buffer;
+   sb->capacity = capacity;
+
+   return 0;
+}
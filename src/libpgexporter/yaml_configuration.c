@@ -29,9 +29,10 @@
 /* pgexporter */
 #include <pgexporter.h>
 #include <art.h>
+#include <catalog.h>
+#include <configuration.h>
 #include <extension.h>
 #include <ext_query_alts.h>
-#include <internal.h>
 #include <logging.h>
 #include <pg_query_alts.h>
 #include <shmem.h>
@@ -44,12 +45,27 @@
 /* system */
 #include <yaml.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
-static int pgexporter_read_yaml(struct prometheus* prometheus, int prometheus_idx, char* filename, int* number_of_metrics);
+#define STAMP_OFFSET_BASIS 14695981039346656037ULL
+#define STAMP_PRIME        1099511628211ULL
+
+#define CACHE_MAGIC  0x50474543
+#define CACHE_FORMAT 1
+#define CACHE_NULL   UINT32_MAX
+
+static int pgexporter_read_yaml(struct configuration* config, int prometheus_idx, char* filename, int* number_of_metrics);
 
 static int get_yaml_files(char* base, int* number_of_yaml_files, char*** files);
 static bool is_yaml_file(char* filename);
 
+static uint64_t stamp_bytes(uint64_t stamp, void* data, size_t size);
+static int stamp_file(char* filename, uint64_t* stamp);
+static int read_file(char* filename, char** data, size_t* size, uint64_t* stamp);
+
 /* YAML Parsing */
 
 /* YAML file's structure definitions */
@@ -84,6 +100,7 @@ typedef struct yaml_metric
    char* sort;
    char* collector;
    char* server;
+   char* interval;
    bool exec_on_all_dbs;
    bool optional;
 } __attribute__((aligned(64))) yaml_metric_t;
@@ -158,7 +175,23 @@ static void free_yaml_queries(yaml_query_t** queries, size_t n_queries);
 static void free_yaml_columns(yaml_column_t** columns, size_t n_columns);
 
 // Extract the meaning of the `yaml_config` and load the metrics into `prometheus`
-static int semantics_yaml(struct prometheus* prometheus, int prometheus_idx, yaml_config_t* yaml_config);
+static int semantics_yaml(struct configuration* config, int prometheus_idx, yaml_config_t* yaml_config);
+
+// Read a YAML file into `yaml_config`, from the metrics YAML cache when it is up to date
+static int read_yaml_config(struct configuration* config, char* filename, yaml_config_t* yaml_config);
+
+// Validate the `yaml_config` and load its metrics into the configuration
+static int load_yaml_config(struct configuration* config, int prometheus_idx, int* number_of_metrics, yaml_config_t* yaml_config);
+
+// The metrics YAML cache, holding the `yaml_config` of a file under the stamp of the file
+static void cache_path(struct configuration* config, char* filename, char* path);
+static int read_cache(char* path, uint64_t stamp, yaml_config_t* yaml_config);
+static int write_cache(char* path, uint64_t stamp, yaml_config_t* yaml_config);
+static void cache_write_int(FILE* file, uint32_t value);
+static void cache_write_string(FILE* file, char* str);
+static int cache_read_int(char** cursor, char* end, uint32_t* value);
+static int cache_read_count(char** cursor, char* end, size_t record_size, int* count);
+static int cache_read_string(char** cursor, char* end, char** dest);
 
 // Extension helper functions
 static struct extension_metrics* search_or_add_extension(struct configuration* config, char* extension_name);
@@ -181,7 +214,7 @@ pgexporter_read_metrics_configuration(void* shmem)
    if (pgexporter_is_file(config->metrics_path))
    {
       number_of_metrics = 0;
-      if (pgexporter_read_yaml(config->prometheus, idx_metrics, config->metrics_path, &number_of_metrics))
+      if (pgexporter_read_yaml(config, idx_metrics, config->metrics_path, &number_of_metrics))
       {
          return 1;
       }
@@ -199,7 +232,7 @@ pgexporter_read_metrics_configuration(void* shmem)
                                         "/",
                                         yaml_files[i]);
 
-         if (pgexporter_read_yaml(config->prometheus, idx_metrics, yaml_path, &number_of_metrics))
+         if (pgexporter_read_yaml(config, idx_metrics, yaml_path, &number_of_metrics))
          {
             free(yaml_path);
             yaml_path = NULL;
@@ -231,13 +264,9 @@ int
 pgexporter_read_internal_yaml_metrics(struct configuration* config, bool start)
 {
    int number_of_metrics = 0;
-   int ret;
-   FILE* internal_yaml_ptr = fmemopen(INTERNAL_YAML, strlen(INTERNAL_YAML), "r");
 
-   ret = pgexporter_read_yaml_from_file_pointer(config->prometheus, 0, &number_of_metrics, internal_yaml_ptr);
-   fclose(internal_yaml_ptr);
-
-   if (ret)
+   /* INTERNAL_YAML is parsed and validated when building */
+   if (pgexporter_catalog_load(config, 0, &number_of_metrics))
    {
       return 1;
    }
@@ -252,25 +281,614 @@ pgexporter_read_internal_yaml_metrics(struct configuration* config, bool start)
    return 0;
 }
 
+int
+pgexporter_metrics_stamp(char* metrics_path, uint64_t* stamp)
+{
+   uint64_t s = STAMP_OFFSET_BASIS;
+   int number_of_yaml_files = 0;
+   char** yaml_files = NULL;
+   char* yaml_path = NULL;
+
+   *stamp = 0;
+
+   s = stamp_bytes(s, metrics_path, strlen(metrics_path));
+
+   if (pgexporter_is_file(metrics_path))
+   {
+      if (stamp_file(metrics_path, &s))
+      {
+         goto error;
+      }
+   }
+   else if (pgexporter_is_directory(metrics_path))
+   {
+      /* Same files in the same order as pgexporter_read_metrics_configuration() */
+      get_yaml_files(metrics_path, &number_of_yaml_files, &yaml_files);
+      for (int i = 0; i < number_of_yaml_files; i++)
+      {
+         yaml_path = pgexporter_vappend(yaml_path, 3,
+                                        metrics_path,
+                                        "/",
+                                        yaml_files[i]);
+
+         if (stamp_file(yaml_path, &s))
+         {
+            goto error;
+         }
+
+         free(yaml_path);
+         yaml_path = NULL;
+      }
+   }
+
+   *stamp = s != 0 ? s : 1;
+
+   for (int i = 0; i < number_of_yaml_files; i++)
+   {
+      free(yaml_files[i]);
+   }
+   free(yaml_files);
+
+   return 0;
+
+error:
+   free(yaml_path);
+   for (int i = 0; i < number_of_yaml_files; i++)
+   {
+      free(yaml_files[i]);
+   }
+   free(yaml_files);
+
+   return 1;
+}
+
+static uint64_t
+stamp_bytes(uint64_t stamp, void* data, size_t size)
+{
+   unsigned char* d = (unsigned char*)data;
+
+   /* FNV-1a */
+   for (size_t i = 0; i < size; i++)
+   {
+      stamp ^= d[i];
+      stamp *= STAMP_PRIME;
+   }
+
+   return stamp;
+}
+
+static int
+stamp_file(char* filename, uint64_t* stamp)
+{
+   char* data = NULL;
+   size_t size = 0;
+
+   if (read_file(filename, &data, &size, stamp))
+   {
+      return 1;
+   }
+
+   free(data);
+
+   return 0;
+}
+
 static int
-pgexporter_read_yaml(struct prometheus* prometheus, int prometheus_idx, char* filename, int* number_of_metrics)
+read_file(char* filename, char** data, size_t* size, uint64_t* stamp)
 {
-   FILE* file;
+   struct stat st;
+   FILE* file = NULL;
+   char* d = NULL;
+   size_t n = 0;
+   int64_t mtime;
+   int64_t length;
+
+   *data = NULL;
+   *size = 0;
 
    file = fopen(filename, "r");
    if (file == NULL)
    {
-      pgexporter_log_error("pgexporter: fopen error %s", strerror(errno));
-      return 1;
+      goto error;
+   }
+
+   if (fstat(fileno(file), &st))
+   {
+      goto error;
+   }
+
+   mtime = (int64_t)st.st_mtime;
+   length = (int64_t)st.st_size;
+
+   d = (char*)malloc(st.st_size + 1);
+   if (d == NULL)
+   {
+      goto error;
    }
 
-   int ret = pgexporter_read_yaml_from_file_pointer(prometheus, prometheus_idx, number_of_metrics, file);
+   n = fread(d, 1, st.st_size, file);
+   if (n != (size_t)st.st_size || ferror(file))
+   {
+      goto error;
+   }
+   d[n] = '\0';
+
+   *stamp = stamp_bytes(*stamp, filename, strlen(filename));
+   *stamp = stamp_bytes(*stamp, &mtime, sizeof(mtime));
+   *stamp = stamp_bytes(*stamp, &length, sizeof(length));
+   *stamp = stamp_bytes(*stamp, d, n);
 
    fclose(file);
 
+   *data = d;
+   *size = n;
+
+   return 0;
+
+error:
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   free(d);
+
+   return 1;
+}
+
+static int
+pgexporter_read_yaml(struct configuration* config, int prometheus_idx, char* filename, int* number_of_metrics)
+{
+   int ret;
+   yaml_config_t yaml_config;
+
+   memset(&yaml_config, 0, sizeof(yaml_config_t));
+
+   if (read_yaml_config(config, filename, &yaml_config))
+   {
+      pgexporter_log_error("pgexporter: Error reading %s", filename);
+      return 1;
+   }
+
+   ret = load_yaml_config(config, prometheus_idx, number_of_metrics, &yaml_config);
+
+   free_yaml_config(&yaml_config);
+
    return ret;
 }
 
+static int
+read_yaml_config(struct configuration* config, char* filename, yaml_config_t* yaml_config)
+{
+   char* data = NULL;
+   size_t size = 0;
+   uint64_t stamp = STAMP_OFFSET_BASIS;
+   char path[MAX_PATH];
+   bool cache = strlen(config->metrics_yaml_cache) > 0;
+   FILE* file = NULL;
+
+   /* The parsing may differ between versions */
+   stamp = stamp_bytes(stamp, PGEXPORTER_VERSION, strlen(PGEXPORTER_VERSION));
+
+   if (read_file(filename, &data, &size, &stamp))
+   {
+      goto error;
+   }
+
+   if (cache)
+   {
+      cache_path(config, filename, &path[0]);
+
+      if (!read_cache(&path[0], stamp, yaml_config))
+      {
+         pgexporter_log_debug("Metrics YAML cache: %s from %s", filename, &path[0]);
+         free(data);
+         return 0;
+      }
+   }
+
+   /* Parse the content that was stamped. An empty file has no metrics */
+   if (size > 0)
+   {
+      file = fmemopen(data, size, "r");
+      if (file == NULL)
+      {
+         goto error;
+      }
+   }
+
+   if (parse_yaml(file, yaml_config))
+   {
+      goto error;
+   }
+
+   if (cache)
+   {
+      if (write_cache(&path[0], stamp, yaml_config))
+      {
+         pgexporter_log_warn("Metrics YAML cache: Could not write %s for %s", &path[0], filename);
+      }
+   }
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   free(data);
+
+   return 0;
+
+error:
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   free(data);
+
+   return 1;
+}
+
+static void
+cache_path(struct configuration* config, char* filename, char* path)
+{
+   uint64_t hash;
+
+   hash = stamp_bytes(STAMP_OFFSET_BASIS, filename, strlen(filename));
+
+   pgexporter_snprintf(path, MAX_PATH, "%s/%016" PRIx64 ".cache", config->metrics_yaml_cache, hash);
+}
+
+static int
+read_cache(char* path, uint64_t stamp, yaml_config_t* yaml_config)
+{
+   char* data = NULL;
+   size_t size = 0;
+   uint64_t ignored = STAMP_OFFSET_BASIS;
+   char* cursor = NULL;
+   char* end = NULL;
+   uint32_t value;
+   uint32_t header[2];
+   uint64_t cached_stamp;
+   yaml_metric_t* metric = NULL;
+   yaml_query_t* query = NULL;
+   yaml_column_t* column = NULL;
+
+   if (read_file(path, &data, &size, &ignored))
+   {
+      return 1;
+   }
+
+   cursor = data;
+   end = data + size;
+
+   if (size < sizeof(header) + sizeof(cached_stamp))
+   {
+      goto error;
+   }
+
+   memcpy(&header[0], cursor, sizeof(header));
+   cursor += sizeof(header);
+   memcpy(&cached_stamp, cursor, sizeof(cached_stamp));
+   cursor += sizeof(cached_stamp);
+
+   if (header[0] != CACHE_MAGIC || header[1] != CACHE_FORMAT || cached_stamp != stamp)
+   {
+      goto error;
+   }
+
+   if (cache_read_int(&cursor, end, &value))
+   {
+      goto error;
+   }
+   yaml_config->default_version = (char)value;
+
+   if (cache_read_int(&cursor, end, &value))
+   {
+      goto error;
+   }
+   yaml_config->is_extension = value != 0;
+
+   if (cache_read_string(&cursor, end, &yaml_config->extension_name) ||
+       cache_read_count(&cursor, end, sizeof(yaml_metric_t), &yaml_config->n_metrics))
+   {
+      goto error;
+   }
+
+   yaml_config->metrics = (yaml_metric_t*)calloc(MAX(yaml_config->n_metrics, 1), sizeof(yaml_metric_t));
+   if (yaml_config->metrics == NULL)
+   {
+      yaml_config->n_metrics = 0;
+      goto error;
+   }
+
+   for (int i = 0; i < yaml_config->n_metrics; i++)
+   {
+      metric = &yaml_config->metrics[i];
+
+      if (cache_read_string(&cursor, end, &metric->tag) ||
+          cache_read_string(&cursor, end, &metric->sort) ||
+          cache_read_string(&cursor, end, &metric->collector) ||
+          cache_read_string(&cursor, end, &metric->server) ||
+          cache_read_string(&cursor, end, &metric->interval))
+      {
+         goto error;
+      }
+
+      if (cache_read_int(&cursor, end, &value))
+      {
+         goto error;
+      }
+      metric->exec_on_all_dbs = value != 0;
+
+      if (cache_read_int(&cursor, end, &value))
+      {
+         goto error;
+      }
+      metric->optional = value != 0;
+
+      if (cache_read_count(&cursor, end, sizeof(yaml_query_t), &metric->n_queries))
+      {
+         goto error;
+      }
+
+      metric->queries = (yaml_query_t*)calloc(MAX(metric->n_queries, 1), sizeof(yaml_query_t));
+      if (metric->queries == NULL)
+      {
+         metric->n_queries = 0;
+         goto error;
+      }
+
+      for (int j = 0; j < metric->n_queries; j++)
+      {
+         query = &metric->queries[j];
+
+         if (cache_read_int(&cursor, end, &value))
+         {
+            goto error;
+         }
+         query->is_histogram = value != 0;
+
+         if (cache_read_int(&cursor, end, &value))
+         {
+            goto error;
+         }
+         query->version = (char)value;
+
+         if (cache_read_string(&cursor, end, &query->query) ||
+             cache_read_string(&cursor, end, &query->version_str) ||
+             cache_read_count(&cursor, end, sizeof(yaml_column_t), &query->n_columns))
+         {
+            goto error;
+         }
+
+         query->columns = (yaml_column_t*)calloc(MAX(query->n_columns, 1), sizeof(yaml_column_t));
+         if (query->columns == NULL)
+         {
+            query->n_columns = 0;
+            goto error;
+         }
+
+         for (int k = 0; k < query->n_columns; k++)
+         {
+            column = &query->columns[k];
+
+            if (cache_read_string(&cursor, end, &column->name) ||
+                cache_read_string(&cursor, end, &column->description) ||
+                cache_read_string(&cursor, end, &column->type))
+            {
+               goto error;
+            }
+         }
+      }
+   }
+
+   if (cursor != end)
+   {
+      goto error;
+   }
+
+   free(data);
+
+   return 0;
+
+error:
+   free_yaml_config(yaml_config);
+   memset(yaml_config, 0, sizeof(yaml_config_t));
+   free(data);
+
+   return 1;
+}
+
+static int
+write_cache(char* path, uint64_t stamp, yaml_config_t* yaml_config)
+{
+   char temp[MAX_PATH];
+   uint32_t header[2] = {CACHE_MAGIC, CACHE_FORMAT};
+   yaml_metric_t* metric = NULL;
+   yaml_query_t* query = NULL;
+   yaml_column_t* column = NULL;
+   FILE* file = NULL;
+   int fd = -1;
+
+   /* Written aside and renamed, so a reader never sees a partial cache */
+   pgexporter_snprintf(&temp[0], sizeof(temp), "%s.%d", path, (int)getpid());
+
+   fd = open(&temp[0], O_WRONLY | O_CREAT | O_TRUNC, 0600);
+   if (fd == -1)
+   {
+      goto error;
+   }
+
+   file = fdopen(fd, "w");
+   if (file == NULL)
+   {
+      close(fd);
+      goto error;
+   }
+
+   fwrite(&header[0], sizeof(header), 1, file);
+   fwrite(&stamp, sizeof(stamp), 1, file);
+
+   cache_write_int(file, (uint32_t)(unsigned char)yaml_config->default_version);
+   cache_write_int(file, yaml_config->is_extension ? 1 : 0);
+   cache_write_string(file, yaml_config->extension_name);
+   cache_write_int(file, (uint32_t)yaml_config->n_metrics);
+
+   for (int i = 0; i < yaml_config->n_metrics; i++)
+   {
+      metric = &yaml_config->metrics[i];
+
+      cache_write_string(file, metric->tag);
+      cache_write_string(file, metric->sort);
+      cache_write_string(file, metric->collector);
+      cache_write_string(file, metric->server);
+      cache_write_string(file, metric->interval);
+      cache_write_int(file, metric->exec_on_all_dbs ? 1 : 0);
+      cache_write_int(file, metric->optional ? 1 : 0);
+      cache_write_int(file, (uint32_t)metric->n_queries);
+
+      for (int j = 0; j < metric->n_queries; j++)
+      {
+         query = &metric->queries[j];
+
+         cache_write_int(file, query->is_histogram ? 1 : 0);
+         cache_write_int(file, (uint32_t)(unsigned char)query->version);
+         cache_write_string(file, query->query);
+         cache_write_string(file, query->version_str);
+         cache_write_int(file, (uint32_t)query->n_columns);
+
+         for (int k = 0; k < query->n_columns; k++)
+         {
+            column = &query->columns[k];
+
+            cache_write_string(file, column->name);
+            cache_write_string(file, column->description);
+            cache_write_string(file, column->type);
+         }
+      }
+   }
+
+   if (ferror(file))
+   {
+      goto error;
+   }
+
+   if (fclose(file))
+   {
+      file = NULL;
+      goto error;
+   }
+   file = NULL;
+
+   if (rename(&temp[0], path))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   unlink(&temp[0]);
+
+   return 1;
+}
+
+static void
+cache_write_int(FILE* file, uint32_t value)
+{
+   fwrite(&value, sizeof(value), 1, file);
+}
+
+static void
+cache_write_string(FILE* file, char* str)
+{
+   uint32_t length;
+
+   if (str == NULL)
+   {
+      cache_write_int(file, CACHE_NULL);
+      return;
+   }
+
+   length = (uint32_t)strlen(str);
+
+   cache_write_int(file, length);
+   fwrite(str, 1, length, file);
+}
+
+static int
+cache_read_int(char** cursor, char* end, uint32_t* value)
+{
+   if ((size_t)(end - *cursor) < sizeof(uint32_t))
+   {
+      return 1;
+   }
+
+   memcpy(value, *cursor, sizeof(uint32_t));
+   *cursor += sizeof(uint32_t);
+
+   return 0;
+}
+
+static int
+cache_read_count(char** cursor, char* end, size_t record_size, int* count)
+{
+   uint32_t value;
+
+   if (cache_read_int(cursor, end, &value))
+   {
+      return 1;
+   }
+
+   /* Every record takes at least one integer, so a larger count is corrupt */
+   if (value > (size_t)(end - *cursor) / sizeof(uint32_t) || value > INT32_MAX / record_size)
+   {
+      return 1;
+   }
+
+   *count = (int)value;
+
+   return 0;
+}
+
+static int
+cache_read_string(char** cursor, char* end, char** dest)
+{
+   uint32_t length;
+
+   *dest = NULL;
+
+   if (cache_read_int(cursor, end, &length))
+   {
+      return 1;
+   }
+
+   if (length == CACHE_NULL)
+   {
+      return 0;
+   }
+
+   if (length > (size_t)(end - *cursor))
+   {
+      return 1;
+   }
+
+   *dest = (char*)malloc(length + 1);
+   if (*dest == NULL)
+   {
+      return 1;
+   }
+
+   memcpy(*dest, *cursor, length);
+   (*dest)[length] = '\0';
+   *cursor += length;
+
+   return 0;
+}
+
 static int
 pgexporter_validate_yaml_metrics(struct configuration* config, yaml_config_t* yaml_config)
 {
@@ -463,11 +1081,10 @@ error:
 }
 
 int
-pgexporter_read_yaml_from_file_pointer(struct prometheus* prometheus, int prometheus_idx, int* number_of_metrics, FILE* file)
+pgexporter_read_yaml_from_file_pointer(struct configuration* config, int prometheus_idx, int* number_of_metrics, FILE* file)
 {
    int ret = 0;
    yaml_config_t yaml_config;
-   struct configuration* config = (struct configuration*)shmem;
 
    memset(&yaml_config, 0, sizeof(yaml_config_t));
 
@@ -477,37 +1094,42 @@ pgexporter_read_yaml_from_file_pointer(struct prometheus* prometheus, int promet
       goto end;
    }
 
-   *number_of_metrics += yaml_config.n_metrics;
+   ret = load_yaml_config(config, prometheus_idx, number_of_metrics, &yaml_config);
+
+end:
+   free_yaml_config(&yaml_config);
+
+   return ret;
+}
+
+static int
+load_yaml_config(struct configuration* config, int prometheus_idx, int* number_of_metrics, yaml_config_t* yaml_config)
+{
+   *number_of_metrics += yaml_config->n_metrics;
 
    /* Validate before inserting them */
-   if (pgexporter_validate_yaml_metrics(config, &yaml_config))
+   if (pgexporter_validate_yaml_metrics(config, yaml_config))
    {
       pgexporter_log_error("YAML contains duplicate metric names");
-      ret = 1;
-      goto end;
+      return 1;
    }
 
-   if (yaml_config.is_extension)
+   if (yaml_config->is_extension)
    {
-      if (semantics_extension_yaml(config, &yaml_config))
+      if (semantics_extension_yaml(config, yaml_config))
       {
-         ret = 1;
-         goto end;
+         return 1;
       }
    }
    else
    {
-      if (semantics_yaml(prometheus, prometheus_idx, &yaml_config))
+      if (semantics_yaml(config, prometheus_idx, yaml_config))
       {
-         ret = 1;
-         goto end;
+         return 1;
       }
    }
 
-end:
-   free_yaml_config(&yaml_config);
-
-   return ret;
+   return 0;
 }
 
 static int
@@ -835,6 +1457,20 @@ parse_metrics(yaml_parser_t* parser_ptr, yaml_event_t* event_ptr, parser_state_t
                   goto error;
                }
             }
+            else if (!strcmp(buf, "interval"))
+            {
+               if (parse_string(parser_ptr, event_ptr, state_ptr, &(*metrics)[*n_metrics].interval))
+               {
+                  goto error;
+               }
+            }
+            else if (!strcmp(buf, "ttl"))
+            {
+               if (parse_string(parser_ptr, event_ptr, state_ptr, &(*metrics)[*n_metrics].interval))
+               {
+                  goto error;
+               }
+            }
             else if (!strcmp(buf, "queries"))
             {
                if (parse_queries(parser_ptr, event_ptr, state_ptr, yaml_config, &(*metrics)[*n_metrics].queries, &(*metrics)[*n_metrics].n_queries))
@@ -1343,6 +1979,10 @@ free_yaml_metrics(yaml_metric_t** metrics, size_t n_metrics)
       {
          free((*metrics)[i].server);
       }
+      if ((*metrics)[i].interval)
+      {
+         free((*metrics)[i].interval);
+      }
       if ((*metrics)[i].queries)
       {
          free_yaml_queries(&(*metrics)[i].queries, (*metrics)[i].n_queries);
@@ -1400,10 +2040,9 @@ free_yaml_columns(yaml_column_t** columns, size_t n_columns)
 }
 
 static int
-semantics_yaml(struct prometheus* prometheus, int prometheus_idx, yaml_config_t* yaml_config)
+semantics_yaml(struct configuration* config, int prometheus_idx, yaml_config_t* yaml_config)
 {
    struct prometheus* prom = NULL;
-   struct configuration* config = (struct configuration*)shmem;
 
    for (int i = 0; i < yaml_config->n_metrics; i++)
    {
@@ -1429,7 +2068,7 @@ semantics_yaml(struct prometheus* prometheus, int prometheus_idx, yaml_config_t*
          return 1;
       }
 
-      prom = &prometheus[prometheus_idx + i];
+      prom = &config->prometheus[prometheus_idx + i];
 
       memcpy(prom->tag, yaml_config->metrics[i].tag, MIN(PROMETHEUS_LENGTH - 1, strlen(yaml_config->metrics[i].tag)));
       memcpy(prom->collector, yaml_config->metrics[i].collector, MIN(MAX_COLLECTOR_LENGTH - 1, strlen(yaml_config->metrics[i].collector)));
@@ -1471,6 +2110,12 @@ semantics_yaml(struct prometheus* prometheus, int prometheus_idx, yaml_config_t*
       prom->exec_on_all_dbs = yaml_config->metrics[i].exec_on_all_dbs;
       prom->optional = yaml_config->metrics[i].optional;
 
+      if (pgexporter_parse_time(yaml_config->metrics[i].interval, &prom->interval))
+      {
+         pgexporter_log_error("pgexporter: unexpected interval %s", yaml_config->metrics[i].interval);
+         return 1;
+      }
+
       // Queries
       for (int j = 0; j < yaml_config->metrics[i].n_queries; j++)
       {
@@ -1602,10 +2247,11 @@ int
 pgexporter_load_single_extension_yaml(char* extensions_path, char* extension_name, struct configuration* config)
 {
    char yaml_path[MAX_PATH];
-   FILE* file = NULL;
    int number_of_metrics = 0;
    int ret = 0;
-   yaml_config_t temp_config;
+   yaml_config_t yaml_config;
+
+   memset(&yaml_config, 0, sizeof(yaml_config_t));
 
    if (!extensions_path || !extension_name || !config)
    {
@@ -1623,36 +2269,33 @@ pgexporter_load_single_extension_yaml(char* extensions_path, char* extension_nam
 
    pgexporter_log_debug("Looking for extension YAML at: %s", yaml_path);
 
-   file = fopen(yaml_path, "r");
-   if (file == NULL)
+   if (!pgexporter_is_file(yaml_path))
    {
       pgexporter_log_debug("Extension YAML file not found: %s (extension: %s)",
                            yaml_path, extension_name);
       goto error;
    }
 
-   pgexporter_log_debug("Found and opened extension YAML: %s", yaml_path);
+   if (read_yaml_config(config, yaml_path, &yaml_config))
+   {
+      pgexporter_log_debug("Failed to parse extension YAML: %s (extension: %s)",
+                           yaml_path, extension_name);
+      goto error;
+   }
 
-   /* parse just enough to check extension name */
-   memset(&temp_config, 0, sizeof(yaml_config_t));
-   if (parse_yaml(file, &temp_config) == 0)
+   pgexporter_log_debug("Found and read extension YAML: %s", yaml_path);
+
+   if (yaml_config.is_extension && yaml_config.extension_name)
    {
-      if (temp_config.is_extension && temp_config.extension_name)
+      if (strcmp(extension_name, yaml_config.extension_name) != 0)
       {
-         if (strcmp(extension_name, temp_config.extension_name) != 0)
-         {
-            pgexporter_log_error("Extension name mismatch: file '%s.yaml' declares extension '%s'",
-                                 extension_name, temp_config.extension_name);
-            free_yaml_config(&temp_config);
-            goto error;
-         }
+         pgexporter_log_error("Extension name mismatch: file '%s.yaml' declares extension '%s'",
+                              extension_name, yaml_config.extension_name);
+         goto error;
       }
    }
-   free_yaml_config(&temp_config);
-   rewind(file);
 
-   ret = pgexporter_read_yaml_from_file_pointer(NULL, 0, &number_of_metrics, file);
-   if (ret != 0)
+   if (load_yaml_config(config, 0, &number_of_metrics, &yaml_config))
    {
       pgexporter_log_debug("Failed to parse extension YAML: %s (extension: %s)",
                            yaml_path, extension_name);
@@ -1662,14 +2305,11 @@ pgexporter_load_single_extension_yaml(char* extensions_path, char* extension_nam
    pgexporter_log_debug("Successfully loaded %d metrics from extension YAML: %s",
                         number_of_metrics, extension_name);
 
-   fclose(file);
+   free_yaml_config(&yaml_config);
    return 0;
 
 error:
-   if (file != NULL)
-   {
-      fclose(file);
-   }
+   free_yaml_config(&yaml_config);
    return 1;
 }
 
@@ -1741,6 +2381,12 @@ semantics_extension_yaml(struct configuration* config, yaml_config_t* yaml_confi
          return 1;
       }
 
+      if (pgexporter_parse_time(yaml_config->metrics[i].interval, &prom->interval))
+      {
+         pgexporter_log_error("pgexporter: unexpected interval %s", yaml_config->metrics[i].interval);
+         return 1;
+      }
+
       for (int j = 0; j < yaml_config->metrics[i].n_queries; j++)
       {
          struct ext_query_alts* new_query = NULL;
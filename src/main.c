@@ -37,6 +37,7 @@
 #include <extension.h>
 #include <ext_query_alts.h>
 #include <fips.h>
+#include <http.h>
 #include <internal.h>
 #include <json.h>
 #include <logging.h>
@@ -62,6 +63,7 @@
 #include <ev.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -84,6 +86,17 @@
 
 #define MAX_FDS 64
 
+#define HTTP_LISTENER_METRICS     0
+#define HTTP_LISTENER_CONSOLE     1
+#define HTTP_LISTENER_BRIDGE      2
+#define HTTP_LISTENER_BRIDGE_JSON 3
+
+#define COLLECTOR_MIN_UPTIME        10
+#define COLLECTOR_MAX_RESTART_DELAY 60
+
+#define HTTP_WORKER_MIN_UPTIME        10
+#define HTTP_WORKER_MAX_RESTART_DELAY 60
+
 static void accept_mgt_cb(struct ev_loop* loop, struct ev_io* watcher, int revents);
 static void accept_transfer_cb(struct ev_loop* loop, struct ev_io* watcher, int revents);
 static void accept_metrics_cb(struct ev_loop* loop, struct ev_io* watcher, int revents);
@@ -95,6 +108,7 @@ static void shutdown_cb(struct ev_loop* loop, ev_signal* w, int revents);
 static void reload_cb(struct ev_loop* loop, ev_signal* w, int revents);
 static void coredump_cb(struct ev_loop* loop, ev_signal* w, int revents);
 static void sigchld_cb(struct ev_loop* loop, ev_signal* w, int revents);
+static void rotate_ticket_keys_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents);
 static bool accept_fatal(int error);
 static bool reload_configuration(void);
 static int create_pidfile(void);
@@ -102,6 +116,24 @@ static void remove_pidfile(void);
 static int create_lockfile(int port);
 static void remove_lockfile(int port);
 static void shutdown_ports(bool remove);
+static void start_collector(void);
+static void shutdown_collector(bool wait);
+static bool http_worker_pool(void);
+static void http_accept_watchers(bool active);
+static void start_http_workers(void);
+static void start_http_worker(int slot);
+static void shutdown_http_workers(void);
+static void resize_http_workers(void);
+static void http_worker(void);
+static void http_worker_listen(struct pollfd* fds, int* types, nfds_t* number_of_fds, int* sockets, int length, int type);
+static int http_worker_serve(int type, int listener);
+static void http_worker_shutdown_cb(int signum);
+static void http_worker_exit_cb(struct ev_loop* loop, struct ev_child* watcher, int revents);
+static void http_worker_restart_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents);
+static void conf_set_exit_cb(struct ev_loop* loop, struct ev_child* watcher, int revents);
+static void collector_exit_cb(struct ev_loop* loop, struct ev_child* watcher, int revents);
+static void collector_restart_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents);
+static int create_metrics_ssl_ctx(void);
 
 struct accept_io
 {
@@ -133,6 +165,22 @@ static struct accept_io io_management[MAX_FDS];
 static int* management_fds = NULL;
 static int management_fds_length = -1;
 static struct accept_io io_transfer;
+static pid_t collector_pid = -1;
+static bool collector_reload = false;
+static int collector_failures = 0;
+static time_t collector_started = 0;
+static struct ev_child collector_watcher;
+static struct ev_timer collector_restart_watcher;
+static struct ev_timer ticket_keys_watcher;
+static pid_t http_worker_pids[NUMBER_OF_HTTP_WORKERS];
+static struct ev_child http_worker_watchers[NUMBER_OF_HTTP_WORKERS];
+static struct ev_timer http_worker_restart_watchers[NUMBER_OF_HTTP_WORKERS];
+static int http_worker_failures[NUMBER_OF_HTTP_WORKERS];
+static time_t http_worker_started[NUMBER_OF_HTTP_WORKERS];
+static int http_workers_running = 0;
+static struct ev_child conf_set_watcher;
+static volatile sig_atomic_t http_worker_running = 1;
+static SSL_CTX* metrics_ssl_ctx = NULL;
 
 static void
 start_mgt(void)
@@ -225,7 +273,10 @@ start_metrics(void)
          ev_io_init((struct ev_io*)&io_metrics[i], accept_metrics_cb, sockfd, EV_READ);
          io_metrics[i].socket = sockfd;
          io_metrics[i].argv = argv_ptr;
-         ev_io_start(main_loop, (struct ev_io*)&io_metrics[i]);
+         if (!http_worker_pool())
+         {
+            ev_io_start(main_loop, (struct ev_io*)&io_metrics[i]);
+         }
       }
    }
 }
@@ -265,7 +316,10 @@ start_console(void)
          ev_io_init((struct ev_io*)&io_console[i], accept_console_cb, sockfd, EV_READ);
          io_console[i].socket = sockfd;
          io_console[i].argv = argv_ptr;
-         ev_io_start(main_loop, (struct ev_io*)&io_console[i]);
+         if (!http_worker_pool())
+         {
+            ev_io_start(main_loop, (struct ev_io*)&io_console[i]);
+         }
       }
    }
 }
@@ -305,7 +359,10 @@ start_bridge(void)
          ev_io_init((struct ev_io*)&io_bridge[i], accept_bridge_cb, sockfd, EV_READ);
          io_bridge[i].socket = sockfd;
          io_bridge[i].argv = argv_ptr;
-         ev_io_start(main_loop, (struct ev_io*)&io_bridge[i]);
+         if (!http_worker_pool())
+         {
+            ev_io_start(main_loop, (struct ev_io*)&io_bridge[i]);
+         }
       }
    }
 }
@@ -345,7 +402,10 @@ start_bridge_json(void)
          ev_io_init((struct ev_io*)&io_bridge_json[i], accept_bridge_json_cb, sockfd, EV_READ);
          io_bridge_json[i].socket = sockfd;
          io_bridge_json[i].argv = argv_ptr;
-         ev_io_start(main_loop, (struct ev_io*)&io_bridge_json[i]);
+         if (!http_worker_pool())
+         {
+            ev_io_start(main_loop, (struct ev_io*)&io_bridge_json[i]);
+         }
       }
    }
 }
@@ -449,6 +509,7 @@ main(int argc, char** argv)
    struct signal_info signal_watcher[6];
    size_t shmem_size;
    size_t prometheus_cache_shmem_size = 0;
+   size_t prometheus_snapshot_shmem_size = 0;
    size_t bridge_cache_shmem_size = 0;
    size_t bridge_json_cache_shmem_size = 0;
    struct configuration* config = NULL;
@@ -954,6 +1015,12 @@ main(int argc, char** argv)
 #endif
          exit(1);
       }
+
+      /* A reload gives the same metrics unless it adds the metrics_path ones */
+      if (strlen(config->metrics_path) == 0)
+      {
+         pgexporter_metrics_stamp(config->metrics_path, &config->metrics_stamp);
+      }
    }
 
    /* Alert definitions */
@@ -1139,6 +1206,17 @@ main(int argc, char** argv)
       errx(1, "Error in creating and initializing prometheus cache shared memory");
    }
 
+   if (config->metrics > 0 && pgexporter_time_is_valid(config->metrics_collector_interval))
+   {
+      if (pgexporter_init_prometheus_snapshot(&prometheus_snapshot_shmem_size, &prometheus_snapshot_shmem))
+      {
+#ifdef HAVE_SYSTEMD
+         sd_notifyf(0, "STATUS=Error in creating and initializing prometheus snapshot shared memory");
+#endif
+         errx(1, "Error in creating and initializing prometheus snapshot shared memory");
+      }
+   }
+
    if (config->bridge > 0 && pgexporter_time_is_valid(config->bridge_cache_max_age) && config->bridge_cache_max_size > 0)
    {
       if (pgexporter_bridge_init_cache(&bridge_cache_shmem_size, &bridge_cache_shmem))
@@ -1215,6 +1293,29 @@ main(int argc, char** argv)
       exit(1);
    }
 
+   /* The session ticket keys live in shared memory, so every process resumes the sessions of the others */
+   if (pgexporter_rotate_ticket_keys(&config->metrics_ticket_keys) ||
+       pgexporter_rotate_ticket_keys(&config->metrics_ticket_keys))
+   {
+      pgexporter_log_fatal("pgexporter: Could not generate the TLS session ticket keys");
+#ifdef HAVE_SYSTEMD
+      sd_notify(0, "STATUS=Could not generate the TLS session ticket keys");
+#endif
+      exit(1);
+   }
+
+   if (create_metrics_ssl_ctx())
+   {
+      pgexporter_log_fatal("pgexporter: Could not create metrics SSL context");
+#ifdef HAVE_SYSTEMD
+      sd_notify(0, "STATUS=Could not create metrics SSL context");
+#endif
+      exit(1);
+   }
+
+   ev_timer_init(&ticket_keys_watcher, rotate_ticket_keys_cb, TLS_TICKET_KEY_ROTATION, TLS_TICKET_KEY_ROTATION);
+   ev_timer_start(main_loop, &ticket_keys_watcher);
+
    if (config->metrics > 0)
    {
       start_transfer();
@@ -1404,6 +1505,8 @@ main(int argc, char** argv)
       exit(1);
    }
 
+   pgexporter_prometheus_warn_intervals();
+
    for (int i = 0; i < config->number_of_servers; i++)
    {
       if (config->servers[i].fd != -1)
@@ -1419,6 +1522,9 @@ main(int argc, char** argv)
 
    pgexporter_close_connections();
 
+   start_collector();
+   start_http_workers();
+
    while (keep_running)
    {
       ev_loop(main_loop, 0);
@@ -1429,6 +1535,9 @@ main(int argc, char** argv)
    sd_notify(0, "STOPPING=1");
 #endif
 
+   shutdown_collector(true);
+   shutdown_http_workers();
+
    pgexporter_close_connections();
 
    shutdown_management(true);
@@ -1454,8 +1563,15 @@ main(int argc, char** argv)
       ev_signal_stop(main_loop, (struct ev_signal*)&signal_watcher[i]);
    }
 
+   ev_timer_stop(main_loop, &ticket_keys_watcher);
+
    ev_loop_destroy(main_loop);
 
+   if (metrics_ssl_ctx != NULL)
+   {
+      SSL_CTX_free(metrics_ssl_ctx);
+   }
+
    free(metrics_fds);
    free(console_fds);
    free(bridge_fds);
@@ -1478,6 +1594,11 @@ main(int argc, char** argv)
    pgexporter_destroy_shared_memory(shmem, shmem_size);
    pgexporter_destroy_shared_memory(prometheus_cache_shmem,
                                     prometheus_cache_shmem_size);
+   if (prometheus_snapshot_shmem != NULL)
+   {
+      pgexporter_destroy_shared_memory(prometheus_snapshot_shmem,
+                                       prometheus_snapshot_shmem_size);
+   }
 
 #ifdef HAVE_LINUX
    pgexporter_free_proc_title();
@@ -1737,6 +1858,11 @@ accept_mgt_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
          pgexporter_set_proc_title(1, ai->argv, "conf set", NULL);
          pgexporter_conf_set(NULL, client_fd, compression, encryption, pyl);
       }
+
+      /* The number of HTTP workers is applied once the new value is in place */
+      ev_child_stop(loop, &conf_set_watcher);
+      ev_child_init(&conf_set_watcher, conf_set_exit_cb, pid, 0);
+      ev_child_start(loop, &conf_set_watcher);
    }
    else
    {
@@ -1837,7 +1963,6 @@ accept_metrics_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
    pid_t pid;
    struct accept_io* ai;
    struct configuration* config;
-   SSL_CTX* ctx = NULL;
    SSL* client_ssl = NULL;
 
    if (EV_ERROR & revents)
@@ -1906,15 +2031,9 @@ accept_metrics_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
 
       /* We are leaving the socket descriptor valid such that the client won't reuse it */
       shutdown_ports(false);
-      if (strlen(config->metrics_cert_file) > 0 && strlen(config->metrics_key_file) > 0)
+      if (metrics_ssl_ctx != NULL)
       {
-         if (pgexporter_create_ssl_ctx(false, &ctx))
-         {
-            pgexporter_log_error("Could not create metrics SSL context");
-            return;
-         }
-
-         if (pgexporter_create_ssl_server(ctx, config->metrics_key_file, config->metrics_cert_file, config->metrics_ca_file, client_fd, &client_ssl))
+         if (pgexporter_create_ssl_server_session(metrics_ssl_ctx, client_fd, &client_ssl))
          {
             pgexporter_log_error("Could not create metrics SSL server");
             return;
@@ -2353,8 +2472,30 @@ reload_configuration(void)
    old_console = config->console;
    old_management = config->management;
 
+   /* The collector holds a copy of the old metric definitions and owns
+    * the server connections, so it is replaced once it has exited */
+   if (collector_pid > 0)
+   {
+      collector_reload = true;
+      shutdown_collector(false);
+   }
+
    pgexporter_reload_configuration(&restart);
 
+   pgexporter_prometheus_warn_intervals();
+
+   /* A reload can be due to a compromised key, the tickets of the previous key still resume */
+   pgexporter_rotate_ticket_keys(&config->metrics_ticket_keys);
+
+   /* Pick up renewed certificates */
+   if (create_metrics_ssl_ctx())
+   {
+      pgexporter_log_error("pgexporter: Could not create metrics SSL context, keeping the previous one");
+   }
+
+   /* The workers hold the old listening sockets */
+   shutdown_http_workers();
+
    if (old_metrics != config->metrics)
    {
       shutdown_metrics(false);
@@ -2451,6 +2592,9 @@ reload_configuration(void)
       }
    }
 
+   http_accept_watchers(!http_worker_pool());
+   start_http_workers();
+
    return restart;
 }
 
@@ -2575,3 +2719,549 @@ shutdown_ports(bool remove)
       shutdown_management(remove);
    }
 }
+
+static void
+start_collector(void)
+{
+   pid_t pid;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (prometheus_snapshot_shmem == NULL)
+   {
+      return;
+   }
+
+   /* The connections of a previous collector are not valid in the new one */
+   for (int i = 0; i < config->number_of_servers; i++)
+   {
+      config->servers[i].ssl = NULL;
+      config->servers[i].fd = -1;
+      config->servers[i].new = false;
+      config->servers[i].database[0] = '\0';
+   }
+
+   pid = fork();
+   if (pid == -1)
+   {
+      pgexporter_log_error("Collector: No fork");
+      return;
+   }
+   else if (pid == 0)
+   {
+      ev_loop_fork(main_loop);
+      shutdown_ports(false);
+
+      pgexporter_set_proc_title(1, argv_ptr, "collector", NULL);
+      pgexporter_prometheus_collector();
+   }
+
+   pgexporter_log_debug("Collector: %d", pid);
+
+   collector_pid = pid;
+   collector_started = time(NULL);
+
+   /* The default loop reaps the children, so it reports the exit */
+   ev_child_init(&collector_watcher, collector_exit_cb, pid, 0);
+   ev_child_start(main_loop, &collector_watcher);
+}
+
+static void
+shutdown_collector(bool wait)
+{
+   pid_t pid;
+
+   if (!wait)
+   {
+      /* The child watcher reaps it */
+      if (collector_pid > 0)
+      {
+         kill(collector_pid, SIGTERM);
+      }
+      return;
+   }
+
+   ev_timer_stop(main_loop, &collector_restart_watcher);
+
+   if (collector_pid > 0)
+   {
+      pid = collector_pid;
+      collector_pid = -1;
+      ev_child_stop(main_loop, &collector_watcher);
+
+      /* Wait for the collector to close its connections */
+      kill(pid, SIGTERM);
+      waitpid(pid, NULL, 0);
+   }
+}
+
+static bool
+http_worker_pool(void)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   return config->http_workers > 0;
+}
+
+static void
+http_accept_watchers(bool active)
+{
+   struct accept_io* watchers[] = {io_metrics, io_console, io_bridge, io_bridge_json};
+   int lengths[] = {metrics_fds_length, console_fds_length, bridge_fds_length, bridge_json_fds_length};
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   for (int i = 0; i < 4; i++)
+   {
+      for (int j = 0; j < lengths[i]; j++)
+      {
+         if (active)
+         {
+            /* The workers made the listening sockets non-blocking */
+            pgexporter_socket_nonblocking(watchers[i][j].socket, config->non_blocking);
+            ev_io_start(main_loop, (struct ev_io*)&watchers[i][j]);
+         }
+         else
+         {
+            ev_io_stop(main_loop, (struct ev_io*)&watchers[i][j]);
+         }
+      }
+   }
+}
+
+static void
+start_http_workers(void)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   for (int i = 0; i < config->http_workers; i++)
+   {
+      http_worker_failures[i] = 0;
+      start_http_worker(i);
+   }
+
+   http_workers_running = config->http_workers;
+}
+
+static void
+start_http_worker(int slot)
+{
+   pid_t pid;
+
+   pid = fork();
+   if (pid == -1)
+   {
+      pgexporter_log_error("HTTP worker: No fork");
+      return;
+   }
+   else if (pid == 0)
+   {
+      /* The listening sockets of the HTTP endpoints stay open */
+      shutdown_management(false);
+
+      pgexporter_set_proc_title(1, argv_ptr, "worker", NULL);
+      http_worker();
+   }
+
+   pgexporter_log_debug("HTTP worker: %d", pid);
+
+   http_worker_pids[slot] = pid;
+   http_worker_started[slot] = time(NULL);
+
+   /* The default loop reaps the children, so it reports the exit */
+   ev_child_init(&http_worker_watchers[slot], http_worker_exit_cb, pid, 0);
+   ev_child_start(main_loop, &http_worker_watchers[slot]);
+}
+
+static void
+shutdown_http_workers(void)
+{
+   pid_t pids[NUMBER_OF_HTTP_WORKERS];
+
+   http_workers_running = 0;
+
+   /* The workers finish the connections they are serving at the same time */
+   for (int i = 0; i < NUMBER_OF_HTTP_WORKERS; i++)
+   {
+      ev_timer_stop(main_loop, &http_worker_restart_watchers[i]);
+
+      pids[i] = http_worker_pids[i];
+
+      if (pids[i] > 0)
+      {
+         http_worker_pids[i] = 0;
+         ev_child_stop(main_loop, &http_worker_watchers[i]);
+
+         kill(pids[i], SIGTERM);
+      }
+   }
+
+   for (int i = 0; i < NUMBER_OF_HTTP_WORKERS; i++)
+   {
+      if (pids[i] > 0)
+      {
+         waitpid(pids[i], NULL, 0);
+      }
+   }
+}
+
+static void
+resize_http_workers(void)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (config->http_workers == http_workers_running)
+   {
+      return;
+   }
+
+   pgexporter_log_info("HTTP workers: %d -> %d", http_workers_running, config->http_workers);
+
+   if (config->http_workers == 0)
+   {
+      shutdown_http_workers();
+      http_accept_watchers(true);
+      return;
+   }
+
+   if (http_workers_running == 0)
+   {
+      http_accept_watchers(false);
+   }
+
+   /* The retired workers finish the connections they are serving */
+   for (int i = config->http_workers; i < http_workers_running; i++)
+   {
+      ev_timer_stop(main_loop, &http_worker_restart_watchers[i]);
+
+      if (http_worker_pids[i] > 0)
+      {
+         kill(http_worker_pids[i], SIGTERM);
+      }
+   }
+
+   for (int i = http_workers_running; i < config->http_workers; i++)
+   {
+      if (http_worker_pids[i] == 0)
+      {
+         http_worker_failures[i] = 0;
+         start_http_worker(i);
+      }
+   }
+
+   http_workers_running = config->http_workers;
+}
+
+static void
+http_worker(void)
+{
+   struct pollfd fds[MAX_FDS * 4];
+   int types[MAX_FDS * 4];
+   nfds_t number_of_fds = 0;
+   int requests = 0;
+   struct sigaction sa;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = http_worker_shutdown_cb;
+   sigemptyset(&sa.sa_mask);
+   sigaction(SIGTERM, &sa, NULL);
+   sigaction(SIGINT, &sa, NULL);
+
+   pgexporter_start_logging();
+   pgexporter_memory_init();
+
+   http_worker_listen(fds, types, &number_of_fds, metrics_fds, metrics_fds_length, HTTP_LISTENER_METRICS);
+   http_worker_listen(fds, types, &number_of_fds, console_fds, console_fds_length, HTTP_LISTENER_CONSOLE);
+   http_worker_listen(fds, types, &number_of_fds, bridge_fds, bridge_fds_length, HTTP_LISTENER_BRIDGE);
+   http_worker_listen(fds, types, &number_of_fds, bridge_json_fds, bridge_json_fds_length, HTTP_LISTENER_BRIDGE_JSON);
+
+   pgexporter_log_debug("HTTP worker started (pid %d, %d sockets)", getpid(), (int)number_of_fds);
+
+   while (http_worker_running &&
+          (config->http_worker_max_requests == 0 || requests < config->http_worker_max_requests))
+   {
+      if (poll(fds, number_of_fds, -1) == -1)
+      {
+         if (errno == EINTR)
+         {
+            errno = 0;
+            continue;
+         }
+
+         pgexporter_log_error("HTTP worker: %s", strerror(errno));
+         break;
+      }
+
+      for (nfds_t i = 0; i < number_of_fds && http_worker_running; i++)
+      {
+         if (fds[i].revents & POLLIN)
+         {
+            requests += http_worker_serve(types[i], fds[i].fd);
+         }
+      }
+   }
+
+   pgexporter_log_debug("HTTP worker stopped (pid %d, %d requests)", getpid(), requests);
+
+   pgexporter_memory_destroy();
+   pgexporter_stop_logging();
+
+   OPENSSL_cleanup();
+
+   exit(0);
+}
+
+static void
+http_worker_listen(struct pollfd* fds, int* types, nfds_t* number_of_fds, int* sockets, int length, int type)
+{
+   for (int i = 0; i < length; i++)
+   {
+      /* Every worker polls the same sockets, so a blocking accept could wait for the next client */
+      pgexporter_socket_nonblocking(sockets[i], true);
+
+      fds[*number_of_fds].fd = sockets[i];
+      fds[*number_of_fds].events = POLLIN;
+      fds[*number_of_fds].revents = 0;
+      types[*number_of_fds] = type;
+      (*number_of_fds)++;
+   }
+}
+
+static int
+http_worker_serve(int type, int listener)
+{
+   struct sockaddr_in6 client_addr;
+   socklen_t client_addr_length;
+   int client_fd;
+   int requests = 0;
+   SSL* client_ssl = NULL;
+
+   /* The listening sockets are non-blocking, so losing the race to another worker is harmless */
+   memset(&client_addr, 0, sizeof(client_addr));
+   client_addr_length = sizeof(client_addr);
+   client_fd = accept(listener, (struct sockaddr*)&client_addr, &client_addr_length);
+   if (client_fd == -1)
+   {
+      errno = 0;
+      return 0;
+   }
+
+   /* BSD and macOS hand out the non-blocking mode of the listening socket */
+   pgexporter_socket_nonblocking(client_fd, false);
+
+   if (type == HTTP_LISTENER_METRICS)
+   {
+      if (metrics_ssl_ctx != NULL)
+      {
+         if (pgexporter_create_ssl_server_session(metrics_ssl_ctx, client_fd, &client_ssl))
+         {
+            pgexporter_log_error("Could not create metrics SSL server");
+            goto done;
+         }
+      }
+
+      pgexporter_prometheus_serve(client_ssl, client_fd, &requests);
+   }
+   else if (type == HTTP_LISTENER_CONSOLE)
+   {
+      pgexporter_console_serve(NULL, client_fd, &requests);
+   }
+   else if (type == HTTP_LISTENER_BRIDGE)
+   {
+      pgexporter_bridge_serve(client_fd, &requests);
+   }
+   else
+   {
+      pgexporter_bridge_json_serve(client_fd, &requests);
+   }
+
+done:
+
+   pgexporter_close_ssl(client_ssl);
+   pgexporter_disconnect(client_fd);
+
+   return requests;
+}
+
+static void
+http_worker_shutdown_cb(int signum __attribute__((unused)))
+{
+   http_worker_running = 0;
+   pgexporter_http_shutdown();
+}
+
+static void
+http_worker_exit_cb(struct ev_loop* loop, struct ev_child* watcher, int revents __attribute__((unused)))
+{
+   int slot;
+   int delay;
+
+   slot = (int)(watcher - http_worker_watchers);
+
+   ev_child_stop(loop, watcher);
+   http_worker_pids[slot] = 0;
+
+   /* Shut down, or no longer part of the pool */
+   if (!keep_running || slot >= http_workers_running)
+   {
+      return;
+   }
+
+   if (WIFEXITED(watcher->rstatus) && WEXITSTATUS(watcher->rstatus) == 0)
+   {
+      pgexporter_log_debug("HTTP worker: Process %d retired, replacing", watcher->rpid);
+      http_worker_failures[slot] = 0;
+      start_http_worker(slot);
+      return;
+   }
+
+   /* A worker that keeps failing is restarted less and less often */
+   if (time(NULL) - http_worker_started[slot] < HTTP_WORKER_MIN_UPTIME)
+   {
+      http_worker_failures[slot]++;
+   }
+   else
+   {
+      http_worker_failures[slot] = 0;
+   }
+
+   delay = http_worker_failures[slot] < 6 ? 1 << http_worker_failures[slot] : HTTP_WORKER_MAX_RESTART_DELAY;
+   delay = MIN(delay, HTTP_WORKER_MAX_RESTART_DELAY);
+
+   pgexporter_log_warn("HTTP worker: Process %d stopped, restarting in %d seconds", watcher->rpid, delay);
+
+   ev_timer_stop(loop, &http_worker_restart_watchers[slot]);
+   ev_timer_init(&http_worker_restart_watchers[slot], http_worker_restart_cb, delay, 0.);
+   ev_timer_start(loop, &http_worker_restart_watchers[slot]);
+}
+
+static void
+http_worker_restart_cb(struct ev_loop* loop __attribute__((unused)), struct ev_timer* watcher, int revents __attribute__((unused)))
+{
+   int slot;
+
+   slot = (int)(watcher - http_worker_restart_watchers);
+
+   if (keep_running && slot < http_workers_running && http_worker_pids[slot] == 0)
+   {
+      start_http_worker(slot);
+   }
+}
+
+static void
+conf_set_exit_cb(struct ev_loop* loop, struct ev_child* watcher, int revents __attribute__((unused)))
+{
+   ev_child_stop(loop, watcher);
+
+   if (keep_running)
+   {
+      resize_http_workers();
+   }
+}
+
+static void
+rotate_ticket_keys_cb(struct ev_loop* loop __attribute__((unused)), struct ev_timer* watcher __attribute__((unused)), int revents __attribute__((unused)))
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   pgexporter_rotate_ticket_keys(&config->metrics_ticket_keys);
+}
+
+static void
+collector_exit_cb(struct ev_loop* loop, struct ev_child* watcher, int revents __attribute__((unused)))
+{
+   int delay;
+
+   ev_child_stop(loop, watcher);
+   collector_pid = -1;
+
+   if (!keep_running)
+   {
+      return;
+   }
+
+   /* Stopped by a reload, the new configuration is in place */
+   if (collector_reload)
+   {
+      collector_reload = false;
+      start_collector();
+      return;
+   }
+
+   /* A collector that keeps failing is restarted less and less often */
+   if (time(NULL) - collector_started < COLLECTOR_MIN_UPTIME)
+   {
+      collector_failures++;
+   }
+   else
+   {
+      collector_failures = 0;
+   }
+
+   delay = collector_failures < 6 ? 1 << collector_failures : COLLECTOR_MAX_RESTART_DELAY;
+   delay = MIN(delay, COLLECTOR_MAX_RESTART_DELAY);
+
+   pgexporter_log_warn("Collector: Process %d stopped, restarting in %d seconds", watcher->rpid, delay);
+
+   ev_timer_stop(loop, &collector_restart_watcher);
+   ev_timer_init(&collector_restart_watcher, collector_restart_cb, delay, 0.);
+   ev_timer_start(loop, &collector_restart_watcher);
+}
+
+static void
+collector_restart_cb(struct ev_loop* loop __attribute__((unused)), struct ev_timer* watcher __attribute__((unused)), int revents __attribute__((unused)))
+{
+   if (keep_running && collector_pid == -1)
+   {
+      start_collector();
+   }
+}
+
+static int
+create_metrics_ssl_ctx(void)
+{
+   SSL_CTX* ctx = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (strlen(config->metrics_cert_file) == 0 || strlen(config->metrics_key_file) == 0)
+   {
+      if (metrics_ssl_ctx != NULL)
+      {
+         SSL_CTX_free(metrics_ssl_ctx);
+         metrics_ssl_ctx = NULL;
+      }
+
+      return 0;
+   }
+
+   /* The certificate, key and CA are loaded once and the children inherit them */
+   if (pgexporter_create_ssl_server_ctx(config->metrics_key_file, config->metrics_cert_file, config->metrics_ca_file,
+                                        &config->metrics_ticket_keys, &ctx))
+   {
+      return 1;
+   }
+
+   if (metrics_ssl_ctx != NULL)
+   {
+      SSL_CTX_free(metrics_ssl_ctx);
+   }
+
+   metrics_ssl_ctx = ctx;
+
+   return 0;
+}
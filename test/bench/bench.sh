@@ -0,0 +1,187 @@
+#!/bin/bash
+#
+# Copyright (C) 2026 The pgexporter community
+#
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice, this list
+# of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright notice, this
+# list of conditions and the following disclaimer in the documentation and/or other
+# materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its contributors may
+# be used to endorse or promote products derived from this software without specific
+# prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+# EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+# OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+# THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+# OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+set -eo pipefail
+
+# Runs pgexporter against pgexporter-mock and reports the scrape performance
+#
+# Usage: bench.sh [ -n SERVERS ] [ -d DATABASES ] [ -r ROWS ] [ -s SCRAPES ] [ -l DELAY ]
+#                 [ -a trust|scram ] [ -y YAML ] [ -o OPTION ]...
+#
+# The binaries are taken from $PGEXPORTER_BUILD_DIRECTORY, default <project>/build
+
+SCRIPT_DIR="$(realpath "$(dirname "${BASH_SOURCE[0]}")")"
+PROJECT_DIRECTORY=$(realpath "$SCRIPT_DIR/../..")
+BUILD_DIRECTORY=${PGEXPORTER_BUILD_DIRECTORY:-$PROJECT_DIRECTORY/build}
+EXECUTABLE_DIRECTORY=$BUILD_DIRECTORY/src
+TEST_DIRECTORY=$BUILD_DIRECTORY/test
+
+BENCH_DIR="/tmp/pgexporter-bench"
+CONFIGURATION_DIRECTORY=$BENCH_DIR/conf
+LOG_DIR=$BENCH_DIR/log
+
+SERVERS=1
+DATABASES=1
+ROWS=10
+SCRAPES=100
+DELAY=0
+AUTH=scram
+YAML=""
+OPTIONS=()
+
+MOCK_PORT=${PGEXPORTER_BENCH_MOCK_PORT:-16432}
+METRICS_PORT=${PGEXPORTER_BENCH_METRICS_PORT:-15002}
+PG_USER_NAME=pgexporter
+PG_USER_PASSWORD=pgexporter
+
+MOCK_PID=""
+PGEXPORTER_PID=""
+
+usage() {
+   echo "Usage: $0 [ -n SERVERS ] [ -d DATABASES ] [ -r ROWS ] [ -s SCRAPES ] [ -l DELAY ]"
+   echo "          [ -a trust|scram ] [ -y YAML ] [ -o OPTION ]..."
+   echo ""
+   echo "  -n SERVERS    Number of mock servers (default 1)"
+   echo "  -d DATABASES  Number of databases per server (default 1)"
+   echo "  -r ROWS       Rows in generated result sets (default 10)"
+   echo "  -s SCRAPES    Number of measured scrapes (default 100)"
+   echo "  -l DELAY      Delay of every query in milliseconds (default 0)"
+   echo "  -a AUTH       Authentication of the mock, trust or scram (default scram)"
+   echo "  -y YAML       metrics_path, a YAML file or directory"
+   echo "  -o OPTION     Additional [pgexporter] option, e.g. -o 'metrics_query_async = on'"
+}
+
+cleanup() {
+   set +e
+   if [[ -n "$PGEXPORTER_PID" ]]; then
+      $EXECUTABLE_DIRECTORY/pgexporter-cli -c $CONFIGURATION_DIRECTORY/pgexporter.conf shutdown >/dev/null 2>&1
+      for i in {1..10}; do
+         if ! kill -0 $PGEXPORTER_PID 2>/dev/null; then
+            break
+         fi
+         sleep 0.5
+      done
+      kill -9 $PGEXPORTER_PID 2>/dev/null
+      wait $PGEXPORTER_PID 2>/dev/null
+   fi
+   if [[ -n "$MOCK_PID" ]]; then
+      kill $MOCK_PID 2>/dev/null
+      wait $MOCK_PID 2>/dev/null
+   fi
+   echo "Logs --> $LOG_DIR"
+   set -e
+}
+
+while getopts "n:d:r:s:l:a:y:o:h" OPT; do
+   case $OPT in
+      n) SERVERS=$OPTARG ;;
+      d) DATABASES=$OPTARG ;;
+      r) ROWS=$OPTARG ;;
+      s) SCRAPES=$OPTARG ;;
+      l) DELAY=$OPTARG ;;
+      a) AUTH=$OPTARG ;;
+      y) YAML=$(realpath "$OPTARG") ;;
+      o) OPTIONS+=("$OPTARG") ;;
+      *) usage; exit 1 ;;
+   esac
+done
+
+for BINARY in $EXECUTABLE_DIRECTORY/pgexporter $EXECUTABLE_DIRECTORY/pgexporter-admin \
+              $TEST_DIRECTORY/pgexporter-mock $TEST_DIRECTORY/pgexporter-scrape; do
+   if [[ ! -x $BINARY ]]; then
+      echo "$BINARY not found, build with: cmake --build $BUILD_DIRECTORY --target pgexporter-bin pgexporter-cli-bin pgexporter-admin-bin bench"
+      exit 1
+   fi
+done
+
+rm -Rf $BENCH_DIR
+mkdir -p $CONFIGURATION_DIRECTORY $LOG_DIR
+
+trap cleanup EXIT
+
+$TEST_DIRECTORY/pgexporter-mock -p $MOCK_PORT -n $SERVERS -d $DATABASES -r $ROWS -l $DELAY -a $AUTH \
+   -U $PG_USER_NAME -P $PG_USER_PASSWORD > $LOG_DIR/mock.log 2>&1 &
+MOCK_PID=$!
+
+cat <<EOF2 >$CONFIGURATION_DIRECTORY/pgexporter.conf
+[pgexporter]
+host = localhost
+metrics = $METRICS_PORT
+
+log_type = file
+log_level = info
+log_path = $LOG_DIR/pgexporter.log
+
+unix_socket_dir = $BENCH_DIR
+EOF2
+
+if [[ -n "$YAML" ]]; then
+   echo "metrics_path = $YAML" >> $CONFIGURATION_DIRECTORY/pgexporter.conf
+fi
+for OPTION in "${OPTIONS[@]}"; do
+   echo "$OPTION" >> $CONFIGURATION_DIRECTORY/pgexporter.conf
+done
+
+for ((i = 0; i < SERVERS; i++)); do
+   cat <<EOF2 >>$CONFIGURATION_DIRECTORY/pgexporter.conf
+
+[server$((i + 1))]
+host = localhost
+port = $((MOCK_PORT + i))
+user = $PG_USER_NAME
+EOF2
+done
+
+if [[ ! -e $HOME/.pgexporter/master.key ]]; then
+   $EXECUTABLE_DIRECTORY/pgexporter-admin master-key -P $PG_USER_PASSWORD >/dev/null
+fi
+$EXECUTABLE_DIRECTORY/pgexporter-admin -f $CONFIGURATION_DIRECTORY/pgexporter_users.conf \
+   -U $PG_USER_NAME -P $PG_USER_PASSWORD user add >/dev/null
+
+# Not daemonized so the process id is known for the RSS sampling, but in its own
+# session since pgexporter signals its process group on shutdown
+setsid $EXECUTABLE_DIRECTORY/pgexporter -c $CONFIGURATION_DIRECTORY/pgexporter.conf \
+   -u $CONFIGURATION_DIRECTORY/pgexporter_users.conf > $LOG_DIR/pgexporter.out 2>&1 &
+PGEXPORTER_PID=$!
+
+for i in {1..20}; do
+   if $TEST_DIRECTORY/pgexporter-scrape -u http://localhost:$METRICS_PORT/ -n 1 -w 0 >/dev/null 2>&1; then
+      break
+   fi
+   if [[ $i -eq 20 ]] || ! kill -0 $PGEXPORTER_PID 2>/dev/null; then
+      echo "pgexporter not started"
+      tail -20 $LOG_DIR/pgexporter.log 2>/dev/null || true
+      exit 1
+   fi
+   sleep 0.5
+done
+
+echo "servers:          $SERVERS"
+echo "databases:        $DATABASES"
+echo "rows:             $ROWS"
+$TEST_DIRECTORY/pgexporter-scrape -u http://localhost:$METRICS_PORT/metrics -n $SCRAPES \
+   -p $PGEXPORTER_PID
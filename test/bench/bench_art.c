@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <pgexporter.h>
+#include <art.h>
+#include <value.h>
+
+#include <benchmark.h>
+#include <mctf.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KEY_LENGTH 32
+
+static char* create_keys(size_t n);
+
+MCTF_TEST(bench_art_operations)
+{
+   struct art* t = NULL;
+   struct art_iterator* iter = NULL;
+   char* keys = NULL;
+   size_t count;
+   uintptr_t sum;
+   int64_t start;
+
+   for (size_t n = pgexporter_bench_next_size(0, 0); n > 0; n = pgexporter_bench_next_size(n, 0))
+   {
+      keys = create_keys(n);
+      MCTF_ASSERT_PTR_NONNULL(keys, cleanup, "Key generation failed");
+
+      pgexporter_art_create(&t);
+      MCTF_ASSERT_PTR_NONNULL(t, cleanup, "ART creation failed");
+
+      start = pgexporter_bench_now();
+      for (size_t i = 0; i < n; i++)
+      {
+         MCTF_ASSERT(!pgexporter_art_insert(t, keys + i * KEY_LENGTH, (uintptr_t)i, ValueUInt64), cleanup, "Insert failed");
+      }
+      pgexporter_bench_record("art_insert", n, n, pgexporter_bench_now() - start);
+
+      sum = 0;
+      start = pgexporter_bench_now();
+      for (size_t i = 0; i < n; i++)
+      {
+         sum += pgexporter_art_search(t, keys + i * KEY_LENGTH);
+      }
+      pgexporter_bench_record("art_search", n, n, pgexporter_bench_now() - start);
+      MCTF_ASSERT(sum == (uintptr_t)(n * (n - 1) / 2), cleanup, "Search returned wrong values");
+
+      /* Misses extend the keys of the hits */
+      for (size_t i = 0; i < n; i++)
+      {
+         size_t length = strlen(keys + i * KEY_LENGTH);
+
+         keys[i * KEY_LENGTH + length] = 'x';
+         keys[i * KEY_LENGTH + length + 1] = '\0';
+      }
+
+      count = 0;
+      start = pgexporter_bench_now();
+      for (size_t i = 0; i < n; i++)
+      {
+         count += pgexporter_art_contains_key(t, keys + i * KEY_LENGTH) ? 1 : 0;
+      }
+      pgexporter_bench_record("art_search_miss", n, n, pgexporter_bench_now() - start);
+      MCTF_ASSERT(count == 0, cleanup, "Search found missing keys");
+
+      count = 0;
+      start = pgexporter_bench_now();
+      MCTF_ASSERT(!pgexporter_art_iterator_create(t, &iter), cleanup, "Iterator creation failed");
+      while (pgexporter_art_iterator_next(iter))
+      {
+         count++;
+      }
+      pgexporter_art_iterator_destroy(iter);
+      iter = NULL;
+      pgexporter_bench_record("art_iterate", n, n, pgexporter_bench_now() - start);
+      MCTF_ASSERT(count == n, cleanup, "Iterated %zu of %zu keys", count, n);
+
+      start = pgexporter_bench_now();
+      pgexporter_art_destroy(t);
+      t = NULL;
+      pgexporter_bench_record("art_destroy", n, n, pgexporter_bench_now() - start);
+
+      free(keys);
+      keys = NULL;
+   }
+
+cleanup:
+   pgexporter_art_iterator_destroy(iter);
+   pgexporter_art_destroy(t);
+   free(keys);
+   MCTF_FINISH();
+}
+
+MCTF_TEST(bench_art_string_values)
+{
+   struct art* t = NULL;
+   char* keys = NULL;
+   int64_t start;
+
+   /* Metric containers keep their text in string values */
+   for (size_t n = pgexporter_bench_next_size(0, 0); n > 0; n = pgexporter_bench_next_size(n, 0))
+   {
+      keys = create_keys(n);
+      MCTF_ASSERT_PTR_NONNULL(keys, cleanup, "Key generation failed");
+
+      pgexporter_art_create(&t);
+      MCTF_ASSERT_PTR_NONNULL(t, cleanup, "ART creation failed");
+
+      start = pgexporter_bench_now();
+      for (size_t i = 0; i < n; i++)
+      {
+         MCTF_ASSERT(!pgexporter_art_insert(t, keys + i * KEY_LENGTH, (uintptr_t)(keys + i * KEY_LENGTH), ValueString),
+                     cleanup, "Insert failed");
+      }
+      pgexporter_bench_record("art_insert_string", n, n, pgexporter_bench_now() - start);
+
+      start = pgexporter_bench_now();
+      pgexporter_art_destroy(t);
+      t = NULL;
+      pgexporter_bench_record("art_destroy_string", n, n, pgexporter_bench_now() - start);
+
+      free(keys);
+      keys = NULL;
+   }
+
+cleanup:
+   pgexporter_art_destroy(t);
+   free(keys);
+   MCTF_FINISH();
+}
+
+static char*
+create_keys(size_t n)
+{
+   char* keys = NULL;
+
+   keys = malloc(n * KEY_LENGTH);
+   if (keys == NULL)
+   {
+      return NULL;
+   }
+
+   for (size_t i = 0; i < n; i++)
+   {
+      pgexporter_bench_key(i, keys + i * KEY_LENGTH, KEY_LENGTH);
+   }
+
+   return keys;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <pgexporter.h>
+#include <deque.h>
+#include <value.h>
+
+#include <benchmark.h>
+#include <mctf.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KEY_LENGTH 32
+
+MCTF_TEST(bench_deque_operations)
+{
+   struct deque* d = NULL;
+   struct deque_iterator* iter = NULL;
+   char key[KEY_LENGTH];
+   char* tag = NULL;
+   size_t count;
+   int64_t start;
+
+   for (size_t n = pgexporter_bench_next_size(0, 0); n > 0; n = pgexporter_bench_next_size(n, 0))
+   {
+      MCTF_ASSERT(!pgexporter_deque_create(false, &d), cleanup, "Deque creation failed");
+
+      start = pgexporter_bench_now();
+      for (size_t i = 0; i < n; i++)
+      {
+         pgexporter_bench_key(i, &key[0], sizeof(key));
+         MCTF_ASSERT(!pgexporter_deque_add(d, &key[0], (uintptr_t)i, ValueUInt64), cleanup, "Add failed");
+      }
+      pgexporter_bench_record("deque_add", n, n, pgexporter_bench_now() - start);
+
+      count = 0;
+      start = pgexporter_bench_now();
+      MCTF_ASSERT(!pgexporter_deque_iterator_create(d, &iter), cleanup, "Iterator creation failed");
+      while (pgexporter_deque_iterator_next(iter))
+      {
+         count++;
+      }
+      pgexporter_deque_iterator_destroy(iter);
+      iter = NULL;
+      pgexporter_bench_record("deque_iterate", n, n, pgexporter_bench_now() - start);
+      MCTF_ASSERT(count == n, cleanup, "Iterated %zu of %zu entries", count, n);
+
+      start = pgexporter_bench_now();
+      pgexporter_deque_sort(d);
+      pgexporter_bench_record("deque_sort", n, n, pgexporter_bench_now() - start);
+
+      count = 0;
+      start = pgexporter_bench_now();
+      while (!pgexporter_deque_empty(d))
+      {
+         pgexporter_deque_poll(d, &tag);
+         free(tag);
+         tag = NULL;
+         count++;
+      }
+      pgexporter_bench_record("deque_poll", n, n, pgexporter_bench_now() - start);
+      MCTF_ASSERT(count == n, cleanup, "Polled %zu of %zu entries", count, n);
+
+      pgexporter_deque_destroy(d);
+      d = NULL;
+   }
+
+cleanup:
+   pgexporter_deque_iterator_destroy(iter);
+   pgexporter_deque_destroy(d);
+   MCTF_FINISH();
+}
+
+MCTF_TEST(bench_deque_thread_safe)
+{
+   struct deque* d = NULL;
+   int64_t start;
+
+   /* The locking cost of the deques shared between workers */
+   for (size_t n = pgexporter_bench_next_size(0, 0); n > 0; n = pgexporter_bench_next_size(n, 0))
+   {
+      MCTF_ASSERT(!pgexporter_deque_create(true, &d), cleanup, "Deque creation failed");
+
+      start = pgexporter_bench_now();
+      for (size_t i = 0; i < n; i++)
+      {
+         MCTF_ASSERT(!pgexporter_deque_add(d, NULL, (uintptr_t)i, ValueUInt64), cleanup, "Add failed");
+      }
+      pgexporter_bench_record("deque_add_thread_safe", n, n, pgexporter_bench_now() - start);
+
+      start = pgexporter_bench_now();
+      while (!pgexporter_deque_empty(d))
+      {
+         pgexporter_deque_poll(d, NULL);
+      }
+      pgexporter_bench_record("deque_poll_thread_safe", n, n, pgexporter_bench_now() - start);
+
+      pgexporter_deque_destroy(d);
+      d = NULL;
+   }
+
+cleanup:
+   pgexporter_deque_destroy(d);
+   MCTF_FINISH();
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <pgexporter.h>
+#include <json.h>
+#include <management.h>
+#include <value.h>
+
+#include <benchmark.h>
+#include <mctf.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Serializing and parsing grow faster than the payload */
+#define JSON_LIMIT 10000
+#define KEY_LENGTH 32
+
+static int create_payload(size_t servers, struct json** payload);
+
+MCTF_TEST(bench_json_management)
+{
+   struct json* payload = NULL;
+   struct json* parsed = NULL;
+   char* s = NULL;
+   size_t length;
+   int64_t start;
+
+   for (size_t n = pgexporter_bench_next_size(0, JSON_LIMIT); n > 0; n = pgexporter_bench_next_size(n, JSON_LIMIT))
+   {
+      start = pgexporter_bench_now();
+      MCTF_ASSERT(!create_payload(n, &payload), cleanup, "Payload creation failed");
+      pgexporter_bench_record("json_build", n, n, pgexporter_bench_now() - start);
+
+      start = pgexporter_bench_now();
+      s = pgexporter_json_to_string(payload, FORMAT_JSON_COMPACT, NULL, 0);
+      pgexporter_bench_record("json_serialize", n, n, pgexporter_bench_now() - start);
+      MCTF_ASSERT_PTR_NONNULL(s, cleanup, "Serialization failed");
+
+      length = strlen(s);
+
+      start = pgexporter_bench_now();
+      MCTF_ASSERT(!pgexporter_json_parse_string(s, &parsed), cleanup, "Parsing failed");
+      pgexporter_bench_record("json_parse", n, n, pgexporter_bench_now() - start);
+
+      free(s);
+      s = pgexporter_json_to_string(parsed, FORMAT_JSON_COMPACT, NULL, 0);
+      MCTF_ASSERT(s != NULL && strlen(s) == length, cleanup, "Round trip changed the payload");
+
+      start = pgexporter_bench_now();
+      pgexporter_json_destroy(parsed);
+      parsed = NULL;
+      pgexporter_bench_record("json_destroy", n, n, pgexporter_bench_now() - start);
+
+      free(s);
+      s = NULL;
+      pgexporter_json_destroy(payload);
+      payload = NULL;
+   }
+
+cleanup:
+   free(s);
+   pgexporter_json_destroy(parsed);
+   pgexporter_json_destroy(payload);
+   MCTF_FINISH();
+}
+
+static int
+create_payload(size_t servers, struct json** payload)
+{
+   char name[KEY_LENGTH];
+   struct json* j = NULL;
+   struct json* request = NULL;
+   struct json* response = NULL;
+   struct json* outcome = NULL;
+   struct json* list = NULL;
+
+   *payload = NULL;
+
+   /* The shape of a status details reply to the command line interface */
+   if (pgexporter_management_create_header(MANAGEMENT_STATUS_DETAILS, MANAGEMENT_COMPRESSION_NONE, MANAGEMENT_ENCRYPTION_NONE,
+                                           MANAGEMENT_OUTPUT_FORMAT_JSON, &j))
+   {
+      goto error;
+   }
+
+   if (pgexporter_management_create_request(j, &request))
+   {
+      goto error;
+   }
+
+   if (pgexporter_management_create_response(j, -1, &response))
+   {
+      goto error;
+   }
+
+   pgexporter_json_put(response, MANAGEMENT_ARGUMENT_NUMBER_OF_SERVERS, (uintptr_t)servers, ValueInt32);
+   pgexporter_json_put(response, MANAGEMENT_ARGUMENT_PGEXPORTER_FIPS, (uintptr_t)false, ValueBool);
+
+   pgexporter_json_create(&list);
+
+   for (size_t i = 0; i < servers; i++)
+   {
+      struct json* js = NULL;
+
+      pgexporter_json_create(&js);
+
+      pgexporter_bench_key(i, &name[0], sizeof(name));
+
+      pgexporter_json_put(js, MANAGEMENT_ARGUMENT_ACTIVE, (uintptr_t)(i % 2 == 0), ValueBool);
+      pgexporter_json_put(js, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)name, ValueString);
+      pgexporter_json_put(js, MANAGEMENT_ARGUMENT_MAJOR_VERSION, (uintptr_t)17, ValueInt32);
+      pgexporter_json_put(js, MANAGEMENT_ARGUMENT_MINOR_VERSION, (uintptr_t)(i % 10), ValueInt32);
+      pgexporter_json_put(js, MANAGEMENT_ARGUMENT_FIPS, (uintptr_t)false, ValueBool);
+
+      pgexporter_json_append(list, (uintptr_t)js, ValueJSON);
+   }
+
+   pgexporter_json_put(response, MANAGEMENT_ARGUMENT_SERVERS, (uintptr_t)list, ValueJSON);
+
+   if (pgexporter_management_create_outcome_success(j, 0, 0, &outcome))
+   {
+      goto error;
+   }
+
+   *payload = j;
+
+   return 0;
+
+error:
+
+   pgexporter_json_destroy(j);
+
+   return 1;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pgexporter.h>
+#include <configuration.h>
+#include <security.h>
+#include <shmem.h>
+
+#include <benchmark.h>
+#include <mctf.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Every derivation runs the PBKDF2 iterations, so keep the data sets small */
+#define DERIVE_LIMIT 1000
+#define ITERATIONS   4096
+#define SALT_LENGTH  16
+
+MCTF_TEST(bench_scram_keys)
+{
+   char salt[SALT_LENGTH];
+   unsigned char client_key[SCRAM_KEY_LENGTH];
+   unsigned char server_key[SCRAM_KEY_LENGTH];
+   unsigned char cached_client_key[SCRAM_KEY_LENGTH];
+   unsigned char cached_server_key[SCRAM_KEY_LENGTH];
+   int64_t start;
+
+   /* The keys are cached in the shared configuration */
+   MCTF_ASSERT(!pgexporter_create_shared_memory(sizeof(struct configuration), HUGEPAGE_OFF, &shmem), cleanup, "Shared memory failed");
+   pgexporter_init_configuration(shmem);
+
+   memset(&salt[0], 0x5a, sizeof(salt));
+
+   for (size_t n = pgexporter_bench_next_size(0, DERIVE_LIMIT); n > 0; n = pgexporter_bench_next_size(n, DERIVE_LIMIT))
+   {
+      start = pgexporter_bench_now();
+      for (size_t i = 0; i < n; i++)
+      {
+         pgexporter_clear_scram_keys();
+         MCTF_ASSERT(!pgexporter_scram_keys("pgexporter", "pgexporter", &salt[0], sizeof(salt), ITERATIONS,
+                                            &client_key[0], &server_key[0]),
+                     cleanup, "Derivation failed");
+      }
+      pgexporter_bench_record("scram_keys_derive", n, n, pgexporter_bench_now() - start);
+
+      start = pgexporter_bench_now();
+      for (size_t i = 0; i < n; i++)
+      {
+         MCTF_ASSERT(!pgexporter_scram_keys("pgexporter", "pgexporter", &salt[0], sizeof(salt), ITERATIONS,
+                                            &cached_client_key[0], &cached_server_key[0]),
+                     cleanup, "Lookup failed");
+      }
+      pgexporter_bench_record("scram_keys_cached", n, n, pgexporter_bench_now() - start);
+
+      MCTF_ASSERT(!memcmp(&client_key[0], &cached_client_key[0], SCRAM_KEY_LENGTH), cleanup, "ClientKey mismatch");
+      MCTF_ASSERT(!memcmp(&server_key[0], &cached_server_key[0], SCRAM_KEY_LENGTH), cleanup, "ServerKey mismatch");
+   }
+
+cleanup:
+   if (shmem != NULL)
+   {
+      pgexporter_destroy_shared_memory(shmem, sizeof(struct configuration));
+      shmem = NULL;
+   }
+   MCTF_FINISH();
+}
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <pgexporter.h>
+#include <utils.h>
+
+#include <benchmark.h>
+#include <mctf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* pgexporter_append() walks the whole string on every call */
+#define APPEND_LIMIT 10000
+#define KEY_LENGTH   32
+
+/* The size of the exposition of a large fleet */
+#define EXPOSITION_SERIES   50000
+#define EXPOSITION_DATABASE 50
+
+static char* exposition_append(size_t n);
+static char* exposition_builder(size_t n);
+
+MCTF_TEST(bench_string_append)
+{
+   char key[KEY_LENGTH];
+   char* s = NULL;
+   size_t length;
+   int64_t start;
+
+   for (size_t n = pgexporter_bench_next_size(0, APPEND_LIMIT); n > 0; n = pgexporter_bench_next_size(n, APPEND_LIMIT))
+   {
+      start = pgexporter_bench_now();
+      for (size_t i = 0; i < n; i++)
+      {
+         pgexporter_bench_key(i, &key[0], sizeof(key));
+
+         s = pgexporter_append(s, "pgexporter_bench{server=\"");
+         s = pgexporter_append(s, &key[0]);
+         s = pgexporter_append(s, "\"} ");
+         s = pgexporter_append_int(s, (int)i);
+         s = pgexporter_append_char(s, '\n');
+      }
+      pgexporter_bench_record("string_append", n, n, pgexporter_bench_now() - start);
+
+      length = strlen(s);
+      free(s);
+      s = NULL;
+
+      start = pgexporter_bench_now();
+      for (size_t i = 0; i < n; i++)
+      {
+         pgexporter_bench_key(i, &key[0], sizeof(key));
+
+         s = pgexporter_format_and_append(s, "pgexporter_bench{server=\"%s\"} %d\n", &key[0], (int)i);
+      }
+      pgexporter_bench_record("string_format_and_append", n, n, pgexporter_bench_now() - start);
+
+      MCTF_ASSERT(strlen(s) == length, cleanup, "Appended %zu bytes, expected %zu", strlen(s), length);
+
+      free(s);
+      s = NULL;
+   }
+
+cleanup:
+   free(s);
+   MCTF_FINISH();
+}
+
+MCTF_TEST(bench_string_builder)
+{
+   char key[KEY_LENGTH];
+   char* s = NULL;
+   struct string_builder* sb = NULL;
+   size_t length;
+   int64_t start;
+
+   for (size_t n = pgexporter_bench_next_size(0, 0); n > 0; n = pgexporter_bench_next_size(n, 0))
+   {
+      MCTF_ASSERT(!pgexporter_string_builder_create(0, &sb), cleanup, "String builder creation failed");
+
+      start = pgexporter_bench_now();
+      for (size_t i = 0; i < n; i++)
+      {
+         pgexporter_bench_key(i, &key[0], sizeof(key));
+
+         pgexporter_string_builder_append(sb, "pgexporter_bench{server=\"");
+         pgexporter_string_builder_append(sb, &key[0]);
+         pgexporter_string_builder_append(sb, "\"} ");
+         pgexporter_string_builder_append_int(sb, (int64_t)i);
+         pgexporter_string_builder_append_char(sb, '\n');
+      }
+      length = sb->length;
+      s = pgexporter_string_builder_release(sb);
+      sb = NULL;
+      pgexporter_bench_record("string_builder_append", n, n, pgexporter_bench_now() - start);
+
+      MCTF_ASSERT(strlen(s) == length, cleanup, "Built %zu bytes, expected %zu", strlen(s), length);
+
+      free(s);
+      s = NULL;
+   }
+
+cleanup:
+   free(s);
+   pgexporter_string_builder_destroy(sb);
+   MCTF_FINISH();
+}
+
+MCTF_TEST(bench_string_exposition)
+{
+   char* appended = NULL;
+   char* built = NULL;
+   int64_t start;
+
+   start = pgexporter_bench_now();
+   appended = exposition_append(EXPOSITION_SERIES);
+   pgexporter_bench_record("exposition_append", EXPOSITION_SERIES, EXPOSITION_SERIES, pgexporter_bench_now() - start);
+
+   start = pgexporter_bench_now();
+   built = exposition_builder(EXPOSITION_SERIES);
+   pgexporter_bench_record("exposition_builder", EXPOSITION_SERIES, EXPOSITION_SERIES, pgexporter_bench_now() - start);
+
+   MCTF_ASSERT_PTR_NONNULL(appended, cleanup, "Appending failed");
+   MCTF_ASSERT_PTR_NONNULL(built, cleanup, "Building failed");
+   MCTF_ASSERT(!strcmp(appended, built), cleanup, "The outputs differ");
+
+cleanup:
+   free(appended);
+   free(built);
+   MCTF_FINISH();
+}
+
+/**
+ * Build an exposition the way the formatters did before the string builder,
+ * one allocation per series and an append that walks the whole output
+ * @param n The number of series
+ * @return The exposition
+ */
+static char*
+exposition_append(size_t n)
+{
+   char key[KEY_LENGTH];
+   char database[KEY_LENGTH];
+   char value[KEY_LENGTH];
+   char* data = NULL;
+   char* safe = NULL;
+   char* output = NULL;
+
+   output = pgexporter_append(output, "#HELP pgexporter_bench_series A series of the benchmark\n");
+   output = pgexporter_append(output, "#TYPE pgexporter_bench_series gauge\n");
+
+   for (size_t i = 0; i < n; i++)
+   {
+      pgexporter_bench_key(i, &key[0], sizeof(key));
+      snprintf(&database[0], sizeof(database), "db\"%zu", i % EXPOSITION_DATABASE);
+      snprintf(&value[0], sizeof(value), "%zu", i);
+
+      data = pgexporter_vappend(NULL, 2, "pgexporter_bench_series", "{server=\"primary\"");
+
+      safe = pgexporter_escape_string(&database[0]);
+      data = pgexporter_vappend(data, 3, ", database=\"", safe, "\"");
+      free(safe);
+
+      safe = pgexporter_escape_string(&key[0]);
+      data = pgexporter_vappend(data, 3, ", name=\"", safe, "\"");
+      free(safe);
+
+      data = pgexporter_vappend(data, 4, "}", " ", &value[0], "\n");
+
+      output = pgexporter_append(output, data);
+      free(data);
+   }
+
+   return output;
+}
+
+/**
+ * Build an exposition with one string builder, as the formatters do
+ * @param n The number of series
+ * @return The exposition
+ */
+static char*
+exposition_builder(size_t n)
+{
+   char key[KEY_LENGTH];
+   char database[KEY_LENGTH];
+   struct string_builder* sb = NULL;
+
+   if (pgexporter_string_builder_create(0, &sb))
+   {
+      return NULL;
+   }
+
+   pgexporter_string_builder_append(sb, "#HELP pgexporter_bench_series A series of the benchmark\n");
+   pgexporter_string_builder_append(sb, "#TYPE pgexporter_bench_series gauge\n");
+
+   for (size_t i = 0; i < n; i++)
+   {
+      pgexporter_bench_key(i, &key[0], sizeof(key));
+      snprintf(&database[0], sizeof(database), "db\"%zu", i % EXPOSITION_DATABASE);
+
+      pgexporter_string_builder_append(sb, "pgexporter_bench_series{server=\"primary\", database=\"");
+      pgexporter_string_builder_append_escaped(sb, &database[0]);
+      pgexporter_string_builder_append(sb, "\", name=\"");
+      pgexporter_string_builder_append_escaped(sb, &key[0]);
+      pgexporter_string_builder_append(sb, "\"} ");
+      pgexporter_string_builder_append_int(sb, (int64_t)i);
+      pgexporter_string_builder_append_char(sb, '\n');
+   }
+
+   return pgexporter_string_builder_release(sb);
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <pgexporter.h>
+#include <value.h>
+
+#include <benchmark.h>
+#include <mctf.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KEY_LENGTH 32
+
+static int bench_value(char* name, enum value_type type, size_t n);
+
+MCTF_TEST(bench_value_int64)
+{
+   for (size_t n = pgexporter_bench_next_size(0, 0); n > 0; n = pgexporter_bench_next_size(n, 0))
+   {
+      MCTF_ASSERT(!bench_value("value_int64", ValueInt64, n), cleanup, "Int64 values failed");
+   }
+
+cleanup:
+   MCTF_FINISH();
+}
+
+MCTF_TEST(bench_value_string)
+{
+   for (size_t n = pgexporter_bench_next_size(0, 0); n > 0; n = pgexporter_bench_next_size(n, 0))
+   {
+      MCTF_ASSERT(!bench_value("value_string", ValueString, n), cleanup, "String values failed");
+   }
+
+cleanup:
+   MCTF_FINISH();
+}
+
+MCTF_TEST(bench_value_double)
+{
+   for (size_t n = pgexporter_bench_next_size(0, 0); n > 0; n = pgexporter_bench_next_size(n, 0))
+   {
+      MCTF_ASSERT(!bench_value("value_double", ValueDouble, n), cleanup, "Double values failed");
+   }
+
+cleanup:
+   MCTF_FINISH();
+}
+
+static int
+bench_value(char* name, enum value_type type, size_t n)
+{
+   char key[KEY_LENGTH];
+   char tag[64];
+   char* s = NULL;
+   uintptr_t data;
+   struct value** values = NULL;
+   int64_t start;
+
+   values = (struct value**)calloc(n, sizeof(struct value*));
+   if (values == NULL)
+   {
+      goto error;
+   }
+
+   start = pgexporter_bench_now();
+   for (size_t i = 0; i < n; i++)
+   {
+      switch (type)
+      {
+         case ValueString:
+            pgexporter_bench_key(i, &key[0], sizeof(key));
+            data = (uintptr_t)key;
+            break;
+         case ValueDouble:
+            data = pgexporter_value_from_double((double)i / 3.0);
+            break;
+         default:
+            data = (uintptr_t)i;
+            break;
+      }
+
+      if (pgexporter_value_create(type, data, &values[i]))
+      {
+         goto error;
+      }
+   }
+   snprintf(&tag[0], sizeof(tag), "%s_create", name);
+   pgexporter_bench_record(&tag[0], n, n, pgexporter_bench_now() - start);
+
+   start = pgexporter_bench_now();
+   for (size_t i = 0; i < n; i++)
+   {
+      s = pgexporter_value_to_string(values[i], FORMAT_TEXT, NULL, 0);
+      if (s == NULL)
+      {
+         goto error;
+      }
+      free(s);
+      s = NULL;
+   }
+   snprintf(&tag[0], sizeof(tag), "%s_to_string", name);
+   pgexporter_bench_record(&tag[0], n, n, pgexporter_bench_now() - start);
+
+   start = pgexporter_bench_now();
+   for (size_t i = 0; i < n; i++)
+   {
+      pgexporter_value_destroy(values[i]);
+      values[i] = NULL;
+   }
+   snprintf(&tag[0], sizeof(tag), "%s_destroy", name);
+   pgexporter_bench_record(&tag[0], n, n, pgexporter_bench_now() - start);
+
+   free(values);
+
+   return 0;
+
+error:
+
+   if (values != NULL)
+   {
+      for (size_t i = 0; i < n; i++)
+      {
+         pgexporter_value_destroy(values[i]);
+      }
+   }
+   free(values);
+
+   return 1;
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* pgexporter */
+#include <pgexporter.h>
+#include <deque.h>
+
+#include <benchmark.h>
+
+/* system */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** @struct bench_measurement
+ * Defines a measurement
+ */
+struct bench_measurement
+{
+   size_t size;       /**< The size of the data set */
+   size_t operations; /**< The number of operations */
+   int64_t elapsed;   /**< The elapsed time in nanoseconds */
+};
+
+static struct deque* measurements = NULL;
+static size_t max_size = BENCH_DEFAULT_SIZE;
+
+int64_t
+pgexporter_bench_now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+size_t
+pgexporter_bench_max_size(void)
+{
+   return max_size;
+}
+
+void
+pgexporter_bench_set_max_size(size_t size)
+{
+   max_size = MAX(size, (size_t)BENCH_MIN_SIZE);
+}
+
+size_t
+pgexporter_bench_next_size(size_t size, size_t limit)
+{
+   size_t next = size == 0 ? BENCH_MIN_SIZE : size * 10;
+
+   if (next > max_size || (limit > 0 && next > limit))
+   {
+      return 0;
+   }
+
+   return next;
+}
+
+void
+pgexporter_bench_key(size_t i, char* key, size_t size)
+{
+   uint64_t h = (uint64_t)i;
+
+   /* splitmix64 finalizer, a bijection so the keys stay unique */
+   h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+   h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+   h = h ^ (h >> 31);
+
+   snprintf(key, size, "key_%016llx", (unsigned long long)h);
+}
+
+int
+pgexporter_bench_record(char* name, size_t size, size_t operations, int64_t elapsed)
+{
+   struct bench_measurement* m = NULL;
+
+   if (measurements == NULL && pgexporter_deque_create(false, &measurements))
+   {
+      return 1;
+   }
+
+   m = malloc(sizeof(struct bench_measurement));
+   if (m == NULL)
+   {
+      return 1;
+   }
+
+   m->size = size;
+   m->operations = operations;
+   m->elapsed = elapsed;
+
+   return pgexporter_deque_add(measurements, name, (uintptr_t)m, ValueMem);
+}
+
+void
+pgexporter_bench_write(FILE* out)
+{
+   struct deque_iterator* iter = NULL;
+   struct bench_measurement* m = NULL;
+
+   fprintf(out, "benchmark,size,operations,ns_total,ns_per_op\n");
+
+   if (measurements == NULL || pgexporter_deque_iterator_create(measurements, &iter))
+   {
+      return;
+   }
+
+   while (pgexporter_deque_iterator_next(iter))
+   {
+      m = (struct bench_measurement*)pgexporter_value_data(iter->value);
+
+      fprintf(out, "%s,%zu,%zu,%lld,%.2f\n", iter->tag, m->size, m->operations,
+              (long long)m->elapsed,
+              m->operations > 0 ? (double)m->elapsed / (double)m->operations : 0.0);
+   }
+
+   pgexporter_deque_iterator_destroy(iter);
+}
+
+void
+pgexporter_bench_destroy(void)
+{
+   pgexporter_deque_destroy(measurements);
+   measurements = NULL;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef PGEXPORTER_BENCHMARK_H
+#define PGEXPORTER_BENCHMARK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define BENCH_MIN_SIZE     1000
+#define BENCH_DEFAULT_SIZE 1000000
+
+/**
+ * Get the current monotonic time
+ * @return The time in nanoseconds
+ */
+int64_t
+pgexporter_bench_now(void);
+
+/**
+ * Get the largest data set size to benchmark
+ * @return The size
+ */
+size_t
+pgexporter_bench_max_size(void);
+
+/**
+ * Set the largest data set size to benchmark
+ * @param size The size
+ */
+void
+pgexporter_bench_set_max_size(size_t size);
+
+/**
+ * Get the next data set size, the sizes go by powers of ten
+ * from BENCH_MIN_SIZE to the maximum size
+ * @param size The current size, or 0 for the first one
+ * @param limit The largest size the benchmark supports, or 0 for no limit
+ * @return The next size, or 0 when done
+ */
+size_t
+pgexporter_bench_next_size(size_t size, size_t limit);
+
+/**
+ * Generate the key of an element, keys are unique and spread
+ * over the key space
+ * @param i The element
+ * @param key The key buffer
+ * @param size The size of the key buffer
+ */
+void
+pgexporter_bench_key(size_t i, char* key, size_t size);
+
+/**
+ * Record a measurement
+ * @param name The benchmark
+ * @param size The size of the data set
+ * @param operations The number of operations measured
+ * @param elapsed The elapsed time in nanoseconds
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_bench_record(char* name, size_t size, size_t operations, int64_t elapsed);
+
+/**
+ * Write the measurements as CSV
+ * @param out The stream
+ */
+void
+pgexporter_bench_write(FILE* out);
+
+/**
+ * Release the measurements
+ */
+void
+pgexporter_bench_destroy(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
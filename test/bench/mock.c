@@ -0,0 +1,1803 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* pgexporter */
+#include <pgexporter.h>
+#include <utils.h>
+
+/* system */
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+/*
+ * pgexporter-mock
+ *
+ * A small stand-in for PostgreSQL that speaks enough of the v3 protocol for
+ * pgexporter to scrape it: startup, trust and SCRAM-SHA-256 authentication,
+ * simple and extended queries and CancelRequest. The catalog queries issued by
+ * the exporter itself get canned answers, every other SELECT gets a generated
+ * result set whose size is controlled from the command line.
+ */
+
+#define MOCK_MAX_SERVERS     256
+#define MOCK_MAX_STATEMENTS   64
+#define MOCK_MAX_COLUMNS      64
+#define MOCK_FLUSH_SIZE    65536
+#define MOCK_ITERATIONS     4096
+#define MOCK_MAX_CANCELS    1024
+#define MOCK_DELAY_SLICE      10
+
+#define RESULT_ERROR           0
+#define RESULT_COMMAND         1
+#define RESULT_MONITOR         2
+#define RESULT_VERSION         3
+#define RESULT_UPTIME          4
+#define RESULT_PRIMARY         5
+#define RESULT_DATABASE_SIZE   6
+#define RESULT_DATABASE_LIST   7
+#define RESULT_EXTENSIONS      8
+#define RESULT_SETTINGS        9
+#define RESULT_FIPS           10
+#define RESULT_GENERIC        11
+
+/** @struct mock_options
+ * Defines the command line options of the mock
+ */
+struct mock_options
+{
+   char host[MISC_LENGTH];     /**< The listen address */
+   int port;                   /**< The first port */
+   int servers;                /**< The number of servers, one port each */
+   int databases;              /**< The number of databases reported */
+   int rows;                   /**< The number of rows in generated result sets */
+   bool scram;                 /**< Require SCRAM-SHA-256 */
+   char user[MAX_USERNAME_LENGTH]; /**< The user for SCRAM-SHA-256 */
+   char password[MAX_PASSWORD_LENGTH]; /**< The password for SCRAM-SHA-256 */
+   int major[MOCK_MAX_SERVERS]; /**< The reported major version of each server */
+   int minor[MOCK_MAX_SERVERS]; /**< The reported minor version of each server */
+   int delay;                  /**< The delay of every query in milliseconds */
+   int unprivileged;           /**< The first server without the pg_monitor role, -1 for none */
+};
+
+/** @struct mock_result
+ * Defines the answer to a query
+ */
+struct mock_result
+{
+   int type;                                   /**< The result type */
+   int columns;                                /**< The number of columns */
+   int rows;                                   /**< The number of rows */
+   char tag[MISC_LENGTH];                      /**< The command tag */
+   char names[MOCK_MAX_COLUMNS][MISC_LENGTH];  /**< The column names */
+   bool arrays[MOCK_MAX_COLUMNS];              /**< The columns holding arrays */
+};
+
+/** @struct mock_statement
+ * Defines a prepared statement or a portal of the extended protocol
+ */
+struct mock_statement
+{
+   char name[MISC_LENGTH]; /**< The name, empty for the unnamed one */
+   char* query;            /**< The query */
+};
+
+/** @struct mock_connection
+ * Defines a client connection
+ */
+struct mock_connection
+{
+   int socket;                                            /**< The socket */
+   int server;                                            /**< The server index */
+   int32_t pid;                                           /**< The backend process id */
+   int32_t secret;                                        /**< The cancel key */
+   struct string_builder* out;                            /**< The pending output */
+   struct mock_statement statements[MOCK_MAX_STATEMENTS]; /**< The prepared statements */
+   struct mock_statement portals[MOCK_MAX_STATEMENTS];    /**< The portals */
+};
+
+static void usage(void);
+static void print_counters(void);
+static void* connection_main(void* arg);
+static int startup(struct mock_connection* c);
+static int authenticate_scram(struct mock_connection* c);
+static int simple_query(struct mock_connection* c, char* query);
+static int extended_query(struct mock_connection* c, char type, char* data, size_t length, bool* failed);
+static void classify(char* query, struct mock_result* result);
+static int describe_columns(char* query, struct mock_result* result);
+static void describe_column(char* item, size_t length, char* name, bool* array);
+static bool is_identifier(unsigned char c);
+static bool strcasestr_length(char* s, size_t length, char* needle);
+static void result_value(struct mock_connection* c, struct mock_result* result, int row, int column, char* value, size_t size);
+static int send_row_description(struct mock_connection* c, struct mock_result* result);
+static int send_rows(struct mock_connection* c, struct mock_result* result);
+static int send_error(struct mock_connection* c, char* code, char* message);
+static int send_ready(struct mock_connection* c);
+static int send_parameter(struct mock_connection* c, char* name, char* value);
+static int send_authentication(struct mock_connection* c, int32_t code, char* data, size_t length);
+static struct mock_statement* find_statement(struct mock_statement* statements, char* name, bool create);
+static void clear_statements(struct mock_statement* statements);
+static size_t begin_message(struct string_builder* sb, char type);
+static void end_message(struct string_builder* sb, size_t offset);
+static int append_int16(struct string_builder* sb, int16_t i);
+static int append_int32(struct string_builder* sb, int32_t i);
+static int append_cstring(struct string_builder* sb, char* s);
+static int flush_output(struct mock_connection* c);
+static int read_fully(int socket, void* buffer, size_t length);
+static int read_message(int socket, char* type, char** data, size_t* length);
+static int base64_encode(unsigned char* data, size_t length, char* out, size_t size);
+static int base64_decode(char* data, unsigned char* out, size_t size);
+static bool delay_query(struct mock_connection* c);
+static void signal_handler(int signum);
+
+static struct mock_options options;
+static unsigned char scram_salt[16];
+static unsigned char scram_stored_key[SHA256_DIGEST_LENGTH];
+static unsigned char scram_server_key[SHA256_DIGEST_LENGTH];
+static atomic_int next_pid = 10000;
+static atomic_ulong connections = 0;
+static atomic_ulong queries = 0;
+static atomic_ulong cancels = 0;
+static atomic_ulong pipelined = 0;
+static atomic_bool canceled[MOCK_MAX_CANCELS];
+static volatile sig_atomic_t running = 1;
+static volatile sig_atomic_t report = 0;
+
+int
+main(int argc, char** argv)
+{
+   int c;
+   int on = 1;
+   int listeners[MOCK_MAX_SERVERS];
+   struct pollfd fds[MOCK_MAX_SERVERS];
+   struct sockaddr_in address;
+   struct sigaction sa;
+   char* auth = "scram";
+   char* version = "17.0";
+
+   memset(&options, 0, sizeof(struct mock_options));
+   snprintf(&options.host[0], sizeof(options.host), "127.0.0.1");
+   snprintf(&options.user[0], sizeof(options.user), "pgexporter");
+   snprintf(&options.password[0], sizeof(options.password), "pgexporter");
+   options.port = 6432;
+   options.servers = 1;
+   options.databases = 1;
+   options.rows = 10;
+   options.unprivileged = -1;
+
+   while ((c = getopt(argc, argv, "h:p:n:d:r:a:U:P:v:l:m:?")) != -1)
+   {
+      switch (c)
+      {
+         case 'h':
+            snprintf(&options.host[0], sizeof(options.host), "%s", optarg);
+            break;
+         case 'p':
+            options.port = atoi(optarg);
+            break;
+         case 'n':
+            options.servers = atoi(optarg);
+            break;
+         case 'd':
+            options.databases = atoi(optarg);
+            break;
+         case 'r':
+            options.rows = atoi(optarg);
+            break;
+         case 'a':
+            auth = optarg;
+            break;
+         case 'U':
+            snprintf(&options.user[0], sizeof(options.user), "%s", optarg);
+            break;
+         case 'P':
+            snprintf(&options.password[0], sizeof(options.password), "%s", optarg);
+            break;
+         case 'v':
+            version = optarg;
+            break;
+         case 'l':
+            options.delay = atoi(optarg);
+            break;
+         case 'm':
+            options.unprivileged = atoi(optarg);
+            break;
+         default:
+            usage();
+            exit(1);
+      }
+   }
+
+   if (options.servers < 1 || options.servers > MOCK_MAX_SERVERS || options.port <= 0 ||
+       options.databases < 0 || options.rows < 0 || options.delay < 0)
+   {
+      usage();
+      exit(1);
+   }
+
+   if (!strcasecmp(auth, "scram"))
+   {
+      options.scram = true;
+   }
+   else if (strcasecmp(auth, "trust"))
+   {
+      usage();
+      exit(1);
+   }
+
+   /* A comma separated list gives the versions of the servers in order,
+    * the last one is repeated for the remaining servers */
+   for (int i = 0; i < MOCK_MAX_SERVERS; i++)
+   {
+      if (sscanf(version, "%d.%d", &options.major[i], &options.minor[i]) < 1)
+      {
+         usage();
+         exit(1);
+      }
+
+      if (strchr(version, ',') != NULL)
+      {
+         version = strchr(version, ',') + 1;
+      }
+   }
+
+   if (options.scram)
+   {
+      unsigned char salted[SHA256_DIGEST_LENGTH];
+      unsigned char client_key[SHA256_DIGEST_LENGTH];
+      unsigned int length;
+
+      RAND_bytes(&scram_salt[0], sizeof(scram_salt));
+
+      PKCS5_PBKDF2_HMAC(&options.password[0], strlen(&options.password[0]),
+                        &scram_salt[0], sizeof(scram_salt), MOCK_ITERATIONS,
+                        EVP_sha256(), sizeof(salted), &salted[0]);
+
+      HMAC(EVP_sha256(), &salted[0], sizeof(salted), (unsigned char*)"Client Key", 10, &client_key[0], &length);
+      SHA256(&client_key[0], sizeof(client_key), &scram_stored_key[0]);
+      HMAC(EVP_sha256(), &salted[0], sizeof(salted), (unsigned char*)"Server Key", 10, &scram_server_key[0], &length);
+   }
+
+   memset(&sa, 0, sizeof(sa));
+   sa.sa_handler = signal_handler;
+   sigaction(SIGINT, &sa, NULL);
+   sigaction(SIGTERM, &sa, NULL);
+   sigaction(SIGUSR1, &sa, NULL);
+   signal(SIGPIPE, SIG_IGN);
+
+   for (int i = 0; i < options.servers; i++)
+   {
+      listeners[i] = socket(AF_INET, SOCK_STREAM, 0);
+      if (listeners[i] == -1)
+      {
+         perror("socket");
+         exit(1);
+      }
+
+      setsockopt(listeners[i], SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+      memset(&address, 0, sizeof(address));
+      address.sin_family = AF_INET;
+      address.sin_port = htons(options.port + i);
+      if (inet_pton(AF_INET, &options.host[0], &address.sin_addr) != 1)
+      {
+         fprintf(stderr, "pgexporter-mock: Invalid address %s\n", &options.host[0]);
+         exit(1);
+      }
+
+      if (bind(listeners[i], (struct sockaddr*)&address, sizeof(address)) || listen(listeners[i], 128))
+      {
+         fprintf(stderr, "pgexporter-mock: Unable to listen on %s:%d: %s\n",
+                 &options.host[0], options.port + i, strerror(errno));
+         exit(1);
+      }
+
+      fds[i].fd = listeners[i];
+      fds[i].events = POLLIN;
+   }
+
+   printf("pgexporter-mock: %d server(s) on %s:%d-%d, %d database(s), %d row(s), %s, version %d.%d\n",
+          options.servers, &options.host[0], options.port, options.port + options.servers - 1,
+          options.databases, options.rows, options.scram ? "scram-sha-256" : "trust",
+          options.major[0], options.minor[0]);
+   fflush(stdout);
+
+   while (running)
+   {
+      if (report)
+      {
+         report = 0;
+         print_counters();
+      }
+
+      if (poll(&fds[0], options.servers, 1000) <= 0)
+      {
+         continue;
+      }
+
+      for (int i = 0; i < options.servers; i++)
+      {
+         int fd;
+         pthread_t thread;
+         struct mock_connection* conn = NULL;
+
+         if (!(fds[i].revents & POLLIN))
+         {
+            continue;
+         }
+
+         fd = accept(listeners[i], NULL, NULL);
+         if (fd == -1)
+         {
+            continue;
+         }
+
+         setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+         conn = calloc(1, sizeof(struct mock_connection));
+         if (conn == NULL || pgexporter_string_builder_create(MOCK_FLUSH_SIZE, &conn->out))
+         {
+            free(conn);
+            close(fd);
+            continue;
+         }
+
+         conn->socket = fd;
+         conn->server = i;
+         conn->pid = atomic_fetch_add(&next_pid, 1);
+         atomic_store(&canceled[conn->pid % MOCK_MAX_CANCELS], false);
+         conn->secret = (int32_t)random();
+
+         if (pthread_create(&thread, NULL, connection_main, conn))
+         {
+            pgexporter_string_builder_destroy(conn->out);
+            free(conn);
+            close(fd);
+            continue;
+         }
+
+         pthread_detach(thread);
+      }
+   }
+
+   for (int i = 0; i < options.servers; i++)
+   {
+      close(listeners[i]);
+   }
+
+   print_counters();
+
+   return 0;
+}
+
+static void
+print_counters(void)
+{
+   printf("pgexporter-mock: %lu connection(s), %lu quer%s, %lu cancel request(s), %lu pipelined\n",
+          atomic_load(&connections), atomic_load(&queries),
+          atomic_load(&queries) == 1 ? "y" : "ies", atomic_load(&cancels),
+          atomic_load(&pipelined));
+   fflush(stdout);
+}
+
+static void
+usage(void)
+{
+   printf("pgexporter-mock %s\n", VERSION);
+   printf("  Mock PostgreSQL server for benchmarking pgexporter\n");
+   printf("\n");
+   printf("Usage:\n");
+   printf("  pgexporter-mock [ -h HOST ] [ -p PORT ] [ -n SERVERS ] [ -d DATABASES ] [ -r ROWS ]\n");
+   printf("                  [ -a trust|scram ] [ -U USER ] [ -P PASSWORD ] [ -v VERSION ] [ -l DELAY ] [ -m SERVER ]\n");
+   printf("\n");
+   printf("Options:\n");
+   printf("  -h HOST       Listen address (default 127.0.0.1)\n");
+   printf("  -p PORT       First port, server N listens on PORT + N (default 6432)\n");
+   printf("  -n SERVERS    Number of servers (default 1)\n");
+   printf("  -d DATABASES  Number of databases besides postgres (default 1)\n");
+   printf("  -r ROWS       Rows in generated result sets and pg_settings (default 10)\n");
+   printf("  -a AUTH       Authentication, trust or scram (default scram)\n");
+   printf("  -U USER       User name (default pgexporter)\n");
+   printf("  -P PASSWORD   Password for scram (default pgexporter)\n");
+   printf("  -v VERSION    Reported server version, or a comma separated list per server (default 17.0)\n");
+   printf("  -l DELAY      Delay of every query in milliseconds, a cancel request ends it (default 0)\n");
+   printf("  -m SERVER     The servers from SERVER on lack the pg_monitor role (default none)\n");
+   printf("\n");
+   printf("SIGUSR1 prints the counters\n");
+}
+
+static void*
+connection_main(void* arg)
+{
+   struct mock_connection* c = (struct mock_connection*)arg;
+   char type;
+   char* data = NULL;
+   size_t length;
+   bool failed = false;
+
+   atomic_fetch_add(&connections, 1);
+
+   if (startup(c))
+   {
+      goto done;
+   }
+
+   while (running)
+   {
+      free(data);
+      data = NULL;
+
+      if (read_message(c->socket, &type, &data, &length))
+      {
+         break;
+      }
+
+      if (type == 'X')
+      {
+         break;
+      }
+      else if (type == 'Q')
+      {
+         int pending = 0;
+
+         /* The next message was sent before the answer to this query */
+         if (ioctl(c->socket, FIONREAD, &pending) == 0 && pending > 0)
+         {
+            atomic_fetch_add(&pipelined, 1);
+         }
+
+         if (simple_query(c, data))
+         {
+            break;
+         }
+      }
+      else if (type == 'S')
+      {
+         failed = false;
+         if (send_ready(c) || flush_output(c))
+         {
+            break;
+         }
+      }
+      else if (type == 'H')
+      {
+         if (flush_output(c))
+         {
+            break;
+         }
+      }
+      else if (failed)
+      {
+         /* Skip until Sync after an error in the extended protocol */
+         continue;
+      }
+      else if (extended_query(c, type, data, length, &failed))
+      {
+         break;
+      }
+   }
+
+done:
+
+   free(data);
+   clear_statements(&c->statements[0]);
+   clear_statements(&c->portals[0]);
+   pgexporter_string_builder_destroy(c->out);
+   close(c->socket);
+   free(c);
+
+   return NULL;
+}
+
+static int
+startup(struct mock_connection* c)
+{
+   int32_t length;
+   int32_t code;
+   char header[4];
+   char* data = NULL;
+   size_t offset;
+   char* user = NULL;
+   char version[MISC_LENGTH];
+
+   while (true)
+   {
+      if (read_fully(c->socket, &header[0], 4))
+      {
+         goto error;
+      }
+
+      length = pgexporter_read_int32(&header[0]);
+      if (length < 8 || length > 10000)
+      {
+         goto error;
+      }
+
+      data = calloc(1, length - 4 + 1);
+      if (data == NULL || read_fully(c->socket, data, length - 4))
+      {
+         goto error;
+      }
+
+      code = pgexporter_read_int32(data);
+
+      if (code == 80877103 || code == 80877104)
+      {
+         /* SSLRequest and GSSENCRequest are declined */
+         if (write(c->socket, "N", 1) != 1)
+         {
+            goto error;
+         }
+         free(data);
+         data = NULL;
+         continue;
+      }
+      else if (code == 80877102)
+      {
+         /* A cancel request ends the delay of the query of the backend */
+         atomic_fetch_add(&cancels, 1);
+         atomic_store(&canceled[pgexporter_read_int32(data + 4) % MOCK_MAX_CANCELS], true);
+         goto error;
+      }
+      else if (code != 196608)
+      {
+         goto error;
+      }
+
+      break;
+   }
+
+   offset = 4;
+   while (offset < (size_t)length - 4 && data[offset] != '\0')
+   {
+      char* key = data + offset;
+      char* value = key + strlen(key) + 1;
+
+      if (!strcmp(key, "user"))
+      {
+         user = value;
+      }
+
+      offset = (value - data) + strlen(value) + 1;
+   }
+
+   if (options.scram)
+   {
+      if (user == NULL || strcmp(user, &options.user[0]))
+      {
+         send_error(c, "28P01", "password authentication failed");
+         flush_output(c);
+         goto error;
+      }
+
+      if (authenticate_scram(c))
+      {
+         goto error;
+      }
+   }
+
+   snprintf(&version[0], sizeof(version), "%d.%d", options.major[c->server], options.minor[c->server]);
+
+   if (send_authentication(c, 0, NULL, 0) ||
+       send_parameter(c, "server_version", &version[0]) ||
+       send_parameter(c, "server_encoding", "UTF8") ||
+       send_parameter(c, "client_encoding", "UTF8") ||
+       send_parameter(c, "DateStyle", "ISO, MDY") ||
+       send_parameter(c, "integer_datetimes", "on"))
+   {
+      goto error;
+   }
+
+   offset = begin_message(c->out, 'K');
+   append_int32(c->out, c->pid);
+   append_int32(c->out, c->secret);
+   end_message(c->out, offset);
+
+   if (send_ready(c) || flush_output(c))
+   {
+      goto error;
+   }
+
+   free(data);
+
+   return 0;
+
+error:
+
+   free(data);
+
+   return 1;
+}
+
+static int
+authenticate_scram(struct mock_connection* c)
+{
+   char type;
+   char* data = NULL;
+   size_t length;
+   char* client_first = NULL;
+   char* client_first_bare = NULL;
+   char* client_nonce = NULL;
+   char* client_final = NULL;
+   char* proof = NULL;
+   unsigned char server_nonce[18];
+   char nonce[128];
+   char salt[64];
+   char server_first[256];
+   char* auth_message = NULL;
+   size_t auth_length;
+   unsigned char decoded[SHA256_DIGEST_LENGTH + 2];
+   unsigned char signature[SHA256_DIGEST_LENGTH];
+   unsigned char client_key[SHA256_DIGEST_LENGTH];
+   unsigned char stored_key[SHA256_DIGEST_LENGTH];
+   char server_final[128];
+   unsigned int hmac_length;
+   char* p;
+
+   if (send_authentication(c, 10, "SCRAM-SHA-256\0", 15) || flush_output(c))
+   {
+      goto error;
+   }
+
+   /* SASLInitialResponse: mechanism, length, client-first-message */
+   if (read_message(c->socket, &type, &data, &length) || type != 'p')
+   {
+      goto error;
+   }
+
+   if (strcmp(data, "SCRAM-SHA-256") || length < 14 + 4)
+   {
+      goto error;
+   }
+
+   client_first = strndup(data + 14 + 4, length - 14 - 4);
+   free(data);
+   data = NULL;
+
+   if (client_first == NULL || strncmp(client_first, "n,", 2))
+   {
+      goto error;
+   }
+
+   client_first_bare = strchr(client_first + 2, ',');
+   if (client_first_bare == NULL)
+   {
+      goto error;
+   }
+   client_first_bare++;
+
+   client_nonce = strstr(client_first_bare, "r=");
+   if (client_nonce == NULL)
+   {
+      goto error;
+   }
+   client_nonce += 2;
+   p = strchr(client_nonce, ',');
+   if (p != NULL)
+   {
+      *p = '\0';
+   }
+
+   RAND_bytes(&server_nonce[0], sizeof(server_nonce));
+   snprintf(&nonce[0], sizeof(nonce), "%s", client_nonce);
+   if (p != NULL)
+   {
+      *p = ',';
+   }
+   base64_encode(&server_nonce[0], sizeof(server_nonce), &nonce[strlen(nonce)], sizeof(nonce) - strlen(nonce));
+   base64_encode(&scram_salt[0], sizeof(scram_salt), &salt[0], sizeof(salt));
+
+   snprintf(&server_first[0], sizeof(server_first), "r=%s,s=%s,i=%d", &nonce[0], &salt[0], MOCK_ITERATIONS);
+
+   if (send_authentication(c, 11, &server_first[0], strlen(&server_first[0])) || flush_output(c))
+   {
+      goto error;
+   }
+
+   /* SASLResponse: client-final-message */
+   if (read_message(c->socket, &type, &data, &length) || type != 'p')
+   {
+      goto error;
+   }
+
+   client_final = strndup(data, length);
+   if (client_final == NULL)
+   {
+      goto error;
+   }
+
+   proof = strstr(client_final, ",p=");
+   p = strstr(client_final, ",r=");
+   if (proof == NULL || p == NULL || strncmp(p + 3, &nonce[0], strlen(&nonce[0])))
+   {
+      goto error;
+   }
+   *proof = '\0';
+   proof += 3;
+
+   auth_length = strlen(client_first_bare) + 1 + strlen(&server_first[0]) + 1 + strlen(client_final);
+   auth_message = malloc(auth_length + 1);
+   if (auth_message == NULL)
+   {
+      goto error;
+   }
+   snprintf(auth_message, auth_length + 1, "%s,%s,%s", client_first_bare, &server_first[0], client_final);
+
+   if (base64_decode(proof, &decoded[0], sizeof(decoded)) != SHA256_DIGEST_LENGTH)
+   {
+      goto failed;
+   }
+
+   HMAC(EVP_sha256(), &scram_stored_key[0], sizeof(scram_stored_key),
+        (unsigned char*)auth_message, auth_length, &signature[0], &hmac_length);
+
+   for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
+   {
+      client_key[i] = decoded[i] ^ signature[i];
+   }
+
+   SHA256(&client_key[0], sizeof(client_key), &stored_key[0]);
+
+   if (memcmp(&stored_key[0], &scram_stored_key[0], SHA256_DIGEST_LENGTH))
+   {
+      goto failed;
+   }
+
+   HMAC(EVP_sha256(), &scram_server_key[0], sizeof(scram_server_key),
+        (unsigned char*)auth_message, auth_length, &signature[0], &hmac_length);
+
+   memcpy(&server_final[0], "v=", 2);
+   base64_encode(&signature[0], sizeof(signature), &server_final[2], sizeof(server_final) - 2);
+
+   if (send_authentication(c, 12, &server_final[0], strlen(&server_final[0])))
+   {
+      goto error;
+   }
+
+   free(data);
+   free(client_first);
+   free(client_final);
+   free(auth_message);
+
+   return 0;
+
+failed:
+
+   send_error(c, "28P01", "password authentication failed");
+   flush_output(c);
+
+error:
+
+   free(data);
+   free(client_first);
+   free(client_final);
+   free(auth_message);
+
+   return 1;
+}
+
+static int
+simple_query(struct mock_connection* c, char* query)
+{
+   struct mock_result result;
+
+   atomic_fetch_add(&queries, 1);
+
+   if (delay_query(c))
+   {
+      if (send_error(c, "57014", "canceling statement due to user request"))
+      {
+         return 1;
+      }
+
+      goto ready;
+   }
+
+   classify(query, &result);
+
+   if (result.type == RESULT_ERROR)
+   {
+      if (send_error(c, "42601", "query not supported by pgexporter-mock"))
+      {
+         return 1;
+      }
+   }
+   else if (result.type == RESULT_COMMAND)
+   {
+      size_t offset = begin_message(c->out, 'C');
+      append_cstring(c->out, &result.tag[0]);
+      end_message(c->out, offset);
+   }
+   else if (!strcmp(result.tag, "EMPTY"))
+   {
+      size_t offset = begin_message(c->out, 'I');
+      end_message(c->out, offset);
+   }
+   else
+   {
+      if (send_row_description(c, &result) || send_rows(c, &result))
+      {
+         return 1;
+      }
+   }
+
+ready:
+
+   if (send_ready(c) || flush_output(c))
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+extended_query(struct mock_connection* c, char type, char* data, size_t length, bool* failed)
+{
+   struct mock_statement* statement = NULL;
+   struct mock_statement* portal = NULL;
+   struct mock_result result;
+   size_t offset;
+   char* name;
+   char* query;
+
+   switch (type)
+   {
+      case 'P':
+         /* Parse: statement name, query, parameter types */
+         name = data;
+         query = data + strlen(name) + 1;
+         if ((size_t)(query - data) >= length)
+         {
+            goto failed;
+         }
+
+         statement = find_statement(&c->statements[0], name, true);
+         if (statement == NULL)
+         {
+            goto failed;
+         }
+         free(statement->query);
+         statement->query = strdup(query);
+
+         offset = begin_message(c->out, '1');
+         end_message(c->out, offset);
+         break;
+      case 'B':
+         /* Bind: portal name, statement name, parameters are ignored */
+         name = data;
+         statement = find_statement(&c->statements[0], data + strlen(name) + 1, false);
+         portal = find_statement(&c->portals[0], name, true);
+         if (statement == NULL || portal == NULL)
+         {
+            goto failed;
+         }
+         free(portal->query);
+         portal->query = strdup(statement->query);
+
+         offset = begin_message(c->out, '2');
+         end_message(c->out, offset);
+         break;
+      case 'D':
+         /* Describe: 'S' statement or 'P' portal */
+         if (data[0] == 'S')
+         {
+            statement = find_statement(&c->statements[0], data + 1, false);
+         }
+         else
+         {
+            statement = find_statement(&c->portals[0], data + 1, false);
+         }
+
+         if (statement == NULL)
+         {
+            goto failed;
+         }
+
+         if (data[0] == 'S')
+         {
+            offset = begin_message(c->out, 't');
+            append_int16(c->out, 0);
+            end_message(c->out, offset);
+         }
+
+         classify(statement->query, &result);
+         if (result.type == RESULT_ERROR)
+         {
+            goto failed;
+         }
+         else if (result.type == RESULT_COMMAND || !strcmp(result.tag, "EMPTY"))
+         {
+            offset = begin_message(c->out, 'n');
+            end_message(c->out, offset);
+         }
+         else if (send_row_description(c, &result))
+         {
+            return 1;
+         }
+         break;
+      case 'E':
+         /* Execute: portal name, row limit is ignored */
+         portal = find_statement(&c->portals[0], data, false);
+         if (portal == NULL)
+         {
+            goto failed;
+         }
+
+         atomic_fetch_add(&queries, 1);
+
+         if (delay_query(c))
+         {
+            *failed = true;
+            return send_error(c, "57014", "canceling statement due to user request");
+         }
+
+         classify(portal->query, &result);
+         if (result.type == RESULT_ERROR)
+         {
+            goto failed;
+         }
+         else if (result.type == RESULT_COMMAND)
+         {
+            offset = begin_message(c->out, 'C');
+            append_cstring(c->out, &result.tag[0]);
+            end_message(c->out, offset);
+         }
+         else if (!strcmp(result.tag, "EMPTY"))
+         {
+            offset = begin_message(c->out, 'I');
+            end_message(c->out, offset);
+         }
+         else if (send_rows(c, &result))
+         {
+            return 1;
+         }
+         break;
+      case 'C':
+         /* Close: 'S' statement or 'P' portal */
+         statement = find_statement(data[0] == 'S' ? &c->statements[0] : &c->portals[0], data + 1, false);
+         if (statement != NULL)
+         {
+            free(statement->query);
+            memset(statement, 0, sizeof(struct mock_statement));
+         }
+
+         offset = begin_message(c->out, '3');
+         end_message(c->out, offset);
+         break;
+      default:
+         goto failed;
+   }
+
+   return 0;
+
+failed:
+
+   *failed = true;
+
+   return send_error(c, "42601", "message not supported by pgexporter-mock");
+}
+
+static void
+classify(char* query, struct mock_result* result)
+{
+   char* q = query;
+
+   memset(result, 0, sizeof(struct mock_result));
+   result->type = RESULT_GENERIC;
+   result->rows = options.rows;
+   snprintf(&result->tag[0], sizeof(result->tag), "SELECT");
+
+   while (isspace((unsigned char)*q) || *q == '(')
+   {
+      q++;
+   }
+
+   if (*q == '\0')
+   {
+      result->type = RESULT_GENERIC;
+      result->rows = 0;
+      snprintf(&result->tag[0], sizeof(result->tag), "EMPTY");
+      return;
+   }
+
+   /* The queries pgexporter issues itself */
+   if (strstr(q, "pg_has_role(current_user, 'pg_monitor'") != NULL)
+   {
+      result->type = RESULT_MONITOR;
+      result->columns = 1;
+      result->rows = 1;
+   }
+   else if (strstr(q, "split_part(split_part(version()") != NULL)
+   {
+      result->type = RESULT_VERSION;
+      result->columns = 2;
+      result->rows = 1;
+   }
+   else if (!strncmp(q, "SELECT FLOOR(EXTRACT(EPOCH FROM now() - pg_postmaster_start_time))", 66))
+   {
+      result->type = RESULT_UPTIME;
+      result->columns = 1;
+      result->rows = 1;
+   }
+   else if (!strncmp(q, "SELECT (CASE pg_is_in_recovery()", 32) ||
+            !strncmp(q, "SELECT CASE pg_is_in_recovery()", 31))
+   {
+      result->type = RESULT_PRIMARY;
+      result->columns = 1;
+      result->rows = 1;
+   }
+   else if (!strncmp(q, "SELECT datname, pg_database_size(datname) FROM pg_database", 58))
+   {
+      result->type = RESULT_DATABASE_SIZE;
+      result->columns = 2;
+      result->rows = options.databases + 1;
+   }
+   else if (!strncmp(q, "SELECT datname FROM pg_database", 31))
+   {
+      result->type = RESULT_DATABASE_LIST;
+      result->columns = 1;
+      result->rows = options.databases;
+   }
+   else if (!strncmp(q, "SELECT name, installed_version, comment FROM pg_available_extensions", 68))
+   {
+      result->type = RESULT_EXTENSIONS;
+      result->columns = 3;
+      result->rows = 0;
+   }
+   else if (!strncmp(q, "SELECT name,setting,short_desc FROM pg_settings", 47))
+   {
+      result->type = RESULT_SETTINGS;
+      result->columns = 3;
+   }
+   else if (!strncmp(q, "SELECT fips_mode()", 18) || !strncmp(q, "SELECT pgexporter_ext_fips()", 28))
+   {
+      result->type = RESULT_FIPS;
+      result->columns = 1;
+      result->rows = 1;
+   }
+   else if (!strncasecmp(q, "SET", 3) || !strncasecmp(q, "RESET", 5) ||
+            !strncasecmp(q, "BEGIN", 5) || !strncasecmp(q, "COMMIT", 6) ||
+            !strncasecmp(q, "ROLLBACK", 8) || !strncasecmp(q, "DISCARD", 7))
+   {
+      int i = 0;
+
+      result->type = RESULT_COMMAND;
+      while (isalpha((unsigned char)q[i]) && i < (int)sizeof(result->tag) - 1)
+      {
+         result->tag[i] = toupper((unsigned char)q[i]);
+         i++;
+      }
+      result->tag[i] = '\0';
+   }
+   else if (!strncasecmp(q, "SELECT", 6) || !strncasecmp(q, "WITH", 4))
+   {
+      if (describe_columns(q, result) <= 0)
+      {
+         result->type = RESULT_ERROR;
+      }
+   }
+   else
+   {
+      result->type = RESULT_ERROR;
+   }
+}
+
+static int
+describe_columns(char* query, struct mock_result* result)
+{
+   char* select = NULL;
+   char* item;
+   int depth = 0;
+   char quote = '\0';
+
+   result->columns = 0;
+
+   /* Find the outermost SELECT, skipping over a WITH clause */
+   for (char* p = query; *p != '\0'; p++)
+   {
+      if (quote != '\0')
+      {
+         if (*p == quote)
+         {
+            quote = '\0';
+         }
+      }
+      else if (*p == '\'' || *p == '"')
+      {
+         quote = *p;
+      }
+      else if (*p == '(')
+      {
+         depth++;
+      }
+      else if (*p == ')')
+      {
+         depth--;
+      }
+      else if (depth == 0 && !strncasecmp(p, "SELECT", 6) &&
+               (p == query || !is_identifier((unsigned char)p[-1])) && !is_identifier((unsigned char)p[6]))
+      {
+         select = p + 6;
+         break;
+      }
+   }
+
+   if (select == NULL)
+   {
+      return 0;
+   }
+
+   depth = 0;
+   quote = '\0';
+   item = select;
+
+   /* Split the target list on the top level commas up to FROM */
+   for (char* p = select;; p++)
+   {
+      bool last = false;
+
+      if (*p == '\0')
+      {
+         last = true;
+      }
+      else if (quote != '\0')
+      {
+         if (*p == quote)
+         {
+            quote = '\0';
+         }
+         continue;
+      }
+      else if (*p == '\'' || *p == '"')
+      {
+         quote = *p;
+         continue;
+      }
+      else if (*p == '(')
+      {
+         depth++;
+         continue;
+      }
+      else if (*p == ')')
+      {
+         depth--;
+         continue;
+      }
+      else if (depth != 0)
+      {
+         continue;
+      }
+      else if (*p == ';' ||
+               (!is_identifier((unsigned char)p[-1]) && !strncasecmp(p, "FROM", 4) && !is_identifier((unsigned char)p[4])))
+      {
+         last = true;
+      }
+      else if (*p != ',')
+      {
+         continue;
+      }
+
+      if (result->columns < MOCK_MAX_COLUMNS)
+      {
+         describe_column(item, p - item, &result->names[result->columns][0], &result->arrays[result->columns]);
+         result->columns++;
+      }
+
+      if (last)
+      {
+         break;
+      }
+
+      item = p + 1;
+   }
+
+   return result->columns;
+}
+
+static void
+describe_column(char* item, size_t length, char* name, bool* array)
+{
+   size_t start = 0;
+   size_t end = length;
+   size_t token;
+   bool quoted = false;
+
+   while (start < end && isspace((unsigned char)item[start]))
+   {
+      start++;
+   }
+   while (end > start && isspace((unsigned char)item[end - 1]))
+   {
+      end--;
+   }
+
+   *array = (end - start >= 5 && !strncasecmp(item + start, "ARRAY", 5)) ||
+            (end - start >= 9 && strcasestr_length(item + start, end - start, "array_agg("));
+
+   /* Drop trailing casts, the name follows the expression */
+   while (end > start && is_identifier((unsigned char)item[end - 1]))
+   {
+      token = end;
+      while (token > start && is_identifier((unsigned char)item[token - 1]))
+      {
+         token--;
+      }
+      if (token >= start + 2 && item[token - 1] == ':' && item[token - 2] == ':')
+      {
+         end = token - 2;
+      }
+      else
+      {
+         break;
+      }
+   }
+
+   if (end > start && item[end - 1] == '"')
+   {
+      token = end - 1;
+      while (token > start && item[token - 1] != '"')
+      {
+         token--;
+      }
+      quoted = true;
+      snprintf(name, MISC_LENGTH, "%.*s", (int)(end - 1 - token), item + token);
+   }
+   else if (end > start && is_identifier((unsigned char)item[end - 1]))
+   {
+      token = end;
+      while (token > start && is_identifier((unsigned char)item[token - 1]))
+      {
+         token--;
+      }
+
+      if (end - token == 3 && !strncasecmp(item + token, "END", 3))
+      {
+         snprintf(name, MISC_LENGTH, "case");
+      }
+      else if (token == start || item[token - 1] == '.' || isspace((unsigned char)item[token - 1]))
+      {
+         /* A column reference, an AS alias or an implicit alias */
+         snprintf(name, MISC_LENGTH, "%.*s", (int)(end - token), item + token);
+      }
+      else
+      {
+         snprintf(name, MISC_LENGTH, "?column?");
+      }
+   }
+   else if (end > start && item[end - 1] == ')' && is_identifier((unsigned char)item[start]))
+   {
+      /* A function call names the column after the function */
+      token = start;
+      while (token < end && is_identifier((unsigned char)item[token]))
+      {
+         token++;
+      }
+      snprintf(name, MISC_LENGTH, "%.*s", (int)(token - start), item + start);
+   }
+   else
+   {
+      snprintf(name, MISC_LENGTH, "?column?");
+   }
+
+   if (!quoted)
+   {
+      for (char* p = name; *p != '\0'; p++)
+      {
+         *p = tolower((unsigned char)*p);
+      }
+   }
+}
+
+static bool
+is_identifier(unsigned char c)
+{
+   return isalnum(c) || c == '_' || c == '$';
+}
+
+static bool
+strcasestr_length(char* s, size_t length, char* needle)
+{
+   size_t n = strlen(needle);
+
+   for (size_t i = 0; i + n <= length; i++)
+   {
+      if (!strncasecmp(s + i, needle, n))
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+static void
+result_value(struct mock_connection* c, struct mock_result* result, int row, int column, char* value, size_t size)
+{
+   switch (result->type)
+   {
+      case RESULT_MONITOR:
+         snprintf(value, size, options.unprivileged != -1 && c->server >= options.unprivileged ? "f" : "t");
+         break;
+      case RESULT_PRIMARY:
+         snprintf(value, size, "t");
+         break;
+      case RESULT_FIPS:
+         snprintf(value, size, "f");
+         break;
+      case RESULT_VERSION:
+         snprintf(value, size, "%d", column == 0 ? options.major[c->server] : options.minor[c->server]);
+         break;
+      case RESULT_UPTIME:
+         snprintf(value, size, "86400");
+         break;
+      case RESULT_DATABASE_SIZE:
+         if (column == 0)
+         {
+            if (row == 0)
+            {
+               snprintf(value, size, "postgres");
+            }
+            else
+            {
+               snprintf(value, size, "db%d", row);
+            }
+         }
+         else
+         {
+            snprintf(value, size, "%d", 8388608 + row * 65536);
+         }
+         break;
+      case RESULT_DATABASE_LIST:
+         snprintf(value, size, "db%d", row + 1);
+         break;
+      case RESULT_SETTINGS:
+         if (column == 0)
+         {
+            snprintf(value, size, "setting_%d", row);
+         }
+         else if (column == 1)
+         {
+            snprintf(value, size, "%d", row);
+         }
+         else
+         {
+            snprintf(value, size, "Mock setting %d", row);
+         }
+         break;
+      default:
+         /* Numeric values are valid both as labels and as gauge values */
+         if (result->arrays[column])
+         {
+            snprintf(value, size, "{1,5,10,%d}", 50 + row);
+         }
+         else
+         {
+            snprintf(value, size, "%d", row * result->columns + column);
+         }
+         break;
+   }
+}
+
+static int
+send_row_description(struct mock_connection* c, struct mock_result* result)
+{
+   size_t offset;
+   char name[MISC_LENGTH];
+
+   offset = begin_message(c->out, 'T');
+   append_int16(c->out, result->columns);
+   for (int i = 0; i < result->columns; i++)
+   {
+      if (result->names[i][0] != '\0')
+      {
+         append_cstring(c->out, &result->names[i][0]);
+      }
+      else
+      {
+         snprintf(&name[0], sizeof(name), "column%d", i + 1);
+         append_cstring(c->out, &name[0]);
+      }
+      append_int32(c->out, 0);
+      append_int16(c->out, 0);
+      append_int32(c->out, 25);
+      append_int16(c->out, -1);
+      append_int32(c->out, -1);
+      append_int16(c->out, 0);
+   }
+   end_message(c->out, offset);
+
+   return 0;
+}
+
+static int
+send_rows(struct mock_connection* c, struct mock_result* result)
+{
+   size_t offset;
+   char value[MISC_LENGTH];
+   char tag[MISC_LENGTH];
+
+   for (int row = 0; row < result->rows; row++)
+   {
+      offset = begin_message(c->out, 'D');
+      append_int16(c->out, result->columns);
+      for (int column = 0; column < result->columns; column++)
+      {
+         result_value(c, result, row, column, &value[0], sizeof(value));
+         append_int32(c->out, strlen(&value[0]));
+         pgexporter_string_builder_append_length(c->out, &value[0], strlen(&value[0]));
+      }
+      end_message(c->out, offset);
+
+      if (c->out->length >= MOCK_FLUSH_SIZE && flush_output(c))
+      {
+         return 1;
+      }
+   }
+
+   snprintf(&tag[0], sizeof(tag), "SELECT %d", result->rows);
+   offset = begin_message(c->out, 'C');
+   append_cstring(c->out, &tag[0]);
+   end_message(c->out, offset);
+
+   return 0;
+}
+
+static int
+send_error(struct mock_connection* c, char* code, char* message)
+{
+   size_t offset;
+
+   offset = begin_message(c->out, 'E');
+   pgexporter_string_builder_append_char(c->out, 'S');
+   append_cstring(c->out, "ERROR");
+   pgexporter_string_builder_append_char(c->out, 'V');
+   append_cstring(c->out, "ERROR");
+   pgexporter_string_builder_append_char(c->out, 'C');
+   append_cstring(c->out, code);
+   pgexporter_string_builder_append_char(c->out, 'M');
+   append_cstring(c->out, message);
+   pgexporter_string_builder_append_char(c->out, '\0');
+   end_message(c->out, offset);
+
+   return 0;
+}
+
+static int
+send_ready(struct mock_connection* c)
+{
+   size_t offset;
+
+   offset = begin_message(c->out, 'Z');
+   pgexporter_string_builder_append_char(c->out, 'I');
+   end_message(c->out, offset);
+
+   return 0;
+}
+
+static int
+send_parameter(struct mock_connection* c, char* name, char* value)
+{
+   size_t offset;
+
+   offset = begin_message(c->out, 'S');
+   append_cstring(c->out, name);
+   append_cstring(c->out, value);
+   end_message(c->out, offset);
+
+   return 0;
+}
+
+static int
+send_authentication(struct mock_connection* c, int32_t code, char* data, size_t length)
+{
+   size_t offset;
+
+   offset = begin_message(c->out, 'R');
+   append_int32(c->out, code);
+   if (length > 0)
+   {
+      pgexporter_string_builder_append_length(c->out, data, length);
+   }
+   end_message(c->out, offset);
+
+   return 0;
+}
+
+static struct mock_statement*
+find_statement(struct mock_statement* statements, char* name, bool create)
+{
+   struct mock_statement* free_slot = NULL;
+
+   for (int i = 0; i < MOCK_MAX_STATEMENTS; i++)
+   {
+      if (statements[i].query != NULL && !strcmp(&statements[i].name[0], name))
+      {
+         return &statements[i];
+      }
+
+      if (free_slot == NULL && statements[i].query == NULL)
+      {
+         free_slot = &statements[i];
+      }
+   }
+
+   if (create && free_slot != NULL)
+   {
+      snprintf(&free_slot->name[0], sizeof(free_slot->name), "%s", name);
+      return free_slot;
+   }
+
+   return NULL;
+}
+
+static void
+clear_statements(struct mock_statement* statements)
+{
+   for (int i = 0; i < MOCK_MAX_STATEMENTS; i++)
+   {
+      free(statements[i].query);
+      statements[i].query = NULL;
+   }
+}
+
+static size_t
+begin_message(struct string_builder* sb, char type)
+{
+   size_t offset = sb->length;
+
+   pgexporter_string_builder_append_char(sb, type);
+   append_int32(sb, 0);
+
+   return offset;
+}
+
+static void
+end_message(struct string_builder* sb, size_t offset)
+{
+   pgexporter_write_int32(sb->buffer + offset + 1, (int32_t)(sb->length - offset - 1));
+}
+
+static int
+append_int16(struct string_builder* sb, int16_t i)
+{
+   char buffer[2];
+
+   pgexporter_write_int16(&buffer[0], i);
+
+   return pgexporter_string_builder_append_length(sb, &buffer[0], 2);
+}
+
+static int
+append_int32(struct string_builder* sb, int32_t i)
+{
+   char buffer[4];
+
+   pgexporter_write_int32(&buffer[0], i);
+
+   return pgexporter_string_builder_append_length(sb, &buffer[0], 4);
+}
+
+static int
+append_cstring(struct string_builder* sb, char* s)
+{
+   return pgexporter_string_builder_append_length(sb, s, strlen(s) + 1);
+}
+
+static int
+flush_output(struct mock_connection* c)
+{
+   size_t offset = 0;
+   ssize_t written;
+
+   while (offset < c->out->length)
+   {
+      written = write(c->socket, c->out->buffer + offset, c->out->length - offset);
+      if (written <= 0)
+      {
+         if (written == -1 && errno == EINTR)
+         {
+            continue;
+         }
+         return 1;
+      }
+      offset += written;
+   }
+
+   pgexporter_string_builder_reset(c->out);
+
+   return 0;
+}
+
+static int
+read_fully(int socket, void* buffer, size_t length)
+{
+   size_t offset = 0;
+   ssize_t r;
+
+   while (offset < length)
+   {
+      r = read(socket, (char*)buffer + offset, length - offset);
+      if (r <= 0)
+      {
+         if (r == -1 && errno == EINTR)
+         {
+            continue;
+         }
+         return 1;
+      }
+      offset += r;
+   }
+
+   return 0;
+}
+
+static int
+read_message(int socket, char* type, char** data, size_t* length)
+{
+   char header[5];
+   int32_t size;
+   char* d = NULL;
+
+   *data = NULL;
+   *length = 0;
+
+   if (read_fully(socket, &header[0], 5))
+   {
+      return 1;
+   }
+
+   size = pgexporter_read_int32(&header[1]);
+   if (size < 4 || size > 64 * 1024 * 1024)
+   {
+      return 1;
+   }
+
+   d = calloc(1, size - 4 + 1);
+   if (d == NULL || read_fully(socket, d, size - 4))
+   {
+      free(d);
+      return 1;
+   }
+
+   *type = header[0];
+   *data = d;
+   *length = size - 4;
+
+   return 0;
+}
+
+static int
+base64_encode(unsigned char* data, size_t length, char* out, size_t size)
+{
+   if (size < 4 * ((length + 2) / 3) + 1)
+   {
+      return -1;
+   }
+
+   return EVP_EncodeBlock((unsigned char*)out, data, length);
+}
+
+static int
+base64_decode(char* data, unsigned char* out, size_t size)
+{
+   size_t length = strlen(data);
+   unsigned char buffer[128];
+   int decoded;
+
+   if (length == 0 || length % 4 != 0 || 3 * length / 4 > sizeof(buffer))
+   {
+      return -1;
+   }
+
+   decoded = EVP_DecodeBlock(&buffer[0], (unsigned char*)data, length);
+   if (decoded < 0)
+   {
+      return -1;
+   }
+
+   /* EVP_DecodeBlock keeps the padding bytes */
+   if (data[length - 1] == '=')
+   {
+      decoded--;
+   }
+   if (data[length - 2] == '=')
+   {
+      decoded--;
+   }
+
+   if ((size_t)decoded > size)
+   {
+      return -1;
+   }
+
+   memcpy(out, &buffer[0], decoded);
+
+   return decoded;
+}
+
+/**
+ * Delay a query by the configured amount
+ * @param c The connection
+ * @return true if the query was canceled, otherwise false
+ */
+static bool
+delay_query(struct mock_connection* c)
+{
+   int waited = 0;
+
+   atomic_store(&canceled[c->pid % MOCK_MAX_CANCELS], false);
+
+   while (waited < options.delay)
+   {
+      usleep(MIN(MOCK_DELAY_SLICE, options.delay - waited) * 1000);
+      waited += MOCK_DELAY_SLICE;
+
+      if (atomic_exchange(&canceled[c->pid % MOCK_MAX_CANCELS], false))
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+static void
+signal_handler(int signum)
+{
+   if (signum == SIGUSR1)
+   {
+      report = 1;
+   }
+   else
+   {
+      running = 0;
+   }
+}
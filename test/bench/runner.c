@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <benchmark.h>
+#include <mctf.h>
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void
+usage(const char* progname)
+{
+   printf("Usage: %s [OPTIONS]\n", progname);
+   printf("Options:\n");
+   printf("  -t, --test NAME     Run only benchmarks matching NAME\n");
+   printf("  -m, --module NAME   Run all benchmarks in module NAME\n");
+   printf("  -n, --size SIZE     Largest data set size (default %d)\n", BENCH_DEFAULT_SIZE);
+   printf("  -o, --output FILE   Write the CSV results to FILE (default stdout,\n");
+   printf("                      with the progress on stderr)\n");
+   printf("  -h, --help          Show this help message\n");
+   printf("\n");
+   printf("Examples:\n");
+   printf("  %s                      Run all benchmarks\n", progname);
+   printf("  %s -m bench_art         Run the ART benchmarks\n", progname);
+   printf("  %s -n 100000 -o a.csv   Run up to 100000 elements into a.csv\n", progname);
+   printf("\n");
+}
+
+int
+main(int argc, char* argv[])
+{
+   int number_failed = 0;
+   const char* filter = NULL;
+   mctf_filter_type_t filter_type = MCTF_FILTER_NONE;
+   char* output = NULL;
+   char* end = NULL;
+   long long size;
+   FILE* out = NULL;
+   int csv_fd = -1;
+   int c;
+
+   static struct option long_options[] = {
+      {"test", required_argument, 0, 't'},
+      {"module", required_argument, 0, 'm'},
+      {"size", required_argument, 0, 'n'},
+      {"output", required_argument, 0, 'o'},
+      {"help", no_argument, 0, 'h'},
+      {0, 0, 0, 0}};
+
+   while ((c = getopt_long(argc, argv, "t:m:n:o:h", long_options, NULL)) != -1)
+   {
+      switch (c)
+      {
+         case 't':
+         case 'm':
+            if (filter_type != MCTF_FILTER_NONE)
+            {
+               fprintf(stderr, "Error: Cannot specify both -t and -m options\n");
+               usage(argv[0]);
+               return EXIT_FAILURE;
+            }
+            filter = optarg;
+            filter_type = (c == 't') ? MCTF_FILTER_TEST : MCTF_FILTER_MODULE;
+            break;
+         case 'n':
+            size = strtoll(optarg, &end, 10);
+            if (*end != '\0' || size < BENCH_MIN_SIZE)
+            {
+               fprintf(stderr, "Error: The size must be at least %d\n", BENCH_MIN_SIZE);
+               return EXIT_FAILURE;
+            }
+            pgexporter_bench_set_max_size((size_t)size);
+            break;
+         case 'o':
+            output = optarg;
+            break;
+         case 'h':
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+         default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+      }
+   }
+
+   /* Keep stdout for the CSV, so the progress of the run goes to stderr */
+   if (output == NULL)
+   {
+      fflush(stdout);
+      csv_fd = dup(STDOUT_FILENO);
+      dup2(STDERR_FILENO, STDOUT_FILENO);
+   }
+
+   number_failed = mctf_run_tests(filter_type, filter);
+   mctf_print_summary();
+   mctf_cleanup();
+
+   if (csv_fd != -1)
+   {
+      fflush(stdout);
+      dup2(csv_fd, STDOUT_FILENO);
+      close(csv_fd);
+   }
+
+   if (output != NULL)
+   {
+      out = fopen(output, "w");
+      if (out == NULL)
+      {
+         fprintf(stderr, "Error: Could not open %s\n", output);
+         number_failed++;
+      }
+   }
+   else
+   {
+      out = stdout;
+   }
+
+   if (out != NULL)
+   {
+      pgexporter_bench_write(out);
+
+      if (out != stdout)
+      {
+         fclose(out);
+      }
+   }
+
+   pgexporter_bench_destroy();
+
+   return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,499 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/* pgexporter */
+#include <pgexporter.h>
+#include <utils.h>
+
+/* system */
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * pgexporter-scrape
+ *
+ * Scrapes a pgexporter endpoint a number of times and reports the throughput,
+ * the latency distribution and the response size. When the process id of the
+ * exporter is given the peak resident set size of it and its children is
+ * sampled while the scrapes run.
+ */
+
+#define BENCH_BUFFER_SIZE 65536
+#define BENCH_SAMPLE_INTERVAL 20000
+
+/** @struct bench_options
+ * Defines the command line options of the benchmark
+ */
+struct bench_options
+{
+   char host[MISC_LENGTH];   /**< The host */
+   char port[MISC_LENGTH];   /**< The port */
+   char path[MISC_LENGTH];   /**< The path */
+   char header[MISC_LENGTH]; /**< An additional request header */
+   int scrapes;              /**< The number of measured scrapes */
+   int warmup;               /**< The number of scrapes before measuring */
+   int interval;             /**< The pause between scrapes in milliseconds */
+   pid_t pid;                /**< The exporter process, or 0 */
+};
+
+/** @struct bench_scrape
+ * Defines the outcome of a single scrape
+ */
+struct bench_scrape
+{
+   int64_t latency; /**< The latency in microseconds */
+   size_t bytes;    /**< The size of the body */
+   int status;      /**< The HTTP status code */
+};
+
+static void usage(void);
+static int parse_url(char* url);
+static int scrape(struct bench_scrape* result);
+static int64_t now_micros(void);
+static int compare_int64(const void* a, const void* b);
+static int64_t percentile(int64_t* sorted, int n, int p);
+static void* sampler_main(void* arg);
+static long process_hwm(pid_t pid, pid_t* parent);
+
+static struct bench_options options;
+static atomic_bool sampling = false;
+static atomic_long peak_rss = 0;
+static atomic_long peak_rss_total = 0;
+
+int
+main(int argc, char** argv)
+{
+   int c;
+   int failures = 0;
+   int64_t start;
+   int64_t elapsed;
+   int64_t* latencies = NULL;
+   size_t bytes = 0;
+   double seconds;
+   pthread_t sampler;
+   bool sampler_started = false;
+   struct bench_scrape result;
+   char* url = "http://localhost:5002/metrics";
+
+   memset(&options, 0, sizeof(struct bench_options));
+   options.scrapes = 100;
+   options.warmup = 1;
+
+   while ((c = getopt(argc, argv, "u:n:w:i:p:H:?")) != -1)
+   {
+      switch (c)
+      {
+         case 'u':
+            url = optarg;
+            break;
+         case 'n':
+            options.scrapes = atoi(optarg);
+            break;
+         case 'w':
+            options.warmup = atoi(optarg);
+            break;
+         case 'i':
+            options.interval = atoi(optarg);
+            break;
+         case 'p':
+            options.pid = (pid_t)atoi(optarg);
+            break;
+         case 'H':
+            snprintf(&options.header[0], sizeof(options.header), "%s", optarg);
+            break;
+         default:
+            usage();
+            exit(1);
+      }
+   }
+
+   if (options.scrapes <= 0 || options.warmup < 0 || options.interval < 0 || parse_url(url))
+   {
+      usage();
+      exit(1);
+   }
+
+   latencies = calloc(options.scrapes, sizeof(int64_t));
+   if (latencies == NULL)
+   {
+      exit(1);
+   }
+
+   for (int i = 0; i < options.warmup; i++)
+   {
+      if (scrape(&result) || result.status != 200)
+      {
+         fprintf(stderr, "pgexporter-scrape: Warmup scrape of %s failed\n", url);
+         free(latencies);
+         exit(1);
+      }
+   }
+
+   if (options.pid > 0)
+   {
+      atomic_store(&sampling, true);
+      sampler_started = pthread_create(&sampler, NULL, sampler_main, NULL) == 0;
+   }
+
+   start = now_micros();
+
+   for (int i = 0; i < options.scrapes; i++)
+   {
+      if (scrape(&result) || result.status != 200)
+      {
+         failures++;
+      }
+
+      latencies[i] = result.latency;
+      bytes += result.bytes;
+
+      if (options.interval > 0 && i + 1 < options.scrapes)
+      {
+         usleep(options.interval * 1000);
+      }
+   }
+
+   elapsed = now_micros() - start;
+
+   if (sampler_started)
+   {
+      atomic_store(&sampling, false);
+      pthread_join(sampler, NULL);
+   }
+
+   qsort(latencies, options.scrapes, sizeof(int64_t), compare_int64);
+   seconds = elapsed / 1000000.0;
+
+   printf("url:              %s\n", url);
+   printf("scrapes:          %d\n", options.scrapes);
+   printf("failures:         %d\n", failures);
+   printf("scrapes/sec:      %.2f\n", seconds > 0 ? options.scrapes / seconds : 0.0);
+   printf("latency min:      %.3f ms\n", latencies[0] / 1000.0);
+   printf("latency p50:      %.3f ms\n", percentile(latencies, options.scrapes, 50) / 1000.0);
+   printf("latency p99:      %.3f ms\n", percentile(latencies, options.scrapes, 99) / 1000.0);
+   printf("latency max:      %.3f ms\n", latencies[options.scrapes - 1] / 1000.0);
+   printf("bytes/scrape:     %zu\n", bytes / options.scrapes);
+   if (options.pid > 0)
+   {
+      printf("peak rss:         %ld kB\n", atomic_load(&peak_rss));
+      printf("peak rss (total): %ld kB\n", atomic_load(&peak_rss_total));
+   }
+
+   free(latencies);
+
+   return failures > 0 ? 1 : 0;
+}
+
+static void
+usage(void)
+{
+   printf("pgexporter-scrape %s\n", VERSION);
+   printf("  Scrape benchmark for pgexporter\n");
+   printf("\n");
+   printf("Usage:\n");
+   printf("  pgexporter-scrape [ -u URL ] [ -n SCRAPES ] [ -w WARMUP ] [ -i INTERVAL ] [ -p PID ] [ -H HEADER ]\n");
+   printf("\n");
+   printf("Options:\n");
+   printf("  -u URL       The endpoint (default http://localhost:5002/metrics)\n");
+   printf("  -n SCRAPES   Number of measured scrapes (default 100)\n");
+   printf("  -w WARMUP    Number of scrapes before measuring (default 1)\n");
+   printf("  -i INTERVAL  Pause between scrapes in milliseconds (default 0)\n");
+   printf("  -p PID       Sample the peak RSS of this process and its children\n");
+   printf("  -H HEADER    Additional request header, e.g. 'Accept-Encoding: gzip'\n");
+}
+
+static int
+parse_url(char* url)
+{
+   char* host;
+   char* path;
+   char* port;
+
+   if (strncmp(url, "http://", 7))
+   {
+      return 1;
+   }
+
+   host = url + 7;
+   path = strchr(host, '/');
+   port = strchr(host, ':');
+
+   if (path == NULL)
+   {
+      path = host + strlen(host);
+      snprintf(&options.path[0], sizeof(options.path), "/");
+   }
+   else
+   {
+      snprintf(&options.path[0], sizeof(options.path), "%s", path);
+   }
+
+   if (port != NULL && port < path)
+   {
+      snprintf(&options.host[0], sizeof(options.host), "%.*s", (int)(port - host), host);
+      snprintf(&options.port[0], sizeof(options.port), "%.*s", (int)(path - port - 1), port + 1);
+   }
+   else
+   {
+      snprintf(&options.host[0], sizeof(options.host), "%.*s", (int)(path - host), host);
+      snprintf(&options.port[0], sizeof(options.port), "80");
+   }
+
+   return strlen(&options.host[0]) == 0;
+}
+
+static int
+scrape(struct bench_scrape* result)
+{
+   int fd = -1;
+   int64_t start;
+   struct addrinfo hints;
+   struct addrinfo* addresses = NULL;
+   char request[MISC_LENGTH * 4];
+   char buffer[BENCH_BUFFER_SIZE];
+   char header[1024];
+   size_t header_length = 0;
+   size_t total = 0;
+   ssize_t r;
+   char* end;
+
+   memset(result, 0, sizeof(struct bench_scrape));
+   memset(&hints, 0, sizeof(hints));
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+
+   if (getaddrinfo(&options.host[0], &options.port[0], &hints, &addresses))
+   {
+      goto error;
+   }
+
+   snprintf(&request[0], sizeof(request),
+            "GET %s HTTP/1.1\r\nHost: %s:%s\r\n%s%sConnection: close\r\n\r\n",
+            &options.path[0], &options.host[0], &options.port[0],
+            &options.header[0], strlen(&options.header[0]) > 0 ? "\r\n" : "");
+
+   start = now_micros();
+
+   fd = socket(addresses->ai_family, addresses->ai_socktype, addresses->ai_protocol);
+   if (fd == -1 || connect(fd, addresses->ai_addr, addresses->ai_addrlen))
+   {
+      goto error;
+   }
+
+   if (write(fd, &request[0], strlen(&request[0])) != (ssize_t)strlen(&request[0]))
+   {
+      goto error;
+   }
+
+   while ((r = read(fd, &buffer[0], sizeof(buffer))) != 0)
+   {
+      if (r == -1)
+      {
+         if (errno == EINTR)
+         {
+            continue;
+         }
+         goto error;
+      }
+
+      /* Keep the start of the response to find the status line and the end of the headers */
+      if (header_length < sizeof(header) - 1)
+      {
+         size_t n = MIN((size_t)r, sizeof(header) - 1 - header_length);
+         memcpy(&header[header_length], &buffer[0], n);
+         header_length += n;
+         header[header_length] = '\0';
+      }
+
+      total += r;
+   }
+
+   result->latency = now_micros() - start;
+
+   if (sscanf(&header[0], "HTTP/1.%*d %d", &result->status) != 1)
+   {
+      goto error;
+   }
+
+   end = strstr(&header[0], "\r\n\r\n");
+   result->bytes = end != NULL ? total - (end - &header[0] + 4) : 0;
+
+   close(fd);
+   freeaddrinfo(addresses);
+
+   return 0;
+
+error:
+
+   if (fd != -1)
+   {
+      close(fd);
+   }
+   if (addresses != NULL)
+   {
+      freeaddrinfo(addresses);
+   }
+
+   return 1;
+}
+
+static int64_t
+now_micros(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int
+compare_int64(const void* a, const void* b)
+{
+   int64_t x = *(const int64_t*)a;
+   int64_t y = *(const int64_t*)b;
+
+   return (x > y) - (x < y);
+}
+
+static int64_t
+percentile(int64_t* sorted, int n, int p)
+{
+   int rank = (p * n + 99) / 100;
+
+   if (rank < 1)
+   {
+      rank = 1;
+   }
+
+   return sorted[rank - 1];
+}
+
+static void*
+sampler_main(void* arg)
+{
+   (void)arg;
+
+   while (atomic_load(&sampling))
+   {
+      DIR* proc = NULL;
+      struct dirent* entry;
+      long hwm;
+      long total;
+      pid_t parent;
+
+      hwm = process_hwm(options.pid, &parent);
+      total = MAX(hwm, 0);
+
+      /* The children serve the scrapes and may be gone by the next sample */
+      proc = opendir("/proc");
+      if (proc != NULL)
+      {
+         while ((entry = readdir(proc)) != NULL)
+         {
+            long child;
+
+            if (!isdigit((unsigned char)entry->d_name[0]))
+            {
+               continue;
+            }
+
+            child = process_hwm((pid_t)atoi(entry->d_name), &parent);
+            if (child > 0 && parent == options.pid)
+            {
+               hwm = MAX(hwm, child);
+               total += child;
+            }
+         }
+         closedir(proc);
+      }
+
+      if (hwm > atomic_load(&peak_rss))
+      {
+         atomic_store(&peak_rss, hwm);
+      }
+      if (total > atomic_load(&peak_rss_total))
+      {
+         atomic_store(&peak_rss_total, total);
+      }
+
+      usleep(BENCH_SAMPLE_INTERVAL);
+   }
+
+   return NULL;
+}
+
+static long
+process_hwm(pid_t pid, pid_t* parent)
+{
+   FILE* file = NULL;
+   char path[64];
+   char line[256];
+   long hwm = -1;
+
+   *parent = 0;
+
+   snprintf(&path[0], sizeof(path), "/proc/%d/status", (int)pid);
+
+   file = fopen(&path[0], "r");
+   if (file == NULL)
+   {
+      return -1;
+   }
+
+   while (fgets(&line[0], sizeof(line), file) != NULL)
+   {
+      if (!strncmp(&line[0], "PPid:", 5))
+      {
+         *parent = (pid_t)atoi(&line[5]);
+      }
+      else if (!strncmp(&line[0], "VmHWM:", 6))
+      {
+         hwm = atol(&line[6]);
+      }
+   }
+
+   fclose(file);
+
+   return hwm;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef PGEXPORTER_TSBACKEND_H
+#define PGEXPORTER_TSBACKEND_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/**
+ * Listen on the Unix Domain Socket of a fake server,
+ * at <directory>/.s.PGSQL.<port> like PostgreSQL
+ * @param directory The directory
+ * @param port The port
+ * @param fd The resulting descriptor
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_tsbackend_listen(char* directory, int port, int* fd);
+
+/**
+ * Remove the Unix Domain Socket of a fake server
+ * @param directory The directory
+ * @param port The port
+ */
+void
+pgexporter_tsbackend_remove(char* directory, int port);
+
+/**
+ * Read the startup message of a client
+ * @param fd The descriptor
+ * @param buffer The buffer
+ * @param size The size of the buffer
+ * @return The length of the message, or -1 upon error
+ */
+int
+pgexporter_tsbackend_read_startup(int fd, char* buffer, size_t size);
+
+/**
+ * Read a message of a client
+ * @param fd The descriptor
+ * @param buffer The buffer
+ * @param size The size of the buffer
+ * @return The length of the message including its kind, or -1 upon error
+ */
+int
+pgexporter_tsbackend_read(int fd, char* buffer, size_t size);
+
+/**
+ * Write a message to a client
+ * @param fd The descriptor
+ * @param kind The kind of the message
+ * @param payload The payload
+ * @param size The size of the payload
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_tsbackend_write(int fd, char kind, void* payload, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef PGEXPORTER_TSMOCK_H
+#define PGEXPORTER_TSMOCK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgexporter.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <openssl/ssl.h>
+
+#define TSMOCK_PORT    16900
+#define TSMOCK_METRICS 15900
+
+/** @struct tsmock
+ * A pgexporter that scrapes pgexporter-mock servers
+ */
+struct tsmock
+{
+   char directory[MAX_PATH]; /**< The runtime directory */
+   int port;                 /**< The port of the first mock server */
+   int servers;              /**< The number of mock servers */
+   int metrics;              /**< The metrics port of pgexporter */
+   pid_t mock;               /**< The mock process, or -1 */
+   pid_t exporter;           /**< The pgexporter process, or -1 */
+};
+
+/** @struct tsmock_counters
+ * The counters of the mock servers
+ */
+struct tsmock_counters
+{
+   unsigned long connections; /**< The accepted connections, cancel requests included */
+   unsigned long queries;     /**< The executed queries */
+   unsigned long cancels;     /**< The cancel requests */
+   unsigned long pipelined;   /**< The queries that arrived before the previous answer was sent */
+};
+
+/**
+ * Start the mock servers in a new runtime directory
+ * @param servers The number of servers
+ * @param options Additional pgexporter-mock options, or NULL
+ * @param mock The resulting mock
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_tsmock_create(int servers, char* options, struct tsmock** mock);
+
+/**
+ * Start pgexporter against the mock servers
+ * @param mock The mock
+ * @param options Additional [pgexporter] settings, one per line, or NULL
+ * @param metrics The content of the metrics_path file, or NULL
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_tsmock_start(struct tsmock* mock, char* options, char* metrics);
+
+/**
+ * Stop pgexporter and every process it started
+ * @param mock The mock
+ */
+void
+pgexporter_tsmock_stop(struct tsmock* mock);
+
+/**
+ * Stop pgexporter and the mock servers, and remove the runtime directory
+ * @param mock The mock
+ */
+void
+pgexporter_tsmock_destroy(struct tsmock* mock);
+
+/**
+ * Write a file in the runtime directory
+ * @param mock The mock
+ * @param name The file name
+ * @param content The content
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_tsmock_write_file(struct tsmock* mock, char* name, char* content);
+
+/**
+ * Scrape an endpoint of pgexporter on a connection of its own
+ * @param mock The mock
+ * @param path The path
+ * @param headers Additional request headers, each ending with CRLF, or NULL
+ * @param status The resulting HTTP status
+ * @param body The resulting body, decoded from chunks
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_tsmock_scrape(struct tsmock* mock, char* path, char* headers, int* status, char** body);
+
+/**
+ * Create a self-signed certificate and key as server.crt and server.key in the runtime directory
+ * @param mock The mock
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_tsmock_certificate(struct tsmock* mock);
+
+/**
+ * Request the home page of the metrics endpoint over TLS
+ * @param mock The mock
+ * @param session The session to resume, or NULL
+ * @param next The session of the connection, the caller must free it
+ * @param reused Was the session resumed
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_tsmock_tls_request(struct tsmock* mock, SSL_SESSION* session, SSL_SESSION** next, bool* reused);
+
+/**
+ * Reload the configuration of pgexporter
+ * @param mock The mock
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_tsmock_reload(struct tsmock* mock);
+
+/**
+ * Send raw bytes to the metrics endpoint and read until the connection closes
+ * @param mock The mock
+ * @param request The bytes to send in one write
+ * @param timeout The time to wait for the connection to close in milliseconds
+ * @param response The bytes read
+ * @param closed Did pgexporter close the connection
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_tsmock_exchange(struct tsmock* mock, char* request, int timeout, char** response, bool* closed);
+
+/**
+ * Set a configuration value of pgexporter at runtime
+ * @param mock The mock
+ * @param key The key
+ * @param value The value
+ * @param result The resulting value, as applied
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_tsmock_conf_set(struct tsmock* mock, char* key, char* value, int64_t* result);
+
+/**
+ * Find the value of a series in a metrics page
+ * @param body The metrics page
+ * @param series The series, the metric name with its labels
+ * @param value The resulting value
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_tsmock_value(char* body, char* series, double* value);
+
+/**
+ * Read the counters of the mock servers
+ * @param mock The mock
+ * @param counters The resulting counters
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_tsmock_counters(struct tsmock* mock, struct tsmock_counters* counters);
+
+/**
+ * Count the lines of the pgexporter log that contain a text
+ * @param mock The mock
+ * @param text The text
+ * @return The number of lines
+ */
+int
+pgexporter_tsmock_log_count(struct tsmock* mock, char* text);
+
+/**
+ * Find the last occurrence of a text in the pgexporter log
+ * @param mock The mock
+ * @param text The text
+ * @param rest The resulting rest of the line after the text
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgexporter_tsmock_log_last(struct tsmock* mock, char* text, char** rest);
+
+/**
+ * Wait until the pgexporter log has a line that contains a text
+ * @param mock The mock
+ * @param text The text
+ * @param timeout The timeout in milliseconds
+ * @return true if the line was found, otherwise false
+ */
+bool
+pgexporter_tsmock_log_wait(struct tsmock* mock, char* text, int timeout);
+
+/**
+ * The monotonic time
+ * @return The time in milliseconds
+ */
+int64_t
+pgexporter_tsmock_milliseconds(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
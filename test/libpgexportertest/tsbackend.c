@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <pgexporter.h>
+#include <tsbackend.h>
+#include <utils.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static int read_fully(int fd, char* buffer, size_t size);
+
+int
+pgexporter_tsbackend_listen(char* directory, int port, int* fd)
+{
+   struct sockaddr_un addr;
+
+   *fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (*fd == -1)
+   {
+      return 1;
+   }
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   pgexporter_snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/.s.PGSQL.%d", directory, port);
+
+   if (bind(*fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(*fd, 4) == -1)
+   {
+      close(*fd);
+      *fd = -1;
+      return 1;
+   }
+
+   return 0;
+}
+
+void
+pgexporter_tsbackend_remove(char* directory, int port)
+{
+   char path[MAX_PATH];
+
+   memset(&path[0], 0, sizeof(path));
+   pgexporter_snprintf(&path[0], sizeof(path), "%s/.s.PGSQL.%d", directory, port);
+
+   unlink(&path[0]);
+}
+
+int
+pgexporter_tsbackend_read_startup(int fd, char* buffer, size_t size)
+{
+   int length;
+
+   if (size < 4 || read_fully(fd, buffer, 4))
+   {
+      return -1;
+   }
+
+   length = pgexporter_read_int32(buffer);
+   if (length < 4 || (size_t)length > size || read_fully(fd, buffer + 4, length - 4))
+   {
+      return -1;
+   }
+
+   return length;
+}
+
+int
+pgexporter_tsbackend_read(int fd, char* buffer, size_t size)
+{
+   int length;
+
+   if (size < 5 || read_fully(fd, buffer, 5))
+   {
+      return -1;
+   }
+
+   length = pgexporter_read_int32(buffer + 1);
+   if (length < 4 || (size_t)length + 1 > size || read_fully(fd, buffer + 5, length - 4))
+   {
+      return -1;
+   }
+
+   return length + 1;
+}
+
+int
+pgexporter_tsbackend_write(int fd, char kind, void* payload, size_t size)
+{
+   char* message = NULL;
+   ssize_t written;
+   size_t offset = 0;
+
+   message = (char*)malloc(1 + 4 + size);
+   if (message == NULL)
+   {
+      return 1;
+   }
+
+   pgexporter_write_byte(message, kind);
+   pgexporter_write_int32(message + 1, 4 + size);
+   if (size > 0)
+   {
+      memcpy(message + 5, payload, size);
+   }
+
+   while (offset < 1 + 4 + size)
+   {
+      written = write(fd, message + offset, 1 + 4 + size - offset);
+      if (written <= 0)
+      {
+         free(message);
+         return 1;
+      }
+
+      offset += written;
+   }
+
+   free(message);
+
+   return 0;
+}
+
+static int
+read_fully(int fd, char* buffer, size_t size)
+{
+   ssize_t n;
+
+   while (size > 0)
+   {
+      n = read(fd, buffer, size);
+      if (n <= 0)
+      {
+         return 1;
+      }
+
+      buffer += n;
+      size -= n;
+   }
+
+   return 0;
+}
@@ -0,0 +1,1166 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <pgexporter.h>
+#include <json.h>
+#include <management.h>
+#include <network.h>
+#include <shmem.h>
+#include <tsmock.h>
+#include <utils.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#define TSMOCK_STARTUP_TIMEOUT 15000
+#define TSMOCK_SCRAPE_TIMEOUT  60
+#define TSMOCK_MAX_ARGUMENTS   32
+
+static pid_t spawn(char* directory, char* output, char** argv);
+static int wait_port(int port, pid_t pid, int timeout);
+static int connect_port(int port);
+static void stop_process(pid_t pid, int timeout);
+static int read_file(char* path, char** content);
+static int count_lines(char* path, char* text);
+static char* find_header(char* headers, char* name);
+static int decode_chunks(char* data, size_t length, char** body, bool* complete);
+static void sleep_milliseconds(int milliseconds);
+
+int
+pgexporter_tsmock_create(int servers, char* options, struct tsmock** mock)
+{
+   int argc = 0;
+   char* argv[TSMOCK_MAX_ARGUMENTS];
+   char port[16];
+   char number[16];
+   char* copy = NULL;
+   char* token = NULL;
+   char* saveptr = NULL;
+   struct tsmock* m = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   *mock = NULL;
+
+   m = (struct tsmock*)calloc(1, sizeof(struct tsmock));
+   if (m == NULL)
+   {
+      goto error;
+   }
+
+   m->port = TSMOCK_PORT;
+   m->servers = servers;
+   m->metrics = TSMOCK_METRICS;
+   m->mock = -1;
+   m->exporter = -1;
+
+   pgexporter_snprintf(&m->directory[0], sizeof(m->directory), "/tmp/pgexporter-mock-XXXXXX");
+   if (mkdtemp(&m->directory[0]) == NULL)
+   {
+      m->directory[0] = '\0';
+      goto error;
+   }
+
+   pgexporter_snprintf(&port[0], sizeof(port), "%d", m->port);
+   pgexporter_snprintf(&number[0], sizeof(number), "%d", servers);
+
+   argv[argc++] = PGEXPORTER_TEST_MOCK;
+   argv[argc++] = "-p";
+   argv[argc++] = &port[0];
+   argv[argc++] = "-n";
+   argv[argc++] = &number[0];
+   argv[argc++] = "-a";
+   argv[argc++] = "trust";
+   argv[argc++] = "-U";
+   argv[argc++] = &config->users[0].username[0];
+
+   if (options != NULL)
+   {
+      copy = strdup(options);
+      token = strtok_r(copy, " ", &saveptr);
+      while (token != NULL && argc < TSMOCK_MAX_ARGUMENTS - 1)
+      {
+         argv[argc++] = token;
+         token = strtok_r(NULL, " ", &saveptr);
+      }
+   }
+   argv[argc] = NULL;
+
+   m->mock = spawn(&m->directory[0], "mock.log", &argv[0]);
+   if (m->mock == -1)
+   {
+      goto error;
+   }
+
+   if (wait_port(m->port + servers - 1, m->mock, TSMOCK_STARTUP_TIMEOUT))
+   {
+      goto error;
+   }
+
+   free(copy);
+
+   *mock = m;
+
+   return 0;
+
+error:
+
+   free(copy);
+   pgexporter_tsmock_destroy(m);
+
+   return 1;
+}
+
+int
+pgexporter_tsmock_start(struct tsmock* mock, char* options, char* metrics)
+{
+   int argc = 0;
+   char* conf = NULL;
+   char* path = NULL;
+   char* yaml = NULL;
+   char* argv[8];
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (mock == NULL || mock->exporter != -1)
+   {
+      goto error;
+   }
+
+   conf = pgexporter_format_and_append(conf, "[pgexporter]\nhost = 127.0.0.1\nmetrics = %d\n", mock->metrics);
+   conf = pgexporter_format_and_append(conf, "log_type = file\nlog_level = debug\nlog_path = %s/pgexporter.log\n", mock->directory);
+   conf = pgexporter_format_and_append(conf, "unix_socket_dir = %s\n", mock->directory);
+   if (options != NULL)
+   {
+      conf = pgexporter_format_and_append(conf, "%s\n", options);
+   }
+   if (metrics != NULL)
+   {
+      if (pgexporter_tsmock_write_file(mock, "metrics.yaml", metrics))
+      {
+         goto error;
+      }
+      /* The file is read at startup with -Y, and at a reload from metrics_path */
+      yaml = pgexporter_format_and_append(yaml, "%s/metrics.yaml", mock->directory);
+      conf = pgexporter_format_and_append(conf, "metrics_path = %s\n", yaml);
+   }
+   for (int i = 0; i < mock->servers; i++)
+   {
+      conf = pgexporter_format_and_append(conf, "\n[s%d]\nhost = 127.0.0.1\nport = %d\nuser = %s\n",
+                                          i, mock->port + i, &config->users[0].username[0]);
+   }
+
+   if (pgexporter_tsmock_write_file(mock, "pgexporter.conf", conf))
+   {
+      goto error;
+   }
+
+   /* A lock file left behind by a killed run blocks the port */
+   path = pgexporter_format_and_append(path, "/tmp/pgexporter.%d.lock", mock->metrics);
+   unlink(path);
+   free(path);
+   path = NULL;
+
+   path = pgexporter_format_and_append(path, "%s/pgexporter.conf", mock->directory);
+
+   if (getenv("PGEXPORTER_TEST_USER_CONF") == NULL)
+   {
+      goto error;
+   }
+
+   argv[argc++] = PGEXPORTER_TEST_EXPORTER;
+   argv[argc++] = "-c";
+   argv[argc++] = path;
+   argv[argc++] = "-u";
+   argv[argc++] = getenv("PGEXPORTER_TEST_USER_CONF");
+   if (yaml != NULL)
+   {
+      argv[argc++] = "-Y";
+      argv[argc++] = yaml;
+   }
+   argv[argc] = NULL;
+
+   mock->exporter = spawn(&mock->directory[0], "pgexporter.out", &argv[0]);
+   if (mock->exporter == -1)
+   {
+      goto error;
+   }
+
+   if (wait_port(mock->metrics, mock->exporter, TSMOCK_STARTUP_TIMEOUT))
+   {
+      goto error;
+   }
+
+   free(conf);
+   free(path);
+   free(yaml);
+
+   return 0;
+
+error:
+
+   free(conf);
+   free(path);
+   free(yaml);
+
+   return 1;
+}
+
+void
+pgexporter_tsmock_stop(struct tsmock* mock)
+{
+   char* path = NULL;
+
+   if (mock == NULL || mock->exporter == -1)
+   {
+      return;
+   }
+
+   stop_process(mock->exporter, 10000);
+   mock->exporter = -1;
+
+   path = pgexporter_format_and_append(path, "/tmp/pgexporter.%d.lock", mock->metrics);
+   unlink(path);
+   free(path);
+}
+
+void
+pgexporter_tsmock_destroy(struct tsmock* mock)
+{
+   if (mock == NULL)
+   {
+      return;
+   }
+
+   pgexporter_tsmock_stop(mock);
+
+   if (mock->mock != -1)
+   {
+      stop_process(mock->mock, 5000);
+   }
+
+   if (strlen(mock->directory) > 0)
+   {
+      pgexporter_delete_directory(&mock->directory[0]);
+   }
+
+   free(mock);
+}
+
+int
+pgexporter_tsmock_write_file(struct tsmock* mock, char* name, char* content)
+{
+   char* path = NULL;
+   FILE* file = NULL;
+
+   path = pgexporter_format_and_append(path, "%s/%s", mock->directory, name);
+
+   file = fopen(path, "w");
+   if (file == NULL)
+   {
+      goto error;
+   }
+
+   if (fputs(content, file) == EOF)
+   {
+      goto error;
+   }
+
+   fclose(file);
+   free(path);
+
+   return 0;
+
+error:
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   free(path);
+
+   return 1;
+}
+
+int
+pgexporter_tsmock_scrape(struct tsmock* mock, char* path, char* headers, int* status, char** body)
+{
+   int fd = -1;
+   char* request = NULL;
+   char* response = NULL;
+   char* end = NULL;
+   char* decoded = NULL;
+   size_t length = 0;
+   size_t size = 0;
+   size_t header_length = 0;
+   size_t content_length = 0;
+   bool chunked = false;
+   bool complete = false;
+   ssize_t n;
+
+   *status = 0;
+   *body = NULL;
+
+   fd = connect_port(mock->metrics);
+   if (fd == -1)
+   {
+      goto error;
+   }
+
+   request = pgexporter_format_and_append(request, "GET %s HTTP/1.1\r\nHost: localhost\r\n%s\r\n",
+                                          path, headers != NULL ? headers : "");
+
+   if (write(fd, request, strlen(request)) != (ssize_t)strlen(request))
+   {
+      goto error;
+   }
+
+   while (!complete)
+   {
+      if (length + 4096 + 1 > size)
+      {
+         size = size == 0 ? 65536 : size * 2;
+         response = realloc(response, size);
+         if (response == NULL)
+         {
+            goto error;
+         }
+      }
+
+      n = read(fd, response + length, size - length - 1);
+      if (n <= 0)
+      {
+         break;
+      }
+      length += n;
+      response[length] = '\0';
+
+      if (end == NULL)
+      {
+         end = strstr(response, "\r\n\r\n");
+         if (end == NULL)
+         {
+            continue;
+         }
+
+         header_length = end - response + 4;
+         *end = '\0';
+         chunked = find_header(response, "Transfer-Encoding:") != NULL &&
+                   !strncasecmp(find_header(response, "Transfer-Encoding:"), "chunked", 7);
+         if (find_header(response, "Content-Length:") != NULL)
+         {
+            content_length = strtoul(find_header(response, "Content-Length:"), NULL, 10);
+         }
+         sscanf(response, "HTTP/1.%*d %d", status);
+         *end = '\r';
+      }
+
+      if (chunked)
+      {
+         free(decoded);
+         decoded = NULL;
+         if (decode_chunks(response + header_length, length - header_length, &decoded, &complete))
+         {
+            goto error;
+         }
+      }
+      else if (content_length > 0)
+      {
+         complete = length - header_length >= content_length;
+      }
+   }
+
+   if (end == NULL || *status == 0)
+   {
+      goto error;
+   }
+
+   if (!chunked)
+   {
+      decoded = strdup(response + header_length);
+   }
+
+   if (decoded == NULL)
+   {
+      goto error;
+   }
+
+   *body = decoded;
+
+   close(fd);
+   free(request);
+   free(response);
+
+   return 0;
+
+error:
+
+   if (fd != -1)
+   {
+      close(fd);
+   }
+   free(request);
+   free(response);
+   free(decoded);
+
+   return 1;
+}
+
+int
+pgexporter_tsmock_certificate(struct tsmock* mock)
+{
+   char path[MAX_PATH];
+   FILE* file = NULL;
+   EVP_PKEY* key = NULL;
+   X509* certificate = NULL;
+   X509_NAME* name = NULL;
+
+   key = EVP_EC_gen("P-256");
+   certificate = X509_new();
+   if (key == NULL || certificate == NULL)
+   {
+      goto error;
+   }
+
+   X509_set_version(certificate, 2);
+   ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+   X509_gmtime_adj(X509_getm_notBefore(certificate), 0);
+   X509_gmtime_adj(X509_getm_notAfter(certificate), 86400);
+   X509_set_pubkey(certificate, key);
+
+   name = X509_get_subject_name(certificate);
+   X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (unsigned char*)"localhost", -1, -1, 0);
+   X509_set_issuer_name(certificate, name);
+
+   if (!X509_sign(certificate, key, EVP_sha256()))
+   {
+      goto error;
+   }
+
+   snprintf(path, sizeof(path), "%s/server.crt", mock->directory);
+   file = fopen(path, "w");
+   if (file == NULL || !PEM_write_X509(file, certificate))
+   {
+      goto error;
+   }
+   fclose(file);
+
+   snprintf(path, sizeof(path), "%s/server.key", mock->directory);
+   file = fopen(path, "w");
+   if (file == NULL || !PEM_write_PrivateKey(file, key, NULL, NULL, 0, NULL, NULL))
+   {
+      goto error;
+   }
+   fclose(file);
+   file = NULL;
+
+   chmod(path, 0600);
+
+   X509_free(certificate);
+   EVP_PKEY_free(key);
+
+   return 0;
+
+error:
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   X509_free(certificate);
+   EVP_PKEY_free(key);
+
+   return 1;
+}
+
+int
+pgexporter_tsmock_tls_request(struct tsmock* mock, SSL_SESSION* session, SSL_SESSION** next, bool* reused)
+{
+   int fd = -1;
+   char buffer[8192];
+   char* request = "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+   SSL_CTX* ctx = NULL;
+   SSL* ssl = NULL;
+
+   *next = NULL;
+   *reused = false;
+
+   ctx = SSL_CTX_new(TLS_client_method());
+   if (ctx == NULL)
+   {
+      goto error;
+   }
+
+   SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+
+   fd = connect_port(mock->metrics);
+   if (fd == -1)
+   {
+      goto error;
+   }
+
+   ssl = SSL_new(ctx);
+   if (ssl == NULL || SSL_set_fd(ssl, fd) != 1)
+   {
+      goto error;
+   }
+
+   if (session != NULL)
+   {
+      SSL_set_session(ssl, session);
+   }
+
+   if (SSL_connect(ssl) != 1)
+   {
+      goto error;
+   }
+
+   if (SSL_write(ssl, request, strlen(request)) <= 0)
+   {
+      goto error;
+   }
+
+   /* The tickets of TLS 1.3 arrive with the response */
+   while (SSL_read(ssl, buffer, sizeof(buffer)) > 0)
+   {
+   }
+
+   *reused = SSL_session_reused(ssl) == 1;
+   *next = SSL_get1_session(ssl);
+
+   SSL_shutdown(ssl);
+   SSL_free(ssl);
+   SSL_CTX_free(ctx);
+   close(fd);
+
+   return 0;
+
+error:
+
+   SSL_free(ssl);
+   SSL_CTX_free(ctx);
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   return 1;
+}
+
+int
+pgexporter_tsmock_reload(struct tsmock* mock)
+{
+   int reloads;
+
+   reloads = pgexporter_tsmock_log_count(mock, "Reload: Success") + pgexporter_tsmock_log_count(mock, "Reload: Failure");
+
+   if (mock->exporter <= 0 || kill(mock->exporter, SIGHUP))
+   {
+      return 1;
+   }
+
+   for (int waited = 0; waited <= TSMOCK_STARTUP_TIMEOUT; waited += 50)
+   {
+      if (pgexporter_tsmock_log_count(mock, "Reload: Success") + pgexporter_tsmock_log_count(mock, "Reload: Failure") > reloads)
+      {
+         /* The rest of the reload follows the configuration */
+         sleep_milliseconds(200);
+         return 0;
+      }
+      sleep_milliseconds(50);
+   }
+
+   return 1;
+}
+
+int
+pgexporter_tsmock_exchange(struct tsmock* mock, char* request, int timeout, char** response, bool* closed)
+{
+   int fd = -1;
+   char buffer[8192];
+   ssize_t n;
+   struct timeval tv;
+
+   *response = NULL;
+   *closed = false;
+
+   fd = connect_port(mock->metrics);
+   if (fd == -1)
+   {
+      goto error;
+   }
+
+   tv.tv_sec = timeout / 1000;
+   tv.tv_usec = (timeout % 1000) * 1000;
+   setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+   if (write(fd, request, strlen(request)) != (ssize_t)strlen(request))
+   {
+      goto error;
+   }
+
+   while ((n = read(fd, buffer, sizeof(buffer) - 1)) > 0)
+   {
+      buffer[n] = '\0';
+      *response = pgexporter_append(*response, buffer);
+   }
+
+   *closed = n == 0;
+
+   close(fd);
+
+   return 0;
+
+error:
+
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   return 1;
+}
+
+int
+pgexporter_tsmock_conf_set(struct tsmock* mock, char* key, char* value, int64_t* result)
+{
+   int socket = -1;
+   struct json* read = NULL;
+   struct json* outcome = NULL;
+   struct json* response = NULL;
+
+   if (pgexporter_connect_unix_socket(&mock->directory[0], MAIN_UDS, &socket))
+   {
+      goto error;
+   }
+
+   if (pgexporter_management_request_conf_set(NULL, socket, key, value,
+                                              MANAGEMENT_COMPRESSION_NONE, MANAGEMENT_ENCRYPTION_NONE,
+                                              MANAGEMENT_OUTPUT_FORMAT_JSON))
+   {
+      goto error;
+   }
+
+   if (pgexporter_management_read_json(NULL, socket, NULL, NULL, &read))
+   {
+      goto error;
+   }
+
+   outcome = (struct json*)pgexporter_json_get(read, MANAGEMENT_CATEGORY_OUTCOME);
+   if (!(bool)pgexporter_json_get(outcome, MANAGEMENT_ARGUMENT_STATUS))
+   {
+      goto error;
+   }
+
+   response = (struct json*)pgexporter_json_get(read, MANAGEMENT_CATEGORY_RESPONSE);
+   if (!pgexporter_json_contains_key(response, key))
+   {
+      goto error;
+   }
+   *result = (int64_t)pgexporter_json_get(response, key);
+
+   pgexporter_json_destroy(read);
+   pgexporter_disconnect(socket);
+
+   return 0;
+
+error:
+
+   pgexporter_json_destroy(read);
+   if (socket != -1)
+   {
+      pgexporter_disconnect(socket);
+   }
+
+   return 1;
+}
+
+int
+pgexporter_tsmock_value(char* body, char* series, double* value)
+{
+   size_t length = strlen(series);
+   char* line = body;
+
+   while (line != NULL && *line != '\0')
+   {
+      if (!strncmp(line, series, length) && line[length] == ' ')
+      {
+         *value = strtod(line + length + 1, NULL);
+         return 0;
+      }
+
+      line = strchr(line, '\n');
+      if (line != NULL)
+      {
+         line++;
+      }
+   }
+
+   return 1;
+}
+
+int
+pgexporter_tsmock_counters(struct tsmock* mock, struct tsmock_counters* counters)
+{
+   int before;
+   char* path = NULL;
+   char* content = NULL;
+   char* last = NULL;
+   char* line = NULL;
+
+   memset(counters, 0, sizeof(struct tsmock_counters));
+
+   path = pgexporter_format_and_append(path, "%s/mock.log", mock->directory);
+
+   before = count_lines(path, "pipelined");
+
+   kill(mock->mock, SIGUSR1);
+
+   for (int i = 0; i < 100 && count_lines(path, "pipelined") <= before; i++)
+   {
+      sleep_milliseconds(50);
+   }
+
+   if (read_file(path, &content))
+   {
+      goto error;
+   }
+
+   line = content;
+   while ((line = strstr(line, "pgexporter-mock: ")) != NULL)
+   {
+      if (strstr(line, "pipelined") != NULL)
+      {
+         last = line;
+      }
+      line++;
+   }
+
+   if (last == NULL ||
+       sscanf(last, "pgexporter-mock: %lu connection(s), %lu %*s %lu cancel request(s), %lu pipelined",
+              &counters->connections, &counters->queries, &counters->cancels, &counters->pipelined) != 4)
+   {
+      goto error;
+   }
+
+   free(path);
+   free(content);
+
+   return 0;
+
+error:
+
+   free(path);
+   free(content);
+
+   return 1;
+}
+
+int
+pgexporter_tsmock_log_count(struct tsmock* mock, char* text)
+{
+   int count;
+   char* path = NULL;
+
+   path = pgexporter_format_and_append(path, "%s/pgexporter.log", mock->directory);
+   count = count_lines(path, text);
+   free(path);
+
+   return count;
+}
+
+int
+pgexporter_tsmock_log_last(struct tsmock* mock, char* text, char** rest)
+{
+   char* path = NULL;
+   char* content = NULL;
+   char* found = NULL;
+   char* line = NULL;
+   char* end = NULL;
+
+   *rest = NULL;
+
+   path = pgexporter_format_and_append(path, "%s/pgexporter.log", mock->directory);
+
+   if (read_file(path, &content))
+   {
+      goto error;
+   }
+
+   line = content;
+   while ((line = strstr(line, text)) != NULL)
+   {
+      found = line;
+      line++;
+   }
+
+   if (found == NULL)
+   {
+      goto error;
+   }
+
+   found += strlen(text);
+   end = strchr(found, '\n');
+   if (end != NULL)
+   {
+      *end = '\0';
+   }
+
+   *rest = strdup(found);
+
+   free(path);
+   free(content);
+
+   return *rest != NULL ? 0 : 1;
+
+error:
+
+   free(path);
+   free(content);
+
+   return 1;
+}
+
+bool
+pgexporter_tsmock_log_wait(struct tsmock* mock, char* text, int timeout)
+{
+   for (int waited = 0; waited <= timeout; waited += 50)
+   {
+      if (pgexporter_tsmock_log_count(mock, text) > 0)
+      {
+         return true;
+      }
+      sleep_milliseconds(50);
+   }
+
+   return false;
+}
+
+int64_t
+pgexporter_tsmock_milliseconds(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static pid_t
+spawn(char* directory, char* output, char** argv)
+{
+   int fd;
+   pid_t pid;
+   char path[MAX_PATH];
+
+   pgexporter_snprintf(&path[0], sizeof(path), "%s/%s", directory, output);
+
+   pid = fork();
+   if (pid == 0)
+   {
+      /* A process group of its own, so its children are stopped with it */
+      setpgid(0, 0);
+
+      fd = open(&path[0], O_WRONLY | O_CREAT | O_APPEND, 0644);
+      if (fd != -1)
+      {
+         dup2(fd, STDOUT_FILENO);
+         dup2(fd, STDERR_FILENO);
+         close(fd);
+      }
+
+      execv(argv[0], argv);
+      _exit(127);
+   }
+
+   if (pid > 0)
+   {
+      setpgid(pid, pid);
+   }
+
+   return pid;
+}
+
+static int
+wait_port(int port, pid_t pid, int timeout)
+{
+   int fd;
+
+   for (int waited = 0; waited <= timeout; waited += 50)
+   {
+      fd = connect_port(port);
+      if (fd != -1)
+      {
+         close(fd);
+         return 0;
+      }
+
+      if (waitpid(pid, NULL, WNOHANG) == pid)
+      {
+         return 1;
+      }
+
+      sleep_milliseconds(50);
+   }
+
+   return 1;
+}
+
+static int
+connect_port(int port)
+{
+   int fd;
+   struct sockaddr_in address;
+   struct timeval tv;
+
+   fd = socket(AF_INET, SOCK_STREAM, 0);
+   if (fd == -1)
+   {
+      return -1;
+   }
+
+   memset(&address, 0, sizeof(address));
+   address.sin_family = AF_INET;
+   address.sin_port = htons(port);
+   address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+   if (connect(fd, (struct sockaddr*)&address, sizeof(address)) == -1)
+   {
+      close(fd);
+      return -1;
+   }
+
+   tv.tv_sec = TSMOCK_SCRAPE_TIMEOUT;
+   tv.tv_usec = 0;
+   setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+   return fd;
+}
+
+static void
+stop_process(pid_t pid, int timeout)
+{
+   kill(pid, SIGTERM);
+
+   for (int waited = 0; waited <= timeout; waited += 50)
+   {
+      if (waitpid(pid, NULL, WNOHANG) == pid)
+      {
+         /* The children left behind */
+         kill(-pid, SIGKILL);
+         return;
+      }
+      sleep_milliseconds(50);
+   }
+
+   kill(-pid, SIGKILL);
+   waitpid(pid, NULL, 0);
+}
+
+static int
+read_file(char* path, char** content)
+{
+   FILE* file = NULL;
+   char buffer[4096];
+   size_t n;
+   char* c = NULL;
+   size_t length = 0;
+
+   *content = NULL;
+
+   file = fopen(path, "r");
+   if (file == NULL)
+   {
+      return 1;
+   }
+
+   while ((n = fread(&buffer[0], 1, sizeof(buffer), file)) > 0)
+   {
+      char* r = realloc(c, length + n + 1);
+      if (r == NULL)
+      {
+         free(c);
+         fclose(file);
+         return 1;
+      }
+      c = r;
+      memcpy(c + length, &buffer[0], n);
+      length += n;
+      c[length] = '\0';
+   }
+
+   fclose(file);
+
+   if (c == NULL)
+   {
+      c = strdup("");
+   }
+
+   *content = c;
+
+   return c == NULL ? 1 : 0;
+}
+
+static int
+count_lines(char* path, char* text)
+{
+   int count = 0;
+   char* content = NULL;
+   char* line = NULL;
+   char* next = NULL;
+
+   if (read_file(path, &content))
+   {
+      return 0;
+   }
+
+   line = content;
+   while (line != NULL && *line != '\0')
+   {
+      next = strchr(line, '\n');
+      if (next != NULL)
+      {
+         *next = '\0';
+      }
+
+      if (strstr(line, text) != NULL)
+      {
+         count++;
+      }
+
+      line = next != NULL ? next + 1 : NULL;
+   }
+
+   free(content);
+
+   return count;
+}
+
+static char*
+find_header(char* headers, char* name)
+{
+   size_t length = strlen(name);
+   char* line = strstr(headers, "\r\n");
+
+   while (line != NULL)
+   {
+      line += 2;
+      if (!strncasecmp(line, name, length))
+      {
+         line += length;
+         while (*line == ' ')
+         {
+            line++;
+         }
+         return line;
+      }
+      line = strstr(line, "\r\n");
+   }
+
+   return NULL;
+}
+
+static int
+decode_chunks(char* data, size_t length, char** body, bool* complete)
+{
+   size_t offset = 0;
+   size_t size;
+   size_t body_length = 0;
+   char* b = NULL;
+   char* end = NULL;
+
+   *complete = false;
+
+   b = calloc(1, length + 1);
+   if (b == NULL)
+   {
+      return 1;
+   }
+
+   while (offset < length)
+   {
+      end = strstr(data + offset, "\r\n");
+      if (end == NULL)
+      {
+         break;
+      }
+
+      size = strtoul(data + offset, NULL, 16);
+      offset = end - data + 2;
+
+      if (size == 0)
+      {
+         *complete = true;
+         break;
+      }
+
+      if (offset + size + 2 > length)
+      {
+         break;
+      }
+
+      memcpy(b + body_length, data + offset, size);
+      body_length += size;
+      offset += size + 2;
+   }
+
+   b[body_length] = '\0';
+   *body = b;
+
+   return 0;
+}
+
+static void
+sleep_milliseconds(int milliseconds)
+{
+   struct timespec ts;
+
+   ts.tv_sec = milliseconds / 1000;
+   ts.tv_nsec = (milliseconds % 1000) * 1000000L;
+
+   nanosleep(&ts, NULL);
+}
@@ -39,6 +39,18 @@
 #include <string.h>
 #include <time.h>
 
+static struct prometheus_cache_buffer*
+published(struct prometheus_cache* cache)
+{
+   return &cache->buffers[atomic_load(&cache->current)];
+}
+
+static char*
+building(struct prometheus_cache* cache)
+{
+   return cache->data + (size_t)(1 - atomic_load(&cache->current)) * cache->size;
+}
+
 MCTF_TEST_SETUP(cache)
 {
    pgexporter_test_config_save();
@@ -61,12 +73,12 @@ MCTF_TEST(test_cache_init)
 
    MCTF_ASSERT_INT_EQ(pgexporter_cache_init(cache_size, &total_size, &cache_shmem), 0, cleanup, "cache_init failed");
    MCTF_ASSERT(cache_shmem != NULL, cleanup, "cache_shmem is NULL");
-   MCTF_ASSERT_INT_EQ(total_size, cache_size + sizeof(struct prometheus_cache), cleanup, "total_size mismatch");
+   MCTF_ASSERT_INT_EQ(total_size, 2 * cache_size + sizeof(struct prometheus_cache), cleanup, "total_size mismatch");
 
    cache = (struct prometheus_cache*)cache_shmem;
    MCTF_ASSERT_INT_EQ(cache->size, cache_size, cleanup, "cache size mismatch");
-   MCTF_ASSERT_INT_EQ(cache->valid_until, 0, cleanup, "cache valid_until mismatch");
-   MCTF_ASSERT_INT_EQ(cache->data[0], '\0', cleanup, "cache data[0] mismatch");
+   MCTF_ASSERT_INT_EQ(published(cache)->valid_until, 0, cleanup, "cache valid_until mismatch");
+   MCTF_ASSERT_INT_EQ(published(cache)->length, 0, cleanup, "cache length mismatch");
 
 cleanup:
    if (cache_shmem != NULL)
@@ -101,7 +113,7 @@ MCTF_TEST(test_cache_is_valid)
    MCTF_ASSERT(pgexporter_cache_is_valid(cache), cleanup, "Finalized cache should be valid");
 
    // Expired cache
-   cache->valid_until = time(NULL) - 10;
+   published(cache)->valid_until = time(NULL) - 10;
    MCTF_ASSERT(!pgexporter_cache_is_valid(cache), cleanup, "Expired cache should be invalid");
 
 cleanup:
@@ -112,6 +124,46 @@ cleanup:
    MCTF_FINISH();
 }
 
+// Test serving an expired cache while it is refreshed
+MCTF_TEST(test_cache_is_stale)
+{
+   size_t total_size = 0;
+   void* cache_shmem = NULL;
+   struct prometheus_cache* cache = NULL;
+
+   pgexporter_cache_init(64, &total_size, &cache_shmem);
+   cache = (struct prometheus_cache*)cache_shmem;
+
+   MCTF_ASSERT(!pgexporter_cache_is_stale(NULL, PGEXPORTER_TIME_SEC(60)), cleanup, "NULL cache should not be stale");
+   MCTF_ASSERT(!pgexporter_cache_is_stale(cache, PGEXPORTER_TIME_SEC(60)), cleanup, "Empty cache should not be stale");
+
+   pgexporter_cache_append(cache, "data");
+   MCTF_ASSERT(pgexporter_cache_finalize(cache, PGEXPORTER_TIME_SEC(60)), cleanup, "finalize failed");
+   MCTF_ASSERT(published(cache)->created > 0 && published(cache)->created <= time(NULL), cleanup, "created mismatch");
+
+   // A valid cache is fresh, not stale
+   MCTF_ASSERT(!pgexporter_cache_is_stale(cache, PGEXPORTER_TIME_SEC(60)), cleanup, "Valid cache should not be stale");
+
+   // Expired within the bound
+   published(cache)->valid_until = time(NULL) - 10;
+   MCTF_ASSERT(pgexporter_cache_is_stale(cache, PGEXPORTER_TIME_SEC(60)), cleanup, "Expired cache should be stale");
+   MCTF_ASSERT(!pgexporter_cache_is_stale(cache, PGEXPORTER_TIME_DISABLED), cleanup, "Stale serving should be disabled");
+
+   // Expired beyond the bound
+   MCTF_ASSERT(!pgexporter_cache_is_stale(cache, PGEXPORTER_TIME_SEC(5)), cleanup, "Cache beyond max_stale should not be served");
+
+   pgexporter_cache_invalidate(cache);
+   MCTF_ASSERT(!pgexporter_cache_is_stale(cache, PGEXPORTER_TIME_SEC(60)), cleanup, "Invalidated cache should not be stale");
+   MCTF_ASSERT_INT_EQ(published(cache)->created, 0, cleanup, "created not cleared");
+
+cleanup:
+   if (cache_shmem != NULL)
+   {
+      pgexporter_destroy_shared_memory(cache_shmem, total_size);
+   }
+   MCTF_FINISH();
+}
+
 // Test cache invalidation
 MCTF_TEST(test_cache_invalidate)
 {
@@ -130,8 +182,8 @@ MCTF_TEST(test_cache_invalidate)
    MCTF_ASSERT(pgexporter_cache_is_valid(cache), cleanup, "cache should be valid");
 
    pgexporter_cache_invalidate(cache);
-   MCTF_ASSERT_INT_EQ(cache->valid_until, 0, cleanup, "valid_until not cleared");
-   MCTF_ASSERT_INT_EQ(cache->data[0], '\0', cleanup, "data not cleared");
+   MCTF_ASSERT_INT_EQ(published(cache)->valid_until, 0, cleanup, "valid_until not cleared");
+   MCTF_ASSERT_INT_EQ(published(cache)->length, 0, cleanup, "data not cleared");
    MCTF_ASSERT(!pgexporter_cache_is_valid(cache), cleanup, "invalidated cache should be invalid");
 
 cleanup:
@@ -158,12 +210,12 @@ MCTF_TEST(test_cache_append)
 
    // Single append
    MCTF_ASSERT(pgexporter_cache_append(cache, "hello"), cleanup, "append failed");
-   MCTF_ASSERT_STR_EQ(cache->data, "hello", cleanup, "data mismatch");
+   MCTF_ASSERT_STR_EQ(building(cache), "hello", cleanup, "data mismatch");
 
    // Multiple appends
    MCTF_ASSERT(pgexporter_cache_append(cache, "world"), cleanup, "second append failed");
-   MCTF_ASSERT_STR_EQ(cache->data, "helloworld", cleanup, "data mismatch after second append");
-   MCTF_ASSERT_INT_EQ(cache->data[10], '\0', cleanup, "missing null terminator");
+   MCTF_ASSERT_STR_EQ(building(cache), "helloworld", cleanup, "data mismatch after second append");
+   MCTF_ASSERT_INT_EQ(building(cache)[10], '\0', cleanup, "missing null terminator");
 
 cleanup:
    if (cache_shmem != NULL)
@@ -191,8 +243,8 @@ MCTF_TEST(test_cache_append_overflow)
    MCTF_ASSERT(!pgexporter_cache_append(cache, "X"), cleanup, "append should have failed on overflow");
 
    // Cache should be invalidated after overflow
-   MCTF_ASSERT_INT_EQ(cache->data[0], '\0', cleanup, "data should be cleared on overflow");
-   MCTF_ASSERT_INT_EQ(cache->valid_until, 0, cleanup, "valid_until should be cleared on overflow");
+   MCTF_ASSERT_INT_EQ(published(cache)->length, 0, cleanup, "data should be cleared on overflow");
+   MCTF_ASSERT_INT_EQ(published(cache)->valid_until, 0, cleanup, "valid_until should be cleared on overflow");
 
 cleanup:
    if (cache_shmem != NULL)
@@ -218,7 +270,7 @@ MCTF_TEST(test_cache_finalize)
 
    before = time(NULL);
    MCTF_ASSERT(pgexporter_cache_finalize(cache, PGEXPORTER_TIME_SEC(120)), cleanup, "finalize failed");
-   MCTF_ASSERT(cache->valid_until >= before + 120, cleanup, "valid_until mismatch");
+   MCTF_ASSERT(published(cache)->valid_until >= before + 120, cleanup, "valid_until mismatch");
 
 cleanup:
    if (cache_shmem != NULL)
@@ -234,6 +286,10 @@ MCTF_TEST(test_cache_lifecycle)
    size_t total_size = 0;
    void* cache_shmem = NULL;
    struct prometheus_cache* cache = NULL;
+   char* data = NULL;
+   size_t length = 0;
+   time_t created = 0;
+   time_t valid_until = 0;
 
    MCTF_ASSERT_INT_EQ(pgexporter_cache_init(256, &total_size, &cache_shmem), 0, cleanup, "cache_init failed");
    cache = (struct prometheus_cache*)cache_shmem;
@@ -242,7 +298,7 @@ MCTF_TEST(test_cache_lifecycle)
 
    MCTF_ASSERT(pgexporter_cache_append(cache, "metric1 42\n"), cleanup, "append 1 failed");
    MCTF_ASSERT(pgexporter_cache_append(cache, "metric2 99\n"), cleanup, "append 2 failed");
-   MCTF_ASSERT_STR_EQ(cache->data, "metric1 42\nmetric2 99\n", cleanup, "data mismatch");
+   MCTF_ASSERT_STR_EQ(building(cache), "metric1 42\nmetric2 99\n", cleanup, "data mismatch");
    MCTF_ASSERT(!pgexporter_cache_is_valid(cache), cleanup, "unfinalized cache should be invalid");
 
    MCTF_ASSERT(pgexporter_cache_finalize(cache, PGEXPORTER_TIME_SEC(60)), cleanup, "finalize failed");
@@ -255,9 +311,119 @@ MCTF_TEST(test_cache_lifecycle)
    MCTF_ASSERT(pgexporter_cache_append(cache, "new data"), cleanup, "append after invalidation failed");
    MCTF_ASSERT(pgexporter_cache_finalize(cache, PGEXPORTER_TIME_SEC(30)), cleanup, "finalize after invalidation failed");
    MCTF_ASSERT(pgexporter_cache_is_valid(cache), cleanup, "cache should be valid again");
-   MCTF_ASSERT_STR_EQ(cache->data, "new data", cleanup, "new data mismatch");
+   MCTF_ASSERT_INT_EQ(pgexporter_cache_get(cache, &data, &length, &created, &valid_until), 0, cleanup, "get failed");
+   MCTF_ASSERT_STR_EQ(data, "new data", cleanup, "new data mismatch");
+
+cleanup:
+   free(data);
+   if (cache_shmem != NULL)
+   {
+      pgexporter_destroy_shared_memory(cache_shmem, total_size);
+   }
+   MCTF_FINISH();
+}
+
+// Test that the published payload is served while the next one is built
+MCTF_TEST(test_cache_double_buffer)
+{
+   size_t total_size = 0;
+   void* cache_shmem = NULL;
+   struct prometheus_cache* cache = NULL;
+   char* data = NULL;
+   size_t length = 0;
+   time_t created = 0;
+   time_t valid_until = 0;
+
+   pgexporter_cache_init(64, &total_size, &cache_shmem);
+   cache = (struct prometheus_cache*)cache_shmem;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_cache_get(NULL, &data, &length, &created, &valid_until), 1, cleanup, "get from NULL cache should fail");
+   MCTF_ASSERT_INT_EQ(pgexporter_cache_get(cache, &data, &length, &created, &valid_until), 1, cleanup, "get from empty cache should fail");
+   MCTF_ASSERT(data == NULL, cleanup, "data should be NULL");
+
+   pgexporter_cache_append(cache, "first");
+   pgexporter_cache_finalize(cache, PGEXPORTER_TIME_SEC(60));
+
+   // Build the next payload without finalizing it
+   pgexporter_cache_append(cache, "second");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_cache_get(cache, &data, &length, &created, &valid_until), 0, cleanup, "get failed");
+   MCTF_ASSERT_STR_EQ(data, "first", cleanup, "published payload mismatch");
+   MCTF_ASSERT_INT_EQ(length, 5, cleanup, "length mismatch");
+   MCTF_ASSERT(valid_until >= created + 60, cleanup, "valid_until mismatch");
+   free(data);
+   data = NULL;
+
+   pgexporter_cache_finalize(cache, PGEXPORTER_TIME_SEC(60));
+
+   MCTF_ASSERT_INT_EQ(pgexporter_cache_get(cache, &data, &length, &created, &valid_until), 0, cleanup, "get failed");
+   MCTF_ASSERT_STR_EQ(data, "second", cleanup, "new payload mismatch");
+   MCTF_ASSERT_INT_EQ(published(cache)->sequence % 2, 0, cleanup, "published buffer left in write");
+
+cleanup:
+   free(data);
+   if (cache_shmem != NULL)
+   {
+      pgexporter_destroy_shared_memory(cache_shmem, total_size);
+   }
+   MCTF_FINISH();
+}
+
+// Test the compressed copies kept next to the payload
+MCTF_TEST(test_cache_encoded)
+{
+   size_t total_size = 0;
+   void* cache_shmem = NULL;
+   struct prometheus_cache* cache = NULL;
+   char* data = NULL;
+   size_t length = 0;
+   time_t created = 0;
+   time_t valid_until = 0;
+
+   pgexporter_cache_init(32, &total_size, &cache_shmem);
+   cache = (struct prometheus_cache*)cache_shmem;
+
+   // Nothing to attach to before the payload is built
+   MCTF_ASSERT(!pgexporter_cache_append_encoded(cache, CONTENT_ENCODING_GZIP, "gz", 2), cleanup, "attach without payload should fail");
+
+   MCTF_ASSERT(pgexporter_cache_append(cache, "plain"), cleanup, "append failed");
+   MCTF_ASSERT(!pgexporter_cache_append_encoded(cache, CONTENT_ENCODING_IDENTITY, "id", 2), cleanup, "identity is not an encoded copy");
+   MCTF_ASSERT(pgexporter_cache_append_encoded(cache, CONTENT_ENCODING_GZIP, "gz", 2), cleanup, "gzip attach failed");
+   MCTF_ASSERT(pgexporter_cache_append_encoded(cache, CONTENT_ENCODING_ZSTD, "zstd", 4), cleanup, "zstd attach failed");
+
+   // Not published until finalized
+   MCTF_ASSERT_INT_EQ(pgexporter_cache_get_encoded(cache, CONTENT_ENCODING_GZIP, &data, &length, &created, &valid_until), 1, cleanup, "unfinalized copy should not be served");
+
+   pgexporter_cache_finalize(cache, PGEXPORTER_TIME_SEC(60));
+
+   MCTF_ASSERT_INT_EQ(pgexporter_cache_get_encoded(cache, CONTENT_ENCODING_GZIP, &data, &length, &created, &valid_until), 0, cleanup, "gzip get failed");
+   MCTF_ASSERT_INT_EQ(length, 2, cleanup, "gzip length mismatch");
+   MCTF_ASSERT(!memcmp(data, "gz", 2), cleanup, "gzip copy mismatch");
+   free(data);
+   data = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_cache_get_encoded(cache, CONTENT_ENCODING_ZSTD, &data, &length, &created, &valid_until), 0, cleanup, "zstd get failed");
+   MCTF_ASSERT_INT_EQ(length, 4, cleanup, "zstd length mismatch");
+   MCTF_ASSERT(!memcmp(data, "zstd", 4), cleanup, "zstd copy mismatch");
+   free(data);
+   data = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_cache_get(cache, &data, &length, &created, &valid_until), 0, cleanup, "get failed");
+   MCTF_ASSERT_STR_EQ(data, "plain", cleanup, "payload mismatch");
+   free(data);
+   data = NULL;
+
+   // A copy that does not fit is dropped, the payload is still published
+   MCTF_ASSERT(pgexporter_cache_append(cache, "next"), cleanup, "append failed");
+   MCTF_ASSERT(!pgexporter_cache_append_encoded(cache, CONTENT_ENCODING_GZIP, "0123456789012345678901234567890", 31), cleanup, "oversized copy should be dropped");
+   pgexporter_cache_finalize(cache, PGEXPORTER_TIME_SEC(60));
+
+   MCTF_ASSERT_INT_EQ(pgexporter_cache_get_encoded(cache, CONTENT_ENCODING_GZIP, &data, &length, &created, &valid_until), 1, cleanup, "dropped copy should not be served");
+   MCTF_ASSERT_INT_EQ(pgexporter_cache_get(cache, &data, &length, &created, &valid_until), 0, cleanup, "get failed");
+   MCTF_ASSERT_STR_EQ(data, "next", cleanup, "payload mismatch");
 
 cleanup:
+   free(data);
    if (cache_shmem != NULL)
    {
       pgexporter_destroy_shared_memory(cache_shmem, total_size);
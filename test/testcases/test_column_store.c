@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pgexporter.h>
+#include <art.h>
+#include <column_store.h>
+#include <queries.h>
+
+#include <mctf.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUMBER_OF_ROWS   200
+#define NUMBER_OF_GROUPS 6
+
+static void list_walk_add(struct column_store* store, struct column_node* node);
+static void make_row(struct tuple* tuple, struct tuple_cell* cell, char* value);
+
+// Test that the indexed grouping gives the order of a list walk for random rows
+MCTF_TEST(test_column_store_data0_order)
+{
+   char* values[NUMBER_OF_GROUPS] = {"a", "b", "c", "d", "e", NULL};
+   struct tuple tuples[NUMBER_OF_ROWS];
+   struct tuple_cell cells[NUMBER_OF_ROWS];
+   struct column_node indexed[NUMBER_OF_ROWS + 1];
+   struct column_node walked[NUMBER_OF_ROWS + 1];
+   struct column_store indexed_store;
+   struct column_store walked_store;
+   struct column_node* i_node = NULL;
+   struct column_node* w_node = NULL;
+   int count = 0;
+
+   memset(&indexed_store, 0, sizeof(indexed_store));
+
+   srand(42);
+
+   for (int round = 0; round < 20; round++)
+   {
+      memset(&indexed_store, 0, sizeof(indexed_store));
+      memset(&walked_store, 0, sizeof(walked_store));
+      memset(indexed, 0, sizeof(indexed));
+      memset(walked, 0, sizeof(walked));
+
+      /* The first node holds the help and type lines */
+      indexed[0].data = "# HELP";
+      walked[0].data = "# HELP";
+      pgexporter_column_store_add(&indexed_store, &indexed[0], SORT_DATA0);
+      list_walk_add(&walked_store, &walked[0]);
+
+      /* Fewer groups in the early rounds make long runs of the same value */
+      for (int i = 0; i < NUMBER_OF_ROWS; i++)
+      {
+         make_row(&tuples[i], &cells[i], values[rand() % (2 + round % (NUMBER_OF_GROUPS - 1))]);
+
+         indexed[i + 1].data = (char*)&tuples[i];
+         indexed[i + 1].tuple = &tuples[i];
+         walked[i + 1].data = (char*)&tuples[i];
+         walked[i + 1].tuple = &tuples[i];
+
+         pgexporter_column_store_add(&indexed_store, &indexed[i + 1], SORT_DATA0);
+         list_walk_add(&walked_store, &walked[i + 1]);
+      }
+
+      i_node = indexed_store.columns;
+      w_node = walked_store.columns;
+      count = 0;
+
+      while (i_node != NULL && w_node != NULL)
+      {
+         MCTF_ASSERT(i_node->data == w_node->data, cleanup, "row order differs from the list walk");
+         i_node = i_node->next;
+         w_node = w_node->next;
+         count++;
+      }
+
+      MCTF_ASSERT(i_node == NULL && w_node == NULL, cleanup, "row count differs from the list walk");
+      MCTF_ASSERT_INT_EQ(count, NUMBER_OF_ROWS + 1, cleanup, "rows are missing");
+      MCTF_ASSERT(indexed_store.last_column->next == NULL, cleanup, "last column is not the tail");
+      MCTF_ASSERT(indexed_store.last_column->data == walked_store.last_column->data, cleanup, "last column differs from the list walk");
+
+      pgexporter_column_store_destroy(&indexed_store, 1);
+   }
+
+cleanup:
+   pgexporter_column_store_destroy(&indexed_store, 1);
+   MCTF_FINISH();
+}
+
+// Test that the column stores are found by tag, name, type and sort
+MCTF_TEST(test_column_store_index)
+{
+   struct art* index = NULL;
+
+   pgexporter_art_create(&index);
+   MCTF_ASSERT_PTR_NONNULL(index, cleanup, "ART creation failed");
+
+   pgexporter_column_store_index(index, "pg_db", "size", 1, SORT_NAME, 0);
+   pgexporter_column_store_index(index, "pg_db", "size", 1, SORT_DATA0, 1);
+   pgexporter_column_store_index(index, "pg_db", "", 2, SORT_NAME, 2);
+
+   MCTF_ASSERT_INT_EQ(pgexporter_column_store_find(index, "pg_db", "size", 1, SORT_NAME), 0, cleanup, "SORT_NAME slot mismatch");
+   MCTF_ASSERT_INT_EQ(pgexporter_column_store_find(index, "pg_db", "size", 1, SORT_DATA0), 1, cleanup, "SORT_DATA0 slot mismatch");
+   MCTF_ASSERT_INT_EQ(pgexporter_column_store_find(index, "pg_db", "", 2, SORT_NAME), 2, cleanup, "unnamed slot mismatch");
+   MCTF_ASSERT_INT_EQ(pgexporter_column_store_find(index, "pg_db", "size", 2, SORT_NAME), -1, cleanup, "type should be part of the key");
+   MCTF_ASSERT_INT_EQ(pgexporter_column_store_find(index, "pg_d", "bsize", 1, SORT_NAME), -1, cleanup, "tag and name should be separated");
+   MCTF_ASSERT_INT_EQ(pgexporter_column_store_find(NULL, "pg_db", "size", 1, SORT_NAME), -1, cleanup, "missing index should not find");
+
+cleanup:
+   pgexporter_art_destroy(index);
+   MCTF_FINISH();
+}
+
+/* The grouping by a walk of the list that the index replaced */
+static void
+list_walk_add(struct column_store* store, struct column_node* node)
+{
+   struct column_node* temp = store->columns;
+
+   if (temp == NULL)
+   {
+      store->columns = node;
+      store->last_column = node;
+      return;
+   }
+
+   while (temp->next)
+   {
+      if (temp->next->tuple != NULL && node->tuple != NULL)
+      {
+         char* next_d0 = pgexporter_get_column(0, temp->next->tuple);
+         char* cur_d0 = pgexporter_get_column(0, node->tuple);
+
+         if (next_d0 == NULL || (cur_d0 != NULL && !strcmp(next_d0, cur_d0)))
+         {
+            break;
+         }
+      }
+      temp = temp->next;
+   }
+
+   node->next = temp->next;
+   temp->next = node;
+
+   if (node->next == NULL)
+   {
+      store->last_column = node;
+   }
+}
+
+static void
+make_row(struct tuple* tuple, struct tuple_cell* cell, char* value)
+{
+   memset(tuple, 0, sizeof(struct tuple));
+
+   tuple->row = value;
+   tuple->cells = cell;
+   cell->offset = 0;
+   cell->length = value != NULL ? (int)strlen(value) : -1;
+}
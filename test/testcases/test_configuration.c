@@ -29,16 +29,56 @@
 
 #include <pgexporter.h>
 #include <configuration.h>
+#include <internal.h>
 #include <json.h>
+#include <json_configuration.h>
 #include <management.h>
 #include <network.h>
+#include <pg_query_alts.h>
 #include <shmem.h>
 #include <tsclient.h>
 #include <tscommon.h>
 #include <utils.h>
+#include <yaml_configuration.h>
 
 #include <mctf.h>
+#include <dirent.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MAX_QUERIES 32
+
+#define CACHED_METRICS(TAG)                                     \
+   "metrics:\n"                                               \
+   "- tag: " TAG "\n"                                         \
+   "  collector: cached\n"                                    \
+   "  sort: data\n"                                           \
+   "  queries:\n"                                             \
+   "  - query: SELECT name, value FROM " TAG ";\n"            \
+   "    version: 10\n"                                        \
+   "    columns:\n"                                           \
+   "    - name: name\n"                                       \
+   "      type: label\n"                                      \
+   "    - description: Value\n"                               \
+   "      type: gauge\n"                                      \
+   "  - query: SELECT name, value, other FROM " TAG ";\n"     \
+   "    version: 14\n"                                        \
+   "    columns:\n"                                           \
+   "    - name: name\n"                                       \
+   "      type: label\n"                                      \
+   "    - description: Value\n"                               \
+   "      type: gauge\n"                                      \
+   "    - name: other\n"                                      \
+   "      description: Other\n"                               \
+   "      type: counter\n"
+
+static int load_metrics(char* metrics_path, char* cache, struct configuration** config);
+static void free_metrics(struct configuration* config);
+static int write_metrics(char* path, char* content);
+static int cache_file(char* dir, char* path, ino_t* inode);
+static void collect_queries(struct pg_query_alts* root, struct pg_query_alts** queries, int* n);
 
 MCTF_TEST(test_configuration_time_format_output)
 {
@@ -142,6 +182,12 @@ MCTF_TEST(test_configuration_accept_time)
    MCTF_ASSERT(pgexporter_test_assert_conf_set_ok(CONFIGURATION_ARGUMENT_METRICS_CACHE_MAX_AGE, "1w", 7 * 24 * 3600) == 0,
                cleanup, "conf set failed for metrics_cache_max_age=1w");
 
+   MCTF_ASSERT(pgexporter_test_assert_conf_set_ok(CONFIGURATION_ARGUMENT_METRICS_CACHE_MAX_STALE, "30s", 30) == 0,
+               cleanup, "conf set failed for metrics_cache_max_stale=30s");
+
+   MCTF_ASSERT(pgexporter_test_assert_conf_set_ok(CONFIGURATION_ARGUMENT_METRICS_CACHE_MAX_STALE, "0", 0) == 0,
+               cleanup, "conf set failed for metrics_cache_max_stale=0");
+
    MCTF_ASSERT(pgexporter_test_assert_conf_set_ok(CONFIGURATION_ARGUMENT_METRICS_QUERY_TIMEOUT, "5ms", 5) == 0,
                cleanup, "conf set failed for metrics_query_timeout=5ms");
 
@@ -154,6 +200,12 @@ MCTF_TEST(test_configuration_accept_time)
    MCTF_ASSERT(pgexporter_test_assert_conf_set_ok(CONFIGURATION_ARGUMENT_METRICS_QUERY_TIMEOUT, "2M", 120000) == 0,
                cleanup, "conf set failed for metrics_query_timeout=2M");
 
+   MCTF_ASSERT(pgexporter_test_assert_conf_set_ok(CONFIGURATION_ARGUMENT_METRICS_SCRAPE_TIMEOUT, "9500ms", 9500) == 0,
+               cleanup, "conf set failed for metrics_scrape_timeout=9500ms");
+
+   MCTF_ASSERT(pgexporter_test_assert_conf_set_ok(CONFIGURATION_ARGUMENT_METRICS_SCRAPE_TIMEOUT, "10s", 10000) == 0,
+               cleanup, "conf set failed for metrics_scrape_timeout=10s");
+
    MCTF_ASSERT(pgexporter_test_assert_conf_set_ok(CONFIGURATION_ARGUMENT_METRICS_CACHE_MAX_AGE, "1H", 3600) == 0,
                cleanup, "conf set failed for metrics_cache_max_age=1H");
 
@@ -205,6 +257,21 @@ MCTF_TEST(test_configuration_get_returns_set_values)
    MCTF_ASSERT(pgexporter_test_assert_conf_set_ok(CONFIGURATION_ARGUMENT_METRICS_QUERY_TIMEOUT, "500ms", 500) == 0,
                cleanup, "conf set failed for metrics_query_timeout=500ms");
 
+   MCTF_ASSERT(pgexporter_test_assert_conf_set_ok(CONFIGURATION_ARGUMENT_METRICS_QUERY_WORKERS, "4", 4) == 0,
+               cleanup, "conf set failed for metrics_query_workers=4");
+
+   MCTF_ASSERT(pgexporter_test_assert_conf_set_ok(CONFIGURATION_ARGUMENT_HTTP_KEEP_ALIVE_TIMEOUT, "10s", 10) == 0,
+               cleanup, "conf set failed for http_keep_alive_timeout=10s");
+
+   MCTF_ASSERT(pgexporter_test_assert_conf_set_ok(CONFIGURATION_ARGUMENT_HTTP_KEEP_ALIVE_MAX_REQS, "50", 50) == 0,
+               cleanup, "conf set failed for http_keep_alive_max_requests=50");
+
+   MCTF_ASSERT(pgexporter_test_assert_conf_set_ok(CONFIGURATION_ARGUMENT_HTTP_WORKERS, "4", 4) == 0,
+               cleanup, "conf set failed for http_workers=4");
+
+   MCTF_ASSERT(pgexporter_test_assert_conf_set_ok(CONFIGURATION_ARGUMENT_HTTP_WORKER_MAX_REQUESTS, "1000", 1000) == 0,
+               cleanup, "conf set failed for http_worker_max_requests=1000");
+
    MCTF_ASSERT(pgexporter_test_assert_conf_get_ok(CONFIGURATION_ARGUMENT_BLOCKING_TIMEOUT, 45) == 0,
                cleanup, "conf get failed for blocking_timeout");
 
@@ -214,6 +281,21 @@ MCTF_TEST(test_configuration_get_returns_set_values)
    MCTF_ASSERT(pgexporter_test_assert_conf_get_ok(CONFIGURATION_ARGUMENT_METRICS_QUERY_TIMEOUT, 500) == 0,
                cleanup, "conf get failed for metrics_query_timeout");
 
+   MCTF_ASSERT(pgexporter_test_assert_conf_get_ok(CONFIGURATION_ARGUMENT_METRICS_QUERY_WORKERS, 4) == 0,
+               cleanup, "conf get failed for metrics_query_workers");
+
+   MCTF_ASSERT(pgexporter_test_assert_conf_get_ok(CONFIGURATION_ARGUMENT_HTTP_KEEP_ALIVE_TIMEOUT, 10) == 0,
+               cleanup, "conf get failed for http_keep_alive_timeout");
+
+   MCTF_ASSERT(pgexporter_test_assert_conf_get_ok(CONFIGURATION_ARGUMENT_HTTP_KEEP_ALIVE_MAX_REQS, 50) == 0,
+               cleanup, "conf get failed for http_keep_alive_max_requests");
+
+   MCTF_ASSERT(pgexporter_test_assert_conf_get_ok(CONFIGURATION_ARGUMENT_HTTP_WORKERS, 4) == 0,
+               cleanup, "conf get failed for http_workers");
+
+   MCTF_ASSERT(pgexporter_test_assert_conf_get_ok(CONFIGURATION_ARGUMENT_HTTP_WORKER_MAX_REQUESTS, 1000) == 0,
+               cleanup, "conf get failed for http_worker_max_requests");
+
 cleanup:
    pgexporter_test_teardown();
    MCTF_FINISH();
@@ -487,3 +569,394 @@ cleanup:
    pgexporter_json_destroy(res);
    MCTF_FINISH();
 }
+
+MCTF_TEST(test_configuration_metrics_reload)
+{
+   struct configuration* config = NULL;
+   struct configuration* reload = NULL;
+   size_t reload_size = sizeof(struct configuration);
+
+   pgexporter_test_config_save();
+
+   config = (struct configuration*)shmem;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_read_internal_yaml_metrics(config, true), 0, cleanup, "internal metrics failed");
+   MCTF_ASSERT(config->number_of_metrics > 0, cleanup, "no internal metrics");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_create_shared_memory(reload_size, HUGEPAGE_OFF, (void**)&reload), 0, cleanup, "shared memory failed");
+   pgexporter_init_configuration((void*)reload);
+
+   /* The metric names of the running configuration are no duplicates of a reload */
+   MCTF_ASSERT_INT_EQ(pgexporter_read_internal_yaml_metrics(reload, true), 0, cleanup, "reloaded internal metrics failed");
+   MCTF_ASSERT_INT_EQ(reload->number_of_metrics, config->number_of_metrics, cleanup, "number of metrics mismatch");
+   MCTF_ASSERT_INT_EQ(reload->number_of_metric_names, config->number_of_metric_names, cleanup, "number of metric names mismatch");
+   MCTF_ASSERT_STR_EQ(reload->prometheus[0].tag, config->prometheus[0].tag, cleanup, "tag mismatch");
+
+cleanup:
+   if (reload != NULL)
+   {
+      pgexporter_free_pg_query_alts(reload);
+      pgexporter_destroy_shared_memory((void*)reload, reload_size);
+   }
+   pgexporter_free_pg_query_alts(config);
+   pgexporter_test_config_restore();
+   MCTF_FINISH();
+}
+
+MCTF_TEST(test_configuration_metrics_reload_json)
+{
+   struct configuration* config = NULL;
+   struct configuration* reload = NULL;
+   size_t reload_size = sizeof(struct configuration);
+   char path[MAX_PATH];
+
+   pgexporter_test_config_save();
+
+   config = (struct configuration*)shmem;
+
+   pgexporter_snprintf(path, sizeof(path), "%s/test/conf/metrics/custom.json", TEST_BASE_DIR);
+
+   config->number_of_metrics = 0;
+   pgexporter_snprintf(config->metrics_path, MAX_PATH, "%s", path);
+   MCTF_ASSERT_INT_EQ(pgexporter_read_json_metrics_configuration((void*)config), 0, cleanup, "JSON metrics failed");
+   MCTF_ASSERT_INT_EQ(config->number_of_metrics, 1, cleanup, "number of metrics mismatch");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_create_shared_memory(reload_size, HUGEPAGE_OFF, (void**)&reload), 0, cleanup, "shared memory failed");
+   pgexporter_init_configuration((void*)reload);
+
+   /* The metric names of the running configuration are no duplicates of a reload */
+   pgexporter_snprintf(reload->metrics_path, MAX_PATH, "%s", path);
+   MCTF_ASSERT_INT_EQ(pgexporter_read_json_metrics_configuration((void*)reload), 0, cleanup, "reloaded JSON metrics failed");
+   MCTF_ASSERT_INT_EQ(reload->number_of_metrics, 1, cleanup, "reloaded number of metrics mismatch");
+   MCTF_ASSERT_STR_EQ(reload->prometheus[0].tag, "custom_value", cleanup, "tag mismatch");
+
+cleanup:
+   if (reload != NULL)
+   {
+      pgexporter_free_pg_query_alts(reload);
+      pgexporter_destroy_shared_memory((void*)reload, reload_size);
+   }
+   pgexporter_free_pg_query_alts(config);
+   pgexporter_test_config_restore();
+   MCTF_FINISH();
+}
+
+MCTF_TEST(test_configuration_metrics_stamp)
+{
+   char dir[MAX_PATH];
+   char path[MAX_PATH];
+   uint64_t empty = 0;
+   uint64_t first = 0;
+   uint64_t second = 0;
+   uint64_t changed = 0;
+   FILE* f = NULL;
+
+   memset(path, 0, sizeof(path));
+
+   pgexporter_snprintf(dir, sizeof(dir), "/tmp/pgexporter-stamp-XXXXXX");
+   MCTF_ASSERT_PTR_NONNULL(mkdtemp(dir), cleanup, "mkdtemp failed");
+   pgexporter_snprintf(path, sizeof(path), "%s/metrics.yaml", dir);
+
+   f = fopen(path, "w");
+   MCTF_ASSERT_PTR_NONNULL(f, cleanup, "failed to create metrics file");
+   fputs("metrics:\n  - tag: first\n", f);
+   fclose(f);
+
+   MCTF_ASSERT_INT_EQ(pgexporter_metrics_stamp("", &empty), 0, cleanup, "stamp of no metrics failed");
+   MCTF_ASSERT(empty != 0, cleanup, "stamp of no metrics is unknown");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_metrics_stamp(dir, &first), 0, cleanup, "stamp failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_metrics_stamp(dir, &second), 0, cleanup, "second stamp failed");
+   MCTF_ASSERT(first != 0, cleanup, "stamp is unknown");
+   MCTF_ASSERT(first == second, cleanup, "stamp of unchanged files differs");
+   MCTF_ASSERT(first != empty, cleanup, "stamp of the directory is the stamp of no metrics");
+
+   /* Same size, so only the content tells them apart within the same second */
+   f = fopen(path, "w");
+   MCTF_ASSERT_PTR_NONNULL(f, cleanup, "failed to rewrite metrics file");
+   fputs("metrics:\n  - tag: other\n", f);
+   fclose(f);
+
+   MCTF_ASSERT_INT_EQ(pgexporter_metrics_stamp(dir, &changed), 0, cleanup, "changed stamp failed");
+   MCTF_ASSERT(changed != first, cleanup, "stamp of changed files is the same");
+
+cleanup:
+   unlink(path);
+   rmdir(dir);
+   MCTF_FINISH();
+}
+
+MCTF_TEST(test_configuration_catalog)
+{
+   struct configuration* catalog = NULL;
+   struct configuration* parsed = NULL;
+   size_t size = sizeof(struct configuration);
+   int number_of_metrics = 0;
+   FILE* internal_yaml = NULL;
+   struct prometheus* a = NULL;
+   struct prometheus* b = NULL;
+   int na = 0;
+   int nb = 0;
+   struct pg_query_alts* qa[MAX_QUERIES];
+   struct pg_query_alts* qb[MAX_QUERIES];
+
+   pgexporter_test_config_save();
+
+   MCTF_ASSERT_INT_EQ(pgexporter_create_shared_memory(size, HUGEPAGE_OFF, (void**)&catalog), 0, cleanup, "shared memory failed");
+   pgexporter_init_configuration((void*)catalog);
+   MCTF_ASSERT_INT_EQ(pgexporter_create_shared_memory(size, HUGEPAGE_OFF, (void**)&parsed), 0, cleanup, "shared memory failed");
+   pgexporter_init_configuration((void*)parsed);
+
+   /* The compiled catalog gives the metrics of parsing INTERNAL_YAML */
+   MCTF_ASSERT_INT_EQ(pgexporter_read_internal_yaml_metrics(catalog, true), 0, cleanup, "catalog failed");
+
+   internal_yaml = fmemopen(INTERNAL_YAML, strlen(INTERNAL_YAML), "r");
+   MCTF_ASSERT_PTR_NONNULL(internal_yaml, cleanup, "fmemopen failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_read_yaml_from_file_pointer(parsed, 0, &number_of_metrics, internal_yaml), 0, cleanup, "INTERNAL_YAML failed");
+   parsed->number_of_metrics = number_of_metrics;
+
+   MCTF_ASSERT(catalog->number_of_metrics > 0, cleanup, "no metrics in the catalog");
+   MCTF_ASSERT_INT_EQ(catalog->number_of_metrics, parsed->number_of_metrics, cleanup, "number of metrics mismatch");
+   MCTF_ASSERT_INT_EQ(catalog->number_of_metric_names, parsed->number_of_metric_names, cleanup, "number of metric names mismatch");
+
+   for (int i = 0; i < catalog->number_of_metric_names; i++)
+   {
+      MCTF_ASSERT_STR_EQ(catalog->metric_names[i], parsed->metric_names[i], cleanup, "metric name %d mismatch", i);
+   }
+
+   for (int i = 0; i < catalog->number_of_metrics; i++)
+   {
+      a = &catalog->prometheus[i];
+      b = &parsed->prometheus[i];
+
+      MCTF_ASSERT_STR_EQ(a->tag, b->tag, cleanup, "tag %d mismatch", i);
+      MCTF_ASSERT_STR_EQ(a->collector, b->collector, cleanup, "collector of %s mismatch", b->tag);
+      MCTF_ASSERT(a->sort_type == b->sort_type && a->server_query_type == b->server_query_type &&
+                     a->exec_on_all_dbs == b->exec_on_all_dbs && a->optional == b->optional &&
+                     a->interval.ms == b->interval.ms,
+                  cleanup, "settings of %s mismatch", b->tag);
+
+      na = 0;
+      nb = 0;
+      collect_queries(a->pg_root, &qa[0], &na);
+      collect_queries(b->pg_root, &qb[0], &nb);
+
+      MCTF_ASSERT_INT_EQ(na, nb, cleanup, "number of queries of %s mismatch", b->tag);
+
+      for (int j = 0; j < na; j++)
+      {
+         MCTF_ASSERT(qa[j]->pg_version == qb[j]->pg_version && qa[j]->node.is_histogram == qb[j]->node.is_histogram &&
+                        qa[j]->node.n_columns == qb[j]->node.n_columns,
+                     cleanup, "query %d of %s mismatch", j, b->tag);
+         MCTF_ASSERT_STR_EQ(qa[j]->node.query, qb[j]->node.query, cleanup, "query %d of %s mismatch", j, b->tag);
+
+         for (int k = 0; k < qa[j]->node.n_columns; k++)
+         {
+            MCTF_ASSERT(qa[j]->node.columns[k].type == qb[j]->node.columns[k].type, cleanup, "column %d of %s mismatch", k, b->tag);
+            MCTF_ASSERT_STR_EQ(qa[j]->node.columns[k].name, qb[j]->node.columns[k].name, cleanup, "column %d of %s mismatch", k, b->tag);
+            MCTF_ASSERT_STR_EQ(qa[j]->node.columns[k].description, qb[j]->node.columns[k].description, cleanup, "column %d of %s mismatch", k, b->tag);
+         }
+      }
+   }
+
+cleanup:
+   if (internal_yaml != NULL)
+   {
+      fclose(internal_yaml);
+   }
+   free_metrics(catalog);
+   free_metrics(parsed);
+   pgexporter_test_config_restore();
+   MCTF_FINISH();
+}
+
+MCTF_TEST(test_configuration_metrics_yaml_cache)
+{
+   char dir[MAX_PATH];
+   char cache[MAX_PATH];
+   char path[MAX_PATH];
+   char cached[MAX_PATH];
+   int number_of_metric_names = 0;
+   int number_of_queries = 0;
+   struct pg_query_alts* queries[MAX_QUERIES];
+   ino_t first = 0;
+   ino_t second = 0;
+   struct configuration* config = NULL;
+   struct pg_query_alts* query = NULL;
+
+   memset(cache, 0, sizeof(cache));
+   memset(path, 0, sizeof(path));
+   memset(cached, 0, sizeof(cached));
+
+   pgexporter_test_config_save();
+
+   pgexporter_snprintf(dir, sizeof(dir), "/tmp/pgexporter-yaml-cache-XXXXXX");
+   MCTF_ASSERT_PTR_NONNULL(mkdtemp(dir), cleanup, "mkdtemp failed");
+   pgexporter_snprintf(cache, sizeof(cache), "%s/cache", dir);
+   MCTF_ASSERT_INT_EQ(mkdir(cache, 0700), 0, cleanup, "mkdir failed");
+   pgexporter_snprintf(path, sizeof(path), "%s/metrics.yaml", dir);
+
+   MCTF_ASSERT_INT_EQ(write_metrics(path, CACHED_METRICS("cached_a")), 0, cleanup, "failed to create metrics file");
+
+   /* The first load parses the file and writes the cache */
+   MCTF_ASSERT_INT_EQ(load_metrics(path, cache, &config), 0, cleanup, "load failed");
+   MCTF_ASSERT_INT_EQ(config->number_of_metrics, 1, cleanup, "number of metrics mismatch");
+   MCTF_ASSERT_INT_EQ(cache_file(cache, cached, &first), 0, cleanup, "no cache written");
+   number_of_metric_names = config->number_of_metric_names;
+   free_metrics(config);
+   config = NULL;
+
+   /* The second load reads the cache and leaves it as is */
+   MCTF_ASSERT_INT_EQ(load_metrics(path, cache, &config), 0, cleanup, "cached load failed");
+   MCTF_ASSERT_INT_EQ(config->number_of_metrics, 1, cleanup, "cached number of metrics mismatch");
+   MCTF_ASSERT_STR_EQ(config->prometheus[0].tag, "cached_a", cleanup, "cached tag mismatch");
+   MCTF_ASSERT_STR_EQ(config->prometheus[0].collector, "cached", cleanup, "cached collector mismatch");
+   MCTF_ASSERT_INT_EQ(config->prometheus[0].sort_type, SORT_DATA0, cleanup, "cached sort mismatch");
+   MCTF_ASSERT_INT_EQ(config->number_of_metric_names, number_of_metric_names, cleanup, "cached metric names mismatch");
+
+   number_of_queries = 0;
+   collect_queries(config->prometheus[0].pg_root, &queries[0], &number_of_queries);
+   MCTF_ASSERT_INT_EQ(number_of_queries, 2, cleanup, "cached queries mismatch");
+
+   query = queries[0];
+   MCTF_ASSERT_INT_EQ(query->pg_version, 10, cleanup, "cached version mismatch");
+   MCTF_ASSERT_STR_EQ(query->node.query, "SELECT name, value FROM cached_a;", cleanup, "cached query mismatch");
+   MCTF_ASSERT_INT_EQ(query->node.n_columns, 2, cleanup, "cached columns mismatch");
+
+   query = queries[1];
+   MCTF_ASSERT_INT_EQ(query->pg_version, 14, cleanup, "cached version mismatch");
+   MCTF_ASSERT_INT_EQ(query->node.n_columns, 3, cleanup, "cached columns mismatch");
+   MCTF_ASSERT_STR_EQ(query->node.columns[2].name, "other", cleanup, "cached column name mismatch");
+   MCTF_ASSERT_STR_EQ(query->node.columns[2].description, "Other", cleanup, "cached column description mismatch");
+   MCTF_ASSERT_INT_EQ(query->node.columns[2].type, COUNTER_TYPE, cleanup, "cached column type mismatch");
+   MCTF_ASSERT_STR_EQ(query->node.columns[0].description, "", cleanup, "cached empty description mismatch");
+
+   MCTF_ASSERT_INT_EQ(cache_file(cache, cached, &second), 0, cleanup, "cache removed");
+   MCTF_ASSERT(first == second, cleanup, "cache of an unchanged file written again");
+   free_metrics(config);
+   config = NULL;
+
+   /* A changed file is parsed again */
+   MCTF_ASSERT_INT_EQ(write_metrics(path, CACHED_METRICS("cached_b")), 0, cleanup, "failed to rewrite metrics file");
+   MCTF_ASSERT_INT_EQ(load_metrics(path, cache, &config), 0, cleanup, "changed load failed");
+   MCTF_ASSERT_STR_EQ(config->prometheus[0].tag, "cached_b", cleanup, "changed tag mismatch");
+   MCTF_ASSERT_INT_EQ(cache_file(cache, cached, &first), 0, cleanup, "cache removed");
+   MCTF_ASSERT(first != second, cleanup, "cache of a changed file not written");
+   free_metrics(config);
+   config = NULL;
+
+   /* A corrupt cache is ignored */
+   MCTF_ASSERT_INT_EQ(write_metrics(cached, "PGEC"), 0, cleanup, "failed to corrupt cache");
+   MCTF_ASSERT_INT_EQ(load_metrics(path, cache, &config), 0, cleanup, "load with a corrupt cache failed");
+   MCTF_ASSERT_STR_EQ(config->prometheus[0].tag, "cached_b", cleanup, "tag mismatch with a corrupt cache");
+   MCTF_ASSERT_INT_EQ(cache_file(cache, cached, &second), 0, cleanup, "cache removed");
+   MCTF_ASSERT(first != second, cleanup, "corrupt cache not written again");
+
+cleanup:
+   free_metrics(config);
+   if (strlen(cached) > 0)
+   {
+      unlink(cached);
+   }
+   rmdir(cache);
+   unlink(path);
+   rmdir(dir);
+   pgexporter_test_config_restore();
+   MCTF_FINISH();
+}
+
+static int
+load_metrics(char* metrics_path, char* cache, struct configuration** config)
+{
+   struct configuration* c = NULL;
+
+   if (pgexporter_create_shared_memory(sizeof(struct configuration), HUGEPAGE_OFF, (void**)&c))
+   {
+      return 1;
+   }
+   pgexporter_init_configuration((void*)c);
+
+   pgexporter_snprintf(c->metrics_path, MAX_PATH, "%s", metrics_path);
+   pgexporter_snprintf(c->metrics_yaml_cache, MAX_PATH, "%s", cache);
+
+   *config = c;
+
+   return pgexporter_read_metrics_configuration((void*)c);
+}
+
+static void
+free_metrics(struct configuration* config)
+{
+   if (config != NULL)
+   {
+      pgexporter_free_pg_query_alts(config);
+      pgexporter_destroy_shared_memory((void*)config, sizeof(struct configuration));
+   }
+}
+
+static int
+write_metrics(char* path, char* content)
+{
+   FILE* f = NULL;
+
+   f = fopen(path, "w");
+   if (f == NULL)
+   {
+      return 1;
+   }
+
+   fputs(content, f);
+
+   return fclose(f) ? 1 : 0;
+}
+
+static int
+cache_file(char* dir, char* path, ino_t* inode)
+{
+   DIR* d = NULL;
+   struct dirent* entry = NULL;
+   struct stat st;
+   int found = 0;
+
+   d = opendir(dir);
+   if (d == NULL)
+   {
+      return 1;
+   }
+
+   while ((entry = readdir(d)) != NULL)
+   {
+      if (pgexporter_ends_with(entry->d_name, ".cache"))
+      {
+         pgexporter_snprintf(path, MAX_PATH, "%s/%s", dir, entry->d_name);
+         found++;
+      }
+   }
+
+   closedir(d);
+
+   if (found != 1 || stat(path, &st))
+   {
+      return 1;
+   }
+
+   *inode = st.st_ino;
+
+   return 0;
+}
+
+static void
+collect_queries(struct pg_query_alts* root, struct pg_query_alts** queries, int* n)
+{
+   if (root == NULL || *n >= MAX_QUERIES)
+   {
+      return;
+   }
+
+   collect_queries(root->left, queries, n);
+   if (*n < MAX_QUERIES)
+   {
+      queries[(*n)++] = root;
+   }
+   collect_queries(root->right, queries, n);
+}
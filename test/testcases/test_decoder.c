@@ -0,0 +1,456 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pgexporter.h>
+#include <decoder.h>
+#include <memory.h>
+#include <queries.h>
+#include <utils.h>
+
+#include <mctf.h>
+#include <tscommon.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static size_t add_message(char* buffer, size_t offset, char kind, void* payload, size_t size);
+static size_t add_row_description(char* buffer, size_t offset, int n, char** names);
+static size_t add_data_row(char* buffer, size_t offset, int n, char** values);
+static size_t build_results(char* buffer);
+static int feed_in_chunks(struct decoder* decoder, char* buffer, size_t size, size_t chunk);
+static int count_rows(struct decoder* decoder, struct query_request* request, struct message* msg);
+
+MCTF_TEST_SETUP(decoder)
+{
+   pgexporter_memory_init();
+}
+
+MCTF_TEST_TEARDOWN(decoder)
+{
+   pgexporter_memory_destroy();
+}
+
+// Test decoding pipelined results for every way the bytes can be split
+MCTF_TEST(test_decoder_chunks)
+{
+   char buffer[1024];
+   size_t size;
+   size_t chunks[] = {1, 2, 3, 5, 7, 64, 1024};
+   char* names[] = {"first", "second"};
+   struct query_request requests[3];
+   struct decoder* decoder = NULL;
+
+   size = build_results(buffer);
+
+   for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++)
+   {
+      memset(&requests, 0, sizeof(requests));
+      requests[0].qs = "SELECT a, b FROM t;";
+      requests[0].tag = "t";
+      requests[0].columns = 2;
+      requests[0].names = names;
+      requests[1].qs = "SELECT pg_sleep(10);";
+      requests[1].tag = "sleep";
+      requests[1].columns = -1;
+      requests[2].qs = "SET work_mem = 1024;";
+      requests[2].tag = "set";
+      requests[2].columns = -1;
+
+      MCTF_ASSERT_INT_EQ(pgexporter_decoder_create(1, requests, 3, NULL, NULL, NULL, &decoder), 0, cleanup, "decoder_create failed");
+      MCTF_ASSERT_INT_EQ(feed_in_chunks(decoder, buffer, size, chunks[c]), 0, cleanup, "decoder_feed failed for chunk %zu", chunks[c]);
+      MCTF_ASSERT(pgexporter_decoder_done(decoder), cleanup, "decoder not done for chunk %zu", chunks[c]);
+
+      MCTF_ASSERT_INT_EQ(requests[0].error, 0, cleanup, "request 0 failed for chunk %zu", chunks[c]);
+      MCTF_ASSERT_PTR_NONNULL(requests[0].query, cleanup, "request 0 has no query");
+      MCTF_ASSERT_INT_EQ(requests[0].query->number_of_columns, 2, cleanup, "column count mismatch");
+      MCTF_ASSERT_STR_EQ(requests[0].query->names[1], "second", cleanup, "column name mismatch");
+      MCTF_ASSERT_INT_EQ(requests[0].query->type_oids[0], 25, cleanup, "type oid mismatch");
+      MCTF_ASSERT_PTR_NONNULL(requests[0].query->tuples, cleanup, "request 0 has no tuples");
+      MCTF_ASSERT_INT_EQ(requests[0].query->tuples->server, 1, cleanup, "tuple server mismatch");
+      MCTF_ASSERT_STR_EQ(pgexporter_get_column(0, requests[0].query->tuples), "a1", cleanup, "tuple 0 column 0 mismatch");
+      MCTF_ASSERT(pgexporter_get_column(1, requests[0].query->tuples) == NULL, cleanup, "tuple 0 column 1 should be NULL");
+      MCTF_ASSERT_PTR_NONNULL(requests[0].query->tuples->next, cleanup, "request 0 has no second tuple");
+      MCTF_ASSERT_STR_EQ(pgexporter_get_column(1, requests[0].query->tuples->next), "b2", cleanup, "tuple 1 column 1 mismatch");
+      MCTF_ASSERT(requests[0].query->tuples->next->next == NULL, cleanup, "request 0 has too many tuples");
+      MCTF_ASSERT_INT_EQ(pgexporter_get_column_length(0, requests[0].query->tuples), 2, cleanup, "tuple 0 column 0 length mismatch");
+      MCTF_ASSERT_INT_EQ(pgexporter_get_column_length(1, requests[0].query->tuples), -1, cleanup, "tuple 0 column 1 length mismatch");
+      MCTF_ASSERT_PTR_NONNULL(requests[0].query->arena, cleanup, "request 0 should own its tuples");
+      MCTF_ASSERT(!requests[0].timeout, cleanup, "request 0 should not time out");
+
+      MCTF_ASSERT_INT_EQ(requests[1].error, 1, cleanup, "request 1 should fail");
+      MCTF_ASSERT_PTR_NULL(requests[1].query, cleanup, "request 1 should have no query");
+      MCTF_ASSERT(requests[1].timeout, cleanup, "request 1 should time out");
+
+      MCTF_ASSERT_INT_EQ(requests[2].error, 1, cleanup, "request 2 without rows description should fail");
+      MCTF_ASSERT_PTR_NULL(requests[2].query, cleanup, "request 2 should have no query");
+
+      for (int i = 0; i < 3; i++)
+      {
+         MCTF_ASSERT(requests[i].duration >= 0, cleanup, "request %d should have a duration", i);
+      }
+
+      pgexporter_decoder_destroy(decoder);
+      decoder = NULL;
+
+      for (int i = 0; i < 3; i++)
+      {
+         pgexporter_free_query(requests[i].query);
+         requests[i].query = NULL;
+      }
+   }
+
+cleanup:
+   pgexporter_decoder_destroy(decoder);
+   for (int i = 0; i < 3; i++)
+   {
+      pgexporter_free_query(requests[i].query);
+   }
+   MCTF_FINISH();
+}
+
+// Test handing the rows to a callback
+MCTF_TEST(test_decoder_row_callback)
+{
+   char buffer[1024];
+   size_t size;
+   int rows = 0;
+   struct query_request request;
+   struct decoder* decoder = NULL;
+
+   memset(&request, 0, sizeof(request));
+   request.qs = "SELECT a, b FROM t;";
+   request.tag = "t";
+   request.columns = -1;
+
+   size = build_results(buffer);
+
+   MCTF_ASSERT_INT_EQ(pgexporter_decoder_create(0, &request, 1, count_rows, &rows, NULL, &decoder), 0, cleanup, "decoder_create failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_decoder_feed(decoder, buffer, size), 0, cleanup, "decoder_feed failed");
+   MCTF_ASSERT(pgexporter_decoder_done(decoder), cleanup, "decoder not done");
+   MCTF_ASSERT_INT_EQ(rows, 2, cleanup, "row count mismatch");
+   MCTF_ASSERT_INT_EQ(request.error, 0, cleanup, "request failed");
+   MCTF_ASSERT_PTR_NONNULL(request.query, cleanup, "request has no query");
+   MCTF_ASSERT_STR_EQ(request.query->names[0], "a", cleanup, "column name from description mismatch");
+   MCTF_ASSERT_PTR_NULL(request.query->tuples, cleanup, "callback should replace the tuples");
+
+cleanup:
+   pgexporter_decoder_destroy(decoder);
+   pgexporter_free_query(request.query);
+   MCTF_FINISH();
+}
+
+// Test decoding the tuples into an arena
+MCTF_TEST(test_decoder_arena)
+{
+   char buffer[1024];
+   size_t size;
+   char* large = NULL;
+   struct query_request request;
+   struct decoder* decoder = NULL;
+   struct memory_arena* arena = NULL;
+
+   memset(&request, 0, sizeof(request));
+   request.qs = "SELECT a, b FROM t;";
+   request.tag = "t";
+   request.columns = -1;
+
+   size = build_results(buffer);
+
+   MCTF_ASSERT_INT_EQ(pgexporter_memory_arena_create(1024, &arena), 0, cleanup, "arena_create failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_decoder_create(0, &request, 1, NULL, NULL, arena, &decoder), 0, cleanup, "decoder_create failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_decoder_feed(decoder, buffer, size), 0, cleanup, "decoder_feed failed");
+   MCTF_ASSERT(pgexporter_decoder_done(decoder), cleanup, "decoder not done");
+
+   MCTF_ASSERT_PTR_NONNULL(request.query, cleanup, "request has no query");
+   MCTF_ASSERT_PTR_NONNULL(request.query->tuples, cleanup, "request has no tuples");
+   MCTF_ASSERT_PTR_NULL(request.query->arena, cleanup, "tuples should be owned by the shared arena");
+   MCTF_ASSERT_STR_EQ(pgexporter_get_column(0, request.query->tuples), "a1", cleanup, "tuple 0 column 0 mismatch");
+   MCTF_ASSERT(pgexporter_get_column(1, request.query->tuples) == NULL, cleanup, "tuple 0 column 1 should be NULL");
+   MCTF_ASSERT_STR_EQ(pgexporter_get_column(1, request.query->tuples->next), "b2", cleanup, "tuple 1 column 1 mismatch");
+   MCTF_ASSERT_INT_EQ((int)arena->allocations, 2, cleanup, "one allocation per tuple expected");
+
+   large = pgexporter_memory_arena_alloc(arena, 4096);
+   MCTF_ASSERT_PTR_NONNULL(large, cleanup, "large allocation failed");
+   MCTF_ASSERT_INT_EQ(((uintptr_t)large) % alignof(max_align_t), 0, cleanup, "large allocation is not aligned");
+   MCTF_ASSERT_INT_EQ((int)arena->number_of_blocks, 2, cleanup, "large allocation should get its own block");
+   MCTF_ASSERT_STR_EQ(pgexporter_memory_arena_strdup(arena, "arena"), "arena", cleanup, "strdup mismatch");
+
+cleanup:
+   pgexporter_decoder_destroy(decoder);
+   pgexporter_free_query(request.query);
+   pgexporter_memory_arena_destroy(arena);
+   MCTF_FINISH();
+}
+
+// Test that merged queries keep the memory of their tuples
+MCTF_TEST(test_decoder_merge)
+{
+   char buffer[1024];
+   size_t size;
+   int count = 0;
+   struct query* merged = NULL;
+   struct tuple* tuple = NULL;
+   struct query_request requests[2];
+   struct decoder* decoder = NULL;
+
+   memset(&requests, 0, sizeof(requests));
+   size = build_results(buffer);
+
+   for (int i = 0; i < 2; i++)
+   {
+      requests[i].qs = "SELECT a, b FROM t;";
+      requests[i].tag = "t";
+      requests[i].columns = -1;
+
+      MCTF_ASSERT_INT_EQ(pgexporter_decoder_create(i, &requests[i], 1, NULL, NULL, NULL, &decoder), 0, cleanup, "decoder_create failed");
+      MCTF_ASSERT_INT_EQ(pgexporter_decoder_feed(decoder, buffer, size), 0, cleanup, "decoder_feed failed");
+      pgexporter_decoder_destroy(decoder);
+      decoder = NULL;
+   }
+
+   merged = pgexporter_merge_queries(requests[0].query, requests[1].query, SORT_NAME);
+   requests[0].query = NULL;
+   requests[1].query = NULL;
+
+   MCTF_ASSERT_PTR_NONNULL(merged, cleanup, "merge failed");
+   MCTF_ASSERT_PTR_NONNULL(merged->arena, cleanup, "merged query should own the tuples");
+
+   for (tuple = merged->tuples; tuple != NULL; tuple = tuple->next)
+   {
+      MCTF_ASSERT_INT_EQ(tuple->server, count / 2, cleanup, "tuple server mismatch");
+      MCTF_ASSERT_STR_EQ(pgexporter_get_column(0, tuple), count % 2 == 0 ? "a1" : "a2", cleanup, "tuple column 0 mismatch");
+      count++;
+   }
+
+   MCTF_ASSERT_INT_EQ(count, 4, cleanup, "merged tuple count mismatch");
+
+cleanup:
+   pgexporter_decoder_destroy(decoder);
+   pgexporter_free_query(merged);
+   for (int i = 0; i < 2; i++)
+   {
+      pgexporter_free_query(requests[i].query);
+   }
+   MCTF_FINISH();
+}
+
+// Test a result that ends before its ReadyForQuery and a bad length
+MCTF_TEST(test_decoder_incomplete)
+{
+   char buffer[1024];
+   struct query_request request;
+   struct decoder* decoder = NULL;
+
+   memset(&request, 0, sizeof(request));
+   request.qs = "SELECT a, b FROM t;";
+   request.tag = "t";
+   request.columns = -1;
+
+   build_results(buffer);
+
+   MCTF_ASSERT_INT_EQ(pgexporter_decoder_create(0, &request, 1, NULL, NULL, NULL, &decoder), 0, cleanup, "decoder_create failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_decoder_feed(decoder, buffer, 40), 0, cleanup, "decoder_feed failed");
+   MCTF_ASSERT(!pgexporter_decoder_done(decoder), cleanup, "decoder should not be done");
+   MCTF_ASSERT(request.duration == -1, cleanup, "incomplete result should have no duration");
+
+   pgexporter_decoder_destroy(decoder);
+   decoder = NULL;
+   MCTF_ASSERT_PTR_NULL(request.query, cleanup, "incomplete result should be discarded");
+   MCTF_ASSERT_INT_EQ(request.error, 1, cleanup, "incomplete result should fail");
+
+   memset(buffer, 0, sizeof(buffer));
+   buffer[0] = 'D';
+   pgexporter_write_int32(buffer + 1, 2);
+
+   MCTF_ASSERT_INT_EQ(pgexporter_decoder_create(0, &request, 1, NULL, NULL, NULL, &decoder), 0, cleanup, "decoder_create failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_decoder_feed(decoder, buffer, 5), 1, cleanup, "bad length should fail");
+
+cleanup:
+   pgexporter_decoder_destroy(decoder);
+   pgexporter_free_query(request.query);
+   MCTF_FINISH();
+}
+
+// Test a field length that runs past the end of its row
+MCTF_TEST(test_decoder_oversized)
+{
+   char buffer[1024];
+   char payload[16] = {0};
+   size_t size = 0;
+   char* columns[] = {"a"};
+   struct query_request request;
+   struct decoder* decoder = NULL;
+
+   memset(&request, 0, sizeof(request));
+   request.qs = "SELECT a FROM t;";
+   request.tag = "t";
+   request.columns = -1;
+
+   /* One field whose length wraps the offset of a 32-bit bounds check */
+   pgexporter_write_int16(payload, 1);
+   pgexporter_write_int32(payload + 2, INT32_MAX - 2);
+   memcpy(payload + 6, "abcd", 4);
+
+   size = add_row_description(buffer, size, 1, columns);
+   size = add_message(buffer, size, 'D', payload, 10);
+   size = add_message(buffer, size, 'C', "SELECT 1", 9);
+   size = add_message(buffer, size, 'Z', "I", 1);
+
+   MCTF_ASSERT_INT_EQ(pgexporter_decoder_create(0, &request, 1, NULL, NULL, NULL, &decoder), 0, cleanup, "decoder_create failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_decoder_feed(decoder, buffer, size), 0, cleanup, "decoder_feed failed");
+   MCTF_ASSERT(pgexporter_decoder_done(decoder), cleanup, "decoder should be done");
+   MCTF_ASSERT_INT_EQ(request.error, 1, cleanup, "oversized field length should fail the query");
+   MCTF_ASSERT_PTR_NULL(request.query, cleanup, "failed query should be discarded");
+
+cleanup:
+   pgexporter_decoder_destroy(decoder);
+   pgexporter_free_query(request.query);
+   MCTF_FINISH();
+}
+
+static size_t
+add_message(char* buffer, size_t offset, char kind, void* payload, size_t size)
+{
+   pgexporter_write_byte(buffer + offset, kind);
+   pgexporter_write_int32(buffer + offset + 1, 4 + size);
+   if (size > 0)
+   {
+      memcpy(buffer + offset + 5, payload, size);
+   }
+
+   return offset + 5 + size;
+}
+
+static size_t
+add_row_description(char* buffer, size_t offset, int n, char** names)
+{
+   char payload[256] = {0};
+   size_t size = 2;
+
+   pgexporter_write_int16(payload, n);
+
+   for (int i = 0; i < n; i++)
+   {
+      pgexporter_write_string(payload + size, names[i]);
+      size += strlen(names[i]) + 1;
+      pgexporter_write_int32(payload + size, 0);
+      pgexporter_write_int16(payload + size + 4, 0);
+      pgexporter_write_int32(payload + size + 6, 25);
+      pgexporter_write_int16(payload + size + 10, -1);
+      pgexporter_write_int32(payload + size + 12, -1);
+      pgexporter_write_int16(payload + size + 16, 0);
+      size += 18;
+   }
+
+   return add_message(buffer, offset, 'T', payload, size);
+}
+
+static size_t
+add_data_row(char* buffer, size_t offset, int n, char** values)
+{
+   char payload[256] = {0};
+   size_t size = 2;
+
+   pgexporter_write_int16(payload, n);
+
+   for (int i = 0; i < n; i++)
+   {
+      if (values[i] == NULL)
+      {
+         pgexporter_write_int32(payload + size, -1);
+         size += 4;
+      }
+      else
+      {
+         pgexporter_write_int32(payload + size, strlen(values[i]));
+         memcpy(payload + size + 4, values[i], strlen(values[i]));
+         size += 4 + strlen(values[i]);
+      }
+   }
+
+   return add_message(buffer, offset, 'D', payload, size);
+}
+
+static size_t
+build_results(char* buffer)
+{
+   size_t offset = 0;
+   char* columns[] = {"a", "b"};
+   char* row1[] = {"a1", NULL};
+   char* row2[] = {"a2", "b2"};
+   char error[] = "SERROR\0C57014\0Mcanceling statement due to statement timeout\0";
+
+   /* SELECT with two rows */
+   offset = add_row_description(buffer, offset, 2, columns);
+   offset = add_data_row(buffer, offset, 2, row1);
+   offset = add_data_row(buffer, offset, 2, row2);
+   offset = add_message(buffer, offset, 'C', "SELECT 2", 9);
+   offset = add_message(buffer, offset, 'Z', "I", 1);
+
+   /* Canceled query */
+   offset = add_message(buffer, offset, 'E', error, sizeof(error));
+   offset = add_message(buffer, offset, 'Z', "I", 1);
+
+   /* Command without rows */
+   offset = add_message(buffer, offset, 'C', "SET", 4);
+   offset = add_message(buffer, offset, 'Z', "I", 1);
+
+   return offset;
+}
+
+static int
+feed_in_chunks(struct decoder* decoder, char* buffer, size_t size, size_t chunk)
+{
+   for (size_t offset = 0; offset < size; offset += chunk)
+   {
+      size_t length = size - offset < chunk ? size - offset : chunk;
+
+      if (pgexporter_decoder_feed(decoder, buffer + offset, length))
+      {
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
+static int
+count_rows(struct decoder* decoder, struct query_request* request __attribute__((unused)), struct message* msg)
+{
+   int* rows = (int*)decoder->row_data;
+
+   if (msg->kind == 'D')
+   {
+      (*rows)++;
+   }
+
+   return 0;
+}
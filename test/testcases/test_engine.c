@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pgexporter.h>
+#include <engine.h>
+#include <memory.h>
+#include <queries.h>
+#include <security.h>
+#include <shmem.h>
+#include <utils.h>
+
+#include <mctf.h>
+#include <tsbackend.h>
+#include <tscommon.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define FAKE_SERVER_PORT 5432
+#define FAKE_BACKEND_PID 4242
+#define FAKE_BACKEND_KEY 77
+#define DEADLINE         500
+
+/** @struct fake_collection
+ * One batch of one query per server
+ */
+struct fake_collection
+{
+   bool sent[2];                     /**< Was the batch handed out */
+   struct query_request requests[2]; /**< The requests */
+   int status[2];                    /**< The status of the batches, -1 if not done */
+   int64_t done[2];                  /**< The time the batches were done in microseconds */
+};
+
+static bool fake_next_cb(int server, struct engine_batch* batch, void* data);
+static void fake_done_cb(int server, struct engine_batch* batch, int status, void* data);
+static void fake_servers(char* directory);
+static void fake_server_query(int listen_fd);
+static void fake_server_refuse(int listen_fd);
+
+MCTF_TEST_SETUP(engine)
+{
+   pgexporter_test_config_save();
+   pgexporter_memory_init();
+}
+
+MCTF_TEST_TEARDOWN(engine)
+{
+   pgexporter_memory_destroy();
+   pgexporter_test_config_restore();
+}
+
+// Test that a server which never answers the startup does not hold back another one
+MCTF_TEST(test_engine_connect_stalled)
+{
+   struct configuration* config = (struct configuration*)shmem;
+   char directory[] = "/tmp/pgexporter-engine-XXXXXX";
+   char stalled[] = "/tmp/pgexporter-engine-XXXXXX";
+   int listen_fd = -1;
+   int stalled_fd = -1;
+   int status = 0;
+   int64_t start;
+   pid_t pid = -1;
+   struct engine* engine = NULL;
+   struct fake_collection collection;
+
+   memset(&collection, 0, sizeof(collection));
+   collection.status[0] = -1;
+   collection.status[1] = -1;
+
+   MCTF_ASSERT(config->number_of_users > 0, cleanup, "No users configured");
+   MCTF_ASSERT_PTR_NONNULL(mkdtemp(&directory[0]), cleanup, "mkdtemp failed");
+   MCTF_ASSERT_PTR_NONNULL(mkdtemp(&stalled[0]), cleanup, "mkdtemp failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsbackend_listen(&directory[0], FAKE_SERVER_PORT, &listen_fd), 0, cleanup, "Fake server failed");
+
+   /* The kernel accepts the connection, but nothing ever answers it */
+   MCTF_ASSERT_INT_EQ(pgexporter_tsbackend_listen(&stalled[0], FAKE_SERVER_PORT, &stalled_fd), 0, cleanup, "Stalled server failed");
+
+   pid = fork();
+   MCTF_ASSERT(pid != -1, cleanup, "fork failed");
+   if (pid == 0)
+   {
+      fake_server_query(listen_fd);
+      _exit(0);
+   }
+
+   fake_servers(&directory[0]);
+   memcpy(&config->servers[1].host[0], &stalled[0], strlen(stalled) + 1);
+
+   MCTF_ASSERT_INT_EQ(pgexporter_engine_create(fake_next_cb, fake_done_cb, &collection, &engine), 0, cleanup, "Engine creation failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_engine_add(engine, 0), 0, cleanup, "Adding server 0 failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_engine_add(engine, 1), 0, cleanup, "Adding server 1 failed");
+
+   start = pgexporter_monotonic_micros();
+   pgexporter_engine_run(engine, DEADLINE);
+
+   MCTF_ASSERT_INT_EQ(collection.status[0], ENGINE_BATCH_OK, cleanup, "Server 0 should complete");
+   MCTF_ASSERT(collection.done[0] - start < DEADLINE * 1000, cleanup, "Server 0 waited for the stalled server");
+   MCTF_ASSERT_INT_EQ(collection.requests[0].error, 0, cleanup, "Server 0 query failed");
+   MCTF_ASSERT_PTR_NONNULL(collection.requests[0].query, cleanup, "Server 0 has no query");
+   MCTF_ASSERT_PTR_NONNULL(collection.requests[0].query->tuples, cleanup, "Server 0 has no tuples");
+   MCTF_ASSERT_STR_EQ(pgexporter_get_column(0, collection.requests[0].query->tuples), "1", cleanup, "Server 0 value mismatch");
+
+   /* The connection was handed over */
+   MCTF_ASSERT(config->servers[0].fd != -1, cleanup, "Server 0 should be connected");
+   MCTF_ASSERT_STR_EQ(config->servers[0].database, "postgres", cleanup, "Server 0 database mismatch");
+   MCTF_ASSERT_INT_EQ(config->servers[0].backend_pid, FAKE_BACKEND_PID, cleanup, "Server 0 backend pid mismatch");
+   MCTF_ASSERT_INT_EQ(config->servers[0].backend_key, FAKE_BACKEND_KEY, cleanup, "Server 0 backend key mismatch");
+
+   MCTF_ASSERT_INT_EQ(collection.status[1], ENGINE_BATCH_EXPIRED, cleanup, "Server 1 should expire");
+   MCTF_ASSERT(collection.requests[1].timeout, cleanup, "Server 1 request should time out");
+   MCTF_ASSERT_INT_EQ(config->servers[1].fd, -1, cleanup, "Server 1 should not be connected");
+
+cleanup:
+   pgexporter_engine_destroy(engine);
+   pgexporter_close_connection(0);
+   pgexporter_close_connection(1);
+   if (pid > 0)
+   {
+      waitpid(pid, &status, 0);
+   }
+   for (int i = 0; i < 2; i++)
+   {
+      pgexporter_free_query(collection.requests[i].query);
+   }
+   if (listen_fd != -1)
+   {
+      close(listen_fd);
+   }
+   if (stalled_fd != -1)
+   {
+      close(stalled_fd);
+   }
+   pgexporter_tsbackend_remove(&directory[0], FAKE_SERVER_PORT);
+   pgexporter_tsbackend_remove(&stalled[0], FAKE_SERVER_PORT);
+   rmdir(&directory[0]);
+   rmdir(&stalled[0]);
+   MCTF_FINISH();
+}
+
+// Test that a refused password fails the batch without a connection
+MCTF_TEST(test_engine_connect_refused)
+{
+   struct configuration* config = (struct configuration*)shmem;
+   char directory[] = "/tmp/pgexporter-engine-XXXXXX";
+   int listen_fd = -1;
+   int status = 0;
+   pid_t pid = -1;
+   struct engine* engine = NULL;
+   struct fake_collection collection;
+
+   memset(&collection, 0, sizeof(collection));
+   collection.status[0] = -1;
+   collection.status[1] = -1;
+
+   MCTF_ASSERT(config->number_of_users > 0, cleanup, "No users configured");
+   MCTF_ASSERT_PTR_NONNULL(mkdtemp(&directory[0]), cleanup, "mkdtemp failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsbackend_listen(&directory[0], FAKE_SERVER_PORT, &listen_fd), 0, cleanup, "Fake server failed");
+
+   pid = fork();
+   MCTF_ASSERT(pid != -1, cleanup, "fork failed");
+   if (pid == 0)
+   {
+      fake_server_refuse(listen_fd);
+      _exit(0);
+   }
+
+   fake_servers(&directory[0]);
+
+   MCTF_ASSERT_INT_EQ(pgexporter_engine_create(fake_next_cb, fake_done_cb, &collection, &engine), 0, cleanup, "Engine creation failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_engine_add(engine, 0), 0, cleanup, "Adding server 0 failed");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_engine_run(engine, DEADLINE), 0, cleanup, "Engine did not complete");
+
+   MCTF_ASSERT_INT_EQ(collection.status[0], ENGINE_BATCH_NO_CONNECTION, cleanup, "Server 0 should have no connection");
+   MCTF_ASSERT_INT_EQ(collection.requests[0].error, 1, cleanup, "Server 0 request should fail");
+   MCTF_ASSERT(!collection.requests[0].timeout, cleanup, "Server 0 request should not time out");
+   MCTF_ASSERT_INT_EQ(config->servers[0].fd, -1, cleanup, "Server 0 should not be connected");
+
+cleanup:
+   pgexporter_engine_destroy(engine);
+   pgexporter_close_connection(0);
+   if (pid > 0)
+   {
+      waitpid(pid, &status, 0);
+   }
+   pgexporter_free_query(collection.requests[0].query);
+   if (listen_fd != -1)
+   {
+      close(listen_fd);
+   }
+   pgexporter_tsbackend_remove(&directory[0], FAKE_SERVER_PORT);
+   rmdir(&directory[0]);
+   MCTF_FINISH();
+}
+
+static bool
+fake_next_cb(int server, struct engine_batch* batch, void* data)
+{
+   struct fake_collection* collection = (struct fake_collection*)data;
+
+   if (collection->sent[server])
+   {
+      return false;
+   }
+
+   collection->sent[server] = true;
+
+   collection->requests[server].qs = "SELECT 1 AS value;";
+   collection->requests[server].tag = "value";
+   collection->requests[server].columns = -1;
+
+   batch->database = "postgres";
+   batch->requests = &collection->requests[server];
+   batch->n = 1;
+   batch->arena = NULL;
+
+   return true;
+}
+
+static void
+fake_done_cb(int server, struct engine_batch* batch __attribute__((unused)), int status, void* data)
+{
+   struct fake_collection* collection = (struct fake_collection*)data;
+
+   collection->status[server] = status;
+   collection->done[server] = pgexporter_monotonic_micros();
+}
+
+static void
+fake_servers(char* directory)
+{
+   struct configuration* config = (struct configuration*)shmem;
+
+   for (int i = 0; i < 2; i++)
+   {
+      memset(&config->servers[i].host[0], 0, sizeof(config->servers[i].host));
+      memcpy(&config->servers[i].host[0], directory, strlen(directory));
+      memset(&config->servers[i].username[0], 0, sizeof(config->servers[i].username));
+      memcpy(&config->servers[i].username[0], &config->users[0].username[0], strlen(config->users[0].username));
+      memset(&config->servers[i].database[0], 0, sizeof(config->servers[i].database));
+      config->servers[i].port = FAKE_SERVER_PORT;
+      config->servers[i].tls_mode = SERVER_TLS_OFF;
+      config->servers[i].fd = -1;
+      config->servers[i].ssl = NULL;
+   }
+}
+
+/* Trust the user and answer one query */
+static void
+fake_server_query(int listen_fd)
+{
+   char buffer[1024];
+   char payload[64];
+   int fd;
+
+   fd = accept(listen_fd, NULL, NULL);
+   if (fd == -1)
+   {
+      return;
+   }
+
+   if (pgexporter_tsbackend_read_startup(fd, &buffer[0], sizeof(buffer)) <= 0)
+   {
+      goto done;
+   }
+
+   /* AuthenticationOk, BackendKeyData and ReadyForQuery */
+   memset(&payload[0], 0, sizeof(payload));
+   pgexporter_write_int32(&payload[0], 0);
+   pgexporter_tsbackend_write(fd, 'R', &payload[0], 4);
+
+   pgexporter_write_int32(&payload[0], FAKE_BACKEND_PID);
+   pgexporter_write_int32(&payload[4], FAKE_BACKEND_KEY);
+   pgexporter_tsbackend_write(fd, 'K', &payload[0], 8);
+
+   pgexporter_tsbackend_write(fd, 'Z', "I", 1);
+
+   if (pgexporter_tsbackend_read(fd, &buffer[0], sizeof(buffer)) <= 0 || buffer[0] != 'Q')
+   {
+      goto done;
+   }
+
+   /* RowDescription of one text column */
+   memset(&payload[0], 0, sizeof(payload));
+   pgexporter_write_int16(&payload[0], 1);
+   pgexporter_write_string(&payload[2], "value");
+   pgexporter_write_int32(&payload[2 + 6 + 6], 25);
+   pgexporter_write_int16(&payload[2 + 6 + 10], -1);
+   pgexporter_write_int32(&payload[2 + 6 + 12], -1);
+   pgexporter_tsbackend_write(fd, 'T', &payload[0], 2 + 6 + 18);
+
+   memset(&payload[0], 0, sizeof(payload));
+   pgexporter_write_int16(&payload[0], 1);
+   pgexporter_write_int32(&payload[2], 1);
+   payload[6] = '1';
+   pgexporter_tsbackend_write(fd, 'D', &payload[0], 7);
+
+   pgexporter_tsbackend_write(fd, 'C', "SELECT 1", 9);
+   pgexporter_tsbackend_write(fd, 'Z', "I", 1);
+
+   /* Until the client terminates */
+   while (pgexporter_tsbackend_read(fd, &buffer[0], sizeof(buffer)) > 0 && buffer[0] != 'X')
+   {
+   }
+
+done:
+   close(fd);
+}
+
+/* Ask for a clear text password and refuse it */
+static void
+fake_server_refuse(int listen_fd)
+{
+   char buffer[1024];
+   char payload[128];
+   int length;
+   int fd;
+
+   fd = accept(listen_fd, NULL, NULL);
+   if (fd == -1)
+   {
+      return;
+   }
+
+   if (pgexporter_tsbackend_read_startup(fd, &buffer[0], sizeof(buffer)) <= 0)
+   {
+      goto done;
+   }
+
+   memset(&payload[0], 0, sizeof(payload));
+   pgexporter_write_int32(&payload[0], 3);
+   if (pgexporter_tsbackend_write(fd, 'R', &payload[0], 4))
+   {
+      goto done;
+   }
+
+   if (pgexporter_tsbackend_read(fd, &buffer[0], sizeof(buffer)) <= 0 || buffer[0] != 'p')
+   {
+      goto done;
+   }
+
+   memset(&payload[0], 0, sizeof(payload));
+   length = 0;
+   length += pgexporter_snprintf(&payload[length], sizeof(payload) - length, "SFATAL") + 1;
+   length += pgexporter_snprintf(&payload[length], sizeof(payload) - length, "C28P01") + 1;
+   length += pgexporter_snprintf(&payload[length], sizeof(payload) - length, "Mpassword authentication failed") + 1;
+   length++;
+   pgexporter_tsbackend_write(fd, 'E', &payload[0], length);
+
+done:
+   close(fd);
+}
@@ -0,0 +1,858 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pgexporter.h>
+#include <configuration.h>
+#include <utils.h>
+
+#include <mctf.h>
+#include <tscommon.h>
+#include <tsmock.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define ALL_DATABASES_METRICS                     \
+   "metrics:\n"                                 \
+   "- tag: mock_a\n"                            \
+   "  collector: mock\n"                        \
+   "  database: all\n"                          \
+   "  queries:\n"                               \
+   "  - query: SELECT name, value FROM a;\n"    \
+   "    version: 10\n"                          \
+   "    columns:\n"                             \
+   "    - name: name\n"                         \
+   "      type: label\n"                        \
+   "    - description: A\n"                     \
+   "      type: gauge\n"                        \
+   "- tag: mock_b\n"                            \
+   "  collector: mock\n"                        \
+   "  database: all\n"                          \
+   "  queries:\n"                               \
+   "  - query: SELECT name, value FROM b;\n"    \
+   "    version: 10\n"                          \
+   "    columns:\n"                             \
+   "    - name: name\n"                         \
+   "      type: label\n"                        \
+   "    - description: B\n"                     \
+   "      type: gauge\n"                        \
+   "- tag: mock_c\n"                            \
+   "  collector: mock\n"                        \
+   "  database: all\n"                          \
+   "  queries:\n"                               \
+   "  - query: SELECT name, value FROM c;\n"    \
+   "    version: 10\n"                          \
+   "    columns:\n"                             \
+   "    - name: name\n"                         \
+   "      type: label\n"                        \
+   "    - description: C\n"                     \
+   "      type: gauge\n"
+
+#define INTERVAL_METRICS                             \
+   "metrics:\n"                                    \
+   "- tag: mock_slow\n"                            \
+   "  collector: mock\n"                           \
+   "  interval: 1h\n"                              \
+   "  queries:\n"                                  \
+   "  - query: SELECT name, value FROM slow;\n"    \
+   "    version: 10\n"                             \
+   "    columns:\n"                                \
+   "    - name: name\n"                            \
+   "      type: label\n"                           \
+   "    - description: Slow\n"                     \
+   "      type: gauge\n"
+
+#define PLAN_METRICS(NEW)                               \
+   "metrics:\n"                                       \
+   "- tag: mock_plan\n"                               \
+   "  collector: mock\n"                              \
+   "  queries:\n"                                     \
+   "  - query: SELECT name, old FROM t;\n"            \
+   "    version: 10\n"                                \
+   "    columns:\n"                                   \
+   "    - name: name\n"                               \
+   "      type: label\n"                              \
+   "    - name: old\n"                                \
+   "      description: Old\n"                         \
+   "      type: gauge\n"                              \
+   "  - query: SELECT name, " NEW " FROM t;\n"        \
+   "    version: 16\n"                                \
+   "    columns:\n"                                   \
+   "    - name: name\n"                               \
+   "      type: label\n"                              \
+   "    - name: " NEW "\n"                            \
+   "      description: New\n"                         \
+   "      type: gauge\n"
+
+#define SLOW_QUERIES "pgexporter_query_duration_seconds_count{server=\"s0\", tag=\"mock_slow\"}"
+
+static bool child_pid(struct tsmock* mock, char* prefix, int previous, int* pid);
+
+MCTF_TEST_SETUP(scrape)
+{
+   pgexporter_test_config_save();
+}
+
+MCTF_TEST_TEARDOWN(scrape)
+{
+   pgexporter_test_config_restore();
+}
+
+// Test that the servers are collected on several threads and all of them report
+MCTF_TEST_MAX(test_scrape_query_workers, 60)
+{
+   int status = 0;
+   int64_t workers = 0;
+   double value = 0.0;
+   char series[MISC_LENGTH];
+   char* body = NULL;
+   struct tsmock* mock = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_create(4, "-l 20", &mock), 0, cleanup, "Mock servers failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_start(mock, "metrics_query_workers = 4", NULL), 0, cleanup, "pgexporter failed");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape failed");
+   MCTF_ASSERT_INT_EQ(status, 200, cleanup, "Scrape status %d", status);
+
+   for (int i = 0; i < 4; i++)
+   {
+      snprintf(&series[0], sizeof(series), "pgexporter_postgresql_active{server=\"s%d\"}", i);
+      MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, &series[0], &value), 0, cleanup, "No %s", &series[0]);
+      MCTF_ASSERT(value == 1.0, cleanup, "%s is %f", &series[0], value);
+   }
+
+   MCTF_ASSERT(pgexporter_tsmock_log_count(mock, "Collecting 4 servers using 4 workers") > 0, cleanup,
+               "The servers were not collected on 4 workers");
+
+   /* conf set clamps the workers the same way as the configuration file */
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_conf_set(mock, CONFIGURATION_ARGUMENT_METRICS_QUERY_WORKERS, "0", &workers), 0, cleanup, "conf set failed");
+   MCTF_ASSERT_INT_EQ((int)workers, 1, cleanup, "metrics_query_workers=0 applied as %d", (int)workers);
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_conf_set(mock, CONFIGURATION_ARGUMENT_METRICS_QUERY_WORKERS, "100000", &workers), 0, cleanup, "conf set failed");
+   MCTF_ASSERT_INT_EQ((int)workers, NUMBER_OF_SERVERS, cleanup, "metrics_query_workers=100000 applied as %d", (int)workers);
+
+cleanup:
+   free(body);
+   pgexporter_tsmock_destroy(mock);
+   MCTF_FINISH();
+}
+
+// Test that a server without the pg_monitor role is skipped while the others are collected
+MCTF_TEST_MAX(test_scrape_pg_monitor_skip, 60)
+{
+   int status = 0;
+   double value = 0.0;
+   char* body = NULL;
+   struct tsmock* mock = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_create(2, "-m 1", &mock), 0, cleanup, "Mock servers failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_start(mock, "metrics_query_workers = 2", NULL), 0, cleanup, "pgexporter failed");
+
+   for (int i = 0; i < 2; i++)
+   {
+      free(body);
+      body = NULL;
+
+      MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape %d failed", i);
+      MCTF_ASSERT_INT_EQ(status, 200, cleanup, "Scrape %d status %d", i, status);
+
+      MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, "pgexporter_postgresql_active{server=\"s0\"}", &value), 0, cleanup, "No s0");
+      MCTF_ASSERT(value == 1.0, cleanup, "s0 is not active");
+      MCTF_ASSERT(pgexporter_tsmock_value(body, "pgexporter_postgresql_uptime{server=\"s1\"}", &value) != 0, cleanup,
+                  "s1 was collected");
+   }
+
+   MCTF_ASSERT(pgexporter_tsmock_log_count(mock, "Server 's1': pg_monitor role check failed") > 0, cleanup,
+               "The failed check was not logged");
+
+cleanup:
+   free(body);
+   pgexporter_tsmock_destroy(mock);
+   MCTF_FINISH();
+}
+
+// Test that the scrapes are served out of the snapshot of the collector, across a reload
+MCTF_TEST_MAX(test_scrape_snapshot, 60)
+{
+   int status = 0;
+   int collectors = 0;
+   double value = 0.0;
+   char* body = NULL;
+   struct tsmock* mock = NULL;
+   struct tsmock_counters before;
+   struct tsmock_counters after;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_create(2, NULL, &mock), 0, cleanup, "Mock servers failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_start(mock, "metrics_collector_interval = 60s", NULL), 0, cleanup, "pgexporter failed");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape failed");
+   MCTF_ASSERT_INT_EQ(status, 200, cleanup, "Scrape status %d", status);
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, "pgexporter_postgresql_active{server=\"s1\"}", &value), 0, cleanup, "No s1");
+
+   /* The later scrapes read the snapshot and do not query the servers */
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_counters(mock, &before), 0, cleanup, "Counters failed");
+   for (int i = 0; i < 3; i++)
+   {
+      free(body);
+      body = NULL;
+
+      MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape %d failed", i);
+      MCTF_ASSERT_INT_EQ(status, 200, cleanup, "Scrape %d status %d", i, status);
+      MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, "pgexporter_postgresql_active{server=\"s0\"}", &value), 0, cleanup, "No s0");
+   }
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_counters(mock, &after), 0, cleanup, "Counters failed");
+   MCTF_ASSERT(after.queries == before.queries, cleanup, "%lu queries during the snapshot scrapes", after.queries - before.queries);
+
+   /* A reload replaces the collector once the old one has exited */
+   collectors = pgexporter_tsmock_log_count(mock, "Collector: ");
+   kill(mock->exporter, SIGHUP);
+   for (int i = 0; i < 100 && pgexporter_tsmock_log_count(mock, "Collector: ") == collectors; i++)
+   {
+      usleep(50000);
+   }
+   MCTF_ASSERT(pgexporter_tsmock_log_count(mock, "Collector: ") > collectors, cleanup, "No collector after the reload");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_log_count(mock, "stopped, restarting"), 0, cleanup, "The reload was taken as a failure");
+
+   free(body);
+   body = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape after the reload failed");
+   MCTF_ASSERT_INT_EQ(status, 200, cleanup, "Scrape status %d after the reload", status);
+
+cleanup:
+   free(body);
+   pgexporter_tsmock_destroy(mock);
+   MCTF_FINISH();
+}
+
+// Test that a scrape waiting for the first snapshot gives up at its timeout
+MCTF_TEST_MAX(test_scrape_snapshot_timeout, 60)
+{
+   int status = 0;
+   int64_t start;
+   char* body = NULL;
+   struct tsmock* mock = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_create(1, "-l 2000", &mock), 0, cleanup, "Mock servers failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_start(mock, "metrics_collector_interval = 60s\nmetrics_scrape_timeout = 1s", NULL), 0, cleanup,
+                      "pgexporter failed");
+
+   /* The startup checks the servers with the same delay */
+   MCTF_ASSERT(pgexporter_tsmock_log_wait(mock, "Collector: ", 40000), cleanup, "No collector");
+
+   start = pgexporter_tsmock_milliseconds();
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape failed");
+   MCTF_ASSERT_INT_EQ(status, 503, cleanup, "Scrape status %d", status);
+   MCTF_ASSERT(pgexporter_tsmock_milliseconds() - start < 4000, cleanup, "The scrape waited %lld ms",
+               (long long)(pgexporter_tsmock_milliseconds() - start));
+
+cleanup:
+   free(body);
+   pgexporter_tsmock_destroy(mock);
+   MCTF_FINISH();
+}
+
+// Test that a collector which keeps failing is restarted after an increasing delay
+MCTF_TEST_MAX(test_scrape_collector_restart, 60)
+{
+   int pid = 0;
+   struct tsmock* mock = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_create(1, NULL, &mock), 0, cleanup, "Mock servers failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_start(mock, "metrics_collector_interval = 60s", NULL), 0, cleanup, "pgexporter failed");
+
+   for (int attempt = 1; attempt <= 2; attempt++)
+   {
+      MCTF_ASSERT(child_pid(mock, "Collector: ", pid, &pid), cleanup, "No collector (attempt %d)", attempt);
+
+      kill(pid, SIGKILL);
+
+      MCTF_ASSERT(pgexporter_tsmock_log_wait(mock, attempt == 1 ? "restarting in 2 seconds" : "restarting in 4 seconds", 5000), cleanup,
+                  "No delayed restart (attempt %d)", attempt);
+   }
+
+   MCTF_ASSERT(child_pid(mock, "Collector: ", pid, &pid), cleanup, "The collector was not restarted");
+
+cleanup:
+   pgexporter_tsmock_destroy(mock);
+   MCTF_FINISH();
+}
+
+static bool
+child_pid(struct tsmock* mock, char* prefix, int previous, int* pid)
+{
+   char* rest = NULL;
+
+   for (int i = 0; i < 200; i++)
+   {
+      if (!pgexporter_tsmock_log_last(mock, prefix, &rest))
+      {
+         *pid = atoi(rest);
+         free(rest);
+         rest = NULL;
+
+         if (*pid > 0 && *pid != previous)
+         {
+            return true;
+         }
+      }
+      usleep(50000);
+   }
+
+   return false;
+}
+
+// Test that the collector keeps its server connections open from one collection to the next
+MCTF_TEST_MAX(test_scrape_connection_pool, 60)
+{
+   int status = 0;
+   char* body = NULL;
+   struct tsmock* mock = NULL;
+   struct tsmock_counters before;
+   struct tsmock_counters after;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_create(2, NULL, &mock), 0, cleanup, "Mock servers failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_start(mock, "metrics_collector_interval = 500ms", NULL), 0, cleanup, "pgexporter failed");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape failed");
+   MCTF_ASSERT_INT_EQ(status, 200, cleanup, "Scrape status %d", status);
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_counters(mock, &before), 0, cleanup, "Counters failed");
+   usleep(2500000);
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_counters(mock, &after), 0, cleanup, "Counters failed");
+
+   MCTF_ASSERT(after.queries > before.queries, cleanup, "No collection in 2.5 seconds");
+   MCTF_ASSERT(after.connections == before.connections, cleanup, "%lu new connections over %lu queries",
+               after.connections - before.connections, after.queries - before.queries);
+
+cleanup:
+   free(body);
+   pgexporter_tsmock_destroy(mock);
+   MCTF_FINISH();
+}
+
+// Test that the metrics of every database connect once per database
+MCTF_TEST_MAX(test_scrape_all_databases, 60)
+{
+   int status = 0;
+   double value = 0.0;
+   char series[MISC_LENGTH];
+   char* body = NULL;
+   struct tsmock* mock = NULL;
+   struct tsmock_counters before;
+   struct tsmock_counters after;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_create(1, "-d 3 -r 2", &mock), 0, cleanup, "Mock servers failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_start(mock, NULL, ALL_DATABASES_METRICS), 0, cleanup, "pgexporter failed");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_counters(mock, &before), 0, cleanup, "Counters failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape failed");
+   MCTF_ASSERT_INT_EQ(status, 200, cleanup, "Scrape status %d", status);
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_counters(mock, &after), 0, cleanup, "Counters failed");
+
+   for (int i = 1; i <= 3; i++)
+   {
+      snprintf(&series[0], sizeof(series), "pgexporter_mock_c{server=\"s0\", name=\"0\", database=\"db%d\"}", i);
+      MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, &series[0], &value), 0, cleanup, "No %s", &series[0]);
+   }
+
+   /* The first connection, then one per database whatever the number of metrics */
+   MCTF_ASSERT(after.connections - before.connections <= 5, cleanup, "%lu connections for one scrape",
+               after.connections - before.connections);
+
+cleanup:
+   free(body);
+   pgexporter_tsmock_destroy(mock);
+   MCTF_FINISH();
+}
+
+// Test that the queries of a server are sent without waiting for the previous results
+MCTF_TEST_MAX(test_scrape_pipelined, 60)
+{
+   int status = 0;
+   char* body = NULL;
+   struct tsmock* mock = NULL;
+   struct tsmock_counters before;
+   struct tsmock_counters after;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_create(1, NULL, &mock), 0, cleanup, "Mock servers failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_start(mock, NULL, NULL), 0, cleanup, "pgexporter failed");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_counters(mock, &before), 0, cleanup, "Counters failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape failed");
+   MCTF_ASSERT_INT_EQ(status, 200, cleanup, "Scrape status %d", status);
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_counters(mock, &after), 0, cleanup, "Counters failed");
+
+   MCTF_ASSERT(after.pipelined > before.pipelined, cleanup, "None of %lu queries was pipelined", after.queries - before.queries);
+
+cleanup:
+   free(body);
+   pgexporter_tsmock_destroy(mock);
+   MCTF_FINISH();
+}
+
+// Test that the results of a metric with an interval are reused by the collector, and only by it
+MCTF_TEST_MAX(test_scrape_metric_interval, 60)
+{
+   int status = 0;
+   double first = 0.0;
+   double second = 0.0;
+   char* body = NULL;
+   struct tsmock* mock = NULL;
+
+   /* Every scrape collects, the interval is ignored */
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_create(1, NULL, &mock), 0, cleanup, "Mock servers failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_start(mock, NULL, INTERVAL_METRICS), 0, cleanup, "pgexporter failed");
+
+   MCTF_ASSERT(pgexporter_tsmock_log_wait(mock, "Metric mock_slow: interval is ignored", 5000), cleanup, "No warning");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, SLOW_QUERIES, &first), 0, cleanup, "No query count");
+   free(body);
+   body = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, SLOW_QUERIES, &second), 0, cleanup, "No query count");
+   free(body);
+   body = NULL;
+
+   MCTF_ASSERT(second > first, cleanup, "The query did not run again (%f, %f)", first, second);
+
+   pgexporter_tsmock_stop(mock);
+
+   /* The collector runs the query once for the interval */
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_start(mock, "metrics_collector_interval = 500ms", INTERVAL_METRICS), 0, cleanup, "pgexporter failed");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, SLOW_QUERIES, &first), 0, cleanup, "No query count");
+   free(body);
+   body = NULL;
+
+   usleep(2000000);
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, SLOW_QUERIES, &second), 0, cleanup, "No query count");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, "pgexporter_mock_slow{server=\"s0\", name=\"0\", database=\"postgres\"}", &first), 0, cleanup,
+                      "The cached results are missing");
+
+   MCTF_ASSERT(second == 1.0, cleanup, "The query ran %f times", second);
+
+cleanup:
+   free(body);
+   pgexporter_tsmock_destroy(mock);
+   MCTF_FINISH();
+}
+
+// Test that a scrape waiting for another process to refresh the cache gives up with an error page
+MCTF_TEST_MAX(test_scrape_cache_refresh_wait, 90)
+{
+   int status = 0;
+   int64_t start;
+   pid_t pid = -1;
+   char* body = NULL;
+   struct tsmock* mock = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_create(1, "-l 2000", &mock), 0, cleanup, "Mock servers failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_start(mock, "metrics_cache_max_age = 60s\nblocking_timeout = 1s", NULL), 0, cleanup,
+                      "pgexporter failed");
+
+   /* The startup checks the servers with the same delay */
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/", NULL, &status, &body), 0, cleanup, "Home page failed");
+   free(body);
+   body = NULL;
+
+   /* The first scrape refreshes the cache slowly */
+   pid = fork();
+   MCTF_ASSERT(pid >= 0, cleanup, "fork failed");
+   if (pid == 0)
+   {
+      pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body);
+      _exit(0);
+   }
+
+   usleep(500000);
+
+   start = pgexporter_tsmock_milliseconds();
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape failed");
+   MCTF_ASSERT_INT_EQ(status, 503, cleanup, "Scrape status %d", status);
+   MCTF_ASSERT(pgexporter_tsmock_milliseconds() - start < 4000, cleanup, "The scrape waited %lld ms",
+               (long long)(pgexporter_tsmock_milliseconds() - start));
+
+cleanup:
+   if (pid > 0)
+   {
+      kill(pid, SIGKILL);
+      waitpid(pid, NULL, 0);
+   }
+   free(body);
+   pgexporter_tsmock_destroy(mock);
+   MCTF_FINISH();
+}
+
+// Test that a kept alive connection is closed after the first of two requests sent in one write
+MCTF_TEST_MAX(test_scrape_http_pipelined, 60)
+{
+   bool closed = false;
+   char* response = NULL;
+   char* request = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+   char* requests = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\nGET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+   struct tsmock* mock = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_create(1, NULL, &mock), 0, cleanup, "Mock servers failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_start(mock, "http_keep_alive_timeout = 10s", NULL), 0, cleanup, "pgexporter failed");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_exchange(mock, request, 1000, &response, &closed), 0, cleanup, "Exchange failed");
+   MCTF_ASSERT_PTR_NONNULL(response, cleanup, "No response");
+   MCTF_ASSERT(!closed, cleanup, "The connection was not kept alive");
+   MCTF_ASSERT(strstr(response, "Connection: keep-alive") != NULL, cleanup, "No keep-alive header");
+   free(response);
+   response = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_exchange(mock, requests, 5000, &response, &closed), 0, cleanup, "Exchange failed");
+   MCTF_ASSERT_PTR_NONNULL(response, cleanup, "No response");
+   MCTF_ASSERT(closed, cleanup, "The connection was kept alive");
+   MCTF_ASSERT(strstr(response, "Connection: close") != NULL, cleanup, "No close header");
+   MCTF_ASSERT(strstr(response, "HTTP/1.1 200") != NULL, cleanup, "No response to the first request");
+   MCTF_ASSERT(strstr(strstr(response, "HTTP/1.1 200") + 1, "HTTP/1.1") == NULL, cleanup, "The second request got a response");
+
+cleanup:
+   free(response);
+   pgexporter_tsmock_destroy(mock);
+   MCTF_FINISH();
+}
+
+// Test that the HTTP workers serve the scrapes, retire after their requests and follow conf set
+MCTF_TEST_MAX(test_scrape_http_workers, 60)
+{
+   int status = 0;
+   int64_t result = 0;
+   char* body = NULL;
+   struct tsmock* mock = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_create(1, NULL, &mock), 0, cleanup, "Mock servers failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_start(mock, "http_workers = 2\nhttp_worker_max_requests = 2", NULL), 0, cleanup,
+                      "pgexporter failed");
+
+   MCTF_ASSERT(pgexporter_tsmock_log_wait(mock, "HTTP worker started", 5000), cleanup, "No HTTP worker");
+
+   for (int i = 0; i < 6; i++)
+   {
+      MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape %d failed", i);
+      MCTF_ASSERT_INT_EQ(status, 200, cleanup, "Scrape %d status %d", i, status);
+      free(body);
+      body = NULL;
+   }
+
+   MCTF_ASSERT(pgexporter_tsmock_log_wait(mock, "retired, replacing", 5000), cleanup, "No HTTP worker retired");
+   MCTF_ASSERT(pgexporter_tsmock_log_count(mock, "HTTP worker started") >= 3, cleanup, "No HTTP worker replaced");
+
+   /* A new pool size is applied right away */
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_conf_set(mock, "http_workers", "4", &result), 0, cleanup, "conf set failed");
+   MCTF_ASSERT_INT_EQ(result, 4, cleanup, "conf set gave %lld", (long long)result);
+   MCTF_ASSERT(pgexporter_tsmock_log_wait(mock, "HTTP workers: 2 -> 4", 5000), cleanup, "The pool did not grow");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_conf_set(mock, "http_workers", "0", &result), 0, cleanup, "conf set failed");
+   MCTF_ASSERT(pgexporter_tsmock_log_wait(mock, "HTTP workers: 4 -> 0", 5000), cleanup, "The pool was not stopped");
+
+   /* Back to a process for every connection */
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape failed");
+   MCTF_ASSERT_INT_EQ(status, 200, cleanup, "Scrape status %d", status);
+
+cleanup:
+   free(body);
+   pgexporter_tsmock_destroy(mock);
+   MCTF_FINISH();
+}
+
+// Test that a failing HTTP worker is restarted with a growing delay
+MCTF_TEST_MAX(test_scrape_http_worker_restart, 60)
+{
+   int pid = 0;
+   struct tsmock* mock = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_create(1, NULL, &mock), 0, cleanup, "Mock servers failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_start(mock, "http_workers = 1", NULL), 0, cleanup, "pgexporter failed");
+
+   for (int attempt = 1; attempt <= 2; attempt++)
+   {
+      MCTF_ASSERT(child_pid(mock, "HTTP worker: ", pid, &pid), cleanup, "No HTTP worker (attempt %d)", attempt);
+
+      kill(pid, SIGKILL);
+
+      MCTF_ASSERT(pgexporter_tsmock_log_wait(mock, attempt == 1 ? "restarting in 2 seconds" : "restarting in 4 seconds", 5000), cleanup,
+                  "No delayed restart (attempt %d)", attempt);
+   }
+
+   MCTF_ASSERT(child_pid(mock, "HTTP worker: ", pid, &pid), cleanup, "The HTTP worker was not restarted");
+
+cleanup:
+   pgexporter_tsmock_destroy(mock);
+   MCTF_FINISH();
+}
+
+// Test that a TLS session resumes in another process, and no longer once its key is rotated out
+MCTF_TEST_MAX(test_scrape_tls_tickets, 60)
+{
+   bool reused = false;
+   char options[MAX_PATH * 3];
+   SSL_SESSION* session = NULL;
+   SSL_SESSION* next = NULL;
+   struct tsmock* mock = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_create(1, NULL, &mock), 0, cleanup, "Mock servers failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_certificate(mock), 0, cleanup, "No certificate");
+
+   snprintf(options, sizeof(options), "metrics_cert_file = %s/server.crt\nmetrics_key_file = %s/server.key",
+            mock->directory, mock->directory);
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_start(mock, options, NULL), 0, cleanup, "pgexporter failed");
+
+   /* Every connection is served by a process of its own */
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_tls_request(mock, NULL, &session, &reused), 0, cleanup, "TLS request failed");
+   MCTF_ASSERT(!reused, cleanup, "A new session was resumed");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_tls_request(mock, session, &next, &reused), 0, cleanup, "TLS request failed");
+   MCTF_ASSERT(reused, cleanup, "The session did not resume in another process");
+   SSL_SESSION_free(next);
+   next = NULL;
+
+   /* The previous key still decrypts */
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_reload(mock), 0, cleanup, "Reload failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_tls_request(mock, session, &next, &reused), 0, cleanup, "TLS request failed");
+   MCTF_ASSERT(reused, cleanup, "The session did not resume after one rotation");
+   SSL_SESSION_free(next);
+   next = NULL;
+
+   /* Rotated out */
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_reload(mock), 0, cleanup, "Reload failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_tls_request(mock, session, &next, &reused), 0, cleanup, "TLS request failed");
+   MCTF_ASSERT(!reused, cleanup, "The session resumed after two rotations");
+
+cleanup:
+   SSL_SESSION_free(next);
+   SSL_SESSION_free(session);
+   pgexporter_tsmock_destroy(mock);
+   MCTF_FINISH();
+}
+
+// Test that the query engine connects to the servers at the same time
+MCTF_TEST_MAX(test_scrape_engine_connect, 60)
+{
+   int status = 0;
+   int64_t start = 0;
+   int64_t elapsed = 0;
+   double value = 0.0;
+   char series[MISC_LENGTH];
+   char* body = NULL;
+   struct tsmock* mock = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_create(4, "-l 250", &mock), 0, cleanup, "Mock servers failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_start(mock, "metrics_query_async = on", INTERVAL_METRICS), 0, cleanup, "pgexporter failed");
+
+   /* Waits until the startup checks are done */
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/", NULL, &status, &body), 0, cleanup, "Scrape failed");
+   free(body);
+   body = NULL;
+
+   start = pgexporter_tsmock_milliseconds();
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape failed");
+   elapsed = pgexporter_tsmock_milliseconds() - start;
+   MCTF_ASSERT_INT_EQ(status, 200, cleanup, "Scrape status %d", status);
+
+   for (int i = 0; i < 4; i++)
+   {
+      snprintf(&series[0], sizeof(series), "pgexporter_postgresql_active{server=\"s%d\"}", i);
+      MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, &series[0], &value), 0, cleanup, "No %s", &series[0]);
+      MCTF_ASSERT(value == 1.0, cleanup, "%s is %f", &series[0], value);
+   }
+
+   MCTF_ASSERT(pgexporter_tsmock_log_count(mock, "Collecting 4 servers using the query engine") > 0, cleanup,
+               "The servers were not collected by the query engine");
+
+   /* The four queries that inspect a new connection take 1s a server, one after the other they take 4s */
+   MCTF_ASSERT(elapsed < 3500, cleanup, "The scrape took %lld ms", (long long)elapsed);
+
+cleanup:
+   free(body);
+   pgexporter_tsmock_destroy(mock);
+   MCTF_FINISH();
+}
+
+// Test that the queries still running at the deadline are canceled and the scrape is marked partial
+MCTF_TEST_MAX(test_scrape_deadline_cancel, 60)
+{
+   int status = 0;
+   int64_t start = 0;
+   int64_t elapsed = 0;
+   double value = 0.0;
+   char* body = NULL;
+   struct tsmock* mock = NULL;
+   struct tsmock_counters before;
+   struct tsmock_counters after;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_create(1, "-l 1000", &mock), 0, cleanup, "Mock servers failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_start(mock, "metrics_query_async = on\nmetrics_scrape_timeout = 10s", NULL), 0, cleanup,
+                      "pgexporter failed");
+
+   /* Waits until the startup checks are done */
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/", NULL, &status, &body), 0, cleanup, "Scrape failed");
+   free(body);
+   body = NULL;
+
+   /* The header lowers the budget to 1.5s, every query takes 1s */
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_counters(mock, &before), 0, cleanup, "Counters failed");
+   start = pgexporter_tsmock_milliseconds();
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", "X-Prometheus-Scrape-Timeout-Seconds: 2\r\n", &status, &body), 0, cleanup,
+                      "Scrape failed");
+   elapsed = pgexporter_tsmock_milliseconds() - start;
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_counters(mock, &after), 0, cleanup, "Counters failed");
+
+   MCTF_ASSERT_INT_EQ(status, 200, cleanup, "Scrape status %d", status);
+   MCTF_ASSERT(elapsed < 3000, cleanup, "The scrape took %lld ms", (long long)elapsed);
+   MCTF_ASSERT(after.cancels > before.cancels, cleanup, "The running query was not canceled");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, "pgexporter_scrape_partial", &value), 0, cleanup, "No pgexporter_scrape_partial");
+   MCTF_ASSERT(value == 1.0, cleanup, "pgexporter_scrape_partial is %f", value);
+
+cleanup:
+   free(body);
+   pgexporter_tsmock_destroy(mock);
+   MCTF_FINISH();
+}
+
+// Test that the exported latency histograms are cumulative and every phase of a scrape is counted
+MCTF_TEST_MAX(test_scrape_latency_histograms, 60)
+{
+   int status = 0;
+   double value = 0.0;
+   double previous = 0.0;
+   double count = 0.0;
+   double sum = 0.0;
+   char* phases[] = {"connect", "auth", "query", "format", "send"};
+   char series[MISC_LENGTH];
+   char* body = NULL;
+   struct tsmock* mock = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_create(1, "-l 30", &mock), 0, cleanup, "Mock servers failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_start(mock, NULL, INTERVAL_METRICS), 0, cleanup, "pgexporter failed");
+
+   /* The second scrape reports the first one, sent included */
+   for (int i = 0; i < 2; i++)
+   {
+      free(body);
+      body = NULL;
+
+      MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape %d failed", i);
+      MCTF_ASSERT_INT_EQ(status, 200, cleanup, "Scrape %d status %d", i, status);
+   }
+
+   /* Every query takes at least 30ms, so the buckets below it are empty */
+   for (int i = 0; i < NUMBER_OF_LATENCY_BUCKETS; i++)
+   {
+      snprintf(&series[0], sizeof(series), "pgexporter_query_duration_seconds_bucket{le=\"%g\", server=\"s0\", tag=\"mock_slow\"}",
+               pgexporter_latency_bucket(i) / 1000000.0);
+      MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, &series[0], &value), 0, cleanup, "No %s", &series[0]);
+      MCTF_ASSERT(value >= previous, cleanup, "%s is below the previous bucket", &series[0]);
+      MCTF_ASSERT(pgexporter_latency_bucket(i) >= 30000 || value == 0.0, cleanup, "%s is %f", &series[0], value);
+
+      previous = value;
+   }
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, "pgexporter_query_duration_seconds_bucket{le=\"+Inf\", server=\"s0\", tag=\"mock_slow\"}", &value),
+                      0, cleanup, "No +Inf bucket");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, "pgexporter_query_duration_seconds_count{server=\"s0\", tag=\"mock_slow\"}", &count),
+                      0, cleanup, "No count");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, "pgexporter_query_duration_seconds_sum{server=\"s0\", tag=\"mock_slow\"}", &sum),
+                      0, cleanup, "No sum");
+
+   MCTF_ASSERT(value >= previous && value == count, cleanup, "+Inf is %f, the count is %f", value, count);
+   MCTF_ASSERT(count >= 1.0, cleanup, "The query was not counted");
+   MCTF_ASSERT(sum >= 0.03 * count, cleanup, "The sum is %f for %f queries", sum, count);
+
+   for (int i = 0; i < (int)(sizeof(phases) / sizeof(phases[0])); i++)
+   {
+      snprintf(&series[0], sizeof(series), "pgexporter_scrape_phase_seconds_count{phase=\"%s\"}", phases[i]);
+      MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, &series[0], &value), 0, cleanup, "No %s", &series[0]);
+      MCTF_ASSERT(value >= 1.0, cleanup, "%s is %f", &series[0], value);
+   }
+
+cleanup:
+   free(body);
+   pgexporter_tsmock_destroy(mock);
+   MCTF_FINISH();
+}
+
+// Test that every server runs the query for its own version and the plans are made again after a reload
+MCTF_TEST_MAX(test_scrape_query_plans, 60)
+{
+   int status = 0;
+   double value = 0.0;
+   char* body = NULL;
+   struct tsmock* mock = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_create(2, "-v 17.0,13.4", &mock), 0, cleanup, "Mock servers failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_start(mock, NULL, PLAN_METRICS("new")), 0, cleanup, "pgexporter failed");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape failed");
+   MCTF_ASSERT_INT_EQ(status, 200, cleanup, "Status %d", status);
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, "pgexporter_mock_plan_new{server=\"s0\", name=\"0\", database=\"postgres\"}", &value), 0, cleanup,
+                      "No version 16 query on s0");
+   MCTF_ASSERT(pgexporter_tsmock_value(body, "pgexporter_mock_plan_old{server=\"s0\", name=\"0\", database=\"postgres\"}", &value) != 0, cleanup,
+               "The version 10 query ran on s0");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, "pgexporter_mock_plan_old{server=\"s1\", name=\"0\", database=\"postgres\"}", &value), 0, cleanup,
+                      "No version 10 query on s1");
+   MCTF_ASSERT(pgexporter_tsmock_value(body, "pgexporter_mock_plan_new{server=\"s1\", name=\"0\", database=\"postgres\"}", &value) != 0, cleanup,
+               "The version 16 query ran on s1");
+
+   /* The reload replaces the query the plan of s0 points to */
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_write_file(mock, "metrics.yaml", PLAN_METRICS("newer")), 0, cleanup, "Write failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_reload(mock), 0, cleanup, "Reload failed");
+
+   free(body);
+   body = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_scrape(mock, "/metrics", NULL, &status, &body), 0, cleanup, "Scrape after the reload failed");
+   MCTF_ASSERT_INT_EQ(status, 200, cleanup, "Status %d after the reload", status);
+
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, "pgexporter_mock_plan_newer{server=\"s0\", name=\"0\", database=\"postgres\"}", &value), 0, cleanup,
+                      "s0 was not planned again");
+   MCTF_ASSERT(pgexporter_tsmock_value(body, "pgexporter_mock_plan_new{server=\"s0\", name=\"0\", database=\"postgres\"}", &value) != 0, cleanup,
+               "s0 kept its old plan");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsmock_value(body, "pgexporter_mock_plan_old{server=\"s1\", name=\"0\", database=\"postgres\"}", &value), 0, cleanup,
+                      "No version 10 query on s1 after the reload");
+
+cleanup:
+   free(body);
+   pgexporter_tsmock_destroy(mock);
+   MCTF_FINISH();
+}
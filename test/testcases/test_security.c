@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pgexporter.h>
+#include <memory.h>
+#include <network.h>
+#include <security.h>
+#include <shmem.h>
+#include <utils.h>
+
+#include <mctf.h>
+#include <tsbackend.h>
+#include <tscommon.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
+
+/* The SCRAM-SHA-256 example of RFC 7677 */
+#define RFC_USER        "user"
+#define RFC_PASSWORD    "pencil"
+#define RFC_SALT        "W22ZaJ0SNY7soEsUEjb6gQ=="
+#define RFC_ITERATIONS  4096
+#define RFC_CLIENT      "n=user,r=rOprNGfwEbeRWgbNEkqO"
+#define RFC_SERVER      "r=rOprNGfwEbeRWgbNEkqO%hvYDpWUa2RaTCAfuxFIlj)hNlF$k0,s=W22ZaJ0SNY7soEsUEjb6gQ==,i=4096"
+#define RFC_WO_PROOF    "c=biws,r=rOprNGfwEbeRWgbNEkqO%hvYDpWUa2RaTCAfuxFIlj)hNlF$k0"
+#define RFC_PROOF       "dHzbZapWIk4jUhN+Ute9ytag9zjfMHgsqmmiz7AndVQ="
+
+#define FAKE_SERVER_PORT 5432
+
+static int rfc_proof(unsigned char* client_key, char** proof);
+static bool has_scram_keys(char* username);
+static void fake_server_reject(int listen_fd, char* salt);
+
+MCTF_TEST_SETUP(security)
+{
+   pgexporter_test_config_save();
+   pgexporter_memory_init();
+   pgexporter_clear_scram_keys();
+}
+
+MCTF_TEST_TEARDOWN(security)
+{
+   pgexporter_clear_scram_keys();
+   pgexporter_memory_destroy();
+   pgexporter_test_config_restore();
+}
+
+MCTF_TEST(test_security_scram_keys_cached)
+{
+   char* salt = NULL;
+   size_t salt_length = 0;
+   unsigned char derived_client_key[SCRAM_KEY_LENGTH];
+   unsigned char derived_server_key[SCRAM_KEY_LENGTH];
+   unsigned char cached_client_key[SCRAM_KEY_LENGTH];
+   unsigned char cached_server_key[SCRAM_KEY_LENGTH];
+   char* derived_proof = NULL;
+   char* cached_proof = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_base64_decode(RFC_SALT, strlen(RFC_SALT), (void**)&salt, &salt_length), 0, cleanup, "Salt decode failed");
+
+   MCTF_ASSERT(!has_scram_keys(RFC_USER), cleanup, "The cache should start empty");
+   MCTF_ASSERT_INT_EQ(pgexporter_scram_keys(RFC_USER, RFC_PASSWORD, salt, (int)salt_length, RFC_ITERATIONS,
+                                            &derived_client_key[0], &derived_server_key[0]),
+                      0, cleanup, "Derivation failed");
+   MCTF_ASSERT(has_scram_keys(RFC_USER), cleanup, "The derived keys should be cached");
+
+   /* A cache hit ignores the password, so a wrong one shows the keys came from the cache */
+   MCTF_ASSERT_INT_EQ(pgexporter_scram_keys(RFC_USER, "wrong", salt, (int)salt_length, RFC_ITERATIONS,
+                                            &cached_client_key[0], &cached_server_key[0]),
+                      0, cleanup, "Cache lookup failed");
+
+   MCTF_ASSERT(!memcmp(&derived_client_key[0], &cached_client_key[0], SCRAM_KEY_LENGTH), cleanup, "ClientKey mismatch");
+   MCTF_ASSERT(!memcmp(&derived_server_key[0], &cached_server_key[0], SCRAM_KEY_LENGTH), cleanup, "ServerKey mismatch");
+
+   MCTF_ASSERT_INT_EQ(rfc_proof(&derived_client_key[0], &derived_proof), 0, cleanup, "Proof of the derived keys failed");
+   MCTF_ASSERT_INT_EQ(rfc_proof(&cached_client_key[0], &cached_proof), 0, cleanup, "Proof of the cached keys failed");
+
+   MCTF_ASSERT_STR_EQ(derived_proof, RFC_PROOF, cleanup, "Derived proof mismatch");
+   MCTF_ASSERT_STR_EQ(cached_proof, derived_proof, cleanup, "Cached proof mismatch");
+
+   /* Another iteration count is another derivation */
+   MCTF_ASSERT_INT_EQ(pgexporter_scram_keys(RFC_USER, "wrong", salt, (int)salt_length, RFC_ITERATIONS + 1,
+                                            &cached_client_key[0], &cached_server_key[0]),
+                      0, cleanup, "Derivation failed");
+   MCTF_ASSERT(memcmp(&derived_client_key[0], &cached_client_key[0], SCRAM_KEY_LENGTH), cleanup, "The keys should not be shared");
+
+cleanup:
+   free(salt);
+   free(derived_proof);
+   free(cached_proof);
+   MCTF_FINISH();
+}
+
+MCTF_TEST(test_security_scram_keys_evicted)
+{
+   struct configuration* config = (struct configuration*)shmem;
+   char directory[] = "/tmp/pgexporter-security-XXXXXX";
+   char* salt = NULL;
+   size_t salt_length = 0;
+   unsigned char client_key[SCRAM_KEY_LENGTH];
+   unsigned char server_key[SCRAM_KEY_LENGTH];
+   int listen_fd = -1;
+   int fd = -1;
+   int status = 0;
+   pid_t pid = -1;
+   SSL* ssl = NULL;
+
+   MCTF_ASSERT_PTR_NONNULL(mkdtemp(&directory[0]), cleanup, "mkdtemp failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_tsbackend_listen(&directory[0], FAKE_SERVER_PORT, &listen_fd), 0, cleanup, "Fake server failed");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_base64_decode(RFC_SALT, strlen(RFC_SALT), (void**)&salt, &salt_length), 0, cleanup, "Salt decode failed");
+   MCTF_ASSERT_INT_EQ(pgexporter_scram_keys(RFC_USER, RFC_PASSWORD, salt, (int)salt_length, RFC_ITERATIONS,
+                                            &client_key[0], &server_key[0]),
+                      0, cleanup, "Derivation failed");
+   MCTF_ASSERT(has_scram_keys(RFC_USER), cleanup, "The derived keys should be cached");
+
+   pid = fork();
+   MCTF_ASSERT(pid != -1, cleanup, "fork failed");
+   if (pid == 0)
+   {
+      fake_server_reject(listen_fd, RFC_SALT);
+      _exit(0);
+   }
+
+   memset(&config->servers[0].host[0], 0, sizeof(config->servers[0].host));
+   memcpy(&config->servers[0].host[0], &directory[0], strlen(directory));
+   config->servers[0].port = FAKE_SERVER_PORT;
+   config->servers[0].tls_mode = SERVER_TLS_OFF;
+
+   /* The server rejects the proof of the cached keys */
+   MCTF_ASSERT(pgexporter_server_authenticate(0, "postgres", RFC_USER, RFC_PASSWORD, &ssl, &fd) != AUTH_SUCCESS,
+               cleanup, "The authentication should fail");
+   MCTF_ASSERT(!has_scram_keys(RFC_USER), cleanup, "The rejected keys should be evicted");
+
+cleanup:
+   if (pid > 0)
+   {
+      waitpid(pid, &status, 0);
+   }
+   if (fd != -1)
+   {
+      pgexporter_disconnect(fd);
+   }
+   if (listen_fd != -1)
+   {
+      close(listen_fd);
+   }
+   pgexporter_tsbackend_remove(&directory[0], FAKE_SERVER_PORT);
+   rmdir(&directory[0]);
+   free(salt);
+   MCTF_FINISH();
+}
+
+static int
+rfc_proof(unsigned char* client_key, char** proof)
+{
+   char auth_message[256];
+   unsigned char stored_key[SHA256_DIGEST_LENGTH];
+   unsigned char signature[SHA256_DIGEST_LENGTH];
+   unsigned char raw[SCRAM_KEY_LENGTH];
+   unsigned int length = 0;
+   size_t proof_length = 0;
+
+   /* ClientProof = ClientKey XOR HMAC(SHA256(ClientKey), AuthMessage) */
+   pgexporter_snprintf(&auth_message[0], sizeof(auth_message), "%s,%s,%s", RFC_CLIENT, RFC_SERVER, RFC_WO_PROOF);
+
+   SHA256(client_key, SCRAM_KEY_LENGTH, &stored_key[0]);
+   if (HMAC(EVP_sha256(), &stored_key[0], sizeof(stored_key),
+            (unsigned char*)&auth_message[0], strlen(auth_message), &signature[0], &length) == NULL)
+   {
+      return 1;
+   }
+
+   for (int i = 0; i < SCRAM_KEY_LENGTH; i++)
+   {
+      raw[i] = client_key[i] ^ signature[i];
+   }
+
+   return pgexporter_base64_encode(&raw[0], sizeof(raw), proof, &proof_length);
+}
+
+static bool
+has_scram_keys(char* username)
+{
+   struct configuration* config = (struct configuration*)shmem;
+
+   for (int i = 0; i < NUMBER_OF_SCRAM_KEYS; i++)
+   {
+      if (config->scram_keys[i].salt_length > 0 && !strcmp(config->scram_keys[i].username, username))
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+/* Offer SCRAM-SHA-256 and reject whatever proof the client sends */
+static void
+fake_server_reject(int listen_fd, char* salt)
+{
+   char buffer[1024];
+   char payload[256];
+   char* nounce = NULL;
+   int length;
+   int fd;
+
+   fd = accept(listen_fd, NULL, NULL);
+   if (fd == -1)
+   {
+      return;
+   }
+
+   if (pgexporter_tsbackend_read_startup(fd, &buffer[0], sizeof(buffer)) <= 0)
+   {
+      goto done;
+   }
+
+   /* AuthenticationSASL */
+   memset(&payload[0], 0, sizeof(payload));
+   pgexporter_write_int32(&payload[0], 10);
+   pgexporter_write_string(&payload[4], "SCRAM-SHA-256");
+   if (pgexporter_tsbackend_write(fd, 'R', &payload[0], 4 + 14 + 1))
+   {
+      goto done;
+   }
+
+   /* SASLInitialResponse, n,,n=,r=... */
+   length = pgexporter_tsbackend_read(fd, &buffer[0], sizeof(buffer) - 1);
+   if (length <= 26)
+   {
+      goto done;
+   }
+   buffer[length] = '\0';
+   nounce = strstr(&buffer[26], "r=");
+   if (nounce == NULL)
+   {
+      goto done;
+   }
+
+   /* AuthenticationSASLContinue */
+   memset(&payload[0], 0, sizeof(payload));
+   pgexporter_write_int32(&payload[0], 11);
+   length = pgexporter_snprintf(&payload[4], sizeof(payload) - 4, "%sfake,s=%s,i=%d", nounce, salt, RFC_ITERATIONS);
+   if (pgexporter_tsbackend_write(fd, 'R', &payload[0], 4 + length))
+   {
+      goto done;
+   }
+
+   /* SASLResponse */
+   if (pgexporter_tsbackend_read(fd, &buffer[0], sizeof(buffer)) <= 0)
+   {
+      goto done;
+   }
+
+   /* ErrorResponse */
+   memset(&payload[0], 0, sizeof(payload));
+   length = 0;
+   length += pgexporter_snprintf(&payload[length], sizeof(payload) - length, "SFATAL") + 1;
+   length += pgexporter_snprintf(&payload[length], sizeof(payload) - length, "C28P01") + 1;
+   length += pgexporter_snprintf(&payload[length], sizeof(payload) - length, "Mpassword authentication failed") + 1;
+   length++;
+   pgexporter_tsbackend_write(fd, 'E', &payload[0], length);
+
+done:
+   close(fd);
+}
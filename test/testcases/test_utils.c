@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2026 The pgexporter community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pgexporter.h>
+#include <configuration.h>
+#include <utils.h>
+
+#include <mctf.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUMBER_OF_SERIES 2000
+
+// Test appending strings, chars and integers
+MCTF_TEST(test_string_builder_append)
+{
+   struct string_builder* sb = NULL;
+   char* result = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_string_builder_create(4, &sb), 0, cleanup, "string_builder_create failed");
+   MCTF_ASSERT_STR_EQ(sb->buffer, "", cleanup, "new builder should be empty");
+
+   pgexporter_string_builder_append(sb, "pgexporter_");
+   pgexporter_string_builder_append(sb, NULL);
+   pgexporter_string_builder_append_length(sb, "state_up", 5);
+   pgexporter_string_builder_append_char(sb, ' ');
+   pgexporter_string_builder_append_int(sb, -42);
+   pgexporter_string_builder_append_char(sb, ' ');
+   pgexporter_string_builder_append_int(sb, INT64_MAX);
+
+   MCTF_ASSERT_STR_EQ(sb->buffer, "pgexporter_state -42 9223372036854775807", cleanup, "content mismatch");
+   MCTF_ASSERT_INT_EQ((int)sb->length, (int)strlen(sb->buffer), cleanup, "length mismatch");
+   MCTF_ASSERT(sb->capacity > sb->length, cleanup, "capacity should leave room for the terminator");
+
+   result = pgexporter_string_builder_copy(sb);
+   MCTF_ASSERT_STR_EQ(result, sb->buffer, cleanup, "copy mismatch");
+   free(result);
+   result = NULL;
+
+   pgexporter_string_builder_reset(sb);
+   MCTF_ASSERT_INT_EQ((int)sb->length, 0, cleanup, "reset should empty the builder");
+   MCTF_ASSERT_PTR_NULL(pgexporter_string_builder_copy(sb), cleanup, "copy of an empty builder should be NULL");
+
+   pgexporter_string_builder_append(sb, "done");
+   result = pgexporter_string_builder_release(sb);
+   sb = NULL;
+   MCTF_ASSERT_STR_EQ(result, "done", cleanup, "release mismatch");
+
+cleanup:
+   free(result);
+   pgexporter_string_builder_destroy(sb);
+   MCTF_FINISH();
+}
+
+// Test escaping label values
+MCTF_TEST(test_string_builder_escaped)
+{
+   struct string_builder* sb = NULL;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_string_builder_create(0, &sb), 0, cleanup, "string_builder_create failed");
+
+   pgexporter_string_builder_append_escaped(sb, "plain");
+   MCTF_ASSERT_STR_EQ(sb->buffer, "plain", cleanup, "plain value should not change");
+
+   pgexporter_string_builder_reset(sb);
+   pgexporter_string_builder_append_escaped(sb, "a\"b\\c\nd\"");
+   MCTF_ASSERT_STR_EQ(sb->buffer, "a\\\"b\\\\c\\nd\\\"", cleanup, "escaped value mismatch");
+
+cleanup:
+   pgexporter_string_builder_destroy(sb);
+   MCTF_FINISH();
+}
+
+// Test that an exposition matches the one built with pgexporter_append
+MCTF_TEST(test_string_builder_series)
+{
+   struct string_builder* sb = NULL;
+   char* expected = NULL;
+   char line[128];
+
+   MCTF_ASSERT_INT_EQ(pgexporter_string_builder_create(0, &sb), 0, cleanup, "string_builder_create failed");
+
+   for (int i = 0; i < NUMBER_OF_SERIES; i++)
+   {
+      pgexporter_snprintf(line, sizeof(line), "pgexporter_series{server=\"primary\", id=\"%d\"} %d\n", i, i);
+      expected = pgexporter_append(expected, line);
+
+      pgexporter_string_builder_append(sb, "pgexporter_series{server=\"");
+      pgexporter_string_builder_append_escaped(sb, "primary");
+      pgexporter_string_builder_append(sb, "\", id=\"");
+      pgexporter_string_builder_append_int(sb, i);
+      pgexporter_string_builder_append(sb, "\"} ");
+      pgexporter_string_builder_append_int(sb, i);
+      pgexporter_string_builder_append_char(sb, '\n');
+   }
+
+   MCTF_ASSERT_INT_EQ((int)sb->length, (int)strlen(expected), cleanup, "length mismatch");
+   MCTF_ASSERT_STR_EQ(sb->buffer, expected, cleanup, "content mismatch");
+
+cleanup:
+   free(expected);
+   pgexporter_string_builder_destroy(sb);
+   MCTF_FINISH();
+}
+
+// Test parsing the refresh interval of a metric
+MCTF_TEST(test_parse_time)
+{
+   pgexporter_time_t time;
+
+   MCTF_ASSERT_INT_EQ(pgexporter_parse_time(NULL, &time), 0, cleanup, "empty interval should be accepted");
+   MCTF_ASSERT(!pgexporter_time_is_valid(time), cleanup, "empty interval should be disabled");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_parse_time("30", &time), 0, cleanup, "parse 30 failed");
+   MCTF_ASSERT_INT_EQ((int)pgexporter_time_convert(time, FORMAT_TIME_MS), 30000, cleanup, "30 should be seconds");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_parse_time("5m", &time), 0, cleanup, "parse 5m failed");
+   MCTF_ASSERT_INT_EQ((int)pgexporter_time_convert(time, FORMAT_TIME_MS), 300000, cleanup, "5m mismatch");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_parse_time("1h", &time), 0, cleanup, "parse 1h failed");
+   MCTF_ASSERT_INT_EQ((int)pgexporter_time_convert(time, FORMAT_TIME_MS), 3600000, cleanup, "1h mismatch");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_parse_time("500ms", &time), 0, cleanup, "parse 500ms failed");
+   MCTF_ASSERT_INT_EQ((int)pgexporter_time_convert(time, FORMAT_TIME_MS), 500, cleanup, "500ms mismatch");
+
+   MCTF_ASSERT_INT_EQ(pgexporter_parse_time("5x", &time), 1, cleanup, "unknown unit should fail");
+   MCTF_ASSERT_INT_EQ(pgexporter_parse_time("5mh", &time), 1, cleanup, "two units should fail");
+
+cleanup:
+   MCTF_FINISH();
+}
+
+// Test that an observation on a bucket bound counts in that bucket
+MCTF_TEST(test_latency_buckets)
+{
+   struct latency_histogram histogram;
+   unsigned long expected = 0;
+
+   memset(&histogram, 0, sizeof(struct latency_histogram));
+
+   for (int i = 0; i < NUMBER_OF_LATENCY_BUCKETS; i++)
+   {
+      MCTF_ASSERT(i == 0 || pgexporter_latency_bucket(i) > pgexporter_latency_bucket(i - 1), cleanup,
+                  "Bucket %d is not above the previous one", i);
+
+      pgexporter_latency_observe(&histogram, pgexporter_latency_bucket(i));
+      MCTF_ASSERT_INT_EQ((int)atomic_load(&histogram.buckets[i]), 1, cleanup, "The bound of bucket %d is not in it", i);
+
+      pgexporter_latency_observe(&histogram, pgexporter_latency_bucket(i) + 1);
+      MCTF_ASSERT_INT_EQ((int)atomic_load(&histogram.buckets[i + 1]), 1, cleanup, "Above the bound of bucket %d is not in the next", i);
+
+      expected += 2 * pgexporter_latency_bucket(i) + 1;
+
+      /* The next bound is counted again below */
+      atomic_store(&histogram.buckets[i + 1], 0);
+   }
+
+   /* A clock that went backwards counts as no time */
+   pgexporter_latency_observe(&histogram, -5);
+   MCTF_ASSERT_INT_EQ((int)atomic_load(&histogram.buckets[0]), 2, cleanup, "A negative duration is not in the first bucket");
+
+   pgexporter_latency_observe(&histogram, INT32_MAX);
+   MCTF_ASSERT_INT_EQ((int)atomic_load(&histogram.buckets[NUMBER_OF_LATENCY_BUCKETS]), 1, cleanup, "A long duration is not in the last bucket");
+
+   expected += INT32_MAX;
+   MCTF_ASSERT(atomic_load(&histogram.sum) == expected, cleanup, "The sum is %lu, expected %lu", atomic_load(&histogram.sum), expected);
+
+cleanup:
+   MCTF_FINISH();
+}